@@ -0,0 +1,637 @@
+/*
+ * wocky-bench.c - Microbenchmarks for Wocky's hot paths
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Each benchmark runs a fixed number of operations on a fixed corpus, once
+ * to warm up and then BENCH_REPEATS times; the median time is reported,
+ * along with the number of allocations per operation, as JSON so that
+ * results can be compared from one release to the next. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <wocky/wocky.h>
+
+#define BENCH_REPEATS 5
+
+/* Allocation counting. With glibc, the allocator can be wrapped by defining
+ * malloc and friends here: the library's calls resolve to these too. */
+#ifdef __GLIBC__
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static gint n_allocs = 0;
+
+void *
+malloc (size_t size)
+{
+  g_atomic_int_inc (&n_allocs);
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb,
+    size_t size)
+{
+  g_atomic_int_inc (&n_allocs);
+  return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr,
+    size_t size)
+{
+  g_atomic_int_inc (&n_allocs);
+  return __libc_realloc (ptr, size);
+}
+
+#define COUNTING_ALLOCS TRUE
+#define reset_allocs() g_atomic_int_set (&n_allocs, 0)
+#define get_allocs() g_atomic_int_get (&n_allocs)
+
+#else
+
+#define COUNTING_ALLOCS FALSE
+#define reset_allocs() G_STMT_START { } G_STMT_END
+#define get_allocs() 0
+
+#endif
+
+/* A realistic mix of stanzas, as a client sees them */
+#define STREAM_OPEN \
+  "<stream:stream xmlns='jabber:client'" \
+  " xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>"
+
+static const gchar * const corpus[] = {
+  /* chat message, with XHTML-IM, chat state and receipt request */
+  "<message from='romeo@example.net/orchard' to='juliet@example.com/balcony'"
+  " type='chat' id='ktx72v49'>"
+  "<body>Art thou not Romeo, and a Montague?</body>"
+  "<html xmlns='http://jabber.org/protocol/xhtml-im'>"
+  "<body xmlns='http://www.w3.org/1999/xhtml'><p style='font-weight:bold'>"
+  "Art thou not Romeo, and a Montague?</p></body></html>"
+  "<active xmlns='http://jabber.org/protocol/chatstates'/>"
+  "<request xmlns='urn:xmpp:receipts'/>"
+  "</message>",
+
+  /* presence, with entity capabilities */
+  "<presence from='romeo@example.net/orchard'>"
+  "<show>away</show><status>In the orchard</status><priority>5</priority>"
+  "<c xmlns='http://jabber.org/protocol/caps' hash='sha-1'"
+  " node='http://code.google.com/p/exodus'"
+  " ver='QgayPKawpkPSDYmwT/WM94uAlu0='/>"
+  "</presence>",
+
+  /* MUC presence */
+  "<presence from='coven@chat.shakespeare.lit/thirdwitch'"
+  " to='hag66@shakespeare.lit/pda' id='n13mt3l'>"
+  "<x xmlns='http://jabber.org/protocol/muc#user'>"
+  "<item affiliation='member' role='participant'"
+  " jid='hag66@shakespeare.lit/pda'/>"
+  "<status code='110'/>"
+  "</x>"
+  "</presence>",
+
+  /* roster push */
+  "<iq type='set' id='a78b4q6ha463'>"
+  "<query xmlns='jabber:iq:roster' ver='ver14'>"
+  "<item jid='nurse@example.com' name='Nurse' subscription='both'>"
+  "<group>Servants</group></item>"
+  "</query>"
+  "</iq>",
+
+  /* PEP notification */
+  "<message from='juliet@capulet.lit' to='romeo@montague.lit/home'"
+  " type='headline' id='tunefoo1'>"
+  "<event xmlns='http://jabber.org/protocol/pubsub#event'>"
+  "<items node='http://jabber.org/protocol/tune'>"
+  "<item id='bffe6584-0f9c-11dc-84ba-001143d5d5db'>"
+  "<tune xmlns='http://jabber.org/protocol/tune'>"
+  "<artist>Yes</artist><length>686</length><rating>8</rating>"
+  "<source>Yessongs</source><title>Heart of the Sunrise</title>"
+  "<track>3</track><uri>http://www.yesworld.com/lyrics/Fragile.html#9</uri>"
+  "</tune></item></items></event>"
+  "</message>",
+};
+
+#define CORPUS_SIZE G_N_ELEMENTS (corpus)
+
+/* a disco#info reply such as entity capabilities are computed from */
+#define DISCO_INFO \
+  "<iq from='benvolio@capulet.lit/230193' id='disco1'" \
+  " to='juliet@capulet.lit/chamber' type='result'>" \
+  "<query xmlns='http://jabber.org/protocol/disco#info'" \
+  " node='http://psi-im.org#q07IKJEyjvHSyhy//CH0CxmKi8w='>" \
+  "<identity xml:lang='en' category='client' name='Psi 0.11' type='pc'/>" \
+  "<identity xml:lang='el' category='client' name='Ψ 0.11' type='pc'/>" \
+  "<feature var='http://jabber.org/protocol/caps'/>" \
+  "<feature var='http://jabber.org/protocol/disco#info'/>" \
+  "<feature var='http://jabber.org/protocol/disco#items'/>" \
+  "<feature var='http://jabber.org/protocol/muc'/>" \
+  "<feature var='http://jabber.org/protocol/chatstates'/>" \
+  "<feature var='http://jabber.org/protocol/xhtml-im'/>" \
+  "<feature var='http://jabber.org/protocol/tune+notify'/>" \
+  "<feature var='http://jabber.org/protocol/nick+notify'/>" \
+  "<feature var='urn:xmpp:receipts'/>" \
+  "<feature var='urn:xmpp:ping'/>" \
+  "<feature var='urn:xmpp:time'/>" \
+  "<feature var='urn:xmpp:jingle:1'/>" \
+  "<feature var='urn:xmpp:jingle:apps:rtp:1'/>" \
+  "<feature var='urn:xmpp:jingle:apps:rtp:audio'/>" \
+  "<feature var='urn:xmpp:jingle:transports:ice-udp:1'/>" \
+  "<feature var='jabber:iq:version'/>" \
+  "<x xmlns='jabber:x:data' type='result'>" \
+  "<field var='FORM_TYPE' type='hidden'>" \
+  "<value>urn:xmpp:dataforms:softwareinfo</value></field>" \
+  "<field var='ip_version'><value>ipv4</value><value>ipv6</value></field>" \
+  "<field var='os'><value>Mac</value></field>" \
+  "<field var='os_version'><value>10.5.1</value></field>" \
+  "<field var='software'><value>Psi</value></field>" \
+  "<field var='software_version'><value>0.11</value></field>" \
+  "</x>" \
+  "</query>" \
+  "</iq>"
+
+typedef struct {
+  GString *json;
+  const gchar *filter;
+  gdouble scale;
+  guint n_results;
+} Bench;
+
+typedef void (*BenchFunc) (gpointer data,
+    guint ops);
+
+static gint
+compare_doubles (gconstpointer a,
+    gconstpointer b)
+{
+  gdouble x = *(const gdouble *) a;
+  gdouble y = *(const gdouble *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+run (Bench *bench,
+    const gchar *name,
+    BenchFunc func,
+    gpointer data,
+    guint ops)
+{
+  gdouble times[BENCH_REPEATS];
+  gint allocs = G_MAXINT;
+  gdouble ns_per_op;
+  GTimer *timer;
+  guint i;
+
+  if (bench->filter != NULL && strstr (name, bench->filter) == NULL)
+    return;
+
+  ops = MAX (1, ops * bench->scale);
+
+  /* warm up caches, interned strings and buffer pools */
+  func (data, MAX (1, ops / 10));
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < BENCH_REPEATS; i++)
+    {
+      reset_allocs ();
+      g_timer_start (timer);
+      func (data, ops);
+      times[i] = g_timer_elapsed (timer, NULL);
+      allocs = MIN (allocs, get_allocs ());
+    }
+
+  g_timer_destroy (timer);
+
+  qsort (times, BENCH_REPEATS, sizeof (gdouble), compare_doubles);
+  ns_per_op = times[BENCH_REPEATS / 2] * 1e9 / ops;
+
+  g_string_append_printf (bench->json,
+      "%s\n    {\"name\": \"%s\", \"ops\": %u, \"repeats\": %u, "
+      "\"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, ",
+      bench->n_results > 0 ? "," : "", name, ops, BENCH_REPEATS, ns_per_op,
+      1e9 / ns_per_op);
+
+  if (COUNTING_ALLOCS)
+    g_string_append_printf (bench->json, "\"allocs_per_op\": %.2f}",
+        (gdouble) allocs / ops);
+  else
+    g_string_append (bench->json, "\"allocs_per_op\": null}");
+
+  bench->n_results++;
+  g_printerr ("%-40s %12.1f ns/op\n", name, ns_per_op);
+}
+
+static WockyStanza *
+parse (WockyXmppReader *reader,
+    const gchar *xml)
+{
+  WockyStanza *stanza;
+
+  wocky_xmpp_reader_push (reader, (const guint8 *) xml, strlen (xml));
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+
+  return stanza;
+}
+
+/* wocky_xmpp_reader_push() and wocky_xmpp_reader_pop_stanza() */
+static void
+bench_reader (gpointer data,
+    guint ops)
+{
+  WockyXmppReader *reader = data;
+  guint i;
+
+  for (i = 0; i < ops; i++)
+    g_object_unref (parse (reader, corpus[i % CORPUS_SIZE]));
+}
+
+/* wocky_xmpp_writer_write_stanza() */
+typedef struct {
+  WockyXmppWriter *writer;
+  WockyStanza *stanzas[CORPUS_SIZE];
+} WriterBench;
+
+static void
+bench_writer (gpointer data,
+    guint ops)
+{
+  WriterBench *wb = data;
+  const guint8 *out;
+  gsize length;
+  guint i;
+
+  for (i = 0; i < ops; i++)
+    wocky_xmpp_writer_write_stanza (wb->writer, wb->stanzas[i % CORPUS_SIZE],
+        &out, &length);
+}
+
+/* WockyNode lookups, on the chat message */
+static void
+bench_get_child_ns (gpointer data,
+    guint ops)
+{
+  WockyNode *top = wocky_stanza_get_top_node (data);
+  guint i;
+
+  for (i = 0; i < ops; i++)
+    {
+      /* the last child, so that all of them are looked at */
+      WockyNode *child = wocky_node_get_child_ns (top, "request",
+          "urn:xmpp:receipts");
+
+      g_assert (child != NULL);
+    }
+}
+
+static void
+bench_get_attribute_ns (gpointer data,
+    guint ops)
+{
+  WockyNode *top = wocky_stanza_get_top_node (data);
+  guint i;
+
+  for (i = 0; i < ops; i++)
+    {
+      const gchar *id = wocky_node_get_attribute_ns (top, "id", NULL);
+
+      g_assert (id != NULL);
+    }
+}
+
+/* wocky_node_is_superset(), as when matching porter handlers */
+typedef struct {
+  WockyStanza *stanza;
+  WockyStanza *pattern;
+} SupersetBench;
+
+static void
+bench_is_superset (gpointer data,
+    guint ops)
+{
+  SupersetBench *sb = data;
+  guint i;
+
+  for (i = 0; i < ops; i++)
+    {
+      gboolean ret = wocky_node_is_superset (
+          wocky_stanza_get_top_node (sb->stanza),
+          wocky_stanza_get_top_node (sb->pattern));
+
+      g_assert (ret);
+    }
+}
+
+/* wocky_caps_hash_compute_from_node() */
+static void
+bench_caps_hash (gpointer data,
+    guint ops)
+{
+  WockyNode *query = wocky_node_get_first_child (
+      wocky_stanza_get_top_node (data));
+  guint i;
+
+  for (i = 0; i < ops; i++)
+    g_free (wocky_caps_hash_compute_from_node (query));
+}
+
+/* Porter dispatch: messages sent round a loopback stream, so each of them
+ * is serialized, parsed and then dispatched past n_handlers - 1 handlers
+ * which don't match it to one which does. */
+typedef struct {
+  GMainLoop *loop;
+  WockyXmppConnection *connection;
+  WockyPorter *porter;
+  WockyStanza *stanza;
+  guint received;
+  guint expected;
+} PorterBench;
+
+static gboolean
+porter_bench_received_cb (WockyPorter *porter,
+    WockyStanza *stanza,
+    gpointer user_data)
+{
+  PorterBench *pb = user_data;
+
+  if (++pb->received == pb->expected)
+    g_main_loop_quit (pb->loop);
+
+  return TRUE;
+}
+
+static gboolean
+porter_bench_unexpected_cb (WockyPorter *porter,
+    WockyStanza *stanza,
+    gpointer user_data)
+{
+  g_assert_not_reached ();
+  return FALSE;
+}
+
+static void
+porter_bench_recv_open_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  PorterBench *pb = user_data;
+
+  if (!wocky_xmpp_connection_recv_open_finish (
+          WOCKY_XMPP_CONNECTION (source), result,
+          NULL, NULL, NULL, NULL, NULL, NULL))
+    g_assert_not_reached ();
+
+  g_main_loop_quit (pb->loop);
+}
+
+static void
+porter_bench_send_open_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  if (!wocky_xmpp_connection_send_open_finish (
+          WOCKY_XMPP_CONNECTION (source), result, NULL))
+    g_assert_not_reached ();
+
+  wocky_xmpp_connection_recv_open_async (WOCKY_XMPP_CONNECTION (source),
+      NULL, porter_bench_recv_open_cb, user_data);
+}
+
+static void
+porter_bench_closed_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  PorterBench *pb = user_data;
+
+  wocky_porter_close_finish (WOCKY_PORTER (source), result, NULL);
+  g_main_loop_quit (pb->loop);
+}
+
+static void
+porter_bench_setup (PorterBench *pb,
+    guint n_handlers)
+{
+  GIOStream *stream = wocky_loopback_stream_new ();
+  guint i;
+
+  pb->loop = g_main_loop_new (NULL, FALSE);
+  pb->connection = wocky_xmpp_connection_new (stream);
+  g_object_unref (stream);
+
+  wocky_xmpp_connection_send_open_async (pb->connection, NULL, NULL, NULL,
+      NULL, NULL, NULL, porter_bench_send_open_cb, pb);
+  g_main_loop_run (pb->loop);
+
+  pb->porter = wocky_c2s_porter_new (pb->connection,
+      "juliet@example.com/balcony");
+
+  for (i = 1; i < n_handlers; i++)
+    {
+      gchar *ns = g_strdup_printf ("urn:wocky:bench:%u", i);
+
+      wocky_porter_register_handler_from_anyone (pb->porter,
+          WOCKY_STANZA_TYPE_MESSAGE, WOCKY_STANZA_SUB_TYPE_NONE,
+          WOCKY_PORTER_HANDLER_PRIORITY_NORMAL,
+          porter_bench_unexpected_cb, pb,
+          '(', "x", ':', ns, ')',
+          NULL);
+      g_free (ns);
+    }
+
+  wocky_porter_register_handler_from_anyone (pb->porter,
+      WOCKY_STANZA_TYPE_MESSAGE, WOCKY_STANZA_SUB_TYPE_NONE,
+      WOCKY_PORTER_HANDLER_PRIORITY_MIN,
+      porter_bench_received_cb, pb, NULL);
+
+  wocky_porter_start (pb->porter);
+
+  pb->stanza = wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+      WOCKY_STANZA_SUB_TYPE_CHAT, NULL, "juliet@example.com/balcony",
+        '(', "body", '$', "Art thou not Romeo, and a Montague?", ')',
+      NULL);
+}
+
+static void
+porter_bench_teardown (PorterBench *pb)
+{
+  wocky_porter_close_async (pb->porter, NULL, porter_bench_closed_cb, pb);
+  g_main_loop_run (pb->loop);
+
+  g_object_unref (pb->stanza);
+  g_object_unref (pb->porter);
+  g_object_unref (pb->connection);
+  g_main_loop_unref (pb->loop);
+}
+
+static void
+bench_porter_dispatch (gpointer data,
+    guint ops)
+{
+  PorterBench *pb = data;
+  guint i;
+
+  pb->received = 0;
+  pb->expected = ops;
+
+  for (i = 0; i < ops; i++)
+    wocky_porter_send (pb->porter, pb->stanza);
+
+  g_main_loop_run (pb->loop);
+}
+
+static void
+run_all (Bench *bench)
+{
+  static const guint porter_handlers[] = { 1, 10, 100 };
+  WockyXmppReader *reader = wocky_xmpp_reader_new ();
+  WriterBench wb;
+  SupersetBench sb;
+  WockyStanza *message, *disco;
+  const guint8 *out;
+  gsize length;
+  guint i;
+
+  wocky_xmpp_reader_push (reader, (const guint8 *) STREAM_OPEN,
+      strlen (STREAM_OPEN));
+  run (bench, "xmpp-reader/push-pop", bench_reader, reader, 200000);
+
+  /* a writer as a connection has it, with the stream already open */
+  wb.writer = wocky_xmpp_writer_new ();
+  wocky_xmpp_writer_stream_open (wb.writer, NULL, NULL, "1.0", NULL, NULL,
+      &out, &length);
+
+  for (i = 0; i < CORPUS_SIZE; i++)
+    wb.stanzas[i] = parse (reader, corpus[i]);
+
+  run (bench, "xmpp-writer/write-stanza", bench_writer, &wb, 200000);
+
+  message = g_object_ref (wb.stanzas[0]);
+  run (bench, "node/get-child-ns", bench_get_child_ns, message, 5000000);
+  run (bench, "node/get-attribute-ns", bench_get_attribute_ns, message,
+      5000000);
+
+  sb.stanza = message;
+  sb.pattern = wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+      WOCKY_STANZA_SUB_TYPE_CHAT, NULL, NULL,
+        '(', "request", ':', "urn:xmpp:receipts", ')',
+      NULL);
+  run (bench, "node/is-superset", bench_is_superset, &sb, 2000000);
+
+  disco = parse (reader, DISCO_INFO);
+  run (bench, "caps-hash/compute-from-node", bench_caps_hash, disco, 100000);
+
+  for (i = 0; i < G_N_ELEMENTS (porter_handlers); i++)
+    {
+      PorterBench pb = { NULL, };
+      gchar *name = g_strdup_printf ("porter/dispatch-%u-handlers",
+          porter_handlers[i]);
+
+      porter_bench_setup (&pb, porter_handlers[i]);
+      run (bench, name, bench_porter_dispatch, &pb, 50000);
+      porter_bench_teardown (&pb);
+      g_free (name);
+    }
+
+  for (i = 0; i < CORPUS_SIZE; i++)
+    g_object_unref (wb.stanzas[i]);
+
+  g_object_unref (sb.pattern);
+  g_object_unref (message);
+  g_object_unref (disco);
+  g_object_unref (wb.writer);
+  g_object_unref (reader);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  Bench bench = { NULL, NULL, 1.0, 0 };
+  gchar *filter = NULL, *output = NULL;
+  GError *error = NULL;
+  GOptionContext *context;
+  GOptionEntry entries[] = {
+    { "filter", 'f', 0, G_OPTION_ARG_STRING, &filter,
+      "Only run benchmarks whose name contains SUBSTRING", "SUBSTRING" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+      "Write the results to FILE rather than standard output", "FILE" },
+    { "scale", 's', 0, G_OPTION_ARG_DOUBLE, &bench.scale,
+      "Multiply the number of operations by FACTOR", "FACTOR" },
+    { NULL }
+  };
+
+  /* count GSlice allocations too, whichever GLib this is */
+  g_setenv ("G_SLICE", "always-malloc", TRUE);
+
+  context = g_option_context_new ("- run Wocky's microbenchmarks");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      g_option_context_free (context);
+      return 2;
+    }
+
+  g_option_context_free (context);
+
+  wocky_init ();
+
+  bench.filter = filter;
+  bench.json = g_string_new (NULL);
+  g_string_append_printf (bench.json,
+      "{\n  \"glib_version\": \"%u.%u.%u\",\n  \"benchmarks\": [",
+      glib_major_version, glib_minor_version, glib_micro_version);
+
+  run_all (&bench);
+
+  g_string_append (bench.json, "\n  ]\n}\n");
+
+  if (output == NULL)
+    {
+      fputs (bench.json->str, stdout);
+    }
+  else if (!g_file_set_contents (output, bench.json->str, bench.json->len,
+          &error))
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_string_free (bench.json, TRUE);
+  g_free (filter);
+  g_free (output);
+  wocky_deinit ();
+
+  return 0;
+}
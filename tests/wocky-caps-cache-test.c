@@ -0,0 +1,661 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <wocky/wocky.h>
+
+#include "wocky-test-helper.h"
+
+/* The default size of the in-memory part of the cache */
+#define MEMORY_SIZE 100
+
+typedef struct {
+  gchar *dir;
+  gchar *path;
+  gboolean mmap;
+} Fixture;
+
+static void
+setup (Fixture *f,
+    gconstpointer data)
+{
+  f->mmap = !g_strcmp0 (data, "mmap");
+  f->dir = g_dir_make_tmp ("wocky-caps-cache-XXXXXX", NULL);
+  g_assert (f->dir != NULL);
+  f->path = g_build_filename (f->dir, "caps-cache.db", NULL);
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer data)
+{
+  gchar *wal = g_strconcat (f->path, "-wal", NULL);
+  gchar *shm = g_strconcat (f->path, "-shm", NULL);
+
+  g_unlink (f->path);
+  g_unlink (wal);
+  g_unlink (shm);
+  g_rmdir (f->dir);
+  g_free (wal);
+  g_free (shm);
+  g_free (f->path);
+  g_free (f->dir);
+}
+
+static WockyCapsCacheBackend *
+new_backend (Fixture *f)
+{
+  if (f->mmap)
+    return WOCKY_CAPS_CACHE_BACKEND (wocky_caps_cache_mmap_new (f->path));
+  else
+    return WOCKY_CAPS_CACHE_BACKEND (wocky_caps_cache_sqlite_new (f->path));
+}
+
+static WockyCapsCache *
+new_cache (Fixture *f,
+    guint memory_size)
+{
+  WockyCapsCacheBackend *backend = new_backend (f);
+  WockyCapsCache *cache = g_object_new (WOCKY_TYPE_CAPS_CACHE,
+      "backend", backend,
+      "memory-size", memory_size,
+      NULL);
+
+  g_object_unref (backend);
+  return cache;
+}
+
+static WockyNodeTree *
+make_query (guint i)
+{
+  gchar *name = g_strdup_printf ("Client %u", i);
+  gchar *feature = g_strdup_printf ("urn:example:feature:%u", i);
+  WockyNodeTree *tree;
+
+  tree = wocky_node_tree_new ("query", WOCKY_NS_DISCO_INFO,
+      '(', "identity",
+        '@', "category", "client",
+        '@', "type", "pc",
+        '@', "name", name,
+      ')',
+      '(', "feature", '@', "var", WOCKY_NS_DISCO_INFO, ')',
+      '(', "feature", '@', "var", WOCKY_XMPP_NS_PING, ')',
+      '(', "feature", '@', "var", feature, ')',
+      NULL);
+
+  g_free (name);
+  g_free (feature);
+  return tree;
+}
+
+static gchar *
+make_node (guint i)
+{
+  return g_strdup_printf ("http://example.com/client#%u", i);
+}
+
+static void
+insert_queries (WockyCapsCache *cache,
+    guint n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    {
+      gchar *node = make_node (i);
+      WockyNodeTree *tree = make_query (i);
+
+      wocky_caps_cache_insert (cache, node, tree);
+
+      g_object_unref (tree);
+      g_free (node);
+    }
+}
+
+static void
+assert_stats (WockyCapsCache *cache,
+    guint memory_hits,
+    guint disk_hits,
+    guint misses)
+{
+  guint m, d, x;
+
+  wocky_caps_cache_get_stats (cache, &m, &d, &x);
+  g_assert_cmpuint (m, ==, memory_hits);
+  g_assert_cmpuint (d, ==, disk_hits);
+  g_assert_cmpuint (x, ==, misses);
+}
+
+static void
+test_memory_hit (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCache *cache = new_cache (f, MEMORY_SIZE);
+  WockyNodeTree *expected = make_query (0);
+  WockyNodeTree *first, *second;
+  gchar *node = make_node (0);
+
+  g_assert (wocky_caps_cache_lookup (cache, node) == NULL);
+  assert_stats (cache, 0, 0, 1);
+
+  insert_queries (cache, 1);
+
+  first = wocky_caps_cache_lookup (cache, node);
+  g_assert (first != NULL);
+  test_assert_nodes_equal (wocky_node_tree_get_top_node (first),
+      wocky_node_tree_get_top_node (expected));
+  assert_stats (cache, 0, 1, 1);
+
+  /* callers get their own copy, which they may change... */
+  second = wocky_caps_cache_lookup (cache, node);
+  g_assert (second != first);
+  g_assert (!wocky_node_is_sealed (wocky_node_tree_get_top_node (second)));
+  assert_stats (cache, 1, 1, 1);
+  wocky_node_set_attribute (
+      wocky_node_get_first_child (wocky_node_tree_get_top_node (second)),
+      "name", "Changed");
+  g_object_unref (second);
+
+  /* ...without changing what's cached */
+  second = wocky_caps_cache_lookup (cache, node);
+  test_assert_nodes_equal (wocky_node_tree_get_top_node (second),
+      wocky_node_tree_get_top_node (expected));
+  assert_stats (cache, 2, 1, 1);
+  g_object_unref (second);
+  g_object_unref (first);
+
+  /* the parsed tree is shared rather than parsed again */
+  first = wocky_caps_cache_lookup_sealed (cache, node);
+  second = wocky_caps_cache_lookup_sealed (cache, node);
+  g_assert (second == first);
+  g_assert (wocky_node_is_sealed (wocky_node_tree_get_top_node (first)));
+  test_assert_nodes_equal (wocky_node_tree_get_top_node (first),
+      wocky_node_tree_get_top_node (expected));
+  assert_stats (cache, 4, 1, 1);
+
+  g_object_unref (first);
+  g_object_unref (second);
+  g_object_unref (expected);
+  g_object_unref (cache);
+
+  /* entries touched in memory are still on disk next time */
+  cache = new_cache (f, MEMORY_SIZE);
+  first = wocky_caps_cache_lookup (cache, node);
+  g_assert (first != NULL);
+  assert_stats (cache, 0, 1, 0);
+
+  g_object_unref (first);
+  g_object_unref (cache);
+  g_free (node);
+}
+
+static void
+test_eviction (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCache *cache = new_cache (f, 2);
+  guint i;
+
+  insert_queries (cache, 3);
+
+  /* 0, 1, 2 from disk; only 1 and 2 stay in memory */
+  for (i = 0; i < 3; i++)
+    {
+      gchar *node = make_node (i);
+      WockyNodeTree *tree = wocky_caps_cache_lookup (cache, node);
+
+      g_assert (tree != NULL);
+      g_object_unref (tree);
+      g_free (node);
+    }
+
+  assert_stats (cache, 0, 3, 0);
+
+  /* 2 and 1 are in memory, 0 was evicted and comes from disk again */
+  for (i = 3; i > 0; i--)
+    {
+      gchar *node = make_node (i - 1);
+      WockyNodeTree *tree = wocky_caps_cache_lookup (cache, node);
+
+      g_assert (tree != NULL);
+      g_object_unref (tree);
+      g_free (node);
+    }
+
+  assert_stats (cache, 2, 4, 0);
+
+  g_object_unref (cache);
+}
+
+static void
+test_insert_refreshes (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCache *cache = new_cache (f, 2);
+  WockyNodeTree *tree, *replacement;
+  gchar *nodes[3];
+  guint i;
+
+  insert_queries (cache, 3);
+
+  for (i = 0; i < 3; i++)
+    nodes[i] = make_node (i);
+
+  /* 1 is the most recently used, then 0 */
+  for (i = 0; i < 2; i++)
+    {
+      tree = wocky_caps_cache_lookup_sealed (cache, nodes[i]);
+      g_object_unref (tree);
+    }
+
+  /* inserting 0 again makes it the most recently used, with the new tree */
+  replacement = make_query (100);
+  wocky_caps_cache_insert (cache, nodes[0], replacement);
+
+  /* so it's 1 which makes way for 2 */
+  tree = wocky_caps_cache_lookup_sealed (cache, nodes[2]);
+  g_object_unref (tree);
+  assert_stats (cache, 0, 3, 0);
+
+  tree = wocky_caps_cache_lookup_sealed (cache, nodes[0]);
+  test_assert_nodes_equal (wocky_node_tree_get_top_node (tree),
+      wocky_node_tree_get_top_node (replacement));
+  g_object_unref (tree);
+  assert_stats (cache, 1, 3, 0);
+
+  tree = wocky_caps_cache_lookup_sealed (cache, nodes[1]);
+  g_object_unref (tree);
+  assert_stats (cache, 1, 4, 0);
+
+  for (i = 0; i < 3; i++)
+    g_free (nodes[i]);
+
+  g_object_unref (replacement);
+  g_object_unref (cache);
+}
+
+static void
+test_memory_disabled (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCache *cache = new_cache (f, 0);
+  WockyNodeTree *first, *second;
+  gchar *node = make_node (0);
+
+  insert_queries (cache, 1);
+
+  first = wocky_caps_cache_lookup (cache, node);
+  second = wocky_caps_cache_lookup (cache, node);
+  g_assert (first != NULL);
+  g_assert (second != NULL);
+  g_assert (first != second);
+  assert_stats (cache, 0, 2, 0);
+
+  g_object_unref (first);
+  g_object_unref (second);
+  g_object_unref (cache);
+  g_free (node);
+}
+
+/* The default size of the cache, when WOCKY_CAPS_CACHE_SIZE isn't set */
+#define DEFAULT_SIZE 1000
+
+static void
+test_gc (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCache *cache = new_cache (f, MEMORY_SIZE);
+  WockyNodeTree *tree;
+  gchar *node;
+
+  insert_queries (cache, DEFAULT_SIZE + 100);
+
+  /* the oldest entries made way for the newest */
+  node = make_node (0);
+  g_assert (wocky_caps_cache_lookup (cache, node) == NULL);
+  g_free (node);
+
+  node = make_node (DEFAULT_SIZE + 99);
+  tree = wocky_caps_cache_lookup (cache, node);
+  g_assert (tree != NULL);
+  g_object_unref (tree);
+  g_free (node);
+
+  g_object_unref (cache);
+}
+
+/* Two processes sharing a database, each with changes waiting to be
+ * written out: neither locks the other out for longer than its own writes
+ * take, so both sets of changes make it. */
+static void
+test_sqlite_shared (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCache *first = new_cache (f, 0);
+  WockyCapsCache *second = new_cache (f, 0);
+  WockyNodeTree *tree;
+  guint i;
+
+  for (i = 0; i < 4; i++)
+    {
+      gchar *node = make_node (i);
+
+      tree = make_query (i);
+      wocky_caps_cache_insert ((i % 2) ? second : first, node, tree);
+      g_object_unref (tree);
+
+      /* pending changes are seen by the process which made them */
+      tree = wocky_caps_cache_lookup ((i % 2) ? second : first, node);
+      g_assert (tree != NULL);
+      g_object_unref (tree);
+      g_free (node);
+    }
+
+  /* both write out their changes when they go away */
+  g_object_unref (first);
+  g_object_unref (second);
+
+  first = new_cache (f, 0);
+
+  for (i = 0; i < 4; i++)
+    {
+      gchar *node = make_node (i);
+
+      tree = wocky_caps_cache_lookup (first, node);
+      g_assert (tree != NULL);
+      g_object_unref (tree);
+      g_free (node);
+    }
+
+  g_object_unref (first);
+}
+
+/* A roster's worth of contacts coming online, most of them sharing a handful
+ * of clients. */
+#define PERF_CONTACTS 5000
+#define PERF_CLIENTS 20
+
+static void
+roster_login_perf (Fixture *f,
+    guint memory_size)
+{
+  WockyCapsCache *cache = new_cache (f, memory_size);
+  gchar *nodes[PERF_CLIENTS];
+  gdouble elapsed;
+  guint i;
+
+  insert_queries (cache, PERF_CLIENTS);
+
+  for (i = 0; i < PERF_CLIENTS; i++)
+    nodes[i] = make_node (i);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_CONTACTS; i++)
+    {
+      WockyNodeTree *tree = wocky_caps_cache_lookup (cache,
+          nodes[i % PERF_CLIENTS]);
+
+      g_assert (tree != NULL);
+      g_object_unref (tree);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1e6 / PERF_CONTACTS,
+      "%s, memory-size %u: %.2f us per lookup",
+      f->mmap ? "mmap" : "sqlite", memory_size,
+      elapsed * 1e6 / PERF_CONTACTS);
+
+  for (i = 0; i < PERF_CLIENTS; i++)
+    g_free (nodes[i]);
+
+  g_object_unref (cache);
+}
+
+static void
+test_roster_login_perf_disk (Fixture *f,
+    gconstpointer data)
+{
+  roster_login_perf (f, 0);
+}
+
+static void
+test_roster_login_perf_memory (Fixture *f,
+    gconstpointer data)
+{
+  roster_login_perf (f, PERF_CLIENTS);
+}
+
+static void
+test_insert_perf (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCache *cache = new_cache (f, MEMORY_SIZE);
+  gdouble elapsed;
+
+  /* enough to make the cache collect garbage a few times */
+  g_test_timer_start ();
+  insert_queries (cache, 2 * DEFAULT_SIZE);
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_minimized_result (elapsed * 1e6 / (2 * DEFAULT_SIZE),
+      "%s: %.2f us per insert", f->mmap ? "mmap" : "sqlite",
+      elapsed * 1e6 / (2 * DEFAULT_SIZE));
+
+  g_object_unref (cache);
+}
+
+static gchar *
+lookup_reply (WockyCapsCacheBackend *backend,
+    guint i)
+{
+  gchar *node = make_node (i);
+  GBytes *reply = wocky_caps_cache_backend_lookup (backend, node);
+  gchar *name = NULL;
+
+  if (reply != NULL)
+    {
+      WockyNodeTree *tree = wocky_node_tree_new_from_bytes (reply);
+      WockyNode *identity;
+
+      g_assert (tree != NULL);
+      identity = wocky_node_get_child (wocky_node_tree_get_top_node (tree),
+          "identity");
+      name = g_strdup (wocky_node_get_attribute (identity, "name"));
+      g_object_unref (tree);
+      g_bytes_unref (reply);
+    }
+
+  g_free (node);
+  return name;
+}
+
+static void
+insert_replies (WockyCapsCacheBackend *backend,
+    guint n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    {
+      gchar *node = make_node (i);
+      WockyNodeTree *tree = make_query (i);
+      GBytes *reply = wocky_node_tree_to_bytes (tree);
+
+      wocky_caps_cache_backend_insert (backend, node, reply);
+
+      g_bytes_unref (reply);
+      g_object_unref (tree);
+      g_free (node);
+    }
+}
+
+static void
+assert_has_reply (WockyCapsCacheBackend *backend,
+    guint i,
+    gboolean present)
+{
+  gchar *name = lookup_reply (backend, i);
+
+  if (present)
+    {
+      gchar *expected = g_strdup_printf ("Client %u", i);
+
+      g_assert_cmpstr (name, ==, expected);
+      g_free (expected);
+    }
+  else
+    {
+      g_assert_cmpstr (name, ==, NULL);
+    }
+
+  g_free (name);
+}
+
+static void
+test_mmap_shared (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCacheBackend *a = new_backend (f);
+  WockyCapsCacheBackend *b = new_backend (f);
+
+  /* what one writes, the other can read straight away */
+  insert_replies (a, 10);
+  assert_has_reply (b, 0, TRUE);
+  assert_has_reply (b, 9, TRUE);
+  assert_has_reply (b, 10, FALSE);
+
+  /* and an entry which is already there isn't added again */
+  insert_replies (b, 11);
+  assert_has_reply (a, 10, TRUE);
+
+  g_object_unref (a);
+  g_object_unref (b);
+}
+
+static void
+test_mmap_compaction (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCacheBackend *a = new_backend (f);
+  WockyCapsCacheBackend *b = new_backend (f);
+  guint i;
+
+  insert_replies (a, 10);
+  assert_has_reply (b, 0, TRUE);
+
+  /* b notices a has replaced the file and follows it */
+  wocky_caps_cache_backend_shrink (a, 5, 3);
+
+  for (i = 0; i < 7; i++)
+    assert_has_reply (b, i, FALSE);
+
+  for (i = 7; i < 10; i++)
+    assert_has_reply (b, i, TRUE);
+
+  /* enough to outgrow the initial file several times over */
+  insert_replies (b, 10000);
+  assert_has_reply (a, 0, TRUE);
+  assert_has_reply (a, 9999, TRUE);
+
+  g_object_unref (a);
+  g_object_unref (b);
+}
+
+static void
+test_mmap_damaged (Fixture *f,
+    gconstpointer data)
+{
+  WockyCapsCacheBackend *backend = new_backend (f);
+  gchar *contents;
+  gsize len, i;
+  gchar *node = make_node (0);
+  gsize node_len = strlen (node);
+  gboolean found = FALSE;
+
+  insert_replies (backend, 2);
+  g_object_unref (backend);
+
+  /* Damage the first record, as if we'd crashed while writing it */
+  g_assert (g_file_get_contents (f->path, &contents, &len, NULL));
+
+  for (i = 0; i + node_len <= len && !found; i++)
+    {
+      if (!memcmp (contents + i, node, node_len))
+        {
+          contents[i] ^= 1;
+          found = TRUE;
+        }
+    }
+
+  g_assert (found);
+  g_assert (g_file_set_contents (f->path, contents, len, NULL));
+
+  backend = new_backend (f);
+  assert_has_reply (backend, 0, FALSE);
+  assert_has_reply (backend, 1, TRUE);
+
+  /* and it's not in the way of the entry being added again */
+  insert_replies (backend, 1);
+  assert_has_reply (backend, 0, TRUE);
+
+  g_object_unref (backend);
+  g_free (contents);
+  g_free (node);
+}
+
+static void
+add_test (const gchar *backend,
+    const gchar *name,
+    void (*test) (Fixture *, gconstpointer))
+{
+  gchar *path = g_strdup_printf ("/caps-cache/%s/%s", backend, name);
+
+  g_test_add (path, Fixture, backend, setup, test, teardown);
+  g_free (path);
+}
+
+int
+main (int argc, char **argv)
+{
+  const gchar * const backends[] = { "sqlite", "mmap" };
+  guint i;
+  int result;
+
+  /* test_gc relies on the default size */
+  g_unsetenv ("WOCKY_CAPS_CACHE_SIZE");
+
+  test_init (argc, argv);
+
+  for (i = 0; i < G_N_ELEMENTS (backends); i++)
+    {
+      add_test (backends[i], "memory-hit", test_memory_hit);
+      add_test (backends[i], "eviction", test_eviction);
+      add_test (backends[i], "insert-refreshes", test_insert_refreshes);
+      add_test (backends[i], "memory-disabled", test_memory_disabled);
+      add_test (backends[i], "gc", test_gc);
+
+      if (g_test_perf ())
+        {
+          add_test (backends[i], "roster-login-perf/disk",
+              test_roster_login_perf_disk);
+          add_test (backends[i], "roster-login-perf/memory",
+              test_roster_login_perf_memory);
+          add_test (backends[i], "insert-perf", test_insert_perf);
+        }
+    }
+
+  add_test ("sqlite", "shared", test_sqlite_shared);
+  add_test ("mmap", "shared", test_mmap_shared);
+  add_test ("mmap", "compaction", test_mmap_compaction);
+  add_test ("mmap", "damaged", test_mmap_damaged);
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
@@ -805,6 +805,273 @@ test_dataforms_boolean_values (void)
   g_free (two);
 }
 
+static WockyStanza *
+build_complex_stanza (const gchar *os)
+{
+  /* Complex example from XEP-0115, with a choice of OS */
+  return wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+      WOCKY_STANZA_SUB_TYPE_RESULT, NULL, NULL,
+      '(', "identity",
+        '@', "category", "client",
+        '@', "name", "Psi 0.11",
+        '@', "type", "pc",
+        '#', "en",
+      ')',
+      '(', "identity",
+        '@', "category", "client",
+        '@', "name", "Ψ 0.11",
+        '@', "type", "pc",
+        '#', "el",
+      ')',
+      '(', "feature", '@', "var", "http://jabber.org/protocol/disco#info", ')',
+      '(', "feature", '@', "var", "http://jabber.org/protocol/disco#items", ')',
+      '(', "feature", '@', "var", "http://jabber.org/protocol/muc", ')',
+      '(', "feature", '@', "var", "http://jabber.org/protocol/caps", ')',
+      '(', "x",
+        ':', "jabber:x:data",
+        '@', "type", "result",
+        '(', "field",
+          '@', "var", "FORM_TYPE",
+          '@', "type", "hidden",
+          '(', "value", '$', "urn:xmpp:dataforms:softwareinfo", ')',
+        ')',
+        '(', "field",
+          '@', "var", "ip_version",
+          '(', "value", '$', "ipv4", ')',
+          '(', "value", '$', "ipv6", ')',
+        ')',
+        '(', "field",
+          '@', "var", "os",
+          '(', "value", '$', os, ')',
+        ')',
+        '(', "field",
+          '@', "var", "os_version",
+          '(', "value", '$', "10.5.1", ')',
+        ')',
+        '(', "field",
+          '@', "var", "software",
+          '(', "value", '$', "Psi", ')',
+        ')',
+        '(', "field",
+          '@', "var", "software_version",
+          '(', "value", '$', "0.11", ')',
+        ')',
+      ')',
+      NULL);
+}
+
+/* The lists making up build_complex_stanza (os) */
+static void
+build_complex_lists (const gchar *os,
+    GPtrArray **features,
+    GPtrArray **identities,
+    GPtrArray **dataforms)
+{
+  WockyStanza *stanza = build_complex_stanza (os);
+  WockyNode *x = wocky_node_get_child_ns (wocky_stanza_get_top_node (stanza),
+      "x", WOCKY_XMPP_NS_DATA);
+  GError *error = NULL;
+  WockyDataForm *form;
+
+  *features = g_ptr_array_new_with_free_func (g_free);
+  g_ptr_array_add (*features, g_strdup ("http://jabber.org/protocol/muc"));
+  g_ptr_array_add (*features,
+      g_strdup ("http://jabber.org/protocol/disco#info"));
+  g_ptr_array_add (*features, g_strdup ("http://jabber.org/protocol/caps"));
+  g_ptr_array_add (*features,
+      g_strdup ("http://jabber.org/protocol/disco#items"));
+
+  *identities = wocky_disco_identity_array_new ();
+  g_ptr_array_add (*identities,
+      wocky_disco_identity_new ("client", "pc", "el", "Ψ 0.11"));
+  g_ptr_array_add (*identities,
+      wocky_disco_identity_new ("client", "pc", "en", "Psi 0.11"));
+
+  form = wocky_data_form_new_from_node (x, &error);
+  g_assert_no_error (error);
+  *dataforms = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (*dataforms, form);
+
+  g_object_unref (stanza);
+}
+
+static void
+test_dataforms_memoized (void)
+{
+  GPtrArray *features, *identities, *dataforms;
+  WockyStanza *stanza;
+  gchar *one, *two, *linux_from_node;
+
+  build_complex_lists ("Mac", &features, &identities, &dataforms);
+
+  one = wocky_caps_hash_compute_from_lists (features, identities, dataforms);
+  g_assert_cmpstr (one, ==, "q07IKJEyjvHSyhy//CH0CxmKi8w=");
+
+  /* this time, what the form contributes is remembered */
+  two = wocky_caps_hash_compute_from_lists (features, identities, dataforms);
+  g_assert_cmpstr (one, ==, two);
+  g_free (two);
+
+  /* but not once the form has changed */
+  g_assert (wocky_data_form_set_string (g_ptr_array_index (dataforms, 0),
+        "os", "Linux", FALSE));
+  two = wocky_caps_hash_compute_from_lists (features, identities, dataforms);
+  g_assert_cmpstr (one, !=, two);
+
+  stanza = build_complex_stanza ("Linux");
+  linux_from_node = wocky_caps_hash_compute_from_node (
+      wocky_stanza_get_top_node (stanza));
+  g_object_unref (stanza);
+  g_assert_cmpstr (two, ==, linux_from_node);
+
+  g_free (one);
+  g_free (two);
+  g_free (linux_from_node);
+  g_ptr_array_unref (features);
+  wocky_disco_identity_array_free (identities);
+  g_ptr_array_unref (dataforms);
+}
+
+static void
+test_ecaps2_algorithms (void)
+{
+  WockyCapsHashAlgorithm algorithm;
+
+  g_assert (wocky_caps_hash_algorithm_from_name ("blake2b-256", &algorithm));
+  g_assert_cmpuint (algorithm, ==, WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_256);
+  g_assert_cmpstr (wocky_caps_hash_algorithm_get_name (algorithm), ==,
+      "blake2b-256");
+
+  g_assert (wocky_caps_hash_algorithm_from_name ("sha-256", &algorithm));
+  g_assert_cmpuint (algorithm, ==, WOCKY_CAPS_HASH_ALGORITHM_SHA_256);
+
+  /* SHA-1 is not allowed in XEP-0390 */
+  g_assert (!wocky_caps_hash_algorithm_from_name ("sha-1", &algorithm));
+  g_assert (!wocky_caps_hash_algorithm_from_name ("sha3-256", &algorithm));
+}
+
+static void
+check_ecaps2 (WockyStanza *stanza,
+    WockyCapsHashAlgorithm algorithm,
+    const gchar *expected)
+{
+  gchar *hash;
+
+  hash = wocky_caps_hash_compute_ecaps2_from_node (
+      wocky_stanza_get_top_node (stanza), algorithm);
+  g_assert_cmpstr (hash, ==, expected);
+  g_free (hash);
+}
+
+static void
+test_ecaps2_simple (void)
+{
+  WockyStanza *stanza = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+      WOCKY_STANZA_SUB_TYPE_RESULT, NULL, NULL,
+      '(', "identity",
+        '@', "category", "client",
+        '@', "name", "Exodus 0.9.1",
+        '@', "type", "pc",
+      ')',
+      '(', "feature",
+          '@', "var", "http://jabber.org/protocol/disco#info", ')',
+      '(', "feature",
+          '@', "var", "http://jabber.org/protocol/disco#items", ')',
+      '(', "feature", '@', "var", "http://jabber.org/protocol/muc", ')',
+      '(', "feature", '@', "var", "http://jabber.org/protocol/caps", ')',
+      NULL);
+
+  check_ecaps2 (stanza, WOCKY_CAPS_HASH_ALGORITHM_SHA_256,
+      "CYEpCSTmIyvtrwic1NPddIpuV44E9NGYGaZx1kYKFoE=");
+  check_ecaps2 (stanza, WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_256,
+      "Nq9PAMdOPEmDEulJRpStqliI/ryE1wshNvtctDp0DhA=");
+  g_object_unref (stanza);
+}
+
+static void
+test_ecaps2_complex (void)
+{
+  WockyStanza *stanza = build_complex_stanza ("Mac");
+  GPtrArray *features, *identities, *dataforms;
+  gchar *hash;
+
+  check_ecaps2 (stanza, WOCKY_CAPS_HASH_ALGORITHM_SHA_512,
+      "YqsvQchWjoWZWnOYF9oXqOLih4iQL0utkITZ2LcNWr8AFfa6kePWPTvoPATqegB2"
+      "vEJAZu5sfpCm21iHPCSo3w==");
+  check_ecaps2 (stanza, WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_512,
+      "2Xz7qmRiD/3KFZxN4lkXe93q4TEEIc75vG2QWW8T3h0hmR/9+WKrgQr1KXy8stKM"
+      "CDI556KXanR176RjCh1a7Q==");
+  g_object_unref (stanza);
+
+  /* the same from lists in a different order, and the form's
+   * contribution is remembered separately from the XEP-0115 hash's */
+  build_complex_lists ("Mac", &features, &identities, &dataforms);
+  hash = wocky_caps_hash_compute_from_lists (features, identities, dataforms);
+  g_assert_cmpstr (hash, ==, "q07IKJEyjvHSyhy//CH0CxmKi8w=");
+  g_free (hash);
+
+  hash = wocky_caps_hash_compute_ecaps2_from_lists (features, identities,
+      dataforms, WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_512);
+  g_assert_cmpstr (hash, ==,
+      "2Xz7qmRiD/3KFZxN4lkXe93q4TEEIc75vG2QWW8T3h0hmR/9+WKrgQr1KXy8stKM"
+      "CDI556KXanR176RjCh1a7Q==");
+  g_free (hash);
+
+  g_ptr_array_unref (features);
+  wocky_disco_identity_array_free (identities);
+  g_ptr_array_unref (dataforms);
+}
+
+#define PERF_ITERATIONS 10000
+
+static void
+test_perf (void)
+{
+  WockyStanza *stanza = build_complex_stanza ("Mac");
+  GPtrArray *features, *identities, *dataforms;
+  gdouble elapsed;
+  guint i;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ITERATIONS; i++)
+    g_free (wocky_caps_hash_compute_from_node (
+          wocky_stanza_get_top_node (stanza)));
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1e9 / PERF_ITERATIONS,
+      "from node: %.0f ns per hash", elapsed * 1e9 / PERF_ITERATIONS);
+
+  build_complex_lists ("Mac", &features, &identities, &dataforms);
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ITERATIONS; i++)
+    g_free (wocky_caps_hash_compute_from_lists (features, identities,
+          dataforms));
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1e9 / PERF_ITERATIONS,
+      "from lists, reusing the form: %.0f ns per hash",
+      elapsed * 1e9 / PERF_ITERATIONS);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ITERATIONS; i++)
+    g_free (wocky_caps_hash_compute_ecaps2_from_node (
+          wocky_stanza_get_top_node (stanza),
+          WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_256));
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1e9 / PERF_ITERATIONS,
+      "ecaps2 blake2b-256 from node: %.0f ns per hash",
+      elapsed * 1e9 / PERF_ITERATIONS);
+
+  g_ptr_array_unref (features);
+  wocky_disco_identity_array_free (identities);
+  g_ptr_array_unref (dataforms);
+  g_object_unref (stanza);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -828,6 +1095,14 @@ main (int argc, char **argv)
   g_test_add_func ("/caps-hash/dataforms/same-type", test_dataforms_same_type);
   g_test_add_func ("/caps-hash/dataforms/boolean-values",
       test_dataforms_boolean_values);
+  g_test_add_func ("/caps-hash/dataforms/memoized", test_dataforms_memoized);
+
+  g_test_add_func ("/caps-hash/ecaps2/algorithms", test_ecaps2_algorithms);
+  g_test_add_func ("/caps-hash/ecaps2/simple", test_ecaps2_simple);
+  g_test_add_func ("/caps-hash/ecaps2/complex", test_ecaps2_complex);
+
+  if (g_test_perf ())
+    g_test_add_func ("/caps-hash/perf", test_perf);
 
   result = g_test_run ();
   test_deinit ();
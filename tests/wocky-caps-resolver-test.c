@@ -0,0 +1,275 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+
+#include <wocky/wocky.h>
+
+#include "wocky-test-helper.h"
+
+#define NODE "http://example.com/client"
+
+typedef struct {
+  test_data_t *test;
+  WockyCapsCache *cache;
+  WockyCapsResolver *resolver;
+  guint handler_id;
+
+  /* the verification string of make_query (TRUE) */
+  gchar *ver;
+  /* number of disco#info requests received */
+  guint requests;
+  /* the answers given to resolve_cb */
+  guint resolved;
+  guint failed;
+} Fixture;
+
+/* What a client whose JID starts with "liar@" claims not to support */
+#define HIDDEN_FEATURE WOCKY_XMPP_NS_PING
+
+static WockyNodeTree *
+make_query (gboolean honest)
+{
+  WockyNodeTree *tree = wocky_node_tree_new ("query", WOCKY_NS_DISCO_INFO,
+      '(', "identity",
+        '@', "category", "client",
+        '@', "type", "pc",
+        '@', "name", "Example Client",
+      ')',
+      '(', "feature", '@', "var", WOCKY_NS_DISCO_INFO, ')',
+      NULL);
+
+  if (honest)
+    wocky_node_add_build (wocky_node_tree_get_top_node (tree),
+        '(', "feature", '@', "var", HIDDEN_FEATURE, ')',
+        NULL);
+
+  return tree;
+}
+
+/* Replies to disco#info requests: "liar@..." with a reply which doesn't
+ * match Fixture:ver, "broken@..." with an error, and anyone else with a
+ * reply which does. */
+static gboolean
+disco_info_cb (WockyPorter *porter,
+    WockyStanza *stanza,
+    gpointer user_data)
+{
+  Fixture *f = user_data;
+  const gchar *to = wocky_stanza_get_to (stanza);
+  WockyNode *query = wocky_node_get_child_ns (
+      wocky_stanza_get_top_node (stanza), "query", WOCKY_NS_DISCO_INFO);
+  gchar *expected_node = g_strdup_printf ("%s#%s", NODE, f->ver);
+  WockyStanza *reply;
+
+  g_assert_cmpstr (wocky_node_get_attribute (query, "node"), ==,
+      expected_node);
+  f->requests++;
+
+  if (g_str_has_prefix (to, "broken@"))
+    {
+      reply = wocky_stanza_build_iq_error (stanza,
+          '(', "error",
+            '@', "type", "cancel",
+            '(', "item-not-found", ':', WOCKY_XMPP_NS_STANZAS, ')',
+          ')',
+          NULL);
+    }
+  else
+    {
+      WockyNode *reply_query;
+      WockyNodeTree *tree = make_query (!g_str_has_prefix (to, "liar@"));
+
+      reply = wocky_stanza_build_iq_result (stanza, NULL);
+      reply_query = wocky_node_add_node_tree (
+          wocky_stanza_get_top_node (reply), tree);
+      wocky_node_set_attribute (reply_query, "node", expected_node);
+      g_object_unref (tree);
+    }
+
+  wocky_porter_send (porter, reply);
+  g_object_unref (reply);
+  g_free (expected_node);
+  return TRUE;
+}
+
+static void
+setup (Fixture *f,
+    gconstpointer data)
+{
+  WockyNodeTree *query = make_query (TRUE);
+
+  f->ver = wocky_caps_hash_compute_from_node (
+      wocky_node_tree_get_top_node (query));
+  g_object_unref (query);
+
+  f->test = setup_test ();
+  test_open_both_connections (f->test);
+  wocky_porter_start (f->test->sched_out);
+  wocky_porter_start (f->test->sched_in);
+
+  f->handler_id = wocky_porter_register_handler_from_anyone (
+      f->test->sched_in,
+      WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_GET,
+      WOCKY_PORTER_HANDLER_PRIORITY_NORMAL, disco_info_cb, f,
+      '(', "query", ':', WOCKY_NS_DISCO_INFO, ')',
+      NULL);
+
+  f->cache = wocky_caps_cache_new (":memory:");
+  f->resolver = wocky_caps_resolver_new (f->test->sched_out, f->cache);
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer data)
+{
+  g_object_unref (f->resolver);
+  g_object_unref (f->cache);
+  wocky_porter_unregister_handler (f->test->sched_in, f->handler_id);
+  test_close_both_porters (f->test);
+  teardown_test (f->test);
+  g_free (f->ver);
+}
+
+static void
+resolve_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  Fixture *f = user_data;
+  WockyNodeTree *tree;
+  GError *error = NULL;
+
+  tree = wocky_caps_resolver_resolve_finish (WOCKY_CAPS_RESOLVER (source),
+      result, &error);
+
+  if (tree != NULL)
+    {
+      WockyNodeTree *expected = make_query (TRUE);
+      gchar *node = g_strdup_printf ("%s#%s", NODE, f->ver);
+
+      /* the reply's <query/> is handed over as it is, node and all */
+      wocky_node_set_attribute (wocky_node_tree_get_top_node (expected),
+          "node", node);
+      g_assert_no_error (error);
+      test_assert_nodes_equal (wocky_node_tree_get_top_node (tree),
+          wocky_node_tree_get_top_node (expected));
+      g_object_unref (expected);
+      g_free (node);
+      g_object_unref (tree);
+      f->resolved++;
+    }
+  else
+    {
+      g_assert_error (error, WOCKY_CAPS_RESOLVER_ERROR,
+          WOCKY_CAPS_RESOLVER_ERROR_NO_VALID_REPLY);
+      g_error_free (error);
+      f->failed++;
+    }
+
+  f->test->outstanding--;
+  g_main_loop_quit (f->test->loop);
+}
+
+static void
+resolve (Fixture *f,
+    const gchar *jid)
+{
+  wocky_caps_resolver_resolve_async (f->resolver, jid, NODE, f->ver, NULL,
+      resolve_cb, f);
+  f->test->outstanding++;
+}
+
+/* A chatroom full of people using the same client */
+#define OCCUPANTS 50
+
+static void
+test_coalesce (Fixture *f,
+    gconstpointer data)
+{
+  gchar *cache_key = g_strdup_printf ("%s#%s", NODE, f->ver);
+  WockyNodeTree *cached;
+  guint i;
+
+  for (i = 0; i < OCCUPANTS; i++)
+    {
+      gchar *jid = g_strdup_printf ("room@conf.example.com/nick%u", i);
+
+      resolve (f, jid);
+      g_free (jid);
+    }
+
+  test_wait_pending (f->test);
+  g_assert_cmpuint (f->requests, ==, 1);
+  g_assert_cmpuint (f->resolved, ==, OCCUPANTS);
+
+  /* the answer was cached, so nobody needs to be asked again */
+  cached = wocky_caps_cache_lookup (f->cache, cache_key);
+  g_assert (cached != NULL);
+  g_object_unref (cached);
+
+  resolve (f, "late@example.com/client");
+  test_wait_pending (f->test);
+  g_assert_cmpuint (f->requests, ==, 1);
+  g_assert_cmpuint (f->resolved, ==, OCCUPANTS + 1);
+
+  g_free (cache_key);
+}
+
+static void
+test_retry (Fixture *f,
+    gconstpointer data)
+{
+  /* The first two don't give a reply matching the verification string, so
+   * the third is asked too; the fourth is the same as the third, and the
+   * fifth isn't needed. */
+  resolve (f, "liar@example.com/client");
+  resolve (f, "broken@example.com/client");
+  resolve (f, "honest@example.com/client");
+  resolve (f, "honest@example.com/client");
+  resolve (f, "spare@example.com/client");
+
+  test_wait_pending (f->test);
+  g_assert_cmpuint (f->requests, ==, 3);
+  g_assert_cmpuint (f->resolved, ==, 5);
+  g_assert_cmpuint (f->failed, ==, 0);
+}
+
+static void
+test_all_fail (Fixture *f,
+    gconstpointer data)
+{
+  resolve (f, "liar@example.com/client");
+  resolve (f, "broken@example.com/client");
+
+  test_wait_pending (f->test);
+  g_assert_cmpuint (f->requests, ==, 2);
+  g_assert_cmpuint (f->resolved, ==, 0);
+  g_assert_cmpuint (f->failed, ==, 2);
+
+  /* Failures aren't remembered: the next contact is asked afresh */
+  resolve (f, "honest@example.com/client");
+  test_wait_pending (f->test);
+  g_assert_cmpuint (f->requests, ==, 3);
+  g_assert_cmpuint (f->resolved, ==, 1);
+}
+
+int
+main (int argc, char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add ("/caps-resolver/coalesce", Fixture, NULL,
+      setup, test_coalesce, teardown);
+  g_test_add ("/caps-resolver/retry", Fixture, NULL,
+      setup, test_retry, teardown);
+  g_test_add ("/caps-resolver/all-fail", Fixture, NULL,
+      setup, test_all_fail, teardown);
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
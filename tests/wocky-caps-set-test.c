@@ -0,0 +1,324 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <wocky/wocky.h>
+
+#include "wocky-test-helper.h"
+
+static WockyNodeTree *
+make_query (guint version,
+    guint n_features)
+{
+  WockyNodeTree *tree = wocky_node_tree_new ("query", WOCKY_NS_DISCO_INFO,
+      '(', "identity",
+        '@', "category", "client",
+        '@', "type", "pc",
+        '@', "name", "Example Client",
+      ')',
+      /* listed twice, but only one feature */
+      '(', "feature", '@', "var", WOCKY_NS_DISCO_INFO, ')',
+      '(', "feature", '@', "var", WOCKY_NS_DISCO_INFO, ')',
+      NULL);
+  WockyNode *top = wocky_node_tree_get_top_node (tree);
+  guint i;
+
+  /* versions share most of their features */
+  for (i = 0; i < n_features; i++)
+    {
+      gchar *var = g_strdup_printf ("urn:example:feature:%u",
+          i % 2 == 0 ? i : i + version * n_features);
+
+      wocky_node_add_build (top, '(', "feature", '@', "var", var, ')', NULL);
+      g_free (var);
+    }
+
+  return tree;
+}
+
+static WockyCapsSet *
+make_set (guint version,
+    guint n_features)
+{
+  WockyNodeTree *tree = make_query (version, n_features);
+  gchar *ver = g_strdup_printf ("ver%u", version);
+  WockyCapsSet *set = wocky_caps_set_new_from_node (ver,
+      wocky_node_tree_get_top_node (tree));
+
+  g_object_unref (tree);
+  g_free (ver);
+  return set;
+}
+
+static void
+test_interned (void)
+{
+  WockyCapsSet *a = make_set (0, 4);
+  WockyCapsSet *b = make_set (0, 4);
+  WockyCapsSet *c = make_set (1, 4);
+  WockyCapsSet *found;
+
+  /* one set per verification string */
+  g_assert (a == b);
+  g_assert (a != c);
+  g_assert_cmpstr (wocky_caps_set_get_ver (a), ==, "ver0");
+
+  found = wocky_caps_set_lookup ("ver1");
+  g_assert (found == c);
+  wocky_caps_set_unref (found);
+
+  wocky_caps_set_unref (a);
+  wocky_caps_set_unref (b);
+  wocky_caps_set_unref (c);
+
+  /* and it goes away with its last reference */
+  g_assert (wocky_caps_set_lookup ("ver0") == NULL);
+  g_assert (wocky_caps_set_lookup ("ver1") == NULL);
+}
+
+static void
+test_features (void)
+{
+  WockyCapsSet *set = make_set (2, 4);
+  const GPtrArray *identities = wocky_caps_set_get_identities (set);
+  WockyDiscoIdentity *identity;
+  guint id;
+
+  g_assert_cmpuint (wocky_caps_set_get_n_features (set), ==, 5);
+  g_assert (wocky_caps_set_has_feature (set, WOCKY_NS_DISCO_INFO));
+  g_assert (wocky_caps_set_has_feature (set, "urn:example:feature:0"));
+  g_assert (wocky_caps_set_has_feature (set, "urn:example:feature:9"));
+  g_assert (!wocky_caps_set_has_feature (set, "urn:example:feature:1"));
+  g_assert (!wocky_caps_set_has_feature (set, "urn:example:never-seen"));
+
+  id = wocky_caps_feature_intern ("urn:example:feature:9");
+  g_assert (wocky_caps_set_has_feature_id (set, id));
+  g_assert_cmpstr (wocky_caps_feature_to_string (id), ==,
+      "urn:example:feature:9");
+
+  /* a feature interned after the set was made */
+  id = wocky_caps_feature_intern ("urn:example:later");
+  g_assert (!wocky_caps_set_has_feature_id (set, id));
+
+  g_assert_cmpuint (identities->len, ==, 1);
+  identity = g_ptr_array_index (identities, 0);
+  g_assert_cmpstr (identity->category, ==, "client");
+  g_assert_cmpstr (identity->type, ==, "pc");
+  g_assert_cmpstr (identity->name, ==, "Example Client");
+
+  wocky_caps_set_unref (set);
+}
+
+/* A contact which only keeps a reference to its set */
+typedef struct {
+  GObject parent;
+  WockyCapsSet *caps;
+} TestContact;
+
+typedef struct {
+  GObjectClass parent_class;
+} TestContactClass;
+
+static GType test_contact_get_type (void);
+static void test_contact_caps_iface_init (gpointer g_iface, gpointer data);
+
+G_DEFINE_TYPE_WITH_CODE (TestContact, test_contact, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (WOCKY_TYPE_XEP_0115_CAPABILITIES,
+        test_contact_caps_iface_init))
+
+static void
+test_contact_init (TestContact *self)
+{
+}
+
+static void
+test_contact_finalize (GObject *object)
+{
+  TestContact *self = (TestContact *) object;
+
+  if (self->caps != NULL)
+    wocky_caps_set_unref (self->caps);
+
+  G_OBJECT_CLASS (test_contact_parent_class)->finalize (object);
+}
+
+static void
+test_contact_class_init (TestContactClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = test_contact_finalize;
+}
+
+static WockyCapsSet *
+test_contact_get_caps_set (WockyXep0115Capabilities *contact)
+{
+  return ((TestContact *) contact)->caps;
+}
+
+static void
+test_contact_caps_iface_init (gpointer g_iface,
+    gpointer data)
+{
+  WockyXep0115CapabilitiesInterface *iface = g_iface;
+
+  iface->get_caps_set = test_contact_get_caps_set;
+}
+
+static void
+test_xep_0115_capabilities (void)
+{
+  TestContact *contact = g_object_new (test_contact_get_type (), NULL);
+  WockyXep0115Capabilities *caps = WOCKY_XEP_0115_CAPABILITIES (contact);
+
+  g_assert (!wocky_xep_0115_capabilities_has_feature (caps,
+        WOCKY_NS_DISCO_INFO));
+
+  contact->caps = make_set (3, 4);
+  g_assert (wocky_xep_0115_capabilities_get_caps_set (caps) ==
+      contact->caps);
+  g_assert (wocky_xep_0115_capabilities_has_feature (caps,
+        WOCKY_NS_DISCO_INFO));
+  g_assert (!wocky_xep_0115_capabilities_has_feature (caps,
+        "urn:example:feature:1"));
+
+  g_object_unref (contact);
+}
+
+/* A big roster, with a typical spread of clients */
+#define PERF_CONTACTS 10000
+#define PERF_VERSIONS 20
+#define PERF_FEATURES 40
+
+static gboolean
+strv_has (GPtrArray *features,
+    const gchar *feature)
+{
+  guint i;
+
+  for (i = 0; i < features->len; i++)
+    if (!strcmp (g_ptr_array_index (features, i), feature))
+      return TRUE;
+
+  return FALSE;
+}
+
+static void
+test_memory_perf (void)
+{
+  GPtrArray *lists[PERF_CONTACTS];
+  WockyCapsSet *sets[PERF_CONTACTS];
+  gsize list_bytes = 0, set_bytes = 0;
+  guint max_id = 0;
+  gdouble elapsed;
+  guint i, hits;
+  /* only in version 0, and at the end of the lists */
+  const gchar *feature = "urn:example:feature:39";
+
+  /* Each contact keeping its own list of feature strings */
+  for (i = 0; i < PERF_CONTACTS; i++)
+    {
+      WockyNodeTree *tree = make_query (i % PERF_VERSIONS, PERF_FEATURES);
+      WockyNodeIter iter;
+      WockyNode *child;
+
+      lists[i] = g_ptr_array_new_with_free_func (g_free);
+      list_bytes += sizeof (GPtrArray);
+      wocky_node_iter_init (&iter, wocky_node_tree_get_top_node (tree),
+          "feature", NULL);
+
+      while (wocky_node_iter_next (&iter, &child))
+        {
+          const gchar *var = wocky_node_get_attribute (child, "var");
+
+          g_ptr_array_add (lists[i], g_strdup (var));
+          list_bytes += sizeof (gpointer) + strlen (var) + 1;
+        }
+
+      g_object_unref (tree);
+    }
+
+  /* Each contact keeping a reference to a shared set */
+  for (i = 0; i < PERF_CONTACTS; i++)
+    {
+      sets[i] = make_set (i % PERF_VERSIONS, PERF_FEATURES);
+      set_bytes += sizeof (gpointer);
+    }
+
+  /* The sets themselves, and the names in the feature index; each set's
+   * bitmap needs a bit for every feature interned before it. */
+  for (i = 0; i < PERF_VERSIONS; i++)
+    {
+      WockyNodeTree *tree = make_query (i, PERF_FEATURES);
+      WockyNodeIter iter;
+      WockyNode *child;
+
+      wocky_node_iter_init (&iter, wocky_node_tree_get_top_node (tree),
+          "feature", NULL);
+
+      while (wocky_node_iter_next (&iter, &child))
+        max_id = MAX (max_id, wocky_caps_feature_intern (
+              wocky_node_get_attribute (child, "var")));
+
+      g_object_unref (tree);
+    }
+
+  for (i = 0; i <= max_id; i++)
+    set_bytes += strlen (wocky_caps_feature_to_string (i)) + 1;
+
+  set_bytes += PERF_VERSIONS * (max_id / 8 + 1 + 64);
+
+  g_test_message ("%u contacts, %u versions: %" G_GSIZE_FORMAT
+      " bytes of feature lists; %" G_GSIZE_FORMAT " bytes with shared sets",
+      PERF_CONTACTS, PERF_VERSIONS, list_bytes, set_bytes);
+  g_test_minimized_result (set_bytes, "%" G_GSIZE_FORMAT " bytes",
+      set_bytes);
+
+  g_test_timer_start ();
+
+  for (i = 0, hits = 0; i < PERF_CONTACTS; i++)
+    hits += strv_has (lists[i], feature);
+
+  elapsed = g_test_timer_elapsed ();
+  g_assert_cmpuint (hits, ==, PERF_CONTACTS / PERF_VERSIONS);
+  g_test_message ("scanning lists: %.1f ns per contact",
+      elapsed * 1e9 / PERF_CONTACTS);
+
+  g_test_timer_start ();
+
+  for (i = 0, hits = 0; i < PERF_CONTACTS; i++)
+    hits += wocky_caps_set_has_feature (sets[i], feature);
+
+  elapsed = g_test_timer_elapsed ();
+  g_assert_cmpuint (hits, ==, PERF_CONTACTS / PERF_VERSIONS);
+  g_test_minimized_result (elapsed * 1e9 / PERF_CONTACTS,
+      "shared sets: %.1f ns per contact", elapsed * 1e9 / PERF_CONTACTS);
+
+  for (i = 0; i < PERF_CONTACTS; i++)
+    {
+      g_ptr_array_unref (lists[i]);
+      wocky_caps_set_unref (sets[i]);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/caps-set/interned", test_interned);
+  g_test_add_func ("/caps-set/features", test_features);
+  g_test_add_func ("/caps-set/xep-0115-capabilities",
+      test_xep_0115_capabilities);
+
+  if (g_test_perf ())
+    g_test_add_func ("/caps-set/memory-perf", test_memory_perf);
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
@@ -406,8 +406,8 @@ test_submit (void)
 {
   WockyStanza *stanza;
   WockyDataForm *form;
-  WockyNode *x;
-  GSList *l;
+  WockyNode *x, *node;
+  WockyNodeIter iter;
   const gchar *description[] = { "Badger", "Mushroom", "Snake", NULL };
   const gchar *features[] = { "news", "search", NULL };
   const gchar *invitees[] = { "juliet@example.org",
@@ -468,9 +468,10 @@ test_submit (void)
   g_assert (x != NULL);
   g_assert_cmpstr (wocky_node_get_attribute (x, "type"), ==, "submit");
 
-  for (l = x->children; l != NULL; l = g_slist_next (l))
+  wocky_node_iter_init (&iter, x, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &node))
     {
-      WockyNode *v, *node = l->data;
+      WockyNode *v;
       const gchar *var, *type, *value = NULL;
 
       g_assert_cmpstr (node->name, ==, "field");
@@ -494,14 +495,14 @@ test_submit (void)
         }
       else if (!wocky_strdiff (var, "description"))
         {
-          GSList *m;
+          WockyNodeIter value_iter;
+          WockyNode *tmp;
           gboolean badger = FALSE, mushroom = FALSE, snake = FALSE;
 
           g_assert_cmpstr (type, ==, "text-multi");
-          for (m = node->children; m != NULL; m = g_slist_next (m))
+          wocky_node_iter_init (&value_iter, node, NULL, NULL);
+          while (wocky_node_iter_next (&value_iter, &tmp))
             {
-              WockyNode *tmp = m->data;
-
               g_assert_cmpstr (tmp->name, ==, "value");
               if (!wocky_strdiff (tmp->content, "Badger"))
                 badger = TRUE;
@@ -526,14 +527,14 @@ test_submit (void)
         }
       else if (!wocky_strdiff (var, "features"))
         {
-          GSList *m;
+          WockyNodeIter value_iter;
+          WockyNode *tmp;
           gboolean news = FALSE, search = FALSE;
 
           g_assert_cmpstr (type, ==, "list-multi");
-          for (m = node->children; m != NULL; m = g_slist_next (m))
+          wocky_node_iter_init (&value_iter, node, NULL, NULL);
+          while (wocky_node_iter_next (&value_iter, &tmp))
             {
-              WockyNode *tmp = m->data;
-
               g_assert_cmpstr (tmp->name, ==, "value");
               if (!wocky_strdiff (tmp->content, "news"))
                 news = TRUE;
@@ -551,14 +552,14 @@ test_submit (void)
         }
       else if (!wocky_strdiff (var, "invitelist"))
         {
-          GSList *m;
+          WockyNodeIter value_iter;
+          WockyNode *tmp;
           gboolean juliet = FALSE, romeo = FALSE;
 
           g_assert_cmpstr (type, ==, "jid-multi");
-          for (m = node->children; m != NULL; m = g_slist_next (m))
+          wocky_node_iter_init (&value_iter, node, NULL, NULL);
+          while (wocky_node_iter_next (&value_iter, &tmp))
             {
-              WockyNode *tmp = m->data;
-
               g_assert_cmpstr (tmp->name, ==, "value");
               if (!wocky_strdiff (tmp->content, "juliet@example.org"))
                 juliet = TRUE;
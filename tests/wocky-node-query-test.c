@@ -0,0 +1,405 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <wocky/wocky.h>
+
+#include "wocky-test-helper.h"
+
+static WockyStanza *
+make_presence (void)
+{
+  return wocky_stanza_build (WOCKY_STANZA_TYPE_PRESENCE,
+      WOCKY_STANZA_SUB_TYPE_NONE,
+      "chat@conf.example.com/romeo", "juliet@example.com/balcony",
+      '(', "status", '$', "wherefore art thou", ')',
+      '(', "c", ':', "http://jabber.org/protocol/caps",
+        '@', "hash", "sha-1",
+        '@', "node", "http://example.com/client",
+        '@', "ver", "QgayPKawpkPSDYmwT/WM94uAlu0=",
+      ')',
+      '(', "x", ':', WOCKY_NS_MUC_USER,
+        '(', "item",
+          '@', "affiliation", "member",
+          '@', "role", "participant",
+          '@', "jid", "romeo@example.net/garden",
+          '@', "nick", "romeo",
+          '(', "actor", '@', "jid", "nurse@example.com", ')',
+          '(', "reason", '$', "because", ')',
+        ')',
+        '(', "status", '@', "code", "100", ')',
+        '(', "status", ')',
+        '(', "status", '@', "code", "110", ')',
+      ')',
+      '(', "x", ':', "urn:example:other",
+        '(', "item", '@', "jid", "tybalt@example.com", ')',
+      ')',
+      NULL);
+}
+
+static WockyNodeQuery *
+compile (const gchar *path)
+{
+  GError *error = NULL;
+  WockyNodeQuery *query = wocky_node_query_new (path, &error);
+
+  g_assert_no_error (error);
+  g_assert (query != NULL);
+  g_assert_cmpstr (wocky_node_query_get_path (query), ==, path);
+
+  return query;
+}
+
+static void
+check_string (const gchar *path,
+    WockyNode *node,
+    const gchar *expected)
+{
+  WockyNodeQuery *query = compile (path);
+
+  g_assert_cmpstr (wocky_node_query_get_string (query, node), ==, expected);
+  wocky_node_query_unref (query);
+}
+
+static void
+test_match (void)
+{
+  WockyStanza *stanza = make_presence ();
+  WockyNode *top = wocky_stanza_get_top_node (stanza);
+  WockyNodeQuery *query, *item_query;
+  WockyNode *item;
+
+  check_string ("status", top, "wherefore art thou");
+  check_string ("@from", top, "chat@conf.example.com/romeo");
+  check_string ("@type", top, NULL);
+  check_string ("nothing", top, NULL);
+
+  /* without a namespace, any matches */
+  check_string ("x/item/@jid", top, "romeo@example.net/garden");
+  check_string ("{urn:example:other}x/item/@jid", top, "tybalt@example.com");
+  check_string ("{" WOCKY_NS_MUC_USER "}x/item/actor/@jid", top,
+      "nurse@example.com");
+  check_string ("{" WOCKY_NS_MUC_USER "}x/item/reason", top, "because");
+  check_string ("{urn:example:nowhere}x/item/@jid", top, NULL);
+  check_string ("*/item/@nick", top, "romeo");
+  check_string ("x/*/reason", top, "because");
+
+  /* predicates */
+  check_string ("x/item[@role='participant']/@nick", top, "romeo");
+  check_string ("x/item[@role=\"moderator\"]/@nick", top, NULL);
+  check_string ("x[@xmlns]/item/@jid", top, NULL);
+  check_string ("c[@hash='sha-1'][@node]/@ver", top,
+      "QgayPKawpkPSDYmwT/WM94uAlu0=");
+  check_string ("c[@hash='sha-1'][@nope]/@ver", top, NULL);
+
+  /* a later match is found if an earlier branch is a dead end */
+  check_string ("x/item[@jid='tybalt@example.com']/@jid", top,
+      "tybalt@example.com");
+
+  /* "@key" is just the node itself */
+  query = compile ("@jid");
+  item_query = compile ("x/item");
+  item = wocky_node_query_get_node (item_query, top);
+  g_assert (wocky_node_query_get_node (query, item) == item);
+  g_assert_cmpstr (wocky_node_query_get_value (query, item), ==,
+      "romeo@example.net/garden");
+  g_assert (wocky_node_query_get_node (query, top) == NULL);
+  g_assert_cmpstr (wocky_node_query_get_value (query, NULL), ==, NULL);
+  wocky_node_query_unref (query);
+  wocky_node_query_unref (item_query);
+
+  g_object_unref (stanza);
+}
+
+static void
+test_iterate (void)
+{
+  WockyStanza *stanza = make_presence ();
+  WockyNode *top = wocky_stanza_get_top_node (stanza);
+  WockyNodeQuery *query = compile ("x/status/@code");
+  WockyNodeQueryIter iter;
+  WockyNode *node;
+  GString *codes = g_string_new ("");
+
+  wocky_node_query_iter_init (&iter, query, top);
+
+  while (wocky_node_query_iter_next (&iter, &node))
+    g_string_append_printf (codes, "%s;",
+        wocky_node_query_get_value (query, node));
+
+  /* the <status/> without a code is skipped */
+  g_assert_cmpstr (codes->str, ==, "100;110;");
+
+  /* and it stays finished */
+  g_assert (!wocky_node_query_iter_next (&iter, NULL));
+  wocky_node_query_unref (query);
+
+  /* matches across several parents come in document order */
+  query = compile ("x/item");
+  g_string_truncate (codes, 0);
+  wocky_node_query_iter_init (&iter, query, top);
+
+  while (wocky_node_query_iter_next (&iter, &node))
+    g_string_append_printf (codes, "%s;",
+        wocky_node_get_attribute (node, "jid"));
+
+  g_assert_cmpstr (codes->str, ==,
+      "romeo@example.net/garden;tybalt@example.com;");
+
+  wocky_node_query_unref (query);
+  g_string_free (codes, TRUE);
+  g_object_unref (stanza);
+}
+
+static void
+test_invalid (void)
+{
+  const gchar *invalid[] = { "", "/", "x/", "x//y", "{}x", "{urn:x",
+      "x[", "x[@]", "x[jid]", "x[@jid", "x[@jid=y]", "x[@jid='y]",
+      "x/@", "x/@jid/y", "x@jid", "*x", "a/b/c/d/e/f/g/h/i", NULL };
+  guint i;
+
+  for (i = 0; invalid[i] != NULL; i++)
+    {
+      GError *error = NULL;
+
+      g_assert (wocky_node_query_new (invalid[i], &error) == NULL);
+      g_assert_error (error, WOCKY_NODE_QUERY_ERROR,
+          WOCKY_NODE_QUERY_ERROR_INVALID_PATH);
+      g_error_free (error);
+    }
+
+  /* but as many steps as there's room for is fine */
+  wocky_node_query_unref (compile ("a/b/c/d/e/f/g/h"));
+}
+
+/* What handle_presence_standard() in wocky-muc.c wants to know */
+typedef struct {
+  const gchar *msg;
+  const gchar *jid;
+  const gchar *nick;
+  const gchar *role;
+  const gchar *affiliation;
+  const gchar *actor;
+  const gchar *reason;
+  guint codes;
+} Presence;
+
+static void
+parse_by_hand (WockyNode *top,
+    Presence *p)
+{
+  WockyNode *x = wocky_node_get_child_ns (top, "x", WOCKY_NS_MUC_USER);
+  WockyNode *item, *actor, *reason, *status;
+  WockyNodeIter iter;
+
+  p->msg = wocky_node_get_content_from_child (top, "status");
+  item = wocky_node_get_child (x, "item");
+  p->jid = wocky_node_get_attribute (item, "jid");
+  p->nick = wocky_node_get_attribute (item, "nick");
+  p->role = wocky_node_get_attribute (item, "role");
+  p->affiliation = wocky_node_get_attribute (item, "affiliation");
+  actor = wocky_node_get_child (item, "actor");
+  p->actor = wocky_node_get_attribute (actor, "jid");
+  reason = wocky_node_get_child (item, "reason");
+  p->reason = reason->content;
+  p->codes = 0;
+
+  wocky_node_iter_init (&iter, x, "status", NULL);
+
+  while (wocky_node_iter_next (&iter, &status))
+    {
+      const gchar *code = wocky_node_get_attribute (status, "code");
+
+      if (code != NULL)
+        p->codes += atoi (code);
+    }
+}
+
+static struct {
+  WockyNodeQuery *muc_user;
+  WockyNodeQuery *status;
+  WockyNodeQuery *item;
+  WockyNodeQuery *status_code;
+  WockyNodeQuery *jid;
+  WockyNodeQuery *nick;
+  WockyNodeQuery *role;
+  WockyNodeQuery *affiliation;
+  WockyNodeQuery *actor_jid;
+  WockyNodeQuery *reason;
+} queries;
+
+static void
+parse_with_queries (WockyNode *top,
+    Presence *p)
+{
+  WockyNode *x = wocky_node_query_get_node (queries.muc_user, top);
+  WockyNode *item, *status;
+  WockyNodeQueryIter iter;
+
+  p->msg = wocky_node_query_get_string (queries.status, top);
+  item = wocky_node_query_get_node (queries.item, x);
+  p->jid = wocky_node_query_get_value (queries.jid, item);
+  p->nick = wocky_node_query_get_value (queries.nick, item);
+  p->role = wocky_node_query_get_value (queries.role, item);
+  p->affiliation = wocky_node_query_get_value (queries.affiliation, item);
+  p->actor = wocky_node_query_get_string (queries.actor_jid, item);
+  p->reason = wocky_node_query_get_string (queries.reason, item);
+  p->codes = 0;
+
+  wocky_node_query_iter_init (&iter, queries.status_code, x);
+
+  while (wocky_node_query_iter_next (&iter, &status))
+    p->codes += atoi (wocky_node_query_get_value (queries.status_code,
+          status));
+}
+
+#define PERF_ROUNDS 1000000
+
+static void
+test_muc_presence_perf (void)
+{
+  WockyStanza *stanza = make_presence ();
+  WockyNode *top = wocky_stanza_get_top_node (stanza);
+  Presence by_hand, with_queries;
+  gdouble hand, compiled;
+  guint i;
+
+  queries.muc_user = compile ("{" WOCKY_NS_MUC_USER "}x");
+  queries.status = compile ("status");
+  queries.item = compile ("item");
+  queries.status_code = compile ("status/@code");
+  queries.jid = compile ("@jid");
+  queries.nick = compile ("@nick");
+  queries.role = compile ("@role");
+  queries.affiliation = compile ("@affiliation");
+  queries.actor_jid = compile ("actor/@jid");
+  queries.reason = compile ("reason");
+
+  parse_by_hand (top, &by_hand);
+  parse_with_queries (top, &with_queries);
+  g_assert_cmpstr (with_queries.msg, ==, by_hand.msg);
+  g_assert_cmpstr (with_queries.jid, ==, by_hand.jid);
+  g_assert_cmpstr (with_queries.nick, ==, by_hand.nick);
+  g_assert_cmpstr (with_queries.role, ==, by_hand.role);
+  g_assert_cmpstr (with_queries.affiliation, ==, by_hand.affiliation);
+  g_assert_cmpstr (with_queries.actor, ==, by_hand.actor);
+  g_assert_cmpstr (with_queries.reason, ==, by_hand.reason);
+  g_assert_cmpuint (with_queries.codes, ==, 210);
+  g_assert_cmpuint (by_hand.codes, ==, 210);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ROUNDS; i++)
+    parse_by_hand (top, &by_hand);
+
+  hand = g_test_timer_elapsed () * 1e9 / PERF_ROUNDS;
+  g_test_message ("MUC presence by hand: %.0f ns", hand);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ROUNDS; i++)
+    parse_with_queries (top, &with_queries);
+
+  compiled = g_test_timer_elapsed () * 1e9 / PERF_ROUNDS;
+  g_test_minimized_result (compiled, "MUC presence with queries: %.0f ns",
+      compiled);
+
+  wocky_node_query_unref (queries.muc_user);
+  wocky_node_query_unref (queries.status);
+  wocky_node_query_unref (queries.item);
+  wocky_node_query_unref (queries.status_code);
+  wocky_node_query_unref (queries.jid);
+  wocky_node_query_unref (queries.nick);
+  wocky_node_query_unref (queries.role);
+  wocky_node_query_unref (queries.affiliation);
+  wocky_node_query_unref (queries.actor_jid);
+  wocky_node_query_unref (queries.reason);
+  g_object_unref (stanza);
+}
+
+static void
+test_pubsub_event_perf (void)
+{
+  WockyStanza *stanza = wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+      WOCKY_STANZA_SUB_TYPE_NONE, "pubsub.example.com", "juliet@example.com",
+      '(', "event", ':', WOCKY_XMPP_NS_PUBSUB_EVENT,
+        '(', "items", '@', "node", "urn:example:geoloc",
+          '(', "item", '@', "id", "1", ')',
+        ')',
+      ')',
+      '(', "headers", ':', "http://jabber.org/protocol/shim", ')',
+      NULL);
+  WockyNode *top = wocky_stanza_get_top_node (stanza);
+  WockyNodeQuery *event = compile ("{" WOCKY_XMPP_NS_PUBSUB_EVENT "}event");
+  WockyNodeQuery *action = compile ("items");
+  WockyNodeQuery *node_name = compile ("@node");
+  const gchar *name = NULL;
+  gdouble hand, compiled;
+  guint i;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ROUNDS; i++)
+    {
+      WockyNode *e = wocky_node_get_child_ns (top, "event",
+          WOCKY_XMPP_NS_PUBSUB_EVENT);
+
+      name = wocky_node_get_attribute (wocky_node_get_child (e, "items"),
+          "node");
+    }
+
+  hand = g_test_timer_elapsed () * 1e9 / PERF_ROUNDS;
+  g_assert_cmpstr (name, ==, "urn:example:geoloc");
+  g_test_message ("pubsub event by hand: %.0f ns", hand);
+
+  name = NULL;
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ROUNDS; i++)
+    {
+      WockyNode *e = wocky_node_query_get_node (event, top);
+
+      name = wocky_node_query_get_value (node_name,
+          wocky_node_query_get_node (action, e));
+    }
+
+  compiled = g_test_timer_elapsed () * 1e9 / PERF_ROUNDS;
+  g_assert_cmpstr (name, ==, "urn:example:geoloc");
+  g_test_minimized_result (compiled, "pubsub event with queries: %.0f ns",
+      compiled);
+
+  wocky_node_query_unref (event);
+  wocky_node_query_unref (action);
+  wocky_node_query_unref (node_name);
+  g_object_unref (stanza);
+}
+
+int
+main (int argc, char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/node-query/match", test_match);
+  g_test_add_func ("/node-query/iterate", test_iterate);
+  g_test_add_func ("/node-query/invalid", test_invalid);
+
+  if (g_test_perf ())
+    {
+      g_test_add_func ("/node-query/muc-presence-perf",
+          test_muc_presence_perf);
+      g_test_add_func ("/node-query/pubsub-event-perf",
+          test_pubsub_event_perf);
+    }
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
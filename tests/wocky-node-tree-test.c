@@ -31,7 +31,7 @@ test_build_simple_tree (void)
   g_assert_cmpstr (n->name, ==, "lions");
   g_assert_cmpstr (wocky_node_get_ns (n), ==, "animals");
 
-  g_assert_cmpint (g_slist_length (n->children), ==, 1);
+  g_assert_cmpint (wocky_node_get_n_children (n), ==, 1);
   n = wocky_node_get_first_child (n);
   g_assert (n != NULL);
   g_assert_cmpstr (n->name, ==, "distribution");
@@ -94,6 +94,172 @@ test_node_add_tree (void)
   g_object_unref (destination);
 }
 
+static WockyNodeTree *
+make_disco_reply (guint n_features)
+{
+  WockyNodeTree *tree;
+  WockyNode *query;
+  guint i;
+
+  tree = wocky_node_tree_new ("query", WOCKY_NS_DISCO_INFO,
+    '*', &query,
+    '@', "node", "http://example.com/client#abcdefghijklmnopqrstuvwxyz0=",
+    '(', "identity",
+      '@', "category", "client",
+      '@', "type", "pc",
+      '#', "en",
+      '@', "name", "Wocky Test Client",
+    ')',
+    '(', "x", ':', "jabber:x:data",
+      '@', "type", "result",
+      '(', "field",
+        '@', "var", "FORM_TYPE",
+        '@', "type", "hidden",
+        '(', "value", '$', "urn:xmpp:dataforms:softwareinfo", ')',
+      ')',
+      '(', "field", '@', "var", "os",
+        '(', "value", '$', "Eyjafjallajökull <&> \"éruption\"", ')',
+      ')',
+    ')',
+    NULL);
+
+  wocky_node_set_attribute_ns (query, "hash", "sha-1",
+      "urn:wocky:test:attribute-ns");
+  wocky_node_add_child_with_content (query, "empty", "");
+
+  for (i = 0; i < n_features; i++)
+    {
+      gchar *var = g_strdup_printf ("urn:example:feature:%u", i);
+
+      wocky_node_set_attribute (wocky_node_add_child (query, "feature"),
+          "var", var);
+      g_free (var);
+    }
+
+  return tree;
+}
+
+static void
+test_bytes_round_trip (void)
+{
+  WockyNodeTree *tree = make_disco_reply (20);
+  WockyNodeTree *copy;
+  WockyNode *top;
+  GBytes *bytes;
+
+  bytes = wocky_node_tree_to_bytes (tree);
+  copy = wocky_node_tree_new_from_bytes (bytes);
+  g_assert (copy != NULL);
+
+  test_assert_nodes_equal (wocky_node_tree_get_top_node (tree),
+    wocky_node_tree_get_top_node (copy));
+
+  top = wocky_node_tree_get_top_node (copy);
+  g_assert_cmpstr (wocky_node_get_attribute_ns (top, "hash",
+      "urn:wocky:test:attribute-ns"), ==, "sha-1");
+  g_assert_cmpstr (wocky_node_get_language (
+      wocky_node_get_child (top, "identity")), ==, "en");
+  g_assert_cmpstr (wocky_node_get_content_from_child (top, "empty"), ==, "");
+  g_assert (wocky_node_get_child (top, "identity")->content == NULL);
+
+  g_bytes_unref (bytes);
+  g_object_unref (copy);
+  g_object_unref (tree);
+}
+
+static void
+test_bytes_malformed (void)
+{
+  WockyNodeTree *tree = make_disco_reply (3);
+  GBytes *bytes = wocky_node_tree_to_bytes (tree);
+  gsize len, i;
+  const guint8 *data = g_bytes_get_data (bytes, &len);
+  guint8 *copy;
+
+  /* Every truncation is rejected */
+  for (i = 0; i < len; i++)
+    {
+      GBytes *truncated = g_bytes_new_from_bytes (bytes, 0, i);
+
+      g_assert (wocky_node_tree_new_from_bytes (truncated) == NULL);
+      g_bytes_unref (truncated);
+    }
+
+  /* So is trailing garbage */
+  copy = g_malloc (len + 1);
+  memcpy (copy, data, len);
+  copy[len] = 0;
+  g_bytes_unref (bytes);
+  bytes = g_bytes_new_take (copy, len + 1);
+  g_assert (wocky_node_tree_new_from_bytes (bytes) == NULL);
+  g_bytes_unref (bytes);
+
+  /* And versions we don't know */
+  bytes = g_bytes_new_static ("WNT\377\0", 5);
+  g_assert (wocky_node_tree_new_from_bytes (bytes) == NULL);
+  g_bytes_unref (bytes);
+
+  g_object_unref (tree);
+}
+
+#define PERF_ITERATIONS 2000
+
+static void
+test_bytes_perf (void)
+{
+  WockyNodeTree *tree = make_disco_reply (60);
+  WockyXmppWriter *writer = wocky_xmpp_writer_new_no_stream ();
+  WockyXmppReader *reader = wocky_xmpp_reader_new_no_stream ();
+  const guint8 *xml;
+  gsize xml_len;
+  GBytes *bytes;
+  gdouble xml_time, bytes_time;
+  guint i;
+
+  wocky_xmpp_writer_write_node_tree (writer, tree, &xml, &xml_len);
+  bytes = wocky_node_tree_to_bytes (tree);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ITERATIONS; i++)
+    {
+      WockyStanza *parsed;
+
+      wocky_xmpp_reader_push (reader, xml, xml_len);
+      parsed = wocky_xmpp_reader_pop_stanza (reader);
+      g_assert (parsed != NULL);
+      g_object_unref (parsed);
+      wocky_xmpp_reader_reset (reader);
+    }
+
+  xml_time = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ITERATIONS; i++)
+    {
+      WockyNodeTree *decoded = wocky_node_tree_new_from_bytes (bytes);
+
+      g_assert (decoded != NULL);
+      g_object_unref (decoded);
+    }
+
+  bytes_time = g_test_timer_elapsed ();
+
+  g_test_message ("XML: %" G_GSIZE_FORMAT " bytes, %.2f us to parse",
+      xml_len, xml_time * 1e6 / PERF_ITERATIONS);
+  g_test_message ("binary: %" G_GSIZE_FORMAT " bytes, %.2f us to decode",
+      g_bytes_get_size (bytes), bytes_time * 1e6 / PERF_ITERATIONS);
+  g_test_minimized_result (bytes_time * 1e6 / PERF_ITERATIONS,
+      "%.2f us to decode, %.1fx faster than parsing XML",
+      bytes_time * 1e6 / PERF_ITERATIONS, xml_time / bytes_time);
+
+  g_bytes_unref (bytes);
+  g_object_unref (reader);
+  g_object_unref (writer);
+  g_object_unref (tree);
+}
+
 
 int
 main (int argc, char **argv)
@@ -108,6 +274,13 @@ main (int argc, char **argv)
     test_tree_from_node);
   g_test_add_func ("/xmpp-node-tree/node-add-tree",
     test_node_add_tree);
+  g_test_add_func ("/xmpp-node-tree/bytes-round-trip",
+    test_bytes_round_trip);
+  g_test_add_func ("/xmpp-node-tree/bytes-malformed",
+    test_bytes_malformed);
+
+  if (g_test_perf ())
+    g_test_add_func ("/xmpp-node-tree/bytes-perf", test_bytes_perf);
 
   result =  g_test_run ();
   test_deinit ();
@@ -188,6 +188,215 @@ test_send (void)
   teardown_test (test);
 }
 
+static void
+send_multicast_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  test_data_t *data = (test_data_t *) user_data;
+  GError *error = NULL;
+
+  g_assert (wocky_porter_send_multicast_finish (WOCKY_PORTER (source), res,
+      &error));
+  g_assert_no_error (error);
+
+  data->outstanding--;
+  g_main_loop_quit (data->loop);
+}
+
+static void
+multicast_sending_cb (WockyPorter *porter,
+    WockyStanza *stanza,
+    gpointer user_data)
+{
+  GPtrArray *sent_to = user_data;
+
+  g_ptr_array_add (sent_to, g_strdup (wocky_stanza_get_to (stanza)));
+}
+
+static void
+test_send_multicast (void)
+{
+  test_data_t *test = setup_test ();
+  const gchar * const recipients[] = { "romeo@example.net",
+      "tybalt@example.net", "nurse@example.net/a&b", NULL };
+  GPtrArray *sent_to = g_ptr_array_new_with_free_func (g_free);
+  WockyStanza *s;
+  guint i;
+
+  test_open_connection (test);
+
+  g_signal_connect (test->sched_in, "sending",
+      G_CALLBACK (multicast_sending_cb), sent_to);
+
+  s = wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+    WOCKY_STANZA_SUB_TYPE_CHAT, "juliet@example.com", NULL,
+      '(', "body", '$', "Good night, good night!", ')',
+      '(', "html", ':', "http://jabber.org/protocol/xhtml-im",
+        '(', "body", ':', "http://www.w3.org/1999/xhtml",
+          '$', "Parting is such sweet sorrow",
+        ')',
+      ')',
+    NULL);
+
+  wocky_porter_send_multicast_async (test->sched_in, s, recipients, NULL,
+      send_multicast_cb, test);
+  test->outstanding++;
+
+  /* each recipient gets the same stanza, addressed to them */
+  for (i = 0; recipients[i] != NULL; i++)
+    {
+      WockyStanza *expected = wocky_stanza_copy (s);
+
+      wocky_node_set_attribute (wocky_stanza_get_top_node (expected), "to",
+          recipients[i]);
+      g_queue_push_tail (test->expected_stanzas, expected);
+    }
+
+  /* sending to nobody is a no-op */
+  wocky_porter_send_multicast_async (test->sched_in, s, recipients + 3, NULL,
+      send_multicast_cb, test);
+  test->outstanding++;
+
+  g_object_unref (s);
+
+  wocky_xmpp_connection_recv_stanza_async (test->out, NULL,
+      send_stanza_received_cb, test);
+  test->outstanding++;
+
+  test_wait_pending (test);
+
+  /* ::sending saw each recipient's own copy */
+  g_assert_cmpuint (sent_to->len, ==, 3);
+  for (i = 0; recipients[i] != NULL; i++)
+    g_assert_cmpstr (g_ptr_array_index (sent_to, i), ==, recipients[i]);
+
+  g_signal_handlers_disconnect_by_func (test->sched_in,
+      G_CALLBACK (multicast_sending_cb), sent_to);
+  g_ptr_array_unref (sent_to);
+
+  test_close_connection (test);
+  teardown_test (test);
+}
+
+static void
+send_cork_stanzas (test_data_t *test,
+    guint n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    {
+      gchar *to = g_strdup_printf ("room%u@conference.example.net/juliet", i);
+      WockyStanza *s = wocky_stanza_build (WOCKY_STANZA_TYPE_PRESENCE,
+          WOCKY_STANZA_SUB_TYPE_NONE, "juliet@example.com/Balcony", to,
+            '(', "show", '$', "away", ')',
+            '(', "status", '$', "Parting is such sweet sorrow", ')',
+          NULL);
+
+      wocky_porter_send_async (test->sched_in, s, NULL, send_stanza_cb, test);
+      g_queue_push_tail (test->expected_stanzas, s);
+      test->outstanding++;
+      g_free (to);
+    }
+
+  wocky_xmpp_connection_recv_stanza_async (test->out, NULL,
+      send_stanza_received_cb, test);
+  test->outstanding++;
+}
+
+static void
+test_cork (void)
+{
+  test_data_t *test = setup_test ();
+  WockyC2SPorter *porter = WOCKY_C2S_PORTER (test->sched_in);
+  GOutputStream *output = test->stream->stream0_output;
+  guint writes, before;
+  gsize bytes;
+
+  test_open_connection (test);
+  wocky_test_stream_set_write_mode (output, WOCKY_TEST_STREAM_WRITE_COMPLETE);
+
+  /* nothing is written until the porter is flushed... */
+  wocky_c2s_porter_set_cork (porter, 60000, 65536);
+  wocky_test_output_stream_get_stats (output, &before, &bytes);
+  send_cork_stanzas (test, 5);
+  wocky_test_output_stream_get_stats (output, &writes, &bytes);
+  g_assert_cmpuint (writes, ==, before);
+
+  /* ... and then everything is, at once */
+  wocky_porter_flush (test->sched_in);
+  test_wait_pending (test);
+  wocky_test_output_stream_get_stats (output, &writes, &bytes);
+  g_assert_cmpuint (writes, ==, before + 1);
+
+  /* or once the latency is up */
+  wocky_c2s_porter_set_cork (porter, 10, 65536);
+  before = writes;
+  send_cork_stanzas (test, 5);
+  test_wait_pending (test);
+  wocky_test_output_stream_get_stats (output, &writes, &bytes);
+  g_assert_cmpuint (writes, ==, before + 1);
+
+  /* no more than threshold bytes are held back, or written at once */
+  wocky_c2s_porter_set_cork (porter, 60000, 1);
+  before = writes;
+  send_cork_stanzas (test, 3);
+  test_wait_pending (test);
+  wocky_test_output_stream_get_stats (output, &writes, &bytes);
+  g_assert_cmpuint (writes, ==, before + 3);
+
+  test_close_connection (test);
+  teardown_test (test);
+}
+
+#define CORK_BURSTS 100
+#define CORK_BURST_SIZE 20
+
+static void
+cork_perf (guint latency,
+    gsize threshold)
+{
+  test_data_t *test = setup_test ();
+  GOutputStream *output = test->stream->stream0_output;
+  guint writes, i;
+  gsize bytes;
+  gdouble elapsed;
+
+  test_open_connection (test);
+  wocky_test_stream_set_write_mode (output, WOCKY_TEST_STREAM_WRITE_COMPLETE);
+  wocky_c2s_porter_set_cork (WOCKY_C2S_PORTER (test->sched_in), latency,
+      threshold);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < CORK_BURSTS; i++)
+    {
+      send_cork_stanzas (test, CORK_BURST_SIZE);
+      test_wait_pending (test);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  wocky_test_output_stream_get_stats (output, &writes, &bytes);
+
+  g_test_message ("cork latency %u ms, threshold %" G_GSIZE_FORMAT ": "
+      "%" G_GSIZE_FORMAT " bytes in %u writes, %.2f ms per burst of %u",
+      latency, threshold, bytes, writes, elapsed * 1000 / CORK_BURSTS,
+      CORK_BURST_SIZE);
+  g_test_minimized_result ((gdouble) writes / CORK_BURSTS,
+      "%.1f writes per burst", (gdouble) writes / CORK_BURSTS);
+
+  test_close_connection (test);
+  teardown_test (test);
+}
+
+static void
+test_cork_perf (void)
+{
+  cork_perf (0, 0);
+  cork_perf (2, 16384);
+}
+
 /* receive testing */
 static gboolean
 test_receive_stanza_received_cb (WockyPorter *porter,
@@ -3574,6 +3783,8 @@ main (int argc, char **argv)
 
   g_test_add_func ("/xmpp-porter/initiation", test_instantiation);
   g_test_add_func ("/xmpp-porter/send", test_send);
+  g_test_add_func ("/xmpp-porter/send-multicast", test_send_multicast);
+  g_test_add_func ("/xmpp-porter/cork", test_cork);
   g_test_add_func ("/xmpp-porter/receive", test_receive);
   g_test_add_func ("/xmpp-porter/filter", test_filter);
   g_test_add_func ("/xmpp-porter/close-flush", test_close_flush);
@@ -3632,6 +3843,9 @@ main (int argc, char **argv)
       test_reply_from_domain);
   g_test_add_func ("/xmpp-porter/wildcard-handlers", wildcard_handlers);
 
+  if (g_test_perf ())
+    g_test_add_func ("/xmpp-porter/cork-perf", test_cork_perf);
+
   result = g_test_run ();
   test_deinit ();
   return result;
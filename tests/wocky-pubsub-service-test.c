@@ -537,8 +537,8 @@ test_create_node_config_create_iq_cb (WockyPorter *porter,
 {
   test_data_t *test = (test_data_t *) user_data;
   WockyStanza *reply;
-  WockyNode *node;
-  GSList *l;
+  WockyNode *node, *field;
+  WockyNodeIter iter;
   gboolean form_type = FALSE, title = FALSE, notif = FALSE;
 
   node = wocky_node_get_child_ns (wocky_stanza_get_top_node (stanza),
@@ -549,9 +549,9 @@ test_create_node_config_create_iq_cb (WockyPorter *porter,
   node = wocky_node_get_child_ns (node, "x", WOCKY_XMPP_NS_DATA);
   g_assert (node != NULL);
 
-  for (l = node->children; l != NULL; l = g_slist_next (l))
+  wocky_node_iter_init (&iter, node, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &field))
     {
-      WockyNode *field = l->data;
       const gchar *type, *var, *value = NULL;
       WockyNode *v;
 
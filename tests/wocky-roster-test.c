@@ -295,6 +295,64 @@ test_fetch_roster_reply (void)
   teardown_test (test);
 }
 
+/* Test that a roster push which arrives before the fetch reply is applied
+ * before the reply's items, even though those are read as they arrive */
+static gboolean
+fetch_roster_push_first_reply_cb (WockyPorter *porter,
+    WockyStanza *stanza,
+    gpointer user_data)
+{
+  WockyStanza *push;
+
+  /* Had the reply's items been applied as they were read, Juliet would be
+   * removed once the push was dispatched */
+  push = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_SET,
+      NULL, NULL,
+      '@', "id", "push1",
+      '(', "query",
+        ':', "jabber:iq:roster",
+        '(', "item",
+          '@', "jid", "juliet@example.net",
+          '@', "subscription", "remove",
+        ')',
+      ')',
+      NULL);
+
+  wocky_porter_send (porter, push);
+  g_object_unref (push);
+
+  return fetch_roster_reply_cb (porter, stanza, user_data);
+}
+
+static void
+test_fetch_roster_push_first (void)
+{
+  WockyRoster *roster;
+  test_data_t *test = setup_test ();
+
+  test_open_both_connections (test);
+
+  wocky_porter_register_handler_from_anyone (test->sched_out,
+      WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_GET,
+      WOCKY_PORTER_HANDLER_PRIORITY_MAX,
+      fetch_roster_push_first_reply_cb, test, NULL);
+
+  wocky_porter_start (test->sched_out);
+  wocky_session_start (test->session_in);
+
+  roster = wocky_roster_new (test->session_in);
+
+  wocky_roster_fetch_roster_async (roster, NULL,
+      fetch_roster_reply_roster_cb, test);
+
+  test->outstanding++;
+  test_wait_pending (test);
+
+  test_close_both_porters (test);
+  g_object_unref (roster);
+  teardown_test (test);
+}
+
 /* Test if roster is properly upgraded when a contact is added to it */
 static WockyBareContact *
 create_nurse (void)
@@ -575,7 +633,8 @@ check_edit_roster_stanza (WockyStanza *stanza,
   WockyStanzaType type;
   WockyStanzaSubType sub_type;
   WockyNode *node;
-  GSList *l;
+  WockyNodeIter iter;
+  WockyNode *group;
   guint i;
   GHashTable *expected_groups;
 
@@ -607,7 +666,7 @@ check_edit_roster_stanza (WockyStanza *stanza,
   if (groups == NULL)
     {
       /* No group children */
-      g_assert_cmpuint (g_slist_length (node->children), == , 0);
+      g_assert_cmpuint (wocky_node_get_n_children (node), == , 0);
       return;
     }
 
@@ -618,10 +677,9 @@ check_edit_roster_stanza (WockyStanza *stanza,
           GUINT_TO_POINTER (TRUE));
     }
 
-  for (l = node->children; l != NULL; l = g_slist_next (l))
+  wocky_node_iter_init (&iter, node, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &group))
     {
-      WockyNode *group = (WockyNode *) l->data;
-
       g_assert (!wocky_strdiff (group->name, "group"));
 
       g_assert (g_hash_table_remove (expected_groups, group->content));
@@ -884,7 +942,7 @@ change_name_send_iq_cb (WockyPorter *porter,
   g_assert (!wocky_strdiff (wocky_node_get_attribute (node,
         "subscription"), "both"));
 
-  g_assert_cmpuint (g_slist_length (node->children), ==, 1);
+  g_assert_cmpuint (wocky_node_get_n_children (node), ==, 1);
   node = wocky_node_get_child (node, "group");
   g_assert (node != NULL);
   g_assert (!wocky_strdiff (node->content, "Friends"));
@@ -1000,7 +1058,8 @@ add_group_send_iq_cb (WockyPorter *porter,
   WockyStanzaSubType sub_type;
   WockyNode *node;
   const gchar *groups[] = { "Friends", "Badger", NULL };
-  GSList *l;
+  WockyNodeIter iter;
+  WockyNode *group;
   gboolean group_friend = FALSE, group_badger = FALSE;
 
   /* Make sure stanza is as expected. */
@@ -1022,11 +1081,10 @@ add_group_send_iq_cb (WockyPorter *porter,
   g_assert (!wocky_strdiff (wocky_node_get_attribute (node,
         "subscription"), "both"));
 
-  g_assert_cmpuint (g_slist_length (node->children), ==, 2);
-  for (l = node->children; l != NULL; l = g_slist_next (l))
+  g_assert_cmpuint (wocky_node_get_n_children (node), ==, 2);
+  wocky_node_iter_init (&iter, node, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &group))
     {
-      WockyNode *group = (WockyNode *) l->data;
-
       g_assert (!wocky_strdiff (group->name, "group"));
 
       if (!wocky_strdiff (group->content, "Friends"))
@@ -1169,7 +1227,7 @@ remove_group_send_iq_cb (WockyPorter *porter,
   g_assert (!wocky_strdiff (wocky_node_get_attribute (node,
         "subscription"), "both"));
 
-  g_assert_cmpuint (g_slist_length (node->children), ==, 0);
+  g_assert_cmpuint (wocky_node_get_n_children (node), ==, 0);
 
   send_roster_update (test, "romeo@example.net", "Romeo", "both", groups);
 
@@ -2093,6 +2151,8 @@ main (int argc, char **argv)
   g_test_add_func ("/xmpp-roster/fetch-roster-send-iq",
       test_fetch_roster_send_iq);
   g_test_add_func ("/xmpp-roster/fetch-roster-reply", test_fetch_roster_reply);
+  g_test_add_func ("/xmpp-roster/fetch-roster-push-first",
+      test_fetch_roster_push_first);
   /* receive upgrade from server */
   g_test_add_func ("/xmpp-roster/roster-upgrade-add", test_roster_upgrade_add);
   g_test_add_func ("/xmpp-roster/roster-upgrade-remove",
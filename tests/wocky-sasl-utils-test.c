@@ -146,6 +146,164 @@ test_sasl_utils_hmac_sha1 (digest_test *t)
   g_byte_array_unref (result);
 }
 
+typedef struct {
+  GChecksumType type;
+  const gchar *password;
+  gsize password_len;
+  const gchar *salt;
+  gsize salt_len;
+  guint64 iterations;
+  gsize out_len;
+  const gchar *result;
+} pbkdf2_test;
+
+/* PBKDF2-HMAC-SHA1 test vectors as per RFC 6070, plus vectors for the other
+ * digests SCRAM uses. The 16777216 iteration RFC vector is left out as it
+ * takes too long */
+pbkdf2_test pbkdf2_tests[] = {
+  { G_CHECKSUM_SHA1, "password", 8, "salt", 4, 1, 20,
+    "0c60c80f961f0e71f3a9b524af6012062fe037a6" },
+  { G_CHECKSUM_SHA1, "password", 8, "salt", 4, 2, 20,
+    "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957" },
+  { G_CHECKSUM_SHA1, "password", 8, "salt", 4, 4096, 20,
+    "4b007901b765489abead49d926f721d065a429c1" },
+  { G_CHECKSUM_SHA1, "passwordPASSWORDpassword", 24,
+    "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36, 4096, 25,
+    "3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038" },
+  { G_CHECKSUM_SHA1, "pass\0word", 9, "sa\0lt", 5, 4096, 16,
+    "56fa6aa75548099dcc37d7f03425e0c3" },
+  { G_CHECKSUM_SHA256, "password", 8, "salt", 4, 1, 32,
+    "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b" },
+  { G_CHECKSUM_SHA256, "password", 8, "salt", 4, 4096, 32,
+    "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a" },
+  { G_CHECKSUM_SHA256, "passwordPASSWORDpassword", 24,
+    "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36, 4096, 40,
+    "348c89dbcbd32b2f32d814b8116e84cf2b17347ebc1800181c4e2a1fb8dd53e1"
+    "c635518c7dac47e9" },
+  /* key longer than the block size */
+  { G_CHECKSUM_SHA256,
+    "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+    "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", 100,
+    "salt", 4, 2, 32,
+    "d43a18cd77bafc1a4b0c6025dbbf29c7e6d67acce6ad02a736d4a3003b6a3c26" },
+  { G_CHECKSUM_SHA384, "password", 8, "salt", 4, 4096, 48,
+    "559726be38db125bc85ed7895f6e3cf574c7a01c080c3447"
+    "db1e8a76764deb3c307b94853fbe424f6488c5f4f1289626" },
+  { G_CHECKSUM_SHA512, "password", 8, "salt", 4, 4096, 64,
+    "d197b1b33db0143e018b12f3d1d1479e6cdebdcc97c5c0f87f6902e072f457b5"
+    "143f30602641b3d55cd335988cb36b84376060ecd532e039b742a239434af2d5" },
+  /* not handled by the fast path */
+  { G_CHECKSUM_MD5, "password", 8, "salt", 4, 4096, 16,
+    "15001f89b9c29ee6998c520d1a0629e8" },
+  { 0, NULL, 0, NULL, 0, 0, 0, NULL },
+};
+
+static void
+test_sasl_utils_pbkdf2 (pbkdf2_test *t)
+{
+  guint8 *out = g_malloc (t->out_len);
+  GString *hex = g_string_new (NULL);
+  gsize i;
+
+  sasl_pbkdf2_hmac (t->type,
+    (guint8 *) t->password, t->password_len,
+    (guint8 *) t->salt, t->salt_len,
+    t->iterations, out, t->out_len);
+
+  for (i = 0; i < t->out_len; i++)
+    g_string_append_printf (hex, "%02x", out[i]);
+
+  g_assert_cmpstr (hex->str, ==, t->result);
+
+  g_string_free (hex, TRUE);
+  g_free (out);
+}
+
+typedef struct {
+  const gchar *name;
+  GChecksumType type;
+} pbkdf2_benchmark;
+
+pbkdf2_benchmark pbkdf2_benchmarks[] = {
+  { "sha1", G_CHECKSUM_SHA1 },
+  { "sha256", G_CHECKSUM_SHA256 },
+  { "sha512", G_CHECKSUM_SHA512 },
+  { NULL, 0 },
+};
+
+static guint64 pbkdf2_benchmark_iterations[] = { 4096, 10000, 100000 };
+
+/* The straightforward Hi() the SCRAM handler used to do, to compare with */
+static void
+pbkdf2_reference (GChecksumType type,
+    guint8 *password,
+    gsize password_len,
+    guint8 *salt,
+    gsize salt_len,
+    guint64 iterations)
+{
+  guint8 one[] = { 0, 0, 0, 1 };
+  GByteArray *s = g_byte_array_new ();
+  GByteArray *result, *prev;
+  guint64 n;
+  guint i;
+
+  g_byte_array_append (s, salt, salt_len);
+  g_byte_array_append (s, one, sizeof (one));
+
+  result = sasl_calculate_hmac (type, password, password_len,
+      s->data, s->len);
+  prev = g_byte_array_sized_new (result->len);
+  g_byte_array_append (prev, result->data, result->len);
+
+  for (n = 1; n < iterations; n++)
+    {
+      GByteArray *u = sasl_calculate_hmac (type, password, password_len,
+          prev->data, prev->len);
+
+      g_byte_array_unref (prev);
+      prev = u;
+
+      for (i = 0; i < result->len; i++)
+        result->data[i] ^= u->data[i];
+    }
+
+  g_byte_array_unref (prev);
+  g_byte_array_unref (result);
+  g_byte_array_unref (s);
+}
+
+static void
+test_sasl_utils_pbkdf2_perf (pbkdf2_benchmark *b)
+{
+  guint8 out[64];
+  gsize out_len = g_checksum_type_get_length (b->type);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (pbkdf2_benchmark_iterations); i++)
+    {
+      guint64 iterations = pbkdf2_benchmark_iterations[i];
+      gdouble fast, reference;
+
+      g_test_timer_start ();
+      sasl_pbkdf2_hmac (b->type,
+          (guint8 *) "pencil", 6, (guint8 *) "QSXCR+Q6sek8bf92", 16,
+          iterations, out, out_len);
+      fast = g_test_timer_elapsed ();
+
+      g_test_timer_start ();
+      pbkdf2_reference (b->type,
+          (guint8 *) "pencil", 6, (guint8 *) "QSXCR+Q6sek8bf92", 16,
+          iterations);
+      reference = g_test_timer_elapsed ();
+
+      g_test_minimized_result (fast,
+          "PBKDF2-HMAC-%s, %" G_GUINT64_FORMAT " iterations: %.4fs "
+          "(GHmac loop: %.4fs, %.1fx)", b->name, iterations, fast,
+          reference, reference / fast);
+    }
+}
+
 int
 main (int argc,
     char **argv)
@@ -164,5 +322,29 @@ main (int argc,
       g_free (name);
     }
 
+  for (i = 0 ; pbkdf2_tests[i].password != NULL ; i++)
+    {
+      gchar *name = g_strdup_printf ("/sasl-utils/pbkdf2-%d", i + 1);
+
+      g_test_add_data_func (name,
+        pbkdf2_tests + i,
+        (void (*)(const void *)) test_sasl_utils_pbkdf2);
+      g_free (name);
+    }
+
+  if (g_test_perf ())
+    {
+      for (i = 0 ; pbkdf2_benchmarks[i].name != NULL ; i++)
+        {
+          gchar *name = g_strdup_printf ("/sasl-utils/pbkdf2-perf/%s",
+              pbkdf2_benchmarks[i].name);
+
+          g_test_add_data_func (name,
+            pbkdf2_benchmarks + i,
+            (void (*)(const void *)) test_sasl_utils_pbkdf2_perf);
+          g_free (name);
+        }
+    }
+
   return g_test_run ();
 }
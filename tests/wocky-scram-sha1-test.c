@@ -22,6 +22,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <wocky/wocky.h>
 
 #include "wocky-test-helper.h"
@@ -85,6 +86,214 @@ test_scram_sha1 (testcase *test)
   g_object_unref (scram);
 }
 
+static void
+auth_data_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GAsyncResult **res = user_data;
+
+  *res = g_object_ref (result);
+}
+
+/* Goes through the asynchronous API, which derives the keys in a thread */
+static GString *
+handle_auth_data_async (WockyAuthHandler *scram,
+    const gchar *data,
+    GError **error)
+{
+  GAsyncResult *result = NULL;
+  GString *in = g_string_new (data);
+  GString *out = NULL;
+
+  wocky_auth_handler_handle_auth_data_async (scram, in, auth_data_cb,
+      &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  wocky_auth_handler_handle_auth_data_finish (scram, result, &out, error);
+
+  g_object_unref (result);
+  g_string_free (in, TRUE);
+
+  return out;
+}
+
+static void
+run_scram_sha1_async (testcase *test,
+    const gchar *password,
+    WockySaslScramCache *cache)
+{
+  WockyAuthHandler *scram;
+  GString *out;
+  GError *error = NULL;
+
+  g_random_set_seed (test->seed);
+
+  scram = WOCKY_AUTH_HANDLER (wocky_sasl_scram_new (
+    test->server, test->user, password));
+
+  g_object_set (scram,
+      "hash-algo", G_CHECKSUM_SHA1,
+      "cache", cache,
+      NULL);
+
+  g_assert (wocky_auth_handler_get_initial_response (scram,
+      &out,
+      &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpstr (test->client_initial_response, ==, out->str);
+  g_string_free (out, TRUE);
+
+  out = handle_auth_data_async (scram, test->server_initial_response,
+      &error);
+  g_assert_no_error (error);
+  g_assert_cmpstr (test->client_final_response, ==, out->str);
+  g_string_free (out, TRUE);
+
+  out = handle_auth_data_async (scram, test->server_final_response,
+      &error);
+  g_assert_no_error (error);
+  g_assert (out == NULL);
+
+  g_assert (wocky_auth_handler_handle_success (scram, &error));
+  g_assert_no_error (error);
+
+  g_object_unref (scram);
+}
+
+static void
+test_scram_sha1_async (testcase *test)
+{
+  run_scram_sha1_async (test, test->password, NULL);
+}
+
+/* Runs the client side of the exchange up to the client final message,
+ * which is returned */
+static gchar *
+scram_sha1_client_final (testcase *test,
+    const gchar *password,
+    WockySaslScramCache *cache,
+    WockySaslScram **scram)
+{
+  GString *out;
+  GError *error = NULL;
+
+  g_random_set_seed (test->seed);
+  *scram = wocky_sasl_scram_new (test->server, test->user, password);
+  g_object_set (*scram,
+      "hash-algo", G_CHECKSUM_SHA1,
+      "cache", cache,
+      NULL);
+  g_assert (wocky_auth_handler_get_initial_response (
+      WOCKY_AUTH_HANDLER (*scram), &out, &error));
+  g_assert_no_error (error);
+  g_string_free (out, TRUE);
+  out = handle_auth_data_async (WOCKY_AUTH_HANDLER (*scram),
+      test->server_initial_response, &error);
+  g_assert_no_error (error);
+
+  return g_string_free (out, FALSE);
+}
+
+static void
+test_scram_sha1_cache (testcase *test)
+{
+  WockySaslScramCache *cache = wocky_sasl_scram_cache_new ();
+  WockySaslScram *scram;
+  GByteArray *client_key, *server_key, *bogus;
+  gchar *salt, *final;
+  guint64 iterations;
+
+  run_scram_sha1_async (test, test->password, cache);
+
+  /* server first is r=...,s=<salt>,i=<iterations> */
+  salt = g_strdup (strstr (test->server_initial_response, ",s=") + 3);
+  *strchr (salt, ',') = '\0';
+  iterations = g_ascii_strtoull (
+      strstr (test->server_initial_response, ",i=") + 3, NULL, 10);
+
+  g_assert (wocky_sasl_scram_cache_lookup (cache, test->server, test->user,
+      salt, iterations, G_CHECKSUM_SHA1, &client_key, &server_key));
+  g_assert_cmpuint (client_key->len, ==, 20);
+  g_assert_cmpuint (server_key->len, ==, 20);
+  g_byte_array_unref (client_key);
+  g_byte_array_unref (server_key);
+
+  /* The keys are only for this server, salt and iteration count */
+  g_assert (!wocky_sasl_scram_cache_lookup (cache, "example.net", test->user,
+      salt, iterations, G_CHECKSUM_SHA1, &client_key, &server_key));
+  g_assert (!wocky_sasl_scram_cache_lookup (cache, test->server, test->user,
+      "c2FsdDE=", iterations, G_CHECKSUM_SHA1, &client_key, &server_key));
+  g_assert (!wocky_sasl_scram_cache_lookup (cache, test->server, test->user,
+      salt, iterations + 1, G_CHECKSUM_SHA1, &client_key, &server_key));
+
+  /* The cached keys are used in place of the password: replace them with
+   * junk, and the proof changes */
+  bogus = g_byte_array_new ();
+  g_byte_array_set_size (bogus, 20);
+  memset (bogus->data, 0x5a, bogus->len);
+  wocky_sasl_scram_cache_store (cache, test->server, test->user, salt,
+      iterations, G_CHECKSUM_SHA1, bogus, bogus);
+  g_byte_array_unref (bogus);
+
+  final = scram_sha1_client_final (test, test->password, cache, &scram);
+  g_assert_cmpstr (final, !=, test->client_final_response);
+  g_free (final);
+
+  /* and dropped when they turn out not to work */
+  wocky_sasl_scram_forget_cached_keys (scram);
+  g_object_unref (scram);
+
+  g_assert (!wocky_sasl_scram_cache_lookup (cache, test->server, test->user,
+      salt, iterations, G_CHECKSUM_SHA1, &client_key, &server_key));
+
+  /* With nothing cached, a wrong password gives a wrong proof */
+  final = scram_sha1_client_final (test, "not the password", cache, &scram);
+  g_assert_cmpstr (final, !=, test->client_final_response);
+  g_free (final);
+  g_object_unref (scram);
+
+  g_free (salt);
+  g_object_unref (cache);
+}
+
+static void
+test_scram_sha1_cache_bounded (void)
+{
+  WockySaslScramCache *cache = g_object_new (WOCKY_TYPE_SASL_SCRAM_CACHE,
+      "max-entries", 2,
+      NULL);
+  GByteArray *key = g_byte_array_new ();
+  GByteArray *client_key, *server_key;
+  const gchar * const salts[] = { "c2FsdDE=", "c2FsdDI=", "c2FsdDM=" };
+  guint i;
+
+  g_byte_array_set_size (key, 20);
+  memset (key->data, 0, key->len);
+
+  for (i = 0; i < G_N_ELEMENTS (salts); i++)
+    wocky_sasl_scram_cache_store (cache, "example.com", "harry", salts[i],
+        4096, G_CHECKSUM_SHA1, key, key);
+
+  /* the oldest entry made way for the newest */
+  g_assert (!wocky_sasl_scram_cache_lookup (cache, "example.com", "harry",
+      salts[0], 4096, G_CHECKSUM_SHA1, &client_key, &server_key));
+
+  for (i = 1; i < G_N_ELEMENTS (salts); i++)
+    {
+      g_assert (wocky_sasl_scram_cache_lookup (cache, "example.com", "harry",
+          salts[i], 4096, G_CHECKSUM_SHA1, &client_key, &server_key));
+      g_byte_array_unref (client_key);
+      g_byte_array_unref (server_key);
+    }
+
+  g_byte_array_unref (key);
+  g_object_unref (cache);
+}
+
 /* Some static tests as generated by trail of our current implementation, which
  * has been tested against real servers. These testcases are mostly here
  * because to prevent regressions and differences of output on different
@@ -133,7 +342,20 @@ main (int argc,
       g_test_add_data_func (name, tests + i,
         (void (*)(const void *)) test_scram_sha1);
       g_free (name);
+
+      name = g_strdup_printf ("/scram-sha1/async-%d", i);
+      g_test_add_data_func (name, tests + i,
+        (void (*)(const void *)) test_scram_sha1_async);
+      g_free (name);
+
+      name = g_strdup_printf ("/scram-sha1/cache-%d", i);
+      g_test_add_data_func (name, tests + i,
+        (void (*)(const void *)) test_scram_sha1_cache);
+      g_free (name);
     }
 
+  g_test_add_func ("/scram-sha1/cache-bounded",
+      test_scram_sha1_cache_bounded);
+
   return g_test_run ();
 }
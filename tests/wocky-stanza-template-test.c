@@ -0,0 +1,251 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <wocky/wocky.h>
+
+#include "wocky-test-helper.h"
+
+static void
+test_instantiate (void)
+{
+  WockyStanzaTemplate *tmpl = wocky_stanza_template_new (
+      WOCKY_STANZA_TYPE_MESSAGE, WOCKY_STANZA_SUB_TYPE_CHAT,
+      "juliet@example.com/balcony", NULL,
+      '?', "to", "to",
+      '(', "body", '%', "body", ')',
+      '(', "html", ':', "http://jabber.org/protocol/xhtml-im",
+        '(', "body", ':', "http://www.w3.org/1999/xhtml",
+          '(', "p", '@', "style", "font-weight: bold",
+            '?', "class", "class",
+            '%', "html",
+          ')',
+        ')',
+      ')',
+      NULL);
+  WockyStanza *stanza, *expected;
+
+  g_assert_cmpuint (wocky_stanza_template_get_n_slots (tmpl), ==, 4);
+
+  stanza = wocky_stanza_template_instantiate (tmpl,
+      "to", "romeo@example.net",
+      "body", "Wherefore art thou?",
+      "class", "aside",
+      "html", "Wherefore art thou?",
+      NULL);
+  expected = wocky_stanza_build (
+      WOCKY_STANZA_TYPE_MESSAGE, WOCKY_STANZA_SUB_TYPE_CHAT,
+      "juliet@example.com/balcony", "romeo@example.net",
+      '(', "body", '$', "Wherefore art thou?", ')',
+      '(', "html", ':', "http://jabber.org/protocol/xhtml-im",
+        '(', "body", ':', "http://www.w3.org/1999/xhtml",
+          '(', "p", '@', "style", "font-weight: bold",
+            '@', "class", "aside",
+            '$', "Wherefore art thou?",
+          ')',
+        ')',
+      ')',
+      NULL);
+  test_assert_stanzas_equal (stanza, expected);
+  g_object_unref (stanza);
+  g_object_unref (expected);
+
+  /* slots without values are left out */
+  stanza = wocky_stanza_template_instantiate (tmpl,
+      "body", "Deny thy father",
+      NULL);
+  expected = wocky_stanza_build (
+      WOCKY_STANZA_TYPE_MESSAGE, WOCKY_STANZA_SUB_TYPE_CHAT,
+      "juliet@example.com/balcony", NULL,
+      '(', "body", '$', "Deny thy father", ')',
+      '(', "html", ':', "http://jabber.org/protocol/xhtml-im",
+        '(', "body", ':', "http://www.w3.org/1999/xhtml",
+          '(', "p", '@', "style", "font-weight: bold", ')',
+        ')',
+      ')',
+      NULL);
+  test_assert_stanzas_equal (stanza, expected);
+  g_object_unref (stanza);
+  g_object_unref (expected);
+
+  wocky_stanza_template_unref (tmpl);
+}
+
+static void
+test_values (void)
+{
+  WockyStanzaTemplate *tmpl = wocky_stanza_template_new (
+      WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_GET, NULL, NULL,
+      '?', "to", "to",
+      '?', "id", "id",
+      '(', "ping", ':', WOCKY_XMPP_NS_PING, ')',
+      NULL);
+  const gchar *values[] = { "example.com", "ping1" };
+  WockyStanza *first, *second, *expected;
+  WockyStanzaType type;
+  WockyStanzaSubType sub_type;
+
+  g_assert_cmpint (wocky_stanza_template_get_slot (tmpl, "to"), ==, 0);
+  g_assert_cmpint (wocky_stanza_template_get_slot (tmpl, "id"), ==, 1);
+  g_assert_cmpint (wocky_stanza_template_get_slot (tmpl, "from"), ==, -1);
+
+  first = wocky_stanza_template_instantiate_values (tmpl, values);
+  expected = wocky_stanza_build (
+      WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_GET, NULL, "example.com",
+      '@', "id", "ping1",
+      '(', "ping", ':', WOCKY_XMPP_NS_PING, ')',
+      NULL);
+  test_assert_stanzas_equal (first, expected);
+
+  wocky_stanza_get_type_info (first, &type, &sub_type);
+  g_assert_cmpuint (type, ==, WOCKY_STANZA_TYPE_IQ);
+  g_assert_cmpuint (sub_type, ==, WOCKY_STANZA_SUB_TYPE_GET);
+
+  /* instances have nothing to do with each other */
+  wocky_node_add_child (wocky_stanza_get_top_node (first), "extra");
+  values[1] = "ping2";
+  second = wocky_stanza_template_instantiate_values (tmpl, values);
+  wocky_node_set_attribute (wocky_stanza_get_top_node (expected), "id",
+      "ping2");
+  test_assert_stanzas_equal (second, expected);
+
+  g_object_unref (first);
+  g_object_unref (second);
+  g_object_unref (expected);
+  wocky_stanza_template_unref (tmpl);
+}
+
+#define PERF_STANZAS 100000
+
+static void
+report (const gchar *what,
+    gdouble built,
+    gdouble instantiated)
+{
+  g_test_message ("%s with wocky_stanza_build(): %.0f ns", what,
+      built * 1e9 / PERF_STANZAS);
+  g_test_minimized_result (instantiated * 1e9 / PERF_STANZAS,
+      "%s from a template: %.0f ns", what,
+      instantiated * 1e9 / PERF_STANZAS);
+}
+
+static void
+test_ping_perf (void)
+{
+  WockyStanzaTemplate *tmpl = wocky_stanza_template_new (
+      WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_GET, NULL, NULL,
+      '?', "to", "to",
+      '?', "id", "id",
+      '(', "ping", ':', WOCKY_XMPP_NS_PING, ')',
+      NULL);
+  const gchar *values[] = { "example.com", NULL };
+  gchar id[16];
+  gdouble built, instantiated;
+  guint i;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_STANZAS; i++)
+    {
+      WockyStanza *stanza;
+
+      g_snprintf (id, sizeof (id), "ping%u", i);
+      stanza = wocky_stanza_build (
+          WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_GET, NULL, "example.com",
+          '@', "id", id,
+          '(', "ping", ':', WOCKY_XMPP_NS_PING, ')',
+          NULL);
+      g_object_unref (stanza);
+    }
+
+  built = g_test_timer_elapsed ();
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_STANZAS; i++)
+    {
+      WockyStanza *stanza;
+
+      g_snprintf (id, sizeof (id), "ping%u", i);
+      values[1] = id;
+      stanza = wocky_stanza_template_instantiate_values (tmpl, values);
+      g_object_unref (stanza);
+    }
+
+  instantiated = g_test_timer_elapsed ();
+  report ("ping", built, instantiated);
+
+  wocky_stanza_template_unref (tmpl);
+}
+
+static void
+test_muc_presence_perf (void)
+{
+  /* as wocky_muc_create_presence() and wocky_muc_join() make them */
+  WockyStanzaTemplate *tmpl = wocky_stanza_template_new (
+      WOCKY_STANZA_TYPE_PRESENCE, WOCKY_STANZA_SUB_TYPE_NONE, NULL, NULL,
+      '?', "type", "type",
+      '?', "from", "from",
+      '?', "to", "to",
+      NULL);
+  const gchar *values[] = { NULL, "romeo@example.net/orchard",
+      "garden@conference.example.net/romeo" };
+  gdouble built, instantiated;
+  guint i;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_STANZAS; i++)
+    {
+      WockyStanza *stanza = wocky_stanza_build (WOCKY_STANZA_TYPE_PRESENCE,
+          WOCKY_STANZA_SUB_TYPE_NONE, values[1], values[2], NULL);
+
+      wocky_node_add_child_ns (wocky_stanza_get_top_node (stanza), "x",
+          WOCKY_NS_MUC);
+      g_object_unref (stanza);
+    }
+
+  built = g_test_timer_elapsed ();
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_STANZAS; i++)
+    {
+      WockyStanza *stanza = wocky_stanza_template_instantiate_values (tmpl,
+          values);
+
+      wocky_node_add_child_ns (wocky_stanza_get_top_node (stanza), "x",
+          WOCKY_NS_MUC);
+      g_object_unref (stanza);
+    }
+
+  instantiated = g_test_timer_elapsed ();
+  report ("MUC presence", built, instantiated);
+
+  wocky_stanza_template_unref (tmpl);
+}
+
+int
+main (int argc, char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/stanza-template/instantiate", test_instantiate);
+  g_test_add_func ("/stanza-template/values", test_values);
+
+  if (g_test_perf ())
+    {
+      g_test_add_func ("/stanza-template/ping-perf", test_ping_perf);
+      g_test_add_func ("/stanza-template/muc-presence-perf",
+          test_muc_presence_perf);
+    }
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
@@ -10,6 +10,10 @@
 
 #include <wocky/wocky.h>
 
+#define WOCKY_COMPILATION
+#include <wocky/wocky-stanza-internal.h>
+#undef WOCKY_COMPILATION
+
 #include "wocky-test-helper.h"
 
 static void
@@ -45,6 +49,183 @@ test_copy (void)
   g_object_unref (expected);
 }
 
+static WockyStanza *
+make_event (guint n_items)
+{
+  WockyStanza *stanza;
+  WockyNode *items;
+  guint i;
+
+  stanza = wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+      WOCKY_STANZA_SUB_TYPE_HEADLINE, "pubsub.example.com", NULL,
+      '(', "event", ':', WOCKY_XMPP_NS_PUBSUB_EVENT,
+        '(', "items",
+          '@', "node", "urn:example:geoloc",
+          '*', &items,
+        ')',
+      ')',
+      NULL);
+
+  for (i = 0; i < n_items; i++)
+    {
+      gchar *id = g_strdup_printf ("item%u", i);
+
+      wocky_node_add_build (items,
+          '(', "item",
+            '@', "id", id,
+            '(', "geoloc", ':', "http://jabber.org/protocol/geoloc",
+              '(', "lat", '$', "45.44", ')',
+              '(', "lon", '$', "12.33", ')',
+              '(', "locality", '$', "Venice", ')',
+              '(', "text", '$', "On the Rialto, looking for a gondola", ')',
+            ')',
+          ')',
+          NULL);
+      g_free (id);
+    }
+
+  return stanza;
+}
+
+static void
+test_copy_sealed (void)
+{
+  WockyStanza *event = make_event (3);
+  WockyStanza *copy, *other;
+  WockyNode *top, *copy_top, *copy_event, *items, *copy_items, *item;
+
+  top = wocky_stanza_get_top_node (event);
+  g_assert (!wocky_node_is_sealed (top));
+  wocky_node_seal (top);
+  g_assert (wocky_node_is_sealed (top));
+  g_assert (wocky_node_is_sealed (wocky_node_get_first_child (top)));
+
+  copy = wocky_stanza_copy (event);
+  other = wocky_stanza_copy (event);
+  test_assert_stanzas_equal (event, copy);
+
+  /* the top node is the copy's own, but everything below it is shared */
+  copy_top = wocky_stanza_get_top_node (copy);
+  g_assert (!wocky_node_is_sealed (copy_top));
+  copy_event = wocky_node_get_first_child (copy_top);
+  g_assert (copy_event == wocky_node_get_first_child (top));
+
+  wocky_node_set_attribute (copy_top, "to", "juliet@example.com");
+  g_assert_cmpstr (wocky_stanza_get_to (copy), ==, "juliet@example.com");
+  g_assert_cmpstr (wocky_stanza_get_to (event), ==, NULL);
+
+  /* changing something further down only unshares the path to it */
+  copy_event = wocky_node_make_child_writable (copy_top, copy_event);
+  g_assert (!wocky_node_is_sealed (copy_event));
+  g_assert (copy_event != wocky_node_get_first_child (top));
+  g_assert (wocky_node_get_first_child (copy_top) == copy_event);
+
+  items = wocky_node_get_first_child (wocky_node_get_first_child (top));
+  copy_items = wocky_node_make_child_writable (copy_event,
+      wocky_node_get_first_child (copy_event));
+  g_assert (copy_items != items);
+  wocky_node_set_attribute (copy_items, "node", "urn:example:tune");
+  g_assert_cmpstr (wocky_node_get_attribute (items, "node"), ==,
+      "urn:example:geoloc");
+
+  item = wocky_node_get_child (copy_items, "item");
+  g_assert (item == wocky_node_get_child (items, "item"));
+  /* which leaves children which are already writable alone */
+  g_assert (wocky_node_make_child_writable (copy_event, copy_items) ==
+      copy_items);
+
+  /* the sealed original can go away before its copies */
+  g_object_unref (event);
+  g_assert_cmpstr (wocky_node_get_attribute (item, "id"), ==, "item0");
+  g_assert_cmpstr (wocky_node_get_attribute (
+        wocky_node_get_first_child (wocky_node_get_first_child (
+            wocky_stanza_get_top_node (other))), "node"), ==,
+      "urn:example:geoloc");
+
+  /* copying a copy shares what it shares */
+  event = wocky_stanza_copy (copy);
+  test_assert_stanzas_equal (event, copy);
+  g_assert (wocky_node_get_child (wocky_node_get_first_child (
+          wocky_node_get_first_child (wocky_stanza_get_top_node (event))),
+        "item") == item);
+
+  g_object_unref (event);
+  g_object_unref (copy);
+  g_object_unref (other);
+}
+
+/* Roughly what a copy of @node allocates for itself */
+static gsize
+owned_bytes (WockyNode *node)
+{
+  WockyNodeIter iter;
+  WockyNode *child;
+  gsize bytes;
+
+  if (wocky_node_is_sealed (node))
+    return 0;
+
+  bytes = sizeof (WockyNode) +
+      (node->content != NULL ? strlen (node->content) + 1 : 0) +
+      (node->language != NULL ? strlen (node->language) + 1 : 0) +
+      wocky_node_get_n_children (node) * sizeof (WockyNode *);
+
+  wocky_node_iter_init (&iter, node, NULL, NULL);
+
+  while (wocky_node_iter_next (&iter, &child))
+    bytes += owned_bytes (child);
+
+  return bytes;
+}
+
+#define PERF_ITEMS 50
+#define PERF_RECIPIENTS 10000
+
+static gdouble
+time_forwarding (WockyStanza *event,
+    gsize *bytes)
+{
+  gdouble elapsed;
+  guint i;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_RECIPIENTS; i++)
+    {
+      WockyStanza *copy = wocky_stanza_copy (event);
+
+      wocky_node_set_attribute (wocky_stanza_get_top_node (copy), "to",
+          "juliet@example.com/balcony");
+
+      if (i == 0)
+        *bytes = owned_bytes (wocky_stanza_get_top_node (copy));
+
+      g_object_unref (copy);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  return elapsed * 1e9 / PERF_RECIPIENTS;
+}
+
+static void
+test_copy_perf (void)
+{
+  WockyStanza *event = make_event (PERF_ITEMS);
+  gsize deep_bytes, sealed_bytes;
+  gdouble deep, sealed;
+
+  deep = time_forwarding (event, &deep_bytes);
+  g_test_message ("deep copies: %.0f ns and about %" G_GSIZE_FORMAT
+      " bytes per recipient", deep, deep_bytes);
+
+  wocky_node_seal (wocky_stanza_get_top_node (event));
+  sealed = time_forwarding (event, &sealed_bytes);
+  g_test_minimized_result (sealed, "sealed copies: %.0f ns and about %"
+      G_GSIZE_FORMAT " bytes per recipient", sealed, sealed_bytes);
+
+  g_object_unref (event);
+}
+
 static void
 test_build_iq_result_simple_ack (void)
 {
@@ -818,6 +999,264 @@ test_unknown (
   g_object_unref (stanza);
 }
 
+typedef struct {
+  const gchar *name;
+  const gchar *ns;
+  WockyStanzaType type;
+} TypeCase;
+
+static const TypeCase type_cases[] = {
+  { "message", WOCKY_XMPP_NS_JABBER_CLIENT, WOCKY_STANZA_TYPE_MESSAGE },
+  { "presence", WOCKY_XMPP_NS_JABBER_CLIENT, WOCKY_STANZA_TYPE_PRESENCE },
+  { "iq", WOCKY_XMPP_NS_JABBER_CLIENT, WOCKY_STANZA_TYPE_IQ },
+  { "stream", WOCKY_XMPP_NS_STREAM, WOCKY_STANZA_TYPE_STREAM },
+  { "features", WOCKY_XMPP_NS_STREAM, WOCKY_STANZA_TYPE_STREAM_FEATURES },
+  { "auth", WOCKY_XMPP_NS_SASL_AUTH, WOCKY_STANZA_TYPE_AUTH },
+  { "challenge", WOCKY_XMPP_NS_SASL_AUTH, WOCKY_STANZA_TYPE_CHALLENGE },
+  { "response", WOCKY_XMPP_NS_SASL_AUTH, WOCKY_STANZA_TYPE_RESPONSE },
+  { "success", WOCKY_XMPP_NS_SASL_AUTH, WOCKY_STANZA_TYPE_SUCCESS },
+  { "failure", WOCKY_XMPP_NS_SASL_AUTH, WOCKY_STANZA_TYPE_FAILURE },
+  { "error", WOCKY_XMPP_NS_STREAM, WOCKY_STANZA_TYPE_STREAM_ERROR },
+  /* right names in the wrong places, and near misses */
+  { "error", WOCKY_XMPP_NS_JABBER_CLIENT, WOCKY_STANZA_TYPE_UNKNOWN },
+  { "iq", WOCKY_XMPP_NS_STREAM, WOCKY_STANZA_TYPE_UNKNOWN },
+  { "i", WOCKY_XMPP_NS_JABBER_CLIENT, WOCKY_STANZA_TYPE_UNKNOWN },
+  { "iqq", WOCKY_XMPP_NS_JABBER_CLIENT, WOCKY_STANZA_TYPE_UNKNOWN },
+  { "Message", WOCKY_XMPP_NS_JABBER_CLIENT, WOCKY_STANZA_TYPE_UNKNOWN },
+  { "presences", WOCKY_XMPP_NS_JABBER_CLIENT, WOCKY_STANZA_TYPE_UNKNOWN },
+};
+
+typedef struct {
+  const gchar *name;
+  WockyStanzaSubType sub_type;
+} SubTypeCase;
+
+static const SubTypeCase sub_type_cases[] = {
+  { NULL, WOCKY_STANZA_SUB_TYPE_NONE },
+  { "normal", WOCKY_STANZA_SUB_TYPE_NORMAL },
+  { "chat", WOCKY_STANZA_SUB_TYPE_CHAT },
+  { "groupchat", WOCKY_STANZA_SUB_TYPE_GROUPCHAT },
+  { "headline", WOCKY_STANZA_SUB_TYPE_HEADLINE },
+  { "unavailable", WOCKY_STANZA_SUB_TYPE_UNAVAILABLE },
+  { "probe", WOCKY_STANZA_SUB_TYPE_PROBE },
+  { "subscribe", WOCKY_STANZA_SUB_TYPE_SUBSCRIBE },
+  { "unsubscribe", WOCKY_STANZA_SUB_TYPE_UNSUBSCRIBE },
+  { "subscribed", WOCKY_STANZA_SUB_TYPE_SUBSCRIBED },
+  { "unsubscribed", WOCKY_STANZA_SUB_TYPE_UNSUBSCRIBED },
+  { "get", WOCKY_STANZA_SUB_TYPE_GET },
+  { "set", WOCKY_STANZA_SUB_TYPE_SET },
+  { "result", WOCKY_STANZA_SUB_TYPE_RESULT },
+  { "error", WOCKY_STANZA_SUB_TYPE_ERROR },
+  { "", WOCKY_STANZA_SUB_TYPE_UNKNOWN },
+  { "g", WOCKY_STANZA_SUB_TYPE_UNKNOWN },
+  { "ge", WOCKY_STANZA_SUB_TYPE_UNKNOWN },
+  { "available", WOCKY_STANZA_SUB_TYPE_UNKNOWN },
+  { "Chat", WOCKY_STANZA_SUB_TYPE_UNKNOWN },
+  { "subscribes", WOCKY_STANZA_SUB_TYPE_UNKNOWN },
+};
+
+static void
+test_classify (void)
+{
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (type_cases); i++)
+    for (j = 0; j < G_N_ELEMENTS (sub_type_cases); j++)
+      {
+        WockyStanza *stanza = wocky_stanza_new (type_cases[i].name,
+            type_cases[i].ns);
+        WockyStanzaType type;
+        WockyStanzaSubType sub_type;
+
+        if (sub_type_cases[j].name != NULL)
+          wocky_node_set_attribute (wocky_stanza_get_top_node (stanza),
+              "type", sub_type_cases[j].name);
+
+        wocky_stanza_get_type_info (stanza, &type, &sub_type);
+        g_assert_cmpuint (type, ==, type_cases[i].type);
+        g_assert_cmpuint (sub_type, ==, sub_type_cases[j].sub_type);
+
+        g_object_unref (stanza);
+      }
+}
+
+static void
+test_classify_invalidate (void)
+{
+  WockyStanza *stanza = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+      WOCKY_STANZA_SUB_TYPE_GET, "juliet@example.com", "romeo@example.net",
+      NULL);
+  WockyNode *top = wocky_stanza_get_top_node (stanza);
+  WockyStanza *copy;
+  WockyStanzaType type;
+  WockyStanzaSubType sub_type;
+
+  _wocky_stanza_classify (stanza);
+  wocky_stanza_get_type_info (stanza, &type, &sub_type);
+  g_assert_cmpuint (type, ==, WOCKY_STANZA_TYPE_IQ);
+  g_assert_cmpuint (sub_type, ==, WOCKY_STANZA_SUB_TYPE_GET);
+
+  /* changing any other attribute leaves the sub-type alone */
+  wocky_node_set_attribute (top, "id", "1");
+  wocky_stanza_get_type_info (stanza, NULL, &sub_type);
+  g_assert_cmpuint (sub_type, ==, WOCKY_STANZA_SUB_TYPE_GET);
+
+  wocky_node_set_attribute (top, "type", "result");
+  wocky_stanza_get_type_info (stanza, &type, &sub_type);
+  g_assert_cmpuint (type, ==, WOCKY_STANZA_TYPE_IQ);
+  g_assert_cmpuint (sub_type, ==, WOCKY_STANZA_SUB_TYPE_RESULT);
+
+  /* a copy keeps the classification, but not forever */
+  copy = wocky_stanza_copy (stanza);
+  wocky_stanza_get_type_info (copy, &type, &sub_type);
+  g_assert_cmpuint (type, ==, WOCKY_STANZA_TYPE_IQ);
+  g_assert_cmpuint (sub_type, ==, WOCKY_STANZA_SUB_TYPE_RESULT);
+
+  wocky_node_set_attribute (wocky_stanza_get_top_node (copy), "type",
+      "error");
+  wocky_stanza_get_type_info (copy, NULL, &sub_type);
+  g_assert_cmpuint (sub_type, ==, WOCKY_STANZA_SUB_TYPE_ERROR);
+  wocky_stanza_get_type_info (stanza, NULL, &sub_type);
+  g_assert_cmpuint (sub_type, ==, WOCKY_STANZA_SUB_TYPE_RESULT);
+
+  g_object_unref (copy);
+  g_object_unref (stanza);
+}
+
+/* How wocky_stanza_get_type_info() used to work it out every time */
+static GQuark reference_ns[G_N_ELEMENTS (type_cases)];
+
+static void
+reference_classify (WockyNode *node,
+    WockyStanzaType *type,
+    WockyStanzaSubType *sub_type)
+{
+  const gchar *name;
+  guint i;
+
+  *type = WOCKY_STANZA_TYPE_UNKNOWN;
+
+  for (i = 0; i < G_N_ELEMENTS (type_cases); i++)
+    if (node->ns == reference_ns[i] &&
+        strcmp (node->name, type_cases[i].name) == 0)
+      {
+        *type = type_cases[i].type;
+        break;
+      }
+
+  name = wocky_node_get_attribute (node, "type");
+  *sub_type = (name == NULL) ? WOCKY_STANZA_SUB_TYPE_NONE :
+      WOCKY_STANZA_SUB_TYPE_UNKNOWN;
+
+  for (i = 1; name != NULL && i < G_N_ELEMENTS (sub_type_cases); i++)
+    if (strcmp (name, sub_type_cases[i].name) == 0)
+      {
+        *sub_type = sub_type_cases[i].sub_type;
+        break;
+      }
+}
+
+#define PERF_STANZAS 1000
+#define PERF_ROUNDS 1000
+/* how often a stanza is typically classified on its way through a porter */
+#define PERF_LOOKUPS 4
+
+static void
+test_classify_perf (void)
+{
+  WockyStanza *stanzas[PERF_STANZAS];
+  guint i, j, k, hits;
+  gdouble elapsed;
+  WockyStanzaType type;
+  WockyStanzaSubType sub_type;
+
+  for (i = 0; i < G_N_ELEMENTS (type_cases); i++)
+    reference_ns[i] = g_quark_from_static_string (type_cases[i].ns);
+
+  /* a mix like a busy session's: mostly presence and messages */
+  for (i = 0; i < PERF_STANZAS; i++)
+    {
+      switch (i % 8)
+        {
+          case 0:
+          case 1:
+          case 2:
+            stanzas[i] = wocky_stanza_build (WOCKY_STANZA_TYPE_PRESENCE,
+                i % 8 == 0 ? WOCKY_STANZA_SUB_TYPE_UNAVAILABLE :
+                WOCKY_STANZA_SUB_TYPE_NONE, "romeo@example.net/orchard",
+                NULL, NULL);
+            break;
+          case 3:
+          case 4:
+          case 5:
+            stanzas[i] = wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+                WOCKY_STANZA_SUB_TYPE_GROUPCHAT, "room@conf.example.net/romeo",
+                NULL, '(', "body", '$', "hi", ')', NULL);
+            break;
+          case 6:
+            stanzas[i] = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+                WOCKY_STANZA_SUB_TYPE_RESULT, "example.net", NULL, NULL);
+            break;
+          default:
+            stanzas[i] = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+                WOCKY_STANZA_SUB_TYPE_GET, "example.net", NULL,
+                '(', "ping", ':', WOCKY_XMPP_NS_PING, ')', NULL);
+            break;
+        }
+    }
+
+  g_test_timer_start ();
+
+  for (k = 0, hits = 0; k < PERF_ROUNDS; k++)
+    for (i = 0; i < PERF_STANZAS; i++)
+      for (j = 0; j < PERF_LOOKUPS; j++)
+        {
+          reference_classify (wocky_stanza_get_top_node (stanzas[i]), &type,
+              &sub_type);
+          hits += (type == WOCKY_STANZA_TYPE_IQ);
+        }
+
+  elapsed = g_test_timer_elapsed ();
+  g_assert_cmpuint (hits, ==, PERF_ROUNDS * PERF_LOOKUPS * PERF_STANZAS / 4);
+  g_test_message ("linear search, %u times: %.1f ns per stanza",
+      PERF_LOOKUPS, elapsed * 1e9 / (PERF_ROUNDS * PERF_STANZAS));
+
+  g_test_timer_start ();
+
+  for (k = 0, hits = 0; k < PERF_ROUNDS; k++)
+    for (i = 0; i < PERF_STANZAS; i++)
+      for (j = 0; j < PERF_LOOKUPS; j++)
+        {
+          _wocky_stanza_classify_node (wocky_stanza_get_top_node (stanzas[i]),
+              &type, &sub_type);
+          hits += (type == WOCKY_STANZA_TYPE_IQ);
+        }
+
+  elapsed = g_test_timer_elapsed ();
+  g_assert_cmpuint (hits, ==, PERF_ROUNDS * PERF_LOOKUPS * PERF_STANZAS / 4);
+  g_test_message ("perfect hash, %u times: %.1f ns per stanza",
+      PERF_LOOKUPS, elapsed * 1e9 / (PERF_ROUNDS * PERF_STANZAS));
+
+  g_test_timer_start ();
+
+  for (k = 0, hits = 0; k < PERF_ROUNDS; k++)
+    for (i = 0; i < PERF_STANZAS; i++)
+      for (j = 0; j < PERF_LOOKUPS; j++)
+        {
+          wocky_stanza_get_type_info (stanzas[i], &type, &sub_type);
+          hits += (type == WOCKY_STANZA_TYPE_IQ);
+        }
+
+  elapsed = g_test_timer_elapsed ();
+  g_assert_cmpuint (hits, ==, PERF_ROUNDS * PERF_LOOKUPS * PERF_STANZAS / 4);
+  g_test_minimized_result (elapsed * 1e9 / (PERF_ROUNDS * PERF_STANZAS),
+      "cached, %u times: %.1f ns per stanza", PERF_LOOKUPS,
+      elapsed * 1e9 / (PERF_ROUNDS * PERF_STANZAS));
+
+  for (i = 0; i < PERF_STANZAS; i++)
+    g_object_unref (stanzas[i]);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -825,6 +1264,7 @@ main (int argc, char **argv)
 
   test_init (argc, argv);
   g_test_add_func ("/xmpp-stanza/copy", test_copy);
+  g_test_add_func ("/xmpp-stanza/copy-sealed", test_copy_sealed);
   g_test_add_func ("/xmpp-stanza/iq-result/build-simple-ack",
       test_build_iq_result_simple_ack);
   g_test_add_func ("/xmpp-stanza/iq-result/build-complex-reply",
@@ -868,6 +1308,16 @@ main (int argc, char **argv)
   g_test_add_data_func ("/xmpp-stanza/types/wrong-namespaces",
       "challenge\0this:is:not:the:sasl:namespace",
       test_unknown);
+  g_test_add_func ("/xmpp-stanza/types/classify", test_classify);
+  g_test_add_func ("/xmpp-stanza/types/classify-invalidate",
+      test_classify_invalidate);
+
+  if (g_test_perf ())
+    {
+      g_test_add_func ("/xmpp-stanza/copy-perf", test_copy_perf);
+      g_test_add_func ("/xmpp-stanza/types/classify-perf",
+          test_classify_perf);
+    }
 
   result =  g_test_run ();
   test_deinit ();
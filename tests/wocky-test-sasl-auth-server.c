@@ -55,6 +55,7 @@ typedef int (*sasl_callback_ft)(void);
 #else
 
 #define SASL_OK 0
+#define SASL_BADPROT -5
 #define SASL_BADAUTH -13
 #define SASL_NOUSER  -20
 #define CHECK_SASL_RETURN(x) \
@@ -102,6 +103,10 @@ struct _TestSaslAuthServerPrivate
   GTask *task;
   GCancellable *cancellable;
   WockySaslScram *scram;
+  /* SASL2 + FAST stand-in */
+  gchar *fast_token;
+  gboolean sasl2;
+  gboolean token_requested;
 };
 
 G_DEFINE_TYPE_WITH_CODE (TestSaslAuthServer, test_sasl_auth_server, G_TYPE_OBJECT,
@@ -182,6 +187,7 @@ test_sasl_auth_server_finalize (GObject *object)
   g_free (priv->password);
   g_free (priv->mech);
   g_free (priv->selected_mech);
+  g_free (priv->fast_token);
 
   G_OBJECT_CLASS (test_sasl_auth_server_parent_class)->finalize (object);
 }
@@ -334,19 +340,10 @@ post_auth_features_sent (GObject *source,
 }
 
 static void
-post_auth_open_sent (GObject *source,
-    GAsyncResult *result,
-    gpointer user_data)
+post_auth_send_features (TestSaslAuthServer *tsas,
+    WockyXmppConnection *conn)
 {
-  TestSaslAuthServer *tsas = TEST_SASL_AUTH_SERVER (user_data);
   TestSaslAuthServerPrivate *priv = tsas->priv;
-  gboolean ok;
-  GError *error = NULL;
-
-  ok = wocky_xmpp_connection_send_open_finish (
-    WOCKY_XMPP_CONNECTION (source), result, &error);
-  g_assert_no_error (error);
-  g_assert (ok);
 
   /* if our caller wanted control back, hand it back here: */
   if (priv->task != NULL)
@@ -366,12 +363,29 @@ post_auth_open_sent (GObject *source,
   else
     {
       WockyStanza *s = wocky_stanza_new ("features", WOCKY_XMPP_NS_STREAM);
-      wocky_xmpp_connection_send_stanza_async (WOCKY_XMPP_CONNECTION (source),
-          s, NULL, post_auth_features_sent, user_data);
+      wocky_xmpp_connection_send_stanza_async (conn,
+          s, NULL, post_auth_features_sent, tsas);
       g_object_unref (s);
     }
 }
 
+static void
+post_auth_open_sent (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  gboolean ok;
+  GError *error = NULL;
+
+  ok = wocky_xmpp_connection_send_open_finish (
+    WOCKY_XMPP_CONNECTION (source), result, &error);
+  g_assert_no_error (error);
+  g_assert (ok);
+
+  post_auth_send_features (TEST_SASL_AUTH_SERVER (user_data),
+      WOCKY_XMPP_CONNECTION (source));
+}
+
 static void
 post_auth_open_received (GObject *source,
     GAsyncResult *result,
@@ -423,6 +437,13 @@ success_sent (GObject *source,
       return;
     }
 
+  /* no stream restart after SASL2 */
+  if (priv->sasl2)
+    {
+      post_auth_send_features (tsas, WOCKY_XMPP_CONNECTION (source));
+      return;
+    }
+
   wocky_xmpp_connection_reset (WOCKY_XMPP_CONNECTION (source));
 
   wocky_xmpp_connection_recv_open_async (WOCKY_XMPP_CONNECTION (source),
@@ -438,8 +459,34 @@ auth_succeeded (TestSaslAuthServer *self, const gchar *challenge)
   g_assert_cmpint (priv->state, <, AUTH_STATE_AUTHENTICATED);
   priv->state = AUTH_STATE_AUTHENTICATED;
 
-  s = wocky_stanza_new ("success", WOCKY_XMPP_NS_SASL_AUTH);
-  wocky_node_set_content (wocky_stanza_get_top_node (s), challenge);
+  if (priv->sasl2)
+    {
+      WockyNode *top;
+
+      s = wocky_stanza_new ("success", WOCKY_XMPP_NS_SASL2);
+      top = wocky_stanza_get_top_node (s);
+
+      if (challenge != NULL)
+        wocky_node_add_child_with_content (top, "additional-data",
+            challenge);
+
+      wocky_node_add_child_with_content (top, "authorization-identifier",
+          priv->username);
+
+      if (priv->token_requested && priv->fast_token != NULL)
+        {
+          WockyNode *token = wocky_node_add_child_ns (top, "token",
+              WOCKY_XMPP_NS_FAST);
+
+          wocky_node_set_attribute (token, "expiry", "2100-01-01T00:00:00Z");
+          wocky_node_set_attribute (token, "token", priv->fast_token);
+        }
+    }
+  else
+    {
+      s = wocky_stanza_new ("success", WOCKY_XMPP_NS_SASL_AUTH);
+      wocky_node_set_content (wocky_stanza_get_top_node (s), challenge);
+    }
 
   wocky_xmpp_connection_send_stanza_async (priv->conn, s, NULL,
     success_sent, self);
@@ -486,10 +533,19 @@ not_authorized (TestSaslAuthServer *self)
   g_assert_cmpint (priv->state, <, AUTH_STATE_AUTHENTICATED);
   priv->state = AUTH_STATE_AUTHENTICATED;
 
-  s = wocky_stanza_build (WOCKY_STANZA_TYPE_FAILURE,
-    WOCKY_STANZA_SUB_TYPE_NONE, NULL, NULL,
-      '(', "not-authorized", ')',
-    NULL);
+  if (priv->sasl2)
+    {
+      s = wocky_stanza_new ("failure", WOCKY_XMPP_NS_SASL2);
+      wocky_node_add_child_ns (wocky_stanza_get_top_node (s),
+          "not-authorized", WOCKY_XMPP_NS_SASL_AUTH);
+    }
+  else
+    {
+      s = wocky_stanza_build (WOCKY_STANZA_TYPE_FAILURE,
+        WOCKY_STANZA_SUB_TYPE_NONE, NULL, NULL,
+          '(', "not-authorized", ')',
+        NULL);
+    }
   /* Ensure we have something to handle the callback at the end of the test */
   g_object_ref (self);
   wocky_xmpp_connection_send_stanza_async (priv->conn, s, priv->cancellable,
@@ -720,8 +776,8 @@ handle_auth (TestSaslAuthServer *self, WockyStanza *stanza)
 {
   TestSaslAuthServerPrivate *priv = self->priv;
   guchar *response = NULL;
-  const gchar *challenge;
-  unsigned challenge_len;
+  const gchar *challenge = NULL;
+  unsigned challenge_len = 0;
   gsize response_len = 0;
   int ret;
   WockyNode *auth = wocky_stanza_get_top_node (stanza);
@@ -940,7 +996,8 @@ handle_auth (TestSaslAuthServer *self, WockyStanza *stanza)
           challenge64 = g_base64_encode ((guchar *) challenge, challenge_len);
         }
 
-      c = wocky_stanza_new ("challenge", WOCKY_XMPP_NS_SASL_AUTH);
+      c = wocky_stanza_new ("challenge", priv->sasl2 ?
+          WOCKY_XMPP_NS_SASL2 : WOCKY_XMPP_NS_SASL_AUTH);
       wocky_node_set_content (wocky_stanza_get_top_node (c), challenge64);
       wocky_xmpp_connection_send_stanza_async (priv->conn, c,
         NULL, NULL, NULL);
@@ -1036,8 +1093,8 @@ handle_response (TestSaslAuthServer *self, WockyStanza *stanza)
 {
   TestSaslAuthServerPrivate * priv = self->priv;
   guchar *response = NULL;
-  const gchar *challenge;
-  unsigned challenge_len;
+  const gchar *challenge = NULL;
+  unsigned challenge_len = 0;
   gsize response_len = 0;
   int ret;
 
@@ -1152,14 +1209,16 @@ handle_response (TestSaslAuthServer *self, WockyStanza *stanza)
         }
 
       if (priv->state == AUTH_STATE_FINAL_CHALLENGE &&
-          (priv->problem == SERVER_PROBLEM_FINAL_DATA_IN_SUCCESS
+          (priv->sasl2
+           || priv->problem == SERVER_PROBLEM_FINAL_DATA_IN_SUCCESS
            || priv->problem == SERVER_PROBLEM_SCRAMBLED_BINDING))
         {
           auth_succeeded (self, challenge64);
         }
       else
         {
-          c = wocky_stanza_new ("challenge", WOCKY_XMPP_NS_SASL_AUTH);
+          c = wocky_stanza_new ("challenge", priv->sasl2 ?
+              WOCKY_XMPP_NS_SASL2 : WOCKY_XMPP_NS_SASL_AUTH);
           wocky_node_set_content (wocky_stanza_get_top_node (c),
               challenge64);
           wocky_xmpp_connection_send_stanza_async (priv->conn, c,
@@ -1182,6 +1241,114 @@ out:
 }
 
 
+static GByteArray *
+token_hash (TestSaslAuthServer *self, const gchar *label)
+{
+  TestSaslAuthServerPrivate *priv = self->priv;
+  GHmac *hmac = g_hmac_new (G_CHECKSUM_SHA256, (guchar *) priv->fast_token,
+      strlen (priv->fast_token));
+  GByteArray *hash = g_byte_array_sized_new (32);
+  gsize len = 32;
+
+  g_byte_array_set_size (hash, len);
+  g_hmac_update (hmac, (guchar *) label, -1);
+  g_hmac_get_digest (hmac, hash->data, &len);
+  g_hmac_unref (hmac);
+
+  return hash;
+}
+
+static void
+handle_token_auth (TestSaslAuthServer *self, const gchar *initial_response)
+{
+  TestSaslAuthServerPrivate *priv = self->priv;
+  guchar *response = NULL;
+  gsize response_len = 0;
+  gsize user_len;
+  GByteArray *expected;
+  gboolean ok = FALSE;
+
+  g_assert_nonnull (priv->fast_token);
+  g_assert_nonnull (initial_response);
+
+  response = g_base64_decode (initial_response, &response_len);
+  user_len = strnlen ((gchar *) response, response_len);
+  expected = token_hash (self, "Initiator");
+
+  if (user_len + 1 + expected->len == response_len &&
+      !wocky_strdiff ((gchar *) response, priv->username) &&
+      memcmp (response + user_len + 1, expected->data, expected->len) == 0)
+    ok = TRUE;
+
+  g_byte_array_unref (expected);
+  g_free (response);
+
+  if (ok)
+    {
+      GByteArray *proof = token_hash (self, "Responder");
+      gchar *proof64 = g_base64_encode (proof->data, proof->len);
+
+      auth_succeeded (self, proof64);
+
+      g_free (proof64);
+      g_byte_array_unref (proof);
+    }
+  else
+    {
+      /* refuse the token but stay around for the password fallback */
+      WockyStanza *s = wocky_stanza_new ("failure", WOCKY_XMPP_NS_SASL2);
+
+      wocky_node_add_child_ns (wocky_stanza_get_top_node (s),
+          "not-authorized", WOCKY_XMPP_NS_SASL_AUTH);
+      wocky_xmpp_connection_send_stanza_async (priv->conn, s, NULL,
+          NULL, NULL);
+      g_object_unref (s);
+
+      priv->state = AUTH_STATE_STARTED;
+    }
+}
+
+static void
+handle_authenticate (TestSaslAuthServer *self, WockyStanza *stanza)
+{
+  TestSaslAuthServerPrivate *priv = self->priv;
+  WockyNode *top = wocky_stanza_get_top_node (stanza);
+  const gchar *mech = wocky_node_get_attribute (top, "mechanism");
+  const gchar *initial = wocky_node_get_content_from_child (top,
+      "initial-response");
+  WockyStanza *auth;
+
+  g_assert_cmpstr (wocky_node_get_ns (top), ==, WOCKY_XMPP_NS_SASL2);
+  g_assert_cmpint (priv->state, ==, AUTH_STATE_STARTED);
+
+  priv->sasl2 = TRUE;
+  priv->token_requested =
+    (wocky_node_get_child_ns (top, "request-token", WOCKY_XMPP_NS_FAST)
+        != NULL);
+
+  if (!wocky_strdiff (mech, WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE))
+    {
+      g_assert_nonnull (wocky_node_get_child_ns (top, "fast",
+          WOCKY_XMPP_NS_FAST));
+
+      g_free (priv->selected_mech);
+      priv->selected_mech = g_strdup (mech);
+      handle_token_auth (self, initial);
+      return;
+    }
+
+  /* Everything else takes the same path as plain old SASL */
+  auth = wocky_stanza_new ("auth", WOCKY_XMPP_NS_SASL_AUTH);
+  wocky_node_set_attribute (wocky_stanza_get_top_node (auth), "mechanism",
+      mech);
+
+  if (wocky_strdiff (initial, "="))
+    wocky_node_set_content (wocky_stanza_get_top_node (auth), initial);
+
+  handle_auth (self, auth);
+  g_object_unref (auth);
+}
+
 #define HANDLE(x) { #x, handle_##x }
 static void
 received_stanza (GObject *source,
@@ -1196,7 +1363,8 @@ received_stanza (GObject *source,
   struct {
     const gchar *name;
     void (*func)(TestSaslAuthServer *self, WockyStanza *stanza);
-  } handlers[] = { HANDLE(auth), HANDLE(response), { NULL, NULL } };
+  } handlers[] = { HANDLE(auth), HANDLE(response), HANDLE(authenticate),
+      { NULL, NULL } };
 
   stanza = wocky_xmpp_connection_recv_stanza_finish (
       WOCKY_XMPP_CONNECTION (source), result, &error);
@@ -1216,7 +1384,9 @@ received_stanza (GObject *source,
   g_assert (stanza != NULL);
 
   if (wocky_strdiff (wocky_node_get_ns (
-        wocky_stanza_get_top_node (stanza)), WOCKY_XMPP_NS_SASL_AUTH))
+        wocky_stanza_get_top_node (stanza)), WOCKY_XMPP_NS_SASL_AUTH)
+      && wocky_strdiff (wocky_node_get_ns (
+        wocky_stanza_get_top_node (stanza)), WOCKY_XMPP_NS_SASL2))
     {
       g_assert_not_reached ();
     }
@@ -1472,9 +1642,40 @@ test_sasl_auth_server_set_mechs (GObject *obj,
             }
         }
     }
+
+  /* Offer the same mechanisms over SASL2, plus FAST */
+  if (priv->fast_token != NULL && mechnode != NULL)
+    {
+      WockyNode *auth, *fast, *mech;
+      WockyNodeIter iter;
+
+      auth = wocky_node_add_child_ns (wocky_stanza_get_top_node (feat),
+          "authentication", WOCKY_XMPP_NS_SASL2);
+
+      wocky_node_iter_init (&iter, mechnode, "mechanism", NULL);
+      while (wocky_node_iter_next (&iter, &mech))
+        wocky_node_add_child_with_content (auth, "mechanism", mech->content);
+
+      fast = wocky_node_add_child_ns (wocky_node_add_child (auth, "inline"),
+          "fast", WOCKY_XMPP_NS_FAST);
+      wocky_node_add_child_with_content (fast, "mechanism",
+          WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE);
+    }
+
   return ret;
 }
 
+/* Advertise SASL2 with FAST, accepting and handing out @token */
+void
+test_sasl_auth_server_set_fast_token (TestSaslAuthServer *self,
+    const gchar *token)
+{
+  TestSaslAuthServerPrivate *priv = self->priv;
+
+  g_free (priv->fast_token);
+  priv->fast_token = g_strdup (token);
+}
+
 const gchar *
 test_sasl_auth_server_get_selected_mech (TestSaslAuthServer *self)
 {
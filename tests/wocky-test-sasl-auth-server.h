@@ -104,6 +104,9 @@ void test_sasl_auth_server_stop (TestSaslAuthServer *self);
 gint test_sasl_auth_server_set_mechs (GObject *obj, WockyStanza *feat,
     const gchar *must);
 
+void test_sasl_auth_server_set_fast_token (TestSaslAuthServer *self,
+    const gchar *token);
+
 G_END_DECLS
 
 #endif /* #ifndef __TEST_SASL_AUTH_SERVER_H__*/
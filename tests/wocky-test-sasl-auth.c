@@ -36,6 +36,108 @@ gboolean run_done = FALSE;
 test_t *current_test = NULL;
 GError *error = NULL;
 
+/* A credential store keeping a single token in memory */
+typedef struct {
+  GObject parent;
+  WockyFastToken *token;
+  gchar *key;
+} TestCredentialStore;
+
+typedef struct {
+  GObjectClass parent_class;
+} TestCredentialStoreClass;
+
+static GType test_credential_store_get_type (void);
+static void credential_store_iface_init (gpointer g_iface);
+
+G_DEFINE_TYPE_WITH_CODE (TestCredentialStore, test_credential_store,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (WOCKY_TYPE_CREDENTIAL_STORE,
+        credential_store_iface_init))
+
+static void
+test_credential_store_finalize (GObject *object)
+{
+  TestCredentialStore *self = (TestCredentialStore *) object;
+
+  wocky_fast_token_free (self->token);
+  g_free (self->key);
+
+  G_OBJECT_CLASS (test_credential_store_parent_class)->finalize (object);
+}
+
+static void
+test_credential_store_class_init (TestCredentialStoreClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = test_credential_store_finalize;
+}
+
+static void
+test_credential_store_init (TestCredentialStore *self)
+{
+}
+
+static WockyFastToken *
+store_get_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server)
+{
+  TestCredentialStore *self = (TestCredentialStore *) store;
+  gchar *key = g_strdup_printf ("%s@%s", username, server);
+  WockyFastToken *token = NULL;
+
+  if (self->token != NULL && !wocky_strdiff (key, self->key))
+    token = wocky_fast_token_copy (self->token);
+
+  g_free (key);
+  return token;
+}
+
+static void
+store_set_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server,
+    const WockyFastToken *token)
+{
+  TestCredentialStore *self = (TestCredentialStore *) store;
+
+  wocky_fast_token_free (self->token);
+  g_free (self->key);
+  self->token = wocky_fast_token_copy (token);
+  self->key = g_strdup_printf ("%s@%s", username, server);
+}
+
+static void
+store_forget_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server)
+{
+  TestCredentialStore *self = (TestCredentialStore *) store;
+
+  wocky_fast_token_free (self->token);
+  self->token = NULL;
+}
+
+static gchar *
+store_dup_user_agent_id (WockyCredentialStore *store)
+{
+  return g_strdup ("d4565fa7-4d72-4749-b3d3-740edbf87770");
+}
+
+static void
+credential_store_iface_init (gpointer g_iface)
+{
+  WockyCredentialStoreIface *iface = g_iface;
+
+  iface->get_token_func = store_get_token;
+  iface->set_token_func = store_set_token;
+  iface->forget_token_func = store_forget_token;
+  iface->dup_user_agent_id_func = store_dup_user_agent_id;
+}
+
+/* NULL if the test doesn't use SASL2 */
+TestCredentialStore *credential_store = NULL;
+
 static void
 post_auth_recv_stanza (GObject *source,
   GAsyncResult *result,
@@ -106,6 +208,24 @@ post_auth_open_sent (GObject *source,
     NULL, post_auth_open_received, user_data);
 }
 
+static void
+post_sasl2_features_received (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  WockyStanza *stanza;
+
+  stanza = wocky_xmpp_connection_recv_stanza_finish (
+    WOCKY_XMPP_CONNECTION (source), result, NULL);
+  g_assert (stanza != NULL);
+  g_assert (wocky_stanza_has_type (stanza,
+      WOCKY_STANZA_TYPE_STREAM_FEATURES));
+  g_object_unref (stanza);
+
+  wocky_xmpp_connection_send_close_async (WOCKY_XMPP_CONNECTION (source),
+    NULL, post_auth_close_sent, user_data);
+}
+
 static void
 sasl_auth_finished_cb (GObject *source,
     GAsyncResult *res,
@@ -119,6 +239,14 @@ sasl_auth_finished_cb (GObject *source,
     {
       authenticated = TRUE;
 
+      /* no stream restart after SASL2, just the new features */
+      if (wocky_sasl_auth_is_sasl2 (WOCKY_SASL_AUTH (source)))
+        {
+          wocky_xmpp_connection_recv_stanza_async (conn, NULL,
+              post_sasl2_features_received, NULL);
+          return;
+        }
+
       wocky_xmpp_connection_reset (conn);
 
       wocky_xmpp_connection_send_open_async (conn,
@@ -158,6 +286,9 @@ feature_stanza_received (GObject *source,
 
   g_object_get (sasl, "auth-registry", &auth_registry, NULL);
 
+  if (credential_store != NULL)
+    g_object_set (auth_registry, "credential-store", credential_store, NULL);
+
   test_handler = WOCKY_AUTH_HANDLER (wocky_test_sasl_handler_new ());
   wocky_auth_registry_add_handler (auth_registry, test_handler);
 
@@ -201,17 +332,21 @@ stream_open_sent (GObject *source,
 }
 
 static void
-run_test (gconstpointer user_data)
+run_test_full (test_t *test,
+    const gchar *fast_token,
+    gchar **selected_mech)
 {
   TestSaslAuthServer *server;
   WockyTestStream *stream;
-  test_t *test = (test_t *) user_data;
 
   stream = g_object_new (WOCKY_TYPE_TEST_STREAM, NULL);
 
   server = test_sasl_auth_server_new (stream->stream0, test->mech,
       test->username, test->password, test->servername, test->problem, TRUE);
 
+  if (fast_token != NULL)
+    test_sasl_auth_server_set_fast_token (server, fast_token);
+
   authenticated = FALSE;
   run_done = FALSE;
   current_test = test;
@@ -236,6 +371,10 @@ run_test (gconstpointer user_data)
 
   test_sasl_auth_server_stop (server);
 
+  if (selected_mech != NULL)
+    *selected_mech = g_strdup (
+        test_sasl_auth_server_get_selected_mech (server));
+
   g_object_unref (server);
   g_object_unref (stream);
   g_object_unref (conn);
@@ -257,6 +396,62 @@ run_test (gconstpointer user_data)
   error = NULL;
 }
 
+static void
+run_test (gconstpointer user_data)
+{
+  run_test_full ((test_t *) user_data, NULL, NULL);
+}
+
+#define FAST_SERVER_TOKEN "WXZzciBwYmFndmdhaGUgamJhcWVyZmhlIHNiZSBzdXJ2ZS4="
+
+typedef struct {
+  gchar *description;
+  const gchar *stored_token;
+  gint64 stored_expiry;
+  const gchar *expected_mech;
+} fast_test_t;
+
+static void
+run_fast_test (gconstpointer user_data)
+{
+  const fast_test_t *fast = user_data;
+  test_t test = { NULL, "SCRAM-SHA-512-PLUS", TRUE, 0, 0,
+      SERVER_PROBLEM_NO_PROBLEM, FALSE, FALSE,
+      "test", "test123", "example.com" };
+  WockyFastToken *token;
+  gchar *selected_mech = NULL;
+
+  credential_store = g_object_new (test_credential_store_get_type (), NULL);
+
+  if (fast->stored_token != NULL)
+    {
+      token = wocky_fast_token_new (WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE,
+          fast->stored_token, fast->stored_expiry);
+      wocky_credential_store_set_token (
+          WOCKY_CREDENTIAL_STORE (credential_store),
+          test.username, test.servername, token);
+      wocky_fast_token_free (token);
+    }
+
+  run_test_full (&test, FAST_SERVER_TOKEN, &selected_mech);
+
+  g_assert_cmpstr (selected_mech, ==, fast->expected_mech);
+
+  /* Whichever way we got in, we now hold the server's current token */
+  token = wocky_credential_store_get_token (
+      WOCKY_CREDENTIAL_STORE (credential_store),
+      test.username, test.servername);
+  g_assert (token != NULL);
+  g_assert_cmpstr (token->mechanism, ==,
+      WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE);
+  g_assert_cmpstr (token->secret, ==, FAST_SERVER_TOKEN);
+  g_assert (!wocky_fast_token_has_expired (token));
+  wocky_fast_token_free (token);
+
+  g_free (selected_mech);
+  g_clear_object (&credential_store);
+}
+
 #define SUCCESS(desc, mech, allow_plain) \
  { desc, mech, allow_plain, 0, 0, SERVER_PROBLEM_NO_PROBLEM, FALSE, FALSE, \
   "test", "test123", NULL }
@@ -343,6 +538,20 @@ main (int argc,
       "ripley", "open sesame", "mother" },
   };
 
+  fast_test_t fast_tests[] = {
+    /* no token yet: authenticate with SCRAM over SASL2, ask for one */
+    { "/xmpp-sasl/fast/request-token", NULL, 0, "SCRAM-SHA-512-PLUS" },
+    /* reconnect with the token instead of the password */
+    { "/xmpp-sasl/fast/token-auth", FAST_SERVER_TOKEN, 0,
+      WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE },
+    /* the server forgot our token: fall back to SCRAM and get a new one */
+    { "/xmpp-sasl/fast/refused-token", "c3RhbGU=", 0,
+      "SCRAM-SHA-512-PLUS" },
+    /* an expired token isn't even tried */
+    { "/xmpp-sasl/fast/expired-token", FAST_SERVER_TOKEN, 1,
+      "SCRAM-SHA-512-PLUS" },
+  };
+
   test_init (argc, argv);
 
   mainloop = g_main_loop_new (NULL, FALSE);
@@ -351,6 +560,10 @@ main (int argc,
     g_test_add_data_func (tests[i].description,
         &tests[i], run_test);
 
+  for (i = 0; i < G_N_ELEMENTS (fast_tests); i++)
+    g_test_add_data_func (fast_tests[i].description,
+        &fast_tests[i], run_fast_test);
+
   result = g_test_run ();
   test_deinit ();
   return result;
@@ -60,6 +60,8 @@ typedef struct {
   WockyTestStreamWriteMode mode;
   GError *write_error /* no, this is not a coding style violation */;
   gboolean dispose_has_run;
+  guint n_writes;
+  gsize n_bytes;
 } WockyTestOutputStream;
 
 typedef struct {
@@ -621,6 +623,8 @@ wocky_test_output_stream_write (GOutputStream *stream, const void *buffer,
   g_assert_nonnull (buffer);
 
   g_async_queue_push (self->queue, data);
+  self->n_writes++;
+  self->n_bytes += written;
   g_signal_emit (self, output_signals[OUTPUT_DATA_WRITTEN], 0);
 
   return written;
@@ -746,6 +750,17 @@ wocky_test_output_stream_set_write_error (GOutputStream *stream)
        "write error");
 }
 
+void
+wocky_test_output_stream_get_stats (GOutputStream *stream,
+    guint *n_writes,
+    gsize *n_bytes)
+{
+  WockyTestOutputStream *self = WOCKY_TEST_OUTPUT_STREAM (stream);
+
+  *n_writes = self->n_writes;
+  *n_bytes = self->n_bytes;
+}
+
 static gboolean
 wocky_test_output_stream_is_writable (GPollableOutputStream *pollable)
 {
@@ -68,6 +68,12 @@ void wocky_test_input_stream_set_read_error (GInputStream *stream);
 
 void wocky_test_output_stream_set_write_error (GOutputStream *stream);
 
+/* How many successful writes have been made to @stream, and of how many
+ * bytes in all */
+void wocky_test_output_stream_get_stats (GOutputStream *stream,
+    guint *n_writes,
+    gsize *n_bytes);
+
 void wocky_test_stream_cork (GInputStream *stream, gboolean cork);
 
 typedef enum {
@@ -0,0 +1,348 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <wocky/wocky.h>
+
+/* We're being naughty and using an internal header to test each of the
+ * validators, not just the one this machine happens to pick. */
+#define WOCKY_COMPILATION
+#include <wocky/wocky-utf8-internal.h>
+#undef WOCKY_COMPILATION
+
+#include "wocky-test-helper.h"
+
+/* What g_utf8_validate () thinks is the valid prefix of @str */
+static gsize
+reference_validate (const gchar *str,
+    gsize len)
+{
+  const gchar *end;
+
+  g_utf8_validate (str, len, &end);
+  return end - str;
+}
+
+/* How wocky sanitized strings before it had its own validators */
+static gchar *
+reference_make_valid (const gchar *str,
+    gssize len)
+{
+  const gchar *remainder = str;
+  GString *result;
+  const gchar *endp;
+  gssize left = len;
+
+  if (left < 0)
+    left = strlen (remainder);
+
+  result = g_string_sized_new (left);
+
+  while (!g_utf8_validate (remainder, left, &endp))
+    {
+      g_string_append_len (result, remainder, endp - remainder);
+      g_string_append (result, "\357\277\275");
+      left -= (endp - remainder);
+
+      remainder = g_utf8_find_next_char (endp, endp + left);
+
+      if (remainder == NULL)
+        left = 0;
+      else if (left > 0)
+        left -= (remainder - endp);
+    }
+
+  g_string_append_len (result, remainder, left);
+  return g_string_free (result, FALSE);
+}
+
+static void
+check_all (const gchar *str,
+    gsize len)
+{
+  gsize expected = reference_validate (str, len);
+  const gchar *end;
+  gchar *valid, *reference;
+  guint impl;
+
+  for (impl = 0; impl < WOCKY_UTF8_N_IMPLS; impl++)
+    {
+      gsize got;
+
+      if (!_wocky_utf8_impl_is_supported (impl))
+        continue;
+
+      got = _wocky_utf8_validate_with (impl, str, len);
+
+      if (got != expected)
+        g_error ("%s validator: valid prefix of %" G_GSIZE_FORMAT
+            " bytes, expected %" G_GSIZE_FORMAT,
+            _wocky_utf8_impl_get_name (impl), got, expected);
+    }
+
+  g_assert_cmpint (_wocky_utf8_validate (str, len, &end), ==,
+      expected == len);
+  g_assert_cmpuint (end - str, ==, expected);
+
+  valid = _wocky_utf8_make_valid (str, len);
+  reference = reference_make_valid (str, len);
+  g_assert_cmpstr (valid, ==, reference);
+  g_assert (g_utf8_validate (valid, -1, NULL));
+  g_free (valid);
+  g_free (reference);
+}
+
+static void
+append_random_char (GString *s,
+    GRand *rand)
+{
+  gunichar c;
+  gint kind = g_rand_int_range (rand, 0, 10);
+
+  /* mostly ASCII, like most XMPP traffic, with some of everything else */
+  if (kind < 5)
+    c = g_rand_int_range (rand, 1, 0x80);
+  else if (kind < 7)
+    c = g_rand_int_range (rand, 0x80, 0x800);
+  else if (kind < 9)
+    c = g_rand_int_range (rand, 0x800, 0x10000);
+  else
+    c = g_rand_int_range (rand, 0x10000, 0x110000);
+
+  if (c >= 0xd800 && c < 0xe000)
+    c = 0xfffd;
+
+  g_string_append_unichar (s, c);
+}
+
+static void
+test_random (void)
+{
+  GRand *rand = g_rand_new_with_seed (0x5eed);
+  guint i;
+
+  for (i = 0; i < 20000; i++)
+    {
+      GString *s = g_string_new (NULL);
+      guint n = g_rand_int_range (rand, 0, 100);
+      guint j;
+
+      while (n-- > 0)
+        append_random_char (s, rand);
+
+      check_all (s->str, s->len);
+
+      /* then break it in a few random places */
+      for (j = g_rand_int_range (rand, 0, 4); j > 0 && s->len > 0; j--)
+        {
+          gsize pos = g_rand_int_range (rand, 0, s->len);
+
+          switch (g_rand_int_range (rand, 0, 3))
+            {
+              case 0:
+                s->str[pos] = g_rand_int_range (rand, 0, 256);
+                break;
+              case 1:
+                s->str[pos] = 0x80 | g_rand_int_range (rand, 0, 0x40);
+                break;
+              default:
+                g_string_truncate (s, pos);
+                break;
+            }
+        }
+
+      check_all (s->str, s->len);
+      g_string_free (s, TRUE);
+    }
+
+  g_rand_free (rand);
+}
+
+static const gchar *invalid[] = {
+    "\x80",                 /* lone continuation byte */
+    "\xbf",
+    "\xc0\xaf",             /* overlong '/' */
+    "\xc1\xbf",
+    "\xe0\x80\xaf",
+    "\xe0\x9f\xbf",
+    "\xf0\x80\x80\xaf",
+    "\xf0\x8f\xbf\xbf",
+    "\xed\xa0\x80",         /* surrogates */
+    "\xed\xbf\xbf",
+    "\xf4\x90\x80\x80",     /* beyond U+10FFFF */
+    "\xf5\x80\x80\x80",
+    "\xff",
+    "\xfe",
+    "\xc3",                 /* truncated */
+    "\xe2\x82",
+    "\xf0\x9f\x98",
+    "\xc3\x28",             /* bad continuation */
+    "\xe2\x28\xa1",
+    "\xf0\x28\x8c\xbc",
+    NULL
+};
+
+static void
+test_invalid (void)
+{
+  guint i;
+
+  for (i = 0; invalid[i] != NULL; i++)
+    {
+      gsize bad_len = strlen (invalid[i]);
+      gsize pos;
+
+      /* put the bad sequence everywhere around the vector block sizes, with
+       * ASCII or multibyte padding either side */
+      for (pos = 0; pos < 70; pos++)
+        {
+          GString *ascii = g_string_new (NULL);
+          GString *multi = g_string_new (NULL);
+          gsize j;
+
+          for (j = 0; j < pos; j++)
+            g_string_append_c (ascii, 'a' + j % 26);
+
+          while (multi->len < pos)
+            g_string_append (multi,
+                multi->len % 3 ? "\xc3\xa9" : "\xe2\x82\xac");
+
+          g_string_append_len (ascii, invalid[i], bad_len);
+          g_string_append_len (multi, invalid[i], bad_len);
+          check_all (ascii->str, ascii->len);
+          check_all (multi->str, multi->len);
+
+          g_string_append (ascii, "and then some perfectly good text \xc3\xa9");
+          g_string_append (multi, "and then some perfectly good text \xc3\xa9");
+          check_all (ascii->str, ascii->len);
+          check_all (multi->str, multi->len);
+
+          g_string_free (ascii, TRUE);
+          g_string_free (multi, TRUE);
+        }
+    }
+}
+
+static void
+test_nul (void)
+{
+  static const gchar with_nul[] = "0123456789abcdef0123456789abcdef\0tail";
+  const gchar *end;
+
+  /* an explicit length doesn't make a nul valid */
+  g_assert (!_wocky_utf8_validate (with_nul, sizeof (with_nul) - 1, &end));
+  g_assert (end == with_nul + 32);
+  check_all (with_nul, sizeof (with_nul) - 1);
+
+  /* but with -1 it's just where the string ends */
+  g_assert (_wocky_utf8_validate (with_nul, -1, &end));
+  g_assert (end == with_nul + 32);
+}
+
+static void
+test_make_valid (void)
+{
+  WockyNode *node;
+  gchar *s;
+
+  s = _wocky_utf8_make_valid ("caf\xc3\xa9", -1);
+  g_assert_cmpstr (s, ==, "caf\xc3\xa9");
+  g_free (s);
+
+  /* a bad byte, and the continuation bytes following it, become one U+FFFD */
+  s = _wocky_utf8_make_valid ("a\xe2\x28\xa1z", -1);
+  g_assert_cmpstr (s, ==, "a\357\277\275(\357\277\275z");
+  g_free (s);
+
+  s = _wocky_utf8_make_valid ("a\xf0\x9f\x98", 4);
+  g_assert_cmpstr (s, ==, "a\357\277\275");
+  g_free (s);
+
+  /* and it's what nodes do with what they're given */
+  node = wocky_node_new ("x", "urn:example");
+  wocky_node_set_content (node, "bad \xff content");
+  g_assert_cmpstr (node->content, ==, "bad \357\277\275 content");
+  wocky_node_free (node);
+}
+
+#define PERF_LEN (1024 * 1024)
+#define PERF_ROUNDS 200
+
+static void
+time_validators (const gchar *what,
+    const gchar *str,
+    gsize len)
+{
+  gdouble elapsed;
+  guint impl, i;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ROUNDS; i++)
+    g_assert (g_utf8_validate (str, len, NULL));
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_message ("%s, g_utf8_validate: %.2f GB/s", what,
+      len * (gdouble) PERF_ROUNDS / elapsed / 1e9);
+
+  for (impl = 0; impl < WOCKY_UTF8_N_IMPLS; impl++)
+    {
+      if (!_wocky_utf8_impl_is_supported (impl))
+        continue;
+
+      g_test_timer_start ();
+
+      for (i = 0; i < PERF_ROUNDS; i++)
+        g_assert_cmpuint (_wocky_utf8_validate_with (impl, str, len), ==, len);
+
+      elapsed = g_test_timer_elapsed ();
+      g_test_maximized_result (len * (gdouble) PERF_ROUNDS / elapsed / 1e9,
+          "%s, %s: %.2f GB/s", what, _wocky_utf8_impl_get_name (impl),
+          len * (gdouble) PERF_ROUNDS / elapsed / 1e9);
+    }
+}
+
+static void
+test_perf (void)
+{
+  GRand *rand = g_rand_new_with_seed (42);
+  GString *ascii = g_string_sized_new (PERF_LEN);
+  GString *mixed = g_string_sized_new (PERF_LEN + 4);
+
+  while (ascii->len < PERF_LEN)
+    g_string_append_c (ascii, g_rand_int_range (rand, 0x20, 0x7f));
+
+  while (mixed->len < PERF_LEN)
+    append_random_char (mixed, rand);
+
+  time_validators ("ASCII", ascii->str, ascii->len);
+  time_validators ("mixed", mixed->str, mixed->len);
+
+  g_string_free (ascii, TRUE);
+  g_string_free (mixed, TRUE);
+  g_rand_free (rand);
+}
+
+int
+main (int argc, char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/utf8/random", test_random);
+  g_test_add_func ("/utf8/invalid", test_invalid);
+  g_test_add_func ("/utf8/nul", test_nul);
+  g_test_add_func ("/utf8/make-valid", test_make_valid);
+
+  if (g_test_perf ())
+    g_test_add_func ("/utf8/perf", test_perf);
+
+  result = g_test_run ();
+  test_deinit ();
+  return result;
+}
@@ -186,6 +186,74 @@ test_send_simple_message (void)
   teardown_test (test);
 }
 
+static void
+send_bytes_received_cb (GObject *source,
+    GAsyncResult *res,
+    gpointer user_data)
+{
+  test_data_t *data = (test_data_t *) user_data;
+  WockyStanza *s, *expected;
+  GError *error = NULL;
+
+  s = wocky_xmpp_connection_recv_stanza_finish (
+      WOCKY_XMPP_CONNECTION (source), res, &error);
+  g_assert_no_error (error);
+  g_assert (s != NULL);
+
+  expected = g_queue_pop_head (data->expected_stanzas);
+  test_assert_stanzas_equal (s, expected);
+
+  g_object_unref (s);
+  g_object_unref (expected);
+  data->outstanding--;
+  g_main_loop_quit (data->loop);
+}
+
+static void
+test_send_bytes (void)
+{
+  WockyXmppWriter *writer = wocky_xmpp_writer_new ();
+  WockyStanza *s;
+  GBytes *bytes;
+  const guint8 *data;
+  gsize length;
+  test_data_t *test = setup_test ();
+  int i;
+
+  test_open_connection (test);
+
+  s = wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+    WOCKY_STANZA_SUB_TYPE_CHAT, "juliet@example.com", "romeo@example.net",
+      '(', "body", '$', "Art thou not Romeo, and a Montague?", ')',
+    NULL);
+  bytes = wocky_xmpp_writer_write_stanza_bytes (writer, s);
+
+  /* the bytes don't depend on the writer any more */
+  wocky_xmpp_writer_write_stanza (writer, s, &data, &length);
+  g_object_unref (writer);
+
+  /* the same serialized stanza can be sent again */
+  for (i = 0; i < 2; i++)
+    {
+      wocky_xmpp_connection_send_bytes_async (
+          WOCKY_XMPP_CONNECTION (test->in), bytes, NULL, send_stanza_cb,
+          test);
+      g_queue_push_tail (test->expected_stanzas, g_object_ref (s));
+
+      wocky_xmpp_connection_recv_stanza_async (
+          WOCKY_XMPP_CONNECTION (test->out), NULL, send_bytes_received_cb,
+          test);
+
+      test->outstanding += 2;
+      test_wait_pending (test);
+    }
+
+  test_close_connection (test);
+  g_bytes_unref (bytes);
+  g_object_unref (s);
+  teardown_test (test);
+}
+
 /* Test for various error codes */
 static void
 error_pending_open_received_cb (GObject *source,
@@ -916,6 +984,7 @@ main (int argc, char **argv)
     test_recv_simple_message);
   g_test_add_func ("/xmpp-connection/send-simple-message",
     test_send_simple_message);
+  g_test_add_func ("/xmpp-connection/send-bytes", test_send_bytes);
   g_test_add_func ("/xmpp-connection/error-pending", test_error_pending);
   g_test_add_func ("/xmpp-connection/error-not-open", test_error_not_open);
   g_test_add_func ("/xmpp-connection/error-is-open-or-closed",
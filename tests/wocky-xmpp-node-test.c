@@ -3,6 +3,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -39,6 +40,28 @@ test_node_equal (void)
   g_object_unref (b);
 }
 
+static gboolean
+count_attribute (const gchar *key,
+    const gchar *value,
+    const gchar *prefix,
+    const gchar *ns,
+    gpointer user_data)
+{
+  guint *n = user_data;
+
+  (*n)++;
+  return TRUE;
+}
+
+static guint
+n_attributes (WockyNode *node)
+{
+  guint n = 0;
+
+  wocky_node_each_attribute (node, count_attribute, &n);
+  return n;
+}
+
 static void
 test_node_add_build (void)
 {
@@ -51,14 +74,14 @@ test_node_add_build (void)
       ')',
     NULL);
 
-  g_assert_cmpint (g_slist_length (n->children), ==, 1);
+  g_assert_cmpint (wocky_node_get_n_children (n), ==, 1);
 
   child = wocky_node_get_first_child (n);
   g_assert_cmpstr (child->name, ==, "testnode");
   g_assert_cmpstr (wocky_node_get_ns (child), ==, DUMMY_NS_A);
   g_assert_cmpstr (child->content, ==, "testcontent");
 
-  g_assert_cmpint (g_slist_length (child->attributes), ==, 1);
+  g_assert_cmpuint (n_attributes (child), ==, 1);
   g_assert_cmpstr (wocky_node_get_attribute (child, "test"),
       ==, "attribute");
 
@@ -274,6 +297,180 @@ test_set_attribute_ns (void)
   g_object_unref (sb);
 }
 
+static gboolean
+check_attribute_order (const gchar *key,
+    const gchar *value,
+    const gchar *prefix,
+    const gchar *ns,
+    gpointer user_data)
+{
+  guint *i = user_data;
+  gchar *expected_key = g_strdup_printf ("key%u", *i);
+
+  g_assert_cmpstr (key, ==, expected_key);
+  g_free (expected_key);
+  (*i)++;
+  return TRUE;
+}
+
+static void
+test_many_attributes (void)
+{
+  WockyNodeTree *tree = wocky_node_tree_new ("item", DUMMY_NS_A, NULL);
+  WockyNode *node = wocky_node_tree_get_top_node (tree);
+  WockyNodeTree *copy, *decoded;
+  GBytes *bytes;
+  GQuark ns_b = g_quark_from_string (DUMMY_NS_B);
+  guint i;
+
+  /* enough to need the attribute array to grow a few times */
+  for (i = 0; i < 20; i++)
+    {
+      gchar *key = g_strdup_printf ("key%u", i);
+      gchar *value = g_strdup_printf ("value%u", i);
+
+      wocky_node_set_attribute (node, key, value);
+      g_free (key);
+      g_free (value);
+    }
+
+  g_assert_cmpuint (n_attributes (node), ==, 20);
+  g_assert_cmpstr (wocky_node_get_attribute (node, "key0"), ==, "value0");
+  g_assert_cmpstr (wocky_node_get_attribute (node, "key19"), ==, "value19");
+  g_assert (wocky_node_get_attribute (node, "key20") == NULL);
+
+  /* attributes stay in the order they were set in */
+  i = 0;
+  wocky_node_each_attribute (node, check_attribute_order, &i);
+  g_assert_cmpuint (i, ==, 20);
+
+  /* replacing one moves it to the end */
+  wocky_node_set_attribute (node, "key0", "again");
+  g_assert_cmpuint (n_attributes (node), ==, 20);
+  g_assert_cmpstr (wocky_node_get_attribute (node, "key0"), ==, "again");
+
+  wocky_node_set_attribute_ns (node, "key1", "namespaced", DUMMY_NS_B);
+  g_assert_cmpuint (n_attributes (node), ==, 21);
+  g_assert_cmpstr (wocky_node_get_attribute_ns_q (node, "key1", ns_b), ==,
+      "namespaced");
+  g_assert_cmpstr (wocky_node_get_attribute_ns_q (node, "key1", 0), ==,
+      "value1");
+  g_assert (wocky_node_get_attribute_ns_q (node, "key2", ns_b) == NULL);
+  g_assert (wocky_node_get_attribute_ns (node, "key1",
+        "urn:wocky:test:never-used") == NULL);
+
+  copy = wocky_node_tree_new_from_node (node);
+  test_assert_nodes_equal (node, wocky_node_tree_get_top_node (copy));
+
+  bytes = wocky_node_tree_to_bytes (tree);
+  decoded = wocky_node_tree_new_from_bytes (bytes);
+  g_assert (decoded != NULL);
+  test_assert_nodes_equal (node, wocky_node_tree_get_top_node (decoded));
+
+  wocky_node_set_attribute (wocky_node_tree_get_top_node (copy), "key5",
+      "changed");
+  test_assert_nodes_not_equal (node, wocky_node_tree_get_top_node (copy));
+
+  g_bytes_unref (bytes);
+  g_object_unref (decoded);
+  g_object_unref (copy);
+  g_object_unref (tree);
+}
+
+#define PERF_ITERATIONS 100000
+
+static void
+test_attribute_perf (void)
+{
+  /* some typical stanzas' top nodes, with their attributes */
+  WockyStanza *corpus[] = {
+      wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+          WOCKY_STANZA_SUB_TYPE_CHAT, "romeo@example.net/orchard",
+          "juliet@example.com/balcony",
+          '@', "id", "ktx72v49",
+          '@', "xml:lang", "en",
+          '(', "body", '$', "Art thou not Romeo, and a Montague?", ')',
+          NULL),
+      wocky_stanza_build (WOCKY_STANZA_TYPE_PRESENCE,
+          WOCKY_STANZA_SUB_TYPE_NONE, "romeo@example.net/orchard", NULL,
+          '(', "c", ':', "http://jabber.org/protocol/caps",
+            '@', "hash", "sha-1",
+            '@', "node", "http://code.google.com/p/exodus",
+            '@', "ver", "QgayPKawpkPSDYmwT/WM94uAlu0=",
+          ')',
+          NULL),
+      wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+          WOCKY_STANZA_SUB_TYPE_GET, "romeo@example.net/orchard",
+          "juliet@example.com/balcony",
+          '@', "id", "info1",
+          '(', "query", ':', WOCKY_NS_DISCO_INFO, ')',
+          NULL),
+  };
+  const gchar *keys[] = { "to", "from", "id", "type", "xml:lang", "ver" };
+  GQuark ns = g_quark_from_string (DUMMY_NS_A);
+  guint n = G_N_ELEMENTS (corpus) * G_N_ELEMENTS (keys);
+  guint i, j, k;
+  gdouble elapsed;
+
+  for (i = 0; i < G_N_ELEMENTS (corpus); i++)
+    wocky_node_set_attribute_ns (wocky_stanza_get_top_node (corpus[i]),
+        "extra", "value", DUMMY_NS_A);
+
+  g_test_timer_start ();
+
+  for (k = 0; k < PERF_ITERATIONS; k++)
+    for (i = 0; i < G_N_ELEMENTS (corpus); i++)
+      for (j = 0; j < G_N_ELEMENTS (keys); j++)
+        wocky_node_get_attribute (wocky_stanza_get_top_node (corpus[i]),
+            keys[j]);
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1e9 / (PERF_ITERATIONS * n),
+      "get_attribute: %.1f ns", elapsed * 1e9 / (PERF_ITERATIONS * n));
+
+  g_test_timer_start ();
+
+  for (k = 0; k < PERF_ITERATIONS; k++)
+    for (i = 0; i < G_N_ELEMENTS (corpus); i++)
+      wocky_node_get_attribute_ns (wocky_stanza_get_top_node (corpus[i]),
+          "extra", DUMMY_NS_A);
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (
+      elapsed * 1e9 / (PERF_ITERATIONS * G_N_ELEMENTS (corpus)),
+      "get_attribute_ns: %.1f ns",
+      elapsed * 1e9 / (PERF_ITERATIONS * G_N_ELEMENTS (corpus)));
+
+  g_test_timer_start ();
+
+  for (k = 0; k < PERF_ITERATIONS; k++)
+    for (i = 0; i < G_N_ELEMENTS (corpus); i++)
+      wocky_node_get_attribute_ns_q (wocky_stanza_get_top_node (corpus[i]),
+          "extra", ns);
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (
+      elapsed * 1e9 / (PERF_ITERATIONS * G_N_ELEMENTS (corpus)),
+      "get_attribute_ns_q: %.1f ns",
+      elapsed * 1e9 / (PERF_ITERATIONS * G_N_ELEMENTS (corpus)));
+
+  g_test_timer_start ();
+
+  for (k = 0; k < PERF_ITERATIONS; k++)
+    for (i = 0; i < G_N_ELEMENTS (corpus); i++)
+      wocky_node_set_attribute (wocky_stanza_get_top_node (corpus[i]),
+          "id", "replaced");
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (
+      elapsed * 1e9 / (PERF_ITERATIONS * G_N_ELEMENTS (corpus)),
+      "set_attribute: %.1f ns",
+      elapsed * 1e9 / (PERF_ITERATIONS * G_N_ELEMENTS (corpus)));
+
+  for (i = 0; i < G_N_ELEMENTS (corpus); i++)
+    g_object_unref (corpus[i]);
+}
+
 static void
 do_test_iteration (WockyNodeIter *iter, const gchar **names)
 {
@@ -394,7 +591,7 @@ test_node_iter_remove (void)
   while (wocky_node_iter_next (&iter, NULL))
     wocky_node_iter_remove (&iter);
 
-  g_assert_cmpuint (g_slist_length (top->children), ==, 2);
+  g_assert_cmpuint (wocky_node_get_n_children (top), ==, 2);
 
   wocky_node_iter_init (&iter, top, NULL, NULL);
   while (wocky_node_iter_next (&iter, &child))
@@ -437,6 +634,534 @@ test_get_first_child (void)
   g_object_unref (tree);
 }
 
+static void
+test_many_children (void)
+{
+  WockyNodeTree *tree = wocky_node_tree_new ("query", DUMMY_NS_A, NULL);
+  WockyNode *top = wocky_node_tree_get_top_node (tree);
+  WockyNodeTree *first, *copy, *decoded;
+  WockyNodeIter iter;
+  WockyNode *child;
+  GBytes *bytes;
+  guint i;
+
+  /* enough for lookups to go through the index */
+  for (i = 0; i < 100; i++)
+    {
+      gchar *name = g_strdup_printf ("child%u", i % 10);
+      gchar *content = g_strdup_printf ("%u", i);
+
+      wocky_node_add_child_with_content_ns (top, name, content,
+          (i / 10) % 2 == 0 ? DUMMY_NS_A : DUMMY_NS_B);
+      g_free (name);
+      g_free (content);
+    }
+
+  g_assert_cmpuint (wocky_node_get_n_children (top), ==, 100);
+
+  child = wocky_node_get_child (top, "child3");
+  g_assert (child != NULL);
+  g_assert_cmpstr (child->content, ==, "3");
+
+  child = wocky_node_get_child_ns (top, "child3", DUMMY_NS_A);
+  g_assert (child != NULL);
+  g_assert_cmpstr (child->content, ==, "3");
+
+  child = wocky_node_get_child_ns_q (top, "child3",
+      g_quark_from_string (DUMMY_NS_B));
+  g_assert (child != NULL);
+  g_assert_cmpstr (child->content, ==, "13");
+
+  g_assert (wocky_node_get_child (top, "child10") == NULL);
+  g_assert (wocky_node_get_child_ns (top, "child3",
+        "urn:wocky:test:never-used") == NULL);
+
+  /* children added once the index exists are found too */
+  child = wocky_node_add_child_with_content (top, "late", "100");
+  g_assert (wocky_node_get_child (top, "late") == child);
+
+  first = wocky_node_tree_new ("child3", DUMMY_NS_A, '$', "first", NULL);
+  wocky_node_prepend_node_tree (top, first);
+  g_object_unref (first);
+  g_assert_cmpstr (wocky_node_get_first_child (top)->content, ==, "first");
+  g_assert_cmpstr (wocky_node_get_child (top, "child3")->content, ==,
+      "first");
+  g_assert_cmpstr (
+      wocky_node_get_child_ns (top, "child3", DUMMY_NS_B)->content, ==, "13");
+
+  /* as are the ones left after others are removed */
+  wocky_node_iter_init (&iter, top, "child3", NULL);
+  while (wocky_node_iter_next (&iter, &child))
+    if (strcmp (child->content, "33") != 0)
+      wocky_node_iter_remove (&iter);
+
+  g_assert_cmpuint (wocky_node_get_n_children (top), ==, 92);
+  g_assert_cmpstr (wocky_node_get_child (top, "child3")->content, ==, "33");
+  g_assert (wocky_node_get_child_ns (top, "child3", DUMMY_NS_A) == NULL);
+
+  /* and the rest are still in order */
+  i = 0;
+  wocky_node_iter_init (&iter, top, "child4", NULL);
+  while (wocky_node_iter_next (&iter, &child))
+    {
+      g_assert_cmpuint (atoi (child->content), ==, i * 10 + 4);
+      i++;
+    }
+  g_assert_cmpuint (i, ==, 10);
+
+  copy = wocky_node_tree_new_from_node (top);
+  test_assert_nodes_equal (top, wocky_node_tree_get_top_node (copy));
+
+  bytes = wocky_node_tree_to_bytes (tree);
+  decoded = wocky_node_tree_new_from_bytes (bytes);
+  g_assert (decoded != NULL);
+  test_assert_nodes_equal (top, wocky_node_tree_get_top_node (decoded));
+
+  g_bytes_unref (bytes);
+  g_object_unref (decoded);
+  g_object_unref (copy);
+  g_object_unref (tree);
+}
+
+#define PERF_ROSTER_ITEMS 10000
+#define PERF_ROSTER_PARSES 20
+
+static WockyStanza *
+make_roster (WockyNode **query)
+{
+  WockyStanza *stanza = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+      WOCKY_STANZA_SUB_TYPE_RESULT, NULL, "romeo@example.net/orchard",
+      '@', "id", "roster1",
+      '(', "query", ':', WOCKY_XMPP_NS_ROSTER, '*', query, ')',
+      NULL);
+  guint i;
+
+  for (i = 0; i < PERF_ROSTER_ITEMS; i++)
+    {
+      gchar *jid = g_strdup_printf ("contact%u@example.com", i);
+      gchar *name = g_strdup_printf ("Contact %u", i);
+
+      wocky_node_add_build (*query,
+          '(', "item",
+            '@', "jid", jid,
+            '@', "name", name,
+            '@', "subscription", "both",
+            '(', "group", '$', "Friends", ')',
+          ')',
+          NULL);
+      g_free (jid);
+      g_free (name);
+    }
+
+  return stanza;
+}
+
+static void
+test_children_perf (void)
+{
+  WockyNode *query;
+  WockyStanza *stanza = make_roster (&query);
+  WockyXmppWriter *writer = wocky_xmpp_writer_new_no_stream ();
+  WockyXmppReader *reader = wocky_xmpp_reader_new_no_stream ();
+  WockyStanza *parsed = NULL;
+  WockyNodeIter iter;
+  WockyNode *child;
+  const guint8 *xml;
+  gsize xml_len;
+  gdouble elapsed;
+  guint i, n;
+
+  /* something a lookup has to get past all the items to find */
+  wocky_node_add_child (query, "annotation");
+
+  wocky_xmpp_writer_write_stanza (writer, stanza, &xml, &xml_len);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ROSTER_PARSES; i++)
+    {
+      if (parsed != NULL)
+        g_object_unref (parsed);
+
+      wocky_xmpp_reader_push (reader, xml, xml_len);
+      parsed = wocky_xmpp_reader_pop_stanza (reader);
+      g_assert (parsed != NULL);
+      wocky_xmpp_reader_reset (reader);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1e3 / PERF_ROSTER_PARSES,
+      "parsing a %u item roster: %.2f ms", PERF_ROSTER_ITEMS,
+      elapsed * 1e3 / PERF_ROSTER_PARSES);
+
+  query = wocky_node_get_child_ns (wocky_stanza_get_top_node (parsed),
+      "query", WOCKY_XMPP_NS_ROSTER);
+  g_assert (query != NULL);
+  g_assert_cmpuint (wocky_node_get_n_children (query), ==,
+      PERF_ROSTER_ITEMS + 1);
+
+  g_test_timer_start ();
+
+  n = 0;
+  wocky_node_iter_init (&iter, query, "item", WOCKY_XMPP_NS_ROSTER);
+  while (wocky_node_iter_next (&iter, &child))
+    n++;
+
+  elapsed = g_test_timer_elapsed ();
+  g_assert_cmpuint (n, ==, PERF_ROSTER_ITEMS);
+  g_test_minimized_result (elapsed * 1e9 / PERF_ROSTER_ITEMS,
+      "iterating: %.1f ns per item", elapsed * 1e9 / PERF_ROSTER_ITEMS);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < PERF_ITERATIONS; i++)
+    {
+      g_assert (wocky_node_get_child (query, "annotation") != NULL);
+      g_assert (wocky_node_get_child_ns (query, "item",
+            WOCKY_XMPP_NS_ROSTER) != NULL);
+      g_assert (wocky_node_get_child (query, "not-there") == NULL);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed * 1e9 / (PERF_ITERATIONS * 3),
+      "get_child_ns: %.1f ns", elapsed * 1e9 / (PERF_ITERATIONS * 3));
+
+  g_object_unref (parsed);
+  g_object_unref (reader);
+  g_object_unref (writer);
+  g_object_unref (stanza);
+}
+
+static gboolean
+get_first_key (const gchar *key,
+    const gchar *value,
+    const gchar *prefix,
+    const gchar *ns,
+    gpointer user_data)
+{
+  *(const gchar **) user_data = key;
+  return FALSE;
+}
+
+static void
+test_interned_names (void)
+{
+  WockyNodeTree *a = wocky_node_tree_new ("item", DUMMY_NS_A,
+      '@', "jid", "juliet@example.com",
+      NULL);
+  WockyNodeTree *b = wocky_node_tree_new ("item", DUMMY_NS_B,
+      '(', "bad\xff", ')',
+      NULL);
+  WockyNodeTree *copy;
+  WockyNode *top_a = wocky_node_tree_get_top_node (a);
+  WockyNode *top_b = wocky_node_tree_get_top_node (b);
+  const gchar *key = NULL;
+  const gchar *copy_key = NULL;
+
+  /* nodes with the same name share it */
+  g_assert (top_a->name == top_b->name);
+  g_assert_cmpstr (top_a->name, ==, "item");
+
+  copy = wocky_node_tree_new_from_node (top_a);
+  g_assert (wocky_node_tree_get_top_node (copy)->name == top_a->name);
+
+  wocky_node_each_attribute (top_a, get_first_key, &key);
+  wocky_node_each_attribute (wocky_node_tree_get_top_node (copy),
+      get_first_key, &copy_key);
+  g_assert_cmpstr (key, ==, "jid");
+  g_assert (copy_key == key);
+
+  /* names which aren't valid UTF-8 are fixed up before being interned */
+  g_assert_cmpstr (wocky_node_get_first_child (top_b)->name, ==,
+      "bad\357\277\275");
+
+  /* and lookups by the fixed-up name find them */
+  g_assert (wocky_node_get_child (top_b, "bad\357\277\275") != NULL);
+
+  g_object_unref (copy);
+  g_object_unref (a);
+  g_object_unref (b);
+}
+
+#define N_UNIQUE_NAMES 20000
+
+static WockyStanza *
+parse_unique (WockyXmppReader *reader,
+    guint i)
+{
+  gchar *xml = g_strdup_printf ("<message xmlns='jabber:client'>"
+      "<x%u xmlns='" DUMMY_NS_A "' k%u='v'/></message>", i, i);
+  WockyStanza *stanza;
+
+  wocky_xmpp_reader_push (reader, (const guint8 *) xml, strlen (xml));
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+  wocky_xmpp_reader_reset (reader);
+  g_free (xml);
+
+  return stanza;
+}
+
+static void
+test_unique_names (void)
+{
+  WockyXmppReader *reader = wocky_xmpp_reader_new_no_stream ();
+  WockyStanza *a, *b;
+  WockyNode *top_a, *top_b, *child_a, *child_b;
+  const gchar *key_a = NULL, *key_b = NULL;
+  gchar *name;
+  guint i;
+
+  /* a peer making up names can only fill the intern table, after which
+   * names are copied, not interned */
+  for (i = 0; i < N_UNIQUE_NAMES; i++)
+    g_object_unref (parse_unique (reader, i));
+
+  a = parse_unique (reader, N_UNIQUE_NAMES);
+  b = parse_unique (reader, N_UNIQUE_NAMES);
+  top_a = wocky_stanza_get_top_node (a);
+  top_b = wocky_stanza_get_top_node (b);
+  child_a = wocky_node_get_first_child (top_a);
+  child_b = wocky_node_get_first_child (top_b);
+
+  /* names interned before the table filled up are still shared */
+  g_assert (top_a->name == top_b->name);
+  g_assert (child_a->name != child_b->name);
+
+  /* copies compare equal to each other, and to interned names */
+  name = g_strdup_printf ("x%u", N_UNIQUE_NAMES);
+  g_assert_cmpstr (child_a->name, ==, name);
+  g_assert (wocky_node_get_child (top_a, name) == child_a);
+  g_assert (wocky_node_get_child_ns (top_b, child_a->name, DUMMY_NS_A) ==
+      child_b);
+  g_free (name);
+
+  /* and so are attribute keys */
+  wocky_node_each_attribute (child_a, get_first_key, &key_a);
+  wocky_node_each_attribute (child_b, get_first_key, &key_b);
+  g_assert (key_a != key_b);
+  g_assert_cmpstr (key_a, ==, key_b);
+
+  name = g_strdup_printf ("k%u", N_UNIQUE_NAMES);
+  g_assert_cmpstr (wocky_node_get_attribute (child_a, name), ==, "v");
+  g_assert_cmpstr (wocky_node_get_attribute (child_b, key_a), ==, "v");
+  g_free (name);
+
+  test_assert_stanzas_equal (a, b);
+  g_assert (wocky_node_is_superset (top_a, top_b));
+  g_assert (wocky_node_matches (child_b, child_a->name, DUMMY_NS_A));
+
+  g_object_unref (a);
+  g_object_unref (b);
+  g_object_unref (reader);
+}
+
+typedef struct {
+  GHashTable *seen;
+  guint n;
+  gsize copied_bytes;
+  gsize interned_bytes;
+} InternStats;
+
+static void
+count_name (InternStats *stats,
+    const gchar *name)
+{
+  gsize len = strlen (name) + 1;
+
+  stats->n++;
+  stats->copied_bytes += len;
+
+  if (!g_hash_table_contains (stats->seen, name))
+    {
+      g_hash_table_add (stats->seen, (gpointer) name);
+      stats->interned_bytes += len;
+    }
+}
+
+static gboolean
+count_key (const gchar *key,
+    const gchar *value,
+    const gchar *prefix,
+    const gchar *ns,
+    gpointer user_data)
+{
+  count_name (user_data, key);
+  return TRUE;
+}
+
+static gboolean
+count_names (WockyNode *node,
+    gpointer user_data)
+{
+  count_name (user_data, node->name);
+  wocky_node_each_attribute (node, count_key, user_data);
+  wocky_node_each_child (node, count_names, user_data);
+  return TRUE;
+}
+
+static void
+test_intern_perf (void)
+{
+  WockyNode *query;
+  WockyStanza *stanza = make_roster (&query);
+  WockyXmppWriter *writer = wocky_xmpp_writer_new_no_stream ();
+  WockyXmppReader *reader = wocky_xmpp_reader_new_no_stream ();
+  WockyStanza *parsed;
+  InternStats stats = { g_hash_table_new (NULL, NULL), 0, 0, 0 };
+  const guint8 *xml;
+  gsize xml_len;
+
+  wocky_xmpp_writer_write_stanza (writer, stanza, &xml, &xml_len);
+  wocky_xmpp_reader_push (reader, xml, xml_len);
+  parsed = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (parsed != NULL);
+
+  count_names (wocky_stanza_get_top_node (parsed), &stats);
+
+  /* the few distinct names are all there is left to store; each copy
+   * would have been a separate allocation on top of its bytes */
+  g_assert_cmpuint (g_hash_table_size (stats.seen), <, 16);
+  g_test_message ("%u names and keys in a %u item roster: %" G_GSIZE_FORMAT
+      " bytes as copies, %" G_GSIZE_FORMAT " bytes interned",
+      stats.n, PERF_ROSTER_ITEMS, stats.copied_bytes, stats.interned_bytes);
+  g_test_maximized_result (stats.copied_bytes - stats.interned_bytes,
+      "%" G_GSIZE_FORMAT " bytes saved",
+      stats.copied_bytes - stats.interned_bytes);
+
+  g_hash_table_unref (stats.seen);
+  g_object_unref (parsed);
+  g_object_unref (reader);
+  g_object_unref (writer);
+  g_object_unref (stanza);
+}
+
+#define PREFIX_NAMESPACES 8
+
+typedef struct {
+  GQuark namespaces[PREFIX_NAMESPACES];
+  const gchar *prefixes[PREFIX_NAMESPACES];
+  guint lookups;
+  /* if non-zero, this thread adds that many new namespaces instead */
+  guint additions;
+} PrefixJob;
+
+static gpointer
+prefix_thread (gpointer user_data)
+{
+  PrefixJob *job = user_data;
+  guint i;
+
+  for (i = 0; i < job->additions; i++)
+    {
+      gchar *urn = g_strdup_printf ("urn:wocky:test:prefix:%p:%u", job, i);
+
+      g_assert (wocky_node_attribute_ns_get_prefix_from_urn (urn) != NULL);
+      g_free (urn);
+    }
+
+  for (i = 0; i < job->lookups; i++)
+    {
+      guint n = i % PREFIX_NAMESPACES;
+
+      g_assert_cmpstr (wocky_node_attribute_ns_get_prefix_from_quark (
+          job->namespaces[n]), ==, job->prefixes[n]);
+    }
+
+  return NULL;
+}
+
+static void
+prefix_job_init (PrefixJob *job,
+    guint lookups,
+    guint additions)
+{
+  guint i;
+
+  for (i = 0; i < PREFIX_NAMESPACES; i++)
+    {
+      gchar *urn = g_strdup_printf ("urn:wocky:test:prefixed:%u", i);
+
+      job->namespaces[i] = g_quark_from_string (urn);
+      job->prefixes[i] = wocky_node_attribute_ns_get_prefix_from_quark (
+          job->namespaces[i]);
+      g_free (urn);
+    }
+
+  job->lookups = lookups;
+  job->additions = additions;
+}
+
+/* Returns the time it took @n_threads threads to look up @lookups prefixes
+ * each, while @n_writers more threads add new namespaces */
+static gdouble
+run_prefix_threads (guint n_threads,
+    guint n_writers,
+    guint lookups)
+{
+  GThread **threads = g_new0 (GThread *, n_threads + n_writers);
+  PrefixJob reader_job, *writer_jobs = g_new0 (PrefixJob, n_writers);
+  gdouble elapsed;
+  guint i;
+
+  prefix_job_init (&reader_job, lookups, 0);
+
+  for (i = 0; i < n_writers; i++)
+    prefix_job_init (writer_jobs + i, 0, 1000);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("prefix", prefix_thread, &reader_job);
+
+  for (i = 0; i < n_writers; i++)
+    threads[n_threads + i] = g_thread_new ("prefix", prefix_thread,
+        writer_jobs + i);
+
+  for (i = 0; i < n_threads + n_writers; i++)
+    g_thread_join (threads[i]);
+
+  elapsed = g_test_timer_elapsed ();
+  g_free (writer_jobs);
+  g_free (threads);
+  return elapsed;
+}
+
+static void
+test_prefix_threads (void)
+{
+  /* lookups on several threads while others add enough namespaces for the
+   * table to grow a few times */
+  run_prefix_threads (4, 2, 100000);
+}
+
+#define PERF_PREFIX_LOOKUPS 2000000
+
+static void
+test_prefix_threads_perf (void)
+{
+  guint max_threads = MAX (g_get_num_processors (), 1);
+  gdouble single = 0, rate = 0;
+  guint n;
+
+  /* lookups take no lock, so they should scale with the threads */
+  for (n = 1; n <= max_threads; n *= 2)
+    {
+      gdouble elapsed = run_prefix_threads (n, 0, PERF_PREFIX_LOOKUPS);
+
+      rate = n * PERF_PREFIX_LOOKUPS / elapsed;
+
+      if (n == 1)
+        single = rate;
+
+      g_test_message ("%u thread(s): %.0f prefix lookups/s, %.2fx one thread",
+          n, rate, rate / single);
+    }
+
+  g_test_maximized_result (rate / single,
+      "speedup with the most threads tried: %.2fx", rate / single);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -449,9 +1174,25 @@ main (int argc, char **argv)
   g_test_add_func ("/xmpp-node/set-attribute", test_set_attribute);
   g_test_add_func ("/xmpp-node/append-content-n", test_append_content_n);
   g_test_add_func ("/xmpp-node/set-attribute-ns", test_set_attribute_ns);
+  g_test_add_func ("/xmpp-node/many-attributes", test_many_attributes);
   g_test_add_func ("/xmpp-node/node-iterator", test_node_iteration);
   g_test_add_func ("/xmpp-node/node-iterator-remove", test_node_iter_remove);
   g_test_add_func ("/xmpp-node/get-first-child", test_get_first_child);
+  g_test_add_func ("/xmpp-node/many-children", test_many_children);
+  g_test_add_func ("/xmpp-node/interned-names", test_interned_names);
+
+  if (g_test_perf ())
+    {
+      g_test_add_func ("/xmpp-node/attribute-perf", test_attribute_perf);
+      g_test_add_func ("/xmpp-node/children-perf", test_children_perf);
+      g_test_add_func ("/xmpp-node/intern-perf", test_intern_perf);
+      g_test_add_func ("/xmpp-node/prefix-threads-perf",
+          test_prefix_threads_perf);
+    }
+
+  /* these fill the intern table for the rest of the run, so they go last */
+  g_test_add_func ("/xmpp-node/prefix-threads", test_prefix_threads);
+  g_test_add_func ("/xmpp-node/unique-names", test_unique_names);
 
   result = g_test_run ();
   test_deinit ();
@@ -339,6 +339,46 @@ test_invalid_namespace (void)
   g_object_unref (reader);
 }
 
+static const gchar *
+parse_prefixed_attribute (const gchar *ns,
+    const gchar *prefix)
+{
+  WockyXmppReader *reader = wocky_xmpp_reader_new_no_stream ();
+  WockyStanza *stanza;
+  gchar *xml = g_strdup_printf ("<message xmlns='jabber:client'"
+      " xmlns:%s='%s' %s:mood='amorous'/>", prefix, ns, prefix);
+
+  wocky_xmpp_reader_push (reader, (guint8 *) xml, strlen (xml));
+  g_assert ((stanza = wocky_xmpp_reader_pop_stanza (reader)) != NULL);
+  g_assert_cmpstr (wocky_node_get_attribute_ns (
+      wocky_stanza_get_top_node (stanza), "mood", ns), ==, "amorous");
+
+  g_object_unref (stanza);
+  g_object_unref (reader);
+  g_free (xml);
+
+  return wocky_node_attribute_ns_get_prefix_from_urn (ns);
+}
+
+static void
+test_received_prefixes (void)
+{
+  gchar *long_prefix = g_strnfill (200, 'p');
+
+  /* a namespace keeps the first prefix it is received with */
+  g_assert_cmpstr (parse_prefixed_attribute ("urn:example:prefixes", "moo"),
+      ==, "moo");
+  g_assert_cmpstr (parse_prefixed_attribute ("urn:example:prefixes", "baa"),
+      ==, "moo");
+
+  /* and one too long to intern is replaced by a generated one */
+  g_assert (g_str_has_prefix (
+      parse_prefixed_attribute ("urn:example:long-prefix", long_prefix),
+      "wocky-"));
+
+  g_free (long_prefix);
+}
+
 /* Helper function for the whitespace body tests */
 static void
 test_body_with_alternative (
@@ -475,6 +515,478 @@ test_no_stream_specified_default_namespace (void)
 #undef WEIRD
 }
 
+/* no whitespace between the elements, so the stanzas compare equal to
+ * built ones */
+#define ROSTER_ITEM(jid) \
+"<item jid='" jid "' subscription='both'><group>Friends</group></item>"
+
+#define ROSTER_RESULT \
+"<iq type='result' id='roster1' to='juliet@example.com/balcony'>" \
+"<query xmlns='jabber:iq:roster'>" \
+ROSTER_ITEM ("romeo@example.net") \
+ROSTER_ITEM ("nurse@example.com") \
+ROSTER_ITEM ("benvolio@example.net") \
+"</query></iq>"
+
+/* turned down when it starts, so not streamed */
+#define ROSTER_OTHER_RESULT \
+"<iq type='result' id='roster2' to='juliet@example.com/balcony'>" \
+"<query xmlns='jabber:iq:roster'>" \
+ROSTER_ITEM ("mercutio@example.net") \
+"</query></iq>"
+
+/* not an IQ, so not streamed */
+#define ROSTER_MESSAGE \
+"<message to='juliet@example.com/balcony'>" \
+"<query xmlns='jabber:iq:roster'>" \
+ROSTER_ITEM ("tybalt@example.net") \
+"</query></message>"
+
+static gboolean
+stream_roster_item_cb (WockyStanza *stanza,
+    WockyNode *item,
+    gpointer user_data)
+{
+  GPtrArray *jids = user_data;
+  const gchar *id = wocky_node_get_attribute (
+      wocky_stanza_get_top_node (stanza), "id");
+  const gchar *jid;
+
+  /* the top node's attributes are all there already, so the stanza can be
+   * vetted before any of its items */
+  if (item == NULL)
+    {
+      g_ptr_array_add (jids, g_strdup_printf ("start %s", id));
+      return !wocky_strdiff (id, "roster1");
+    }
+
+  g_assert_cmpstr (id, ==, "roster1");
+  g_assert (wocky_node_get_child (item, "group") != NULL);
+
+  jid = wocky_node_get_attribute (item, "jid");
+
+  g_ptr_array_add (jids, g_strdup (jid));
+
+  /* keep one item, to check that it survives */
+  return wocky_strdiff (jid, "nurse@example.com");
+}
+
+static void
+test_streaming (void)
+{
+  WockyXmppReader *reader = wocky_xmpp_reader_new ();
+  GPtrArray *jids = g_ptr_array_new_with_free_func (g_free);
+  WockyStanza *stanza, *expected;
+  guint id;
+
+  id = wocky_xmpp_reader_add_streaming_handler (reader,
+      WOCKY_STANZA_TYPE_IQ, "query", WOCKY_XMPP_NS_ROSTER,
+      stream_roster_item_cb, jids, NULL);
+  g_assert_cmpuint (id, !=, 0);
+
+  wocky_xmpp_reader_push (reader,
+    (guint8 *) HEADER ROSTER_RESULT ROSTER_OTHER_RESULT ROSTER_MESSAGE,
+    strlen (HEADER ROSTER_RESULT ROSTER_OTHER_RESULT ROSTER_MESSAGE));
+
+  g_assert_cmpuint (jids->len, ==, 5);
+  g_assert_cmpstr (g_ptr_array_index (jids, 0), ==, "start roster1");
+  g_assert_cmpstr (g_ptr_array_index (jids, 1), ==, "romeo@example.net");
+  g_assert_cmpstr (g_ptr_array_index (jids, 2), ==, "nurse@example.com");
+  g_assert_cmpstr (g_ptr_array_index (jids, 3), ==, "benvolio@example.net");
+  g_assert_cmpstr (g_ptr_array_index (jids, 4), ==, "start roster2");
+
+  /* the IQ itself still comes out, less the items which were dealt with */
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+  expected = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+      WOCKY_STANZA_SUB_TYPE_RESULT, NULL, "juliet@example.com/balcony",
+      '@', "id", "roster1",
+      '(', "query", ':', WOCKY_XMPP_NS_ROSTER,
+        '(', "item",
+          '@', "jid", "nurse@example.com",
+          '@', "subscription", "both",
+          '(', "group", '$', "Friends", ')',
+        ')',
+      ')', NULL);
+  test_assert_stanzas_equal (stanza, expected);
+  g_object_unref (stanza);
+  g_object_unref (expected);
+
+  /* the IQ which was turned down keeps all its items */
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+  g_assert (wocky_node_get_first_child (wocky_node_get_first_child (
+      wocky_stanza_get_top_node (stanza))) != NULL);
+  g_object_unref (stanza);
+
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+  g_assert (wocky_node_get_first_child (wocky_node_get_first_child (
+      wocky_stanza_get_top_node (stanza))) != NULL);
+  g_object_unref (stanza);
+
+  /* once the handler has gone, nothing is streamed */
+  wocky_xmpp_reader_remove_streaming_handler (reader, id);
+  wocky_xmpp_reader_push (reader,
+    (guint8 *) ROSTER_RESULT, strlen (ROSTER_RESULT));
+  g_assert_cmpuint (jids->len, ==, 5);
+
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+  g_assert (wocky_node_get_child (wocky_node_get_first_child (
+      wocky_stanza_get_top_node (stanza)), "item") != NULL);
+  g_object_unref (stanza);
+
+  g_ptr_array_unref (jids);
+  g_object_unref (reader);
+}
+
+#define PERF_ROSTER_ITEMS 10000
+
+static gboolean
+count_roster_item_cb (WockyStanza *stanza,
+    WockyNode *item,
+    gpointer user_data)
+{
+  guint *count = user_data;
+
+  if (item != NULL)
+    (*count)++;
+
+  return TRUE;
+}
+
+static gdouble
+time_roster (const gchar *xml,
+    gboolean streaming)
+{
+  WockyXmppReader *reader = wocky_xmpp_reader_new_no_stream ();
+  WockyStanza *stanza;
+  guint count = 0;
+  gdouble elapsed;
+
+  if (streaming)
+    wocky_xmpp_reader_add_streaming_handler (reader,
+        WOCKY_STANZA_TYPE_IQ, "query", WOCKY_XMPP_NS_ROSTER,
+        count_roster_item_cb, &count, NULL);
+
+  g_test_timer_start ();
+  wocky_xmpp_reader_push (reader, (guint8 *) xml, strlen (xml));
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_object_unref (stanza);
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert_cmpuint (count, ==, streaming ? PERF_ROSTER_ITEMS : 0);
+  g_object_unref (reader);
+  return elapsed;
+}
+
+static void
+test_streaming_perf (void)
+{
+  GString *xml = g_string_new ("<iq xmlns='jabber:client' type='result' "
+      "id='roster1'><query xmlns='jabber:iq:roster'>");
+  gdouble whole, streamed;
+  guint i;
+
+  for (i = 0; i < PERF_ROSTER_ITEMS; i++)
+    g_string_append_printf (xml, "<item jid='contact%u@example.com' "
+        "name='Contact %u' subscription='both'><group>Friends</group>"
+        "</item>", i, i);
+
+  g_string_append (xml, "</query></iq>");
+
+  whole = time_roster (xml->str, FALSE);
+  streamed = time_roster (xml->str, TRUE);
+
+  /* the streamed stanza never holds more than one item at once */
+  g_test_message ("%u-item roster read whole: %.2f ms",
+      PERF_ROSTER_ITEMS, whole * 1e3);
+  g_test_minimized_result (streamed, "%u-item roster streamed: %.2f ms",
+      PERF_ROSTER_ITEMS, streamed * 1e3);
+
+  g_string_free (xml, TRUE);
+}
+
+#define XHTML_MESSAGE \
+"<message to='juliet@example.com' from='romeo@example.net' type='chat'>" \
+"<body>Art thou not Romeo?</body>" \
+"<html xmlns='http://jabber.org/protocol/xhtml-im' xml:lang='en'>" \
+"<body xmlns='http://www.w3.org/1999/xhtml'>" \
+"<p style='font-weight:bold'>Art thou not <em>Romeo</em>?</p>" \
+"</body></html>" \
+"</message>"
+
+#define AVATAR_PRESENCE \
+"<presence from='romeo@example.net/orchard'>" \
+"<show>away</show>" \
+"<x xmlns='vcard-temp:x:update' kind='avatar'>" \
+"<photo>01b87fcd030b72895ff8e88db57ec525450f000d</photo>" \
+"</x>" \
+"</presence>"
+
+static void
+test_filter (void)
+{
+  WockyXmppReader *reader = wocky_xmpp_reader_new ();
+  WockyStanza *stanza, *expected;
+  guint skip, truncate;
+
+  skip = wocky_xmpp_reader_add_filter (reader, NULL, WOCKY_XMPP_NS_XHTML_IM,
+      WOCKY_XMPP_READER_FILTER_SKIP);
+  truncate = wocky_xmpp_reader_add_filter (reader, "x",
+      WOCKY_NS_VCARD_TEMP_UPDATE, WOCKY_XMPP_READER_FILTER_TRUNCATE);
+  g_assert_cmpuint (skip, !=, truncate);
+
+  wocky_xmpp_reader_push (reader,
+    (guint8 *) HEADER XHTML_MESSAGE AVATAR_PRESENCE,
+    strlen (HEADER XHTML_MESSAGE AVATAR_PRESENCE));
+
+  /* only placeholders are left of the filtered elements */
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+  expected = wocky_stanza_build (WOCKY_STANZA_TYPE_MESSAGE,
+      WOCKY_STANZA_SUB_TYPE_CHAT, "romeo@example.net", "juliet@example.com",
+      '(', "body", '$', "Art thou not Romeo?", ')',
+      '(', "html", ':', WOCKY_XMPP_NS_XHTML_IM, ')',
+      NULL);
+  test_assert_stanzas_equal (stanza, expected);
+  g_object_unref (stanza);
+  g_object_unref (expected);
+
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+  expected = wocky_stanza_build (WOCKY_STANZA_TYPE_PRESENCE,
+      WOCKY_STANZA_SUB_TYPE_NONE, "romeo@example.net/orchard", NULL,
+      '(', "show", '$', "away", ')',
+      '(', "x", ':', WOCKY_NS_VCARD_TEMP_UPDATE,
+        '@', "kind", "avatar",
+      ')',
+      NULL);
+  test_assert_stanzas_equal (stanza, expected);
+  g_object_unref (stanza);
+  g_object_unref (expected);
+
+  /* without the filters, everything is read again */
+  wocky_xmpp_reader_remove_filter (reader, skip);
+  wocky_xmpp_reader_remove_filter (reader, truncate);
+  wocky_xmpp_reader_push (reader,
+    (guint8 *) AVATAR_PRESENCE, strlen (AVATAR_PRESENCE));
+
+  stanza = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (stanza != NULL);
+  g_assert_cmpstr (wocky_node_get_content_from_child_ns (
+      wocky_node_get_child_ns (wocky_stanza_get_top_node (stanza), "x",
+          WOCKY_NS_VCARD_TEMP_UPDATE), "photo", WOCKY_NS_VCARD_TEMP_UPDATE),
+      ==, "01b87fcd030b72895ff8e88db57ec525450f000d");
+  g_object_unref (stanza);
+
+  g_object_unref (reader);
+}
+
+#define PERF_CORPUS_STANZAS 10000
+
+static gdouble
+time_corpus (const gchar *xml,
+    gboolean filtered)
+{
+  WockyXmppReader *reader = wocky_xmpp_reader_new ();
+  WockyStanza *stanza;
+  guint n = 0;
+  gdouble elapsed;
+
+  if (filtered)
+    {
+      wocky_xmpp_reader_add_filter (reader, NULL, WOCKY_XMPP_NS_XHTML_IM,
+          WOCKY_XMPP_READER_FILTER_SKIP);
+      wocky_xmpp_reader_add_filter (reader, "x", WOCKY_NS_VCARD_TEMP_UPDATE,
+          WOCKY_XMPP_READER_FILTER_SKIP);
+    }
+
+  g_test_timer_start ();
+  wocky_xmpp_reader_push (reader, (guint8 *) xml, strlen (xml));
+
+  while ((stanza = wocky_xmpp_reader_pop_stanza (reader)) != NULL)
+    {
+      g_object_unref (stanza);
+      n++;
+    }
+
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert_cmpuint (n, ==, PERF_CORPUS_STANZAS);
+  g_object_unref (reader);
+  return elapsed;
+}
+
+static void
+test_filter_perf (void)
+{
+  GString *xml = g_string_new (HEADER);
+  gdouble whole, filtered;
+  guint i, j;
+
+  /* alternately, presences with oversized vCard photo updates and
+   * messages with XHTML-IM bodies */
+  for (i = 0; i < PERF_CORPUS_STANZAS; i++)
+    {
+      if (i % 2 == 0)
+        {
+          g_string_append_printf (xml,
+              "<presence from='contact%u@example.com/res'>"
+              "<c xmlns='http://jabber.org/protocol/caps' hash='sha-1' "
+              "node='http://example.com/client' "
+              "ver='QgayPKawpkPSDYmwT/WM94uAlu0='/>"
+              "<x xmlns='vcard-temp:x:update'><photo>", i);
+
+          for (j = 0; j < 64; j++)
+            g_string_append (xml, "01b87fcd030b72895ff8e88db57ec525450f000d");
+
+          g_string_append (xml, "</photo></x></presence>");
+        }
+      else
+        {
+          g_string_append_printf (xml,
+              "<message from='contact%u@example.com/res' type='chat'>"
+              "<body>Hello</body>"
+              "<html xmlns='http://jabber.org/protocol/xhtml-im'>"
+              "<body xmlns='http://www.w3.org/1999/xhtml'>", i);
+
+          for (j = 0; j < 16; j++)
+            g_string_append (xml, "<p style='font-style:italic'>Hello, "
+                "<strong>world</strong> <a href='http://example.com/'>"
+                "link</a></p>");
+
+          g_string_append (xml, "</body></html></message>");
+        }
+    }
+
+  whole = time_corpus (xml->str, FALSE);
+  filtered = time_corpus (xml->str, TRUE);
+
+  g_test_message ("%u stanzas (%" G_GSIZE_FORMAT " bytes) read whole: "
+      "%.2f ms", PERF_CORPUS_STANZAS, xml->len, whole * 1e3);
+  g_test_minimized_result (filtered, "%u stanzas read filtered: %.2f ms",
+      PERF_CORPUS_STANZAS, filtered * 1e3);
+
+  g_string_free (xml, TRUE);
+}
+
+/* every prefixed attribute read sets its namespace's prefix, and writing
+ * it out looks the prefix up again */
+#define PREFIXED_MESSAGE \
+"<message to='juliet@example.com' from='romeo@example.net' type='chat'" \
+" xmlns:ga='http://www.google.com/talk/protocol/auth'" \
+" xmlns:mine='urn:example:mine' ga:client-uses-full-bind-result='true'" \
+" mine:mood='amorous'>" \
+"<body>Art thou not Romeo, and a Montague?</body>" \
+"<x xmlns='jabber:x:oob'><url>http://example.net/balcony.jpg</url></x>" \
+"</message>"
+
+typedef struct {
+  guint stanzas;
+  /* whether to keep changing a namespace's prefix, too */
+  gboolean set_prefixes;
+} ParseJob;
+
+static gpointer
+parse_thread (gpointer user_data)
+{
+  ParseJob *job = user_data;
+  WockyXmppReader *reader = wocky_xmpp_reader_new ();
+  WockyXmppWriter *writer = wocky_xmpp_writer_new_no_stream ();
+  GQuark mine = g_quark_from_static_string ("urn:example:mine");
+  guint read = 0;
+  guint i;
+
+  wocky_xmpp_reader_push (reader, (guint8 *) HEADER, strlen (HEADER));
+
+  for (i = 0; i < job->stanzas; i++)
+    {
+      WockyStanza *stanza;
+      const guint8 *data;
+      gsize length;
+
+      if (job->set_prefixes)
+        wocky_node_attribute_ns_set_prefix (mine, i % 2 ? "mine" : "ours");
+
+      wocky_xmpp_reader_push (reader, (guint8 *) PREFIXED_MESSAGE,
+          strlen (PREFIXED_MESSAGE));
+
+      while ((stanza = wocky_xmpp_reader_pop_stanza (reader)) != NULL)
+        {
+          wocky_xmpp_writer_write_stanza (writer, stanza, &data, &length);
+          g_assert (length > 0);
+          g_object_unref (stanza);
+          read++;
+        }
+    }
+
+  g_object_unref (writer);
+  g_object_unref (reader);
+  return GUINT_TO_POINTER (read);
+}
+
+/* Returns the time it took @n_threads threads to parse and serialize
+ * @stanzas stanzas each */
+static gdouble
+run_parse_threads (guint n_threads,
+    guint stanzas,
+    gboolean set_prefixes)
+{
+  GThread **threads = g_new0 (GThread *, n_threads);
+  ParseJob job = { stanzas, set_prefixes };
+  gdouble elapsed;
+  guint i;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("parse", parse_thread, &job);
+
+  for (i = 0; i < n_threads; i++)
+    g_assert_cmpuint (GPOINTER_TO_UINT (g_thread_join (threads[i])), ==,
+        stanzas);
+
+  elapsed = g_test_timer_elapsed ();
+  g_free (threads);
+  return elapsed;
+}
+
+static void
+test_threads (void)
+{
+  /* readers and writers on several threads, while the prefixes they use
+   * are being changed */
+  run_parse_threads (4, 500, TRUE);
+}
+
+#define PERF_THREAD_STANZAS 20000
+
+static void
+test_threads_perf (void)
+{
+  guint max_threads = MAX (g_get_num_processors (), 1);
+  gdouble single = 0, rate = 0;
+  guint n;
+
+  for (n = 1; n <= max_threads; n *= 2)
+    {
+      gdouble elapsed = run_parse_threads (n, PERF_THREAD_STANZAS, FALSE);
+
+      rate = n * PERF_THREAD_STANZAS / elapsed;
+
+      if (n == 1)
+        single = rate;
+
+      g_test_message ("%u thread(s): %.0f stanzas/s, %.2fx one thread", n,
+          rate, rate / single);
+    }
+
+  g_test_maximized_result (rate / single,
+      "speedup with the most threads tried: %.2fx", rate / single);
+}
+
 int
 main (int argc,
     char **argv)
@@ -492,6 +1004,7 @@ main (int argc,
   g_test_add_func ("/xmpp-reader/no-stream-resetting", test_no_stream_reset);
   g_test_add_func ("/xmpp-reader/vcard-namespace", test_vcard_namespace);
   g_test_add_func ("/xmpp-reader/invalid-namespace", test_invalid_namespace);
+  g_test_add_func ("/xmpp-reader/received-prefixes", test_received_prefixes);
   g_test_add_func ("/xmpp-reader/whitespace-padding", test_whitespace_padding);
   g_test_add_func ("/xmpp-reader/whitespace-only", test_whitespace_only);
   g_test_add_func ("/xmpp-reader/utf-non-character-codepoints",
@@ -500,6 +1013,16 @@ main (int argc,
       test_no_stream_default_default_namespace);
   g_test_add_func ("/xmpp-reader/no-stream-specified-default-namespace",
       test_no_stream_specified_default_namespace);
+  g_test_add_func ("/xmpp-reader/streaming", test_streaming);
+  g_test_add_func ("/xmpp-reader/filter", test_filter);
+  g_test_add_func ("/xmpp-reader/threads", test_threads);
+
+  if (g_test_perf ())
+    {
+      g_test_add_func ("/xmpp-reader/streaming-perf", test_streaming_perf);
+      g_test_add_func ("/xmpp-reader/filter-perf", test_filter_perf);
+      g_test_add_func ("/xmpp-reader/threads-perf", test_threads_perf);
+    }
 
   result = g_test_run ();
   test_deinit ();
@@ -202,6 +202,151 @@ test_readwrite_nostream (void)
   g_object_unref (writer);
 }
 
+static GByteArray *
+join_split (GByteArray *buffer,
+    GBytes *head,
+    const gchar *to,
+    GBytes *tail)
+{
+  gchar *escaped = g_markup_escape_text (to, -1);
+  gsize length;
+  gconstpointer data;
+
+  g_byte_array_set_size (buffer, 0);
+  data = g_bytes_get_data (head, &length);
+  g_byte_array_append (buffer, data, length);
+  g_byte_array_append (buffer, (const guint8 *) " to=\"", 5);
+  g_byte_array_append (buffer, (const guint8 *) escaped, strlen (escaped));
+  g_byte_array_append (buffer, (const guint8 *) "\"", 1);
+  data = g_bytes_get_data (tail, &length);
+  g_byte_array_append (buffer, data, length);
+
+  g_free (escaped);
+  return buffer;
+}
+
+static void
+test_split (void)
+{
+  const gchar *recipients[] = { "romeo@example.net", "nurse@example.net/<&>",
+      NULL };
+  WockyXmppReader *reader;
+  WockyXmppWriter *writer;
+  WockyStanza *received, *sent;
+  GByteArray *buffer = g_byte_array_new ();
+  GBytes *head, *tail;
+  const guint8 *data;
+  gsize length;
+  guint i;
+
+  writer = wocky_xmpp_writer_new ();
+  reader = wocky_xmpp_reader_new ();
+
+  wocky_xmpp_writer_stream_open (writer, TO, FROM, XMPP_VERSION, LANG, NULL,
+      &data, &length);
+  wocky_xmpp_reader_push (reader, data, length);
+
+  sent = create_stanza ();
+  wocky_xmpp_writer_write_stanza_split (writer, sent, &head, &tail);
+
+  /* the original "to" is left out */
+  g_assert (g_strstr_len (g_bytes_get_data (tail, NULL),
+      g_bytes_get_size (tail), "romeo") == NULL);
+
+  for (i = 0; recipients[i] != NULL; i++)
+    {
+      join_split (buffer, head, recipients[i], tail);
+      wocky_xmpp_reader_push (reader, buffer->data, buffer->len);
+
+      received = wocky_xmpp_reader_pop_stanza (reader);
+      g_assert (received != NULL);
+
+      wocky_node_set_attribute (wocky_stanza_get_top_node (sent), "to",
+          recipients[i]);
+      test_assert_stanzas_equal (sent, received);
+      g_object_unref (received);
+    }
+
+  /* the split stanza does not depend on the writer's buffer */
+  wocky_xmpp_writer_write_stanza (writer, sent, &data, &length);
+  join_split (buffer, head, recipients[0], tail);
+  wocky_xmpp_reader_push (reader, buffer->data, buffer->len);
+  received = wocky_xmpp_reader_pop_stanza (reader);
+  g_assert (received != NULL);
+  g_object_unref (received);
+
+  g_bytes_unref (head);
+  g_bytes_unref (tail);
+  g_byte_array_unref (buffer);
+  g_object_unref (sent);
+  g_object_unref (reader);
+  g_object_unref (writer);
+}
+
+static void
+split_perf (guint n_recipients)
+{
+  WockyXmppWriter *writer = wocky_xmpp_writer_new ();
+  WockyStanza *stanza = create_stanza ();
+  GByteArray *buffer = g_byte_array_new ();
+  gchar **recipients = g_new0 (gchar *, n_recipients + 1);
+  GBytes *head, *tail;
+  const guint8 *data;
+  gsize length;
+  gdouble each, once;
+  guint i, round, rounds = 100000 / n_recipients;
+
+  for (i = 0; i < n_recipients; i++)
+    recipients[i] = g_strdup_printf ("guest%u@example.net/resource", i);
+
+  g_test_timer_start ();
+
+  for (round = 0; round < rounds; round++)
+    {
+      for (i = 0; i < n_recipients; i++)
+        {
+          wocky_node_set_attribute (wocky_stanza_get_top_node (stanza), "to",
+              recipients[i]);
+          wocky_xmpp_writer_write_stanza (writer, stanza, &data, &length);
+        }
+    }
+
+  each = g_test_timer_elapsed ();
+  g_test_timer_start ();
+
+  for (round = 0; round < rounds; round++)
+    {
+      wocky_xmpp_writer_write_stanza_split (writer, stanza, &head, &tail);
+
+      for (i = 0; i < n_recipients; i++)
+        join_split (buffer, head, recipients[i], tail);
+
+      g_bytes_unref (head);
+      g_bytes_unref (tail);
+    }
+
+  once = g_test_timer_elapsed ();
+
+  g_test_message ("%u recipients, serialized for each: %.0f ns/recipient",
+      n_recipients, each * 1e9 / (rounds * n_recipients));
+  g_test_minimized_result (once * 1e9 / (rounds * n_recipients),
+      "%u recipients, serialized once: %.0f ns/recipient", n_recipients,
+      once * 1e9 / (rounds * n_recipients));
+
+  g_strfreev (recipients);
+  g_byte_array_unref (buffer);
+  g_object_unref (stanza);
+  g_object_unref (writer);
+}
+
+static void
+test_split_perf (void)
+{
+  split_perf (10);
+  split_perf (100);
+  split_perf (1000);
+}
+
 int
 main (int argc,
     char **argv)
@@ -213,6 +358,10 @@ main (int argc,
   g_test_add_func ("/xmpp-readwrite/readwrite", test_readwrite);
   g_test_add_func ("/xmpp-readwrite/readwrite-nostream",
     test_readwrite_nostream);
+  g_test_add_func ("/xmpp-readwrite/split", test_split);
+
+  if (g_test_perf ())
+    g_test_add_func ("/xmpp-readwrite/split-perf", test_split_perf);
 
   result = g_test_run ();
   test_deinit ();
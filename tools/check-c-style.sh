@@ -19,7 +19,8 @@ fi
 # The second and third ignore block comments (gtkdoc uses foo() as markup).
 # The fourth ignores cpp so you can
 #   #define foo(bar) (_real_foo (__FUNC__, bar)) (cpp insists on foo() style).
-if grep -n '^[^"]*[[:lower:]](' "$@" \
+# /dev/null makes grep print file names, which those rely on, even for one file.
+if grep -n '^[^"]*[[:lower:]](' "$@" /dev/null \
   | grep -v '^[-[:alnum:]_./]*:[[:digit:]]*: *\*' \
   | grep -v '^[-[:alnum:]_./]*:[[:digit:]]*: */\*' \
   | grep -v '^[-[:alnum:]_./]*:[[:digit:]]*: *#'
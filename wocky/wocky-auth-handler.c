@@ -4,6 +4,7 @@
 
 #include "wocky-auth-handler.h"
 #include "wocky-auth-registry.h"
+#include "wocky-utils.h"
 
 typedef WockyAuthHandlerIface WockyAuthHandlerInterface;
 
@@ -113,6 +114,82 @@ wocky_auth_handler_handle_auth_data (
   return func (handler, data, response, error);
 }
 
+/**
+ * wocky_auth_handler_handle_auth_data_async:
+ * @handler: a #WockyAuthHandler object
+ * @data: the challenge string
+ * @callback: a callback to call when the response is ready
+ * @user_data: data to pass to @callback
+ *
+ * Asynchronous version of wocky_auth_handler_handle_auth_data(). Handlers
+ * which have expensive work to do, such as the SCRAM key derivation, do it
+ * without blocking the main loop; for the others this is the same as the
+ * synchronous call.
+ */
+void
+wocky_auth_handler_handle_auth_data_async (
+    WockyAuthHandler *handler,
+    const GString *data,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockyAuthHandlerIface *iface = WOCKY_AUTH_HANDLER_GET_IFACE (handler);
+  GTask *task;
+  GString *response = NULL;
+  GError *error = NULL;
+
+  if (iface->auth_data_async_func != NULL)
+    {
+      iface->auth_data_async_func (handler, data, callback, user_data);
+      return;
+    }
+
+  task = g_task_new (G_OBJECT (handler), NULL, callback, user_data);
+  g_task_set_source_tag (task, wocky_auth_handler_handle_auth_data_async);
+
+  if (wocky_auth_handler_handle_auth_data (handler, data, &response, &error))
+    g_task_return_pointer (task, response,
+        (GDestroyNotify) wocky_g_string_free);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+/**
+ * wocky_auth_handler_handle_auth_data_finish:
+ * @handler: a #WockyAuthHandler object
+ * @result: the #GAsyncResult passed to the callback
+ * @response: (out) (transfer full): a location to fill with a challenge
+ *  response in a #GString
+ * @error: an optional location for a #GError to fill, or %NULL
+ *
+ * Finishes a call to wocky_auth_handler_handle_auth_data_async().
+ *
+ * Returns: %TRUE on success, otherwise %FALSE
+ */
+gboolean
+wocky_auth_handler_handle_auth_data_finish (
+    WockyAuthHandler *handler,
+    GAsyncResult *result,
+    GString **response,
+    GError **error)
+{
+  WockyAuthHandlerIface *iface = WOCKY_AUTH_HANDLER_GET_IFACE (handler);
+
+  g_assert (response != NULL);
+  *response = NULL;
+
+  if (iface->auth_data_async_func != NULL)
+    return iface->auth_data_finish_func (handler, result, response, error);
+
+  g_return_val_if_fail (g_task_is_valid (result, handler), FALSE);
+
+  *response = g_task_propagate_pointer (G_TASK (result), error);
+
+  return !g_task_had_error (G_TASK (result));
+}
+
 /**
  * wocky_auth_handler_handle_success:
  * @handler: a #WockyAuthHandler object
@@ -6,6 +6,7 @@
 #define _WOCKY_AUTH_HANDLER_H
 
 #include <glib.h>
+#include <gio/gio.h>
 
 #include "wocky-stanza.h"
 
@@ -69,6 +70,42 @@ typedef gboolean (*WockyAuthAuthDataFunc) (
     GString **response,
     GError **error);
 
+/**
+ * WockyAuthAuthDataAsyncFunc:
+ * @handler: a #WockyAuthHandler object
+ * @data: the challenge string
+ * @callback: a callback to call when the response is ready
+ * @user_data: data to pass to @callback
+ *
+ * Like #WockyAuthAuthDataFunc, for mechanisms which have expensive work to
+ * do before they can respond, such as deriving keys from the password.
+ * Handlers implementing it should do that work without blocking the main
+ * loop, for example in a thread.
+ **/
+typedef void (*WockyAuthAuthDataAsyncFunc) (
+    WockyAuthHandler *handler,
+    const GString *data,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+/**
+ * WockyAuthAuthDataFinishFunc:
+ * @handler: a #WockyAuthHandler object
+ * @result: the #GAsyncResult passed to the callback
+ * @response: (out) (transfer full): a location to fill with a challenge
+ *  response in a #GString
+ * @error: an optional location for a #GError to fill, or %NULL
+ *
+ * Finishes a #WockyAuthAuthDataAsyncFunc call.
+ *
+ * Returns: %TRUE On success, otherwise %FALSE
+ **/
+typedef gboolean (*WockyAuthAuthDataFinishFunc) (
+    WockyAuthHandler *handler,
+    GAsyncResult *result,
+    GString **response,
+    GError **error);
+
 /**
  * WockyAuthSuccessFunc:
  * @handler: a #WockyAuthHandler object
@@ -107,6 +144,20 @@ wocky_auth_handler_handle_auth_data (
     GString **response,
     GError **error);
 
+void
+wocky_auth_handler_handle_auth_data_async (
+    WockyAuthHandler *handler,
+    const GString *data,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+gboolean
+wocky_auth_handler_handle_auth_data_finish (
+    WockyAuthHandler *handler,
+    GAsyncResult *result,
+    GString **response,
+    GError **error);
+
 gboolean
 wocky_auth_handler_handle_success (
     WockyAuthHandler *handler,
@@ -127,6 +178,9 @@ typedef struct _WockyAuthHandlerIface WockyAuthHandlerIface;
  *   server is received
  * @success_func: Called when a <code>&lt;success/&gt;</code> stanza
  *   is received.
+ * @auth_data_async_func: If not %NULL, used instead of @auth_data_func
+ *   when authenticating asynchronously
+ * @auth_data_finish_func: Finishes @auth_data_async_func
  **/
 struct _WockyAuthHandlerIface
 {
@@ -136,6 +190,8 @@ struct _WockyAuthHandlerIface
     WockyAuthInitialResponseFunc initial_response_func;
     WockyAuthAuthDataFunc auth_data_func;
     WockyAuthSuccessFunc success_func;
+    WockyAuthAuthDataAsyncFunc auth_data_async_func;
+    WockyAuthAuthDataFinishFunc auth_data_finish_func;
 };
 
 G_END_DECLS
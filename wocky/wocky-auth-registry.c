@@ -9,6 +9,7 @@
 #include "wocky-sasl-scram.h"
 #include "wocky-sasl-digest-md5.h"
 #include "wocky-sasl-plain.h"
+#include "wocky-sasl-ht.h"
 #include "wocky-jabber-auth-password.h"
 #include "wocky-jabber-auth-digest.h"
 #include "wocky-utils.h"
@@ -21,6 +22,8 @@ enum
 {
   PROP_CB_TYPE = 1,
   PROP_CB_DATA,
+  PROP_CREDENTIAL_STORE,
+  PROP_SCRAM_CACHE,
 };
 
 /* private structure */
@@ -29,6 +32,8 @@ struct _WockyAuthRegistryPrivate
   gboolean dispose_has_run;
   WockyTLSBindingType cb_type;
   gchar *cb_data;
+  WockyCredentialStore *credential_store;
+  WockySaslScramCache *scram_cache;
 
   WockyAuthHandler *handler;
   GSList *handlers;
@@ -108,6 +113,14 @@ wocky_auth_registry_get_property (GObject    *object,
       g_value_set_string (value, priv->cb_data);
       break;
 
+    case PROP_CREDENTIAL_STORE:
+      g_value_set_object (value, priv->credential_store);
+      break;
+
+    case PROP_SCRAM_CACHE:
+      g_value_set_object (value, priv->scram_cache);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -133,6 +146,16 @@ wocky_auth_registry_set_property (GObject      *object,
       priv->cb_data = g_value_dup_string (value);
       break;
 
+    case PROP_CREDENTIAL_STORE:
+      g_clear_object (&priv->credential_store);
+      priv->credential_store = g_value_dup_object (value);
+      break;
+
+    case PROP_SCRAM_CACHE:
+      g_clear_object (&priv->scram_cache);
+      priv->scram_cache = g_value_dup_object (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -151,6 +174,9 @@ wocky_auth_registry_dispose (GObject *object)
 
   g_free (priv->cb_data);
   /* release any references held by the object here */
+  g_clear_object (&priv->credential_store);
+  g_clear_object (&priv->scram_cache);
+
   if (priv->handler != NULL)
     {
       g_object_unref (priv->handler);
@@ -190,6 +216,33 @@ wocky_auth_registry_class_init (WockyAuthRegistryClass *klass)
           "Base64 encoded TLS Channel binding data for the set type", NULL,
           G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * WockyAuthRegistry:credential-store:
+   *
+   * A #WockyCredentialStore holding XEP-0484 FAST tokens. When set, a
+   * stored token is preferred over the password if the server offers its
+   * mechanism, and #WockySaslAuth requests a new token over SASL2.
+   */
+  g_object_class_install_property (object_class, PROP_CREDENTIAL_STORE,
+      g_param_spec_object ("credential-store", "Credential store",
+          "Where FAST authentication tokens are kept",
+          WOCKY_TYPE_CREDENTIAL_STORE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * WockyAuthRegistry:scram-cache:
+   *
+   * A #WockySaslScramCache to look up and store the keys derived by the
+   * SCRAM mechanisms in, so that reconnecting to a server which kept the
+   * same salt doesn't derive them from the password again. May be shared
+   * between registries.
+   */
+  g_object_class_install_property (object_class, PROP_SCRAM_CACHE,
+      g_param_spec_object ("scram-cache", "SCRAM key cache",
+          "Where keys derived from the password for SCRAM are kept",
+          WOCKY_TYPE_SASL_SCRAM_CACHE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   object_class->dispose = wocky_auth_registry_dispose;
   object_class->finalize = wocky_auth_registry_finalize;
 
@@ -257,6 +310,93 @@ wocky_auth_registry_start_data_free (WockyAuthRegistryStartData *start_data)
   g_slice_free (WockyAuthRegistryStartData, start_data);
 }
 
+/* Token mechanisms in order of preference, with the channel binding each
+ * one needs. */
+static const struct {
+  const gchar *mech;
+  WockyTLSBindingType cb_type;
+} ht_handlers[] = {
+  { WOCKY_AUTH_MECH_SASL_HT_SHA_256_EXPR, WOCKY_TLS_BINDING_TLS_EXPORTER },
+  { WOCKY_AUTH_MECH_SASL_HT_SHA_256_ENDP,
+    WOCKY_TLS_BINDING_TLS_SERVER_END_POINT },
+  { WOCKY_AUTH_MECH_SASL_HT_SHA_256_UNIQ, WOCKY_TLS_BINDING_TLS_UNIQUE },
+  { WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE, WOCKY_TLS_BINDING_NONE },
+  { NULL, WOCKY_TLS_BINDING_NONE }
+};
+
+/**
+ * wocky_auth_registry_is_token_mechanism:
+ * @mechanism: the name of a SASL mechanism
+ *
+ * Returns: %TRUE if @mechanism is one of the XEP-0484 HT-* token mechanisms
+ */
+gboolean
+wocky_auth_registry_is_token_mechanism (const gchar *mechanism)
+{
+  return mechanism != NULL && g_str_has_prefix (mechanism, "HT-");
+}
+
+static WockyAuthHandler *
+wocky_auth_registry_select_token_handler (WockyAuthRegistry *self,
+    GSList *mechanisms,
+    const gchar *username,
+    const gchar *server)
+{
+  WockyAuthRegistryPrivate *priv = self->priv;
+  WockyAuthHandler *handler = NULL;
+  WockyFastToken *token;
+  guint i;
+
+  if (priv->credential_store == NULL || username == NULL)
+    return NULL;
+
+  token = wocky_credential_store_get_token (priv->credential_store,
+      username, server);
+
+  if (token == NULL)
+    return NULL;
+
+  if (wocky_fast_token_has_expired (token))
+    {
+      DEBUG ("Stored %s token has expired", token->mechanism);
+      wocky_credential_store_forget_token (priv->credential_store,
+          username, server);
+      goto out;
+    }
+
+  if (!wocky_auth_registry_has_mechanism (mechanisms, token->mechanism))
+    goto out;
+
+  for (i = 0; ht_handlers[i].mech != NULL; i++)
+    {
+      const gchar *cb_data = NULL;
+
+      if (wocky_strdiff (ht_handlers[i].mech, token->mechanism))
+        continue;
+
+      if (ht_handlers[i].cb_type != WOCKY_TLS_BINDING_NONE)
+        {
+          /* a bound token is no use if we can't bind to this channel */
+          if (priv->cb_type != ht_handlers[i].cb_type || priv->cb_data == NULL)
+            break;
+
+          cb_data = priv->cb_data;
+        }
+
+      DEBUG ("Choosing %s as auth mechanism", ht_handlers[i].mech);
+      handler = WOCKY_AUTH_HANDLER (wocky_sasl_ht_new (username,
+              token->secret));
+      WOCKY_AUTH_HANDLER_GET_IFACE (handler)->mechanism =
+          (gchar *) ht_handlers[i].mech;
+      g_object_set (G_OBJECT (handler), "cb-data", cb_data, NULL);
+      break;
+    }
+
+out:
+  wocky_fast_token_free (token);
+  return handler;
+}
+
 static gboolean
 wocky_auth_registry_select_handler (WockyAuthRegistry *self,
     GSList *mechanisms,
@@ -306,6 +446,17 @@ wocky_auth_registry_select_handler (WockyAuthRegistry *self,
         }
     }
 
+  /* A token saves us the password derivation altogether, so try that
+   * first. It is only worth it when we are actually authenticating. */
+  if (out_handler != NULL)
+    {
+      *out_handler = wocky_auth_registry_select_token_handler (self,
+          mechanisms, username, server);
+
+      if (*out_handler != NULL)
+        return TRUE;
+    }
+
   /* All the below mechanisms require password so if we have none
    * let's just stop here */
   g_return_val_if_fail (out_handler == NULL || password != NULL, FALSE);
@@ -331,6 +482,7 @@ wocky_auth_registry_select_handler (WockyAuthRegistry *self,
                   "hash-algo", scram_handlers[i].algo,
                   "cb-type", cb_type,
                   "cb-data", priv->cb_data,
+                  "cache", priv->scram_cache,
                   NULL);
             }
           return TRUE;
@@ -408,7 +560,9 @@ wocky_auth_registry_start_auth_async_func (WockyAuthRegistry *self,
 
   task = g_task_new (G_OBJECT (self), NULL, callback, user_data);
 
-  g_assert (priv->handler == NULL);
+  /* we may be restarted with a narrower mechanism list after a stored
+   * token was refused */
+  g_clear_object (&priv->handler);
 
   if (!wocky_auth_registry_select_handler (self, mechanisms,
           allow_plain, username, password, server, session_id,
@@ -487,20 +641,16 @@ wocky_auth_registry_start_auth_finish_func (WockyAuthRegistry *self,
 }
 
 static void
-wocky_auth_registry_challenge_async_func (WockyAuthRegistry *self,
-    const GString *challenge_data,
-    GAsyncReadyCallback callback,
+wocky_auth_registry_challenge_cb (GObject *source,
+    GAsyncResult *result,
     gpointer user_data)
 {
-  WockyAuthRegistryPrivate *priv = self->priv;
+  GTask *task = G_TASK (user_data);
   GString *response = NULL;
   GError *error = NULL;
-  GTask *task = g_task_new (G_OBJECT (self), NULL, callback, user_data);
-
-  g_assert (priv->handler != NULL);
 
-  if (!wocky_auth_handler_handle_auth_data (priv->handler, challenge_data,
-          &response, &error))
+  if (!wocky_auth_handler_handle_auth_data_finish (
+          WOCKY_AUTH_HANDLER (source), result, &response, &error))
     {
       g_task_return_error (task, error);
     }
@@ -513,6 +663,23 @@ wocky_auth_registry_challenge_async_func (WockyAuthRegistry *self,
   g_object_unref (task);
 }
 
+static void
+wocky_auth_registry_challenge_async_func (WockyAuthRegistry *self,
+    const GString *challenge_data,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockyAuthRegistryPrivate *priv = self->priv;
+  GTask *task = g_task_new (G_OBJECT (self), NULL, callback, user_data);
+
+  g_assert (priv->handler != NULL);
+
+  /* The handler may respond later, eg. after deriving the SCRAM keys in a
+   * thread */
+  wocky_auth_handler_handle_auth_data_async (priv->handler, challenge_data,
+      wocky_auth_registry_challenge_cb, task);
+}
+
 void
 wocky_auth_registry_challenge_async (WockyAuthRegistry *self,
     const GString *challenge_data,
@@ -602,6 +769,11 @@ wocky_auth_registry_failure (WockyAuthRegistry *self,
     GError *error)
 {
   WockyAuthRegistryClass *cls = WOCKY_AUTH_REGISTRY_GET_CLASS (self);
+  WockyAuthRegistryPrivate *priv = self->priv;
+
+  /* Keys which didn't work must not be tried again */
+  if (priv->handler != NULL && WOCKY_IS_SASL_SCRAM (priv->handler))
+    wocky_sasl_scram_forget_cached_keys (WOCKY_SASL_SCRAM (priv->handler));
 
   if (cls->failure_func != NULL)
     cls->failure_func (self, error);
@@ -9,6 +9,7 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 #include "wocky-auth-handler.h"
+#include "wocky-credential-store.h"
 #include "wocky-enumtypes.h"
 
 G_BEGIN_DECLS
@@ -68,6 +69,10 @@ typedef enum
 #define WOCKY_AUTH_MECH_SASL_SCRAM_SHA_384 "SCRAM-SHA-384"
 #define WOCKY_AUTH_MECH_SASL_SCRAM_SHA_384_PLUS "SCRAM-SHA-384-PLUS"
 #endif
+#define WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE "HT-SHA-256-NONE"
+#define WOCKY_AUTH_MECH_SASL_HT_SHA_256_UNIQ "HT-SHA-256-UNIQ"
+#define WOCKY_AUTH_MECH_SASL_HT_SHA_256_ENDP "HT-SHA-256-ENDP"
+#define WOCKY_AUTH_MECH_SASL_HT_SHA_256_EXPR "HT-SHA-256-EXPR"
 
 /**
  * WockyTLSBindingType
@@ -363,6 +368,8 @@ gboolean wocky_auth_registry_supports_one_of (WockyAuthRegistry *self,
     GSList *mechanisms,
     gboolean allow_plain);
 
+gboolean wocky_auth_registry_is_token_mechanism (const gchar *mechanism);
+
 G_END_DECLS
 
 #endif /* _WOCKY_AUTH_REGISTRY_H */
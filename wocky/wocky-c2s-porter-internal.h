@@ -0,0 +1,40 @@
+/*
+ * wocky-c2s-porter-internal.h - internal methods for WockyC2SPorter
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_COMPILATION)
+# error "This is an internal header."
+#endif
+
+#ifndef WOCKY_C2S_PORTER_INTERNAL_H
+#define WOCKY_C2S_PORTER_INTERNAL_H
+
+#include "wocky-c2s-porter.h"
+
+G_BEGIN_DECLS
+
+void _wocky_c2s_porter_send_split_async (WockyC2SPorter *self,
+    WockyStanza *stanza,
+    GBytes *head,
+    const gchar *to,
+    GBytes *tail,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+G_END_DECLS
+
+#endif /* WOCKY_C2S_PORTER_INTERNAL_H */
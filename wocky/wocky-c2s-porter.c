@@ -48,6 +48,8 @@
 #include "wocky-utils.h"
 #include "wocky-namespaces.h"
 #include "wocky-contact-factory.h"
+#include "wocky-xmpp-writer.h"
+#include "wocky-c2s-porter-internal.h"
 
 #define WOCKY_DEBUG_FLAG WOCKY_DEBUG_PORTER
 #include "wocky-debug-internal.h"
@@ -103,6 +105,21 @@ struct _WockyC2SPorterPrivate
   GQueue queueable_stanza_patterns;
 
   WockyXmppConnection *connection;
+  /* serializes the stanzas which the porter does not just hand to the
+   * connection: those sent to several recipients, and corked ones. Lazily
+   * created */
+  WockyXmppWriter *writer;
+
+  /* how long, in milliseconds, stanzas may be held back to be written
+   * together with the next ones; 0 if they are written straight away */
+  guint cork_latency;
+  /* how many bytes of stanzas may be held back */
+  gsize cork_threshold;
+  guint cork_timeout_id;
+  /* how many bytes of stanzas are being held back */
+  gsize corked_bytes;
+  /* how many stanzas, from the head of sending_queue, are being written */
+  guint n_sending;
 };
 
 G_DEFINE_TYPE_WITH_CODE (WockyC2SPorter, wocky_c2s_porter, G_TYPE_OBJECT,
@@ -116,6 +133,15 @@ typedef struct
   GCancellable *cancellable;
   GTask *task;
   gulong cancelled_sig_id;
+  /* if head is not NULL, stanza has already been serialized, as head and
+   * tail, and is to be sent to the recipient to */
+  GBytes *head;
+  GBytes *tail;
+  gchar *to;
+  /* the serialized stanza, if the porter serialized it itself */
+  GBytes *bytes;
+  /* whether bytes counts towards corked_bytes */
+  gboolean corked;
 } sending_queue_elem;
 
 static void wocky_c2s_porter_send_async (WockyPorter *porter,
@@ -155,6 +181,16 @@ sending_queue_elem_free (sending_queue_elem *elem)
     }
   g_object_unref (elem->task);
 
+  if (elem->head != NULL)
+    {
+      g_bytes_unref (elem->head);
+      g_bytes_unref (elem->tail);
+      g_free (elem->to);
+    }
+
+  if (elem->bytes != NULL)
+    g_bytes_unref (elem->bytes);
+
   g_slice_free (sending_queue_elem, elem);
 }
 
@@ -512,6 +548,13 @@ wocky_c2s_porter_dispose (GObject *object)
   priv->dispose_has_run = TRUE;
 
   g_clear_object (&(priv->connection));
+  g_clear_object (&(priv->writer));
+
+  if (priv->cork_timeout_id != 0)
+    {
+      g_source_remove (priv->cork_timeout_id);
+      priv->cork_timeout_id = 0;
+    }
 
   if (priv->receive_cancellable != NULL)
     {
@@ -582,17 +625,189 @@ wocky_c2s_porter_new (WockyXmppConnection *connection,
     NULL);
 }
 
+static WockyXmppWriter *
+ensure_writer (WockyC2SPorter *self)
+{
+  WockyC2SPorterPrivate *priv = self->priv;
+
+  if (priv->writer == NULL)
+    {
+      const guint8 *data;
+      gsize length;
+
+      /* The stanzas are going into the connection's stream, so there's no
+       * need to declare its namespaces on each of them */
+      priv->writer = wocky_xmpp_writer_new ();
+      wocky_xmpp_writer_stream_open (priv->writer, NULL, NULL, NULL, NULL,
+          NULL, &data, &length);
+    }
+
+  return priv->writer;
+}
+
+/* Serializes @elem's stanza, if that hasn't been done already */
+static GBytes *
+sending_queue_elem_get_bytes (WockyC2SPorter *self,
+    sending_queue_elem *elem)
+{
+  if (elem->bytes != NULL)
+    return elem->bytes;
+
+  if (elem->head != NULL)
+    {
+      gchar *escaped = g_markup_escape_text (elem->to, -1);
+      GByteArray *joined = g_byte_array_new ();
+      gconstpointer data;
+      gsize size;
+
+      data = g_bytes_get_data (elem->head, &size);
+      g_byte_array_append (joined, data, size);
+      g_byte_array_append (joined, (const guint8 *) " to=\"", 5);
+      g_byte_array_append (joined, (const guint8 *) escaped, strlen (escaped));
+      g_byte_array_append (joined, (const guint8 *) "\"", 1);
+      data = g_bytes_get_data (elem->tail, &size);
+      g_byte_array_append (joined, data, size);
+
+      elem->bytes = g_byte_array_free_to_bytes (joined);
+      g_free (escaped);
+    }
+  else
+    {
+      elem->bytes = wocky_xmpp_writer_write_stanza_bytes (
+          ensure_writer (self), elem->stanza);
+    }
+
+  return elem->bytes;
+}
+
+/* Emits ::sending for @elem. Split stanzas are shared between all the
+ * recipients of a multicast and have no "to" attribute, so if anyone is
+ * listening, give them a copy addressed to this recipient. */
+static void
+emit_sending (WockyC2SPorter *self,
+    sending_queue_elem *elem)
+{
+  static guint sending_id = 0;
+  WockyStanza *addressed;
+
+  if (elem->to == NULL)
+    {
+      g_signal_emit_by_name (self, "sending", elem->stanza);
+      return;
+    }
+
+  if (sending_id == 0)
+    sending_id = g_signal_lookup ("sending", WOCKY_TYPE_PORTER);
+
+  if (!g_signal_has_handler_pending (self, sending_id, 0, FALSE))
+    return;
+
+  addressed = wocky_stanza_copy (elem->stanza);
+  wocky_node_set_attribute (wocky_stanza_get_top_node (addressed), "to",
+      elem->to);
+  g_signal_emit (self, sending_id, 0, addressed);
+  g_object_unref (addressed);
+}
+
+/* Writes as many stanzas from the head of the queue as fit in
+ * cork_threshold, and at least one, in a single write */
+static void
+send_corked_stanzas (WockyC2SPorter *self)
+{
+  WockyC2SPorterPrivate *priv = self->priv;
+  GByteArray *batch = NULL;
+  GBytes *bytes = NULL;
+  GCancellable *cancellable = NULL;
+  GList *l;
+  gsize size = 0;
+  guint i;
+
+  for (l = priv->sending_queue->head; l != NULL; l = l->next)
+    {
+      sending_queue_elem *elem = l->data;
+      GBytes *elem_bytes = sending_queue_elem_get_bytes (self, elem);
+      gsize elem_size = g_bytes_get_size (elem_bytes);
+
+      if (priv->n_sending > 0 && size + elem_size > priv->cork_threshold)
+        break;
+
+      if (elem->cancelled_sig_id != 0)
+        {
+          g_signal_handler_disconnect (elem->cancellable,
+              elem->cancelled_sig_id);
+          elem->cancelled_sig_id = 0;
+        }
+
+      if (elem->corked)
+        {
+          priv->corked_bytes -= elem_size;
+          elem->corked = FALSE;
+        }
+
+      if (priv->n_sending == 0)
+        {
+          bytes = g_bytes_ref (elem_bytes);
+          cancellable = elem->cancellable;
+        }
+      else
+        {
+          if (batch == NULL)
+            {
+              batch = g_byte_array_sized_new (priv->cork_threshold);
+              g_byte_array_append (batch, g_bytes_get_data (bytes, NULL),
+                  g_bytes_get_size (bytes));
+              g_bytes_unref (bytes);
+            }
+
+          g_byte_array_append (batch, g_bytes_get_data (elem_bytes, NULL),
+              elem_size);
+          /* a write of several stanzas can't be cancelled for just one of
+           * them */
+          cancellable = NULL;
+        }
+
+      size += elem_size;
+      priv->n_sending++;
+    }
+
+  if (batch != NULL)
+    bytes = g_byte_array_free_to_bytes (batch);
+
+  DEBUG ("writing %u stanzas, %" G_GSIZE_FORMAT " bytes", priv->n_sending,
+      size);
+
+  wocky_xmpp_connection_send_bytes_async (priv->connection, bytes,
+      cancellable, send_stanza_cb, g_object_ref (self));
+  g_bytes_unref (bytes);
+
+  for (i = 0, l = priv->sending_queue->head; i < priv->n_sending;
+      i++, l = l->next)
+    emit_sending (self, l->data);
+}
+
 static void
 send_head_stanza (WockyC2SPorter *self)
 {
   WockyC2SPorterPrivate *priv = self->priv;
   sending_queue_elem *elem;
 
+  if (priv->cork_timeout_id != 0)
+    {
+      g_source_remove (priv->cork_timeout_id);
+      priv->cork_timeout_id = 0;
+    }
+
   elem = g_queue_peek_head (priv->sending_queue);
   if (elem == NULL)
     /* Nothing to send */
     return;
 
+  if (priv->cork_latency > 0 || elem->bytes != NULL)
+    {
+      send_corked_stanzas (self);
+      return;
+    }
+
   if (elem->cancelled_sig_id != 0)
     {
       /* We are going to start sending the stanza. Lower layers are now
@@ -601,10 +816,17 @@ send_head_stanza (WockyC2SPorter *self)
       elem->cancelled_sig_id = 0;
     }
 
-  wocky_xmpp_connection_send_stanza_async (priv->connection,
-      elem->stanza, elem->cancellable, send_stanza_cb, g_object_ref (self));
+  priv->n_sending = 1;
+
+  if (elem->head != NULL)
+    wocky_xmpp_connection_send_split_stanza_async (priv->connection,
+        elem->head, elem->to, elem->tail, elem->cancellable, send_stanza_cb,
+        g_object_ref (self));
+  else
+    wocky_xmpp_connection_send_stanza_async (priv->connection,
+        elem->stanza, elem->cancellable, send_stanza_cb, g_object_ref (self));
 
-  g_signal_emit_by_name (self, "sending", elem->stanza);
+  emit_sending (self, elem);
 }
 
 static void
@@ -621,6 +843,9 @@ terminate_sending_operations (WockyC2SPorter *self,
       g_task_return_error (elem->task, g_error_copy (error));
       sending_queue_elem_free (elem);
     }
+
+  priv->n_sending = 0;
+  priv->corked_bytes = 0;
 }
 
 static gboolean
@@ -664,17 +889,19 @@ send_stanza_cb (GObject *source,
     }
   else
     {
-      sending_queue_elem *elem = g_queue_pop_head (priv->sending_queue);
-
-      if (elem == NULL)
-        /* The elem could have been removed from the queue if its sending
+      if (priv->n_sending == 0)
+        /* The elems could have been removed from the queue if their sending
          * operation has already been completed (for example by forcing to
          * close the connection). */
         return;
 
-      g_task_return_boolean (elem->task, TRUE);
+      for (; priv->n_sending > 0; priv->n_sending--)
+        {
+          sending_queue_elem *elem = g_queue_pop_head (priv->sending_queue);
 
-      sending_queue_elem_free (elem);
+          g_task_return_boolean (elem->task, TRUE);
+          sending_queue_elem_free (elem);
+        }
 
       if (g_queue_get_length (priv->sending_queue) > 0)
         {
@@ -698,10 +925,73 @@ send_cancelled_cb (GCancellable *cancellable,
   g_task_return_new_error (elem->task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
         "Sending was cancelled");
 
+  if (elem->corked)
+    priv->corked_bytes -= g_bytes_get_size (elem->bytes);
+
   g_queue_remove (priv->sending_queue, elem);
   sending_queue_elem_free (elem);
 }
 
+static gboolean
+cork_timeout_cb (gpointer user_data)
+{
+  WockyC2SPorter *self = user_data;
+  WockyC2SPorterPrivate *priv = self->priv;
+
+  priv->cork_timeout_id = 0;
+
+  if (priv->n_sending == 0 && !priv->sending_whitespace_ping)
+    send_head_stanza (self);
+
+  return FALSE;
+}
+
+/* Whether the stanza just queued should be held back, to be written
+ * together with the next ones */
+static gboolean
+cork_elem (WockyC2SPorter *self,
+    sending_queue_elem *elem)
+{
+  WockyC2SPorterPrivate *priv = self->priv;
+
+  if (priv->cork_latency == 0)
+    return FALSE;
+
+  priv->corked_bytes += g_bytes_get_size (
+      sending_queue_elem_get_bytes (self, elem));
+  elem->corked = TRUE;
+
+  if (priv->corked_bytes >= priv->cork_threshold)
+    return FALSE;
+
+  if (priv->cork_timeout_id == 0)
+    priv->cork_timeout_id = g_timeout_add (priv->cork_latency,
+        cork_timeout_cb, self);
+
+  return TRUE;
+}
+
+static void
+queue_elem (WockyC2SPorter *self,
+    sending_queue_elem *elem)
+{
+  WockyC2SPorterPrivate *priv = self->priv;
+  gboolean corked;
+
+  g_queue_push_tail (priv->sending_queue, elem);
+  corked = cork_elem (self, elem);
+
+  if (priv->n_sending == 0 && !priv->sending_whitespace_ping && !corked)
+    {
+      send_head_stanza (self);
+    }
+  else if (elem->cancellable != NULL)
+    {
+      elem->cancelled_sig_id = g_cancellable_connect (elem->cancellable,
+          G_CALLBACK (send_cancelled_cb), elem, NULL);
+    }
+}
+
 static void
 wocky_c2s_porter_send_async (WockyPorter *porter,
     WockyStanza *stanza,
@@ -711,7 +1001,6 @@ wocky_c2s_porter_send_async (WockyPorter *porter,
 {
   WockyC2SPorter *self = WOCKY_C2S_PORTER (porter);
   WockyC2SPorterPrivate *priv = self->priv;
-  sending_queue_elem *elem;
 
   if (priv->close_task != NULL || priv->force_close_task != NULL)
     {
@@ -722,20 +1011,188 @@ wocky_c2s_porter_send_async (WockyPorter *porter,
       return;
     }
 
+  queue_elem (self, sending_queue_elem_new (self, stanza, cancellable,
+      callback, user_data));
+}
+
+/*
+ * _wocky_c2s_porter_send_split_async:
+ * @self: a porter
+ * @stanza: the stanza to send
+ * @head: @stanza's serialization, from wocky_xmpp_writer_write_stanza_split()
+ * @to: the recipient
+ * @tail: the rest of @stanza's serialization
+ *
+ * Queues @stanza to be sent to @to, as wocky_porter_send_async() does but
+ * without serializing it again. Finish with wocky_porter_send_finish().
+ */
+void
+_wocky_c2s_porter_send_split_async (WockyC2SPorter *self,
+    WockyStanza *stanza,
+    GBytes *head,
+    const gchar *to,
+    GBytes *tail,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockyC2SPorterPrivate *priv = self->priv;
+  sending_queue_elem *elem;
+
+  if (priv->close_task != NULL || priv->force_close_task != NULL)
+    {
+      g_task_report_new_error (G_OBJECT (self), callback, user_data,
+          _wocky_c2s_porter_send_split_async,
+          WOCKY_PORTER_ERROR, WOCKY_PORTER_ERROR_CLOSING,
+          "Porter is closing");
+      return;
+    }
+
   elem = sending_queue_elem_new (self, stanza, cancellable, callback,
       user_data);
-  g_queue_push_tail (priv->sending_queue, elem);
+  elem->head = g_bytes_ref (head);
+  elem->tail = g_bytes_ref (tail);
+  elem->to = g_strdup (to);
 
-  if (g_queue_get_length (priv->sending_queue) == 1 &&
-      !priv->sending_whitespace_ping)
+  queue_elem (self, elem);
+}
+
+typedef struct {
+    GTask *task;
+    guint pending;
+    GError *first_error /* owned, NULL until a send fails */;
+} MulticastData;
+
+static void
+multicast_sent_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  MulticastData *data = user_data;
+  GError *error = NULL;
+
+  if (!wocky_porter_send_finish (WOCKY_PORTER (source), result, &error))
     {
-      send_head_stanza (self);
+      /* report the first error, but carry on with the other recipients */
+      if (data->first_error == NULL)
+        data->first_error = error;
+      else
+        g_error_free (error);
     }
-  else if (cancellable != NULL)
+
+  if (--data->pending > 0)
+    return;
+
+  if (data->first_error != NULL)
+    g_task_return_error (data->task, data->first_error);
+  else
+    g_task_return_boolean (data->task, TRUE);
+
+  g_object_unref (data->task);
+  g_slice_free (MulticastData, data);
+}
+
+static void
+wocky_c2s_porter_flush (WockyPorter *porter)
+{
+  WockyC2SPorter *self = WOCKY_C2S_PORTER (porter);
+  WockyC2SPorterPrivate *priv = self->priv;
+
+  /* if a write is in progress, everything queued will be written as soon
+   * as it has finished */
+  if (priv->n_sending == 0 && !priv->sending_whitespace_ping)
+    send_head_stanza (self);
+}
+
+/**
+ * wocky_c2s_porter_set_cork:
+ * @self: a #WockyC2SPorter
+ * @latency: how long, in milliseconds, stanzas may be held back, or 0 to
+ *  write each stanza as soon as possible
+ * @threshold: how many bytes of stanzas may be held back
+ *
+ * Sets whether the porter should be in cork mode. In cork mode, a stanza
+ * sent while nothing else is being written is held back for up to @latency
+ * milliseconds, or until @threshold bytes of stanzas have been queued, and
+ * all the stanzas queued by then are written out at once. Stanzas queued
+ * while a write is in progress are likewise written together, up to
+ * @threshold bytes at a time. This cuts down on the number of writes (and,
+ * over TLS, of records) when a burst of stanzas is sent at once.
+ *
+ * Call wocky_porter_flush() to write any stanzas which are being held back
+ * straight away.
+ */
+void
+wocky_c2s_porter_set_cork (WockyC2SPorter *self,
+    guint latency,
+    gsize threshold)
+{
+  WockyC2SPorterPrivate *priv;
+
+  g_return_if_fail (WOCKY_IS_C2S_PORTER (self));
+
+  priv = self->priv;
+  priv->cork_latency = latency;
+  priv->cork_threshold = threshold;
+
+  if (latency == 0)
+    wocky_c2s_porter_flush (WOCKY_PORTER (self));
+}
+
+static void
+wocky_c2s_porter_send_multicast_async (WockyPorter *porter,
+    WockyStanza *stanza,
+    const gchar * const *recipients,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockyC2SPorter *self = WOCKY_C2S_PORTER (porter);
+  WockyC2SPorterPrivate *priv = self->priv;
+  MulticastData *data;
+  GBytes *head, *tail;
+  guint i;
+
+  if (priv->close_task != NULL || priv->force_close_task != NULL)
     {
-      elem->cancelled_sig_id = g_cancellable_connect (cancellable,
-          G_CALLBACK (send_cancelled_cb), elem, NULL);
+      g_task_report_new_error (G_OBJECT (self), callback, user_data,
+          wocky_c2s_porter_send_multicast_async,
+          WOCKY_PORTER_ERROR, WOCKY_PORTER_ERROR_CLOSING,
+          "Porter is closing");
+      return;
+    }
+
+  data = g_slice_new0 (MulticastData);
+  data->task = g_task_new (G_OBJECT (self), cancellable, callback, user_data);
+  data->pending = g_strv_length ((gchar **) recipients);
+
+  if (data->pending == 0)
+    {
+      g_task_return_boolean (data->task, TRUE);
+      g_object_unref (data->task);
+      g_slice_free (MulticastData, data);
+      return;
     }
+
+  wocky_xmpp_writer_write_stanza_split (ensure_writer (self), stanza,
+      &head, &tail);
+
+  for (i = 0; recipients[i] != NULL; i++)
+    _wocky_c2s_porter_send_split_async (self, stanza, head, recipients[i],
+        tail, cancellable, multicast_sent_cb, data);
+
+  g_bytes_unref (head);
+  g_bytes_unref (tail);
+}
+
+static gboolean
+wocky_c2s_porter_send_multicast_finish (WockyPorter *porter,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, porter), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 static gboolean
@@ -1460,6 +1917,9 @@ wocky_c2s_porter_close_async (WockyPorter *porter,
 
   g_signal_emit_by_name (self, "closing");
 
+  /* don't keep the close waiting for stanzas held back by cork mode */
+  wocky_porter_flush (porter);
+
   if (sending_in_progress (self))
     {
       DEBUG ("Sending queue is not empty. Flushing it before "
@@ -1736,6 +2196,149 @@ wocky_c2s_porter_register_handler_from_server (
   return ret;
 }
 
+typedef struct {
+    WockyC2SPorter *self;
+    WockyXmppReaderStreamingFunc func;
+    gpointer user_data;
+    GDestroyNotify destroy;
+} StreamingHandler;
+
+static gboolean
+streaming_handler_from_server_cb (WockyStanza *stanza,
+    WockyNode *item,
+    gpointer user_data)
+{
+  StreamingHandler *handler = user_data;
+  const gchar *from;
+  gchar *node = NULL, *domain = NULL, *resource = NULL;
+  gboolean is_from_server;
+
+  /* The sender is vetted once, when the stanza starts; its items only get
+   * this far if it passed */
+  if (item != NULL)
+    return handler->func (stanza, item, handler->user_data);
+
+  /* The same test as handle_stanza() makes for MATCH_SERVER handlers */
+  from = wocky_stanza_get_from (stanza);
+
+  if (from == NULL)
+    {
+      is_from_server = TRUE;
+    }
+  else if (wocky_decode_jid (from, &node, &domain, &resource))
+    {
+      gchar *nfrom = wocky_compose_jid (node, domain, resource);
+
+      is_from_server = stanza_is_from_server (handler->self, nfrom);
+      g_free (nfrom);
+    }
+  else
+    {
+      is_from_server = FALSE;
+    }
+
+  g_free (node);
+  g_free (domain);
+  g_free (resource);
+
+  /* Items from anyone else stay in the stanza, to be dispatched as usual */
+  if (!is_from_server)
+    return FALSE;
+
+  return handler->func (stanza, NULL, handler->user_data);
+}
+
+static void
+streaming_handler_free (gpointer data)
+{
+  StreamingHandler *handler = data;
+
+  if (handler->destroy != NULL)
+    handler->destroy (handler->user_data);
+
+  g_slice_free (StreamingHandler, handler);
+}
+
+/**
+ * wocky_c2s_porter_add_streaming_handler_from_server:
+ * @self: A #WockyC2SPorter instance
+ * @type: the type of stanza to stream
+ * @name: the name of a child of the stanzas' top nodes
+ * @ns: the namespace of that child
+ * @func: a function to call with each child of that child
+ * @user_data: data to pass to @func
+ * @destroy: called on @user_data when the handler is removed, or %NULL
+ *
+ * Streams the items of stanzas from the local user's server to @func as
+ * they are read, as wocky_xmpp_connection_add_streaming_handler() does.
+ * Each item @func accepts is left out of the stanza which is eventually
+ * dispatched to the porter's handlers; this is useful for replies such as
+ * rosters which may be too large to build in memory in one piece. The
+ * sender of each stanza is checked once, before @func is called with a
+ * %NULL item; stanzas from anyone else are left whole.
+ *
+ * Items reach @func as soon as they are read, which may be before stanzas
+ * received earlier have been dispatched to the porter's handlers. If that
+ * matters, @func should keep what it learns from the items until the
+ * stanza itself is dispatched, as #WockyRoster does.
+ *
+ * For example, to see each item of a roster as it arrives, call:
+ *
+ * |[
+ * id = wocky_c2s_porter_add_streaming_handler_from_server (porter,
+ *   WOCKY_STANZA_TYPE_IQ, "query", WOCKY_XMPP_NS_ROSTER,
+ *   roster_item_received_cb, self, NULL);
+ * ]|
+ *
+ * Returns: a non-zero ID for use with
+ *  wocky_c2s_porter_remove_streaming_handler().
+ */
+guint
+wocky_c2s_porter_add_streaming_handler_from_server (
+    WockyC2SPorter *self,
+    WockyStanzaType type,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderStreamingFunc func,
+    gpointer user_data,
+    GDestroyNotify destroy)
+{
+  StreamingHandler *handler;
+
+  g_return_val_if_fail (WOCKY_IS_C2S_PORTER (self), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  handler = g_slice_new (StreamingHandler);
+  handler->self = self;
+  handler->func = func;
+  handler->user_data = user_data;
+  handler->destroy = destroy;
+
+  return wocky_xmpp_connection_add_streaming_handler (self->priv->connection,
+      type, name, ns, streaming_handler_from_server_cb, handler,
+      streaming_handler_free);
+}
+
+/**
+ * wocky_c2s_porter_remove_streaming_handler:
+ * @self: A #WockyC2SPorter instance
+ * @id: the id of a handler added by
+ *  wocky_c2s_porter_add_streaming_handler_from_server()
+ *
+ * Stops streaming items to a handler.
+ */
+void
+wocky_c2s_porter_remove_streaming_handler (WockyC2SPorter *self,
+    guint id)
+{
+  g_return_if_fail (WOCKY_IS_C2S_PORTER (self));
+
+  if (self->priv->connection == NULL)
+    return;
+
+  wocky_xmpp_connection_remove_streaming_handler (self->priv->connection, id);
+}
+
 static void
 wocky_c2s_porter_unregister_handler (WockyPorter *porter,
     guint id)
@@ -2218,4 +2821,9 @@ wocky_porter_iface_init (gpointer g_iface,
 
   iface->force_close_async = wocky_c2s_porter_force_close_async;
   iface->force_close_finish = wocky_c2s_porter_force_close_finish;
+
+  iface->send_multicast_async = wocky_c2s_porter_send_multicast_async;
+  iface->send_multicast_finish = wocky_c2s_porter_send_multicast_finish;
+
+  iface->flush = wocky_c2s_porter_flush;
 }
@@ -119,9 +119,24 @@ guint wocky_c2s_porter_register_handler_from_server (
     gpointer user_data,
     ...) G_GNUC_NULL_TERMINATED;
 
+guint wocky_c2s_porter_add_streaming_handler_from_server (
+    WockyC2SPorter *self,
+    WockyStanzaType type,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderStreamingFunc func,
+    gpointer user_data,
+    GDestroyNotify destroy);
+void wocky_c2s_porter_remove_streaming_handler (WockyC2SPorter *self,
+    guint id);
+
 void wocky_c2s_porter_enable_power_saving_mode (WockyC2SPorter *porter,
     gboolean enable);
 
+void wocky_c2s_porter_set_cork (WockyC2SPorter *self,
+    guint latency,
+    gsize threshold);
+
 G_END_DECLS
 
 #endif /* #ifndef __WOCKY_C2S_PORTER_H__*/
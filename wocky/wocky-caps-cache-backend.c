@@ -0,0 +1,149 @@
+/*
+ * wocky-caps-cache-backend.c - Source for WockyCapsCacheBackend
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION: wocky-caps-cache-backend
+ * @title: WockyCapsCacheBackend
+ * @short_description: storage for #WockyCapsCache
+ * @include: wocky/wocky-caps-cache-backend.h
+ *
+ * The interface to the persistent store behind a #WockyCapsCache. Wocky
+ * provides #WockyCapsCacheSqlite, the default, and #WockyCapsCacheMmap.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-caps-cache-backend.h"
+
+typedef WockyCapsCacheBackendIface WockyCapsCacheBackendInterface;
+
+G_DEFINE_INTERFACE (WockyCapsCacheBackend, wocky_caps_cache_backend,
+    G_TYPE_OBJECT)
+
+static void
+wocky_caps_cache_backend_default_init (
+    WockyCapsCacheBackendInterface *iface)
+{
+}
+
+/**
+ * wocky_caps_cache_backend_lookup:
+ * @backend: a #WockyCapsCacheBackend
+ * @node: the capability node to look up
+ *
+ * Looks up the disco#info reply stored for @node.
+ *
+ * Returns: (transfer full): the encoded reply, to be decoded with
+ *  wocky_node_tree_new_from_bytes(), or %NULL if there is none
+ */
+GBytes *
+wocky_caps_cache_backend_lookup (WockyCapsCacheBackend *backend,
+    const gchar *node)
+{
+  WockyCapsCacheBackendLookupFunc func =
+    WOCKY_CAPS_CACHE_BACKEND_GET_IFACE (backend)->lookup_func;
+
+  g_return_val_if_fail (node != NULL, NULL);
+
+  if (func == NULL)
+    return NULL;
+
+  return func (backend, node);
+}
+
+/**
+ * wocky_caps_cache_backend_insert:
+ * @backend: a #WockyCapsCacheBackend
+ * @node: the capability node
+ * @reply: the reply for @node, encoded by wocky_node_tree_to_bytes()
+ *
+ * Stores @reply for @node, unless something is already stored for it.
+ */
+void
+wocky_caps_cache_backend_insert (WockyCapsCacheBackend *backend,
+    const gchar *node,
+    GBytes *reply)
+{
+  WockyCapsCacheBackendInsertFunc func =
+    WOCKY_CAPS_CACHE_BACKEND_GET_IFACE (backend)->insert_func;
+
+  g_return_if_fail (node != NULL);
+  g_return_if_fail (reply != NULL);
+
+  if (func != NULL)
+    func (backend, node, reply);
+}
+
+/**
+ * wocky_caps_cache_backend_touch:
+ * @backend: a #WockyCapsCacheBackend
+ * @node: a capability node which was just used
+ *
+ * Marks @node as recently used.
+ */
+void
+wocky_caps_cache_backend_touch (WockyCapsCacheBackend *backend,
+    const gchar *node)
+{
+  WockyCapsCacheBackendTouchFunc func =
+    WOCKY_CAPS_CACHE_BACKEND_GET_IFACE (backend)->touch_func;
+
+  if (func != NULL)
+    func (backend, node);
+}
+
+/**
+ * wocky_caps_cache_backend_shrink:
+ * @backend: a #WockyCapsCacheBackend
+ * @high_threshold: the number of entries above which to shrink
+ * @low_threshold: the number of entries to shrink to
+ *
+ * Throws away the least recently used entries if @backend has grown past
+ * @high_threshold.
+ */
+void
+wocky_caps_cache_backend_shrink (WockyCapsCacheBackend *backend,
+    guint high_threshold,
+    guint low_threshold)
+{
+  WockyCapsCacheBackendShrinkFunc func =
+    WOCKY_CAPS_CACHE_BACKEND_GET_IFACE (backend)->shrink_func;
+
+  g_return_if_fail (low_threshold <= high_threshold);
+
+  if (func != NULL)
+    func (backend, high_threshold, low_threshold);
+}
+
+/**
+ * wocky_caps_cache_backend_clear:
+ * @backend: a #WockyCapsCacheBackend
+ *
+ * Throws away everything stored in @backend.
+ */
+void
+wocky_caps_cache_backend_clear (WockyCapsCacheBackend *backend)
+{
+  WockyCapsCacheBackendClearFunc func =
+    WOCKY_CAPS_CACHE_BACKEND_GET_IFACE (backend)->clear_func;
+
+  if (func != NULL)
+    func (backend);
+}
@@ -0,0 +1,156 @@
+/*
+ * wocky-caps-cache-backend.h - Header for WockyCapsCacheBackend
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef _WOCKY_CAPS_CACHE_BACKEND_H
+#define _WOCKY_CAPS_CACHE_BACKEND_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define WOCKY_TYPE_CAPS_CACHE_BACKEND (wocky_caps_cache_backend_get_type ())
+#define WOCKY_CAPS_CACHE_BACKEND(obj) (G_TYPE_CHECK_INSTANCE_CAST( \
+    (obj), WOCKY_TYPE_CAPS_CACHE_BACKEND, WockyCapsCacheBackend))
+#define WOCKY_IS_CAPS_CACHE_BACKEND(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE((obj), WOCKY_TYPE_CAPS_CACHE_BACKEND))
+#define WOCKY_CAPS_CACHE_BACKEND_GET_IFACE(obj) \
+    (G_TYPE_INSTANCE_GET_INTERFACE ((obj), WOCKY_TYPE_CAPS_CACHE_BACKEND, \
+        WockyCapsCacheBackendIface))
+
+typedef struct _WockyCapsCacheBackend WockyCapsCacheBackend;
+
+/**
+ * WockyCapsCacheBackendLookupFunc:
+ * @backend: a #WockyCapsCacheBackend object
+ * @node: the capability node to look up
+ *
+ * Looks up the disco#info reply stored for @node.
+ *
+ * Returns: (transfer full): the reply, as encoded by
+ *  wocky_node_tree_to_bytes(), or %NULL if nothing is stored for @node
+ **/
+typedef GBytes * (*WockyCapsCacheBackendLookupFunc) (
+    WockyCapsCacheBackend *backend,
+    const gchar *node);
+
+/**
+ * WockyCapsCacheBackendInsertFunc:
+ * @backend: a #WockyCapsCacheBackend object
+ * @node: the capability node
+ * @reply: the disco#info reply for @node, as encoded by
+ *  wocky_node_tree_to_bytes()
+ *
+ * Stores @reply for @node. If something is already stored for @node, it
+ * is kept: the reply for a given node never changes.
+ **/
+typedef void (*WockyCapsCacheBackendInsertFunc) (
+    WockyCapsCacheBackend *backend,
+    const gchar *node,
+    GBytes *reply);
+
+/**
+ * WockyCapsCacheBackendTouchFunc:
+ * @backend: a #WockyCapsCacheBackend object
+ * @node: a capability node which was just used
+ *
+ * Records that @node was used, so that it's among the last entries to be
+ * thrown away when the cache is full.
+ **/
+typedef void (*WockyCapsCacheBackendTouchFunc) (
+    WockyCapsCacheBackend *backend,
+    const gchar *node);
+
+/**
+ * WockyCapsCacheBackendShrinkFunc:
+ * @backend: a #WockyCapsCacheBackend object
+ * @high_threshold: the number of entries above which @backend should shrink
+ * @low_threshold: the number of entries to shrink to
+ *
+ * Called after every insert. If @backend holds more than @high_threshold
+ * entries, it should throw away the least recently used ones until it holds
+ * @low_threshold. This should be cheap when there is nothing to do.
+ **/
+typedef void (*WockyCapsCacheBackendShrinkFunc) (
+    WockyCapsCacheBackend *backend,
+    guint high_threshold,
+    guint low_threshold);
+
+/**
+ * WockyCapsCacheBackendClearFunc:
+ * @backend: a #WockyCapsCacheBackend object
+ *
+ * Throws everything away. Called when something stored in @backend turns
+ * out to be unreadable, in case that means the store is corrupt.
+ **/
+typedef void (*WockyCapsCacheBackendClearFunc) (
+    WockyCapsCacheBackend *backend);
+
+GType
+wocky_caps_cache_backend_get_type (void);
+
+GBytes *
+wocky_caps_cache_backend_lookup (WockyCapsCacheBackend *backend,
+    const gchar *node);
+
+void
+wocky_caps_cache_backend_insert (WockyCapsCacheBackend *backend,
+    const gchar *node,
+    GBytes *reply);
+
+void
+wocky_caps_cache_backend_touch (WockyCapsCacheBackend *backend,
+    const gchar *node);
+
+void
+wocky_caps_cache_backend_shrink (WockyCapsCacheBackend *backend,
+    guint high_threshold,
+    guint low_threshold);
+
+void
+wocky_caps_cache_backend_clear (WockyCapsCacheBackend *backend);
+
+typedef struct _WockyCapsCacheBackendIface WockyCapsCacheBackendIface;
+
+/**
+ * WockyCapsCacheBackendIface:
+ * @parent: The parent interface.
+ * @lookup_func: Called to look up a stored reply
+ * @insert_func: Called to store a new reply
+ * @touch_func: Called when a stored reply is used
+ * @shrink_func: Called after each insert to keep the store's size bounded
+ * @clear_func: Called to throw away everything
+ *
+ * The interface implemented by the stores #WockyCapsCache keeps disco#info
+ * replies in.
+ **/
+struct _WockyCapsCacheBackendIface
+{
+    GTypeInterface parent;
+    WockyCapsCacheBackendLookupFunc lookup_func;
+    WockyCapsCacheBackendInsertFunc insert_func;
+    WockyCapsCacheBackendTouchFunc touch_func;
+    WockyCapsCacheBackendShrinkFunc shrink_func;
+    WockyCapsCacheBackendClearFunc clear_func;
+};
+
+G_END_DECLS
+
+#endif /* defined _WOCKY_CAPS_CACHE_BACKEND_H */
@@ -0,0 +1,955 @@
+/*
+ * wocky-caps-cache-mmap.c - Source for WockyCapsCacheMmap
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION: wocky-caps-cache-mmap
+ * @title: WockyCapsCacheMmap
+ * @short_description: memory-mapped storage for #WockyCapsCache
+ * @include: wocky/wocky-caps-cache-mmap.h
+ *
+ * A #WockyCapsCacheBackend which keeps disco#info replies in a single
+ * append-only file, mapped into memory by every process using it. Once the
+ * file is mapped, looking an entry up is a probe of an open-addressing
+ * index and a copy; it takes no locks and makes no system calls, so any
+ * number of processes can read the cache concurrently.
+ *
+ * Processes adding entries take an exclusive lock on the file. New records
+ * are appended to the data area and only then published in the index, so a
+ * crash part-way through an append leaves nothing visible but some unused
+ * space. When the index or the data area is full, or there are too many
+ * entries, a compacted copy of the file is written and renamed over the
+ * original, and the original is marked as obsolete so that other processes
+ * mapping it know to open the new one.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-caps-cache-mmap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#define WOCKY_DEBUG_FLAG WOCKY_DEBUG_PRESENCE
+#include "wocky-debug-internal.h"
+
+/* "WCCM" when read in the byte order it was written in, so a file from a
+ * machine with the other byte order looks invalid and is replaced. */
+#define MMAP_MAGIC 0x4D434357
+#define MMAP_VERSION 1
+
+/* Sizes of a new, empty file. Compaction grows the file if it's too small
+ * for what's kept in it. */
+#define MIN_SLOTS 1024
+#define MIN_DATA_SIZE (256 * 1024)
+
+/* The index is compacted into a bigger one once it's this full, in
+ * percent, to keep probe sequences short. */
+#define MAX_LOAD 70
+
+/* How many times to follow other processes' compactions before giving up */
+#define MAX_ATTEMPTS 5
+
+/* All fields are in the byte order of the machine which wrote the file.
+ * Fields marked (atomic) are changed while other processes may be reading
+ * the file, and are only accessed with g_atomic_int_*(). */
+typedef struct {
+  guint32 magic;
+  guint32 version;
+  /* size of the index, always a power of two */
+  guint32 n_slots;
+  /* size of the whole file, which never changes once it's created */
+  guint32 size;
+  /* (atomic) offset just past the last record appended */
+  guint32 data_end;
+  /* (atomic) number of slots in use */
+  guint32 n_entries;
+  /* (atomic) non-zero once the file has been replaced by a compacted
+   * copy and must no longer be used */
+  guint32 obsolete;
+  guint32 reserved;
+} MmapHeader;
+
+typedef struct {
+  /* (atomic) offset of the record from the start of the file, or 0 if the
+   * slot is free; slots are published by setting this last */
+  guint32 offset;
+  /* hash of the node, so most probes don't need to look at the record */
+  guint32 hash;
+  /* (atomic) when the entry was last used, in seconds since the epoch */
+  guint32 timestamp;
+  guint32 reserved;
+} MmapSlot;
+
+/* Followed by node_len bytes of node (without a trailing NUL) and
+ * reply_len bytes of reply, padded to a multiple of 4 bytes. */
+typedef struct {
+  guint32 node_len;
+  guint32 reply_len;
+  /* hash of the node and the reply, to spot records damaged by a crash */
+  guint32 checksum;
+} MmapRecord;
+
+#define DATA_START(n_slots) \
+  (sizeof (MmapHeader) + (gsize) (n_slots) * sizeof (MmapSlot))
+#define RECORD_SIZE(node_len, reply_len) \
+  ((sizeof (MmapRecord) + (gsize) (node_len) + (reply_len) + 3) & ~(gsize) 3)
+
+struct _WockyCapsCacheMmapPrivate
+{
+  gchar *path;
+
+  /* -1 and NULL if the file couldn't be opened */
+  gint fd;
+  guint8 *map;
+
+  /* copied from the header once it has been checked, so that nothing
+   * another process writes into the file can make us look outside it */
+  gsize size;
+  guint32 n_slots;
+};
+
+static void backend_iface_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (WockyCapsCacheMmap, wocky_caps_cache_mmap,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (WockyCapsCacheMmap)
+    G_IMPLEMENT_INTERFACE (WOCKY_TYPE_CAPS_CACHE_BACKEND, backend_iface_init))
+
+enum
+{
+  PROP_PATH = 1,
+};
+
+typedef struct {
+  guint32 offset;
+  guint32 timestamp;
+} LiveEntry;
+
+static void caps_cache_mmap_open (WockyCapsCacheMmap *self);
+
+static guint32
+fnv1a (guint32 hash,
+    const guint8 *data,
+    gsize len)
+{
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      hash ^= data[i];
+      hash *= 16777619;
+    }
+
+  return hash;
+}
+
+#define FNV1A_INIT 2166136261U
+
+static guint32
+now (void)
+{
+  return (guint32) (g_get_real_time () / G_USEC_PER_SEC);
+}
+
+static MmapHeader *
+get_header (WockyCapsCacheMmap *self)
+{
+  return (MmapHeader *) self->priv->map;
+}
+
+static MmapSlot *
+get_slot (WockyCapsCacheMmap *self,
+    guint32 i)
+{
+  return (MmapSlot *) (self->priv->map + sizeof (MmapHeader)) + i;
+}
+
+/* Returns the record at @offset, or %NULL if it doesn't lie within the
+ * data area. */
+static const MmapRecord *
+get_record (WockyCapsCacheMmap *self,
+    guint32 offset)
+{
+  const MmapRecord *record;
+
+  if (offset < DATA_START (self->priv->n_slots) ||
+      offset % 4 != 0 ||
+      offset > self->priv->size - sizeof (MmapRecord))
+    return NULL;
+
+  record = (const MmapRecord *) (self->priv->map + offset);
+
+  if (record->node_len > self->priv->size ||
+      record->reply_len > self->priv->size ||
+      RECORD_SIZE (record->node_len, record->reply_len) >
+          self->priv->size - offset)
+    return NULL;
+
+  return record;
+}
+
+static const guint8 *
+record_node (const MmapRecord *record)
+{
+  return (const guint8 *) (record + 1);
+}
+
+static const guint8 *
+record_reply (const MmapRecord *record)
+{
+  return record_node (record) + record->node_len;
+}
+
+static guint32
+record_checksum (const MmapRecord *record)
+{
+  return fnv1a (FNV1A_INIT, record_node (record),
+      record->node_len + record->reply_len);
+}
+
+/* Finds the slot holding @node, or the free slot which ends its probe
+ * sequence. Returns %NULL if neither exists. */
+static MmapSlot *
+caps_cache_mmap_find (WockyCapsCacheMmap *self,
+    const gchar *node)
+{
+  gsize node_len = strlen (node);
+  guint32 hash = fnv1a (FNV1A_INIT, (const guint8 *) node, node_len);
+  guint32 mask = self->priv->n_slots - 1;
+  guint32 i;
+
+  for (i = 0; i < self->priv->n_slots; i++)
+    {
+      MmapSlot *slot = get_slot (self, (hash + i) & mask);
+      guint32 offset = g_atomic_int_get ((gint *) &slot->offset);
+      const MmapRecord *record;
+
+      if (offset == 0)
+        return slot;
+
+      if (slot->hash != hash)
+        continue;
+
+      record = get_record (self, offset);
+
+      if (record != NULL &&
+          record->node_len == node_len &&
+          !memcmp (record_node (record), node, node_len))
+        return slot;
+    }
+
+  return NULL;
+}
+
+static void
+caps_cache_mmap_close (WockyCapsCacheMmap *self)
+{
+  if (self->priv->map != NULL)
+    {
+      munmap (self->priv->map, self->priv->size);
+      self->priv->map = NULL;
+      self->priv->size = 0;
+      self->priv->n_slots = 0;
+    }
+
+  if (self->priv->fd >= 0)
+    {
+      close (self->priv->fd);
+      self->priv->fd = -1;
+    }
+}
+
+static void
+caps_cache_mmap_reopen (WockyCapsCacheMmap *self)
+{
+  caps_cache_mmap_close (self);
+  caps_cache_mmap_open (self);
+}
+
+/* Makes sure the file we have mapped is still the current one. This is
+ * the only thing a lookup does that may make a system call, and it only
+ * does so after another process has compacted the file. */
+static gboolean
+caps_cache_mmap_check (WockyCapsCacheMmap *self)
+{
+  if (self->priv->map == NULL)
+    return FALSE;
+
+  if (g_atomic_int_get ((gint *) &get_header (self)->obsolete))
+    {
+      DEBUG ("%s was compacted by someone else; reopening", self->priv->path);
+      caps_cache_mmap_reopen (self);
+    }
+
+  return self->priv->map != NULL;
+}
+
+static gboolean
+caps_cache_mmap_flock (gint fd,
+    gint operation)
+{
+  while (flock (fd, operation) != 0)
+    {
+      if (errno != EINTR)
+        {
+          DEBUG ("flock failed: %s", g_strerror (errno));
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/* Takes the lock which writers hold, following any compactions made by
+ * other processes before we got it. */
+static gboolean
+caps_cache_mmap_lock (WockyCapsCacheMmap *self)
+{
+  guint attempts;
+
+  for (attempts = 0; attempts < MAX_ATTEMPTS; attempts++)
+    {
+      if (self->priv->map == NULL ||
+          !caps_cache_mmap_flock (self->priv->fd, LOCK_EX))
+        return FALSE;
+
+      if (!g_atomic_int_get ((gint *) &get_header (self)->obsolete))
+        return TRUE;
+
+      caps_cache_mmap_flock (self->priv->fd, LOCK_UN);
+      caps_cache_mmap_reopen (self);
+    }
+
+  return FALSE;
+}
+
+static void
+caps_cache_mmap_unlock (WockyCapsCacheMmap *self)
+{
+  caps_cache_mmap_flock (self->priv->fd, LOCK_UN);
+}
+
+static gint
+live_entry_compare_newest_first (gconstpointer a,
+    gconstpointer b)
+{
+  const LiveEntry *ea = a;
+  const LiveEntry *eb = b;
+
+  if (ea->timestamp != eb->timestamp)
+    return ea->timestamp > eb->timestamp ? -1 : 1;
+
+  /* Entries used in the same second: the one added last is newer */
+  return ea->offset > eb->offset ? -1 : (ea->offset < eb->offset ? 1 : 0);
+}
+
+static gint
+live_entry_compare_offset (gconstpointer a,
+    gconstpointer b)
+{
+  const LiveEntry *ea = a;
+  const LiveEntry *eb = b;
+
+  return ea->offset > eb->offset ? 1 : (ea->offset < eb->offset ? -1 : 0);
+}
+
+/* Returns the entries whose records are intact. Sets *damaged if there
+ * were any which aren't. */
+static GArray *
+caps_cache_mmap_get_live_entries (WockyCapsCacheMmap *self,
+    gboolean *damaged)
+{
+  GArray *entries = g_array_new (FALSE, FALSE, sizeof (LiveEntry));
+  guint32 data_end = g_atomic_int_get ((gint *) &get_header (self)->data_end);
+  guint32 i;
+
+  *damaged = FALSE;
+
+  for (i = 0; i < self->priv->n_slots; i++)
+    {
+      MmapSlot *slot = get_slot (self, i);
+      LiveEntry entry;
+      const MmapRecord *record;
+
+      entry.offset = g_atomic_int_get ((gint *) &slot->offset);
+
+      if (entry.offset == 0)
+        continue;
+
+      record = get_record (self, entry.offset);
+
+      if (record == NULL ||
+          entry.offset + RECORD_SIZE (record->node_len, record->reply_len) >
+              data_end ||
+          record_checksum (record) != record->checksum ||
+          fnv1a (FNV1A_INIT, record_node (record), record->node_len) !=
+              slot->hash)
+        {
+          DEBUG ("record at %u in %s is damaged", entry.offset,
+              self->priv->path);
+          *damaged = TRUE;
+          continue;
+        }
+
+      entry.timestamp = g_atomic_int_get ((gint *) &slot->timestamp);
+      g_array_append_val (entries, entry);
+    }
+
+  return entries;
+}
+
+/* Builds a file holding the records of @self listed in @entries, with room
+ * for at least @extra more bytes of records. Returns %NULL if that would be
+ * too big. */
+static guint8 *
+caps_cache_mmap_build (WockyCapsCacheMmap *self,
+    GArray *entries,
+    gsize extra,
+    gsize *size)
+{
+  guint8 *file;
+  MmapHeader *header;
+  MmapSlot *slots;
+  guint32 n_slots = MIN_SLOTS;
+  gsize used = 0;
+  gsize data_size;
+  gsize pos;
+  guint i;
+
+  for (i = 0; i < entries->len; i++)
+    {
+      const MmapRecord *record = get_record (self,
+          g_array_index (entries, LiveEntry, i).offset);
+
+      used += RECORD_SIZE (record->node_len, record->reply_len);
+    }
+
+  /* Leave room to grow, so a compaction isn't followed by another one */
+  while (n_slots * MAX_LOAD / 100 < 2 * (entries->len + 1))
+    n_slots *= 2;
+
+  data_size = MAX (MIN_DATA_SIZE, 2 * (used + extra));
+
+  if (DATA_START (n_slots) + data_size > G_MAXUINT32)
+    return NULL;
+
+  *size = DATA_START (n_slots) + data_size;
+  file = g_malloc0 (*size);
+  header = (MmapHeader *) file;
+  slots = (MmapSlot *) (file + sizeof (MmapHeader));
+
+  header->magic = MMAP_MAGIC;
+  header->version = MMAP_VERSION;
+  header->n_slots = n_slots;
+  header->size = *size;
+  header->n_entries = entries->len;
+
+  /* Keep the records in the order they were added, so that entries used in
+   * the same second are still thrown away oldest first. */
+  g_array_sort (entries, live_entry_compare_offset);
+  pos = DATA_START (n_slots);
+
+  for (i = 0; i < entries->len; i++)
+    {
+      LiveEntry *entry = &g_array_index (entries, LiveEntry, i);
+      const MmapRecord *record = get_record (self, entry->offset);
+      gsize record_size = RECORD_SIZE (record->node_len, record->reply_len);
+      guint32 hash = fnv1a (FNV1A_INIT, record_node (record),
+          record->node_len);
+      guint32 j = hash & (n_slots - 1);
+
+      while (slots[j].offset != 0)
+        j = (j + 1) & (n_slots - 1);
+
+      memcpy (file + pos, record, record_size);
+      slots[j].offset = pos;
+      slots[j].hash = hash;
+      slots[j].timestamp = entry->timestamp;
+      pos += record_size;
+    }
+
+  header->data_end = pos;
+  return file;
+}
+
+/* Writes @file over the path and marks the file we have open as obsolete,
+ * then opens the new one. The caller must hold the lock, if there's a file
+ * open; it's released. */
+static void
+caps_cache_mmap_replace (WockyCapsCacheMmap *self,
+    const guint8 *file,
+    gsize size)
+{
+  GError *error = NULL;
+
+  /* This writes to a temporary file and renames it into place, so other
+   * processes see either the old file or the new one. */
+  if (!g_file_set_contents (self->priv->path, (const gchar *) file, size,
+        &error))
+    {
+      DEBUG ("couldn't write %s: %s", self->priv->path, error->message);
+      g_error_free (error);
+      caps_cache_mmap_close (self);
+      return;
+    }
+
+  /* Anyone waiting for the lock on the old file will see this and move on
+   * to the new one. */
+  if (self->priv->map != NULL)
+    g_atomic_int_set ((gint *) &get_header (self)->obsolete, 1);
+
+  caps_cache_mmap_reopen (self);
+}
+
+/* Rewrites the file keeping only the @keep most recently used intact
+ * entries, with room for @extra more bytes of records. Must be called with
+ * the lock held; it's released. */
+static void
+caps_cache_mmap_compact (WockyCapsCacheMmap *self,
+    guint keep,
+    gsize extra)
+{
+  GArray *entries;
+  gboolean damaged;
+  guint8 *file;
+  gsize size;
+  guint before;
+
+  entries = caps_cache_mmap_get_live_entries (self, &damaged);
+  before = entries->len;
+
+  if (entries->len > keep)
+    {
+      g_array_sort (entries, live_entry_compare_newest_first);
+      g_array_set_size (entries, keep);
+    }
+
+  file = caps_cache_mmap_build (self, entries, extra, &size);
+
+  if (file == NULL)
+    {
+      DEBUG ("%s would be too big; emptying it", self->priv->path);
+      g_array_set_size (entries, 0);
+      file = caps_cache_mmap_build (self, entries, 0, &size);
+    }
+
+  DEBUG ("compacting %s: %u entries kept of %u", self->priv->path,
+      entries->len, before);
+  caps_cache_mmap_replace (self, file, size);
+
+  g_free (file);
+  g_array_unref (entries);
+}
+
+/* Checks the header of the file we've just mapped. */
+static gboolean
+caps_cache_mmap_check_header (WockyCapsCacheMmap *self,
+    gsize file_size)
+{
+  MmapHeader *header = get_header (self);
+  guint32 data_end;
+
+  if (file_size < sizeof (MmapHeader) ||
+      header->magic != MMAP_MAGIC ||
+      header->version != MMAP_VERSION ||
+      header->size != file_size ||
+      header->n_slots == 0 ||
+      (header->n_slots & (header->n_slots - 1)) != 0 ||
+      DATA_START (header->n_slots) > file_size)
+    return FALSE;
+
+  data_end = g_atomic_int_get ((gint *) &header->data_end);
+
+  return data_end >= DATA_START (header->n_slots) && data_end <= file_size;
+}
+
+/* Opens the current file at our path, creating it if necessary, and drops
+ * any records which were damaged by a crash. */
+static void
+caps_cache_mmap_open (WockyCapsCacheMmap *self)
+{
+  guint attempts;
+
+  g_return_if_fail (self->priv->map == NULL);
+
+  for (attempts = 0; attempts < MAX_ATTEMPTS; attempts++)
+    {
+      struct stat fd_stat, path_stat;
+      GArray *entries;
+      gboolean damaged;
+      guint8 *file;
+      gsize size;
+      gpointer map;
+
+      self->priv->fd = g_open (self->priv->path, O_RDWR | O_CREAT, 0600);
+
+      if (self->priv->fd < 0)
+        {
+          DEBUG ("couldn't open %s: %s", self->priv->path, g_strerror (errno));
+          return;
+        }
+
+      if (!caps_cache_mmap_flock (self->priv->fd, LOCK_EX))
+        {
+          caps_cache_mmap_close (self);
+          return;
+        }
+
+      if (fstat (self->priv->fd, &fd_stat) != 0 ||
+          g_stat (self->priv->path, &path_stat) != 0 ||
+          fd_stat.st_dev != path_stat.st_dev ||
+          fd_stat.st_ino != path_stat.st_ino)
+        {
+          /* Someone replaced the file between us opening and locking it */
+          caps_cache_mmap_close (self);
+          continue;
+        }
+
+      if (fd_stat.st_size >= (off_t) sizeof (MmapHeader) &&
+          fd_stat.st_size <= G_MAXUINT32)
+        {
+          map = mmap (NULL, fd_stat.st_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED, self->priv->fd, 0);
+
+          if (map == MAP_FAILED)
+            {
+              DEBUG ("couldn't map %s: %s", self->priv->path,
+                  g_strerror (errno));
+              caps_cache_mmap_close (self);
+              return;
+            }
+
+          self->priv->map = map;
+          self->priv->size = fd_stat.st_size;
+
+          if (caps_cache_mmap_check_header (self, fd_stat.st_size))
+            {
+              self->priv->n_slots = get_header (self)->n_slots;
+
+              /* Compacted by someone else since we opened it */
+              if (g_atomic_int_get ((gint *) &get_header (self)->obsolete))
+                {
+                  caps_cache_mmap_close (self);
+                  continue;
+                }
+
+              entries = caps_cache_mmap_get_live_entries (self, &damaged);
+              g_array_unref (entries);
+
+              if (!damaged)
+                {
+                  DEBUG ("opened %s", self->priv->path);
+                  caps_cache_mmap_unlock (self);
+                  return;
+                }
+
+              /* Throw the damaged records away, and open the result */
+              caps_cache_mmap_compact (self, G_MAXUINT, 0);
+              return;
+            }
+
+          DEBUG ("%s isn't a caps cache we understand; replacing it",
+              self->priv->path);
+          munmap (self->priv->map, self->priv->size);
+          self->priv->map = NULL;
+          self->priv->size = 0;
+        }
+
+      /* Nobody can be using this file, so it's safe to replace it without
+       * marking it as obsolete; processes waiting for the lock on it will
+       * see it's not the one at our path any more. */
+      entries = g_array_new (FALSE, FALSE, sizeof (LiveEntry));
+      file = caps_cache_mmap_build (self, entries, 0, &size);
+      g_array_unref (entries);
+      caps_cache_mmap_replace (self, file, size);
+      g_free (file);
+      return;
+    }
+
+  DEBUG ("%s keeps changing under our feet; giving up", self->priv->path);
+}
+
+static void
+wocky_caps_cache_mmap_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (object);
+
+  switch (property_id)
+    {
+    case PROP_PATH:
+      g_value_set_string (value, self->priv->path);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+wocky_caps_cache_mmap_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (object);
+
+  switch (property_id)
+    {
+    case PROP_PATH:
+      g_free (self->priv->path);
+      self->priv->path = g_value_dup_string (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+wocky_caps_cache_mmap_constructed (GObject *object)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (object);
+
+  g_return_if_fail (self->priv->path != NULL);
+
+  caps_cache_mmap_open (self);
+
+  if (self->priv->map == NULL)
+    DEBUG ("couldn't open %s; giving up", self->priv->path);
+}
+
+static void
+wocky_caps_cache_mmap_finalize (GObject *object)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (object);
+
+  caps_cache_mmap_close (self);
+  g_free (self->priv->path);
+
+  G_OBJECT_CLASS (wocky_caps_cache_mmap_parent_class)->finalize (object);
+}
+
+static void
+wocky_caps_cache_mmap_class_init (WockyCapsCacheMmapClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = wocky_caps_cache_mmap_constructed;
+  object_class->get_property = wocky_caps_cache_mmap_get_property;
+  object_class->set_property = wocky_caps_cache_mmap_set_property;
+  object_class->finalize = wocky_caps_cache_mmap_finalize;
+
+  /**
+   * WockyCapsCacheMmap:path:
+   *
+   * The path on disk to the file where this #WockyCapsCacheMmap stores its
+   * information.
+   */
+  g_object_class_install_property (object_class, PROP_PATH,
+      g_param_spec_string ("path", "Path", "The path to the cache", NULL,
+          G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS));
+}
+
+static void
+wocky_caps_cache_mmap_init (WockyCapsCacheMmap *self)
+{
+  self->priv = wocky_caps_cache_mmap_get_instance_private (self);
+  self->priv->fd = -1;
+}
+
+/**
+ * wocky_caps_cache_mmap_new:
+ * @path: full path to where the file should be stored
+ *
+ * Convenience function to create a new #WockyCapsCacheMmap.
+ *
+ * Returns: a new #WockyCapsCacheMmap.
+ */
+WockyCapsCacheMmap *
+wocky_caps_cache_mmap_new (const gchar *path)
+{
+  return g_object_new (WOCKY_TYPE_CAPS_CACHE_MMAP,
+      "path", path,
+      NULL);
+}
+
+static GBytes *
+caps_cache_mmap_lookup (WockyCapsCacheBackend *backend,
+    const gchar *node)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (backend);
+  MmapSlot *slot;
+  const MmapRecord *record;
+
+  if (!caps_cache_mmap_check (self))
+    return NULL;
+
+  slot = caps_cache_mmap_find (self, node);
+
+  if (slot == NULL)
+    return NULL;
+
+  record = get_record (self, g_atomic_int_get ((gint *) &slot->offset));
+
+  if (record == NULL)
+    return NULL;
+
+  return g_bytes_new (record_reply (record), record->reply_len);
+}
+
+static void
+caps_cache_mmap_insert (WockyCapsCacheBackend *backend,
+    const gchar *node,
+    GBytes *reply)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (backend);
+  gsize node_len = strlen (node);
+  gsize reply_len;
+  const guint8 *reply_data = g_bytes_get_data (reply, &reply_len);
+  gsize record_size = RECORD_SIZE (node_len, reply_len);
+  guint attempts;
+
+  for (attempts = 0; attempts < MAX_ATTEMPTS; attempts++)
+    {
+      MmapHeader *header;
+      MmapSlot *slot;
+      MmapRecord *record;
+      guint32 data_end, n_entries;
+
+      if (!caps_cache_mmap_lock (self))
+        return;
+
+      header = get_header (self);
+      data_end = g_atomic_int_get ((gint *) &header->data_end);
+      n_entries = g_atomic_int_get ((gint *) &header->n_entries);
+      slot = caps_cache_mmap_find (self, node);
+
+      if (slot != NULL && g_atomic_int_get ((gint *) &slot->offset) != 0)
+        {
+          /* The reply for a node never changes */
+          caps_cache_mmap_unlock (self);
+          return;
+        }
+
+      if (slot == NULL ||
+          (n_entries + 1) * 100 > (gsize) self->priv->n_slots * MAX_LOAD ||
+          record_size > self->priv->size - data_end)
+        {
+          caps_cache_mmap_compact (self, G_MAXUINT, record_size);
+          continue;
+        }
+
+      /* Write the record, then claim the space, then publish it. If we
+       * crash before the end, the record is never seen. */
+      record = (MmapRecord *) (self->priv->map + data_end);
+      record->node_len = node_len;
+      record->reply_len = reply_len;
+      memcpy (record + 1, node, node_len);
+      memcpy ((guint8 *) (record + 1) + node_len, reply_data, reply_len);
+      record->checksum = record_checksum (record);
+      g_atomic_int_set ((gint *) &header->data_end, data_end + record_size);
+
+      slot->hash = fnv1a (FNV1A_INIT, (const guint8 *) node, node_len);
+      g_atomic_int_set ((gint *) &slot->timestamp, now ());
+      g_atomic_int_set ((gint *) &slot->offset, data_end);
+      g_atomic_int_inc ((gint *) &header->n_entries);
+
+      caps_cache_mmap_unlock (self);
+      return;
+    }
+
+  DEBUG ("couldn't make room for %s", node);
+}
+
+static void
+caps_cache_mmap_touch (WockyCapsCacheBackend *backend,
+    const gchar *node)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (backend);
+  MmapSlot *slot;
+
+  if (!caps_cache_mmap_check (self))
+    return;
+
+  slot = caps_cache_mmap_find (self, node);
+
+  /* Timestamps are only used to pick what to throw away, so there's no
+   * need to lock the file; if it's being compacted, the touch is lost. */
+  if (slot != NULL && g_atomic_int_get ((gint *) &slot->offset) != 0)
+    g_atomic_int_set ((gint *) &slot->timestamp, now ());
+}
+
+static void
+caps_cache_mmap_shrink (WockyCapsCacheBackend *backend,
+    guint high_threshold,
+    guint low_threshold)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (backend);
+
+  if (!caps_cache_mmap_check (self) ||
+      g_atomic_int_get ((gint *) &get_header (self)->n_entries) <=
+          (gint) high_threshold ||
+      !caps_cache_mmap_lock (self))
+    return;
+
+  /* Another process may have shrunk it while we waited for the lock */
+  if (g_atomic_int_get ((gint *) &get_header (self)->n_entries) <=
+        (gint) high_threshold)
+    {
+      caps_cache_mmap_unlock (self);
+      return;
+    }
+
+  caps_cache_mmap_compact (self, low_threshold, 0);
+}
+
+static void
+caps_cache_mmap_clear (WockyCapsCacheBackend *backend)
+{
+  WockyCapsCacheMmap *self = WOCKY_CAPS_CACHE_MMAP (backend);
+
+  if (!caps_cache_mmap_lock (self))
+    return;
+
+  DEBUG ("throwing away everything in %s", self->priv->path);
+  caps_cache_mmap_compact (self, 0, 0);
+}
+
+static void
+backend_iface_init (gpointer g_iface,
+    gpointer iface_data)
+{
+  WockyCapsCacheBackendIface *iface = g_iface;
+
+  iface->lookup_func = caps_cache_mmap_lookup;
+  iface->insert_func = caps_cache_mmap_insert;
+  iface->touch_func = caps_cache_mmap_touch;
+  iface->shrink_func = caps_cache_mmap_shrink;
+  iface->clear_func = caps_cache_mmap_clear;
+}
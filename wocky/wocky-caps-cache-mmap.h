@@ -0,0 +1,83 @@
+/*
+ * wocky-caps-cache-mmap.h - Header for WockyCapsCacheMmap
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef __WOCKY_CAPS_CACHE_MMAP_H__
+#define __WOCKY_CAPS_CACHE_MMAP_H__
+
+#include <glib-object.h>
+
+#include "wocky-caps-cache-backend.h"
+
+G_BEGIN_DECLS
+
+/**
+ * WockyCapsCacheMmap:
+ *
+ * A #WockyCapsCacheBackend storing disco#info replies in a memory-mapped
+ * file.
+ */
+typedef struct _WockyCapsCacheMmap WockyCapsCacheMmap;
+
+/**
+ * WockyCapsCacheMmapClass:
+ *
+ * The class of a #WockyCapsCacheMmap.
+ */
+typedef struct _WockyCapsCacheMmapClass WockyCapsCacheMmapClass;
+typedef struct _WockyCapsCacheMmapPrivate WockyCapsCacheMmapPrivate;
+
+#define WOCKY_TYPE_CAPS_CACHE_MMAP wocky_caps_cache_mmap_get_type()
+#define WOCKY_CAPS_CACHE_MMAP(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), WOCKY_TYPE_CAPS_CACHE_MMAP, \
+        WockyCapsCacheMmap))
+#define WOCKY_CAPS_CACHE_MMAP_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_CAST ((klass), WOCKY_TYPE_CAPS_CACHE_MMAP, \
+        WockyCapsCacheMmapClass))
+#define WOCKY_IS_CAPS_CACHE_MMAP(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WOCKY_TYPE_CAPS_CACHE_MMAP))
+#define WOCKY_IS_CAPS_CACHE_MMAP_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_TYPE ((klass), WOCKY_TYPE_CAPS_CACHE_MMAP))
+#define WOCKY_CAPS_CACHE_MMAP_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS ((obj), WOCKY_TYPE_CAPS_CACHE_MMAP, \
+        WockyCapsCacheMmapClass))
+
+struct _WockyCapsCacheMmap
+{
+  /*<private>*/
+  GObject parent;
+  WockyCapsCacheMmapPrivate *priv;
+};
+
+struct _WockyCapsCacheMmapClass
+{
+  /*<private>*/
+  GObjectClass parent_class;
+};
+
+GType
+wocky_caps_cache_mmap_get_type (void);
+
+WockyCapsCacheMmap *
+wocky_caps_cache_mmap_new (const gchar *path);
+
+G_END_DECLS
+
+#endif /* ifndef __WOCKY_CAPS_CACHE_MMAP_H__ */
@@ -0,0 +1,1072 @@
+/*
+ * wocky-caps-cache-sqlite.c - Source for WockyCapsCacheSqlite
+ * Copyright (C) 2010 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION: wocky-caps-cache-sqlite
+ * @title: WockyCapsCacheSqlite
+ * @short_description: SQLite storage for #WockyCapsCache
+ * @include: wocky/wocky-caps-cache-sqlite.h
+ *
+ * The default #WockyCapsCacheBackend, which keeps disco#info replies in an
+ * SQLite database.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-caps-cache-sqlite.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <sqlite3.h>
+
+#include "wocky-node-tree.h"
+#include "wocky-xmpp-reader.h"
+
+#define WOCKY_DEBUG_FLAG WOCKY_DEBUG_PRESENCE
+#include "wocky-debug-internal.h"
+
+/* Version 3 stores replies encoded by wocky_node_tree_to_bytes(); version
+ * 2 stored them as XML, and such rows are upgraded as they're looked up. */
+#define DB_USER_VERSION 3
+#define DB_USER_VERSION_XML 2
+
+/* Inserts and timestamp updates are kept in memory, and written out
+ * together this long after the first of them, in one short transaction, so
+ * that the database is only locked for as long as the writes take. Lookups
+ * see pending inserts straight away; timestamps are only used to pick what
+ * to throw away when the cache is full, so they can be a little late. */
+#define FLUSH_INTERVAL_SECONDS 1
+
+/* When this many inserts are pending, they're written out straight away;
+ * if the database is locked by others, further ones are dropped until they
+ * have been. */
+#define MAX_PENDING_INSERTS 1000
+
+/* How long to wait for another process sharing the database to finish
+ * writing, in milliseconds */
+#define BUSY_TIMEOUT 250
+
+struct _WockyCapsCacheSqlitePrivate
+{
+  gchar *path;
+  sqlite3 *db;
+
+  /* prepared once when the database is opened */
+  sqlite3_stmt *select_stmt;
+  sqlite3_stmt *insert_stmt;
+  sqlite3_stmt *touch_stmt;
+  sqlite3_stmt *upgrade_stmt;
+  sqlite3_stmt *gc_stmt;
+
+  /* Number of entries, kept up to date as we insert and delete. Other
+   * processes may be using the same database, so it's only an estimate,
+   * checked against the real number before deleting anything. */
+  guint count;
+
+  guint flush_source;
+
+  /* Changes not written to the database yet: owned node => GBytes reply
+   * to insert, or to replace an old XML reply with */
+  GHashTable *pending_inserts;
+  /* the nodes in pending_inserts, in the order they were inserted, so that
+   * their rows are too; when the cache is full, the oldest rows go first */
+  GQueue *insert_order;
+  GHashTable *pending_upgrades;
+  /* set of nodes whose timestamp needs updating */
+  GHashTable *pending_touches;
+
+  /* only used for rows from before the binary encoding */
+  WockyXmppReader *reader;
+};
+
+static void backend_iface_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (WockyCapsCacheSqlite, wocky_caps_cache_sqlite,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (WockyCapsCacheSqlite)
+    G_IMPLEMENT_INTERFACE (WOCKY_TYPE_CAPS_CACHE_BACKEND, backend_iface_init))
+
+enum
+{
+  PROP_PATH = 1,
+};
+
+static gboolean caps_cache_get_one_uint (WockyCapsCacheSqlite *self,
+    const gchar *sql, guint *value);
+static gboolean caps_cache_flush (WockyCapsCacheSqlite *self);
+static void caps_cache_close (WockyCapsCacheSqlite *self);
+static gboolean caps_cache_prepare (WockyCapsCacheSqlite *self,
+    const gchar *sql, sqlite3_stmt **stmt);
+
+static void
+wocky_caps_cache_sqlite_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (object);
+
+  switch (property_id)
+    {
+    case PROP_PATH:
+      g_value_set_string (value, self->priv->path);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+wocky_caps_cache_sqlite_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (object);
+
+  switch (property_id)
+    {
+    case PROP_PATH:
+      g_free (self->priv->path);
+      self->priv->path = g_value_dup_string (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static gboolean
+caps_cache_check_version (WockyCapsCacheSqlite *self)
+{
+  guint version;
+
+  if (!caps_cache_get_one_uint (self, "PRAGMA user_version;", &version))
+    return FALSE;
+
+  if (version == 0)
+    {
+    /* ______________________________________________________________________
+      ( Unfortunately the first incarnation of the caps cache db didn't set  )
+      ( user_version, so we can't tell if 0 means this is a new, empty       )
+      ( database or an old one.                                              )
+      (                                                                      )
+      ( So... let's check if the capabilities table exists. If so, we'll     )
+      ( pretend user_version was 1.                                          )
+      (                                                                      )
+      ( When there's nothing left to burn, you have to set yourself on fire. )
+       ----------------------------------------------------------------------
+                o   ^__^
+                 o  (oo)\_______
+                    (__)\       )\/\
+                        ||----w |
+                        ||     ||   */
+      guint dummy;
+
+      if (caps_cache_get_one_uint (self, "PRAGMA table_info(capabilities)",
+            &dummy))
+        {
+          DEBUG ("capabilities table exists; this isn't a new database");
+          version = 1;
+        }
+    }
+
+  switch (version)
+    {
+      case 0:
+        DEBUG ("opened new, empty database at %s", self->priv->path);
+        return TRUE;
+
+      case DB_USER_VERSION_XML:
+        DEBUG ("opened %s, user_version %u; entries will be converted from "
+            "XML as they are used", self->priv->path, version);
+        return TRUE;
+
+      case DB_USER_VERSION:
+        DEBUG ("opened %s, user_version %u", self->priv->path, version);
+        return TRUE;
+
+      default:
+        DEBUG ("%s is version %u, not our version %u; let's nuke it",
+            self->priv->path, version, DB_USER_VERSION);
+        return FALSE;
+    }
+}
+
+static void
+caps_cache_finalize_statements (WockyCapsCacheSqlite *self)
+{
+  /* sqlite3_finalize (NULL) is a no-op */
+  sqlite3_finalize (self->priv->select_stmt);
+  self->priv->select_stmt = NULL;
+  sqlite3_finalize (self->priv->insert_stmt);
+  self->priv->insert_stmt = NULL;
+  sqlite3_finalize (self->priv->touch_stmt);
+  self->priv->touch_stmt = NULL;
+  sqlite3_finalize (self->priv->upgrade_stmt);
+  self->priv->upgrade_stmt = NULL;
+  sqlite3_finalize (self->priv->gc_stmt);
+  self->priv->gc_stmt = NULL;
+}
+
+static gboolean
+caps_cache_prepare_statements (WockyCapsCacheSqlite *self)
+{
+  return caps_cache_prepare (self,
+        "SELECT disco_reply FROM capabilities WHERE node=?",
+        &self->priv->select_stmt) &&
+    caps_cache_prepare (self,
+        "INSERT INTO capabilities (node, disco_reply, timestamp) "
+        "VALUES (?, ?, ?)", &self->priv->insert_stmt) &&
+    caps_cache_prepare (self,
+        "UPDATE capabilities SET timestamp=? WHERE node=?",
+        &self->priv->touch_stmt) &&
+    caps_cache_prepare (self,
+        "UPDATE capabilities SET disco_reply=? WHERE node=?",
+        &self->priv->upgrade_stmt) &&
+    /* This emulates DELETE ... ORDER ... LIMIT because some Sqlites (e.g.
+     * Debian) ship without SQLITE_ENABLE_UPDATE_DELETE_LIMIT unabled.
+     */
+    caps_cache_prepare (self,
+        "DELETE FROM capabilities WHERE oid IN ("
+        "  SELECT oid FROM capabilities"
+        "    ORDER BY timestamp ASC, oid ASC"
+        "    LIMIT ?)", &self->priv->gc_stmt);
+}
+
+/* Closes the database. Pending changes are kept, to be written out if it's
+ * opened again. */
+static void
+caps_cache_close (WockyCapsCacheSqlite *self)
+{
+  if (self->priv->flush_source != 0)
+    {
+      g_source_remove (self->priv->flush_source);
+      self->priv->flush_source = 0;
+    }
+
+  caps_cache_finalize_statements (self);
+
+  if (self->priv->db != NULL)
+    {
+      sqlite3_close (self->priv->db);
+      self->priv->db = NULL;
+    }
+
+  self->priv->count = 0;
+}
+
+static gboolean
+caps_cache_open (WockyCapsCacheSqlite *self)
+{
+  gint ret;
+  gchar *error;
+
+  g_return_val_if_fail (self->priv->db == NULL, FALSE);
+
+  ret = sqlite3_open (self->priv->path, &self->priv->db);
+
+  if (ret != SQLITE_OK)
+    {
+      DEBUG ("opening database %s failed: %s", self->priv->path,
+          sqlite3_errmsg (self->priv->db));
+      goto err;
+    }
+
+  if (!caps_cache_check_version (self))
+    goto err;
+
+  ret = sqlite3_exec (self->priv->db,
+      "PRAGMA user_version = " G_STRINGIFY (DB_USER_VERSION) ";"
+      "PRAGMA journal_mode = WAL;"
+      "PRAGMA synchronous = OFF",
+      NULL, NULL, &error);
+
+  if (ret != SQLITE_OK)
+    {
+      DEBUG ("failed to set user_version, turn off fsync() and "
+          "turn on write-ahead logging: %s", error);
+      sqlite3_free (error);
+      goto err;
+    }
+
+  ret = sqlite3_exec (self->priv->db,
+      "CREATE TABLE IF NOT EXISTS capabilities (\n"
+      "  node text PRIMARY KEY,\n"
+      "  disco_reply text,\n"
+      "  timestamp int)", NULL, NULL, &error);
+
+  if (ret != SQLITE_OK)
+    {
+      DEBUG ("failed to ensure table exists: %s", error);
+      sqlite3_free (error);
+      goto err;
+    }
+
+  /* Other processes may share the database, and in WAL mode only writers
+   * get in each other's way; give them a moment to finish. Writes are done
+   * in short transactions (see caps_cache_flush()), so that's all they
+   * should need. */
+  sqlite3_busy_timeout (self->priv->db, BUSY_TIMEOUT);
+
+  if (!caps_cache_prepare_statements (self))
+    goto err;
+
+  /* The only time we count the rows unless garbage collection is due */
+  if (!caps_cache_get_one_uint (self, "SELECT COUNT(*) FROM capabilities",
+        &self->priv->count))
+    goto err;
+
+  return TRUE;
+
+ err:
+  caps_cache_close (self);
+  return FALSE;
+}
+
+static void
+nuke_it_and_try_again (WockyCapsCacheSqlite *self)
+{
+  int ret;
+
+  g_return_if_fail (self->priv->path != NULL);
+  g_return_if_fail (self->priv->db == NULL);
+
+  ret = unlink (self->priv->path);
+
+  if (ret != 0)
+    {
+      DEBUG ("removing database failed: %s", g_strerror (errno));
+    }
+  else
+    {
+      gchar *wal = g_strconcat (self->priv->path, "-wal", NULL);
+      gchar *shm = g_strconcat (self->priv->path, "-shm", NULL);
+
+      /* A stale log must not be replayed into the new database */
+      unlink (wal);
+      unlink (shm);
+      g_free (wal);
+      g_free (shm);
+
+      caps_cache_open (self);
+    }
+}
+
+static void
+close_nuke_and_reopen_database (WockyCapsCacheSqlite *self)
+{
+  g_return_if_fail (self->priv->db != NULL);
+
+  DEBUG ("Database seems to be corrupt; blowing it away and reinitializing");
+
+  g_hash_table_remove_all (self->priv->pending_inserts);
+  g_queue_clear (self->priv->insert_order);
+  g_hash_table_remove_all (self->priv->pending_upgrades);
+  g_hash_table_remove_all (self->priv->pending_touches);
+  caps_cache_close (self);
+
+  nuke_it_and_try_again (self);
+}
+
+static void
+wocky_caps_cache_sqlite_constructed (GObject *object)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (object);
+
+  if (!caps_cache_open (self))
+    {
+      /* Couldn't open it, or it's got a different user_version. */
+      nuke_it_and_try_again (self);
+    }
+
+  if (self->priv->db == NULL)
+    {
+      DEBUG ("couldn't open db; giving up");
+      return;
+    }
+
+  self->priv->reader = wocky_xmpp_reader_new_no_stream ();
+}
+
+static void
+wocky_caps_cache_sqlite_dispose (GObject *object)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (object);
+
+  /* Write out the outstanding changes while we still can */
+  if (self->priv->db != NULL && !caps_cache_flush (self))
+    DEBUG ("couldn't write out pending changes; they are lost");
+
+  G_OBJECT_CLASS (wocky_caps_cache_sqlite_parent_class)->dispose (object);
+}
+
+static void
+wocky_caps_cache_sqlite_finalize (GObject *object)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (object);
+
+  caps_cache_close (self);
+
+  g_free (self->priv->path);
+  self->priv->path = NULL;
+
+  g_hash_table_unref (self->priv->pending_inserts);
+  g_queue_free (self->priv->insert_order);
+  g_hash_table_unref (self->priv->pending_upgrades);
+  g_hash_table_unref (self->priv->pending_touches);
+
+  if (self->priv->reader != NULL)
+    {
+      g_object_unref (self->priv->reader);
+      self->priv->reader = NULL;
+    }
+
+  G_OBJECT_CLASS (wocky_caps_cache_sqlite_parent_class)->finalize (object);
+}
+
+static void
+wocky_caps_cache_sqlite_class_init (WockyCapsCacheSqliteClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = wocky_caps_cache_sqlite_constructed;
+  object_class->get_property = wocky_caps_cache_sqlite_get_property;
+  object_class->set_property = wocky_caps_cache_sqlite_set_property;
+  object_class->dispose = wocky_caps_cache_sqlite_dispose;
+  object_class->finalize = wocky_caps_cache_sqlite_finalize;
+
+  /**
+   * WockyCapsCacheSqlite:path:
+   *
+   * The path on disk to the SQLite database where this
+   * #WockyCapsCacheSqlite stores its information.
+   */
+  g_object_class_install_property (object_class, PROP_PATH,
+      g_param_spec_string ("path", "Path", "The path to the cache", NULL,
+          G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS));
+}
+
+static void
+wocky_caps_cache_sqlite_init (WockyCapsCacheSqlite *self)
+{
+  self->priv = wocky_caps_cache_sqlite_get_instance_private (self);
+
+  self->priv->pending_inserts = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, (GDestroyNotify) g_bytes_unref);
+  self->priv->insert_order = g_queue_new ();
+  self->priv->pending_upgrades = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, (GDestroyNotify) g_bytes_unref);
+  self->priv->pending_touches = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, NULL);
+}
+
+/**
+ * wocky_caps_cache_sqlite_new:
+ * @path: full path to where the SQLite database should be stored
+ *
+ * Convenience function to create a new #WockyCapsCacheSqlite.
+ *
+ * Returns: a new #WockyCapsCacheSqlite.
+ */
+WockyCapsCacheSqlite *
+wocky_caps_cache_sqlite_new (const gchar *path)
+{
+  return g_object_new (WOCKY_TYPE_CAPS_CACHE_SQLITE,
+      "path", path,
+      NULL);
+}
+
+static gboolean
+caps_cache_prepare (WockyCapsCacheSqlite *self,
+    const gchar *sql,
+    sqlite3_stmt **stmt)
+{
+  gint ret;
+
+  g_return_val_if_fail (self->priv->db != NULL, FALSE);
+
+  ret = sqlite3_prepare_v2 (self->priv->db, sql, -1, stmt, NULL);
+
+  if (ret != SQLITE_OK)
+    {
+      g_warning ("preparing statement '%s' failed: %s", sql,
+          sqlite3_errmsg (self->priv->db));
+      return FALSE;
+    }
+
+  g_assert (stmt != NULL);
+  return TRUE;
+}
+
+/* Resets @stmt, and forgets the values bound to it, so it can be used again.
+ */
+static void
+caps_cache_reset (sqlite3_stmt *stmt)
+{
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+}
+
+/* Resets @stmt if an error happens. */
+static gboolean
+caps_cache_bind_int (WockyCapsCacheSqlite *self,
+    sqlite3_stmt *stmt,
+    gint param,
+    gint value)
+{
+  gint ret = sqlite3_bind_int (stmt, param, value);
+
+  if (ret != SQLITE_OK)
+    {
+      g_warning ("parameter binding failed: %s",
+          sqlite3_errmsg (self->priv->db));
+      caps_cache_reset (stmt);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Resets @stmt if an error happens.
+ *
+ * Note: the parameter is bound statically, so it mustn't be freed before the
+ * statment is reset.
+ */
+static gboolean
+caps_cache_bind_text (WockyCapsCacheSqlite *self,
+    sqlite3_stmt *stmt,
+    gint param,
+    gint len,
+    const gchar *value)
+{
+  gint ret = sqlite3_bind_text (stmt, param, value, len, SQLITE_STATIC);
+
+  if (ret != SQLITE_OK)
+    {
+      g_warning ("parameter binding failed: %s",
+          sqlite3_errmsg (self->priv->db));
+      caps_cache_reset (stmt);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Resets @stmt if an error happens.
+ *
+ * Note: the parameter is bound statically, so @bytes mustn't be freed before
+ * the statment is reset.
+ */
+static gboolean
+caps_cache_bind_bytes (WockyCapsCacheSqlite *self,
+    sqlite3_stmt *stmt,
+    gint param,
+    GBytes *bytes)
+{
+  gsize len;
+  gconstpointer data = g_bytes_get_data (bytes, &len);
+  gint ret = sqlite3_bind_blob (stmt, param, data, len, SQLITE_STATIC);
+
+  if (ret != SQLITE_OK)
+    {
+      g_warning ("parameter binding failed: %s",
+          sqlite3_errmsg (self->priv->db));
+      caps_cache_reset (stmt);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * caps_cache_get_one_uint:
+ * @self: the caps cache
+ * @sql: a query expected to yield one row with one integer colum
+ * @value: location at which to store that single unsigned integer
+ *
+ * Returns: %TRUE if @value was successfully retrieved; %FALSE otherwise.
+ */
+static gboolean
+caps_cache_get_one_uint (WockyCapsCacheSqlite *self,
+    const gchar *sql,
+    guint *value)
+{
+  sqlite3_stmt *stmt;
+  int ret;
+
+  if (!caps_cache_prepare (self, sql, &stmt))
+    return FALSE;
+
+  ret = sqlite3_step (stmt);
+
+  switch (ret)
+    {
+      case SQLITE_ROW:
+        *value = sqlite3_column_int (stmt, 0);
+        sqlite3_finalize (stmt);
+        return TRUE;
+
+      case SQLITE_DONE:
+        DEBUG ("'%s' returned no results", sql);
+        break;
+
+      default:
+        DEBUG ("executing '%s' failed: %s", sql,
+            sqlite3_errmsg (self->priv->db));
+    }
+
+  sqlite3_finalize (stmt);
+  return FALSE;
+}
+
+static gboolean
+caps_cache_flush_timeout_cb (gpointer user_data)
+{
+  WockyCapsCacheSqlite *self = user_data;
+
+  self->priv->flush_source = 0;
+  caps_cache_flush (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+caps_cache_schedule_flush (WockyCapsCacheSqlite *self)
+{
+  if (self->priv->flush_source == 0)
+    self->priv->flush_source = g_timeout_add_seconds (
+        FLUSH_INTERVAL_SECONDS, caps_cache_flush_timeout_cb, self);
+}
+
+static gboolean
+caps_cache_has_pending (WockyCapsCacheSqlite *self)
+{
+  return g_hash_table_size (self->priv->pending_inserts) > 0 ||
+      g_hash_table_size (self->priv->pending_upgrades) > 0 ||
+      g_hash_table_size (self->priv->pending_touches) > 0;
+}
+
+/* Runs @stmt, to which @node and @reply are bound, for each of @nodes
+ * and its pending change in @pending, in order. Returns the result of the
+ * first step which fails, or SQLITE_DONE. */
+static gint
+caps_cache_write_replies (WockyCapsCacheSqlite *self,
+    sqlite3_stmt *stmt,
+    gint node_param,
+    gint reply_param,
+    GHashTable *pending,
+    GList *nodes,
+    guint *added)
+{
+  GList *l;
+  gint ret;
+  gint now = time (NULL);
+
+  for (l = nodes; l != NULL; l = l->next)
+    {
+      const gchar *node = l->data;
+      GBytes *reply = g_hash_table_lookup (pending, node);
+
+      /* These reset the statement on failure */
+      if (!caps_cache_bind_text (self, stmt, node_param, -1, node) ||
+          !caps_cache_bind_bytes (self, stmt, reply_param, reply))
+        return SQLITE_ERROR;
+
+      /* only the insert statement has a timestamp */
+      if (added != NULL && !caps_cache_bind_int (self, stmt, 3, now))
+        return SQLITE_ERROR;
+
+      ret = sqlite3_step (stmt);
+      caps_cache_reset (stmt);
+
+      if (ret == SQLITE_DONE)
+        {
+          if (added != NULL)
+            (*added)++;
+        }
+      /* SQLITE_CONSTRAINT presumably means another process inserted the
+       * same key first. Ignore it. */
+      else if (ret != SQLITE_CONSTRAINT)
+        {
+          DEBUG ("statement execution failed: %s",
+              sqlite3_errmsg (self->priv->db));
+          return ret;
+        }
+    }
+
+  return SQLITE_DONE;
+}
+
+/* Updates the timestamps of the entries used since the last time. Returns
+ * the result of the first step which fails, or SQLITE_DONE. */
+static gint
+caps_cache_write_touches (WockyCapsCacheSqlite *self)
+{
+  GHashTableIter iter;
+  gpointer node;
+  gint ret;
+  sqlite3_stmt *stmt = self->priv->touch_stmt;
+  gint now = time (NULL);
+
+  g_hash_table_iter_init (&iter, self->priv->pending_touches);
+
+  while (g_hash_table_iter_next (&iter, &node, NULL))
+    {
+      /* These reset the statement on failure */
+      if (!caps_cache_bind_int (self, stmt, 1, now) ||
+          !caps_cache_bind_text (self, stmt, 2, -1, node))
+        return SQLITE_ERROR;
+
+      ret = sqlite3_step (stmt);
+      caps_cache_reset (stmt);
+
+      if (ret != SQLITE_DONE)
+        {
+          DEBUG ("statement execution failed: %s",
+              sqlite3_errmsg (self->priv->db));
+          return ret;
+        }
+    }
+
+  return SQLITE_DONE;
+}
+
+/* Writes out the pending changes in one transaction. It is started with
+ * BEGIN IMMEDIATE, so that if another process is writing we find out before
+ * doing anything rather than part way through, and it's committed straight
+ * away, so other processes are only kept waiting while the rows are written.
+ * If the database is busy, or the writes fail, the changes stay pending and
+ * are tried again later.
+ *
+ * Returns: %TRUE if nothing is pending any more. */
+static gboolean
+caps_cache_flush (WockyCapsCacheSqlite *self)
+{
+  guint added = 0;
+  GList *upgrades;
+  gint ret;
+
+  if (self->priv->flush_source != 0)
+    {
+      g_source_remove (self->priv->flush_source);
+      self->priv->flush_source = 0;
+    }
+
+  if (self->priv->db == NULL)
+    return FALSE;
+
+  if (!caps_cache_has_pending (self))
+    return TRUE;
+
+  ret = sqlite3_exec (self->priv->db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+
+  if (ret != SQLITE_OK)
+    goto failed;
+
+  ret = caps_cache_write_replies (self, self->priv->insert_stmt, 1, 2,
+      self->priv->pending_inserts, self->priv->insert_order->head, &added);
+
+  if (ret == SQLITE_DONE)
+    {
+      upgrades = g_hash_table_get_keys (self->priv->pending_upgrades);
+      ret = caps_cache_write_replies (self, self->priv->upgrade_stmt, 2, 1,
+          self->priv->pending_upgrades, upgrades, NULL);
+      g_list_free (upgrades);
+    }
+
+  if (ret == SQLITE_DONE)
+    ret = caps_cache_write_touches (self);
+
+  if (ret == SQLITE_DONE)
+    ret = sqlite3_exec (self->priv->db, "COMMIT", NULL, NULL, NULL);
+
+  if (ret != SQLITE_OK)
+    {
+      /* Nothing was written, so it can all be tried again */
+      if (!sqlite3_get_autocommit (self->priv->db))
+        sqlite3_exec (self->priv->db, "ROLLBACK", NULL, NULL, NULL);
+
+      goto failed;
+    }
+
+  DEBUG ("wrote %u new entries, %u converted entries and %u timestamps",
+      added, g_hash_table_size (self->priv->pending_upgrades),
+      g_hash_table_size (self->priv->pending_touches));
+
+  /* self->priv->count was increased when they were queued */
+  self->priv->count -= g_hash_table_size (self->priv->pending_inserts) - added;
+  g_hash_table_remove_all (self->priv->pending_inserts);
+  g_queue_clear (self->priv->insert_order);
+  g_hash_table_remove_all (self->priv->pending_upgrades);
+  g_hash_table_remove_all (self->priv->pending_touches);
+  return TRUE;
+
+ failed:
+  if (ret == SQLITE_CORRUPT)
+    {
+      close_nuke_and_reopen_database (self);
+      return FALSE;
+    }
+
+  if (ret == SQLITE_BUSY || ret == SQLITE_LOCKED)
+    DEBUG ("database busy; will write %u entries later",
+        g_hash_table_size (self->priv->pending_inserts));
+  else
+    DEBUG ("writing changes failed: %s; will try again later",
+        sqlite3_errmsg (self->priv->db));
+
+  caps_cache_schedule_flush (self);
+  return FALSE;
+}
+
+/* Parses a reply stored by a version of the cache from before the binary
+ * encoding. */
+static WockyNodeTree *
+caps_cache_parse_xml (WockyCapsCacheSqlite *self,
+    const gchar *node,
+    sqlite3_stmt *stmt)
+{
+  const guchar *value = sqlite3_column_text (stmt, 0);
+  int bytes = sqlite3_column_bytes (stmt, 0);
+  WockyNodeTree *query_node;
+
+  wocky_xmpp_reader_push (self->priv->reader, value, bytes);
+  query_node = (WockyNodeTree *)
+      wocky_xmpp_reader_pop_stanza (self->priv->reader);
+
+  if (query_node == NULL)
+    {
+      GError *error = wocky_xmpp_reader_get_error (self->priv->reader);
+
+      g_warning ("could not parse query_node of %s: %s", node,
+          (error != NULL ? error->message : "no error; incomplete xml?"));
+
+      if (error != NULL)
+        g_error_free (error);
+    }
+
+  wocky_xmpp_reader_reset (self->priv->reader);
+  return query_node;
+}
+
+/* Replaces the XML stored for @node with its binary encoding, next time
+ * changes are written out. */
+static void
+caps_cache_upgrade (WockyCapsCacheSqlite *self,
+    const gchar *node,
+    GBytes *encoded)
+{
+  g_hash_table_replace (self->priv->pending_upgrades, g_strdup (node),
+      g_bytes_ref (encoded));
+  caps_cache_schedule_flush (self);
+}
+
+static GBytes *
+caps_cache_sqlite_lookup (WockyCapsCacheBackend *backend,
+    const gchar *node)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (backend);
+  sqlite3_stmt *stmt = self->priv->select_stmt;
+  WockyNodeTree *query_node;
+  GBytes *reply;
+  gint ret;
+
+  if (self->priv->db == NULL)
+    /* DB open failed. */
+    return NULL;
+
+  reply = g_hash_table_lookup (self->priv->pending_inserts, node);
+
+  if (reply == NULL)
+    reply = g_hash_table_lookup (self->priv->pending_upgrades, node);
+
+  if (reply != NULL)
+    return g_bytes_ref (reply);
+
+  if (!caps_cache_bind_text (self, stmt, 1, -1, node))
+    return NULL;
+
+  ret = sqlite3_step (stmt);
+
+  if (ret == SQLITE_DONE)
+    {
+      /* No result. */
+      caps_cache_reset (stmt);
+      return NULL;
+    }
+
+  if (ret != SQLITE_ROW)
+    {
+      DEBUG ("statement execution failed: %s",
+          sqlite3_errmsg (self->priv->db));
+      caps_cache_reset (stmt);
+      return NULL;
+    }
+
+  if (sqlite3_column_type (stmt, 0) != SQLITE_TEXT)
+    {
+      reply = g_bytes_new (sqlite3_column_blob (stmt, 0),
+          sqlite3_column_bytes (stmt, 0));
+      caps_cache_reset (stmt);
+      return reply;
+    }
+
+  query_node = caps_cache_parse_xml (self, node, stmt);
+  caps_cache_reset (stmt);
+
+  if (query_node == NULL)
+    {
+      /* Destroy the town in order to save it. */
+      close_nuke_and_reopen_database (self);
+      return NULL;
+    }
+
+  reply = wocky_node_tree_to_bytes (query_node);
+  g_object_unref (query_node);
+  caps_cache_upgrade (self, node, reply);
+
+  return reply;
+}
+
+/* Queues @reply to be written out with the other pending changes. */
+static void
+caps_cache_sqlite_insert (WockyCapsCacheBackend *backend,
+    const gchar *node,
+    GBytes *reply)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (backend);
+  gchar *key;
+
+  if (self->priv->db == NULL ||
+      g_hash_table_contains (self->priv->pending_inserts, node))
+    return;
+
+  if (g_hash_table_size (self->priv->pending_inserts) >= MAX_PENDING_INSERTS
+      && !caps_cache_flush (self))
+    {
+      DEBUG ("too many entries waiting to be written; dropping %s", node);
+      return;
+    }
+
+  key = g_strdup (node);
+  g_hash_table_insert (self->priv->pending_inserts, key, g_bytes_ref (reply));
+  g_queue_push_tail (self->priv->insert_order, key);
+  self->priv->count++;
+  caps_cache_schedule_flush (self);
+}
+
+/* This only looks at the database once the cache seems to be too big, and
+ * then shrinks it enough that it isn't again for a while. */
+static void
+caps_cache_sqlite_shrink (WockyCapsCacheBackend *backend,
+    guint high_threshold,
+    guint low_threshold)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (backend);
+  gint ret;
+  guint count;
+  sqlite3_stmt *stmt = self->priv->gc_stmt;
+
+  if (self->priv->db == NULL || self->priv->count <= high_threshold)
+    return;
+
+  /* Make sure new and recently used entries are in the database, and
+   * aren't the ones thrown away. If that can't be done now, neither can
+   * this; it'll be tried again on the next insert. */
+  if (!caps_cache_flush (self))
+    return;
+
+  /* Our count might be off if other processes use the same database */
+  if (!caps_cache_get_one_uint (self, "SELECT COUNT(*) FROM capabilities",
+        &count))
+    return;
+
+  self->priv->count = count;
+
+  if (count <= high_threshold)
+    return;
+
+  /* This is a single statement, so it's a short transaction of its own */
+  if (!caps_cache_bind_int (self, stmt, 1, count - low_threshold))
+    return;
+
+  ret = sqlite3_step (stmt);
+
+  if (ret == SQLITE_DONE)
+    {
+      self->priv->count -= sqlite3_changes (self->priv->db);
+      DEBUG ("cache reduced from %u to %u items", count, self->priv->count);
+    }
+  else
+    {
+      DEBUG ("statement execution failed: %s", sqlite3_errmsg (self->priv->db));
+    }
+
+  caps_cache_reset (stmt);
+
+  if (ret == SQLITE_CORRUPT)
+    close_nuke_and_reopen_database (self);
+}
+
+/* Schedule an update of the entry's timestamp. */
+static void
+caps_cache_sqlite_touch (WockyCapsCacheBackend *backend,
+    const gchar *node)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (backend);
+
+  if (self->priv->db == NULL)
+    return;
+
+  if (!g_hash_table_contains (self->priv->pending_touches, node))
+    g_hash_table_add (self->priv->pending_touches, g_strdup (node));
+
+  caps_cache_schedule_flush (self);
+}
+
+static void
+caps_cache_sqlite_clear (WockyCapsCacheBackend *backend)
+{
+  WockyCapsCacheSqlite *self = WOCKY_CAPS_CACHE_SQLITE (backend);
+
+  if (self->priv->db != NULL)
+    close_nuke_and_reopen_database (self);
+}
+
+static void
+backend_iface_init (gpointer g_iface,
+    gpointer iface_data)
+{
+  WockyCapsCacheBackendIface *iface = g_iface;
+
+  iface->lookup_func = caps_cache_sqlite_lookup;
+  iface->insert_func = caps_cache_sqlite_insert;
+  iface->touch_func = caps_cache_sqlite_touch;
+  iface->shrink_func = caps_cache_sqlite_shrink;
+  iface->clear_func = caps_cache_sqlite_clear;
+}
@@ -0,0 +1,82 @@
+/*
+ * wocky-caps-cache-sqlite.h - Header for WockyCapsCacheSqlite
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef __WOCKY_CAPS_CACHE_SQLITE_H__
+#define __WOCKY_CAPS_CACHE_SQLITE_H__
+
+#include <glib-object.h>
+
+#include "wocky-caps-cache-backend.h"
+
+G_BEGIN_DECLS
+
+/**
+ * WockyCapsCacheSqlite:
+ *
+ * A #WockyCapsCacheBackend storing disco#info replies in SQLite.
+ */
+typedef struct _WockyCapsCacheSqlite WockyCapsCacheSqlite;
+
+/**
+ * WockyCapsCacheSqliteClass:
+ *
+ * The class of a #WockyCapsCacheSqlite.
+ */
+typedef struct _WockyCapsCacheSqliteClass WockyCapsCacheSqliteClass;
+typedef struct _WockyCapsCacheSqlitePrivate WockyCapsCacheSqlitePrivate;
+
+#define WOCKY_TYPE_CAPS_CACHE_SQLITE wocky_caps_cache_sqlite_get_type()
+#define WOCKY_CAPS_CACHE_SQLITE(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), WOCKY_TYPE_CAPS_CACHE_SQLITE, \
+        WockyCapsCacheSqlite))
+#define WOCKY_CAPS_CACHE_SQLITE_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_CAST ((klass), WOCKY_TYPE_CAPS_CACHE_SQLITE, \
+        WockyCapsCacheSqliteClass))
+#define WOCKY_IS_CAPS_CACHE_SQLITE(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WOCKY_TYPE_CAPS_CACHE_SQLITE))
+#define WOCKY_IS_CAPS_CACHE_SQLITE_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_TYPE ((klass), WOCKY_TYPE_CAPS_CACHE_SQLITE))
+#define WOCKY_CAPS_CACHE_SQLITE_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS ((obj), WOCKY_TYPE_CAPS_CACHE_SQLITE, \
+        WockyCapsCacheSqliteClass))
+
+struct _WockyCapsCacheSqlite
+{
+  /*<private>*/
+  GObject parent;
+  WockyCapsCacheSqlitePrivate *priv;
+};
+
+struct _WockyCapsCacheSqliteClass
+{
+  /*<private>*/
+  GObjectClass parent_class;
+};
+
+GType
+wocky_caps_cache_sqlite_get_type (void);
+
+WockyCapsCacheSqlite *
+wocky_caps_cache_sqlite_new (const gchar *path);
+
+G_END_DECLS
+
+#endif /* ifndef __WOCKY_CAPS_CACHE_SQLITE_H__ */
@@ -22,47 +22,55 @@
 
 #include "wocky-caps-cache.h"
 
-#include <errno.h>
 #include <stdio.h>
-#include <string.h>
 
-#ifdef HAVE_UNISTD_H
-#include <unistd.h>
-#endif
-
-#include <sqlite3.h>
-
-#include "wocky-xmpp-reader.h"
-#include "wocky-xmpp-writer.h"
+#include "wocky-caps-cache-mmap.h"
+#include "wocky-caps-cache-sqlite.h"
+#include "wocky-node-private.h"
 
 #define WOCKY_DEBUG_FLAG WOCKY_DEBUG_PRESENCE
 #include "wocky-debug-internal.h"
 
-#define DB_USER_VERSION 2
+/* How many parsed trees to keep in memory by default */
+#define DEFAULT_MEMORY_SIZE 100
 
 static WockyCapsCache *shared_cache = NULL;
 
 struct _WockyCapsCachePrivate
 {
   gchar *path;
-  sqlite3 *db;
-  guint inserts;
+  WockyCapsCacheBackend *backend;
 
-  WockyXmppReader *reader;
-  WockyXmppWriter *writer;
+  /* Trees decoded from the backend, most recently used first. They are
+   * sealed, and handed out as new references by
+   * wocky_caps_cache_lookup_sealed() or copied by wocky_caps_cache_lookup().
+   */
+  GQueue lru;
+  /* owned by the entries in lru: node => GList link in lru */
+  GHashTable *lru_index;
+  guint memory_size;
+
+  guint memory_hits;
+  guint disk_hits;
+  guint misses;
 };
 
+typedef struct {
+  gchar *node;
+  WockyNodeTree *tree;
+} LruEntry;
+
 G_DEFINE_TYPE_WITH_CODE (WockyCapsCache, wocky_caps_cache, G_TYPE_OBJECT,
           G_ADD_PRIVATE (WockyCapsCache))
 
 enum
 {
   PROP_PATH = 1,
+  PROP_BACKEND,
+  PROP_MEMORY_SIZE,
 };
 
-static void wocky_caps_cache_constructed (GObject *object);
-static gboolean caps_cache_get_one_uint (WockyCapsCache *self,
-    const gchar *sql, guint *value);
+static void caps_cache_lru_clear (WockyCapsCache *self);
 
 static void
 wocky_caps_cache_get_property (GObject *object,
@@ -77,6 +85,12 @@ wocky_caps_cache_get_property (GObject *object,
     case PROP_PATH:
       g_value_set_string (value, self->priv->path);
       break;
+    case PROP_BACKEND:
+      g_value_set_object (value, self->priv->backend);
+      break;
+    case PROP_MEMORY_SIZE:
+      g_value_set_uint (value, self->priv->memory_size);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -96,14 +110,35 @@ wocky_caps_cache_set_property (GObject *object,
       g_free (self->priv->path);
       self->priv->path = g_value_dup_string (value);
       break;
+    case PROP_BACKEND:
+      self->priv->backend = g_value_dup_object (value);
+      break;
+    case PROP_MEMORY_SIZE:
+      self->priv->memory_size = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
 }
 
+static void
+wocky_caps_cache_constructed (GObject *object)
+{
+  WockyCapsCache *self = WOCKY_CAPS_CACHE (object);
+
+  if (self->priv->backend == NULL)
+    self->priv->backend = WOCKY_CAPS_CACHE_BACKEND (
+        wocky_caps_cache_sqlite_new (self->priv->path));
+}
+
 static void
 wocky_caps_cache_dispose (GObject *object)
 {
+  WockyCapsCache *self = WOCKY_CAPS_CACHE (object);
+
+  caps_cache_lru_clear (self);
+  g_clear_object (&self->priv->backend);
+
   G_OBJECT_CLASS (wocky_caps_cache_parent_class)->dispose (object);
 }
 
@@ -115,23 +150,7 @@ wocky_caps_cache_finalize (GObject *object)
   g_free (self->priv->path);
   self->priv->path = NULL;
 
-  if (self->priv->db != NULL)
-    {
-      sqlite3_close (self->priv->db);
-      self->priv->db = NULL;
-    }
-
-  if (self->priv->reader != NULL)
-    {
-      g_object_unref (self->priv->reader);
-      self->priv->reader = NULL;
-    }
-
-  if (self->priv->writer != NULL)
-    {
-      g_object_unref (self->priv->writer);
-      self->priv->writer = NULL;
-    }
+  g_hash_table_unref (self->priv->lru_index);
 
   G_OBJECT_CLASS (wocky_caps_cache_parent_class)->finalize (object);
 }
@@ -151,16 +170,44 @@ wocky_caps_cache_class_init (WockyCapsCacheClass *klass)
    * WockyCapsCache:path:
    *
    * The path on disk to the SQLite database where this
-   * #WockyCapsCache stores its information.
+   * #WockyCapsCache stores its information, if #WockyCapsCache:backend
+   * isn't set.
    */
   g_object_class_install_property (object_class, PROP_PATH,
       g_param_spec_string ("path", "Path", "The path to the cache", NULL,
           G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
           G_PARAM_STATIC_STRINGS));
+
+  /**
+   * WockyCapsCache:backend:
+   *
+   * Where the cache is stored. If this isn't set, a #WockyCapsCacheSqlite
+   * is created for #WockyCapsCache:path.
+   */
+  g_object_class_install_property (object_class, PROP_BACKEND,
+      g_param_spec_object ("backend", "Backend", "Where the cache is stored",
+          WOCKY_TYPE_CAPS_CACHE_BACKEND,
+          G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS));
+
+  /**
+   * WockyCapsCache:memory-size:
+   *
+   * The number of parsed entries to keep in memory in front of the
+   * database, so that looking up the same node repeatedly (as happens when
+   * many contacts share a client) doesn't parse it every time. 0 disables
+   * the in-memory cache.
+   */
+  g_object_class_install_property (object_class, PROP_MEMORY_SIZE,
+      g_param_spec_uint ("memory-size", "Memory size",
+          "The number of entries to keep parsed in memory",
+          0, G_MAXUINT, DEFAULT_MEMORY_SIZE,
+          G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS));
 }
 
 static gchar *
-get_path (void)
+get_path (const gchar *filename)
 {
   gchar *free_dir = NULL, *ret;
   const gchar *dir, *path;
@@ -179,13 +226,12 @@ get_path (void)
 
       if (dir != NULL)
         {
-          ret = g_build_path (G_DIR_SEPARATOR_S, dir, "caps-cache.db", NULL);
+          ret = g_build_path (G_DIR_SEPARATOR_S, dir, filename, NULL);
         }
       else
         {
           ret = g_build_path (G_DIR_SEPARATOR_S,
-              g_get_user_cache_dir (), "wocky", "caps", "caps-cache.db",
-              NULL);
+              g_get_user_cache_dir (), "wocky", "caps", filename, NULL);
           dir = free_dir = g_path_get_dirname (ret);
         }
     }
@@ -198,167 +244,13 @@ get_path (void)
   return ret;
 }
 
-static gboolean
-caps_cache_check_version (WockyCapsCache *self)
-{
-  guint version;
-
-  if (!caps_cache_get_one_uint (self, "PRAGMA user_version;", &version))
-    return FALSE;
-
-  if (version == 0)
-    {
-    /* ______________________________________________________________________
-      ( Unfortunately the first incarnation of the caps cache db didn't set  )
-      ( user_version, so we can't tell if 0 means this is a new, empty       )
-      ( database or an old one.                                              )
-      (                                                                      )
-      ( So... let's check if the capabilities table exists. If so, we'll     )
-      ( pretend user_version was 1.                                          )
-      (                                                                      )
-      ( When there's nothing left to burn, you have to set yourself on fire. )
-       ----------------------------------------------------------------------
-                o   ^__^
-                 o  (oo)\_______
-                    (__)\       )\/\
-                        ||----w |
-                        ||     ||   */
-      guint dummy;
-
-      if (caps_cache_get_one_uint (self, "PRAGMA table_info(capabilities)",
-            &dummy))
-        {
-          DEBUG ("capabilities table exists; this isn't a new database");
-          version = 1;
-        }
-    }
-
-  switch (version)
-    {
-      case 0:
-        DEBUG ("opened new, empty database at %s", self->priv->path);
-        return TRUE;
-
-      case DB_USER_VERSION:
-        DEBUG ("opened %s, user_version %u", self->priv->path, version);
-        return TRUE;
-
-      default:
-        DEBUG ("%s is version %u, not our version %u; let's nuke it",
-            self->priv->path, version, DB_USER_VERSION);
-        return FALSE;
-    }
-}
-
-static gboolean
-caps_cache_open (WockyCapsCache *self)
-{
-  gint ret;
-  gchar *error;
-
-  g_return_val_if_fail (self->priv->db == NULL, FALSE);
-
-  ret = sqlite3_open (self->priv->path, &self->priv->db);
-
-  if (ret != SQLITE_OK)
-    {
-      DEBUG ("opening database %s failed: %s", self->priv->path,
-          sqlite3_errmsg (self->priv->db));
-      goto err;
-    }
-
-  if (!caps_cache_check_version (self))
-    goto err;
-
-  ret = sqlite3_exec (self->priv->db,
-      "PRAGMA user_version = " G_STRINGIFY (DB_USER_VERSION) ";"
-      "PRAGMA journal_mode = MEMORY;"
-      "PRAGMA synchronous = OFF",
-      NULL, NULL, &error);
-
-  if (ret != SQLITE_OK)
-    {
-      DEBUG ("failed to set user_version, turn off fsync() and "
-          "turn off on-disk journalling: %s", error);
-      sqlite3_free (error);
-      goto err;
-    }
-
-  ret = sqlite3_exec (self->priv->db,
-      "CREATE TABLE IF NOT EXISTS capabilities (\n"
-      "  node text PRIMARY KEY,\n"
-      "  disco_reply text,\n"
-      "  timestamp int)", NULL, NULL, &error);
-
-  if (ret != SQLITE_OK)
-    {
-      DEBUG ("failed to ensure table exists: %s", error);
-      sqlite3_free (error);
-      goto err;
-    }
-
-  return TRUE;
-
- err:
-  sqlite3_close (self->priv->db);
-  self->priv->db = NULL;
-  return FALSE;
-}
-
-static void
-nuke_it_and_try_again (WockyCapsCache *self)
-{
-  int ret;
-
-  g_return_if_fail (self->priv->path != NULL);
-  g_return_if_fail (self->priv->db == NULL);
-
-  ret = unlink (self->priv->path);
-
-  if (ret != 0)
-    DEBUG ("removing database failed: %s", g_strerror (errno));
-  else
-    caps_cache_open (self);
-}
-
-static void
-close_nuke_and_reopen_database (WockyCapsCache *self)
-{
-  g_return_if_fail (self->priv->db != NULL);
-
-  DEBUG ("Database seems to be corrupt; blowing it away and reinitializing");
-
-  sqlite3_close (self->priv->db);
-  self->priv->db = NULL;
-
-  nuke_it_and_try_again (self);
-}
-
-static void
-wocky_caps_cache_constructed (GObject *object)
-{
-  WockyCapsCache *self = WOCKY_CAPS_CACHE (object);
-
-  if (!caps_cache_open (self))
-    {
-      /* Couldn't open it, or it's got a different user_version. */
-      nuke_it_and_try_again (self);
-    }
-
-  if (self->priv->db == NULL)
-    {
-      DEBUG ("couldn't open db; giving up");
-      return;
-    }
-
-  self->priv->reader = wocky_xmpp_reader_new_no_stream ();
-  self->priv->writer = wocky_xmpp_writer_new_no_stream ();
-}
-
 static void
 wocky_caps_cache_init (WockyCapsCache *self)
 {
   self->priv = wocky_caps_cache_get_instance_private (self);
+
+  g_queue_init (&self->priv->lru);
+  self->priv->lru_index = g_hash_table_new (g_str_hash, g_str_equal);
 }
 
 /**
@@ -388,6 +280,10 @@ wocky_caps_cache_new (const gchar *path)
  * wocky_caps_cache_free_shared() to shared the shared #WockyCapsCache
  * object.
  *
+ * The cache is stored with SQLite, or in a #WockyCapsCacheMmap file if the
+ * <envar>WOCKY_CAPS_CACHE_BACKEND</envar> environment variable is set to
+ * <literal>mmap</literal>.
+ *
  * Returns: a new, or cached, #WockyCapsCache.
  */
 WockyCapsCache *
@@ -397,8 +293,23 @@ wocky_caps_cache_dup_shared (void)
     {
       gchar *path;
 
-      path = get_path ();
-      shared_cache = wocky_caps_cache_new (path);
+      if (!g_strcmp0 (g_getenv ("WOCKY_CAPS_CACHE_BACKEND"), "mmap"))
+        {
+          WockyCapsCacheMmap *backend;
+
+          path = get_path ("caps-cache.map");
+          backend = wocky_caps_cache_mmap_new (path);
+          shared_cache = g_object_new (WOCKY_TYPE_CAPS_CACHE,
+              "backend", backend,
+              NULL);
+          g_object_unref (backend);
+        }
+      else
+        {
+          path = get_path ("caps-cache.db");
+          shared_cache = wocky_caps_cache_new (path);
+        }
+
       g_free (path);
     }
 
@@ -423,329 +334,177 @@ wocky_caps_cache_free_shared (void)
     }
 }
 
-static gboolean
-caps_cache_prepare (WockyCapsCache *self,
-    const gchar *sql,
-    sqlite3_stmt **stmt)
-{
-  gint ret;
-
-  g_return_val_if_fail (self->priv->db != NULL, FALSE);
-
-  ret = sqlite3_prepare_v2 (self->priv->db, sql, -1, stmt, NULL);
-
-  if (ret != SQLITE_OK)
-    {
-      g_warning ("preparing statement '%s' failed: %s", sql,
-          sqlite3_errmsg (self->priv->db));
-      return FALSE;
-    }
-
-  g_assert (stmt != NULL);
-  return TRUE;
-}
-
-/* Finalizes @stmt if an error happens. */
-static gboolean
-caps_cache_bind_int (WockyCapsCache *self,
-    sqlite3_stmt *stmt,
-    gint param,
-    gint value)
+static void
+lru_entry_free (LruEntry *entry)
 {
-  gint ret = sqlite3_bind_int (stmt, param, value);
-
-  if (ret != SQLITE_OK)
-    {
-      g_warning ("parameter binding failed: %s",
-          sqlite3_errmsg (self->priv->db));
-      sqlite3_finalize (stmt);
-      return FALSE;
-    }
-
-  return TRUE;
+  g_object_unref (entry->tree);
+  g_free (entry->node);
+  g_slice_free (LruEntry, entry);
 }
 
-/* Finalizes @stmt if an error happens.
- *
- * Note: the parameter is bound statically, so it mustn't be freed before the
- * statment is finalized.
- */
-static gboolean
-caps_cache_bind_text (WockyCapsCache *self,
-    sqlite3_stmt *stmt,
-    gint param,
-    gint len,
-    const gchar *value)
+static void
+caps_cache_lru_clear (WockyCapsCache *self)
 {
-  gint ret = sqlite3_bind_text (stmt, param, value, len, SQLITE_STATIC);
+  LruEntry *entry;
 
-  if (ret != SQLITE_OK)
-    {
-      g_warning ("parameter binding failed: %s",
-          sqlite3_errmsg (self->priv->db));
-      sqlite3_finalize (stmt);
-      return FALSE;
-    }
+  g_hash_table_remove_all (self->priv->lru_index);
 
-  return TRUE;
+  while ((entry = g_queue_pop_head (&self->priv->lru)) != NULL)
+    lru_entry_free (entry);
 }
 
-/*
- * caps_cache_get_one_uint:
- * @self: the caps cache
- * @sql: a query expected to yield one row with one integer colum
- * @value: location at which to store that single unsigned integer
- *
- * Returns: %TRUE if @value was successfully retrieved; %FALSE otherwise.
- */
-static gboolean
-caps_cache_get_one_uint (WockyCapsCache *self,
-    const gchar *sql,
-    guint *value)
+/* Returns a borrowed reference to the tree for @node, if it's in memory,
+ * and marks it as the most recently used. */
+static WockyNodeTree *
+caps_cache_lru_lookup (WockyCapsCache *self,
+    const gchar *node)
 {
-  sqlite3_stmt *stmt;
-  int ret;
+  GList *link = g_hash_table_lookup (self->priv->lru_index, node);
 
-  if (!caps_cache_prepare (self, sql, &stmt))
-    return FALSE;
-
-  ret = sqlite3_step (stmt);
+  if (link == NULL)
+    return NULL;
 
-  switch (ret)
-    {
-      case SQLITE_ROW:
-        *value = sqlite3_column_int (stmt, 0);
-        sqlite3_finalize (stmt);
-        return TRUE;
-
-      case SQLITE_DONE:
-        DEBUG ("'%s' returned no results", sql);
-        break;
-
-      default:
-        DEBUG ("executing '%s' failed: %s", sql,
-            sqlite3_errmsg (self->priv->db));
-    }
+  g_queue_unlink (&self->priv->lru, link);
+  g_queue_push_head_link (&self->priv->lru, link);
 
-  sqlite3_finalize (stmt);
-  return FALSE;
+  return ((LruEntry *) link->data)->tree;
 }
 
-/* Update cache entry timestmp. */
+/* Adds @tree, which must be sealed, as the most recently used entry for
+ * @node, replacing any older tree for it. */
 static void
-caps_cache_touch (WockyCapsCache *self,
-    const gchar *node)
+caps_cache_lru_add (WockyCapsCache *self,
+    const gchar *node,
+    WockyNodeTree *tree)
 {
-  gint ret = SQLITE_OK;
-  sqlite3_stmt *stmt;
+  LruEntry *entry;
+  GList *link;
 
-  if (!caps_cache_prepare (self,
-        "UPDATE capabilities SET timestamp=? WHERE node=?", &stmt))
+  if (self->priv->memory_size == 0)
     return;
 
-  if (!caps_cache_bind_int (self, stmt, 1, time (NULL)))
-    return;
+  link = g_hash_table_lookup (self->priv->lru_index, node);
 
-  if (!caps_cache_bind_text (self, stmt, 2, -1, node))
-    return;
-
-  ret = sqlite3_step (stmt);
-
-  if (ret != SQLITE_DONE)
+  if (link != NULL)
     {
-      DEBUG ("statement execution failed: %s",
-          sqlite3_errmsg (self->priv->db));
+      entry = link->data;
+      g_object_unref (entry->tree);
+      entry->tree = g_object_ref (tree);
+      g_queue_unlink (&self->priv->lru, link);
+      g_queue_push_head_link (&self->priv->lru, link);
+      return;
     }
 
-  sqlite3_finalize (stmt);
+  entry = g_slice_new (LruEntry);
+  entry->node = g_strdup (node);
+  entry->tree = g_object_ref (tree);
+
+  g_queue_push_head (&self->priv->lru, entry);
+  g_hash_table_insert (self->priv->lru_index, entry->node,
+      self->priv->lru.head);
 
-  if (ret == SQLITE_CORRUPT)
-    close_nuke_and_reopen_database (self);
+  while (self->priv->lru.length > self->priv->memory_size)
+    {
+      entry = g_queue_pop_tail (&self->priv->lru);
+      g_hash_table_remove (self->priv->lru_index, entry->node);
+      lru_entry_free (entry);
+    }
 }
 
 /**
- * wocky_caps_cache_lookup:
+ * wocky_caps_cache_lookup_sealed:
  * @self: a #WockyCapsCache
  * @node: the node to look up in the cache
  *
- * Look up @node in the caps cache @self. The caller is responsible
- * for unreffing the returned #WockyNodeTree.
+ * Looks up @node in the caps cache @self, like wocky_caps_cache_lookup(),
+ * but without copying the result. Recently used entries are kept decoded in
+ * memory (see #WockyCapsCache:memory-size), so the same tree may be returned
+ * to several callers; its top node is sealed with wocky_node_seal(), so it
+ * cannot be modified. The caller is responsible for unreffing the returned
+ * #WockyNodeTree.
  *
- * Returns: a #WockyNodeTree if @node was found in the cache, or %NULL
- * if a match was not found
+ * Returns: (transfer full): a sealed #WockyNodeTree if @node was found in
+ *  the cache, or %NULL if a match was not found
  */
 WockyNodeTree *
-wocky_caps_cache_lookup (WockyCapsCache *self,
+wocky_caps_cache_lookup_sealed (WockyCapsCache *self,
     const gchar *node)
 {
-  gint ret;
-  sqlite3_stmt *stmt;
-  const guchar *value;
-  int bytes;
   WockyNodeTree *query_node;
+  GBytes *reply;
 
-  if (!self->priv->db)
-    /* DB open failed. */
-    return NULL;
-
-  if (!caps_cache_prepare (self,
-        "SELECT disco_reply FROM capabilities WHERE node=?", &stmt))
-    return NULL;
+  query_node = caps_cache_lru_lookup (self, node);
 
-  if (!caps_cache_bind_text (self, stmt, 1, -1, node))
-    return NULL;
-
-  ret = sqlite3_step (stmt);
-
-  if (ret == SQLITE_DONE)
+  if (query_node != NULL)
     {
-      /* No result. */
-      DEBUG ("caps cache miss: %s", node);
-      sqlite3_finalize (stmt);
-      return NULL;
+      DEBUG ("caps cache memory hit: %s", node);
+      self->priv->memory_hits++;
+      wocky_caps_cache_backend_touch (self->priv->backend, node);
+      return g_object_ref (query_node);
     }
 
-  if (ret != SQLITE_ROW)
+  reply = wocky_caps_cache_backend_lookup (self->priv->backend, node);
+
+  if (reply == NULL)
     {
-      DEBUG ("statement execution failed: %s",
-          sqlite3_errmsg (self->priv->db));
-      sqlite3_finalize (stmt);
+      DEBUG ("caps cache miss: %s", node);
+      self->priv->misses++;
       return NULL;
     }
 
   DEBUG ("caps cache hit: %s", node);
-  value = sqlite3_column_text (stmt, 0);
-  bytes = sqlite3_column_bytes (stmt, 0);
-  wocky_xmpp_reader_push (self->priv->reader, value, bytes);
-  query_node = (WockyNodeTree *)
-      wocky_xmpp_reader_pop_stanza (self->priv->reader);
-
-  sqlite3_finalize (stmt);
+  query_node = wocky_node_tree_new_from_bytes (reply);
+  g_bytes_unref (reply);
 
   if (query_node == NULL)
     {
-      GError *error = wocky_xmpp_reader_get_error (self->priv->reader);
-
-      g_warning ("could not parse query_node of %s: %s", node,
-          (error != NULL ? error->message : "no error; incomplete xml?"));
-
-      if (error != NULL)
-        g_error_free (error);
+      g_warning ("could not decode query_node of %s", node);
 
       /* Destroy the town in order to save it. */
-      close_nuke_and_reopen_database (self);
-    }
-  else
-    {
-      caps_cache_touch (self, node);
+      caps_cache_lru_clear (self);
+      wocky_caps_cache_backend_clear (self->priv->backend);
+      return NULL;
     }
 
-  wocky_xmpp_reader_reset (self->priv->reader);
+  wocky_node_seal (wocky_node_tree_get_top_node (query_node));
+  self->priv->disk_hits++;
+  wocky_caps_cache_backend_touch (self->priv->backend, node);
+  caps_cache_lru_add (self, node, query_node);
 
   return query_node;
 }
 
-static void
-caps_cache_insert (WockyCapsCache *self,
-    const gchar *node,
-    WockyNodeTree *query_node)
-{
-  const guint8 *val;
-  gsize len;
-  gint ret = SQLITE_OK;
-  sqlite3_stmt *stmt;
-
-  if (!caps_cache_prepare (self,
-        "INSERT INTO capabilities (node, disco_reply, timestamp) "
-        "VALUES (?, ?, ?)", &stmt))
-    return;
-
-  if (!caps_cache_bind_text (self, stmt, 1, -1, node))
-    return;
-
-  wocky_xmpp_writer_write_node_tree (self->priv->writer, query_node,
-      &val, &len);
-
-  if (!caps_cache_bind_text (self, stmt, 2, len, (const gchar *) val))
-    return;
-
-  if (!caps_cache_bind_int (self, stmt, 3, time (NULL)))
-    return;
-
-  ret = sqlite3_step (stmt);
-
-  if (ret == SQLITE_CONSTRAINT)
-    /* Presumably the error is because the key already exists. Ignore it. */
-    goto OUT;
-
-  if (ret != SQLITE_DONE)
-    {
-      DEBUG ("statement execution failed: %s",
-          sqlite3_errmsg (self->priv->db));
-    }
-
-OUT:
-  sqlite3_finalize (stmt);
-
-  if (ret == SQLITE_CORRUPT)
-    close_nuke_and_reopen_database (self);
-}
-
-static gboolean
-caps_cache_count_entries (WockyCapsCache *self,
-    guint *count)
-{
-  if (!self->priv->db)
-    return FALSE;
-
-  return caps_cache_get_one_uint (self, "SELECT COUNT(*) FROM capabilities",
-      count);
-}
-
-/* If the number of entries is above @high_threshold, remove entries older
- * than @max_age while the cache is bigger than @low_threshold.
+/**
+ * wocky_caps_cache_lookup:
+ * @self: a #WockyCapsCache
+ * @node: the node to look up in the cache
+ *
+ * Look up @node in the caps cache @self. The caller is responsible
+ * for unreffing the returned #WockyNodeTree, and may modify it.
+ * wocky_caps_cache_lookup_sealed() avoids copying the tree, for callers
+ * which only read it.
+ *
+ * Returns: a #WockyNodeTree if @node was found in the cache, or %NULL
+ * if a match was not found
  */
-static void
-caps_cache_gc (WockyCapsCache *self,
-    guint high_threshold,
-    guint low_threshold)
+WockyNodeTree *
+wocky_caps_cache_lookup (WockyCapsCache *self,
+    const gchar *node)
 {
-  gint ret;
-  guint count;
-  sqlite3_stmt *stmt;
-
-  if (!caps_cache_count_entries (self, &count))
-    return;
-
-  if (count <= high_threshold)
-    return;
-
-  /* This emulates DELETE ... ORDER ... LIMIT because some Sqlites (e.g.
-   * Debian) ship without SQLITE_ENABLE_UPDATE_DELETE_LIMIT unabled.
-   */
+  WockyNodeTree *shared, *copy;
 
-  if (!caps_cache_prepare (self,
-        "DELETE FROM capabilities WHERE oid IN ("
-        "  SELECT oid FROM capabilities"
-        "    ORDER BY timestamp ASC, oid ASC"
-        "    LIMIT ?)", &stmt))
-    return;
+  shared = wocky_caps_cache_lookup_sealed (self, node);
 
-  if (!caps_cache_bind_int (self, stmt, 1, count - low_threshold))
-    return;
-
-  ret = sqlite3_step (stmt);
-
-  if (ret == SQLITE_DONE)
-    DEBUG ("cache reduced from %d to %d items",
-        count, count - sqlite3_changes (self->priv->db));
-  else
-      DEBUG ("statement execution failed: %s", sqlite3_errmsg (self->priv->db));
+  if (shared == NULL)
+    return NULL;
 
-  sqlite3_finalize (stmt);
+  copy = g_object_new (WOCKY_TYPE_NODE_TREE,
+      "top-node", _wocky_node_copy_deep (
+          wocky_node_tree_get_top_node (shared)),
+      NULL);
+  g_object_unref (shared);
 
-  if (ret == SQLITE_CORRUPT)
-    close_nuke_and_reopen_database (self);
+  return copy;
 }
 
 static guint
@@ -788,19 +547,58 @@ wocky_caps_cache_insert (WockyCapsCache *self,
     WockyNodeTree *query_node)
 {
   guint size = get_size ();
-
-  if (!self->priv->db)
-    /* DB open failed. */
-    return;
+  GBytes *reply;
 
   DEBUG ("caps cache insert: %s", node);
-  caps_cache_insert (self, node, query_node);
+  reply = wocky_node_tree_to_bytes (query_node);
+  wocky_caps_cache_backend_insert (self->priv->backend, node, reply);
+  g_bytes_unref (reply);
 
-  /* Remove old entries after every 50th insert. */
+  /* if it's in memory, replace the old tree and make it the most recently
+   * used, as it's about to be looked up */
+  if (g_hash_table_contains (self->priv->lru_index, node))
+    {
+      WockyNodeTree *sealed;
 
-  if (self->priv->inserts % 50 == 0)
-    caps_cache_gc (self, size, MAX (1, 0.95 * size));
+      if (wocky_node_is_sealed (wocky_node_tree_get_top_node (query_node)))
+        sealed = g_object_ref (query_node);
+      else
+        sealed = wocky_node_tree_new_from_node (
+            wocky_node_tree_get_top_node (query_node));
 
-  self->priv->inserts++;
+      wocky_node_seal (wocky_node_tree_get_top_node (sealed));
+      caps_cache_lru_add (self, node, sealed);
+      g_object_unref (sealed);
+    }
+
+  wocky_caps_cache_backend_shrink (self->priv->backend, size,
+      MAX (1, 0.95 * size));
 }
 
+/**
+ * wocky_caps_cache_get_stats:
+ * @self: a #WockyCapsCache
+ * @memory_hits: (out) (allow-none): the number of lookups answered from
+ *  memory
+ * @disk_hits: (out) (allow-none): the number of lookups answered from the
+ *  database
+ * @misses: (out) (allow-none): the number of lookups of unknown nodes
+ *
+ * Gets the number of lookups done in @self so far, by where the result came
+ * from.
+ */
+void
+wocky_caps_cache_get_stats (WockyCapsCache *self,
+    guint *memory_hits,
+    guint *disk_hits,
+    guint *misses)
+{
+  if (memory_hits != NULL)
+    *memory_hits = self->priv->memory_hits;
+
+  if (disk_hits != NULL)
+    *disk_hits = self->priv->disk_hits;
+
+  if (misses != NULL)
+    *misses = self->priv->misses;
+}
@@ -78,6 +78,9 @@ wocky_caps_cache_get_type (void);
 WockyNodeTree *wocky_caps_cache_lookup (WockyCapsCache *self,
     const gchar *node);
 
+WockyNodeTree *wocky_caps_cache_lookup_sealed (WockyCapsCache *self,
+    const gchar *node);
+
 void wocky_caps_cache_insert (WockyCapsCache *self,
     const gchar *node,
     WockyNodeTree *query_node);
@@ -91,6 +94,11 @@ wocky_caps_cache_dup_shared (void);
 void
 wocky_caps_cache_free_shared (void);
 
+void wocky_caps_cache_get_stats (WockyCapsCache *self,
+    guint *memory_hits,
+    guint *disk_hits,
+    guint *misses);
+
 G_END_DECLS
 
 #endif /* ifndef __WOCKY_CAPS_CACHE_H__ */
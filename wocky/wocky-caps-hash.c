@@ -22,7 +22,15 @@
  * @title: WockyCapsHash
  * @short_description: Utilities for computing verification string hash
  *
- * Computes verification string hashes according to XEP-0115 v1.5
+ * Computes verification string hashes according to XEP-0115 v1.5, and
+ * XEP-0390 Entity Capabilities 2.0 hashes.
+ *
+ * The strings making up the hash input are fed to the hash function
+ * straight from the disco reply or the lists they came from, without
+ * being copied into an intermediate buffer. What a #WockyDataForm
+ * contributes to the input is remembered on the form until a field is
+ * added or set on it, so hashing the same forms again only costs the
+ * identities and features.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -37,72 +45,280 @@
 #include "wocky-disco-identity.h"
 #include "wocky-utils.h"
 #include "wocky-data-form.h"
+#include "wocky-data-form-internal.h"
 #include "wocky-namespaces.h"
 
 #define WOCKY_DEBUG_FLAG WOCKY_DEBUG_PRESENCE
 #include "wocky-debug-internal.h"
 
-static gint
-char_cmp (gconstpointer a,
-    gconstpointer b)
+typedef enum {
+  /* XEP-0115 v1.5: SHA-1 over '<'-terminated strings */
+  CAPS_HASH_V1,
+  /* XEP-0390: strings terminated by the ASCII separator characters */
+  CAPS_HASH_V2,
+} CapsHashVersion;
+
+/* Separators used by XEP-0390 */
+#define ECAPS2_UNIT_SEPARATOR 0x1f
+#define ECAPS2_RECORD_SEPARATOR 0x1e
+#define ECAPS2_GROUP_SEPARATOR 0x1d
+#define ECAPS2_FILE_SEPARATOR 0x1c
+
+static const struct {
+    const gchar *name;
+    GChecksumType checksum_type;
+    /* if non-zero, BLAKE2b is used rather than checksum_type */
+    gsize blake2b_digest_len;
+} algorithms[] = {
+  { "sha-256", G_CHECKSUM_SHA256, 0 },
+  { "sha-512", G_CHECKSUM_SHA512, 0 },
+  { "blake2b-256", G_CHECKSUM_SHA256, 32 },
+  { "blake2b-512", G_CHECKSUM_SHA256, 64 },
+};
+
+/* BLAKE2b, unkeyed, as described by RFC 7693 */
+
+typedef struct {
+  guint64 h[8];
+  guint64 t[2];
+  guint8 buf[128];
+  gsize buf_len;
+  gsize digest_len;
+} Blake2b;
+
+static const guint64 blake2b_iv[8] = {
+  G_GUINT64_CONSTANT (0x6a09e667f3bcc908),
+  G_GUINT64_CONSTANT (0xbb67ae8584caa73b),
+  G_GUINT64_CONSTANT (0x3c6ef372fe94f82b),
+  G_GUINT64_CONSTANT (0xa54ff53a5f1d36f1),
+  G_GUINT64_CONSTANT (0x510e527fade682d1),
+  G_GUINT64_CONSTANT (0x9b05688c2b3e6c1f),
+  G_GUINT64_CONSTANT (0x1f83d9abfb41bd6b),
+  G_GUINT64_CONSTANT (0x5be0cd19137e2179),
+};
+
+static const guint8 blake2b_sigma[12][16] = {
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+  { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+  { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+  { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+  { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+  { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+  { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+  { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+  { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+  { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+  { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+};
+
+#define BLAKE2B_ROTR(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#define BLAKE2B_G(a, b, c, d, x, y) \
+  G_STMT_START { \
+    v[a] = v[a] + v[b] + (x); \
+    v[d] = BLAKE2B_ROTR (v[d] ^ v[a], 32); \
+    v[c] = v[c] + v[d]; \
+    v[b] = BLAKE2B_ROTR (v[b] ^ v[c], 24); \
+    v[a] = v[a] + v[b] + (y); \
+    v[d] = BLAKE2B_ROTR (v[d] ^ v[a], 16); \
+    v[c] = v[c] + v[d]; \
+    v[b] = BLAKE2B_ROTR (v[b] ^ v[c], 63); \
+  } G_STMT_END
+
+static void
+blake2b_compress (Blake2b *ctx,
+    gboolean last)
 {
-  gchar *left = *(gchar **) a;
-  gchar *right = *(gchar **) b;
+  guint64 v[16], m[16];
+  guint i;
+
+  for (i = 0; i < 8; i++)
+    {
+      v[i] = ctx->h[i];
+      v[i + 8] = blake2b_iv[i];
+    }
+
+  v[12] ^= ctx->t[0];
+  v[13] ^= ctx->t[1];
+
+  if (last)
+    v[14] = ~v[14];
+
+  for (i = 0; i < 16; i++)
+    {
+      memcpy (&m[i], ctx->buf + 8 * i, 8);
+      m[i] = GUINT64_FROM_LE (m[i]);
+    }
 
-  return strcmp (left, right);
+  for (i = 0; i < 12; i++)
+    {
+      const guint8 *s = blake2b_sigma[i];
+
+      BLAKE2B_G (0, 4, 8, 12, m[s[0]], m[s[1]]);
+      BLAKE2B_G (1, 5, 9, 13, m[s[2]], m[s[3]]);
+      BLAKE2B_G (2, 6, 10, 14, m[s[4]], m[s[5]]);
+      BLAKE2B_G (3, 7, 11, 15, m[s[6]], m[s[7]]);
+      BLAKE2B_G (0, 5, 10, 15, m[s[8]], m[s[9]]);
+      BLAKE2B_G (1, 6, 11, 12, m[s[10]], m[s[11]]);
+      BLAKE2B_G (2, 7, 8, 13, m[s[12]], m[s[13]]);
+      BLAKE2B_G (3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+
+  for (i = 0; i < 8; i++)
+    ctx->h[i] ^= v[i] ^ v[i + 8];
 }
 
-static gint
-identity_cmp (gconstpointer a,
-    gconstpointer b)
+static void
+blake2b_init (Blake2b *ctx,
+    gsize digest_len)
 {
-  WockyDiscoIdentity *left = *(WockyDiscoIdentity **) a;
-  WockyDiscoIdentity *right = *(WockyDiscoIdentity **) b;
+  memcpy (ctx->h, blake2b_iv, sizeof (ctx->h));
+  /* the parameter block: no key, a fanout and depth of 1 */
+  ctx->h[0] ^= 0x01010000 ^ digest_len;
+  ctx->t[0] = 0;
+  ctx->t[1] = 0;
+  ctx->buf_len = 0;
+  ctx->digest_len = digest_len;
+}
+
+static void
+blake2b_count (Blake2b *ctx,
+    gsize n)
+{
+  ctx->t[0] += n;
 
-  return wocky_disco_identity_cmp (left, right);
+  if (ctx->t[0] < n)
+    ctx->t[1]++;
 }
 
-static gint
-dataforms_cmp (gconstpointer a,
-    gconstpointer b)
+static void
+blake2b_update (Blake2b *ctx,
+    const guint8 *data,
+    gsize len)
 {
-  WockyDataForm *left = *(WockyDataForm **) a;
-  WockyDataForm *right = *(WockyDataForm **) b;
-  WockyDataFormField *left_type, *right_type;
+  while (len > 0)
+    {
+      gsize n;
 
-  left_type = g_hash_table_lookup (left->fields, "FORM_TYPE");
-  right_type = g_hash_table_lookup (right->fields, "FORM_TYPE");
+      /* A full block is only compressed once there is more input, since
+       * the last block is compressed differently. */
+      if (ctx->buf_len == sizeof (ctx->buf))
+        {
+          blake2b_count (ctx, ctx->buf_len);
+          blake2b_compress (ctx, FALSE);
+          ctx->buf_len = 0;
+        }
+
+      n = MIN (len, sizeof (ctx->buf) - ctx->buf_len);
+      memcpy (ctx->buf + ctx->buf_len, data, n);
+      ctx->buf_len += n;
+      data += n;
+      len -= n;
+    }
+}
+
+static void
+blake2b_final (Blake2b *ctx,
+    guint8 *digest)
+{
+  gsize i;
+
+  blake2b_count (ctx, ctx->buf_len);
+  memset (ctx->buf + ctx->buf_len, 0, sizeof (ctx->buf) - ctx->buf_len);
+  blake2b_compress (ctx, TRUE);
+
+  for (i = 0; i < ctx->digest_len; i++)
+    digest[i] = (ctx->h[i / 8] >> (8 * (i % 8))) & 0xff;
+}
+
+/* Whichever hash function is in use */
+typedef struct {
+  /* if NULL, blake2b is used */
+  GChecksum *checksum;
+  Blake2b blake2b;
+} Hasher;
 
-  if (left_type == NULL && right_type == NULL)
-    return 0;
-  else if (left_type == NULL && right_type != NULL)
-    return -1;
-  else if (left_type != NULL && right_type == NULL)
-    return 1;
-  else /* left_type != NULL && right_type != NULL */
+static void
+hasher_init (Hasher *hasher,
+    GChecksumType checksum_type,
+    gsize blake2b_digest_len)
+{
+  if (blake2b_digest_len != 0)
+    {
+      hasher->checksum = NULL;
+      blake2b_init (&hasher->blake2b, blake2b_digest_len);
+    }
+  else
     {
-      const gchar *left_value = NULL, *right_value = NULL;
+      hasher->checksum = g_checksum_new (checksum_type);
+    }
+}
 
-      if (left_type->raw_value_contents != NULL)
-        left_value = left_type->raw_value_contents[0];
+static void
+hasher_update (Hasher *hasher,
+    const guint8 *data,
+    gsize len)
+{
+  if (hasher->checksum != NULL)
+    g_checksum_update (hasher->checksum, data, len);
+  else
+    blake2b_update (&hasher->blake2b, data, len);
+}
 
-      if (right_type->raw_value_contents != NULL)
-        right_value = right_type->raw_value_contents[0];
+static void
+hasher_update_str (Hasher *hasher,
+    const gchar *str,
+    guint8 terminator)
+{
+  hasher_update (hasher, (const guint8 *) str, strlen (str));
+  hasher_update (hasher, &terminator, 1);
+}
 
-      return g_strcmp0 (left_value, right_value);
+static gchar *
+hasher_finish (Hasher *hasher)
+{
+  guint8 digest[64];
+  gsize len = sizeof (digest);
+
+  if (hasher->checksum != NULL)
+    {
+      g_checksum_get_digest (hasher->checksum, digest, &len);
+      g_checksum_free (hasher->checksum);
+    }
+  else
+    {
+      blake2b_final (&hasher->blake2b, digest);
+      len = hasher->blake2b.digest_len;
     }
+
+  return g_base64_encode (digest, len);
 }
 
-static GPtrArray *
-ptr_array_copy (GPtrArray *old)
+static void
+byte_array_append_str (GByteArray *array,
+    const gchar *str,
+    guint8 terminator)
 {
-  GPtrArray *new = g_ptr_array_sized_new (old->len);
-  guint i;
+  g_byte_array_append (array, (const guint8 *) str, strlen (str));
+  g_byte_array_append (array, &terminator, 1);
+}
 
-  for (i = 0 ; i < old->len ; i++)
-    g_ptr_array_add (new, g_ptr_array_index (old, i));
+/* Orders byte strings by their octets, with a prefix first */
+static gint
+byte_array_cmp (gconstpointer a,
+    gconstpointer b)
+{
+  const GByteArray *left = *(GByteArray * const *) a;
+  const GByteArray *right = *(GByteArray * const *) b;
+  gint ret;
 
-  return new;
+  ret = memcmp (left->data, right->data, MIN (left->len, right->len));
+
+  if (ret != 0)
+    return ret;
+
+  return (left->len > right->len) - (left->len < right->len);
 }
 
 /* see qsort(3) */
@@ -117,241 +333,512 @@ cmpstringp (const void *p1,
   return strcmp (* (char * const *) p1, * (char * const *) p2);
 }
 
-/**
- * wocky_caps_hash_compute_from_lists:
- * @features: a #GPtrArray of strings of features
- * @identities: a #GPtrArray of #WockyDiscoIdentity structures
- * @dataforms: a #GPtrArray of #WockyDataForm objects, or %NULL
- *
- * Compute the hash as defined by the XEP-0115 from a list of
- * features, identities and dataforms.
- *
- * Returns: a newly allocated string of the caps hash which should be
- *          freed using g_free()
- */
-gchar *
-wocky_caps_hash_compute_from_lists (
-    GPtrArray *features,
-    GPtrArray *identities,
-    GPtrArray *dataforms)
+/* Compares two strings in the order XEP-0390 sorts them: by their octets
+ * followed by the 0x1f which terminates each of them in the hash input. */
+static gint
+ecaps2_strcmp (const gchar *left,
+    const gchar *right)
 {
-  GChecksum *checksum;
-  guint8 *sha1;
-  guint i;
-  gchar *encoded = NULL;
-  gsize sha1_buffer_size;
-  GHashTable *form_names;
+  const guchar *l = (const guchar *) left;
+  const guchar *r = (const guchar *) right;
 
-  GPtrArray *features_sorted, *identities_sorted, *dataforms_sorted;
+  while (*l != '\0' && *l == *r)
+    {
+      l++;
+      r++;
+    }
 
-  g_return_val_if_fail (features != NULL, NULL);
-  g_return_val_if_fail (identities != NULL, NULL);
+  return (*l == '\0' ? ECAPS2_UNIT_SEPARATOR : *l) -
+      (*r == '\0' ? ECAPS2_UNIT_SEPARATOR : *r);
+}
 
-  /* not a deep copy, we only need to sort */
-  features_sorted = ptr_array_copy (features);
-  identities_sorted = ptr_array_copy (identities);
+static int
+ecaps2_cmpstringp (const void *p1,
+    const void *p2)
+{
+  return ecaps2_strcmp (* (char * const *) p1, * (char * const *) p2);
+}
 
-  if (dataforms != NULL)
-    dataforms_sorted = ptr_array_copy (dataforms);
-  else
-    dataforms_sorted = g_ptr_array_new ();
+/* for a GArray of WockyDiscoIdentity structures */
+static gint
+identity_cmp (gconstpointer a,
+    gconstpointer b)
+{
+  return wocky_disco_identity_cmp ((WockyDiscoIdentity *) a,
+      (WockyDiscoIdentity *) b);
+}
 
-  g_ptr_array_sort (identities_sorted, identity_cmp);
-  g_ptr_array_sort (features_sorted, char_cmp);
-  g_ptr_array_sort (dataforms_sorted, dataforms_cmp);
+static gint
+ecaps2_identity_cmp (gconstpointer a,
+    gconstpointer b)
+{
+  const WockyDiscoIdentity *left = a;
+  const WockyDiscoIdentity *right = b;
+  gint ret;
+
+  if ((ret = ecaps2_strcmp (left->category, right->category)) != 0)
+    return ret;
+  if ((ret = ecaps2_strcmp (left->type, right->type)) != 0)
+    return ret;
+  if ((ret = ecaps2_strcmp (left->lang, right->lang)) != 0)
+    return ret;
+  return ecaps2_strcmp (left->name, right->name);
+}
 
-  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+static gint
+field_cmp (gconstpointer a,
+    gconstpointer b)
+{
+  return wocky_data_form_field_cmp (* (WockyDataFormField * const *) a,
+      * (WockyDataFormField * const *) b);
+}
 
-  form_names = g_hash_table_new (g_str_hash, g_str_equal);
+typedef enum {
+  /* the form is part of the hash input */
+  FORM_HASHED,
+  /* the form has no hidden FORM_TYPE field, so is left out */
+  FORM_IGNORED,
+  /* the form can't be hashed, so neither can anything it's part of */
+  FORM_INVALID,
+} FormStatus;
+
+/* What a data form contributes to the hash, as of a given serial */
+typedef struct {
+  guint serial;
+  FormStatus status;
+  /* borrowed from the form's FORM_TYPE field */
+  const gchar *form_type;
+  GByteArray *input;
+} FormMemo;
+
+static void
+form_memo_free (gpointer p)
+{
+  FormMemo *memo = p;
 
-  /* okay go and actually create this caps hash */
-  for (i = 0 ; i < identities_sorted->len ; i++)
-    {
-      const WockyDiscoIdentity *identity = g_ptr_array_index (identities_sorted, i);
-      gchar *str = g_strdup_printf ("%s/%s/%s/%s",
-          identity->category, identity->type,
-          identity->lang ? identity->lang : "",
-          identity->name ? identity->name : "");
-      g_checksum_update (checksum, (guchar *) str, -1);
-      g_checksum_update (checksum, (guchar *) "<", 1);
-      g_free (str);
-    }
+  if (memo->input != NULL)
+    g_byte_array_unref (memo->input);
 
-  for (i = 0 ; i < features_sorted->len ; i++)
-    {
-      g_checksum_update (checksum, (guchar *) g_ptr_array_index (features_sorted, i), -1);
-      g_checksum_update (checksum, (guchar *) "<", 1);
-    }
+  g_slice_free (FormMemo, memo);
+}
 
-  for (i = 0; i < dataforms_sorted->len; i++)
-    {
-      WockyDataForm *dataform = g_ptr_array_index (dataforms_sorted, i);
-      WockyDataFormField *field;
-      GSList *fields, *l;
-      const gchar *form_name;
+static gint
+form_memo_type_cmp (const void *p1,
+    const void *p2)
+{
+  const FormMemo *left = * (FormMemo * const *) p1;
+  const FormMemo *right = * (FormMemo * const *) p2;
 
-      field = g_hash_table_lookup (dataform->fields, "FORM_TYPE");
+  return strcmp (left->form_type, right->form_type);
+}
 
-      if (field == NULL)
-        {
-          DEBUG ("Data form is missing FORM_TYPE field; ignoring form and "
-              "moving onto next one");
-          continue;
-        }
+static gint
+form_memo_input_cmp (const void *p1,
+    const void *p2)
+{
+  const FormMemo *left = * (FormMemo * const *) p1;
+  const FormMemo *right = * (FormMemo * const *) p2;
+
+  return byte_array_cmp (&left->input, &right->input);
+}
 
-      if (field->type != WOCKY_DATA_FORM_FIELD_TYPE_HIDDEN)
+static GQuark
+form_memo_quark (CapsHashVersion version)
+{
+  static GQuark quarks[2] = { 0, 0 };
+
+  if (quarks[version] == 0)
+    quarks[version] = g_quark_from_static_string (version == CAPS_HASH_V1 ?
+        "wocky-caps-hash-v1" : "wocky-caps-hash-v2");
+
+  return quarks[version];
+}
+
+/* XEP-0115 v1.5 §5.1 steps 7 and 8, except for the FORM_TYPE */
+static gboolean
+form_memo_fill_v1 (FormMemo *memo,
+    GPtrArray *fields)
+{
+  GPtrArray *values = g_ptr_array_new ();
+  gboolean ret = FALSE;
+  guint i, j;
+
+  g_ptr_array_sort (fields, field_cmp);
+
+  for (i = 0; i < fields->len; i++)
+    {
+      WockyDataFormField *field = g_ptr_array_index (fields, i);
+      GStrv tmp;
+
+      if (field->var == NULL)
         {
-          DEBUG ("FORM_TYPE field is not hidden; "
-              "ignoring form and moving onto next one");
-          continue;
+          DEBUG ("can't hash form '%s': it has an anonymous field",
+              memo->form_type);
+          goto out;
         }
 
-      if (field->raw_value_contents == NULL ||
-          g_strv_length (field->raw_value_contents) != 1)
+      if (!wocky_strdiff (field->var, "FORM_TYPE"))
+        continue;
+
+      byte_array_append_str (memo->input, field->var, '<');
+
+      if (field->raw_value_contents == NULL
+          || field->raw_value_contents[0] == NULL)
         {
-          DEBUG ("FORM_TYPE field does not have exactly one value; failing");
-          goto cleanup;
+          DEBUG ("could not get field %s value", field->var);
+          goto out;
         }
 
-      form_name = field->raw_value_contents[0];
+      g_ptr_array_set_size (values, 0);
+
+      for (tmp = field->raw_value_contents; *tmp != NULL; tmp++)
+        g_ptr_array_add (values, *tmp);
 
-      if (g_hash_table_lookup (form_names, form_name) != NULL)
+      /* a shallow copy so we can sort it */
+      g_ptr_array_sort (values, cmpstringp);
+
+      for (j = 0; j < values->len; j++)
+        byte_array_append_str (memo->input, g_ptr_array_index (values, j),
+            '<');
+    }
+
+  ret = TRUE;
+
+out:
+  g_ptr_array_unref (values);
+  return ret;
+}
+
+/* XEP-0390 §4.1 step 3, for a single form */
+static gboolean
+form_memo_fill_v2 (FormMemo *memo,
+    GPtrArray *fields)
+{
+  GPtrArray *encoded = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_byte_array_unref);
+  GPtrArray *values = g_ptr_array_new ();
+  const guint8 end_of_field = ECAPS2_RECORD_SEPARATOR;
+  const guint8 end_of_form = ECAPS2_GROUP_SEPARATOR;
+  gboolean ret = FALSE;
+  guint i, j;
+
+  for (i = 0; i < fields->len; i++)
+    {
+      WockyDataFormField *field = g_ptr_array_index (fields, i);
+      GByteArray *field_input;
+      GStrv tmp;
+
+      if (field->var == NULL)
         {
-          DEBUG ("error: there are multiple data forms with the "
-              "same form type: %s", form_name);
-          goto cleanup;
+          DEBUG ("can't hash form '%s': it has an anonymous field",
+              memo->form_type);
+          goto out;
         }
 
-      g_hash_table_insert (form_names,
-          (gpointer) form_name, (gpointer) form_name);
+      field_input = g_byte_array_new ();
+      g_ptr_array_add (encoded, field_input);
+      byte_array_append_str (field_input, field->var, ECAPS2_UNIT_SEPARATOR);
+      g_ptr_array_set_size (values, 0);
 
-      g_checksum_update (checksum, (guchar *) form_name, -1);
-      g_checksum_update (checksum, (guchar *) "<", 1);
+      for (tmp = field->raw_value_contents; tmp != NULL && *tmp != NULL; tmp++)
+        g_ptr_array_add (values, *tmp);
 
-      /* we need to make a shallow copy to sort the fields */
-      fields = g_slist_copy (dataform->fields_list);
-      fields = g_slist_sort (fields, (GCompareFunc) wocky_data_form_field_cmp);
+      g_ptr_array_sort (values, ecaps2_cmpstringp);
 
-      for (l = fields; l != NULL; l = l->next)
-        {
-          GStrv values = NULL;
-          GStrv tmp;
+      for (j = 0; j < values->len; j++)
+        byte_array_append_str (field_input, g_ptr_array_index (values, j),
+            ECAPS2_UNIT_SEPARATOR);
 
-          field = l->data;
+      g_byte_array_append (field_input, &end_of_field, 1);
+    }
 
-          if (field->var == NULL)
-            {
-              DEBUG ("can't hash form '%s': it has an anonymous field",
-                  form_name);
-              g_slist_free (fields);
-              goto cleanup;
-            }
+  /* fields are ordered by their whole encoding, values and all */
+  g_ptr_array_sort (encoded, byte_array_cmp);
 
-          if (!wocky_strdiff (field->var, "FORM_TYPE"))
-            continue;
+  for (i = 0; i < encoded->len; i++)
+    {
+      GByteArray *field_input = g_ptr_array_index (encoded, i);
 
-          g_checksum_update (checksum, (guchar *) field->var, -1);
-          g_checksum_update (checksum, (guchar *) "<", 1);
+      g_byte_array_append (memo->input, field_input->data, field_input->len);
+    }
 
-          if (field->raw_value_contents == NULL
-              || field->raw_value_contents[0] == NULL)
-            {
-              DEBUG ("could not get field %s value", field->var);
-              g_slist_free (fields);
-              goto cleanup;
-            }
+  g_byte_array_append (memo->input, &end_of_form, 1);
+  ret = TRUE;
+
+out:
+  g_ptr_array_unref (values);
+  g_ptr_array_unref (encoded);
+  return ret;
+}
+
+static FormMemo *
+form_memo_new (WockyDataForm *form,
+    CapsHashVersion version)
+{
+  FormMemo *memo = g_slice_new0 (FormMemo);
+  WockyDataFormField *field;
+  GPtrArray *fields;
+  GSList *l;
+
+  memo->serial = _wocky_data_form_get_serial (form);
+  memo->status = FORM_IGNORED;
+
+  field = g_hash_table_lookup (form->fields, "FORM_TYPE");
+
+  if (field == NULL)
+    {
+      DEBUG ("Data form is missing FORM_TYPE field; ignoring form and "
+          "moving onto next one");
+      return memo;
+    }
+
+  if (field->type != WOCKY_DATA_FORM_FIELD_TYPE_HIDDEN)
+    {
+      DEBUG ("FORM_TYPE field is not hidden; "
+          "ignoring form and moving onto next one");
+      return memo;
+    }
+
+  memo->status = FORM_INVALID;
+
+  if (field->raw_value_contents == NULL ||
+      g_strv_length (field->raw_value_contents) != 1)
+    {
+      DEBUG ("FORM_TYPE field does not have exactly one value; failing");
+      return memo;
+    }
+
+  memo->form_type = field->raw_value_contents[0];
+  memo->input = g_byte_array_new ();
+
+  /* a shallow copy, to be sorted */
+  fields = g_ptr_array_new ();
+
+  for (l = form->fields_list; l != NULL; l = l->next)
+    g_ptr_array_add (fields, l->data);
+
+  if (version == CAPS_HASH_V1)
+    {
+      byte_array_append_str (memo->input, memo->form_type, '<');
+
+      if (form_memo_fill_v1 (memo, fields))
+        memo->status = FORM_HASHED;
+    }
+  else
+    {
+      if (form_memo_fill_v2 (memo, fields))
+        memo->status = FORM_HASHED;
+    }
+
+  g_ptr_array_unref (fields);
+  return memo;
+}
+
+static FormMemo *
+form_memo_get (WockyDataForm *form,
+    CapsHashVersion version)
+{
+  GQuark quark = form_memo_quark (version);
+  FormMemo *memo = g_object_get_qdata (G_OBJECT (form), quark);
+
+  if (memo == NULL || memo->serial != _wocky_data_form_get_serial (form))
+    {
+      memo = form_memo_new (form, version);
+      g_object_set_qdata_full (G_OBJECT (form), quark, memo, form_memo_free);
+    }
+
+  return memo;
+}
+
+/*
+ * caps_hash_compute:
+ * @features: the features, whose strings are borrowed; sorted in place
+ * @identities: #WockyDiscoIdentity structures, whose strings are borrowed;
+ *  sorted in place
+ * @dataforms: (allow-none): #WockyDataForm objects
+ */
+static gchar *
+caps_hash_compute (CapsHashVersion version,
+    WockyCapsHashAlgorithm algorithm,
+    GPtrArray *features,
+    GArray *identities,
+    GPtrArray *dataforms)
+{
+  Hasher hasher;
+  FormMemo **forms = NULL;
+  guint n_forms = 0;
+  guint i;
+  gchar *encoded = NULL;
+
+  if (dataforms != NULL && dataforms->len > 0)
+    {
+      forms = g_new (FormMemo *, dataforms->len);
 
-          /* make a copy so we can sort it */
-          values = g_strdupv (field->raw_value_contents);
+      for (i = 0; i < dataforms->len; i++)
+        {
+          FormMemo *memo = form_memo_get (g_ptr_array_index (dataforms, i),
+              version);
+
+          if (memo->status == FORM_INVALID)
+            goto out;
+
+          if (memo->status == FORM_HASHED)
+            forms[n_forms++] = memo;
+        }
 
-          qsort (values, g_strv_length (values),
-              sizeof (gchar *), cmpstringp);
+      if (n_forms > 1)
+        qsort (forms, n_forms, sizeof (FormMemo *), form_memo_type_cmp);
 
-          for (tmp = values; tmp != NULL && *tmp != NULL; tmp++)
+      for (i = 1; i < n_forms; i++)
+        {
+          if (!strcmp (forms[i - 1]->form_type, forms[i]->form_type))
             {
-              g_checksum_update (checksum, (guchar *) *tmp, -1);
-              g_checksum_update (checksum, (guchar *) "<", 1);
+              DEBUG ("error: there are multiple data forms with the "
+                  "same form type: %s", forms[i]->form_type);
+              goto out;
             }
+        }
+    }
+
+  if (version == CAPS_HASH_V1)
+    {
+      g_array_sort (identities, identity_cmp);
+      g_ptr_array_sort (features, cmpstringp);
+
+      hasher_init (&hasher, G_CHECKSUM_SHA1, 0);
+
+      for (i = 0; i < identities->len; i++)
+        {
+          const WockyDiscoIdentity *identity = &g_array_index (identities,
+              WockyDiscoIdentity, i);
 
-          g_strfreev (values);
+          hasher_update_str (&hasher, identity->category, '/');
+          hasher_update_str (&hasher, identity->type, '/');
+          hasher_update_str (&hasher, identity->lang, '/');
+          hasher_update_str (&hasher, identity->name, '<');
         }
 
-      g_slist_free (fields);
+      for (i = 0; i < features->len; i++)
+        hasher_update_str (&hasher, g_ptr_array_index (features, i), '<');
+
+      for (i = 0; i < n_forms; i++)
+        hasher_update (&hasher, forms[i]->input->data, forms[i]->input->len);
     }
+  else
+    {
+      const guint8 end_of_section = ECAPS2_FILE_SEPARATOR;
+      const guint8 end_of_identity = ECAPS2_RECORD_SEPARATOR;
 
-  sha1_buffer_size = g_checksum_type_get_length (G_CHECKSUM_SHA1);
-  sha1 = g_new0 (guint8, sha1_buffer_size);
-  g_checksum_get_digest (checksum, sha1, &sha1_buffer_size);
+      g_ptr_array_sort (features, ecaps2_cmpstringp);
+      g_array_sort (identities, ecaps2_identity_cmp);
 
-  encoded = g_base64_encode (sha1, sha1_buffer_size);
-  g_free (sha1);
+      if (n_forms > 1)
+        qsort (forms, n_forms, sizeof (FormMemo *), form_memo_input_cmp);
 
-cleanup:
-  g_checksum_free (checksum);
+      hasher_init (&hasher, algorithms[algorithm].checksum_type,
+          algorithms[algorithm].blake2b_digest_len);
 
-  g_hash_table_unref (form_names);
+      for (i = 0; i < features->len; i++)
+        hasher_update_str (&hasher, g_ptr_array_index (features, i),
+            ECAPS2_UNIT_SEPARATOR);
 
-  g_ptr_array_unref (identities_sorted);
-  g_ptr_array_unref (features_sorted);
-  g_ptr_array_unref (dataforms_sorted);
+      hasher_update (&hasher, &end_of_section, 1);
+
+      for (i = 0; i < identities->len; i++)
+        {
+          const WockyDiscoIdentity *identity = &g_array_index (identities,
+              WockyDiscoIdentity, i);
+
+          hasher_update_str (&hasher, identity->category,
+              ECAPS2_UNIT_SEPARATOR);
+          hasher_update_str (&hasher, identity->type, ECAPS2_UNIT_SEPARATOR);
+          hasher_update_str (&hasher, identity->lang, ECAPS2_UNIT_SEPARATOR);
+          hasher_update_str (&hasher, identity->name, ECAPS2_UNIT_SEPARATOR);
+          hasher_update (&hasher, &end_of_identity, 1);
+        }
 
+      hasher_update (&hasher, &end_of_section, 1);
+
+      for (i = 0; i < n_forms; i++)
+        hasher_update (&hasher, forms[i]->input->data, forms[i]->input->len);
+
+      hasher_update (&hasher, &end_of_section, 1);
+    }
+
+  encoded = hasher_finish (&hasher);
+
+out:
+  g_free (forms);
   return encoded;
 }
 
-/**
- * wocky_caps_hash_compute_from_node:
- * @node: a #WockyNode
- *
- * Compute the hash as defined by the XEP-0115 from a received
- * #WockyNode.
- *
- * @node should be the top-level node from a disco response such as
- * the example given in XEP-0115 §5.3 "Complex Generation Example".
- *
- * Returns: the hash. The called must free the returned hash with
- *          g_free().
- */
-gchar *
-wocky_caps_hash_compute_from_node (WockyNode *node)
+/* Shallow copies of @features and @identities, with missing strings in the
+ * identities replaced by "" */
+static void
+copy_lists (GPtrArray *features,
+    GPtrArray *identities,
+    GPtrArray **features_copy,
+    GArray **identities_copy)
+{
+  guint i;
+
+  *features_copy = g_ptr_array_sized_new (features->len);
+
+  for (i = 0 ; i < features->len ; i++)
+    g_ptr_array_add (*features_copy, g_ptr_array_index (features, i));
+
+  *identities_copy = g_array_sized_new (FALSE, FALSE,
+      sizeof (WockyDiscoIdentity), identities->len);
+
+  for (i = 0 ; i < identities->len ; i++)
+    {
+      WockyDiscoIdentity identity = *(WockyDiscoIdentity *)
+          g_ptr_array_index (identities, i);
+
+      if (identity.lang == NULL)
+        identity.lang = (gchar *) "";
+      if (identity.name == NULL)
+        identity.name = (gchar *) "";
+
+      g_array_append_val (*identities_copy, identity);
+    }
+}
+
+/* Gathers the features, identities and data forms in a disco#info reply,
+ * borrowing strings from @node. */
+static gboolean
+collect_from_node (WockyNode *node,
+    GPtrArray *features,
+    GArray *identities,
+    GPtrArray *dataforms)
 {
-  GPtrArray *features = g_ptr_array_new_with_free_func (
-      (GDestroyNotify) g_free);
-  GPtrArray *identities = wocky_disco_identity_array_new ();
-  GPtrArray *dataforms = g_ptr_array_new_with_free_func (
-      (GDestroyNotify) g_object_unref);
-  gchar *str = NULL;
-  GSList *c;
   WockyNodeIter iter;
+  WockyNode *child;
   WockyNode *x_node = NULL;
 
-  for (c = node->children; c != NULL; c = c->next)
+  wocky_node_iter_init (&iter, node, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &child))
     {
-      WockyNode *child = c->data;
-
       if (g_str_equal (child->name, "identity"))
         {
-          const gchar *category;
-          const gchar *name;
-          const gchar *type;
-          const gchar *xmllang;
-          WockyDiscoIdentity *identity;
-
-          category = wocky_node_get_attribute (child, "category");
-          name = wocky_node_get_attribute (child, "name");
-          type = wocky_node_get_attribute (child, "type");
-          xmllang = wocky_node_get_language (child);
-
-          if (NULL == category)
+          WockyDiscoIdentity identity;
+
+          identity.category = (gchar *) wocky_node_get_attribute (child,
+              "category");
+          identity.name = (gchar *) wocky_node_get_attribute (child, "name");
+          identity.type = (gchar *) wocky_node_get_attribute (child, "type");
+          identity.lang = (gchar *) wocky_node_get_language (child);
+
+          if (NULL == identity.category)
             continue;
-          if (NULL == name)
-            name = "";
-          if (NULL == type)
-            type = "";
-          if (NULL == xmllang)
-            xmllang = "";
-
-          identity = wocky_disco_identity_new (category, type, xmllang, name);
-          g_ptr_array_add (identities, identity);
+          if (NULL == identity.name)
+            identity.name = (gchar *) "";
+          if (NULL == identity.type)
+            identity.type = (gchar *) "";
+          if (NULL == identity.lang)
+            identity.lang = (gchar *) "";
+
+          g_array_append_val (identities, identity);
         }
       else if (g_str_equal (child->name, "feature"))
         {
@@ -361,7 +848,7 @@ wocky_caps_hash_compute_from_node (WockyNode *node)
           if (NULL == var)
             continue;
 
-          g_ptr_array_add (features, g_strdup (var));
+          g_ptr_array_add (features, (gpointer) var);
         }
     }
 
@@ -375,18 +862,196 @@ wocky_caps_hash_compute_from_node (WockyNode *node)
         {
           DEBUG ("Failed to parse data form: %s\n", error->message);
           g_clear_error (&error);
-          goto out;
+          return FALSE;
         }
 
       g_ptr_array_add (dataforms, dataform);
    }
 
-  str = wocky_caps_hash_compute_from_lists (features, identities, dataforms);
+  return TRUE;
+}
+
+static gchar *
+caps_hash_compute_from_node (CapsHashVersion version,
+    WockyCapsHashAlgorithm algorithm,
+    WockyNode *node)
+{
+  GPtrArray *features = g_ptr_array_new ();
+  GArray *identities = g_array_new (FALSE, FALSE,
+      sizeof (WockyDiscoIdentity));
+  GPtrArray *dataforms = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_object_unref);
+  gchar *str = NULL;
+
+  if (collect_from_node (node, features, identities, dataforms))
+    str = caps_hash_compute (version, algorithm, features, identities,
+        dataforms);
 
-out:
-  wocky_disco_identity_array_free (identities);
   g_ptr_array_unref (features);
+  g_array_unref (identities);
   g_ptr_array_unref (dataforms);
 
   return str;
 }
+
+static gchar *
+caps_hash_compute_from_lists (CapsHashVersion version,
+    WockyCapsHashAlgorithm algorithm,
+    GPtrArray *features,
+    GPtrArray *identities,
+    GPtrArray *dataforms)
+{
+  GPtrArray *features_copy;
+  GArray *identities_copy;
+  gchar *str;
+
+  /* not deep copies, we only need to sort */
+  copy_lists (features, identities, &features_copy, &identities_copy);
+  str = caps_hash_compute (version, algorithm, features_copy,
+      identities_copy, dataforms);
+
+  g_ptr_array_unref (features_copy);
+  g_array_unref (identities_copy);
+
+  return str;
+}
+
+/**
+ * wocky_caps_hash_compute_from_lists:
+ * @features: a #GPtrArray of strings of features
+ * @identities: a #GPtrArray of #WockyDiscoIdentity structures
+ * @dataforms: a #GPtrArray of #WockyDataForm objects, or %NULL
+ *
+ * Compute the hash as defined by the XEP-0115 from a list of
+ * features, identities and dataforms.
+ *
+ * Returns: a newly allocated string of the caps hash which should be
+ *          freed using g_free()
+ */
+gchar *
+wocky_caps_hash_compute_from_lists (
+    GPtrArray *features,
+    GPtrArray *identities,
+    GPtrArray *dataforms)
+{
+  g_return_val_if_fail (features != NULL, NULL);
+  g_return_val_if_fail (identities != NULL, NULL);
+
+  return caps_hash_compute_from_lists (CAPS_HASH_V1, 0, features,
+      identities, dataforms);
+}
+
+/**
+ * wocky_caps_hash_compute_from_node:
+ * @node: a #WockyNode
+ *
+ * Compute the hash as defined by the XEP-0115 from a received
+ * #WockyNode.
+ *
+ * @node should be the top-level node from a disco response such as
+ * the example given in XEP-0115 §5.3 "Complex Generation Example".
+ *
+ * Returns: the hash. The called must free the returned hash with
+ *          g_free().
+ */
+gchar *
+wocky_caps_hash_compute_from_node (WockyNode *node)
+{
+  g_return_val_if_fail (node != NULL, NULL);
+
+  return caps_hash_compute_from_node (CAPS_HASH_V1, 0, node);
+}
+
+/**
+ * wocky_caps_hash_algorithm_get_name:
+ * @algorithm: a hash algorithm
+ *
+ * Returns: the name of @algorithm in XEP-0300, as used in the
+ *          <literal>algo</literal> attribute of XEP-0390 hashes
+ */
+const gchar *
+wocky_caps_hash_algorithm_get_name (WockyCapsHashAlgorithm algorithm)
+{
+  g_return_val_if_fail (algorithm < G_N_ELEMENTS (algorithms), NULL);
+
+  return algorithms[algorithm].name;
+}
+
+/**
+ * wocky_caps_hash_algorithm_from_name:
+ * @name: the name of a hash algorithm in XEP-0300
+ * @algorithm: (out): location to store the algorithm called @name
+ *
+ * Returns: %TRUE if @name is an algorithm supported by
+ *          wocky_caps_hash_compute_ecaps2_from_node()
+ */
+gboolean
+wocky_caps_hash_algorithm_from_name (const gchar *name,
+    WockyCapsHashAlgorithm *algorithm)
+{
+  guint i;
+
+  g_return_val_if_fail (name != NULL, FALSE);
+
+  for (i = 0; i < G_N_ELEMENTS (algorithms); i++)
+    {
+      if (!strcmp (algorithms[i].name, name))
+        {
+          if (algorithm != NULL)
+            *algorithm = i;
+
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/**
+ * wocky_caps_hash_compute_ecaps2_from_lists:
+ * @features: a #GPtrArray of strings of features
+ * @identities: a #GPtrArray of #WockyDiscoIdentity structures
+ * @dataforms: a #GPtrArray of #WockyDataForm objects, or %NULL
+ * @algorithm: the hash function to use
+ *
+ * Compute the hash as defined by XEP-0390 from a list of features,
+ * identities and dataforms.
+ *
+ * Returns: a newly allocated string of the Base64-encoded hash which
+ *          should be freed using g_free(), or %NULL if the data forms
+ *          can't be hashed
+ */
+gchar *
+wocky_caps_hash_compute_ecaps2_from_lists (GPtrArray *features,
+    GPtrArray *identities,
+    GPtrArray *dataforms,
+    WockyCapsHashAlgorithm algorithm)
+{
+  g_return_val_if_fail (features != NULL, NULL);
+  g_return_val_if_fail (identities != NULL, NULL);
+  g_return_val_if_fail (algorithm < G_N_ELEMENTS (algorithms), NULL);
+
+  return caps_hash_compute_from_lists (CAPS_HASH_V2, algorithm, features,
+      identities, dataforms);
+}
+
+/**
+ * wocky_caps_hash_compute_ecaps2_from_node:
+ * @node: a #WockyNode
+ * @algorithm: the hash function to use
+ *
+ * Compute the hash as defined by XEP-0390 from the
+ * <literal>query</literal> node of a received disco#info reply.
+ *
+ * Returns: the Base64-encoded hash, which should be freed with g_free(),
+ *          or %NULL if the reply's data forms can't be hashed
+ */
+gchar *
+wocky_caps_hash_compute_ecaps2_from_node (WockyNode *node,
+    WockyCapsHashAlgorithm algorithm)
+{
+  g_return_val_if_fail (node != NULL, NULL);
+  g_return_val_if_fail (algorithm < G_N_ELEMENTS (algorithms), NULL);
+
+  return caps_hash_compute_from_node (CAPS_HASH_V2, algorithm, node);
+}
@@ -25,6 +25,25 @@
 
 #include "wocky-node.h"
 
+/**
+ * WockyCapsHashAlgorithm:
+ * @WOCKY_CAPS_HASH_ALGORITHM_SHA_256: SHA-256, as <literal>sha-256</literal>
+ * @WOCKY_CAPS_HASH_ALGORITHM_SHA_512: SHA-512, as <literal>sha-512</literal>
+ * @WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_256: BLAKE2b with a 256-bit digest, as
+ *  <literal>blake2b-256</literal>
+ * @WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_512: BLAKE2b with a 512-bit digest, as
+ *  <literal>blake2b-512</literal>
+ *
+ * Hash functions which can be used for XEP-0390 Entity Capabilities 2.0
+ * hashes, named as in XEP-0300.
+ */
+typedef enum {
+  WOCKY_CAPS_HASH_ALGORITHM_SHA_256,
+  WOCKY_CAPS_HASH_ALGORITHM_SHA_512,
+  WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_256,
+  WOCKY_CAPS_HASH_ALGORITHM_BLAKE2B_512,
+} WockyCapsHashAlgorithm;
+
 gchar * wocky_caps_hash_compute_from_node (
     WockyNode *node) G_GNUC_WARN_UNUSED_RESULT;
 
@@ -32,4 +51,17 @@ gchar * wocky_caps_hash_compute_from_lists (
     GPtrArray *features, GPtrArray *identities,
     GPtrArray *dataforms) G_GNUC_WARN_UNUSED_RESULT;
 
+const gchar * wocky_caps_hash_algorithm_get_name (
+    WockyCapsHashAlgorithm algorithm);
+
+gboolean wocky_caps_hash_algorithm_from_name (const gchar *name,
+    WockyCapsHashAlgorithm *algorithm);
+
+gchar * wocky_caps_hash_compute_ecaps2_from_node (WockyNode *node,
+    WockyCapsHashAlgorithm algorithm) G_GNUC_WARN_UNUSED_RESULT;
+
+gchar * wocky_caps_hash_compute_ecaps2_from_lists (
+    GPtrArray *features, GPtrArray *identities, GPtrArray *dataforms,
+    WockyCapsHashAlgorithm algorithm) G_GNUC_WARN_UNUSED_RESULT;
+
 #endif /* #ifndef __WOCKY_CAPS_HASH_H__ */
@@ -0,0 +1,548 @@
+/*
+ * wocky-caps-resolver.c - Source for WockyCapsResolver
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION: wocky-caps-resolver
+ * @title: WockyCapsResolver
+ * @short_description: Looks up what XEP-0115 capabilities mean
+ * @include: wocky/wocky-caps-resolver.h
+ *
+ * When a contact's presence advertises a XEP-0115 verification string
+ * which isn't in the #WockyCapsCache, the contact has to be asked for its
+ * disco#info. In a busy chatroom many contacts usually advertise the same
+ * string at once; a #WockyCapsResolver asks only one of them at a time,
+ * checks the reply really has that verification string, stores it in the
+ * cache and hands it to everyone who asked. If the reply doesn't match,
+ * another contact which advertised the same string is asked instead.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-caps-resolver.h"
+
+#include "wocky-caps-hash.h"
+#include "wocky-namespaces.h"
+#include "wocky-stanza.h"
+#include "wocky-utils.h"
+
+#define WOCKY_DEBUG_FLAG WOCKY_DEBUG_PRESENCE
+#include "wocky-debug-internal.h"
+
+struct _WockyCapsResolverPrivate
+{
+  WockyPorter *porter;
+  WockyCapsCache *cache;
+
+  /* borrowed "node#ver" => owned PendingLookup */
+  GHashTable *pending;
+};
+
+/* Everyone waiting for one verification string */
+typedef struct {
+  /* not a reference: the resolver owns us */
+  WockyCapsResolver *self;
+
+  /* "node#ver", which is also what's asked for and the cache key */
+  gchar *key;
+  gchar *ver;
+
+  /* GTasks to complete when we know the answer */
+  GQueue waiters;
+  /* owned JIDs which advertised the string and haven't been asked yet */
+  GQueue candidates;
+  /* set of owned JIDs which have ever been added to candidates */
+  GHashTable *seen;
+
+  /* the JID a disco#info request is in flight to, owned by seen, or NULL */
+  const gchar *querying;
+} PendingLookup;
+
+G_DEFINE_TYPE_WITH_CODE (WockyCapsResolver, wocky_caps_resolver,
+    G_TYPE_OBJECT,
+    G_ADD_PRIVATE (WockyCapsResolver))
+
+enum
+{
+  PROP_PORTER = 1,
+  PROP_CACHE,
+};
+
+GQuark
+wocky_caps_resolver_error_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (quark == 0)
+    quark = g_quark_from_static_string ("wocky-caps-resolver-error");
+
+  return quark;
+}
+
+static PendingLookup *
+pending_lookup_new (WockyCapsResolver *self,
+    const gchar *key,
+    const gchar *ver)
+{
+  PendingLookup *pending = g_slice_new0 (PendingLookup);
+
+  pending->self = self;
+  pending->key = g_strdup (key);
+  pending->ver = g_strdup (ver);
+  g_queue_init (&pending->waiters);
+  g_queue_init (&pending->candidates);
+  pending->seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+
+  return pending;
+}
+
+static void
+pending_lookup_free (PendingLookup *pending)
+{
+  /* All the waiters must have been given an answer by now */
+  g_warn_if_fail (g_queue_is_empty (&pending->waiters));
+  g_warn_if_fail (pending->querying == NULL);
+
+  /* the JIDs in candidates are owned by seen */
+  g_queue_clear (&pending->candidates);
+  g_hash_table_unref (pending->seen);
+  g_free (pending->key);
+  g_free (pending->ver);
+  g_slice_free (PendingLookup, pending);
+}
+
+static void
+pending_lookup_add_candidate (PendingLookup *pending,
+    const gchar *jid)
+{
+  gchar *owned;
+
+  if (g_hash_table_contains (pending->seen, jid))
+    return;
+
+  owned = g_strdup (jid);
+  g_hash_table_add (pending->seen, owned);
+  g_queue_push_tail (&pending->candidates, owned);
+}
+
+static void
+wocky_caps_resolver_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  WockyCapsResolver *self = WOCKY_CAPS_RESOLVER (object);
+
+  switch (property_id)
+    {
+    case PROP_PORTER:
+      g_value_set_object (value, self->priv->porter);
+      break;
+    case PROP_CACHE:
+      g_value_set_object (value, self->priv->cache);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+wocky_caps_resolver_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  WockyCapsResolver *self = WOCKY_CAPS_RESOLVER (object);
+
+  switch (property_id)
+    {
+    case PROP_PORTER:
+      self->priv->porter = g_value_dup_object (value);
+      break;
+    case PROP_CACHE:
+      self->priv->cache = g_value_dup_object (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+wocky_caps_resolver_constructed (GObject *object)
+{
+  WockyCapsResolver *self = WOCKY_CAPS_RESOLVER (object);
+
+  g_assert (self->priv->porter != NULL);
+
+  if (self->priv->cache == NULL)
+    self->priv->cache = wocky_caps_cache_dup_shared ();
+}
+
+static void
+wocky_caps_resolver_dispose (GObject *object)
+{
+  WockyCapsResolver *self = WOCKY_CAPS_RESOLVER (object);
+
+  g_clear_object (&self->priv->porter);
+  g_clear_object (&self->priv->cache);
+
+  G_OBJECT_CLASS (wocky_caps_resolver_parent_class)->dispose (object);
+}
+
+static void
+wocky_caps_resolver_finalize (GObject *object)
+{
+  WockyCapsResolver *self = WOCKY_CAPS_RESOLVER (object);
+
+  /* Requests in flight hold a reference to us, so there are none left */
+  g_warn_if_fail (g_hash_table_size (self->priv->pending) == 0);
+  g_hash_table_unref (self->priv->pending);
+
+  G_OBJECT_CLASS (wocky_caps_resolver_parent_class)->finalize (object);
+}
+
+static void
+wocky_caps_resolver_class_init (WockyCapsResolverClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = wocky_caps_resolver_constructed;
+  object_class->get_property = wocky_caps_resolver_get_property;
+  object_class->set_property = wocky_caps_resolver_set_property;
+  object_class->dispose = wocky_caps_resolver_dispose;
+  object_class->finalize = wocky_caps_resolver_finalize;
+
+  /**
+   * WockyCapsResolver:porter:
+   *
+   * The porter used to send disco#info requests.
+   */
+  g_object_class_install_property (object_class, PROP_PORTER,
+      g_param_spec_object ("porter", "Porter",
+          "The porter used to send disco#info requests",
+          WOCKY_TYPE_PORTER,
+          G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS));
+
+  /**
+   * WockyCapsResolver:cache:
+   *
+   * The cache which is checked before asking anyone, and which verified
+   * replies are added to. If this isn't set, the cache returned by
+   * wocky_caps_cache_dup_shared() is used.
+   */
+  g_object_class_install_property (object_class, PROP_CACHE,
+      g_param_spec_object ("cache", "Cache",
+          "The cache of verified disco#info replies",
+          WOCKY_TYPE_CAPS_CACHE,
+          G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE |
+          G_PARAM_STATIC_STRINGS));
+}
+
+static void
+wocky_caps_resolver_init (WockyCapsResolver *self)
+{
+  self->priv = wocky_caps_resolver_get_instance_private (self);
+
+  self->priv->pending = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+/**
+ * wocky_caps_resolver_new:
+ * @porter: the porter used to send disco#info requests
+ * @cache: (allow-none): the cache to use, or %NULL to use the one returned
+ *  by wocky_caps_cache_dup_shared()
+ *
+ * Convenience function to create a new #WockyCapsResolver.
+ *
+ * Returns: a new #WockyCapsResolver.
+ */
+WockyCapsResolver *
+wocky_caps_resolver_new (WockyPorter *porter,
+    WockyCapsCache *cache)
+{
+  return g_object_new (WOCKY_TYPE_CAPS_RESOLVER,
+      "porter", porter,
+      "cache", cache,
+      NULL);
+}
+
+/* Removes @pending and gives its waiters @tree, or @error if @tree is
+ * %NULL. */
+static void
+caps_resolver_complete (WockyCapsResolver *self,
+    PendingLookup *pending,
+    WockyNodeTree *tree,
+    const GError *error)
+{
+  GTask *task;
+
+  /* Take it out of the table first, so that anyone asking about the same
+   * string from a callback starts afresh. */
+  g_hash_table_remove (self->priv->pending, pending->key);
+
+  while ((task = g_queue_pop_head (&pending->waiters)) != NULL)
+    {
+      if (tree != NULL)
+        g_task_return_pointer (task, g_object_ref (tree), g_object_unref);
+      else
+        g_task_return_error (task, g_error_copy (error));
+
+      g_object_unref (task);
+    }
+
+  pending_lookup_free (pending);
+}
+
+/* Checks @reply is a disco#info result with the verification string we're
+ * after, and returns it if so. */
+static WockyNodeTree *
+caps_resolver_verify (PendingLookup *pending,
+    WockyStanza *reply)
+{
+  const gchar *jid = pending->querying;
+  WockyNode *query;
+  GError *error = NULL;
+  gchar *computed;
+  WockyNodeTree *tree = NULL;
+
+  if (wocky_stanza_extract_errors (reply, NULL, &error, NULL, NULL))
+    {
+      DEBUG ("%s couldn't tell us about %s: %s", jid, pending->key,
+          error->message);
+      g_error_free (error);
+      return NULL;
+    }
+
+  query = wocky_node_get_child_ns (wocky_stanza_get_top_node (reply),
+      "query", WOCKY_NS_DISCO_INFO);
+
+  if (query == NULL)
+    {
+      DEBUG ("%s replied about %s without a disco#info <query/>", jid,
+          pending->key);
+      return NULL;
+    }
+
+  computed = wocky_caps_hash_compute_from_node (query);
+
+  if (wocky_strdiff (computed, pending->ver))
+    DEBUG ("%s's reply about %s has verification string %s; ignoring it",
+        jid, pending->key, computed);
+  else
+    tree = wocky_node_tree_new_from_node (query);
+
+  /* it's handed to every waiter, and kept by the cache */
+  if (tree != NULL)
+    wocky_node_seal (wocky_node_tree_get_top_node (tree));
+
+  g_free (computed);
+  return tree;
+}
+
+static void caps_resolver_query_next (WockyCapsResolver *self,
+    PendingLookup *pending);
+
+/* @user_data is the PendingLookup, which can't go away while a request is
+ * in flight; the request holds a reference to the resolver. */
+static void
+caps_resolver_query_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  PendingLookup *pending = user_data;
+  WockyCapsResolver *self = pending->self;
+  WockyStanza *reply;
+  WockyNodeTree *tree = NULL;
+  GError *error = NULL;
+
+  reply = wocky_porter_send_iq_finish (WOCKY_PORTER (source), result,
+      &error);
+
+  if (reply == NULL)
+    {
+      DEBUG ("asking %s about %s failed: %s", pending->querying,
+          pending->key, error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      tree = caps_resolver_verify (pending, reply);
+      g_object_unref (reply);
+    }
+
+  pending->querying = NULL;
+
+  if (tree != NULL)
+    {
+      DEBUG ("verified %s; telling %u waiters", pending->key,
+          g_queue_get_length (&pending->waiters));
+      wocky_caps_cache_insert (self->priv->cache, pending->key, tree);
+      caps_resolver_complete (self, pending, tree, NULL);
+      g_object_unref (tree);
+    }
+  else
+    {
+      caps_resolver_query_next (self, pending);
+    }
+
+  g_object_unref (self);
+}
+
+/* Asks the next contact which advertised @pending's verification string
+ * what it means, or gives up if there's nobody left to ask. */
+static void
+caps_resolver_query_next (WockyCapsResolver *self,
+    PendingLookup *pending)
+{
+  WockyStanza *stanza;
+  const gchar *jid;
+
+  jid = g_queue_pop_head (&pending->candidates);
+
+  if (jid == NULL)
+    {
+      GError *error = g_error_new (WOCKY_CAPS_RESOLVER_ERROR,
+          WOCKY_CAPS_RESOLVER_ERROR_NO_VALID_REPLY,
+          "None of the %u contacts advertising %s told us what it means",
+          g_hash_table_size (pending->seen), pending->key);
+
+      DEBUG ("%s", error->message);
+      caps_resolver_complete (self, pending, NULL, error);
+      g_error_free (error);
+      return;
+    }
+
+  DEBUG ("asking %s about %s", jid, pending->key);
+
+  stanza = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+      WOCKY_STANZA_SUB_TYPE_GET, NULL, jid,
+      '(', "query",
+        ':', WOCKY_NS_DISCO_INFO,
+        '@', "node", pending->key,
+      ')',
+      NULL);
+
+  pending->querying = jid;
+  g_object_ref (self);
+  wocky_porter_send_iq_async (self->priv->porter, stanza, NULL,
+      caps_resolver_query_cb, pending);
+  g_object_unref (stanza);
+}
+
+/**
+ * wocky_caps_resolver_resolve_async:
+ * @self: a #WockyCapsResolver
+ * @jid: the full JID of a contact advertising @ver
+ * @node: the node from the contact's capabilities
+ * @ver: the SHA-1 verification string from the contact's capabilities
+ * @cancellable: (allow-none): an optional #GCancellable, or %NULL
+ * @callback: a function to call when the capabilities are known
+ * @user_data: user data for @callback
+ *
+ * Finds out what the capabilities @jid advertised mean, from the
+ * #WockyCapsResolver:cache if possible, or by asking @jid otherwise.
+ *
+ * If someone is already asking about the same @node and @ver, no new
+ * request is sent: @callback is called when that one is answered. If the
+ * answer doesn't match @ver, @jid and any other contacts which have been
+ * passed with the same @node and @ver are asked in turn until one of them
+ * gives an answer which does.
+ *
+ * Cancelling @cancellable makes this call fail with
+ * %G_IO_ERROR_CANCELLED once the request finishes; the request itself is
+ * not cancelled, as others may be waiting for it.
+ */
+void
+wocky_caps_resolver_resolve_async (WockyCapsResolver *self,
+    const gchar *jid,
+    const gchar *node,
+    const gchar *ver,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  PendingLookup *pending;
+  WockyNodeTree *tree;
+  GTask *task;
+  gchar *key;
+
+  g_return_if_fail (WOCKY_IS_CAPS_RESOLVER (self));
+  g_return_if_fail (jid != NULL);
+  g_return_if_fail (node != NULL);
+  g_return_if_fail (ver != NULL);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, wocky_caps_resolver_resolve_async);
+  key = g_strdup_printf ("%s#%s", node, ver);
+  tree = wocky_caps_cache_lookup_sealed (self->priv->cache, key);
+
+  if (tree != NULL)
+    {
+      g_task_return_pointer (task, tree, g_object_unref);
+      g_object_unref (task);
+      g_free (key);
+      return;
+    }
+
+  pending = g_hash_table_lookup (self->priv->pending, key);
+
+  if (pending == NULL)
+    {
+      pending = pending_lookup_new (self, key, ver);
+      g_hash_table_insert (self->priv->pending, pending->key, pending);
+    }
+  else
+    {
+      DEBUG ("already asking about %s; adding %s to the waiters", key, jid);
+    }
+
+  g_queue_push_tail (&pending->waiters, task);
+  pending_lookup_add_candidate (pending, jid);
+
+  if (pending->querying == NULL)
+    caps_resolver_query_next (self, pending);
+
+  g_free (key);
+}
+
+/**
+ * wocky_caps_resolver_resolve_finish:
+ * @self: a #WockyCapsResolver
+ * @result: the result passed to the callback
+ * @error: a location to store a #GError if an error occurs
+ *
+ * Finishes a call to wocky_caps_resolver_resolve_async().
+ *
+ * Returns: (transfer full): the verified disco#info &lt;query/&gt;, which
+ *  may be shared with other callers and must not be modified, or %NULL on
+ *  error
+ */
+WockyNodeTree *
+wocky_caps_resolver_resolve_finish (WockyCapsResolver *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+      wocky_caps_resolver_resolve_async, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,118 @@
+/*
+ * wocky-caps-resolver.h - Header for WockyCapsResolver
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef __WOCKY_CAPS_RESOLVER_H__
+#define __WOCKY_CAPS_RESOLVER_H__
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "wocky-caps-cache.h"
+#include "wocky-enumtypes.h"
+#include "wocky-node-tree.h"
+#include "wocky-porter.h"
+
+G_BEGIN_DECLS
+
+/**
+ * WockyCapsResolverError:
+ * @WOCKY_CAPS_RESOLVER_ERROR_NO_VALID_REPLY: none of the contacts
+ *   advertising a verification string replied with a disco#info result
+ *   matching it
+ *
+ * #WockyCapsResolver specific errors.
+ */
+typedef enum {
+  WOCKY_CAPS_RESOLVER_ERROR_NO_VALID_REPLY,
+} WockyCapsResolverError;
+
+GQuark wocky_caps_resolver_error_quark (void);
+
+#define WOCKY_CAPS_RESOLVER_ERROR (wocky_caps_resolver_error_quark ())
+
+/**
+ * WockyCapsResolver:
+ *
+ * An object which looks up what XEP-0115 capabilities mean, asking each
+ * verification string's contacts only once.
+ */
+typedef struct _WockyCapsResolver WockyCapsResolver;
+
+/**
+ * WockyCapsResolverClass:
+ *
+ * The class of a #WockyCapsResolver.
+ */
+typedef struct _WockyCapsResolverClass WockyCapsResolverClass;
+typedef struct _WockyCapsResolverPrivate WockyCapsResolverPrivate;
+
+#define WOCKY_TYPE_CAPS_RESOLVER wocky_caps_resolver_get_type()
+#define WOCKY_CAPS_RESOLVER(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), WOCKY_TYPE_CAPS_RESOLVER, \
+        WockyCapsResolver))
+#define WOCKY_CAPS_RESOLVER_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_CAST ((klass), WOCKY_TYPE_CAPS_RESOLVER, \
+        WockyCapsResolverClass))
+#define WOCKY_IS_CAPS_RESOLVER(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WOCKY_TYPE_CAPS_RESOLVER))
+#define WOCKY_IS_CAPS_RESOLVER_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_TYPE ((klass), WOCKY_TYPE_CAPS_RESOLVER))
+#define WOCKY_CAPS_RESOLVER_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS ((obj), WOCKY_TYPE_CAPS_RESOLVER, \
+        WockyCapsResolverClass))
+
+struct _WockyCapsResolver
+{
+  /*<private>*/
+  GObject parent;
+  WockyCapsResolverPrivate *priv;
+};
+
+struct _WockyCapsResolverClass
+{
+  /*<private>*/
+  GObjectClass parent_class;
+};
+
+GType
+wocky_caps_resolver_get_type (void);
+
+WockyCapsResolver *
+wocky_caps_resolver_new (WockyPorter *porter,
+    WockyCapsCache *cache);
+
+void
+wocky_caps_resolver_resolve_async (WockyCapsResolver *self,
+    const gchar *jid,
+    const gchar *node,
+    const gchar *ver,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+WockyNodeTree *
+wocky_caps_resolver_resolve_finish (WockyCapsResolver *self,
+    GAsyncResult *result,
+    GError **error);
+
+G_END_DECLS
+
+#endif /* ifndef __WOCKY_CAPS_RESOLVER_H__ */
@@ -0,0 +1,446 @@
+/*
+ * wocky-caps-set.c - Source for WockyCapsSet
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION: wocky-caps-set
+ * @title: WockyCapsSet
+ * @short_description: Shared sets of capabilities
+ * @include: wocky/wocky-caps-set.h
+ *
+ * Thousands of contacts typically advertise a few dozen distinct XEP-0115
+ * verification strings between them. A #WockyCapsSet holds what one
+ * verified string means, and there is only ever one for each string at a
+ * time: wocky_caps_set_new_from_node() and wocky_caps_set_lookup() return
+ * a new reference to the existing set if there is one.
+ *
+ * Every feature any set has is given a small integer by
+ * wocky_caps_feature_intern(), which is the same for the whole process, and
+ * a set keeps its features as a bitmap of these. Checking for a feature is
+ * a lookup of its integer followed by a bit test, or just the bit test with
+ * wocky_caps_set_has_feature_id() if the caller keeps the integers of
+ * features it checks often.
+ *
+ * Sets, and the feature index, may be used from any thread.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-caps-set.h"
+
+#include "wocky-disco-identity.h"
+
+struct _WockyCapsSet
+{
+  gint ref_count;
+  gchar *ver;
+  GPtrArray *identities;
+  guint n_features;
+
+  /* bit n is set if we have the feature interned as n */
+  guint n_words;
+  guint32 words[];
+};
+
+/* Protects feature_ids and feature_names. Looking a feature up is far more
+ * common than adding one. */
+static GRWLock features_lock;
+/* owned URI => GUINT_TO_POINTER (id + 1) */
+static GHashTable *feature_ids = NULL;
+/* id => URI, owned by feature_ids */
+static GPtrArray *feature_names = NULL;
+
+/* Protects sets */
+G_LOCK_DEFINE_STATIC (sets);
+/* borrowed ver => WockyCapsSet with a non-zero ref_count, not a reference */
+static GHashTable *sets = NULL;
+
+G_DEFINE_BOXED_TYPE (WockyCapsSet, wocky_caps_set,
+    wocky_caps_set_ref, wocky_caps_set_unref)
+
+/* Returns the id of @feature plus one, or 0 if it hasn't been interned.
+ * The caller must hold features_lock. */
+static guint
+caps_feature_lookup_locked (const gchar *feature)
+{
+  if (feature_ids == NULL)
+    return 0;
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (feature_ids, feature));
+}
+
+/**
+ * wocky_caps_feature_intern:
+ * @feature: a feature URI
+ *
+ * Gets the process-wide integer standing for @feature, giving it one if it
+ * hasn't got one yet. Integers are given out in order from 0, and are
+ * never reused.
+ *
+ * Returns: the integer for @feature
+ */
+guint
+wocky_caps_feature_intern (const gchar *feature)
+{
+  guint id;
+  gchar *owned;
+
+  g_return_val_if_fail (feature != NULL, 0);
+
+  g_rw_lock_reader_lock (&features_lock);
+  id = caps_feature_lookup_locked (feature);
+  g_rw_lock_reader_unlock (&features_lock);
+
+  if (id != 0)
+    return id - 1;
+
+  g_rw_lock_writer_lock (&features_lock);
+
+  /* Someone else may have added it while we didn't hold the lock */
+  id = caps_feature_lookup_locked (feature);
+
+  if (id == 0)
+    {
+      if (feature_ids == NULL)
+        {
+          feature_ids = g_hash_table_new_full (g_str_hash, g_str_equal,
+              g_free, NULL);
+          feature_names = g_ptr_array_new ();
+        }
+
+      owned = g_strdup (feature);
+      g_ptr_array_add (feature_names, owned);
+      id = feature_names->len;
+      g_hash_table_insert (feature_ids, owned, GUINT_TO_POINTER (id));
+    }
+
+  g_rw_lock_writer_unlock (&features_lock);
+
+  return id - 1;
+}
+
+/**
+ * wocky_caps_feature_to_string:
+ * @feature_id: an integer returned by wocky_caps_feature_intern()
+ *
+ * Returns: the feature URI standing for @feature_id, which is valid for
+ *  the rest of the process's life, or %NULL if @feature_id hasn't been
+ *  given out
+ */
+const gchar *
+wocky_caps_feature_to_string (guint feature_id)
+{
+  const gchar *feature = NULL;
+
+  g_rw_lock_reader_lock (&features_lock);
+
+  if (feature_names != NULL && feature_id < feature_names->len)
+    feature = g_ptr_array_index (feature_names, feature_id);
+
+  g_rw_lock_reader_unlock (&features_lock);
+
+  return feature;
+}
+
+/* Returns a new reference to the set for @ver, or %NULL if there's none or
+ * it's being freed. The caller must hold the sets lock. */
+static WockyCapsSet *
+caps_set_lookup_locked (const gchar *ver)
+{
+  WockyCapsSet *self;
+  gint ref_count;
+
+  if (sets == NULL)
+    return NULL;
+
+  self = g_hash_table_lookup (sets, ver);
+
+  if (self == NULL)
+    return NULL;
+
+  /* Once the count has dropped to zero the set is as good as gone, and
+   * mustn't be brought back; whoever dropped it will take it out of the
+   * table. */
+  do
+    {
+      ref_count = g_atomic_int_get (&self->ref_count);
+
+      if (ref_count == 0)
+        return NULL;
+    }
+  while (!g_atomic_int_compare_and_exchange (&self->ref_count, ref_count,
+        ref_count + 1));
+
+  return self;
+}
+
+/**
+ * wocky_caps_set_lookup:
+ * @ver: a verified verification string
+ *
+ * Returns: (transfer full): a new reference to the set for @ver, if
+ *  something still holds one, or %NULL
+ */
+WockyCapsSet *
+wocky_caps_set_lookup (const gchar *ver)
+{
+  WockyCapsSet *self;
+
+  g_return_val_if_fail (ver != NULL, NULL);
+
+  G_LOCK (sets);
+  self = caps_set_lookup_locked (ver);
+  G_UNLOCK (sets);
+
+  return self;
+}
+
+/**
+ * wocky_caps_set_new_from_node:
+ * @ver: the verification string @query has been checked to have
+ * @query: a disco#info &lt;query/&gt;
+ *
+ * Gets the set for @ver, creating it from the identities and features in
+ * @query if there isn't one yet. The caller is trusted to have checked,
+ * for instance with wocky_caps_hash_compute_from_node(), that @query
+ * really has the verification string @ver.
+ *
+ * Returns: (transfer full): the set for @ver
+ */
+WockyCapsSet *
+wocky_caps_set_new_from_node (const gchar *ver,
+    WockyNode *query)
+{
+  WockyCapsSet *self, *existing;
+  GArray *ids;
+  GPtrArray *identities;
+  WockyNodeIter iter;
+  WockyNode *child;
+  guint max_id = 0;
+  guint i;
+
+  g_return_val_if_fail (ver != NULL, NULL);
+  g_return_val_if_fail (query != NULL, NULL);
+
+  self = wocky_caps_set_lookup (ver);
+
+  if (self != NULL)
+    return self;
+
+  ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  identities = wocky_disco_identity_array_new ();
+
+  wocky_node_iter_init (&iter, query, "feature", NULL);
+
+  while (wocky_node_iter_next (&iter, &child))
+    {
+      const gchar *var = wocky_node_get_attribute (child, "var");
+      guint id;
+
+      if (var == NULL)
+        continue;
+
+      id = wocky_caps_feature_intern (var);
+      g_array_append_val (ids, id);
+      max_id = MAX (max_id, id);
+    }
+
+  wocky_node_iter_init (&iter, query, "identity", NULL);
+
+  while (wocky_node_iter_next (&iter, &child))
+    {
+      const gchar *category = wocky_node_get_attribute (child, "category");
+      const gchar *type = wocky_node_get_attribute (child, "type");
+
+      /* the same as wocky_caps_hash_compute_from_node() */
+      if (category == NULL)
+        continue;
+
+      g_ptr_array_add (identities, wocky_disco_identity_new (category,
+          type != NULL ? type : "",
+          wocky_node_get_language (child),
+          wocky_node_get_attribute (child, "name")));
+    }
+
+  self = g_malloc0 (sizeof (WockyCapsSet) +
+      (max_id / 32 + 1) * sizeof (guint32));
+  self->ref_count = 1;
+  self->ver = g_strdup (ver);
+  self->identities = identities;
+  self->n_words = max_id / 32 + 1;
+
+  for (i = 0; i < ids->len; i++)
+    {
+      guint id = g_array_index (ids, guint, i);
+
+      if ((self->words[id / 32] & (1U << (id % 32))) == 0)
+        self->n_features++;
+
+      self->words[id / 32] |= 1U << (id % 32);
+    }
+
+  g_array_unref (ids);
+
+  G_LOCK (sets);
+
+  /* Someone else may have made one while we didn't hold the lock */
+  existing = caps_set_lookup_locked (ver);
+
+  if (existing != NULL)
+    {
+      G_UNLOCK (sets);
+      wocky_caps_set_unref (self);
+      return existing;
+    }
+
+  if (sets == NULL)
+    sets = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* This may replace a set whose last reference is being dropped; that set
+   * won't take us out of the table. */
+  g_hash_table_insert (sets, self->ver, self);
+  G_UNLOCK (sets);
+
+  return self;
+}
+
+/**
+ * wocky_caps_set_ref:
+ * @self: a #WockyCapsSet
+ *
+ * Returns: (transfer full): a new reference to @self
+ */
+WockyCapsSet *
+wocky_caps_set_ref (WockyCapsSet *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+  return self;
+}
+
+/**
+ * wocky_caps_set_unref:
+ * @self: a #WockyCapsSet
+ *
+ * Drops a reference to @self, freeing it if it was the last.
+ */
+void
+wocky_caps_set_unref (WockyCapsSet *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  G_LOCK (sets);
+
+  if (sets != NULL && g_hash_table_lookup (sets, self->ver) == self)
+    g_hash_table_remove (sets, self->ver);
+
+  G_UNLOCK (sets);
+
+  wocky_disco_identity_array_free (self->identities);
+  g_free (self->ver);
+  g_free (self);
+}
+
+/**
+ * wocky_caps_set_get_ver:
+ * @self: a #WockyCapsSet
+ *
+ * Returns: the verification string @self stands for
+ */
+const gchar *
+wocky_caps_set_get_ver (WockyCapsSet *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->ver;
+}
+
+/**
+ * wocky_caps_set_get_identities:
+ * @self: a #WockyCapsSet
+ *
+ * Returns: (element-type WockyDiscoIdentity): the identities in @self,
+ *  which must not be modified
+ */
+const GPtrArray *
+wocky_caps_set_get_identities (WockyCapsSet *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->identities;
+}
+
+/**
+ * wocky_caps_set_get_n_features:
+ * @self: a #WockyCapsSet
+ *
+ * Returns: the number of distinct features in @self
+ */
+guint
+wocky_caps_set_get_n_features (WockyCapsSet *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_features;
+}
+
+/**
+ * wocky_caps_set_has_feature_id:
+ * @self: a #WockyCapsSet
+ * @feature_id: an integer returned by wocky_caps_feature_intern()
+ *
+ * Returns: %TRUE if @self has the feature standing for @feature_id
+ */
+gboolean
+wocky_caps_set_has_feature_id (WockyCapsSet *self,
+    guint feature_id)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  return feature_id / 32 < self->n_words &&
+      (self->words[feature_id / 32] & (1U << (feature_id % 32))) != 0;
+}
+
+/**
+ * wocky_caps_set_has_feature:
+ * @self: a #WockyCapsSet
+ * @feature: a feature URI
+ *
+ * Returns: %TRUE if @self has @feature
+ */
+gboolean
+wocky_caps_set_has_feature (WockyCapsSet *self,
+    const gchar *feature)
+{
+  guint id;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (feature != NULL, FALSE);
+
+  g_rw_lock_reader_lock (&features_lock);
+  id = caps_feature_lookup_locked (feature);
+  g_rw_lock_reader_unlock (&features_lock);
+
+  /* No set can have a feature which was never interned */
+  return id != 0 && wocky_caps_set_has_feature_id (self, id - 1);
+}
@@ -0,0 +1,64 @@
+/*
+ * wocky-caps-set.h - Header for WockyCapsSet
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef __WOCKY_CAPS_SET_H__
+#define __WOCKY_CAPS_SET_H__
+
+#include <glib-object.h>
+
+#include "wocky-node.h"
+
+G_BEGIN_DECLS
+
+/**
+ * WockyCapsSet:
+ *
+ * An immutable set of the identities and features a verified XEP-0115
+ * verification string stands for, shared by every contact advertising it.
+ */
+typedef struct _WockyCapsSet WockyCapsSet;
+
+#define WOCKY_TYPE_CAPS_SET (wocky_caps_set_get_type ())
+GType wocky_caps_set_get_type (void);
+
+guint wocky_caps_feature_intern (const gchar *feature);
+const gchar *wocky_caps_feature_to_string (guint feature_id);
+
+WockyCapsSet *wocky_caps_set_new_from_node (const gchar *ver,
+    WockyNode *query) G_GNUC_WARN_UNUSED_RESULT;
+WockyCapsSet *wocky_caps_set_lookup (const gchar *ver)
+    G_GNUC_WARN_UNUSED_RESULT;
+
+WockyCapsSet *wocky_caps_set_ref (WockyCapsSet *self);
+void wocky_caps_set_unref (WockyCapsSet *self);
+
+const gchar *wocky_caps_set_get_ver (WockyCapsSet *self);
+const GPtrArray *wocky_caps_set_get_identities (WockyCapsSet *self);
+guint wocky_caps_set_get_n_features (WockyCapsSet *self);
+
+gboolean wocky_caps_set_has_feature (WockyCapsSet *self,
+    const gchar *feature);
+gboolean wocky_caps_set_has_feature_id (WockyCapsSet *self,
+    guint feature_id);
+
+G_END_DECLS
+
+#endif /* #ifndef __WOCKY_CAPS_SET_H__ */
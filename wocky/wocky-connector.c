@@ -1411,6 +1411,15 @@ sasl_auth_done (GObject *source,
   DEBUG ("SASL complete (success)");
   priv->state = WCON_XMPP_AUTHED;
   priv->authed = TRUE;
+
+  /* SASL2 does not restart the stream: the new features follow directly */
+  if (wocky_sasl_auth_is_sasl2 (sasl))
+    {
+      wocky_xmpp_connection_recv_stanza_async (priv->conn, priv->cancellable,
+          xmpp_features_cb, self);
+      goto out;
+    }
+
   wocky_xmpp_connection_reset (priv->conn);
   xmpp_init (self);
  out:
@@ -1727,7 +1736,8 @@ xep77_signup_send (WockyConnector *self,
   WockyConnectorPrivate *priv = self->priv;
   WockyStanza *riq = NULL;
   WockyNode *reg = NULL;
-  GSList *arg = NULL;
+  WockyNodeIter iter;
+  WockyNode *a;
   gchar *jid = g_strdup_printf ("%s@%s", priv->user, priv->domain);
   gchar *iid = wocky_xmpp_connection_new_id (priv->conn);
   guint args = 0;
@@ -1741,10 +1751,10 @@ xep77_signup_send (WockyConnector *self,
   reg = wocky_node_add_child_ns (wocky_stanza_get_top_node (riq),
       "query", WOCKY_XEP77_NS_REGISTER);
 
-  for (arg = req->children; arg != NULL; arg = g_slist_next (arg))
+  wocky_node_iter_init (&iter, req, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &a))
     {
       gchar *value = NULL;
-      WockyNode *a = (WockyNode *) arg->data;
 
       if (!wocky_strdiff ("instructions", a->name))
         continue;
@@ -0,0 +1,178 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "wocky-credential-store.h"
+
+typedef WockyCredentialStoreIface WockyCredentialStoreInterface;
+
+G_DEFINE_INTERFACE (WockyCredentialStore, wocky_credential_store,
+    G_TYPE_OBJECT)
+
+static void
+wocky_credential_store_default_init (WockyCredentialStoreInterface *iface)
+{
+}
+
+/**
+ * wocky_credential_store_get_token:
+ * @store: a #WockyCredentialStore
+ * @username: the username the token was issued to
+ * @server: the server which issued the token
+ *
+ * Looks up the FAST token stored for @username on @server.
+ *
+ * Returns: (transfer full): a #WockyFastToken to be freed with
+ *  wocky_fast_token_free(), or %NULL if no token is stored.
+ */
+WockyFastToken *
+wocky_credential_store_get_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server)
+{
+  WockyCredentialStoreGetTokenFunc func =
+    WOCKY_CREDENTIAL_STORE_GET_IFACE (store)->get_token_func;
+
+  if (func == NULL)
+    return NULL;
+
+  return func (store, username, server);
+}
+
+/**
+ * wocky_credential_store_set_token:
+ * @store: a #WockyCredentialStore
+ * @username: the username the token was issued to
+ * @server: the server which issued the token
+ * @token: the token to store
+ *
+ * Stores @token for @username on @server, replacing any previous token.
+ */
+void
+wocky_credential_store_set_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server,
+    const WockyFastToken *token)
+{
+  WockyCredentialStoreSetTokenFunc func =
+    WOCKY_CREDENTIAL_STORE_GET_IFACE (store)->set_token_func;
+
+  g_return_if_fail (token != NULL);
+
+  if (func != NULL)
+    func (store, username, server, token);
+}
+
+/**
+ * wocky_credential_store_forget_token:
+ * @store: a #WockyCredentialStore
+ * @username: the username the token was issued to
+ * @server: the server which issued the token
+ *
+ * Drops the token stored for @username on @server, if any.
+ */
+void
+wocky_credential_store_forget_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server)
+{
+  WockyCredentialStoreForgetTokenFunc func =
+    WOCKY_CREDENTIAL_STORE_GET_IFACE (store)->forget_token_func;
+
+  if (func != NULL)
+    func (store, username, server);
+}
+
+/**
+ * wocky_credential_store_dup_user_agent_id:
+ * @store: a #WockyCredentialStore
+ *
+ * Returns the identifier of this client installation, which FAST tokens
+ * are bound to by the server.
+ *
+ * Returns: (transfer full): the user agent identifier, or %NULL if @store
+ *  does not provide one.
+ */
+gchar *
+wocky_credential_store_dup_user_agent_id (WockyCredentialStore *store)
+{
+  WockyCredentialStoreDupUserAgentIdFunc func =
+    WOCKY_CREDENTIAL_STORE_GET_IFACE (store)->dup_user_agent_id_func;
+
+  if (func == NULL)
+    return NULL;
+
+  return func (store);
+}
+
+/**
+ * wocky_fast_token_new:
+ * @mechanism: the mechanism the token was issued for
+ * @secret: the token
+ * @expiry: the expiry time in seconds since the Unix epoch, or 0
+ *
+ * Returns: (transfer full): a new #WockyFastToken
+ */
+WockyFastToken *
+wocky_fast_token_new (const gchar *mechanism,
+    const gchar *secret,
+    gint64 expiry)
+{
+  WockyFastToken *token = g_slice_new0 (WockyFastToken);
+
+  token->mechanism = g_strdup (mechanism);
+  token->secret = g_strdup (secret);
+  token->expiry = expiry;
+
+  return token;
+}
+
+/**
+ * wocky_fast_token_copy:
+ * @token: a #WockyFastToken
+ *
+ * Returns: (transfer full): a copy of @token
+ */
+WockyFastToken *
+wocky_fast_token_copy (const WockyFastToken *token)
+{
+  return wocky_fast_token_new (token->mechanism, token->secret,
+      token->expiry);
+}
+
+/**
+ * wocky_fast_token_free:
+ * @token: a #WockyFastToken
+ *
+ * Frees @token, clearing the secret first.
+ */
+void
+wocky_fast_token_free (WockyFastToken *token)
+{
+  if (token == NULL)
+    return;
+
+  if (token->secret != NULL)
+    memset (token->secret, 0, strlen (token->secret));
+
+  g_free (token->mechanism);
+  g_free (token->secret);
+  g_slice_free (WockyFastToken, token);
+}
+
+/**
+ * wocky_fast_token_has_expired:
+ * @token: a #WockyFastToken
+ *
+ * Returns: %TRUE if @token has an expiry time and it is in the past.
+ */
+gboolean
+wocky_fast_token_has_expired (const WockyFastToken *token)
+{
+  if (token->expiry == 0)
+    return FALSE;
+
+  return token->expiry <= g_get_real_time () / G_USEC_PER_SEC;
+}
@@ -0,0 +1,156 @@
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef _WOCKY_CREDENTIAL_STORE_H
+#define _WOCKY_CREDENTIAL_STORE_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define WOCKY_TYPE_CREDENTIAL_STORE (wocky_credential_store_get_type ())
+#define WOCKY_CREDENTIAL_STORE(obj) (G_TYPE_CHECK_INSTANCE_CAST( \
+    (obj), WOCKY_TYPE_CREDENTIAL_STORE, WockyCredentialStore))
+#define WOCKY_IS_CREDENTIAL_STORE(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE((obj), WOCKY_TYPE_CREDENTIAL_STORE))
+#define WOCKY_CREDENTIAL_STORE_GET_IFACE(obj) (G_TYPE_INSTANCE_GET_INTERFACE ( \
+    (obj), WOCKY_TYPE_CREDENTIAL_STORE, WockyCredentialStoreIface))
+
+typedef struct _WockyCredentialStore WockyCredentialStore;
+
+/**
+ * WockyFastToken:
+ * @mechanism: the token mechanism the token was issued for, eg.
+ *   <literal>HT-SHA-256-NONE</literal>
+ * @secret: the token itself, as sent by the server
+ * @expiry: the expiry time of the token in seconds since the Unix epoch,
+ *   or 0 if the server did not give one
+ *
+ * A XEP-0484 FAST token, as issued by the server at the end of a successful
+ * SASL2 authentication and presented on subsequent connections instead of
+ * the password.
+ */
+typedef struct {
+  gchar *mechanism;
+  gchar *secret;
+  gint64 expiry;
+} WockyFastToken;
+
+/**
+ * WockyCredentialStoreGetTokenFunc:
+ * @store: a #WockyCredentialStore object
+ * @username: the username the token was issued to
+ * @server: the server which issued the token
+ *
+ * Looks up the token stored for @username on @server.
+ *
+ * Returns: (transfer full): a newly allocated #WockyFastToken, or %NULL
+ *  if there is no token stored
+ **/
+typedef WockyFastToken * (*WockyCredentialStoreGetTokenFunc) (
+    WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server);
+
+/**
+ * WockyCredentialStoreSetTokenFunc:
+ * @store: a #WockyCredentialStore object
+ * @username: the username the token was issued to
+ * @server: the server which issued the token
+ * @token: the token to store
+ *
+ * Stores @token for @username on @server, replacing any token previously
+ * stored for them. The store must copy @token if it wants to keep it.
+ **/
+typedef void (*WockyCredentialStoreSetTokenFunc) (
+    WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server,
+    const WockyFastToken *token);
+
+/**
+ * WockyCredentialStoreForgetTokenFunc:
+ * @store: a #WockyCredentialStore object
+ * @username: the username the token was issued to
+ * @server: the server which issued the token
+ *
+ * Removes the token stored for @username on @server, if any. Called when
+ * the token has expired or was rejected by the server.
+ **/
+typedef void (*WockyCredentialStoreForgetTokenFunc) (
+    WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server);
+
+/**
+ * WockyCredentialStoreDupUserAgentIdFunc:
+ * @store: a #WockyCredentialStore object
+ *
+ * Returns the identifier of this client installation. Servers bind FAST
+ * tokens to the user agent identifier they were issued to, so it must stay
+ * the same for as long as the tokens in @store are kept.
+ *
+ * Returns: (transfer full): a stable user agent identifier
+ **/
+typedef gchar * (*WockyCredentialStoreDupUserAgentIdFunc) (
+    WockyCredentialStore *store);
+
+GType
+wocky_credential_store_get_type (void);
+
+WockyFastToken *
+wocky_credential_store_get_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server);
+
+void
+wocky_credential_store_set_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server,
+    const WockyFastToken *token);
+
+void
+wocky_credential_store_forget_token (WockyCredentialStore *store,
+    const gchar *username,
+    const gchar *server);
+
+gchar *
+wocky_credential_store_dup_user_agent_id (WockyCredentialStore *store);
+
+WockyFastToken *
+wocky_fast_token_new (const gchar *mechanism,
+    const gchar *secret,
+    gint64 expiry);
+
+WockyFastToken *
+wocky_fast_token_copy (const WockyFastToken *token);
+
+void
+wocky_fast_token_free (WockyFastToken *token);
+
+gboolean
+wocky_fast_token_has_expired (const WockyFastToken *token);
+
+typedef struct _WockyCredentialStoreIface WockyCredentialStoreIface;
+
+/**
+ * WockyCredentialStoreIface:
+ * @parent: The parent interface.
+ * @get_token_func: Called to look up a stored token
+ * @set_token_func: Called to store a token newly issued by the server
+ * @forget_token_func: Called to drop an expired or rejected token
+ * @dup_user_agent_id_func: Called to get the identifier tokens are bound to
+ **/
+struct _WockyCredentialStoreIface
+{
+    GTypeInterface parent;
+    WockyCredentialStoreGetTokenFunc get_token_func;
+    WockyCredentialStoreSetTokenFunc set_token_func;
+    WockyCredentialStoreForgetTokenFunc forget_token_func;
+    WockyCredentialStoreDupUserAgentIdFunc dup_user_agent_id_func;
+};
+
+G_END_DECLS
+
+#endif /* defined _WOCKY_CREDENTIAL_STORE_H */
@@ -33,6 +33,7 @@
 #endif
 
 #include "wocky-data-form.h"
+#include "wocky-data-form-internal.h"
 
 #include <string.h>
 
@@ -58,6 +59,9 @@ struct _WockyDataFormPrivate
   /* (gchar *) => owned (WockyDataFormField *) */
   GHashTable *reported;
 
+  /* bumped whenever a field is added or a value is set */
+  guint serial;
+
   gboolean dispose_has_run;
 };
 
@@ -552,7 +556,7 @@ data_form_add_field (WockyDataForm *self,
     WockyDataFormField *field,
     gboolean prepend)
 {
-
+  self->priv->serial++;
   self->fields_list =
       (prepend ? g_slist_prepend : g_slist_append) (self->fields_list, field);
 
@@ -719,6 +723,7 @@ data_form_set_value (WockyDataForm *self,
     wocky_g_value_slice_free (field->value);
 
   field->value = value;
+  self->priv->serial++;
 
   g_strfreev (field->raw_value_contents);
 
@@ -882,11 +887,12 @@ data_form_parse_reported (WockyDataForm *self,
     WockyNode *reported_node)
 {
   WockyDataFormPrivate *priv = self->priv;
-  GSList *l;
+  WockyNodeIter iter;
+  WockyNode *node;
 
-  for (l = reported_node->children; l != NULL; l = g_slist_next (l))
+  wocky_node_iter_init (&iter, reported_node, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &node))
     {
-      WockyNode *node = l->data;
       const gchar *var, *label;
       WockyDataFormField *field;
       WockyDataFormFieldType type;
@@ -948,11 +954,13 @@ static void
 parse_unique_result (WockyDataForm *self,
     WockyNode *x)
 {
-  GSList *l, *item = NULL;
+  GSList *item = NULL;
+  WockyNodeIter iter;
+  WockyNode *node;
 
-  for (l = x->children; l != NULL; l = g_slist_next (l))
+  wocky_node_iter_init (&iter, x, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &node))
     {
-      WockyNode *node = l->data;
       const gchar *var;
       WockyDataFormFieldType type;
       WockyDataFormField *result;
@@ -1098,3 +1106,19 @@ wocky_data_form_add_to_node (WockyDataForm *self,
   g_slist_foreach (self->fields_list,
       (GFunc) add_field_to_node_using_default, x);
 }
+
+/*
+ * _wocky_data_form_get_serial:
+ * @self: a data form
+ *
+ * Returns: a number which changes whenever a field is added to @self or a
+ *          field's value is set, so that things derived from the form's
+ *          fields can be cached until then
+ */
+guint
+_wocky_data_form_get_serial (WockyDataForm *self)
+{
+  g_return_val_if_fail (WOCKY_IS_DATA_FORM (self), 0);
+
+  return self->priv->serial;
+}
@@ -0,0 +1,74 @@
+/*
+ * wocky-intern-internal.h - Bounded table of interned element names and
+ *                           attribute keys
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_COMPILATION)
+# error "This is an internal header."
+#endif
+
+#ifndef WOCKY_INTERN_INTERNAL_H
+#define WOCKY_INTERN_INTERNAL_H
+
+#include <string.h>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Interned strings are copied into this arena, which is all the memory the
+ * table will ever use for them. Whether a string is interned is a matter of
+ * whether it lies inside it. */
+#define WOCKY_INTERN_ARENA_SIZE (64 * 1024)
+
+extern gchar _wocky_intern_arena[WOCKY_INTERN_ARENA_SIZE];
+
+static inline gboolean
+_wocky_is_interned (const gchar *str)
+{
+  return (guintptr) str >= (guintptr) _wocky_intern_arena &&
+      (guintptr) str < (guintptr) _wocky_intern_arena +
+          WOCKY_INTERN_ARENA_SIZE;
+}
+
+/* Interned strings are equal if and only if they are the same string, so
+ * only a comparison involving one which isn't interned needs a strcmp(). */
+static inline gboolean
+_wocky_intern_equal (const gchar *a,
+    const gchar *b)
+{
+  if (a == b)
+    return TRUE;
+
+  if (_wocky_is_interned (a) && _wocky_is_interned (b))
+    return FALSE;
+
+  return strcmp (a, b) == 0;
+}
+
+const gchar *_wocky_intern_lookup (const gchar *str);
+gchar *_wocky_intern_or_dup (const gchar *str);
+gchar *_wocky_intern_take (gchar *str);
+void _wocky_intern_release (gchar *str);
+const gchar *_wocky_intern_permanent (const gchar *str);
+const gchar *_wocky_intern_static (const gchar *str);
+
+GQuark _wocky_intern_quark (const gchar *str);
+GQuark _wocky_intern_try_quark (const gchar *str);
+
+G_END_DECLS
+
+#endif /* WOCKY_INTERN_INTERNAL_H */
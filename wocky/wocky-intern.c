@@ -0,0 +1,283 @@
+/*
+ * wocky-intern.c - Bounded table of interned element names and attribute
+ *                  keys
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Element names and attribute keys come off the network, so they can't go
+ * in GLib's intern table, which only ever grows. Instead they go in this
+ * one, which has a fixed size: once it's full, strings which aren't in it
+ * already are copied rather than interned. The vocabulary of XMPP is small,
+ * so in practice everything worth interning is, and a peer sending made-up
+ * names only costs the table room, not the process memory.
+ *
+ * Strings are never removed, so the table is an insert-only open-addressing
+ * hash set: lookups are lock-free, and inserts claim a slot and a piece of
+ * the arena with compare-and-exchange. The table also remembers the quark of
+ * each string used as a namespace, as g_quark_from_string() takes a lock
+ * shared by the whole process. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-intern-internal.h"
+
+/* a power of two */
+#define N_SLOTS 4096
+/* keep probe sequences short */
+#define MAX_ENTRIES (N_SLOTS / 4 * 3)
+/* longer strings aren't names anyone would be looking for */
+#define MAX_LENGTH 128
+
+gchar _wocky_intern_arena[WOCKY_INTERN_ARENA_SIZE];
+
+static gint arena_used = 0;
+static gint n_entries = 0;
+static gchar *slots[N_SLOTS];
+/* the quark of each slot's string, once it has been asked for */
+static GQuark quarks[N_SLOTS];
+
+/* Reserves @n of something of which there are @max, without going over. */
+static gboolean
+reserve (gint *used,
+    gint n,
+    gint max)
+{
+  gint old;
+
+  do
+    {
+      old = g_atomic_int_get (used);
+
+      if (old + n > max)
+        return FALSE;
+    }
+  while (!g_atomic_int_compare_and_exchange (used, old, old + n));
+
+  return TRUE;
+}
+
+static gchar *
+arena_copy (const gchar *str,
+    gsize len)
+{
+  gchar *copy;
+  gint offset;
+
+  if (!reserve (&n_entries, 1, MAX_ENTRIES))
+    return NULL;
+
+  do
+    {
+      offset = g_atomic_int_get (&arena_used);
+
+      if ((gsize) offset + len + 1 > (gsize) WOCKY_INTERN_ARENA_SIZE)
+        return NULL;
+    }
+  while (!g_atomic_int_compare_and_exchange (&arena_used, offset,
+          offset + (gint) len + 1));
+
+  copy = _wocky_intern_arena + offset;
+  memcpy (copy, str, len + 1);
+
+  return copy;
+}
+
+/* Returns the index of @str's slot, or -1 */
+static gint
+find_slot (const gchar *str,
+    gboolean add)
+{
+  gsize len = strlen (str);
+  guint i = g_str_hash (str) & (N_SLOTS - 1);
+  gchar *copy = NULL;
+  guint probes;
+
+  if (len > MAX_LENGTH)
+    return -1;
+
+  for (probes = 0; probes < N_SLOTS; probes++, i = (i + 1) & (N_SLOTS - 1))
+    {
+      gchar *entry = g_atomic_pointer_get (&slots[i]);
+
+      if (entry == NULL)
+        {
+          if (!add)
+            return -1;
+
+          if (copy == NULL)
+            copy = arena_copy (str, len);
+
+          if (copy == NULL)
+            return -1;
+
+          if (g_atomic_pointer_compare_and_exchange (&slots[i], NULL, copy))
+            return i;
+
+          /* Another thread got there first, possibly with the same string.
+           * If not, our copy goes in a later slot. */
+          entry = g_atomic_pointer_get (&slots[i]);
+        }
+
+      if (entry == str || strcmp (entry, str) == 0)
+        return i;
+    }
+
+  return -1;
+}
+
+static const gchar *
+intern (const gchar *str,
+    gboolean add)
+{
+  gint i = find_slot (str, add);
+
+  return (i < 0) ? NULL : g_atomic_pointer_get (&slots[i]);
+}
+
+/* Returns the interned copy of @str if there is one, or %NULL. */
+const gchar *
+_wocky_intern_lookup (const gchar *str)
+{
+  if (_wocky_is_interned (str))
+    return str;
+
+  return intern (str, FALSE);
+}
+
+/* Returns the interned copy of @str, interning it if there's room, or else
+ * a copy of it. Either way, it must be given back with
+ * _wocky_intern_release(). */
+gchar *
+_wocky_intern_or_dup (const gchar *str)
+{
+  const gchar *interned;
+
+  if (_wocky_is_interned (str))
+    return (gchar *) str;
+
+  interned = intern (str, TRUE);
+
+  if (interned != NULL)
+    return (gchar *) interned;
+
+  return g_strdup (str);
+}
+
+/* Like _wocky_intern_or_dup(), but takes ownership of @str, which is
+ * returned if it isn't interned. */
+gchar *
+_wocky_intern_take (gchar *str)
+{
+  const gchar *interned;
+
+  if (_wocky_is_interned (str))
+    return str;
+
+  interned = intern (str, TRUE);
+
+  if (interned == NULL)
+    return str;
+
+  g_free (str);
+  return (gchar *) interned;
+}
+
+/* @str may be %NULL */
+void
+_wocky_intern_release (gchar *str)
+{
+  if (!_wocky_is_interned (str))
+    g_free (str);
+}
+
+/* For names which are known to the code rather than read from the network,
+ * and are kept forever: like _wocky_intern_or_dup(), but the copy is made
+ * with g_intern_string(), so the result needn't be released. */
+const gchar *
+_wocky_intern_permanent (const gchar *str)
+{
+  const gchar *interned;
+
+  if (_wocky_is_interned (str))
+    return str;
+
+  interned = intern (str, TRUE);
+
+  if (interned == NULL)
+    interned = g_intern_string (str);
+
+  return interned;
+}
+
+/* Like _wocky_intern_permanent(), for a string which is never freed. */
+const gchar *
+_wocky_intern_static (const gchar *str)
+{
+  const gchar *interned = intern (str, TRUE);
+
+  return (interned != NULL) ? interned : str;
+}
+
+/* Like g_quark_from_string(), but without taking GLib's global lock once
+ * @str has been seen before, if it's interned. */
+GQuark
+_wocky_intern_quark (const gchar *str)
+{
+  gint i;
+  GQuark quark;
+
+  if (str == NULL)
+    return 0;
+
+  i = find_slot (str, TRUE);
+
+  if (i < 0)
+    return g_quark_from_string (str);
+
+  quark = (GQuark) g_atomic_int_get ((gint *) &quarks[i]);
+
+  if (quark == 0)
+    {
+      /* threads racing to get here all set the same quark */
+      quark = g_quark_from_string (slots[i]);
+      g_atomic_int_set ((gint *) &quarks[i], (gint) quark);
+    }
+
+  return quark;
+}
+
+/* Likewise for g_quark_try_string() */
+GQuark
+_wocky_intern_try_quark (const gchar *str)
+{
+  gint i;
+  GQuark quark = 0;
+
+  if (str == NULL)
+    return 0;
+
+  i = find_slot (str, FALSE);
+
+  if (i >= 0)
+    quark = (GQuark) g_atomic_int_get ((gint *) &quarks[i]);
+
+  if (quark == 0)
+    quark = g_quark_try_string (str);
+
+  return quark;
+}
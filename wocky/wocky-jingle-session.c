@@ -2621,7 +2621,7 @@ wocky_jingle_session_acknowledge_iq (WockyJingleSession *self,
             {
               WockyNode *reply_node = wocky_stanza_get_top_node (reply);
 
-              reply_node->children = g_slist_append (reply_node->children,
+              _wocky_node_append_child (reply_node,
                   _wocky_node_copy (used_node));
               wocky_porter_send (self->priv->porter, reply);
               g_object_unref (reply);
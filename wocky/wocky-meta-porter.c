@@ -41,6 +41,8 @@ typedef uint16_t u_int16_t;
 #include "wocky-ll-connection-factory.h"
 #include "wocky-contact-factory.h"
 #include "wocky-c2s-porter.h"
+#include "wocky-c2s-porter-internal.h"
+#include "wocky-xmpp-writer.h"
 #include "wocky-utils.h"
 #include "wocky-ll-contact.h"
 #include "wocky-ll-connector.h"
@@ -82,6 +84,9 @@ struct _WockyMetaPorterPrivate
   guint16 port;
 
   guint next_handler_id;
+
+  /* serializes stanzas sent to several contacts, lazily created */
+  WockyXmppWriter *multicast_writer;
 };
 
 typedef struct
@@ -772,6 +777,8 @@ wocky_meta_porter_dispose (GObject *object)
   g_hash_table_unref (priv->porters);
   g_hash_table_unref (priv->handlers);
 
+  g_clear_object (&priv->multicast_writer);
+
   if (G_OBJECT_CLASS (wocky_meta_porter_parent_class)->dispose)
     G_OBJECT_CLASS (wocky_meta_porter_parent_class)->dispose (object);
 }
@@ -1113,6 +1120,190 @@ wocky_meta_porter_send_finish (WockyPorter *self,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+typedef struct
+{
+  GTask *task;
+  WockyStanza *stanza;
+  GBytes *head;
+  GBytes *tail;
+  guint pending;
+  GError *first_error /* owned, NULL until a send fails */;
+} MulticastData;
+
+typedef struct
+{
+  MulticastData *data;
+  gchar *jid;
+} MulticastRecipient;
+
+static void
+multicast_recipient_done (MulticastRecipient *recipient,
+    const GError *error)
+{
+  MulticastData *data = recipient->data;
+
+  if (error != NULL)
+    {
+      DEBUG ("failed to send to %s: %s", recipient->jid, error->message);
+
+      /* report the first error, but carry on with the other recipients */
+      if (data->first_error == NULL)
+        data->first_error = g_error_copy (error);
+    }
+
+  g_free (recipient->jid);
+  g_slice_free (MulticastRecipient, recipient);
+
+  if (--data->pending > 0)
+    return;
+
+  if (data->first_error != NULL)
+    g_task_return_error (data->task, data->first_error);
+  else
+    g_task_return_boolean (data->task, TRUE);
+
+  g_object_unref (data->task);
+  g_object_unref (data->stanza);
+  g_bytes_unref (data->head);
+  g_bytes_unref (data->tail);
+  g_slice_free (MulticastData, data);
+}
+
+static void
+meta_porter_multicast_sent_cb (GObject *source_object,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GError *error = NULL;
+
+  wocky_porter_send_finish (WOCKY_PORTER (source_object), result, &error);
+  multicast_recipient_done (user_data, error);
+  g_clear_error (&error);
+}
+
+static void
+meta_porter_multicast_got_porter_cb (WockyMetaPorter *self,
+    WockyPorter *porter,
+    GCancellable *cancellable,
+    const GError *error,
+    GTask *task,
+    gpointer user_data)
+{
+  MulticastRecipient *recipient = user_data;
+  MulticastData *data = recipient->data;
+
+  if (error != NULL)
+    {
+      multicast_recipient_done (recipient, error);
+      return;
+    }
+
+  _wocky_c2s_porter_send_split_async (WOCKY_C2S_PORTER (porter),
+      data->stanza, data->head, recipient->jid, data->tail, cancellable,
+      meta_porter_multicast_sent_cb, recipient);
+}
+
+static void
+wocky_meta_porter_send_multicast_async (WockyPorter *porter,
+    WockyStanza *stanza,
+    const gchar * const *recipients,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockyMetaPorter *self = WOCKY_META_PORTER (porter);
+  WockyMetaPorterPrivate *priv = self->priv;
+  MulticastData *data;
+  guint i;
+
+  data = g_slice_new0 (MulticastData);
+  data->task = g_task_new (G_OBJECT (self), cancellable, callback, user_data);
+  data->pending = g_strv_length ((gchar **) recipients);
+
+  if (data->pending == 0)
+    {
+      g_task_return_boolean (data->task, TRUE);
+      g_object_unref (data->task);
+      g_slice_free (MulticastData, data);
+      return;
+    }
+
+  /* stamp on from if there is none */
+  if (wocky_stanza_get_from (stanza) == NULL)
+    {
+      wocky_node_set_attribute (wocky_stanza_get_top_node (stanza),
+          "from", priv->jid);
+    }
+
+  if (priv->multicast_writer == NULL)
+    {
+      const guint8 *bytes;
+      gsize length;
+
+      /* The stanzas are going into jabber:client streams, so there's no
+       * need to declare the namespace on each of them */
+      priv->multicast_writer = wocky_xmpp_writer_new ();
+      wocky_xmpp_writer_stream_open (priv->multicast_writer, NULL, NULL,
+          NULL, NULL, NULL, &bytes, &length);
+    }
+
+  data->stanza = g_object_ref (stanza);
+  wocky_xmpp_writer_write_stanza_split (priv->multicast_writer, stanza,
+      &data->head, &data->tail);
+
+  for (i = 0; recipients[i] != NULL; i++)
+    {
+      MulticastRecipient *recipient = g_slice_new0 (MulticastRecipient);
+      WockyLLContact *contact = wocky_contact_factory_lookup_ll_contact (
+          priv->contact_factory, recipients[i]);
+
+      recipient->data = data;
+      recipient->jid = g_strdup (recipients[i]);
+
+      if (contact == NULL)
+        {
+          GError *error = g_error_new (WOCKY_META_PORTER_ERROR,
+              WOCKY_META_PORTER_ERROR_NO_CONTACT_ADDRESS,
+              "No contact %s", recipients[i]);
+
+          multicast_recipient_done (recipient, error);
+          g_error_free (error);
+          continue;
+        }
+
+      open_porter_if_necessary (self, contact, cancellable,
+          meta_porter_multicast_got_porter_cb, data->task, recipient);
+    }
+}
+
+static gboolean
+wocky_meta_porter_send_multicast_finish (WockyPorter *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+wocky_meta_porter_flush (WockyPorter *porter)
+{
+  WockyMetaPorter *self = WOCKY_META_PORTER (porter);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->priv->porters);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      PorterData *data = value;
+
+      if (data->porter != NULL)
+        wocky_porter_flush (data->porter);
+    }
+}
+
 static guint16
 wocky_meta_porter_listen (WockyMetaPorter *self,
     GError **error)
@@ -1856,4 +2047,9 @@ wocky_porter_iface_init (gpointer g_iface,
 
   iface->force_close_async = wocky_meta_porter_force_close_async;
   iface->force_close_finish = wocky_meta_porter_force_close_finish;
+
+  iface->send_multicast_async = wocky_meta_porter_send_multicast_async;
+  iface->send_multicast_finish = wocky_meta_porter_send_multicast_finish;
+
+  iface->flush = wocky_meta_porter_flush;
 }
@@ -42,6 +42,9 @@
 
 #include "wocky-muc.h"
 #include "wocky-namespaces.h"
+#include "wocky-node-query.h"
+#include "wocky-stanza-internal.h"
+#include "wocky-stanza-template.h"
 #include "wocky-utils.h"
 #include "wocky-signals-marshal.h"
 #include "wocky-xmpp-error.h"
@@ -63,6 +66,31 @@ typedef enum {
 
 static guint signals[SIG_NULL] = { 0 };
 
+/* Compiled in class_init, for picking presences and messages apart */
+static struct {
+  /* from the top node */
+  WockyNodeQuery *muc_user;
+  WockyNodeQuery *status;
+  WockyNodeQuery *body;
+  WockyNodeQuery *subject;
+  WockyNodeQuery *id;
+  WockyNodeQuery *from;
+  /* from <x xmlns='...#user'/> */
+  WockyNodeQuery *item;
+  WockyNodeQuery *status_code;
+  /* from its <item/> */
+  WockyNodeQuery *jid;
+  WockyNodeQuery *nick;
+  WockyNodeQuery *role;
+  WockyNodeQuery *affiliation;
+  WockyNodeQuery *actor_jid;
+  WockyNodeQuery *reason;
+} queries;
+
+/* Also compiled in class_init; its slots are type, from and to, in that
+ * order, as wocky_stanza_build() would set them */
+static WockyStanzaTemplate *presence_template;
+
 typedef struct { const gchar *ns; WockyMucFeature flag; } feature;
 static const feature feature_map[] =
   { { WOCKY_NS_MUC,               WOCKY_MUC_MODERN            },
@@ -261,6 +289,28 @@ wocky_muc_class_init (WockyMucClass *klass)
   oclass->dispose      = wocky_muc_dispose;
   oclass->finalize     = wocky_muc_finalize;
 
+  queries.muc_user = wocky_node_query_new ("{" WOCKY_NS_MUC_USER "}x", NULL);
+  queries.status = wocky_node_query_new ("status", NULL);
+  queries.body = wocky_node_query_new ("body", NULL);
+  queries.subject = wocky_node_query_new ("subject", NULL);
+  queries.id = wocky_node_query_new ("@id", NULL);
+  queries.from = wocky_node_query_new ("@from", NULL);
+  queries.item = wocky_node_query_new ("item", NULL);
+  queries.status_code = wocky_node_query_new ("status/@code", NULL);
+  queries.jid = wocky_node_query_new ("@jid", NULL);
+  queries.nick = wocky_node_query_new ("@nick", NULL);
+  queries.role = wocky_node_query_new ("@role", NULL);
+  queries.affiliation = wocky_node_query_new ("@affiliation", NULL);
+  queries.actor_jid = wocky_node_query_new ("actor/@jid", NULL);
+  queries.reason = wocky_node_query_new ("reason", NULL);
+
+  presence_template = wocky_stanza_template_new (WOCKY_STANZA_TYPE_PRESENCE,
+      WOCKY_STANZA_SUB_TYPE_NONE, NULL, NULL,
+      '?', "type", "type",
+      '?', "from", "from",
+      '?', "to", "to",
+      NULL);
+
   spec = g_param_spec_string ("jid", "jid",
       "Full room@service/nick JID of the MUC room",
       NULL,
@@ -906,15 +956,12 @@ wocky_muc_create_presence (WockyMuc *muc,
     const gchar *status)
 {
   WockyMucPrivate *priv = muc->priv;
+  const gchar *values[] = { _wocky_stanza_get_sub_type_name (type),
+      priv->user, priv->jid };
   WockyStanza *stanza =
-    wocky_stanza_build (WOCKY_STANZA_TYPE_PRESENCE,
-        type,
-        priv->user,
-        priv->jid,
-        NULL);
+    wocky_stanza_template_instantiate_values (presence_template, values);
   WockyNode *presence = wocky_stanza_get_top_node (stanza);
 
-
   /* There should be separate API to leave a room, but atm there isn't... so
    * only allow the status to be set directly when making a presence to leave
    * the muc */
@@ -966,20 +1013,16 @@ static guint
 extract_status_codes (WockyNode *x)
 {
   guint codes = 0;
-  WockyNodeIter iter;
+  WockyNodeQueryIter iter;
   WockyNode *node;
 
-  wocky_node_iter_init (&iter, x, "status", NULL);
-  while (wocky_node_iter_next (&iter, &node))
+  wocky_node_query_iter_init (&iter, queries.status_code, x);
+  while (wocky_node_query_iter_next (&iter, &node))
     {
       const gchar *code;
       WockyMucStatusCode cnum;
 
-      code = wocky_node_get_attribute (node, "code");
-
-      if (code == NULL)
-        continue;
-
+      code = wocky_node_query_get_value (queries.status_code, node);
       cnum = status_code_to_muc_flag (g_ascii_strtoull (code, NULL, 10));
       codes |= cnum;
 
@@ -1163,8 +1206,7 @@ handle_presence_standard (WockyMuc *muc,
     const gchar *resource)
 {
   WockyNode *node = wocky_stanza_get_top_node (stanza);
-  WockyNode *x = wocky_node_get_child_ns (node,
-      "x", WOCKY_NS_MUC_USER);
+  WockyNode *x = wocky_node_query_get_node (queries.muc_user, node);
   WockyNode *item = NULL;
   const gchar *from = wocky_stanza_get_from (stanza);
   const gchar *pjid = NULL;
@@ -1180,33 +1222,24 @@ handle_presence_standard (WockyMuc *muc,
   gboolean self_presence = FALSE;
   const gchar *msg = NULL;
 
-  msg = wocky_node_get_content_from_child (node, "status");
+  msg = wocky_node_query_get_string (queries.status, node);
 
   if (x == NULL)
     return FALSE;
 
-  item = wocky_node_get_child (x, "item");
+  item = wocky_node_query_get_node (queries.item, x);
 
   if (item != NULL)
     {
-      WockyNode *actor = NULL;
-      WockyNode *cause = NULL;
-
-      pjid = wocky_node_get_attribute (item, "jid");
-      pnic = wocky_node_get_attribute (item, "nick");
-      role = wocky_node_get_attribute (item, "role");
-      aff = wocky_node_get_attribute (item, "affiliation");
-      actor = wocky_node_get_child (item, "actor");
-      cause = wocky_node_get_child (item, "reason");
+      pjid = wocky_node_query_get_value (queries.jid, item);
+      pnic = wocky_node_query_get_value (queries.nick, item);
+      role = wocky_node_query_get_value (queries.role, item);
+      aff = wocky_node_query_get_value (queries.affiliation, item);
+      ajid = wocky_node_query_get_string (queries.actor_jid, item);
+      why = wocky_node_query_get_string (queries.reason, item);
 
       r = string_to_role (role);
       a = string_to_aff (aff);
-
-      if (actor != NULL)
-        ajid = wocky_node_get_attribute (actor, "jid");
-
-      if (cause != NULL)
-        why = cause->content;
     }
 
   /* if this was not in the item, set it from the envelope: */
@@ -1491,10 +1524,10 @@ handle_message (WockyPorter *porter,
 {
   WockyMuc *muc = WOCKY_MUC (data);
   WockyNode *msg = wocky_stanza_get_top_node (stanza);
-  const gchar *id = wocky_node_get_attribute (msg, "id");
-  const gchar *from = wocky_node_get_attribute (msg, "from");
-  const gchar *body = wocky_node_get_content_from_child (msg, "body");
-  const gchar *subj = wocky_node_get_content_from_child (msg, "subject");
+  const gchar *id = wocky_node_query_get_value (queries.id, msg);
+  const gchar *from = wocky_node_query_get_value (queries.from, msg);
+  const gchar *body = wocky_node_query_get_string (queries.body, msg);
+  const gchar *subj = wocky_node_query_get_string (queries.subject, msg);
   GDateTime *datetime = extract_timestamp (msg);
   WockyStanzaSubType sub_type;
   WockyMucMsgType mtype;
@@ -26,6 +26,12 @@
 #define WOCKY_XMPP_NS_SASL_AUTH \
   "urn:ietf:params:xml:ns:xmpp-sasl"
 
+#define WOCKY_XMPP_NS_SASL2 \
+  "urn:xmpp:sasl:2"
+
+#define WOCKY_XMPP_NS_FAST \
+  "urn:xmpp:fast:0"
+
 #define WOCKY_NS_DISCO_INFO \
   "http://jabber.org/protocol/disco#info"
 
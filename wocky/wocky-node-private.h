@@ -30,6 +30,18 @@
 G_BEGIN_DECLS
 
 WockyNode *_wocky_node_copy (WockyNode *node);
+WockyNode *_wocky_node_copy_deep (WockyNode *node);
+void _wocky_node_append_child (WockyNode *node, WockyNode *child);
+
+WockyNode **_wocky_node_get_children (WockyNode *node, guint *n_children);
+const gchar *_wocky_node_get_attribute_interned (WockyNode *node,
+    const gchar *key);
+void _wocky_node_remove_last_child (WockyNode *node);
+
+void _wocky_node_attribute_ns_add_prefix (GQuark ns, const gchar *prefix);
+
+GBytes *_wocky_node_encode (WockyNode *node);
+WockyNode *_wocky_node_decode (const guint8 *data, gsize len);
 
 G_END_DECLS
 
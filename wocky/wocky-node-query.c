@@ -0,0 +1,602 @@
+/*
+ * wocky-node-query.c - Source for WockyNodeQuery
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION: wocky-node-query
+ * @title: WockyNodeQuery
+ * @short_description: Compiled paths through node trees
+ * @include: wocky/wocky-node-query.h
+ *
+ * A #WockyNodeQuery finds the descendants of a node along a path, which is
+ * compiled once by wocky_node_query_new() and can then be run over any
+ * number of trees without allocating anything. Names, namespaces and
+ * attribute keys are looked up when the query is compiled, so running it
+ * only compares pointers and integers, except to check attribute values.
+ *
+ * A path is a list of steps separated by <literal>/</literal>, each of
+ * which matches children of what the previous step matched (or of the node
+ * the query is run on, for the first step). A step is an element name, or
+ * <literal>*</literal> for any name, optionally preceded by a namespace in
+ * braces and followed by any number of attribute predicates:
+ * <literal>[@key]</literal> matches elements with a <literal>key</literal>
+ * attribute, and <literal>[@key='value']</literal> those where it has
+ * that value. A step without a namespace matches elements in any
+ * namespace. The path may end with <literal>/@key</literal>, in which case
+ * it only matches elements with that attribute, and
+ * wocky_node_query_get_string() returns its value rather than the
+ * element's content. A path which is just <literal>@key</literal> matches
+ * the node the query is run on, if it has that attribute; with
+ * wocky_node_query_get_value(), it is a quicker
+ * wocky_node_get_attribute().
+ *
+ * <example><programlisting>
+ * query = wocky_node_query_new (
+ *     "{" WOCKY_NS_MUC_USER "}x/status[@code='110']", NULL);
+ * </programlisting></example>
+ *
+ * Queries are immutable once compiled, so may be shared between threads.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-node-query.h"
+
+#include <string.h>
+
+#include "wocky-intern-internal.h"
+#include "wocky-node-private.h"
+
+typedef struct {
+  /* interned */
+  const gchar *key;
+  /* owned, or NULL to match any value */
+  gchar *value;
+} Predicate;
+
+typedef struct {
+  /* interned, or NULL to match any name */
+  const gchar *name;
+  /* or 0 to match any namespace */
+  GQuark ns;
+  guint n_predicates;
+  Predicate *predicates;
+} Step;
+
+struct _WockyNodeQuery {
+  gint ref_count;
+  gchar *path;
+  /* interned, or NULL to select the matching elements' content */
+  const gchar *attribute;
+  guint n_steps;
+  Step steps[WOCKY_NODE_QUERY_MAX_STEPS];
+};
+
+G_DEFINE_BOXED_TYPE (WockyNodeQuery, wocky_node_query,
+    wocky_node_query_ref, wocky_node_query_unref)
+
+GQuark
+wocky_node_query_error_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (quark == 0)
+    quark = g_quark_from_static_string ("wocky-node-query-error");
+
+  return quark;
+}
+
+/* Whatever can't appear in a name, namespace, key or value */
+#define SPECIAL "/[]{}@='\""
+
+typedef struct {
+  const gchar *path;
+  const gchar *p;
+  GError **error;
+} Parser;
+
+static gboolean
+parse_error (Parser *parser,
+    const gchar *what)
+{
+  g_set_error (parser->error, WOCKY_NODE_QUERY_ERROR,
+      WOCKY_NODE_QUERY_ERROR_INVALID_PATH, "%s at offset %u of '%s'",
+      what, (guint) (parser->p - parser->path), parser->path);
+  return FALSE;
+}
+
+/* Returns the length of the token at the parser's position, which stops at
+ * @stop or, if @stop is '\0', at anything special. */
+static gsize
+parse_token (Parser *parser,
+    gchar stop)
+{
+  const gchar *end;
+
+  if (stop != '\0')
+    end = strchr (parser->p, stop);
+  else
+    end = parser->p + strcspn (parser->p, SPECIAL);
+
+  return (end != NULL) ? (gsize) (end - parser->p) : strlen (parser->p);
+}
+
+static const gchar *
+parse_interned (Parser *parser,
+    const gchar *what)
+{
+  gsize len = parse_token (parser, '\0');
+  gchar *token;
+  const gchar *interned;
+
+  if (len == 0)
+    {
+      parse_error (parser, what);
+      return NULL;
+    }
+
+  token = g_strndup (parser->p, len);
+  interned = _wocky_intern_permanent (token);
+  g_free (token);
+  parser->p += len;
+
+  return interned;
+}
+
+static gboolean
+parse_predicate (Parser *parser,
+    GArray *predicates)
+{
+  Predicate predicate = { NULL, NULL };
+
+  /* we're just past the '[' */
+  if (*parser->p != '@')
+    return parse_error (parser, "expected '@'");
+
+  parser->p++;
+  predicate.key = parse_interned (parser, "expected an attribute name");
+
+  if (predicate.key == NULL)
+    return FALSE;
+
+  if (*parser->p == '=')
+    {
+      gchar quote;
+      gsize len;
+
+      parser->p++;
+      quote = *parser->p;
+
+      if (quote != '\'' && quote != '"')
+        return parse_error (parser, "expected a quoted value");
+
+      parser->p++;
+      len = parse_token (parser, quote);
+
+      if (parser->p[len] != quote)
+        return parse_error (parser, "unterminated value");
+
+      predicate.value = g_strndup (parser->p, len);
+      parser->p += len + 1;
+    }
+
+  if (*parser->p != ']')
+    {
+      g_free (predicate.value);
+      return parse_error (parser, "expected ']'");
+    }
+
+  parser->p++;
+  g_array_append_val (predicates, predicate);
+  return TRUE;
+}
+
+static gboolean
+parse_step (Parser *parser,
+    Step *step)
+{
+  GArray *predicates;
+  gboolean ok = TRUE;
+
+  if (*parser->p == '{')
+    {
+      gsize len;
+      gchar *ns;
+
+      parser->p++;
+      len = parse_token (parser, '}');
+
+      if (parser->p[len] != '}')
+        return parse_error (parser, "unterminated namespace");
+
+      if (len == 0)
+        return parse_error (parser, "empty namespace");
+
+      ns = g_strndup (parser->p, len);
+      step->ns = g_quark_from_string (ns);
+      g_free (ns);
+      parser->p += len + 1;
+    }
+
+  if (*parser->p == '*')
+    {
+      parser->p++;
+    }
+  else
+    {
+      step->name = parse_interned (parser, "expected an element name");
+
+      if (step->name == NULL)
+        return FALSE;
+    }
+
+  predicates = g_array_new (FALSE, FALSE, sizeof (Predicate));
+
+  while (ok && *parser->p == '[')
+    {
+      parser->p++;
+      ok = parse_predicate (parser, predicates);
+    }
+
+  /* the predicates are freed with the query even if there was an error */
+  step->n_predicates = predicates->len;
+  step->predicates = (Predicate *) g_array_free (predicates, FALSE);
+
+  return ok;
+}
+
+/* Adds a check for @key to @step, so the step only matches elements which
+ * have the attribute the query selects. */
+static void
+step_require_attribute (Step *step,
+    const gchar *key)
+{
+  step->predicates = g_renew (Predicate, step->predicates,
+      step->n_predicates + 1);
+  step->predicates[step->n_predicates].key = key;
+  step->predicates[step->n_predicates].value = NULL;
+  step->n_predicates++;
+}
+
+static gboolean
+parse_path (WockyNodeQuery *query,
+    Parser *parser)
+{
+  while (TRUE)
+    {
+      if (*parser->p == '@')
+        {
+          parser->p++;
+          query->attribute = parse_interned (parser,
+              "expected an attribute name");
+
+          if (query->attribute == NULL)
+            return FALSE;
+
+          if (query->n_steps > 0)
+            step_require_attribute (query->steps + query->n_steps - 1,
+                query->attribute);
+
+          break;
+        }
+
+      if (query->n_steps == WOCKY_NODE_QUERY_MAX_STEPS)
+        return parse_error (parser, "too many steps");
+
+      if (!parse_step (parser, query->steps + query->n_steps++))
+        return FALSE;
+
+      if (*parser->p != '/')
+        break;
+
+      parser->p++;
+    }
+
+  if (*parser->p != '\0')
+    return parse_error (parser, "unexpected character");
+
+  return TRUE;
+}
+
+/**
+ * wocky_node_query_new:
+ * @path: a path, as described above
+ * @error: a location to store a #WockyNodeQueryError if @path isn't valid,
+ *  or %NULL
+ *
+ * Compiles a query.
+ *
+ * Returns: (transfer full): a new query, or %NULL if @path isn't valid
+ */
+WockyNodeQuery *
+wocky_node_query_new (const gchar *path,
+    GError **error)
+{
+  WockyNodeQuery *query;
+  Parser parser = { path, path, error };
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  query = g_slice_new0 (WockyNodeQuery);
+  query->ref_count = 1;
+  query->path = g_strdup (path);
+
+  if (!parse_path (query, &parser))
+    {
+      wocky_node_query_unref (query);
+      return NULL;
+    }
+
+  return query;
+}
+
+WockyNodeQuery *
+wocky_node_query_ref (WockyNodeQuery *query)
+{
+  g_return_val_if_fail (query != NULL, NULL);
+
+  g_atomic_int_inc (&query->ref_count);
+  return query;
+}
+
+void
+wocky_node_query_unref (WockyNodeQuery *query)
+{
+  guint i, j;
+
+  g_return_if_fail (query != NULL);
+
+  if (!g_atomic_int_dec_and_test (&query->ref_count))
+    return;
+
+  for (i = 0; i < query->n_steps; i++)
+    {
+      Step *step = query->steps + i;
+
+      for (j = 0; j < step->n_predicates; j++)
+        g_free (step->predicates[j].value);
+
+      g_free (step->predicates);
+    }
+
+  g_free (query->path);
+  g_slice_free (WockyNodeQuery, query);
+}
+
+/**
+ * wocky_node_query_get_path:
+ * @query: a query
+ *
+ * Returns: the path @query was compiled from
+ */
+const gchar *
+wocky_node_query_get_path (WockyNodeQuery *query)
+{
+  g_return_val_if_fail (query != NULL, NULL);
+
+  return query->path;
+}
+
+static inline gboolean
+step_matches (const Step *step,
+    WockyNode *node)
+{
+  guint i;
+
+  /* element names are usually interned too */
+  if (step->name != NULL && !_wocky_intern_equal (step->name, node->name))
+    return FALSE;
+
+  if (step->ns != 0 && step->ns != node->ns)
+    return FALSE;
+
+  for (i = 0; i < step->n_predicates; i++)
+    {
+      const Predicate *predicate = step->predicates + i;
+      const gchar *value = _wocky_node_get_attribute_interned (node,
+          predicate->key);
+
+      if (value == NULL)
+        return FALSE;
+
+      if (predicate->value != NULL && strcmp (value, predicate->value))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * wocky_node_query_iter_init:
+ * @iter: an uninitialized #WockyNodeQueryIter
+ * @query: a query
+ * @node: the node to run @query on
+ *
+ * Initializes an iterator over the descendants of @node which @query
+ * matches, in document order. @query must stay alive, and the tree below
+ * @node mustn't be changed, while the iterator is used.
+ *
+ * <example><programlisting>
+ * WockyNodeQueryIter iter;
+ * WockyNode *status;
+ *
+ * wocky_node_query_iter_init (&iter, status_query, presence);
+ * while (wocky_node_query_iter_next (&iter, &status))
+ *   do_something_with (wocky_node_query_get_value (status_query, status));
+ * </programlisting></example>
+ */
+void
+wocky_node_query_iter_init (WockyNodeQueryIter *iter,
+    WockyNodeQuery *query,
+    WockyNode *node)
+{
+  g_return_if_fail (iter != NULL);
+  g_return_if_fail (query != NULL);
+  g_return_if_fail (node != NULL);
+
+  iter->query = query;
+  iter->depth = 0;
+  iter->parents[0] = node;
+  iter->next[0] = 0;
+}
+
+/**
+ * wocky_node_query_iter_next:
+ * @iter: an initialized #WockyNodeQueryIter
+ * @next: a location to store the next matching node, or %NULL
+ *
+ * Advances @iter to the next node its query matches.
+ *
+ * Returns: %FALSE if there are no more matching nodes, or %TRUE otherwise
+ */
+gboolean
+wocky_node_query_iter_next (WockyNodeQueryIter *iter,
+    WockyNode **next)
+{
+  WockyNodeQuery *query;
+
+  g_return_val_if_fail (iter != NULL, FALSE);
+
+  query = iter->query;
+
+  /* just "@key", which can only match the node itself */
+  if (query->n_steps == 0)
+    {
+      if (iter->next[0]++ > 0 ||
+          _wocky_node_get_attribute_interned (iter->parents[0],
+              query->attribute) == NULL)
+        return FALSE;
+
+      if (next != NULL)
+        *next = iter->parents[0];
+
+      return TRUE;
+    }
+
+  /* A depth-first walk, keeping the parent and the position among its
+   * children at each step. */
+  while (TRUE)
+    {
+      const Step *step = query->steps + iter->depth;
+      WockyNode *found = NULL;
+      WockyNode **children;
+      guint n;
+
+      children = _wocky_node_get_children (iter->parents[iter->depth], &n);
+
+      while (iter->next[iter->depth] < n)
+        {
+          WockyNode *child = children[iter->next[iter->depth]++];
+
+          if (step_matches (step, child))
+            {
+              found = child;
+              break;
+            }
+        }
+
+      if (found == NULL)
+        {
+          if (iter->depth == 0)
+            return FALSE;
+
+          iter->depth--;
+          continue;
+        }
+
+      if (iter->depth + 1 == query->n_steps)
+        {
+          if (next != NULL)
+            *next = found;
+
+          return TRUE;
+        }
+
+      iter->depth++;
+      iter->parents[iter->depth] = found;
+      iter->next[iter->depth] = 0;
+    }
+}
+
+/**
+ * wocky_node_query_get_node:
+ * @query: a query
+ * @node: the node to run @query on
+ *
+ * Returns: (transfer none): the first descendant of @node which @query
+ *  matches, or %NULL
+ */
+WockyNode *
+wocky_node_query_get_node (WockyNodeQuery *query,
+    WockyNode *node)
+{
+  WockyNodeQueryIter iter;
+  WockyNode *result;
+
+  wocky_node_query_iter_init (&iter, query, node);
+
+  if (wocky_node_query_iter_next (&iter, &result))
+    return result;
+
+  return NULL;
+}
+
+/**
+ * wocky_node_query_get_value:
+ * @query: a query
+ * @match: a node which @query matched, or %NULL
+ *
+ * Returns: the value of the attribute @query selects on @match, or
+ *  @match's content if it doesn't select an attribute; or %NULL if @match
+ *  is %NULL
+ */
+const gchar *
+wocky_node_query_get_value (WockyNodeQuery *query,
+    WockyNode *match)
+{
+  g_return_val_if_fail (query != NULL, NULL);
+
+  if (match == NULL)
+    return NULL;
+
+  if (query->attribute != NULL)
+    return _wocky_node_get_attribute_interned (match, query->attribute);
+
+  return match->content;
+}
+
+/**
+ * wocky_node_query_get_string:
+ * @query: a query
+ * @node: the node to run @query on
+ *
+ * Equivalent to calling wocky_node_query_get_value() on the result of
+ * wocky_node_query_get_node().
+ *
+ * Returns: the value of the attribute @query selects on the first node it
+ *  matches, or that node's content if it doesn't select an attribute; or
+ *  %NULL if it doesn't match anything
+ */
+const gchar *
+wocky_node_query_get_string (WockyNodeQuery *query,
+    WockyNode *node)
+{
+  return wocky_node_query_get_value (query,
+      wocky_node_query_get_node (query, node));
+}
@@ -0,0 +1,99 @@
+/*
+ * wocky-node-query.h - Header for WockyNodeQuery
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef __WOCKY_NODE_QUERY_H__
+#define __WOCKY_NODE_QUERY_H__
+
+#include <glib-object.h>
+
+#include "wocky-node.h"
+
+G_BEGIN_DECLS
+
+/**
+ * WockyNodeQueryError:
+ * @WOCKY_NODE_QUERY_ERROR_INVALID_PATH: the path isn't valid
+ *
+ * Errors compiling a #WockyNodeQuery.
+ */
+typedef enum {
+  WOCKY_NODE_QUERY_ERROR_INVALID_PATH,
+} WockyNodeQueryError;
+
+GQuark wocky_node_query_error_quark (void);
+
+#define WOCKY_NODE_QUERY_ERROR (wocky_node_query_error_quark ())
+
+/**
+ * WOCKY_NODE_QUERY_MAX_STEPS:
+ *
+ * The most elements a #WockyNodeQuery's path may have.
+ */
+#define WOCKY_NODE_QUERY_MAX_STEPS 8
+
+/**
+ * WockyNodeQuery:
+ *
+ * A compiled path through a tree of #WockyNode<!-- -->s. Queries are
+ * immutable once compiled, so may be shared freely.
+ */
+typedef struct _WockyNodeQuery WockyNodeQuery;
+
+#define WOCKY_TYPE_NODE_QUERY (wocky_node_query_get_type ())
+GType wocky_node_query_get_type (void);
+
+WockyNodeQuery *wocky_node_query_new (const gchar *path,
+    GError **error) G_GNUC_WARN_UNUSED_RESULT;
+WockyNodeQuery *wocky_node_query_ref (WockyNodeQuery *query);
+void wocky_node_query_unref (WockyNodeQuery *query);
+
+const gchar *wocky_node_query_get_path (WockyNodeQuery *query);
+
+WockyNode *wocky_node_query_get_node (WockyNodeQuery *query,
+    WockyNode *node);
+const gchar *wocky_node_query_get_string (WockyNodeQuery *query,
+    WockyNode *node);
+const gchar *wocky_node_query_get_value (WockyNodeQuery *query,
+    WockyNode *match);
+
+/**
+ * WockyNodeQueryIter:
+ *
+ * Iterates over the nodes a #WockyNodeQuery matches. See
+ * wocky_node_query_iter_init() for more details.
+ */
+typedef struct {
+  /*< private >*/
+  WockyNodeQuery *query;
+  guint depth;
+  WockyNode *parents[WOCKY_NODE_QUERY_MAX_STEPS];
+  guint next[WOCKY_NODE_QUERY_MAX_STEPS];
+} WockyNodeQueryIter;
+
+void wocky_node_query_iter_init (WockyNodeQueryIter *iter,
+    WockyNodeQuery *query,
+    WockyNode *node);
+gboolean wocky_node_query_iter_next (WockyNodeQueryIter *iter,
+    WockyNode **next);
+
+G_END_DECLS
+
+#endif /* #ifndef __WOCKY_NODE_QUERY_H__ */
@@ -210,3 +210,51 @@ wocky_node_tree_get_top_node (WockyNodeTree *self)
 {
   return self->priv->node;
 }
+
+/**
+ * wocky_node_tree_to_bytes:
+ * @self: a node tree
+ *
+ * Encodes @self in a compact, versioned binary format, which
+ * wocky_node_tree_new_from_bytes() can turn back into a tree much more
+ * cheaply than XML can be parsed. It is meant for storing trees, such as in
+ * #WockyCapsCache, not for exchanging them with anything other than Wocky.
+ *
+ * Returns: (transfer full): the encoded tree
+ */
+GBytes *
+wocky_node_tree_to_bytes (WockyNodeTree *self)
+{
+  g_return_val_if_fail (WOCKY_IS_NODE_TREE (self), NULL);
+
+  return _wocky_node_encode (self->priv->node);
+}
+
+/**
+ * wocky_node_tree_new_from_bytes:
+ * @bytes: a tree encoded by wocky_node_tree_to_bytes()
+ *
+ * Decodes a tree encoded by wocky_node_tree_to_bytes(). The structure of
+ * @bytes is checked, but, as it is expected to have been produced from a
+ * valid tree, the text in it is not validated as UTF-8 again.
+ *
+ * Returns: a new node tree, or %NULL if @bytes is malformed or in a version
+ *  of the format this version of Wocky does not understand
+ */
+WockyNodeTree *
+wocky_node_tree_new_from_bytes (GBytes *bytes)
+{
+  WockyNode *top;
+  gsize len;
+  const guint8 *data;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  data = g_bytes_get_data (bytes, &len);
+  top = _wocky_node_decode (data, len);
+
+  if (top == NULL)
+    return NULL;
+
+  return g_object_new (WOCKY_TYPE_NODE_TREE, "top-node", top, NULL);
+}
@@ -84,6 +84,10 @@ WockyNodeTree *wocky_node_tree_new_from_node (WockyNode *node);
 
 WockyNode *wocky_node_tree_get_top_node (WockyNodeTree *self);
 
+GBytes *wocky_node_tree_to_bytes (WockyNodeTree *self);
+
+WockyNodeTree *wocky_node_tree_new_from_bytes (GBytes *bytes);
+
 G_END_DECLS
 
 #endif /* #ifndef __WOCKY_NODE_TREE_H__*/
@@ -29,6 +29,8 @@
 #include "wocky-node-private.h"
 #include "wocky-node-tree.h"
 #include "wocky-utils.h"
+#include "wocky-utf8-internal.h"
+#include "wocky-intern-internal.h"
 #include "wocky-namespaces.h"
 
 /**
@@ -42,6 +44,9 @@
  * It also offers methods to lookup children of a node.
  */
 
+/* Attributes are kept in an array on their node. Keys and prefixes are
+ * usually interned (see intern_validated()), so usually only the value is
+ * allocated for each attribute. */
 typedef struct {
   gchar *key;
   gchar *value;
@@ -49,62 +54,71 @@ typedef struct {
   GQuark ns;
 } Attribute;
 
+/* Children are kept in an array on their node too, which doubles as it
+ * fills up. Nodes with many children (rosters, disco#items replies, pubsub
+ * items...) also get an index from (name, namespace) to the first such
+ * child, built the first time one is looked up by name. Adding a child keeps
+ * the index up to date; removing one drops it, to be rebuilt if needed. */
+#define CHILD_INDEX_THRESHOLD 32
+
+typedef struct {
+  guint len;
+  guint alloc;
+  GHashTable *index;
+  WockyNode *nodes[1];
+} Children;
+
+/* A node can be sealed, after which neither it nor anything below it can
+ * be changed. Sealed nodes are refcounted and are shared rather than copied
+ * by _wocky_node_copy(), so copying a sealed stanza to forward it or reply
+ * to it only copies its top node; wocky_node_make_child_writable() unshares
+ * a child, so a copy only diverges from the original along the path to
+ * whatever is changed. Unsealed nodes always have exactly one owner. */
+
+/* The index has an entry for each child name in any namespace (with ns 0,
+ * which no node has) as well as in each namespace it's used in. Names
+ * belong to the children. */
 typedef struct {
-  const gchar *key;
+  const gchar *name;
   GQuark ns;
-} Tuple;
+} ChildKey;
 
 typedef struct {
   const gchar *ns_urn;
-  gchar *prefix;
-  GQuark ns;
+  const gchar *prefix;
 } NSPrefix;
 
 static NSPrefix default_attr_ns_prefixes[] =
   { { WOCKY_GOOGLE_NS_AUTH, "ga" },
     { NULL, NULL } };
 
-static GHashTable *user_ns_prefixes = NULL;
-static GHashTable *default_ns_prefixes = NULL;
-
-/* Do a strndup operation, but at the same time replace all characters that
- * aren't valid according to g_utf8_validate by � */
-
-static gchar *
-strndup_make_valid (const gchar *str, gssize len)
-{
-  const gchar *remainder = str;
-  GString *result;
-  const gchar *endp;
-  gssize left = len;
-
-  /* Simplify things by always keeping track of the string lenght */
-  if (left < 0)
-    left = strlen (remainder);
+/* Readers and writers on any thread look prefixes up, and only rarely add
+ * or change one, so lookups take no lock at all. The table is an array of
+ * (namespace, prefix) slots with linear probing: a namespace keeps its slot
+ * once it has one, and its prefix is replaced atomically. Prefixes are
+ * interned, so a prefix returned from the table stays valid even if another
+ * thread replaces it straight afterwards.
+ *
+ * Changes are serialized by prefixes_lock. When the table is half full, a
+ * copy twice the size is published in its place; the old one is kept until
+ * wocky_node_deinit(), as readers may still be looking at it. */
+typedef struct {
+  GQuark ns;
+  const gchar *prefix;
+} PrefixSlot;
 
-  result = g_string_sized_new (len);
+typedef struct {
+  /* a power of two */
+  guint size;
+  guint used;
+  PrefixSlot slots[1];
+} PrefixTable;
 
-  while (!g_utf8_validate (remainder, left, &endp))
-    {
-      g_string_append_len (result, remainder, endp - remainder);
-      /* append U+FFFD REPLACEMENT CHARACTER */
-      g_string_append (result, "\357\277\275");
-
-      /* left, minus the valid part of the string */
-      left -= (endp - remainder);
-
-      remainder = g_utf8_find_next_char (endp, endp + left);
-      /* left, minus the skipped part, if there is no next utf8 character,
-       * nothing is left */
-      if (remainder == NULL)
-        left = 0;
-      else if (left > 0)
-        left -= (remainder - endp);
-    }
-  g_string_append_len (result, remainder, left);
+#define PREFIX_TABLE_INITIAL_SIZE 64
 
-  return g_string_free (result, FALSE);
-}
+static GMutex prefixes_lock;
+static PrefixTable *prefixes = NULL;
+static GSList *retired_prefixes = NULL;
 
 static gchar *
 strndup_validated (const gchar *str, gssize len)
@@ -113,7 +127,7 @@ strndup_validated (const gchar *str, gssize len)
     return NULL;
 
   /* Fast path, string happily validates, simple copy */
-  if (G_LIKELY (g_utf8_validate (str, len, NULL)))
+  if (G_LIKELY (_wocky_utf8_validate (str, len, NULL)))
     {
       if (len < 0)
         return g_strdup (str);
@@ -121,8 +135,23 @@ strndup_validated (const gchar *str, gssize len)
         return g_strndup (str, len);
     }
 
-  /* slow path, string doesn't validate.. */
-  return strndup_make_valid (str, len);
+  /* slow path, string doesn't validate, so replace what isn't valid by
+   * U+FFFD REPLACEMENT CHARACTER */
+  return _wocky_utf8_make_valid (str, len);
+}
+
+/* Element names and attribute keys are interned where possible: there are
+ * only so many of them, and a big stanza repeats the same few over and over.
+ * They come from the network, though, so they go in wocky's own bounded
+ * table rather than GLib's, and anything that doesn't fit is copied instead.
+ * Either way, the result must be given back with _wocky_intern_release(). */
+static gchar *
+intern_validated (const gchar *str)
+{
+  if (G_LIKELY (_wocky_utf8_validate (str, -1, NULL)))
+    return _wocky_intern_or_dup (str);
+
+  return _wocky_intern_take (_wocky_utf8_make_valid (str, -1));
 }
 
 static gchar *
@@ -141,12 +170,12 @@ concat_validated (const gchar *s1, const gchar *s2, gssize s2_size)
   if (s2_size < 0)
     s2_size = strlen (s2);
 
-  if (G_UNLIKELY (!g_utf8_validate (s2, s2_size, NULL)))
+  if (G_UNLIKELY (!_wocky_utf8_validate (s2, s2_size, NULL)))
     {
       /* Make a validated copy we will free later on. Making a copy to just
        * concat and then free isn't the most efficient way, but at this point
        * we're out of the fast-path anyway */
-      to_free = s2 = strndup_make_valid (s2, s2_size);
+      to_free = s2 = _wocky_utf8_make_valid (s2, s2_size);
       s2_size = strlen (s2);
     }
 
@@ -158,21 +187,28 @@ concat_validated (const gchar *s1, const gchar *s2, gssize s2_size)
   return result;
 }
 
+/* Takes ownership of @name, which must come from intern_validated() or
+ * _wocky_intern_or_dup(). */
+static WockyNode *
+new_node_take_name (gchar *name,
+    GQuark ns)
+{
+  WockyNode *result = g_slice_new0 (WockyNode);
+
+  result->name = name;
+  result->ns = ns;
+  result->ref_count = 1;
+
+  return result;
+}
 
 static WockyNode *
 new_node (const char *name, GQuark ns)
 {
-  WockyNode *result;
-
   g_return_val_if_fail (name != NULL, NULL);
   g_return_val_if_fail (ns != 0, NULL);
 
-  result = g_slice_new0 (WockyNode);
-
-  result->name = strndup_validated (name, -1);
-  result->ns = ns;
-
-  return result;
+  return new_node_take_name (intern_validated (name), ns);
 }
 
 /**
@@ -190,16 +226,237 @@ wocky_node_new (const char *name, const gchar *ns)
 {
   g_return_val_if_fail (ns != NULL, NULL);
 
-  return new_node (name, g_quark_from_string (ns));
+  return new_node (name, _wocky_intern_quark (ns));
+}
+
+/* Most elements have very few attributes, so the array starts with room
+ * for two and doubles from there. */
+static guint
+attributes_capacity (guint n_attributes)
+{
+  guint capacity = 2;
+
+  while (capacity < n_attributes)
+    capacity *= 2;
+
+  return capacity;
+}
+
+/* Makes room for another attribute at the end of @node's, which the caller
+ * must fill in. */
+static Attribute *
+append_attribute (WockyNode *node)
+{
+  Attribute *attributes = node->attributes;
+
+  if (attributes == NULL)
+    attributes = g_new (Attribute, attributes_capacity (1));
+  else if (node->n_attributes == attributes_capacity (node->n_attributes))
+    attributes = g_renew (Attribute, attributes, node->n_attributes * 2);
+
+  node->attributes = attributes;
+  return attributes + node->n_attributes++;
+}
+
+/* If @ns is 0, the first attribute called @key in any namespace. */
+static Attribute *
+find_attribute (WockyNode *node,
+    const gchar *key,
+    GQuark ns)
+{
+  Attribute *attributes = node->attributes;
+  guint i;
+
+  for (i = 0; i < node->n_attributes; i++)
+    {
+      Attribute *a = attributes + i;
+
+      if (ns != 0 && a->ns != ns)
+        continue;
+
+      /* a key taken from another node usually matches without a strcmp() */
+      if (_wocky_intern_equal (a->key, key))
+        return a;
+    }
+
+  return NULL;
 }
 
 static void
-attribute_free (Attribute *a)
+attribute_clear (Attribute *a)
 {
-  g_free (a->key);
+  _wocky_intern_release (a->key);
   g_free (a->value);
-  g_free (a->prefix);
-  g_slice_free (Attribute, a);
+  _wocky_intern_release (a->prefix);
+}
+
+static void
+remove_attribute (WockyNode *node,
+    Attribute *a)
+{
+  Attribute *end = (Attribute *) node->attributes + node->n_attributes;
+
+  attribute_clear (a);
+  memmove (a, a + 1, (end - (a + 1)) * sizeof (Attribute));
+  node->n_attributes--;
+}
+
+static ChildKey *
+child_key_new (const gchar *name,
+    GQuark ns)
+{
+  ChildKey *key = g_slice_new (ChildKey);
+
+  key->name = name;
+  key->ns = ns;
+  return key;
+}
+
+static void
+child_key_free (gpointer key)
+{
+  g_slice_free (ChildKey, key);
+}
+
+static guint
+child_key_hash (gconstpointer key)
+{
+  const ChildKey *k = key;
+
+  return g_str_hash (k->name) ^ k->ns;
+}
+
+static gboolean
+child_key_equal (gconstpointer a,
+    gconstpointer b)
+{
+  const ChildKey *ka = a;
+  const ChildKey *kb = b;
+
+  return ka->ns == kb->ns && _wocky_intern_equal (ka->name, kb->name);
+}
+
+/* If @first, @child comes before any other children of the same name
+ * already in @child_index; otherwise it comes after them. */
+static void
+child_index_add (GHashTable *child_index,
+    WockyNode *child,
+    gboolean first)
+{
+  ChildKey any = { child->name, 0 };
+  ChildKey exact = { child->name, child->ns };
+
+  if (first || !g_hash_table_contains (child_index, &any))
+    g_hash_table_replace (child_index, child_key_new (child->name, 0), child);
+
+  if (first || !g_hash_table_contains (child_index, &exact))
+    g_hash_table_replace (child_index,
+        child_key_new (child->name, child->ns), child);
+}
+
+static GHashTable *
+children_get_index (Children *children)
+{
+  guint i;
+
+  if (children->index != NULL)
+    return children->index;
+
+  children->index = g_hash_table_new_full (child_key_hash, child_key_equal,
+      child_key_free, NULL);
+
+  for (i = 0; i < children->len; i++)
+    child_index_add (children->index, children->nodes[i], FALSE);
+
+  return children->index;
+}
+
+/* Makes room for another child of @node. */
+static Children *
+reserve_child (WockyNode *node)
+{
+  Children *children = node->children;
+
+  if (children == NULL)
+    {
+      children = g_malloc (G_STRUCT_OFFSET (Children, nodes) +
+          4 * sizeof (WockyNode *));
+      children->len = 0;
+      children->alloc = 4;
+      children->index = NULL;
+    }
+  else if (children->len == children->alloc)
+    {
+      children->alloc *= 2;
+      children = g_realloc (children, G_STRUCT_OFFSET (Children, nodes) +
+          children->alloc * sizeof (WockyNode *));
+    }
+
+  node->children = children;
+  return children;
+}
+
+/* Takes ownership of @child. */
+static void
+append_child (WockyNode *node,
+    WockyNode *child)
+{
+  Children *children = reserve_child (node);
+
+  children->nodes[children->len++] = child;
+
+  if (children->index != NULL)
+    child_index_add (children->index, child, FALSE);
+}
+
+/* Takes ownership of @child. */
+static void
+prepend_child (WockyNode *node,
+    WockyNode *child)
+{
+  Children *children = reserve_child (node);
+
+  memmove (children->nodes + 1, children->nodes,
+      children->len * sizeof (WockyNode *));
+  children->nodes[0] = child;
+  children->len++;
+
+  if (children->index != NULL)
+    child_index_add (children->index, child, TRUE);
+}
+
+/* Frees the @i-th child of @node, keeping the others in order. */
+static void
+remove_child (WockyNode *node,
+    guint i)
+{
+  Children *children = node->children;
+
+  wocky_node_free (children->nodes[i]);
+  children->len--;
+  memmove (children->nodes + i, children->nodes + i + 1,
+      (children->len - i) * sizeof (WockyNode *));
+
+  if (children->index != NULL)
+    {
+      g_hash_table_unref (children->index);
+      children->index = NULL;
+    }
+}
+
+static inline guint
+n_children (WockyNode *node)
+{
+  Children *children = node->children;
+
+  return children != NULL ? children->len : 0;
+}
+
+static inline WockyNode *
+nth_child (WockyNode *node,
+    guint i)
+{
+  return ((Children *) node->children)->nodes[i];
 }
 
 /**
@@ -212,31 +469,149 @@ attribute_free (Attribute *a)
 void
 wocky_node_free (WockyNode *node)
 {
-  GSList *l;
+  Children *children;
+  Attribute *attributes;
+  guint i;
 
   if (node == NULL)
     {
       return ;
     }
 
-  g_free (node->name);
+  /* anything sealed may be shared with other trees */
+  if (node->sealed && !g_atomic_int_dec_and_test (&node->ref_count))
+    return;
+
+  _wocky_intern_release (node->name);
   g_free (node->content);
   g_free (node->language);
 
-  for (l = node->children; l != NULL ; l = l->next)
+  children = node->children;
+  if (children != NULL)
     {
-      wocky_node_free ((WockyNode *) l->data);
+      if (children->index != NULL)
+        g_hash_table_unref (children->index);
+
+      for (i = 0; i < children->len; i++)
+        wocky_node_free (children->nodes[i]);
+
+      g_free (children);
     }
-  g_slist_free (node->children);
 
-  for (l = node->attributes; l != NULL ; l = l->next)
+  attributes = node->attributes;
+  for (i = 0; i < node->n_attributes; i++)
+    attribute_clear (attributes + i);
+  g_free (attributes);
+
+  g_slice_free (WockyNode, node);
+}
+
+static WockyNode *
+node_ref (WockyNode *node)
+{
+  g_atomic_int_inc (&node->ref_count);
+  return node;
+}
+
+/**
+ * wocky_node_seal:
+ * @node: a #WockyNode
+ *
+ * Makes @node and all of its children immutable: any attempt to change
+ * them afterwards is a programming error. In exchange, copies of a sealed
+ * node (such as made by wocky_stanza_copy() or wocky_node_add_node_tree())
+ * share its children instead of copying them, and sealed nodes may be read
+ * from several threads at once.
+ */
+void
+wocky_node_seal (WockyNode *node)
+{
+  guint i;
+
+  g_return_if_fail (node != NULL);
+
+  if (node->sealed)
+    return;
+
+  /* build the index now, since it can't be built lazily any more */
+  if (n_children (node) >= CHILD_INDEX_THRESHOLD)
+    children_get_index (node->children);
+
+  for (i = 0; i < n_children (node); i++)
+    wocky_node_seal (nth_child (node, i));
+
+  node->sealed = TRUE;
+}
+
+/**
+ * wocky_node_is_sealed:
+ * @node: a #WockyNode
+ *
+ * Returns: %TRUE if @node has been sealed with wocky_node_seal(), or is
+ *  below a node which has.
+ */
+gboolean
+wocky_node_is_sealed (WockyNode *node)
+{
+  g_return_val_if_fail (node != NULL, FALSE);
+
+  return node->sealed;
+}
+
+/**
+ * wocky_node_make_child_writable:
+ * @node: a #WockyNode which isn't sealed
+ * @child: one of @node's children
+ *
+ * If @child is sealed, replaces it among @node's children by an unsealed
+ * copy, which shares @child's own children. Otherwise, does nothing. This
+ * is how to change something below the top node of a copy of a sealed
+ * stanza, one level at a time:
+ * <example><programlisting>
+ * WockyStanza *copy = wocky_stanza_copy (sealed);
+ * WockyNode *top = wocky_stanza_get_top_node (copy);
+ * WockyNode *query = wocky_node_get_first_child (top);
+ *
+ * query = wocky_node_make_child_writable (top, query);
+ * wocky_node_set_attribute (query, "node", "urn:example:other");
+ * </programlisting></example>
+ *
+ * Returns: @child, or its writable replacement
+ */
+WockyNode *
+wocky_node_make_child_writable (WockyNode *node,
+    WockyNode *child)
+{
+  Children *children;
+  WockyNode *copy;
+  guint i;
+
+  g_return_val_if_fail (node != NULL, NULL);
+  g_return_val_if_fail (!node->sealed, NULL);
+  g_return_val_if_fail (child != NULL, NULL);
+
+  if (!child->sealed)
+    return child;
+
+  children = node->children;
+
+  for (i = 0; i < n_children (node); i++)
+    if (children->nodes[i] == child)
+      break;
+
+  g_return_val_if_fail (i < n_children (node), NULL);
+
+  copy = _wocky_node_copy (child);
+  children->nodes[i] = copy;
+
+  if (children->index != NULL)
     {
-      Attribute *a = (Attribute *) l->data;
-      attribute_free (a);
+      g_hash_table_unref (children->index);
+      children->index = NULL;
     }
-  g_slist_free (node->attributes);
 
-  g_slice_free (WockyNode, node);
+  wocky_node_free (child);
+  return copy;
 }
 
 /**
@@ -251,11 +626,12 @@ void
 wocky_node_each_attribute (WockyNode *node,
     wocky_node_each_attr_func func, gpointer user_data)
 {
-  GSList *l;
+  Attribute *attributes = node->attributes;
+  guint i;
 
-  for (l = node->attributes; l != NULL ; l = l->next)
+  for (i = 0; i < node->n_attributes; i++)
     {
-      Attribute *a = (Attribute *) l->data;
+      Attribute *a = attributes + i;
       const gchar *ns = g_quark_to_string (a->ns);
       if (!func (a->key, a->value, a->prefix, ns, user_data))
         {
@@ -276,11 +652,12 @@ void
 wocky_node_each_child (WockyNode *node,
     wocky_node_each_child_func func, gpointer user_data)
 {
-  GSList *l;
+  guint i;
 
-  for (l = node->children; l != NULL ; l = l->next)
+  /* @func may add children, so check the count each time round */
+  for (i = 0; i < n_children (node); i++)
     {
-      WockyNode *n = (WockyNode *) l->data;
+      WockyNode *n = nth_child (node, i);
       if (!func (n, user_data))
         {
           return;
@@ -288,20 +665,6 @@ wocky_node_each_child (WockyNode *node,
     }
 }
 
-static gint
-attribute_compare (gconstpointer a, gconstpointer b)
-{
-  const Attribute *attr = (const Attribute *)a;
-  const Tuple *target = (const Tuple *)b;
-
-  if (target->ns != 0 && attr->ns != target->ns)
-    {
-      return 1;
-    }
-
-  return strcmp (attr->key, target->key);
-}
-
 /**
  * wocky_node_get_attribute_ns:
  * @node: a #WockyNode
@@ -319,15 +682,42 @@ const gchar *
 wocky_node_get_attribute_ns (WockyNode *node,
     const gchar *key, const gchar *ns)
 {
-  GSList *link;
-  Tuple search;
+  GQuark ns_q = 0;
+
+  if (ns != NULL)
+    {
+      /* no attribute can be in a namespace which has never been seen */
+      ns_q = _wocky_intern_try_quark (ns);
 
-  search.key = (gchar *) key;
-  search.ns = (ns != NULL ? g_quark_from_string (ns) : 0);
+      if (ns_q == 0)
+        return NULL;
+    }
+
+  return wocky_node_get_attribute_ns_q (node, key, ns_q);
+}
 
-  link = g_slist_find_custom (node->attributes, &search, attribute_compare);
+/**
+ * wocky_node_get_attribute_ns_q:
+ * @node: a #WockyNode
+ * @key: the attribute name
+ * @ns: the namespace to search within, or 0
+ *
+ * Returns the value of an attribute in a #WockyNode, limiting the search
+ * within a specific namespace. This is the same as
+ * wocky_node_get_attribute_ns(), but saves looking up the namespace's
+ * quark.
+ *
+ * Returns: the value of the attribute @key, or %NULL if @node doesn't
+ * have such attribute in @ns.
+ */
+const gchar *
+wocky_node_get_attribute_ns_q (WockyNode *node,
+    const gchar *key,
+    GQuark ns)
+{
+  Attribute *a = find_attribute (node, key, ns);
 
-  return (link == NULL) ? NULL : ((Attribute *) (link->data))->value;
+  return (a == NULL) ? NULL : a->value;
 }
 
 /**
@@ -343,7 +733,7 @@ wocky_node_get_attribute_ns (WockyNode *node,
 const gchar *
 wocky_node_get_attribute (WockyNode *node, const gchar *key)
 {
-  return wocky_node_get_attribute_ns (node, key, NULL);
+  return wocky_node_get_attribute_ns_q (node, key, 0);
 }
 
 /**
@@ -411,35 +801,14 @@ wocky_node_set_attribute_ns (WockyNode *node, const gchar *key,
       key, value, strlen (value), ns);
 }
 
-static NSPrefix *
-ns_prefix_new (const gchar *urn,
-    GQuark ns,
-    const gchar *prefix)
+static PrefixTable *
+prefix_table_new (guint size)
 {
-  NSPrefix *nsp = g_slice_new0 (NSPrefix);
-  nsp->ns_urn = urn;
-  nsp->prefix = strndup_validated (prefix, -1);
-  nsp->ns = ns;
-
-  return nsp;
-}
+  PrefixTable *table = g_malloc0 (sizeof (PrefixTable) +
+      (size - 1) * sizeof (PrefixSlot));
 
-static void
-ns_prefix_free (NSPrefix *nsp)
-{
-  g_free (nsp->prefix);
-  g_slice_free (NSPrefix, nsp);
-}
-
-static GHashTable *
-_init_prefix_table (void)
-{
-  /* do NOT use the astonishingly poorly named g_int_hash here */
-  /* it most emphatically does NOT do what it says on the tin  */
-  return g_hash_table_new_full (g_direct_hash, /* quarks are uint32s */
-      g_direct_equal,                          /* ibid               */
-      NULL,                                    /* cannot free quarks */
-      (GDestroyNotify)ns_prefix_free);
+  table->size = size;
+  return table;
 }
 
 /* convert the NS URN Quark to a base-26 number represented as a *
@@ -465,67 +834,140 @@ _generate_ns_prefix (GQuark ns)
   return g_string_free (prefix, FALSE);
 }
 
-static void
-_init_user_prefix_table (void)
+/* Safe to call from any thread without holding prefixes_lock */
+static const gchar *
+_lookup_prefix (GQuark ns)
 {
-  if (user_ns_prefixes == NULL)
-    user_ns_prefixes = _init_prefix_table ();
+  PrefixTable *table = g_atomic_pointer_get (&prefixes);
+  guint mask, i;
+
+  if (table == NULL)
+    return NULL;
+
+  mask = table->size - 1;
+
+  /* the table is never full, so this finds an empty slot if nothing else */
+  for (i = ns & mask; ; i = (i + 1) & mask)
+    {
+      GQuark slot_ns = g_atomic_int_get ((gint *) &table->slots[i].ns);
+
+      if (slot_ns == 0)
+        return NULL;
+
+      if (slot_ns == ns)
+        return g_atomic_pointer_get (&table->slots[i].prefix);
+    }
+}
+
+/* must be called with prefixes_lock held */
+static PrefixSlot *
+_claim_prefix_slot (PrefixTable *table,
+    GQuark ns)
+{
+  guint mask = table->size - 1;
+  guint i;
+
+  for (i = ns & mask; ; i = (i + 1) & mask)
+    {
+      if (table->slots[i].ns == 0 || table->slots[i].ns == ns)
+        return table->slots + i;
+    }
 }
 
-static const NSPrefix *
-_add_prefix_to_table (GHashTable *table,
-    GQuark ns,
-    const gchar *urn,
+static void _init_prefix_table (void);
+
+/* must be called with prefixes_lock held */
+static const gchar *
+_set_prefix (GQuark ns,
     const gchar *prefix)
 {
-  NSPrefix *nsp = ns_prefix_new (urn, ns, prefix);
-  g_hash_table_insert (table, GINT_TO_POINTER (ns), nsp);
-  return nsp;
+  PrefixTable *table;
+  PrefixSlot *slot;
+
+  if (prefixes == NULL)
+    _init_prefix_table ();
+
+  table = prefixes;
+  prefix = (prefix != NULL) ? _wocky_intern_permanent (prefix) : NULL;
+  slot = _claim_prefix_slot (table, ns);
+
+  if (slot->ns == ns)
+    {
+      g_atomic_pointer_set (&slot->prefix, prefix);
+      return prefix;
+    }
+
+  if ((table->used + 1) * 2 > table->size)
+    {
+      PrefixTable *bigger = prefix_table_new (table->size * 2);
+      guint i;
+
+      for (i = 0; i < table->size; i++)
+        if (table->slots[i].ns != 0)
+          *_claim_prefix_slot (bigger, table->slots[i].ns) = table->slots[i];
+
+      bigger->used = table->used;
+      g_atomic_pointer_set (&prefixes, bigger);
+      retired_prefixes = g_slist_prepend (retired_prefixes, table);
+
+      table = bigger;
+      slot = _claim_prefix_slot (table, ns);
+    }
+
+  /* readers which see the namespace must see its prefix too */
+  g_atomic_pointer_set (&slot->prefix, prefix);
+  g_atomic_int_set ((gint *) &slot->ns, ns);
+  table->used++;
+
+  return prefix;
 }
 
 static void
-_init_default_prefix_table (void)
+_init_prefix_table (void)
 {
   int i;
 
-  if (default_ns_prefixes != NULL)
+  if (prefixes != NULL)
     return;
 
-  default_ns_prefixes = _init_prefix_table ();
+  g_atomic_pointer_set (&prefixes,
+      prefix_table_new (PREFIX_TABLE_INITIAL_SIZE));
 
   for (i = 0; default_attr_ns_prefixes[i].ns_urn != NULL; i++)
     {
-      const gchar *urn = default_attr_ns_prefixes[i].ns_urn;
-      GQuark ns = g_quark_from_string (urn);
+      GQuark ns = g_quark_from_string (default_attr_ns_prefixes[i].ns_urn);
       gchar *prefix = _generate_ns_prefix (ns);
-      _add_prefix_to_table (default_ns_prefixes, ns, urn, prefix);
+
+      _set_prefix (ns, prefix);
       g_free (prefix);
     }
 }
 
 static const gchar *
-_attribute_ns_get_prefix (GQuark ns,
-    const gchar *urn)
+_attribute_ns_get_prefix (GQuark ns)
 {
-  const NSPrefix *nsp = NULL;
+  const gchar *result;
   gchar *prefix;
 
-  /* check user-registered explicit prefixes for this namespace */
-  nsp = g_hash_table_lookup (user_ns_prefixes, GINT_TO_POINTER (ns));
-  if (nsp != NULL)
-    return nsp->prefix;
+  result = _lookup_prefix (ns);
 
-  /* check any built-in explicit prefixes for this namespace */
-  nsp = g_hash_table_lookup (default_ns_prefixes, GINT_TO_POINTER (ns));
-  if (nsp != NULL)
-    return nsp->prefix;
+  if (result != NULL)
+    return result;
 
-  /* ok, there was no registered prefix - generate and register a prefix */
-  /* initialise the user prefix table here if we need to                 */
-  prefix = _generate_ns_prefix (ns);
-  nsp = _add_prefix_to_table (user_ns_prefixes, ns, urn, prefix);
-  g_free (prefix);
-  return nsp->prefix;
+  /* ok, there was no registered prefix - generate and register a prefix,
+   * unless another thread got there first */
+  g_mutex_lock (&prefixes_lock);
+  result = _lookup_prefix (ns);
+
+  if (result == NULL)
+    {
+      prefix = _generate_ns_prefix (ns);
+      result = _set_prefix (ns, prefix);
+      g_free (prefix);
+    }
+
+  g_mutex_unlock (&prefixes_lock);
+  return result;
 }
 
 /**
@@ -539,16 +981,12 @@ _attribute_ns_get_prefix (GQuark ns,
 const gchar *
 wocky_node_attribute_ns_get_prefix_from_quark (GQuark ns)
 {
-  const gchar *urn;
-
   if (ns == 0)
     return NULL;
 
-  urn = g_quark_to_string (ns);
-
   /* fetch an existing prefix, a default prefix, or a newly allocated one *
    * in that order of preference                                          */
-  return _attribute_ns_get_prefix (ns, urn);
+  return _attribute_ns_get_prefix (ns);
 }
 
 /**
@@ -567,11 +1005,11 @@ wocky_node_attribute_ns_get_prefix_from_urn (const gchar *urn)
   if ((urn == NULL) || (*urn == '\0'))
     return NULL;
 
-  ns = g_quark_from_string (urn);
+  ns = _wocky_intern_quark (urn);
 
   /* fetch an existing prefix, a default prefix, or a newly allocated one *
    * in that order of preference                                          */
-  return _attribute_ns_get_prefix (ns, urn);
+  return _attribute_ns_get_prefix (ns);
 }
 
 /**
@@ -579,15 +1017,51 @@ wocky_node_attribute_ns_get_prefix_from_urn (const gchar *urn)
  * @ns: a #GQuark
  * @prefix: a string containing the desired prefix
  *
- * Sets a desired prefix for a namespace.
+ * Sets a desired prefix for a namespace. Prefixes are kept until
+ * wocky_deinit(), so this is meant for prefixes chosen by the code rather
+ * than read from the network. This may be called from any thread.
  */
 void
 wocky_node_attribute_ns_set_prefix (GQuark ns, const gchar *prefix)
 {
-  const gchar *urn = g_quark_to_string (ns);
+  if (!wocky_strdiff (_lookup_prefix (ns), prefix))
+    return;
 
-  /* add/replace user prefix table entry */
-  _add_prefix_to_table (user_ns_prefixes, ns, urn, prefix);
+  g_mutex_lock (&prefixes_lock);
+  _set_prefix (ns, prefix);
+  g_mutex_unlock (&prefixes_lock);
+}
+
+/* For prefixes read from the network, which must not be able to make the
+ * table grow without bound: a namespace keeps the prefix it already has,
+ * and one which doesn't fit in the bounded intern table gets a generated
+ * prefix instead. */
+void
+_wocky_node_attribute_ns_add_prefix (GQuark ns,
+    const gchar *prefix)
+{
+  gchar *copy;
+
+  if (_lookup_prefix (ns) != NULL)
+    return;
+
+  g_mutex_lock (&prefixes_lock);
+
+  if (_lookup_prefix (ns) == NULL)
+    {
+      copy = _wocky_intern_or_dup (prefix);
+
+      if (!_wocky_is_interned (copy))
+        {
+          g_free (copy);
+          copy = _generate_ns_prefix (ns);
+        }
+
+      _set_prefix (ns, copy);
+      _wocky_intern_release (copy);
+    }
+
+  g_mutex_unlock (&prefixes_lock);
 }
 
 /**
@@ -606,27 +1080,32 @@ void
 wocky_node_set_attribute_n_ns (WockyNode *node, const gchar *key,
     const gchar *value, gsize value_size, const gchar *ns)
 {
-  Attribute *a = g_slice_new0 (Attribute);
-  GSList *link;
-  Tuple search;
+  gchar *interned_key;
+  gchar *validated_value;
+  const gchar *prefix;
+  GQuark ns_q;
+  Attribute *a;
 
-  a->key = strndup_validated (key, -1);
-  a->value = strndup_validated (value, value_size);
-  a->prefix = g_strdup (wocky_node_attribute_ns_get_prefix_from_urn (ns));
-  a->ns = (ns != NULL) ? g_quark_from_string (ns) : 0;
+  g_return_if_fail (!node->sealed);
+
+  interned_key = intern_validated (key);
+  validated_value = strndup_validated (value, value_size);
+  prefix = wocky_node_attribute_ns_get_prefix_from_urn (ns);
+  ns_q = (ns != NULL) ? _wocky_intern_quark (ns) : 0;
 
   /* Remove the old attribute if needed */
-  search.key = a->key;
-  search.ns = a->ns;
-  link = g_slist_find_custom (node->attributes, &search, attribute_compare);
-  if (link != NULL)
-    {
-      Attribute *old = (Attribute *) link->data;
-      attribute_free (old);
-      node->attributes = g_slist_delete_link (node->attributes, link);
-    }
+  a = find_attribute (node, interned_key, ns_q);
+  if (a != NULL)
+    remove_attribute (node, a);
+
+  a = append_attribute (node);
+  a->key = interned_key;
+  a->value = validated_value;
+  a->prefix = (prefix != NULL) ? _wocky_intern_or_dup (prefix) : NULL;
+  a->ns = ns_q;
 
-  node->attributes = g_slist_append (node->attributes, a);
+  /* lets anything caching a value derived from the attributes notice */
+  node->serial++;
 }
 
 /**
@@ -645,21 +1124,6 @@ wocky_node_set_attribute_n (WockyNode *node, const gchar *key,
   wocky_node_set_attribute_n_ns (node, key, value, value_size, NULL);
 }
 
-static gint
-node_compare_child (gconstpointer a, gconstpointer b)
-{
-  const WockyNode *node = (const WockyNode *)a;
-  Tuple *target = (Tuple *) b;
-
-  if (target->ns != 0 && target->ns != node->ns)
-    return 1;
-
-  if (target->key == NULL)
-    return 0;
-
-  return strcmp (node->name, target->key);
-}
-
 /**
  * wocky_node_get_child_ns:
  * @node: a #WockyNode
@@ -676,18 +1140,65 @@ WockyNode *
 wocky_node_get_child_ns (WockyNode *node, const gchar *name,
      const gchar *ns)
 {
-  GSList *link;
-  Tuple t;
+  GQuark ns_q = 0;
+
+  if (ns != NULL)
+    {
+      /* if nothing has used @ns yet, no child can be in it */
+      ns_q = _wocky_intern_try_quark (ns);
+
+      if (ns_q == 0)
+        return NULL;
+    }
+
+  return wocky_node_get_child_ns_q (node, name, ns_q);
+}
+
+/**
+ * wocky_node_get_child_ns_q:
+ * @node: a #WockyNode
+ * @name: the name of the child to get
+ * @ns: the namespace of the child to get, or 0
+ *
+ * Gets the child of a node, searching by name and limiting the search
+ * to the specified namespace. If the namespace is 0, this is equivalent to
+ * wocky_node_get_child().
+ *
+ * Returns: a #WockyNode.
+ */
+WockyNode *
+wocky_node_get_child_ns_q (WockyNode *node,
+    const gchar *name,
+    GQuark ns)
+{
+  Children *children = node->children;
+  guint i;
+
+  if (children == NULL)
+    return NULL;
 
   /* This secretly works just fine if @name is %NULL, but don't tell anyone!
    * wocky_node_get_first_child_ns() is what people should be using.
    * */
-  t.key = name;
-  t.ns = (ns != NULL ?  g_quark_from_string (ns) : 0);
+  if (name != NULL && children->len >= CHILD_INDEX_THRESHOLD)
+    {
+      ChildKey key = { name, ns };
+
+      return g_hash_table_lookup (children_get_index (children), &key);
+    }
+
+  for (i = 0; i < children->len; i++)
+    {
+      WockyNode *child = children->nodes[i];
+
+      if (ns != 0 && child->ns != ns)
+        continue;
 
-  link = g_slist_find_custom (node->children, &t, node_compare_child);
+      if (name == NULL || _wocky_intern_equal (child->name, name))
+        return child;
+    }
 
-  return (link == NULL) ? NULL : (WockyNode *) (link->data);
+  return NULL;
 }
 
 /**
@@ -718,10 +1229,24 @@ wocky_node_get_first_child (WockyNode *node)
 {
   g_return_val_if_fail (node != NULL, NULL);
 
-  if (node->children == NULL)
+  if (n_children (node) == 0)
     return NULL;
 
-  return (WockyNode *) node->children->data;
+  return nth_child (node, 0);
+}
+
+/**
+ * wocky_node_get_n_children:
+ * @node: a #WockyNode
+ *
+ * Returns: the number of children @node has.
+ */
+guint
+wocky_node_get_n_children (WockyNode *node)
+{
+  g_return_val_if_fail (node != NULL, 0);
+
+  return n_children (node);
 }
 
 /**
@@ -876,7 +1401,7 @@ wocky_node_add_child_with_content_ns (WockyNode *node,
     const gchar *name, const gchar *content, const gchar *ns)
 {
   return wocky_node_add_child_with_content_ns_q (node, name, content,
-    ns != NULL ? g_quark_from_string (ns) : 0);
+    ns != NULL ? _wocky_intern_quark (ns) : 0);
 }
 
 /**
@@ -897,11 +1422,15 @@ WockyNode *
 wocky_node_add_child_with_content_ns_q (WockyNode *node,
     const gchar *name, const gchar *content, GQuark ns)
 {
-  WockyNode *result = new_node (name, ns != 0 ? ns : node->ns);
+  WockyNode *result;
+
+  g_return_val_if_fail (!node->sealed, NULL);
+
+  result = new_node (name, ns != 0 ? ns : node->ns);
 
   wocky_node_set_content (result, content);
 
-  node->children = g_slist_append (node->children, result);
+  append_child (node, result);
   return result;
 }
 
@@ -922,7 +1451,7 @@ wocky_node_get_ns (WockyNode *node)
 gboolean
 wocky_node_has_ns (WockyNode *node, const gchar *ns)
 {
-  return wocky_node_has_ns_q (node, g_quark_try_string (ns));
+  return wocky_node_has_ns_q (node, _wocky_intern_try_quark (ns));
 }
 
 gboolean
@@ -951,7 +1480,7 @@ wocky_node_matches_q (
   g_return_val_if_fail (name != NULL, FALSE);
   g_return_val_if_fail (ns != 0, FALSE);
 
-  if (wocky_strdiff (node->name, name))
+  if (!_wocky_intern_equal (node->name, name))
     return FALSE;
 
   return wocky_node_has_ns_q (node, ns);
@@ -977,7 +1506,7 @@ wocky_node_matches (
   g_return_val_if_fail (name != NULL, FALSE);
   g_return_val_if_fail (ns != NULL, FALSE);
 
-  return wocky_node_matches_q (node, name, g_quark_try_string (ns));
+  return wocky_node_matches_q (node, name, _wocky_intern_try_quark (ns));
 }
 
 /**
@@ -1007,6 +1536,8 @@ void
 wocky_node_set_language_n (WockyNode *node, const gchar *lang,
     gsize lang_size)
 {
+  g_return_if_fail (!node->sealed);
+
   g_free (node->language);
   node->language = strndup_validated (lang, lang_size);
 }
@@ -1038,6 +1569,8 @@ wocky_node_set_language (WockyNode *node, const gchar *lang)
 void
 wocky_node_set_content (WockyNode *node, const gchar *content)
 {
+  g_return_if_fail (!node->sealed);
+
   g_free (node->content);
   node->content = strndup_validated (content, -1);
 }
@@ -1054,6 +1587,9 @@ wocky_node_append_content (WockyNode *node,
     const gchar *content)
 {
   gchar *t = node->content;
+
+  g_return_if_fail (!node->sealed);
+
   node->content = concat_validated (t, content, -1);
   g_free (t);
 }
@@ -1072,6 +1608,9 @@ wocky_node_append_content_n (WockyNode *node, const gchar *content,
     gsize size)
 {
   gchar *t = node->content;
+
+  g_return_if_fail (!node->sealed);
+
   node->content = concat_validated (t, content, size);
   g_free (t);
 }
@@ -1103,7 +1642,7 @@ node_to_string (WockyNode *node,
     const gchar *prefix,
     GString *str)
 {
-  GSList *l;
+  guint i;
   gchar *nprefix;
 
   g_string_append_printf (str, "%s* %s", prefix, node->name);
@@ -1121,8 +1660,8 @@ node_to_string (WockyNode *node,
   if (node->content != NULL && *node->content != '\0')
     g_string_append_printf (str, "%s\"%s\"\n", nprefix, node->content);
 
-  for (l = node->children ; l != NULL; l = g_slist_next (l))
-    node_to_string (l->data, node->ns, nprefix, str);
+  for (i = 0; i < n_children (node); i++)
+    node_to_string (nth_child (node, i), node->ns, nprefix, str);
 
   g_free (nprefix);
 
@@ -1166,9 +1705,9 @@ gboolean
 wocky_node_equal (WockyNode *node0,
     WockyNode *node1)
 {
-  GSList *l0, *l1;
+  guint i;
 
-  if (wocky_strdiff (node0->name, node1->name))
+  if (!_wocky_intern_equal (node0->name, node1->name))
     return FALSE;
 
   if (wocky_strdiff (node0->content, node1->content))
@@ -1180,37 +1719,31 @@ wocky_node_equal (WockyNode *node0,
   if (node0->ns != node1->ns)
     return FALSE;
 
-  if (g_slist_length (node0->attributes) != g_slist_length (node1->attributes))
+  if (node0->n_attributes != node1->n_attributes)
     return FALSE;
 
   /* Compare attributes */
-  for (l0 = node0->attributes ; l0 != NULL;  l0 = g_slist_next (l0))
+  for (i = 0; i < node0->n_attributes; i++)
     {
-      Attribute *a = (Attribute *) l0->data;
+      Attribute *a = (Attribute *) node0->attributes + i;
       const gchar *c;
 
-      c = wocky_node_get_attribute_ns (node1, a->key,
-        a->ns == 0 ? NULL : g_quark_to_string (a->ns));
+      c = wocky_node_get_attribute_ns_q (node1, a->key, a->ns);
 
       if (wocky_strdiff (a->value, c))
         return FALSE;
     }
 
+  if (n_children (node0) != n_children (node1))
+    return FALSE;
+
   /* Recursively compare children, order matters */
-  for (l0 = node0->children, l1 = node1->children ;
-      l0 != NULL && l1 != NULL;
-      l0 = g_slist_next (l0), l1 = g_slist_next (l1))
+  for (i = 0; i < n_children (node0); i++)
     {
-      WockyNode *c0 = (WockyNode *) l0->data;
-      WockyNode *c1 = (WockyNode *) l1->data;
-
-      if (!wocky_node_equal (c0, c1))
+      if (!wocky_node_equal (nth_child (node0, i), nth_child (node1, i)))
         return FALSE;
     }
 
-  if (l0 != NULL || l1 != NULL)
-    return FALSE;
-
   return TRUE;
 }
 
@@ -1225,7 +1758,7 @@ gboolean
 wocky_node_is_superset (WockyNode *node,
     WockyNode *subset)
 {
-  GSList *l;
+  guint i;
 
   if (subset == NULL)
     /* We are always a superset of nothing */
@@ -1235,7 +1768,7 @@ wocky_node_is_superset (WockyNode *node,
     /* subset is not NULL so we are not a superset */
     return FALSE;
 
-  if (wocky_strdiff (node->name, subset->name))
+  if (!_wocky_intern_equal (node->name, subset->name))
     /* Node name doesn't match */
     return FALSE;
 
@@ -1250,26 +1783,25 @@ wocky_node_is_superset (WockyNode *node,
     return FALSE;
 
   /* Check attributes */
-  for (l = subset->attributes; l != NULL;  l = g_slist_next (l))
+  for (i = 0; i < subset->n_attributes; i++)
     {
-      Attribute *a = (Attribute *) l->data;
+      Attribute *a = (Attribute *) subset->attributes + i;
       const gchar *c;
 
-      c = wocky_node_get_attribute_ns (node, a->key,
-        a->ns == 0 ? NULL : g_quark_to_string (a->ns));
+      c = wocky_node_get_attribute_ns_q (node, a->key, a->ns);
 
       if (wocky_strdiff (a->value, c))
         return FALSE;
     }
 
   /* Recursively check children; order doesn't matter */
-  for (l = subset->children; l != NULL; l = g_slist_next (l))
+  for (i = 0; i < n_children (subset); i++)
     {
-      WockyNode *pattern_child = (WockyNode *) l->data;
+      WockyNode *pattern_child = nth_child (subset, i);
       WockyNode *node_child;
 
-      node_child = wocky_node_get_child_ns (node, pattern_child->name,
-          wocky_node_get_ns (pattern_child));
+      node_child = wocky_node_get_child_ns_q (node, pattern_child->name,
+          pattern_child->ns);
 
       if (!wocky_node_is_superset (node_child, pattern_child))
         return FALSE;
@@ -1310,10 +1842,10 @@ wocky_node_iter_init (WockyNodeIter *iter,
   g_return_if_fail (node != NULL);
 
   iter->node = node;
-  iter->pending = node->children;
-  iter->current = NULL;
+  iter->pending = 0;
+  iter->current = 0;
   iter->name = name;
-  iter->ns = g_quark_from_string (ns);
+  iter->ns = _wocky_intern_quark (ns);
 }
 
 /**
@@ -1331,14 +1863,15 @@ gboolean
 wocky_node_iter_next (WockyNodeIter *iter,
     WockyNode **next)
 {
-  while (iter->pending != NULL)
+  while (iter->pending < n_children (iter->node))
     {
-      WockyNode *ln = (WockyNode *) iter->pending->data;
+      WockyNode *ln = nth_child (iter->node, iter->pending);
 
-      iter->current = iter->pending;
-      iter->pending = g_slist_next (iter->pending);
+      /* one more than the index of the child last returned, or 0 */
+      iter->current = ++iter->pending;
 
-      if (iter->name != NULL && wocky_strdiff (ln->name, iter->name))
+      /* names are usually interned, and so need no strcmp() */
+      if (iter->name != NULL && !_wocky_intern_equal (ln->name, iter->name))
         continue;
 
       if (iter->ns != 0 && iter->ns != ln->ns)
@@ -1350,7 +1883,7 @@ wocky_node_iter_next (WockyNodeIter *iter,
       return TRUE;
     }
 
-  iter->current = NULL;
+  iter->current = 0;
   return FALSE;
 }
 
@@ -1367,15 +1900,14 @@ void
 wocky_node_iter_remove (WockyNodeIter *iter)
 {
   g_return_if_fail (iter->node != NULL);
-  g_return_if_fail (iter->current != NULL);
+  g_return_if_fail (iter->current != 0);
+  g_return_if_fail (!iter->node->sealed);
 
-  g_assert (iter->current->data != NULL);
-  wocky_node_free (iter->current->data);
+  remove_child (iter->node, iter->current - 1);
 
-  iter->node->children = g_slist_delete_link (iter->node->children,
-      iter->current);
-
-  iter->current = NULL;
+  /* the children after it have moved down by one */
+  iter->pending = iter->current - 1;
+  iter->current = 0;
 }
 
 /**
@@ -1418,6 +1950,8 @@ wocky_node_add_build_va (WockyNode *node, va_list ap)
   GSList *stack = NULL;
   WockyNodeBuildTag arg;
 
+  g_return_if_fail (!node->sealed);
+
   stack = g_slist_prepend (stack, node);
 
   while ((arg = va_arg (ap, WockyNodeBuildTag)) != 0)
@@ -1463,7 +1997,7 @@ wocky_node_add_build_va (WockyNode *node, va_list ap)
 
             g_assert (ns != NULL);
             g_assert (stack != NULL);
-            ((WockyNode *) stack->data)->ns = g_quark_from_string (ns);
+            ((WockyNode *) stack->data)->ns = _wocky_intern_quark (ns);
           }
           break;
 
@@ -1522,35 +2056,103 @@ wocky_node_add_build_va (WockyNode *node, va_list ap)
   g_slist_free (stack);
 }
 
-WockyNode *
-_wocky_node_copy (WockyNode *node)
+static WockyNode *
+copy_node (WockyNode *node,
+    gboolean share_sealed)
 {
-  WockyNode *result = new_node (node->name, node->ns);
-  GSList *l;
+  WockyNode *result = new_node_take_name (
+      _wocky_intern_or_dup (node->name), node->ns);
+  guint i;
 
   result->content = g_strdup (node->content);
   result->language = g_strdup (node->language);
 
-  for (l = node->attributes ; l != NULL; l = g_slist_next (l))
+  for (i = 0; i < node->n_attributes; i++)
     {
-      Attribute *a = l->data;
-      Attribute *b = g_slice_new0 (Attribute);
+      Attribute *a = (Attribute *) node->attributes + i;
+      Attribute *b = append_attribute (result);
 
-      b->key = g_strdup (a->key);
+      b->key = _wocky_intern_or_dup (a->key);
       b->value = g_strdup (a->value);
-      b->prefix = g_strdup (a->prefix);
+      b->prefix = (a->prefix != NULL) ?
+          _wocky_intern_or_dup (a->prefix) : NULL;
       b->ns = a->ns;
-
-      result->attributes = g_slist_append (result->attributes, b);
     }
 
-  for (l = node->children ; l != NULL; l = g_slist_next (l))
-    result->children = g_slist_append (result->children,
-      _wocky_node_copy ((WockyNode *) l->data));
+  for (i = 0; i < n_children (node); i++)
+    {
+      WockyNode *child = nth_child (node, i);
+
+      append_child (result, (share_sealed && child->sealed) ?
+          node_ref (child) : copy_node (child, share_sealed));
+    }
 
   return result;
 }
 
+/* The copy itself is never sealed, but shares any sealed children of
+ * @node rather than copying them. */
+WockyNode *
+_wocky_node_copy (WockyNode *node)
+{
+  return copy_node (node, TRUE);
+}
+
+/* Copies all of @node, sealed or not, so that none of the copy is sealed */
+WockyNode *
+_wocky_node_copy_deep (WockyNode *node)
+{
+  return copy_node (node, FALSE);
+}
+
+/* Takes ownership of @child, which mustn't have a parent already. */
+void
+_wocky_node_append_child (WockyNode *node,
+    WockyNode *child)
+{
+  g_return_if_fail (!node->sealed);
+
+  append_child (node, child);
+}
+
+/* Borrowed; only valid until @node's children are next changed. */
+WockyNode **
+_wocky_node_get_children (WockyNode *node,
+    guint *n)
+{
+  Children *children = node->children;
+
+  *n = n_children (node);
+  return (children != NULL) ? children->nodes : NULL;
+}
+
+/* @key should be interned with _wocky_intern_permanent() or
+ * _wocky_intern_static(), so that it's usually compared by address. Any
+ * namespace matches. */
+const gchar *
+_wocky_node_get_attribute_interned (WockyNode *node,
+    const gchar *key)
+{
+  Attribute *attributes = node->attributes;
+  guint i;
+
+  for (i = 0; i < node->n_attributes; i++)
+    if (_wocky_intern_equal (attributes[i].key, key))
+      return attributes[i].value;
+
+  return NULL;
+}
+
+/* Frees the last of @node's children, which must have some. */
+void
+_wocky_node_remove_last_child (WockyNode *node)
+{
+  g_return_if_fail (n_children (node) > 0);
+  g_return_if_fail (!node->sealed);
+
+  remove_child (node, n_children (node) - 1);
+}
+
 /**
  * wocky_node_add_node_tree:
  * @node: A node
@@ -1567,9 +2169,10 @@ wocky_node_add_node_tree (WockyNode *node, WockyNodeTree *tree)
 
   g_return_val_if_fail (node != NULL, NULL);
   g_return_val_if_fail (tree != NULL, NULL);
+  g_return_val_if_fail (!node->sealed, NULL);
 
   copy = _wocky_node_copy (wocky_node_tree_get_top_node (tree));
-  node->children = g_slist_append (node->children, copy);
+  append_child (node, copy);
 
   return copy;
 }
@@ -1593,13 +2196,490 @@ wocky_node_prepend_node_tree (
 
   g_return_val_if_fail (node != NULL, NULL);
   g_return_val_if_fail (tree != NULL, NULL);
+  g_return_val_if_fail (!node->sealed, NULL);
 
   copy = _wocky_node_copy (wocky_node_tree_get_top_node (tree));
-  node->children = g_slist_prepend (node->children, copy);
+  prepend_child (node, copy);
 
   return copy;
 }
 
+/* Binary encoding of node trees, used to store them more compactly than as
+ * XML and to load them without going through libxml2. All numbers are
+ * unsigned LEB128.
+ *
+ *   header:     'W' 'N' 'T' NODE_ENCODING_VERSION
+ *   strings:    count, then (length, bytes) for each distinct element name,
+ *               namespace, attribute key, attribute prefix and language
+ *   top node:   name, namespace + 1, language + 1 (indices into the string
+ *               table, 0 meaning none), content length + 1 (0 meaning no
+ *               content) followed by the content, attribute count, then
+ *               (key, namespace + 1, prefix + 1, value length, value) for
+ *               each attribute, child count, then each child node
+ *
+ * Anything other than exactly that is rejected. The strings aren't
+ * re-validated as UTF-8 when decoding, since they were when the tree was
+ * built.
+ */
+#define NODE_ENCODING_VERSION 1
+#define NODE_ENCODING_HEADER_LEN 4
+#define NODE_ENCODING_MAX_DEPTH 256
+
+typedef struct {
+  /* const gchar * => index + 1 */
+  GHashTable *indices;
+  /* borrowed from the tree, or quark strings */
+  GPtrArray *strings;
+  GByteArray *body;
+} NodeEncoder;
+
+static void
+encoder_write_uint (GByteArray *out,
+    guint value)
+{
+  guint8 byte;
+
+  do
+    {
+      byte = value & 0x7f;
+      value >>= 7;
+
+      if (value != 0)
+        byte |= 0x80;
+
+      g_byte_array_append (out, &byte, 1);
+    }
+  while (value != 0);
+}
+
+static void
+encoder_write_blob (GByteArray *out,
+    const gchar *data,
+    gsize len)
+{
+  encoder_write_uint (out, len);
+  g_byte_array_append (out, (const guint8 *) data, len);
+}
+
+/* Writes the index of @str in the string table, plus one; or 0 if @str is
+ * %NULL. */
+static void
+encoder_write_string (NodeEncoder *enc,
+    const gchar *str)
+{
+  guint idx;
+
+  if (str == NULL)
+    {
+      encoder_write_uint (enc->body, 0);
+      return;
+    }
+
+  idx = GPOINTER_TO_UINT (g_hash_table_lookup (enc->indices, str));
+
+  if (idx == 0)
+    {
+      g_ptr_array_add (enc->strings, (gpointer) str);
+      idx = enc->strings->len;
+      g_hash_table_insert (enc->indices, (gpointer) str,
+          GUINT_TO_POINTER (idx));
+    }
+
+  encoder_write_uint (enc->body, idx);
+}
+
+static void
+encoder_write_node (NodeEncoder *enc,
+    WockyNode *node)
+{
+  guint i;
+
+  /* The name is mandatory, so store it without the + 1 */
+  encoder_write_uint (enc->body,
+      GPOINTER_TO_UINT (g_hash_table_lookup (enc->indices, node->name)) - 1);
+  encoder_write_string (enc, node->ns != 0 ? g_quark_to_string (node->ns) :
+      NULL);
+  encoder_write_string (enc, node->language);
+
+  if (node->content == NULL)
+    {
+      encoder_write_uint (enc->body, 0);
+    }
+  else
+    {
+      gsize len = strlen (node->content);
+
+      encoder_write_uint (enc->body, len + 1);
+      g_byte_array_append (enc->body, (const guint8 *) node->content, len);
+    }
+
+  encoder_write_uint (enc->body, node->n_attributes);
+
+  for (i = 0; i < node->n_attributes; i++)
+    {
+      Attribute *a = (Attribute *) node->attributes + i;
+
+      encoder_write_uint (enc->body,
+          GPOINTER_TO_UINT (g_hash_table_lookup (enc->indices, a->key)) - 1);
+      encoder_write_string (enc, a->ns != 0 ? g_quark_to_string (a->ns) :
+          NULL);
+      encoder_write_string (enc, a->prefix);
+      encoder_write_blob (enc->body, a->value,
+          a->value != NULL ? strlen (a->value) : 0);
+    }
+
+  encoder_write_uint (enc->body, n_children (node));
+
+  for (i = 0; i < n_children (node); i++)
+    encoder_write_node (enc, nth_child (node, i));
+}
+
+/* Puts every name and attribute key in the string table, so
+ * encoder_write_node() can look them up without checking for NULL. */
+static void
+encoder_add_names (NodeEncoder *enc,
+    WockyNode *node)
+{
+  guint i;
+
+  if (!g_hash_table_contains (enc->indices, node->name))
+    {
+      g_ptr_array_add (enc->strings, node->name);
+      g_hash_table_insert (enc->indices, node->name,
+          GUINT_TO_POINTER (enc->strings->len));
+    }
+
+  for (i = 0; i < node->n_attributes; i++)
+    {
+      Attribute *a = (Attribute *) node->attributes + i;
+
+      if (!g_hash_table_contains (enc->indices, a->key))
+        {
+          g_ptr_array_add (enc->strings, (gpointer) a->key);
+          g_hash_table_insert (enc->indices, a->key,
+              GUINT_TO_POINTER (enc->strings->len));
+        }
+    }
+
+  for (i = 0; i < n_children (node); i++)
+    encoder_add_names (enc, nth_child (node, i));
+}
+
+GBytes *
+_wocky_node_encode (WockyNode *node)
+{
+  static const guint8 header[NODE_ENCODING_HEADER_LEN] =
+      { 'W', 'N', 'T', NODE_ENCODING_VERSION };
+  NodeEncoder enc;
+  GByteArray *out;
+  guint i;
+
+  enc.indices = g_hash_table_new (g_str_hash, g_str_equal);
+  enc.strings = g_ptr_array_new ();
+  enc.body = g_byte_array_new ();
+
+  encoder_add_names (&enc, node);
+  encoder_write_node (&enc, node);
+
+  out = g_byte_array_sized_new (enc.body->len + 16 * enc.strings->len);
+  g_byte_array_append (out, header, NODE_ENCODING_HEADER_LEN);
+  encoder_write_uint (out, enc.strings->len);
+
+  for (i = 0; i < enc.strings->len; i++)
+    {
+      const gchar *str = g_ptr_array_index (enc.strings, i);
+
+      encoder_write_blob (out, str, strlen (str));
+    }
+
+  g_byte_array_append (out, enc.body->data, enc.body->len);
+
+  g_byte_array_unref (enc.body);
+  g_ptr_array_unref (enc.strings);
+  g_hash_table_unref (enc.indices);
+
+  return g_byte_array_free_to_bytes (out);
+}
+
+typedef struct {
+  const guint8 *p;
+  const guint8 *end;
+
+  guint n_strings;
+  const guint8 **strings;
+  gsize *lengths;
+  /* filled in as the strings are used as namespaces */
+  GQuark *quarks;
+} NodeDecoder;
+
+static gboolean
+decoder_read_uint (NodeDecoder *dec,
+    guint *value)
+{
+  guint result = 0;
+  guint shift;
+
+  for (shift = 0; shift < 32 && dec->p < dec->end; shift += 7)
+    {
+      guint8 byte = *dec->p++;
+
+      result |= (guint) (byte & 0x7f) << shift;
+
+      if ((byte & 0x80) == 0)
+        {
+          *value = result;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static gboolean
+decoder_read_blob (NodeDecoder *dec,
+    const guint8 **data,
+    gsize *len)
+{
+  guint l;
+
+  if (!decoder_read_uint (dec, &l) || l > (gsize) (dec->end - dec->p))
+    return FALSE;
+
+  *data = dec->p;
+  *len = l;
+  dec->p += l;
+  return TRUE;
+}
+
+static gchar *
+decoder_dup (const guint8 *data,
+    gsize len)
+{
+  gchar *str = g_malloc (len + 1);
+
+  memcpy (str, data, len);
+  str[len] = '\0';
+  return str;
+}
+
+/* Reads a string table index. If @optional, 0 means none and @idx is set
+ * to G_MAXUINT. */
+static gboolean
+decoder_read_index (NodeDecoder *dec,
+    gboolean optional,
+    guint *idx)
+{
+  if (!decoder_read_uint (dec, idx))
+    return FALSE;
+
+  if (optional)
+    {
+      if (*idx == 0)
+        {
+          *idx = G_MAXUINT;
+          return TRUE;
+        }
+
+      (*idx)--;
+    }
+
+  return *idx < dec->n_strings;
+}
+
+static GQuark
+decoder_get_quark (NodeDecoder *dec,
+    guint idx)
+{
+  if (dec->quarks[idx] == 0)
+    {
+      gchar *str = decoder_dup (dec->strings[idx], dec->lengths[idx]);
+
+      dec->quarks[idx] = _wocky_intern_quark (str);
+      g_free (str);
+    }
+
+  return dec->quarks[idx];
+}
+
+static gboolean
+decoder_read_ns (NodeDecoder *dec,
+    GQuark *ns)
+{
+  guint idx;
+
+  if (!decoder_read_index (dec, TRUE, &idx))
+    return FALSE;
+
+  if (idx == G_MAXUINT)
+    *ns = 0;
+  else
+    *ns = decoder_get_quark (dec, idx);
+
+  return TRUE;
+}
+
+/* Like decoder_read_string(), but the string is interned if possible, and
+ * so must be given back with _wocky_intern_release() */
+static gboolean
+decoder_read_interned (NodeDecoder *dec,
+    gboolean optional,
+    gchar **str)
+{
+  guint idx;
+
+  if (!decoder_read_index (dec, optional, &idx))
+    return FALSE;
+
+  if (idx == G_MAXUINT)
+    *str = NULL;
+  else
+    *str = _wocky_intern_take (
+        decoder_dup (dec->strings[idx], dec->lengths[idx]));
+
+  return TRUE;
+}
+
+static gboolean
+decoder_read_string (NodeDecoder *dec,
+    gboolean optional,
+    gchar **str)
+{
+  guint idx;
+
+  if (!decoder_read_index (dec, optional, &idx))
+    return FALSE;
+
+  if (idx == G_MAXUINT)
+    *str = NULL;
+  else
+    *str = decoder_dup (dec->strings[idx], dec->lengths[idx]);
+
+  return TRUE;
+}
+
+static WockyNode *
+decoder_read_node (NodeDecoder *dec,
+    guint depth)
+{
+  WockyNode *node;
+  gchar *name;
+  guint content_len, n, i;
+
+  if (depth > NODE_ENCODING_MAX_DEPTH)
+    return NULL;
+
+  if (!decoder_read_interned (dec, FALSE, &name))
+    return NULL;
+
+  node = new_node_take_name (name, 0);
+
+  if (!decoder_read_ns (dec, &node->ns) ||
+      !decoder_read_string (dec, TRUE, &node->language) ||
+      !decoder_read_uint (dec, &content_len))
+    goto err;
+
+  if (content_len > 0)
+    {
+      content_len--;
+
+      if (content_len > (gsize) (dec->end - dec->p))
+        goto err;
+
+      node->content = decoder_dup (dec->p, content_len);
+      dec->p += content_len;
+    }
+
+  if (!decoder_read_uint (dec, &n))
+    goto err;
+
+  /* each attribute takes at least a byte */
+  if (n > (gsize) (dec->end - dec->p))
+    goto err;
+
+  for (i = 0; i < n; i++)
+    {
+      Attribute *a = append_attribute (node);
+      const guint8 *value;
+      gsize value_len;
+
+      a->key = NULL;
+      a->value = NULL;
+      a->prefix = NULL;
+
+      if (!decoder_read_interned (dec, FALSE, &a->key) ||
+          !decoder_read_ns (dec, &a->ns) ||
+          !decoder_read_interned (dec, TRUE, &a->prefix) ||
+          !decoder_read_blob (dec, &value, &value_len))
+        goto err;
+
+      a->value = decoder_dup (value, value_len);
+    }
+
+  if (!decoder_read_uint (dec, &n))
+    goto err;
+
+  for (i = 0; i < n; i++)
+    {
+      WockyNode *child = decoder_read_node (dec, depth + 1);
+
+      if (child == NULL)
+        goto err;
+
+      append_child (node, child);
+    }
+
+  return node;
+
+err:
+  wocky_node_free (node);
+  return NULL;
+}
+
+WockyNode *
+_wocky_node_decode (const guint8 *data,
+    gsize len)
+{
+  NodeDecoder dec = { data, data + len, 0, NULL, NULL, NULL };
+  WockyNode *node = NULL;
+  guint i;
+
+  if (len < NODE_ENCODING_HEADER_LEN ||
+      memcmp (data, "WNT", 3) != 0 ||
+      data[3] != NODE_ENCODING_VERSION)
+    return NULL;
+
+  dec.p += NODE_ENCODING_HEADER_LEN;
+
+  /* Every string takes at least one byte, which bounds the allocation */
+  if (!decoder_read_uint (&dec, &dec.n_strings) ||
+      dec.n_strings > (gsize) (dec.end - dec.p))
+    return NULL;
+
+  dec.strings = g_new (const guint8 *, dec.n_strings);
+  dec.lengths = g_new (gsize, dec.n_strings);
+  dec.quarks = g_new0 (GQuark, dec.n_strings);
+
+  for (i = 0; i < dec.n_strings; i++)
+    {
+      if (!decoder_read_blob (&dec, dec.strings + i, dec.lengths + i))
+        goto out;
+    }
+
+  node = decoder_read_node (&dec, 0);
+
+  if (node != NULL && dec.p != dec.end)
+    {
+      wocky_node_free (node);
+      node = NULL;
+    }
+
+out:
+  g_free (dec.strings);
+  g_free (dec.lengths);
+  g_free (dec.quarks);
+  return node;
+}
+
 /**
  * wocky_node_init:
  *
@@ -1609,8 +2689,9 @@ wocky_node_prepend_node_tree (
 void
 wocky_node_init ()
 {
-  _init_user_prefix_table ();
-  _init_default_prefix_table ();
+  g_mutex_lock (&prefixes_lock);
+  _init_prefix_table ();
+  g_mutex_unlock (&prefixes_lock);
 }
 
 /**
@@ -1621,6 +2702,10 @@ wocky_node_init ()
 void
 wocky_node_deinit ()
 {
-  g_hash_table_unref (user_ns_prefixes);
-  g_hash_table_unref (default_ns_prefixes);
+  g_mutex_lock (&prefixes_lock);
+  g_free (prefixes);
+  prefixes = NULL;
+  g_slist_free_full (retired_prefixes, g_free);
+  retired_prefixes = NULL;
+  g_mutex_unlock (&prefixes_lock);
 }
@@ -58,7 +58,9 @@ typedef struct _WockyNode WockyNode;
 
 /**
  * WockyNode:
- * @name: name of the node
+ * @name: name of the node. Nodes with the same name usually share it, but
+ *  names must still be compared with strcmp() or similar. The name must not
+ *  be modified or freed.
  * @content: content of the node
  *
  * A single #WockyNode structure that relates to an element in an XMPP
@@ -71,8 +73,12 @@ struct _WockyNode {
   /*< private >*/
   gchar *language;
   GQuark ns;
-  GSList *attributes;
-  GSList *children;
+  guint n_attributes;
+  gpointer attributes;
+  gpointer children;
+  gint ref_count;
+  gboolean sealed;
+  guint serial;
 };
 
 /**
@@ -114,6 +120,9 @@ const gchar *wocky_node_get_attribute (WockyNode *node,
 const gchar *wocky_node_get_attribute_ns (WockyNode *node,
     const gchar *key, const gchar *ns);
 
+const gchar *wocky_node_get_attribute_ns_q (WockyNode *node,
+    const gchar *key, GQuark ns);
+
 void  wocky_node_set_attribute (WockyNode *node, const gchar *key,
     const gchar *value);
 
@@ -142,7 +151,11 @@ WockyNode *wocky_node_get_child (WockyNode *node,
 WockyNode *wocky_node_get_child_ns (WockyNode *node,
     const gchar *name, const gchar *ns);
 
+WockyNode *wocky_node_get_child_ns_q (WockyNode *node,
+    const gchar *name, GQuark ns);
+
 WockyNode *wocky_node_get_first_child (WockyNode *node);
+guint wocky_node_get_n_children (WockyNode *node);
 WockyNode *wocky_node_get_first_child_ns (WockyNode *node,
     const gchar *ns);
 
@@ -215,6 +228,11 @@ WockyNode *wocky_node_new (const char *name, const gchar *ns);
 /* Frees the node and all it's children! */
 void wocky_node_free (WockyNode *node);
 
+void wocky_node_seal (WockyNode *node);
+gboolean wocky_node_is_sealed (WockyNode *node);
+WockyNode *wocky_node_make_child_writable (WockyNode *node,
+    WockyNode *child);
+
 /* Compare two nodes and all their children */
 gboolean wocky_node_equal (WockyNode *node0,
     WockyNode *node1);
@@ -231,8 +249,8 @@ gboolean wocky_node_is_superset (WockyNode *node,
 typedef struct {
   /*<private>*/
   WockyNode *node;
-  GSList *pending;
-  GSList *current;
+  guint pending;
+  guint current;
   const gchar *name;
   GQuark ns;
 } WockyNodeIter;
@@ -126,7 +126,9 @@ wocky_porter_default_init (WockyPorterInterface *iface)
        *    sending whitespace
        *
        * The ::sending signal is emitted whenever #WockyPorter sends data
-       * on the XMPP connection.
+       * on the XMPP connection. A stanza sent with
+       * wocky_porter_send_multicast_async() is reported once per
+       * recipient, with @stanza addressed to that recipient.
        */
       g_signal_new ("sending", iface_type,
           G_SIGNAL_RUN_LAST, 0, NULL, NULL,
@@ -315,6 +317,190 @@ wocky_porter_send (WockyPorter *porter,
   wocky_porter_send_async (porter, stanza, NULL, NULL, NULL);
 }
 
+typedef struct {
+    GTask *task;
+    guint pending;
+    GError *first_error /* owned, NULL until a send fails */;
+} MulticastData;
+
+static void
+default_multicast_sent_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  MulticastData *data = user_data;
+  GError *error = NULL;
+
+  if (!wocky_porter_send_finish (WOCKY_PORTER (source), result, &error))
+    {
+      /* report the first error, but carry on with the other recipients */
+      if (data->first_error == NULL)
+        data->first_error = error;
+      else
+        g_error_free (error);
+    }
+
+  if (--data->pending > 0)
+    return;
+
+  if (data->first_error != NULL)
+    g_task_return_error (data->task, data->first_error);
+  else
+    g_task_return_boolean (data->task, TRUE);
+
+  g_object_unref (data->task);
+  g_slice_free (MulticastData, data);
+}
+
+/* Used by porters which don't implement send_multicast_async: send a copy
+ * of the stanza, addressed to each recipient in turn. */
+static void
+default_send_multicast_async (WockyPorter *self,
+    WockyStanza *stanza,
+    const gchar * const *recipients,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  MulticastData *data = g_slice_new0 (MulticastData);
+  guint i;
+
+  data->task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (data->task, wocky_porter_send_multicast_async);
+
+  if (recipients[0] == NULL)
+    {
+      g_task_return_boolean (data->task, TRUE);
+      g_object_unref (data->task);
+      g_slice_free (MulticastData, data);
+      return;
+    }
+
+  /* count every recipient up front, so the operation can't complete while
+   * we're still queueing the copies */
+  data->pending = g_strv_length ((gchar **) recipients);
+
+  for (i = 0; recipients[i] != NULL; i++)
+    {
+      WockyStanza *copy = wocky_stanza_copy (stanza);
+
+      wocky_node_set_attribute (wocky_stanza_get_top_node (copy), "to",
+          recipients[i]);
+      wocky_porter_send_async (self, copy, cancellable,
+          default_multicast_sent_cb, data);
+      g_object_unref (copy);
+    }
+}
+
+/**
+ * wocky_porter_send_multicast_async:
+ * @porter: a #WockyPorter
+ * @stanza: the #WockyStanza to send
+ * @recipients: a %NULL-terminated array of JIDs to send @stanza to
+ * @cancellable: optional #GCancellable object, %NULL <!-- --> to ignore
+ * @callback: callback to call when the request is satisfied
+ * @user_data: the data to pass to callback function
+ *
+ * Request asynchronous sending of a #WockyStanza to each of @recipients in
+ * turn, as if by calling wocky_porter_send_async() once for each of them
+ * with the stanza's "to" attribute set to their JID. The stanza is only
+ * serialized once, and its "to" attribute is ignored, so this is much
+ * cheaper than sending it to each recipient separately. Porters which
+ * don't implement this themselves fall back to sending a copy of @stanza
+ * to each recipient with wocky_porter_send_async().
+ *
+ * #WockyPorter::sending is emitted once per recipient, with a stanza
+ * addressed to that recipient.
+ *
+ * When the stanza has been sent to every recipient, or has failed to be,
+ * @callback will be called. You can then call
+ * wocky_porter_send_multicast_finish() to get the result of the operation.
+ */
+void
+wocky_porter_send_multicast_async (WockyPorter *self,
+    WockyStanza *stanza,
+    const gchar * const *recipients,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockyPorterInterface *iface;
+
+  g_return_if_fail (WOCKY_IS_PORTER (self));
+  g_return_if_fail (recipients != NULL);
+
+  iface = WOCKY_PORTER_GET_INTERFACE (self);
+
+  if (iface->send_multicast_async == NULL)
+    {
+      default_send_multicast_async (self, stanza, recipients, cancellable,
+          callback, user_data);
+      return;
+    }
+
+  iface->send_multicast_async (self, stanza, recipients, cancellable,
+      callback, user_data);
+}
+
+/**
+ * wocky_porter_send_multicast_finish:
+ * @porter: a #WockyPorter
+ * @result: a #GAsyncResult
+ * @error: a #GError location to store the error occuring, or %NULL <!-- -->to
+ * ignore.
+ *
+ * Finishes sending a #WockyStanza to several recipients.
+ *
+ * Returns: %TRUE if the stanza was sent to every recipient, or %FALSE if it
+ *  could not be sent to at least one of them, in which case @error is set
+ *  to the first error encountered.
+ */
+gboolean
+wocky_porter_send_multicast_finish (WockyPorter *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  WockyPorterInterface *iface;
+
+  g_return_val_if_fail (WOCKY_IS_PORTER (self), FALSE);
+
+  iface = WOCKY_PORTER_GET_INTERFACE (self);
+
+  if (iface->send_multicast_finish == NULL)
+    {
+      g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+      g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) ==
+          wocky_porter_send_multicast_async, FALSE);
+
+      return g_task_propagate_boolean (G_TASK (result), error);
+    }
+
+  return iface->send_multicast_finish (self, result, error);
+}
+
+/**
+ * wocky_porter_flush:
+ * @porter: a #WockyPorter
+ *
+ * Starts sending any stanzas which the porter is holding back so as to
+ * batch them together with the next ones (see wocky_c2s_porter_set_cork()),
+ * without waiting for more. Senders for whom latency matters more than the
+ * number of writes should call this after queueing their stanzas.
+ */
+void
+wocky_porter_flush (WockyPorter *self)
+{
+  WockyPorterInterface *iface;
+
+  g_return_if_fail (WOCKY_IS_PORTER (self));
+
+  iface = WOCKY_PORTER_GET_INTERFACE (self);
+
+  /* porters which never hold stanzas back have nothing to do */
+  if (iface->flush != NULL)
+    iface->flush (self);
+}
+
 
 /**
  * wocky_porter_register_handler_from_va:
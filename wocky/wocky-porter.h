@@ -142,6 +142,14 @@ typedef gboolean (* WockyPorterHandlerFunc) (
  *   operation; see wocky_porter_force_close_async() for more details.
  * @force_close_finish: Finish an asynchronous porter force close
  *   operation; see wocky_porter_force_close_finish() for more details.
+ * @send_multicast_async: Start an asynchronous operation sending a stanza to
+ *   several recipients; see wocky_porter_send_multicast_async() for more
+ *   details.
+ * @send_multicast_finish: Finish an asynchronous operation sending a
+ *   stanza to several recipients; see wocky_porter_send_multicast_finish()
+ *   for more details.
+ * @flush: Send any stanzas which are being held back to be batched together
+ *   straight away; see wocky_porter_flush() for more details.
  *
  * The vtable for a porter implementation.
  */
@@ -214,6 +222,19 @@ struct _WockyPorterInterface
   gboolean (*force_close_finish) (WockyPorter *porter,
       GAsyncResult *result,
       GError **error);
+
+  void (*send_multicast_async) (WockyPorter *porter,
+      WockyStanza *stanza,
+      const gchar * const *recipients,
+      GCancellable *cancellable,
+      GAsyncReadyCallback callback,
+      gpointer user_data);
+
+  gboolean (*send_multicast_finish) (WockyPorter *porter,
+      GAsyncResult *result,
+      GError **error);
+
+  void (*flush) (WockyPorter *porter);
 };
 
 void wocky_porter_start (WockyPorter *porter);
@@ -236,6 +257,20 @@ gboolean wocky_porter_send_finish (
 void wocky_porter_send (WockyPorter *porter,
     WockyStanza *stanza);
 
+void wocky_porter_send_multicast_async (WockyPorter *porter,
+    WockyStanza *stanza,
+    const gchar * const *recipients,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+gboolean wocky_porter_send_multicast_finish (
+    WockyPorter *porter,
+    GAsyncResult *result,
+    GError **error);
+
+void wocky_porter_flush (WockyPorter *porter);
+
 guint wocky_porter_register_handler_from_va (WockyPorter *self,
     WockyStanzaType type,
     WockyStanzaSubType sub_type,
@@ -198,6 +198,7 @@ wocky_send_ll_pep_event (WockySession *session,
   WockyLLContact *self_contact;
   GList *contacts, *l;
   WockyNode *message, *event, *items;
+  WockyStanza *shared;
   const gchar *pep_node;
   gchar *node;
 
@@ -220,6 +221,11 @@ wocky_send_ll_pep_event (WockySession *session,
 
   contacts = wocky_contact_factory_get_ll_contacts (contact_factory);
 
+  /* Everyone gets the same event, with a different 'to': seal a copy, so
+   * the copy made for each contact only has its own top node. */
+  shared = wocky_stanza_copy (stanza);
+  wocky_node_seal (wocky_stanza_get_top_node (shared));
+
   for (l = contacts; l != NULL; l = l->next)
     {
       WockyXep0115Capabilities *contact;
@@ -230,15 +236,16 @@ wocky_send_ll_pep_event (WockySession *session,
       contact = l->data;
 
       if (wocky_xep_0115_capabilities_has_feature (contact, node))
-        send_stanza_to_contact (porter, WOCKY_CONTACT (contact), stanza);
+        send_stanza_to_contact (porter, WOCKY_CONTACT (contact), shared);
     }
 
   /* now send to self */
   self_contact = wocky_contact_factory_ensure_ll_contact (contact_factory,
       wocky_porter_get_full_jid (porter));
 
-  send_stanza_to_contact (porter, WOCKY_CONTACT (self_contact), stanza);
+  send_stanza_to_contact (porter, WOCKY_CONTACT (self_contact), shared);
 
+  g_object_unref (shared);
   g_object_unref (self_contact);
   g_list_free (contacts);
   g_free (node);
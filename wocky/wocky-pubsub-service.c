@@ -31,6 +31,7 @@
 #include "wocky-pubsub-node-protected.h"
 #include "wocky-pubsub-node-internal.h"
 #include "wocky-namespaces.h"
+#include "wocky-node-query.h"
 #include "wocky-signals-marshal.h"
 
 #define WOCKY_DEBUG_FLAG WOCKY_DEBUG_PUBSUB
@@ -63,10 +64,16 @@ typedef struct _EventTrampoline EventTrampoline;
 struct _EventTrampoline
 {
   const WockyPubsubNodeEventMapping *mapping;
+  /* finds mapping->action below <event/> */
+  WockyNodeQuery *action_query;
   WockyPubsubService *self;
   guint handler_id;
 };
 
+/* Compiled in class_init */
+static WockyNodeQuery *event_query = NULL;
+static WockyNodeQuery *node_name_query = NULL;
+
 struct _WockyPubsubServicePrivate
 {
   WockySession *session;
@@ -170,6 +177,7 @@ wocky_pubsub_service_dispose (GObject *object)
           EventTrampoline *t = g_ptr_array_index (priv->trampolines, i);
 
           wocky_porter_unregister_handler (priv->porter, t->handler_id);
+          wocky_node_query_unref (t->action_query);
           g_slice_free (EventTrampoline, t);
         }
 
@@ -218,6 +226,7 @@ wocky_pubsub_service_constructed (GObject *object)
       EventTrampoline *t = g_slice_new (EventTrampoline);
 
       t->mapping = m;
+      t->action_query = wocky_node_query_new (m->action, NULL);
       t->self = self;
       t->handler_id = wocky_porter_register_handler_from (priv->porter,
           WOCKY_STANZA_TYPE_MESSAGE, WOCKY_STANZA_SUB_TYPE_NONE,
@@ -248,6 +257,10 @@ wocky_pubsub_service_class_init (
   object_class->finalize = wocky_pubsub_service_finalize;
   object_class->constructed = wocky_pubsub_service_constructed;
 
+  event_query = wocky_node_query_new (
+      "{" WOCKY_XMPP_NS_PUBSUB_EVENT "}event", NULL);
+  node_name_query = wocky_node_query_new ("@node", NULL);
+
   param_spec = g_param_spec_object ("session", "session",
       "the Wocky Session associated with this pubsub service",
       WOCKY_TYPE_SESSION,
@@ -481,15 +494,14 @@ pubsub_service_propagate_event (WockyPorter *porter,
 
   g_assert (WOCKY_IS_PUBSUB_SERVICE (self));
 
-  event_node = wocky_node_get_child_ns (
-      wocky_stanza_get_top_node (event_stanza), "event",
-        WOCKY_XMPP_NS_PUBSUB_EVENT);
+  event_node = wocky_node_query_get_node (event_query,
+      wocky_stanza_get_top_node (event_stanza));
   g_return_val_if_fail (event_node != NULL, FALSE);
-  action_node = wocky_node_get_child (event_node,
-      trampoline->mapping->action);
+  action_node = wocky_node_query_get_node (trampoline->action_query,
+      event_node);
   g_return_val_if_fail (action_node != NULL, FALSE);
 
-  node_name = wocky_node_get_attribute (action_node, "node");
+  node_name = wocky_node_query_get_value (node_name_query, action_node);
 
   if (node_name == NULL)
     {
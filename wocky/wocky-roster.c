@@ -45,6 +45,7 @@
 #include "wocky-contact-factory.h"
 #include "wocky-porter.h"
 #include "wocky-session.h"
+#include "wocky-intern-internal.h"
 
 #define WOCKY_DEBUG_FLAG WOCKY_DEBUG_ROSTER
 #include "wocky-debug-internal.h"
@@ -245,6 +246,7 @@ struct _WockyRosterPrivate
   /* owned (gchar *) => reffed (WockyBareContact *) */
   GHashTable *items;
   guint iq_cb;
+  guint stream_cb;
 
   /* owned (gchar *) => owned (PendingOperation *)
    * When an edit attempt is "in-flight", we store a PendingOperation * in
@@ -253,6 +255,12 @@ struct _WockyRosterPrivate
   GHashTable *pending_operations;
 
   GTask *fetch_task;
+  /* the id of the roster fetch IQ, whose reply's items are streamed */
+  gchar *fetch_id;
+  /* owned (RosterItem *), the items streamed so far from the reply to the
+   * roster fetch. They are only applied once the reply is dispatched, after
+   * any stanzas received before it. */
+  GPtrArray *fetched_items;
 
   gboolean dispose_has_run;
 };
@@ -372,15 +380,175 @@ remove_item (WockyRoster *self,
   g_object_unref (contact);
 }
 
+/* A roster item, as read from an <item/> */
+typedef struct {
+  gchar *jid;
+  gchar *name;
+  /* TRUE if the subscription is "remove", in which case the rest is unset */
+  gboolean remove;
+  WockyRosterSubscriptionFlags subscription;
+  GStrv groups;
+} RosterItem;
+
+static void
+roster_item_free (gpointer data)
+{
+  RosterItem *item = data;
+
+  g_free (item->jid);
+  g_free (item->name);
+  g_strfreev (item->groups);
+  g_slice_free (RosterItem, item);
+}
+
+/* Returns NULL if @n isn't a valid item */
+static RosterItem *
+roster_item_parse (WockyNode *n)
+{
+  RosterItem *item;
+  const gchar *jid;
+  const gchar *subscription;
+  WockyRosterSubscriptionFlags subscription_type = 0;
+  gboolean remove = FALSE;
+  GPtrArray *groups_arr;
+  WockyNodeIter group_iter;
+  WockyNode *node;
+  /* node names are usually interned, so these needn't be strcmp()ed */
+  const gchar *item_name = _wocky_intern_static ("item");
+  const gchar *group_name = _wocky_intern_static ("group");
+
+  if (!_wocky_intern_equal (n->name, item_name))
+    {
+      DEBUG ("Node %s is not item, skipping", n->name);
+      return NULL;
+    }
+
+  jid = wocky_node_get_attribute (n, "jid");
+
+  if (jid == NULL)
+    {
+      DEBUG ("Node %s has no jid attribute, skipping", n->name);
+      return NULL;
+    }
+
+  if (strchr (jid, '/') != NULL)
+    {
+      DEBUG ("Item node has resource in jid, skipping");
+      return NULL;
+    }
+
+  /* Parse item. */
+  subscription = wocky_node_get_attribute (n, "subscription");
+
+  if (!wocky_strdiff (subscription, "to"))
+    subscription_type = WOCKY_ROSTER_SUBSCRIPTION_TYPE_TO;
+  else if (!wocky_strdiff (subscription, "from"))
+    subscription_type = WOCKY_ROSTER_SUBSCRIPTION_TYPE_FROM;
+  else if (!wocky_strdiff (subscription, "both"))
+    subscription_type = WOCKY_ROSTER_SUBSCRIPTION_TYPE_BOTH;
+  else if (!wocky_strdiff (subscription, "none"))
+    subscription_type = WOCKY_ROSTER_SUBSCRIPTION_TYPE_NONE;
+  else if (!wocky_strdiff (subscription, "remove"))
+    remove = TRUE;
+  else
+    {
+      DEBUG ("Unknown subscription: %s; ignoring", subscription);
+      return NULL;
+    }
+
+  item = g_slice_new0 (RosterItem);
+  item->jid = g_strdup (jid);
+  item->remove = remove;
+
+  if (remove)
+    return item;
+
+  item->name = g_strdup (wocky_node_get_attribute (n, "name"));
+  item->subscription = subscription_type;
+
+  groups_arr = g_ptr_array_new ();
+
+  /* Look for "group" nodes */
+  wocky_node_iter_init (&group_iter, n, group_name, NULL);
+  while (wocky_node_iter_next (&group_iter, &node))
+    g_ptr_array_add (groups_arr, g_strdup (node->content));
+
+  /* Add trailing NULL */
+  g_ptr_array_add (groups_arr, NULL);
+  item->groups = (GStrv) g_ptr_array_free (groups_arr, FALSE);
+
+  return item;
+}
+
+static void
+roster_apply_item (WockyRoster *self,
+    const RosterItem *item,
+    gboolean fire_signals)
+{
+  WockyRosterPrivate *priv = self->priv;
+  WockyBareContact *contact = NULL;
+
+  if (item->remove)
+    {
+      remove_item (self, item->jid);
+      return;
+    }
+
+  contact = g_hash_table_lookup (priv->items, item->jid);
+  if (contact != NULL)
+    {
+      /* Contact already exists; update. */
+      wocky_bare_contact_set_name (contact, item->name);
+
+      wocky_bare_contact_set_subscription (contact, item->subscription);
+
+      wocky_bare_contact_set_groups (contact, item->groups);
+    }
+  else
+    {
+      /* Create a new contact. */
+      contact = wocky_contact_factory_ensure_bare_contact (
+          priv->contact_factory, item->jid);
+
+      g_object_set (contact,
+          "name", item->name,
+          "subscription", item->subscription,
+          "groups", item->groups,
+          NULL);
+
+      g_hash_table_insert (priv->items, g_strdup (item->jid), contact);
+
+      DEBUG ("New contact added:");
+      wocky_bare_contact_debug_print (contact);
+
+      if (fire_signals)
+        g_signal_emit (self, signals[ADDED], 0, contact);
+    }
+}
+
+static void
+roster_update_item (WockyRoster *self,
+    WockyNode *n,
+    gboolean fire_signals)
+{
+  RosterItem *item = roster_item_parse (n);
+
+  if (item == NULL)
+    return;
+
+  roster_apply_item (self, item, fire_signals);
+  roster_item_free (item);
+}
+
 static gboolean
 roster_update (WockyRoster *self,
     WockyStanza *stanza,
     gboolean fire_signals,
     GError **error)
 {
-  WockyRosterPrivate *priv = self->priv;
   WockyNode *query_node;
-  GSList *j;
+  WockyNodeIter iter;
+  WockyNode *n;
 
   /* Check stanza contains query node. */
   query_node = wocky_node_get_child_ns (
@@ -396,109 +564,47 @@ roster_update (WockyRoster *self,
     }
 
   /* Iterate through item nodes. */
-  for (j = query_node->children; j; j = j->next)
-    {
-      const gchar *jid;
-      WockyNode *n = (WockyNode *) j->data;
-      WockyBareContact *contact = NULL;
-      const gchar *subscription;
-      WockyRosterSubscriptionFlags subscription_type;
-      GPtrArray *groups_arr;
-      GStrv groups = { NULL };
-      GSList *l;
-
-      if (wocky_strdiff (n->name, "item"))
-        {
-          DEBUG ("Node %s is not item, skipping", n->name);
-          continue;
-        }
-
-      jid = wocky_node_get_attribute (n, "jid");
-
-      if (jid == NULL)
-        {
-          DEBUG ("Node %s has no jid attribute, skipping", n->name);
-          continue;
-        }
-
-      if (strchr (jid, '/') != NULL)
-        {
-          DEBUG ("Item node has resource in jid, skipping");
-          continue;
-        }
-
-      /* Parse item. */
-      subscription = wocky_node_get_attribute (n, "subscription");
-
-      if (!wocky_strdiff (subscription, "to"))
-        subscription_type = WOCKY_ROSTER_SUBSCRIPTION_TYPE_TO;
-      else if (!wocky_strdiff (subscription, "from"))
-        subscription_type = WOCKY_ROSTER_SUBSCRIPTION_TYPE_FROM;
-      else if (!wocky_strdiff (subscription, "both"))
-        subscription_type = WOCKY_ROSTER_SUBSCRIPTION_TYPE_BOTH;
-      else if (!wocky_strdiff (subscription, "none"))
-        subscription_type = WOCKY_ROSTER_SUBSCRIPTION_TYPE_NONE;
-      else if (!wocky_strdiff (subscription, "remove"))
-        {
-          remove_item (self, jid);
-          continue;
-        }
-      else
-        {
-          DEBUG ("Unknown subscription: %s; ignoring", subscription);
-          continue;
-        }
-
-      groups_arr = g_ptr_array_new ();
-
-      /* Look for "group" nodes */
-      for (l = n->children; l != NULL; l = g_slist_next (l))
-        {
-          WockyNode *node = (WockyNode *) l->data;
-
-          if (wocky_strdiff (node->name, "group"))
-            continue;
-
-          g_ptr_array_add (groups_arr, g_strdup (node->content));
-        }
-
-      /* Add trailing NULL */
-      g_ptr_array_add (groups_arr, NULL);
-      groups = (GStrv) g_ptr_array_free (groups_arr, FALSE);
+  wocky_node_iter_init (&iter, query_node, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &n))
+    roster_update_item (self, n, fire_signals);
 
-      contact = g_hash_table_lookup (priv->items, jid);
-      if (contact != NULL)
-        {
-          /* Contact already exists; update. */
-          wocky_bare_contact_set_name (contact,
-              wocky_node_get_attribute (n, "name"));
-
-          wocky_bare_contact_set_subscription (contact, subscription_type);
+  return TRUE;
+}
 
-          wocky_bare_contact_set_groups (contact, groups);
-        }
-      else
-        {
-          /* Create a new contact. */
-          contact = wocky_contact_factory_ensure_bare_contact (
-              priv->contact_factory, jid);
+/* Parses the items of the reply to our roster fetch as they are read, so
+ * that a large roster is never held in memory as a whole, only the contacts
+ * it describes. The reply itself still reaches roster_fetch_roster_cb(),
+ * without the items seen here; that's where they are applied, so that any
+ * roster pushes received before the reply are applied before it too. */
+static gboolean
+roster_stream_item_cb (WockyStanza *stanza,
+    WockyNode *item,
+    gpointer user_data)
+{
+  WockyRoster *self = WOCKY_ROSTER (user_data);
+  WockyRosterPrivate *priv = self->priv;
+  RosterItem *parsed;
 
-          g_object_set (contact,
-              "name", wocky_node_get_attribute (n, "name"),
-              "subscription", subscription_type,
-              "groups", groups,
-              NULL);
+  /* the reply starts: is it the one we're waiting for? */
+  if (item == NULL)
+    {
+      WockyNode *top = wocky_stanza_get_top_node (stanza);
 
-          g_hash_table_insert (priv->items, g_strdup (jid), contact);
+      return priv->fetch_id != NULL &&
+          !wocky_strdiff (wocky_node_get_attribute (top, "id"),
+              priv->fetch_id) &&
+          !wocky_strdiff (wocky_node_get_attribute (top, "type"), "result");
+    }
 
-          DEBUG ("New contact added:");
-          wocky_bare_contact_debug_print (contact);
+  parsed = roster_item_parse (item);
 
-          if (fire_signals)
-            g_signal_emit (self, signals[ADDED], 0, contact);
-        }
+  if (parsed != NULL)
+    {
+      if (priv->fetched_items == NULL)
+        priv->fetched_items = g_ptr_array_new_with_free_func (
+            roster_item_free);
 
-      g_strfreev (groups);
+      g_ptr_array_add (priv->fetched_items, parsed);
     }
 
   return TRUE;
@@ -561,6 +667,13 @@ wocky_roster_constructed (GObject *object)
         ':', WOCKY_XMPP_NS_ROSTER,
       ')', NULL);
 
+  /* Other porters can't stream, so the fetch reply is read whole */
+  if (WOCKY_IS_C2S_PORTER (priv->porter))
+    priv->stream_cb = wocky_c2s_porter_add_streaming_handler_from_server (
+        WOCKY_C2S_PORTER (priv->porter),
+        WOCKY_STANZA_TYPE_IQ, "query", WOCKY_XMPP_NS_ROSTER,
+        roster_stream_item_cb, self, NULL);
+
   priv->contact_factory = wocky_session_get_contact_factory (priv->session);
   g_assert (priv->contact_factory != NULL);
   g_object_ref (priv->contact_factory);
@@ -583,6 +696,13 @@ wocky_roster_dispose (GObject *object)
       priv->iq_cb = 0;
     }
 
+  if (priv->stream_cb != 0)
+    {
+      wocky_c2s_porter_remove_streaming_handler (
+          WOCKY_C2S_PORTER (priv->porter), priv->stream_cb);
+      priv->stream_cb = 0;
+    }
+
   g_object_unref (priv->porter);
   g_object_unref (priv->contact_factory);
 
@@ -598,6 +718,10 @@ wocky_roster_finalize (GObject *object)
 
   g_hash_table_unref (priv->items);
   g_hash_table_unref (priv->pending_operations);
+  g_free (priv->fetch_id);
+
+  if (priv->fetched_items != NULL)
+    g_ptr_array_unref (priv->fetched_items);
 
   G_OBJECT_CLASS (wocky_roster_parent_class)->finalize (object);
 }
@@ -653,9 +777,23 @@ roster_fetch_roster_cb (GObject *source_object,
   WockyStanza *iq;
   WockyRoster *self = WOCKY_ROSTER (user_data);
   WockyRosterPrivate *priv = self->priv;
+  GPtrArray *fetched = priv->fetched_items;
+  guint i;
 
   iq = wocky_porter_send_iq_finish (WOCKY_PORTER (source_object), res, &error);
 
+  g_free (priv->fetch_id);
+  priv->fetch_id = NULL;
+  priv->fetched_items = NULL;
+
+  /* the items which were streamed come before any left in the reply */
+  if (iq != NULL && fetched != NULL)
+    for (i = 0; i < fetched->len; i++)
+      roster_apply_item (self, g_ptr_array_index (fetched, i), FALSE);
+
+  if (fetched != NULL)
+    g_ptr_array_unref (fetched);
+
   if (!iq || !roster_update (self, iq, FALSE, &error))
     g_task_return_error (priv->fetch_task, error);
   else
@@ -702,6 +840,10 @@ wocky_roster_fetch_roster_async (WockyRoster *self,
 
   wocky_porter_send_iq_async (priv->porter,
       iq, cancellable, roster_fetch_roster_cb, self);
+
+  /* the porter has given the IQ its id by now */
+  priv->fetch_id = g_strdup (wocky_node_get_attribute (
+      wocky_stanza_get_top_node (iq), "id"));
   g_object_unref (iq);
 }
 
@@ -1332,7 +1474,8 @@ wocky_roster_contact_remove_group_async (WockyRoster *self,
   WockyStanza *iq;
   WockyNode *item;
   GTask *task;
-  GSList *l;
+  WockyNodeIter iter;
+  WockyNode *group_node;
   PendingOperation *pending;
   const gchar *jid;
 
@@ -1373,18 +1516,12 @@ wocky_roster_contact_remove_group_async (WockyRoster *self,
   iq = build_iq_for_contact (contact, &item);
 
   /* remove the group */
-  /* FIXME: should we add a wocky_node_remove_child () ? */
-  for (l = item->children; l != NULL; l = g_slist_next (l))
+  wocky_node_iter_init (&iter, item, "group", NULL);
+  while (wocky_node_iter_next (&iter, &group_node))
     {
-      WockyNode *group_node = (WockyNode *) l->data;
-
-      if (wocky_strdiff (group_node->name, "group"))
-        continue;
-
       if (!wocky_strdiff (group_node->content, group))
         {
-          wocky_node_free (group_node);
-          item->children = g_slist_delete_link (item->children, l);
+          wocky_node_iter_remove (&iter);
           break;
         }
     }
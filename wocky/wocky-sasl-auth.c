@@ -56,6 +56,16 @@ struct _WockySaslAuthPrivate
   GCancellable *cancel;
   GTask *task;
   WockyAuthRegistry *auth_registry;
+
+  /* SASL2 (XEP-0388) and FAST (XEP-0484) state */
+  gboolean sasl2;
+  WockyCredentialStore *credential_store;
+  GSList *mechanisms;
+  gboolean allow_plain;
+  gboolean is_secure;
+  gchar *mechanism;
+  gchar *token_mechanism;
+  WockyFastToken *new_token;
 };
 
 G_DEFINE_TYPE_WITH_CODE (WockySaslAuth, wocky_sasl_auth, G_TYPE_OBJECT,
@@ -63,6 +73,8 @@ G_DEFINE_TYPE_WITH_CODE (WockySaslAuth, wocky_sasl_auth, G_TYPE_OBJECT,
 
 static void sasl_auth_stanza_received (GObject *source, GAsyncResult *res,
     gpointer user_data);
+static void wocky_sasl_auth_start_cb (GObject *source_object,
+    GAsyncResult *res, gpointer user_data);
 
 static void
 wocky_sasl_auth_init (WockySaslAuth *self)
@@ -212,6 +224,8 @@ wocky_sasl_auth_dispose (GObject *object)
   if (priv->auth_registry != NULL)
     g_object_unref (priv->auth_registry);
 
+  g_clear_object (&priv->credential_store);
+
   if (G_OBJECT_CLASS (wocky_sasl_auth_parent_class)->dispose)
     G_OBJECT_CLASS (wocky_sasl_auth_parent_class)->dispose (object);
 }
@@ -226,6 +240,10 @@ wocky_sasl_auth_finalize (GObject *object)
   g_free (priv->server);
   g_free (priv->username);
   g_free (priv->password);
+  g_free (priv->mechanism);
+  g_free (priv->token_mechanism);
+  g_slist_free_full (priv->mechanisms, g_free);
+  wocky_fast_token_free (priv->new_token);
 
   G_OBJECT_CLASS (wocky_sasl_auth_parent_class)->finalize (object);
 }
@@ -258,6 +276,16 @@ auth_succeeded (WockySaslAuth *sasl)
   GTask *t;
 
   DEBUG ("Authentication succeeded");
+
+  if (priv->new_token != NULL)
+    {
+      DEBUG ("Storing new %s token", priv->new_token->mechanism);
+      wocky_credential_store_set_token (priv->credential_store,
+          priv->username, priv->server, priv->new_token);
+      wocky_fast_token_free (priv->new_token);
+      priv->new_token = NULL;
+    }
+
   auth_reset (sasl);
 
   t = priv->task;
@@ -333,6 +361,12 @@ stream_error (WockySaslAuth *sasl, WockyStanza *stanza)
   return FALSE;
 }
 
+static const gchar *
+sasl_auth_ns (WockySaslAuth *sasl)
+{
+  return sasl->priv->sasl2 ? WOCKY_XMPP_NS_SASL2 : WOCKY_XMPP_NS_SASL_AUTH;
+}
+
 WockySaslAuth *
 wocky_sasl_auth_new (const gchar *server,
     const gchar *username,
@@ -371,15 +405,9 @@ sasl_auth_got_failure (WockySaslAuth *sasl,
   WockyStanza *stanza,
   GError **error)
 {
-  WockyNode *reason = NULL;
+  WockyNode *reason = wocky_node_get_first_child (
+      wocky_stanza_get_top_node (stanza));
 
-  if (wocky_stanza_get_top_node (stanza)->children != NULL)
-    {
-      /* TODO add a wocky xmpp node utility to either get the first child or
-       * iterate the children list */
-      reason = (WockyNode *)
-          wocky_stanza_get_top_node (stanza)->children->data;
-    }
     /* TODO Handle the different error cases in a different way. i.e.
      * make it clear for the user if it's credentials were wrong, if the server
      * just has a temporary error or if the authentication procedure itself was
@@ -461,7 +489,7 @@ wocky_sasl_auth_response_cb (GObject *source_object,
 
   response = wocky_sasl_auth_encode_response (response_data);
 
-  response_stanza = wocky_stanza_new ("response", WOCKY_XMPP_NS_SASL_AUTH);
+  response_stanza = wocky_stanza_new ("response", sasl_auth_ns (self));
   wocky_node_set_content (wocky_stanza_get_top_node (response_stanza),
       response);
 
@@ -510,6 +538,92 @@ wocky_sasl_auth_success_response_cb (GObject *source_object,
       wocky_sasl_auth_success_cb, self);
 }
 
+/* Keep the token the server issued with <success/>, to be stored once the
+ * authentication has been verified */
+static void
+sasl_auth_take_token (WockySaslAuth *sasl,
+    WockyNode *success)
+{
+  WockySaslAuthPrivate *priv = sasl->priv;
+  WockyNode *token;
+  const gchar *mechanism = priv->token_mechanism;
+  const gchar *secret;
+  const gchar *expiry;
+  gint64 expiry_time = 0;
+
+  token = wocky_node_get_child_ns (success, "token", WOCKY_XMPP_NS_FAST);
+
+  if (token == NULL)
+    return;
+
+  /* a server may also rotate the token we just authenticated with */
+  if (wocky_auth_registry_is_token_mechanism (priv->mechanism))
+    mechanism = priv->mechanism;
+
+  secret = wocky_node_get_attribute (token, "token");
+
+  if (mechanism == NULL || secret == NULL)
+    {
+      DEBUG ("Ignoring unrequested or empty token");
+      return;
+    }
+
+  expiry = wocky_node_get_attribute (token, "expiry");
+
+  if (expiry != NULL)
+    {
+#if GLIB_CHECK_VERSION (2, 56, 0)
+      GDateTime *dt = g_date_time_new_from_iso8601 (expiry, NULL);
+
+      if (dt != NULL)
+        {
+          expiry_time = g_date_time_to_unix (dt);
+          g_date_time_unref (dt);
+        }
+#else
+      GTimeVal tv;
+
+      if (g_time_val_from_iso8601 (expiry, &tv))
+        expiry_time = tv.tv_sec;
+#endif
+
+      if (expiry_time == 0)
+        DEBUG ("Could not parse token expiry '%s'", expiry);
+    }
+
+  wocky_fast_token_free (priv->new_token);
+  priv->new_token = wocky_fast_token_new (mechanism, secret, expiry_time);
+}
+
+/* The server refused our stored token: drop it and start over with the
+ * remaining mechanisms, which will usually land on SCRAM */
+static void
+sasl_auth_retry_without_token (WockySaslAuth *sasl)
+{
+  WockySaslAuthPrivate *priv = sasl->priv;
+  GSList *l, *next;
+
+  DEBUG ("Server refused our %s token, falling back", priv->mechanism);
+
+  wocky_credential_store_forget_token (priv->credential_store,
+      priv->username, priv->server);
+
+  for (l = priv->mechanisms; l != NULL; l = next)
+    {
+      next = l->next;
+
+      if (wocky_auth_registry_is_token_mechanism (l->data))
+        {
+          g_free (l->data);
+          priv->mechanisms = g_slist_delete_link (priv->mechanisms, l);
+        }
+    }
+
+  wocky_auth_registry_start_auth_async (priv->auth_registry, priv->mechanisms,
+      priv->allow_plain, priv->is_secure, priv->username, priv->password,
+      priv->server, NULL, wocky_sasl_auth_start_cb, sasl);
+}
+
 static void
 sasl_auth_stanza_received (GObject *source,
   GAsyncResult *res,
@@ -528,11 +642,11 @@ sasl_auth_stanza_received (GObject *source,
 
   if (wocky_strdiff (
       wocky_node_get_ns (wocky_stanza_get_top_node (stanza)),
-          WOCKY_XMPP_NS_SASL_AUTH))
+          sasl_auth_ns (sasl)))
     {
       auth_failed (sasl, WOCKY_AUTH_ERROR_INVALID_REPLY,
           "Server sent a reply not in the %s namespace",
-          WOCKY_XMPP_NS_SASL_AUTH);
+          sasl_auth_ns (sasl));
       return;
     }
 
@@ -557,12 +671,22 @@ sasl_auth_stanza_received (GObject *source,
     }
   else if (!wocky_strdiff (wocky_stanza_get_top_node (stanza)->name, "success"))
     {
-      if (wocky_stanza_get_top_node (stanza)->content != NULL)
+      WockyNode *top = wocky_stanza_get_top_node (stanza);
+      const gchar *success_data = top->content;
+
+      /* SASL2 wraps the data and may hand us a new FAST token */
+      if (priv->sasl2)
+        {
+          success_data = wocky_node_get_content_from_child (top,
+              "additional-data");
+          sasl_auth_take_token (sasl, top);
+        }
+
+      if (success_data != NULL)
         {
           GString *challenge;
 
-          challenge = wocky_sasl_auth_decode_challenge (
-              wocky_stanza_get_top_node (stanza)->content);
+          challenge = wocky_sasl_auth_decode_challenge (success_data);
 
           wocky_auth_registry_challenge_async (priv->auth_registry, challenge,
               wocky_sasl_auth_success_response_cb, sasl);
@@ -575,6 +699,11 @@ sasl_auth_stanza_received (GObject *source,
               wocky_sasl_auth_success_cb, sasl);
         }
     }
+  else if (!wocky_strdiff (wocky_stanza_get_top_node (stanza)->name, "failure")
+      && priv->sasl2 && wocky_auth_registry_is_token_mechanism (priv->mechanism))
+    {
+      sasl_auth_retry_without_token (sasl);
+    }
   else if (!wocky_strdiff (wocky_stanza_get_top_node (stanza)->name, "failure"))
     {
       sasl_auth_got_failure (sasl, stanza, &error);
@@ -625,6 +754,63 @@ wocky_sasl_auth_authenticate_finish (WockySaslAuth *sasl,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/* <authenticate xmlns='urn:xmpp:sasl:2' mechanism='...'>
+ *   <initial-response>...</initial-response>
+ *   <user-agent id='...'/>
+ *   <fast xmlns='urn:xmpp:fast:0'/> or <request-token .../>
+ * </authenticate> */
+static WockyStanza *
+wocky_sasl_auth_build_authenticate (WockySaslAuth *self,
+    WockyAuthRegistryStartData *start_data)
+{
+  WockySaslAuthPrivate *priv = self->priv;
+  WockyStanza *stanza;
+  WockyNode *top;
+  gchar *user_agent_id;
+
+  stanza = wocky_stanza_new ("authenticate", WOCKY_XMPP_NS_SASL2);
+  top = wocky_stanza_get_top_node (stanza);
+
+  wocky_node_set_attribute (top, "mechanism", start_data->mechanism);
+
+  if (start_data->initial_response != NULL)
+    {
+      gchar *initial_response_str = wocky_sasl_auth_encode_response (
+          start_data->initial_response);
+
+      /* an empty response is sent as a single '=', as in RFC 6120 */
+      wocky_node_add_child_with_content (top, "initial-response",
+          initial_response_str != NULL ? initial_response_str : "=");
+
+      g_free (initial_response_str);
+    }
+
+  user_agent_id = wocky_credential_store_dup_user_agent_id (
+      priv->credential_store);
+
+  if (user_agent_id != NULL)
+    {
+      WockyNode *ua = wocky_node_add_child (top, "user-agent");
+
+      wocky_node_set_attribute (ua, "id", user_agent_id);
+      g_free (user_agent_id);
+    }
+
+  if (wocky_auth_registry_is_token_mechanism (start_data->mechanism))
+    {
+      wocky_node_add_child_ns (top, "fast", WOCKY_XMPP_NS_FAST);
+    }
+  else if (priv->token_mechanism != NULL)
+    {
+      WockyNode *request = wocky_node_add_child_ns (top, "request-token",
+          WOCKY_XMPP_NS_FAST);
+
+      wocky_node_set_attribute (request, "mechanism", priv->token_mechanism);
+    }
+
+  return stanza;
+}
+
 static void
 wocky_sasl_auth_start_cb (GObject *source_object,
     GAsyncResult *res,
@@ -644,26 +830,36 @@ wocky_sasl_auth_start_cb (GObject *source_object,
       return;
     }
 
-  stanza = wocky_stanza_new ("auth", WOCKY_XMPP_NS_SASL_AUTH);
-
-  /* google JID domain discovery - client sets a namespaced attribute */
-  wocky_node_set_attribute_ns (wocky_stanza_get_top_node (stanza),
-      "client-uses-full-bind-result", "true", WOCKY_GOOGLE_NS_AUTH);
+  g_free (priv->mechanism);
+  priv->mechanism = g_strdup (start_data->mechanism);
 
-  if (start_data->initial_response != NULL)
+  if (priv->sasl2)
     {
-      gchar *initial_response_str = wocky_sasl_auth_encode_response (
-          start_data->initial_response);
+      stanza = wocky_sasl_auth_build_authenticate (self, start_data);
+    }
+  else
+    {
+      stanza = wocky_stanza_new ("auth", WOCKY_XMPP_NS_SASL_AUTH);
 
-      wocky_node_set_content (
-        wocky_stanza_get_top_node (stanza),
-        initial_response_str);
+      /* google JID domain discovery - client sets a namespaced attribute */
+      wocky_node_set_attribute_ns (wocky_stanza_get_top_node (stanza),
+          "client-uses-full-bind-result", "true", WOCKY_GOOGLE_NS_AUTH);
 
-      g_free (initial_response_str);
-    }
+      if (start_data->initial_response != NULL)
+        {
+          gchar *initial_response_str = wocky_sasl_auth_encode_response (
+              start_data->initial_response);
+
+          wocky_node_set_content (
+            wocky_stanza_get_top_node (stanza),
+            initial_response_str);
+
+          g_free (initial_response_str);
+        }
 
-  wocky_node_set_attribute (wocky_stanza_get_top_node (stanza),
-    "mechanism", start_data->mechanism);
+      wocky_node_set_attribute (wocky_stanza_get_top_node (stanza),
+        "mechanism", start_data->mechanism);
+    }
   wocky_xmpp_connection_send_stanza_async (priv->connection, stanza,
     priv->cancel, sasl_auth_stanza_sent, self);
 
@@ -781,16 +977,55 @@ wocky_sasl_auth_authenticate_async (WockySaslAuth *sasl,
 {
   WockySaslAuthPrivate *priv = sasl->priv;
   WockyNode *mech_node;
-  GSList *mechanisms, *t;
+  GSList *mechanisms;
 
   g_assert (sasl != NULL);
   g_assert (features != NULL);
 
+  g_clear_object (&priv->credential_store);
+  g_object_get (priv->auth_registry,
+      "credential-store", &priv->credential_store, NULL);
+
   mech_node = wocky_node_get_child_ns (
     wocky_stanza_get_top_node (features),
-    "mechanisms", WOCKY_XMPP_NS_SASL_AUTH);
+    "authentication", WOCKY_XMPP_NS_SASL2);
+
+  /* SASL2 is only worth it for the FAST tokens, which need somewhere to
+   * live between connections */
+  priv->sasl2 = (mech_node != NULL && priv->credential_store != NULL);
 
-  mechanisms = wocky_sasl_auth_mechanisms_to_list (mech_node);
+  if (priv->sasl2)
+    {
+      WockyNode *fast = NULL;
+      WockyNode *inline_node = wocky_node_get_child (mech_node, "inline");
+
+      if (inline_node != NULL)
+        fast = wocky_node_get_child_ns (inline_node, "fast",
+            WOCKY_XMPP_NS_FAST);
+
+      mechanisms = g_slist_concat (
+          wocky_sasl_auth_mechanisms_to_list (fast),
+          wocky_sasl_auth_mechanisms_to_list (mech_node));
+
+      g_free (priv->token_mechanism);
+      priv->token_mechanism = NULL;
+
+      if (g_slist_find_custom (mechanisms,
+              WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE,
+              (GCompareFunc) g_strcmp0) != NULL)
+        priv->token_mechanism = g_strdup (WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE);
+
+      DEBUG ("Using SASL2%s", priv->token_mechanism != NULL ?
+          " with FAST" : "");
+    }
+  else
+    {
+      mech_node = wocky_node_get_child_ns (
+        wocky_stanza_get_top_node (features),
+        "mechanisms", WOCKY_XMPP_NS_SASL_AUTH);
+
+      mechanisms = wocky_sasl_auth_mechanisms_to_list (mech_node);
+    }
 
   if (G_UNLIKELY (mechanisms == NULL))
     {
@@ -798,7 +1033,7 @@ wocky_sasl_auth_authenticate_async (WockySaslAuth *sasl,
           wocky_sasl_auth_authenticate_async,
           WOCKY_AUTH_ERROR, WOCKY_AUTH_ERROR_NOT_SUPPORTED,
           "Server doesn't have any sasl mechanisms");
-      goto out;
+      return;
     }
 
   if (is_secure)
@@ -821,15 +1056,29 @@ wocky_sasl_auth_authenticate_async (WockySaslAuth *sasl,
   if (cancellable != NULL)
     priv->cancel = g_object_ref (cancellable);
 
+  /* kept in case we need to start over without a refused token */
+  g_slist_free_full (priv->mechanisms, g_free);
+  priv->mechanisms = mechanisms;
+  priv->allow_plain = allow_plain;
+  priv->is_secure = is_secure;
+
   wocky_auth_registry_start_auth_async (priv->auth_registry, mechanisms,
       allow_plain, is_secure, priv->username, priv->password, priv->server,
       NULL, wocky_sasl_auth_start_cb, sasl);
+}
 
-out:
-  for (t = mechanisms ; t != NULL; t = g_slist_next (t))
-    {
-      g_free (t->data);
-    }
-
-  g_slist_free (mechanisms);
+/**
+ * wocky_sasl_auth_is_sasl2:
+ * @sasl: a #WockySaslAuth
+ *
+ * Checks whether the last authentication used SASL2 (XEP-0388). Unlike
+ * RFC 6120 SASL, a successful SASL2 authentication is not followed by a
+ * stream restart: the server sends the new stream features straight away.
+ *
+ * Returns: %TRUE if SASL2 was used
+ */
+gboolean
+wocky_sasl_auth_is_sasl2 (WockySaslAuth *sasl)
+{
+  return sasl->priv->sasl2;
 }
@@ -92,6 +92,8 @@ gboolean wocky_sasl_auth_authenticate_finish (WockySaslAuth *sasl,
   GAsyncResult *result,
   GError **error);
 
+gboolean wocky_sasl_auth_is_sasl2 (WockySaslAuth *sasl);
+
 void
 wocky_sasl_auth_add_handler (WockySaslAuth *auth, WockyAuthHandler *handler);
 
@@ -0,0 +1,312 @@
+/*
+ * wocky-sasl-ht.c - HT-* token mechanisms (XEP-0484)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "wocky-sasl-ht.h"
+#include "wocky-auth-registry.h"
+#include "wocky-sasl-utils.h"
+
+#define WOCKY_DEBUG_FLAG WOCKY_DEBUG_AUTH
+#include "wocky-debug-internal.h"
+
+static void
+auth_handler_iface_init (gpointer g_iface);
+
+enum
+{
+  PROP_USERNAME = 1,
+  PROP_TOKEN,
+  PROP_CB_DATA,
+};
+
+struct _WockySaslHtPrivate
+{
+  gchar *username;
+  gchar *token;
+  gchar *cb_data;
+  gboolean server_verified;
+};
+
+G_DEFINE_TYPE_WITH_CODE (WockySaslHt, wocky_sasl_ht, G_TYPE_OBJECT,
+    G_ADD_PRIVATE (WockySaslHt)
+    G_IMPLEMENT_INTERFACE (WOCKY_TYPE_AUTH_HANDLER, auth_handler_iface_init))
+
+static void
+wocky_sasl_ht_get_property (GObject *object, guint property_id,
+    GValue *value, GParamSpec *pspec)
+{
+  WockySaslHt *self = WOCKY_SASL_HT (object);
+  WockySaslHtPrivate *priv = self->priv;
+
+  switch (property_id)
+    {
+      case PROP_USERNAME:
+        g_value_set_string (value, priv->username);
+        break;
+
+      case PROP_TOKEN:
+        g_value_set_string (value, priv->token);
+        break;
+
+      case PROP_CB_DATA:
+        g_value_set_string (value, priv->cb_data);
+        break;
+
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+wocky_sasl_ht_set_property (GObject *object, guint property_id,
+    const GValue *value, GParamSpec *pspec)
+{
+  WockySaslHt *self = WOCKY_SASL_HT (object);
+  WockySaslHtPrivate *priv = self->priv;
+
+  switch (property_id)
+    {
+      case PROP_USERNAME:
+        g_free (priv->username);
+        priv->username = g_value_dup_string (value);
+        break;
+
+      case PROP_TOKEN:
+        g_free (priv->token);
+        priv->token = g_value_dup_string (value);
+        break;
+
+      case PROP_CB_DATA:
+        g_free (priv->cb_data);
+        priv->cb_data = g_value_dup_string (value);
+        break;
+
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+wocky_sasl_ht_finalize (GObject *object)
+{
+  WockySaslHt *self = WOCKY_SASL_HT (object);
+  WockySaslHtPrivate *priv = self->priv;
+
+  g_free (priv->username);
+
+  if (priv->token != NULL)
+    memset (priv->token, 0, strlen (priv->token));
+
+  g_free (priv->token);
+  g_free (priv->cb_data);
+
+  G_OBJECT_CLASS (wocky_sasl_ht_parent_class)->finalize (object);
+}
+
+static void
+wocky_sasl_ht_class_init (WockySaslHtClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->get_property = wocky_sasl_ht_get_property;
+  object_class->set_property = wocky_sasl_ht_set_property;
+  object_class->finalize = wocky_sasl_ht_finalize;
+
+  g_object_class_install_property (object_class, PROP_USERNAME,
+      g_param_spec_string ("username", "username",
+          "The username to authenticate with", NULL,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_TOKEN,
+      g_param_spec_string ("token", "token",
+          "The FAST token to authenticate with", NULL,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_CB_DATA,
+      g_param_spec_string ("cb-data", "binding data",
+          "Base64 encoded TLS channel binding data, for the bound variants",
+          NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static gboolean
+ht_initial_response (WockyAuthHandler *handler,
+    GString **initial_data,
+    GError **error);
+
+static gboolean
+ht_handle_auth_data (WockyAuthHandler *handler,
+    const GString *data,
+    GString **response,
+    GError **error);
+
+static gboolean
+ht_handle_success (WockyAuthHandler *handler,
+    GError **error);
+
+static void
+auth_handler_iface_init (gpointer g_iface)
+{
+  WockyAuthHandlerIface *iface = g_iface;
+
+  iface->mechanism = WOCKY_AUTH_MECH_SASL_HT_SHA_256_NONE;
+  iface->plain = FALSE;
+  iface->initial_response_func = ht_initial_response;
+  iface->auth_data_func = ht_handle_auth_data;
+  iface->success_func = ht_handle_success;
+}
+
+static void
+wocky_sasl_ht_init (WockySaslHt *self)
+{
+  self->priv = wocky_sasl_ht_get_instance_private (self);
+}
+
+WockySaslHt *
+wocky_sasl_ht_new (const gchar *username, const gchar *token)
+{
+  return g_object_new (WOCKY_TYPE_SASL_HT,
+      "username", username,
+      "token", token,
+      NULL);
+}
+
+/* HMAC-SHA-256 (token, label || channel binding data) */
+static GByteArray *
+ht_calculate_hash (WockySaslHt *self,
+    const gchar *label)
+{
+  WockySaslHtPrivate *priv = self->priv;
+  GByteArray *text = g_byte_array_new ();
+  GByteArray *hash;
+
+  g_byte_array_append (text, (guint8 *) label, strlen (label));
+
+  if (priv->cb_data != NULL)
+    {
+      gsize len;
+      guchar *cb = g_base64_decode (priv->cb_data, &len);
+
+      g_byte_array_append (text, cb, len);
+      g_free (cb);
+    }
+
+  hash = sasl_calculate_hmac (G_CHECKSUM_SHA256,
+      (guint8 *) priv->token, strlen (priv->token),
+      text->data, text->len);
+
+  g_byte_array_unref (text);
+
+  return hash;
+}
+
+static gboolean
+ht_initial_response (WockyAuthHandler *handler,
+    GString **initial_data,
+    GError **error)
+{
+  WockySaslHt *self = WOCKY_SASL_HT (handler);
+  WockySaslHtPrivate *priv = self->priv;
+  GByteArray *hash;
+
+  if (priv->username == NULL || priv->token == NULL)
+    {
+      g_set_error (error, WOCKY_AUTH_ERROR,
+          WOCKY_AUTH_ERROR_NO_CREDENTIALS,
+          "No username or token provided");
+      return FALSE;
+    }
+
+  DEBUG ("Authenticating with a FAST token");
+
+  hash = ht_calculate_hash (self, "Initiator");
+
+  *initial_data = g_string_new (priv->username);
+  g_string_append_c (*initial_data, '\0');
+  g_string_append_len (*initial_data, (gchar *) hash->data, hash->len);
+
+  g_byte_array_unref (hash);
+
+  return TRUE;
+}
+
+/* The only data the server sends is the additional data with success, which
+ * proves it knows the token as well */
+static gboolean
+ht_handle_auth_data (WockyAuthHandler *handler,
+    const GString *data,
+    GString **response,
+    GError **error)
+{
+  WockySaslHt *self = WOCKY_SASL_HT (handler);
+  WockySaslHtPrivate *priv = self->priv;
+  GByteArray *hash;
+  guint8 diff = 0;
+  guint i;
+
+  *response = NULL;
+
+  hash = ht_calculate_hash (self, "Responder");
+
+  if (data->len != hash->len)
+    {
+      diff = 1;
+    }
+  else
+    {
+      for (i = 0; i < hash->len; i++)
+        diff |= hash->data[i] ^ (guint8) data->str[i];
+    }
+
+  g_byte_array_unref (hash);
+
+  if (diff != 0)
+    {
+      g_set_error (error, WOCKY_AUTH_ERROR,
+          WOCKY_AUTH_ERROR_INVALID_REPLY,
+          "Server sent an incorrect token verification");
+      return FALSE;
+    }
+
+  priv->server_verified = TRUE;
+
+  return TRUE;
+}
+
+static gboolean
+ht_handle_success (WockyAuthHandler *handler,
+    GError **error)
+{
+  WockySaslHt *self = WOCKY_SASL_HT (handler);
+  WockySaslHtPrivate *priv = self->priv;
+
+  if (!priv->server_verified)
+    {
+      g_set_error (error, WOCKY_AUTH_ERROR,
+          WOCKY_AUTH_ERROR_INVALID_REPLY,
+          "Server did not prove knowledge of the token");
+      return FALSE;
+    }
+
+  return TRUE;
+}
@@ -0,0 +1,73 @@
+/*
+ * wocky-sasl-ht.h - HT-* token mechanisms (XEP-0484)
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef _WOCKY_SASL_HT_H
+#define _WOCKY_SASL_HT_H
+
+#include <glib-object.h>
+
+#include "wocky-auth-handler.h"
+
+G_BEGIN_DECLS
+
+#define WOCKY_TYPE_SASL_HT \
+    wocky_sasl_ht_get_type ()
+
+#define WOCKY_SASL_HT(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), WOCKY_TYPE_SASL_HT, \
+        WockySaslHt))
+
+#define WOCKY_SASL_HT_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_CAST ((klass), WOCKY_TYPE_SASL_HT, \
+        WockySaslHtClass))
+
+#define WOCKY_IS_SASL_HT(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WOCKY_TYPE_SASL_HT))
+
+#define WOCKY_IS_SASL_HT_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_TYPE ((klass), WOCKY_TYPE_SASL_HT))
+
+#define WOCKY_SASL_HT_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS ((obj), WOCKY_TYPE_SASL_HT, \
+        WockySaslHtClass))
+
+typedef struct _WockySaslHtPrivate WockySaslHtPrivate;
+
+typedef struct
+{
+  GObject parent;
+  WockySaslHtPrivate *priv;
+} WockySaslHt;
+
+typedef struct
+{
+  GObjectClass parent_class;
+} WockySaslHtClass;
+
+GType
+wocky_sasl_ht_get_type (void);
+
+WockySaslHt *
+wocky_sasl_ht_new (const gchar *username, const gchar *token);
+
+G_END_DECLS
+
+#endif /* _WOCKY_SASL_HT_H */
@@ -0,0 +1,422 @@
+/*
+ * wocky-sasl-scram-cache.c - Cache of derived SCRAM keys
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "wocky-sasl-scram-cache.h"
+
+#define DEFAULT_MAX_ENTRIES 32
+#define DEFAULT_MAX_AGE (24 * 60 * 60)
+
+/* properties */
+enum
+{
+  PROP_MAX_ENTRIES = 1,
+  PROP_MAX_AGE,
+};
+
+typedef struct {
+  GByteArray *client_key;
+  GByteArray *server_key;
+  /* g_get_monotonic_time() when stored */
+  gint64 stored;
+} CachedKeys;
+
+struct _WockySaslScramCachePrivate
+{
+  GMutex lock;
+  /* see make_key() => owned CachedKeys */
+  GHashTable *keys;
+  guint max_entries;
+  guint max_age;
+};
+
+G_DEFINE_TYPE_WITH_CODE (WockySaslScramCache, wocky_sasl_scram_cache,
+    G_TYPE_OBJECT, G_ADD_PRIVATE (WockySaslScramCache))
+
+static GByteArray *
+byte_array_dup (const GByteArray *array)
+{
+  GByteArray *copy = g_byte_array_sized_new (array->len);
+
+  g_byte_array_append (copy, array->data, array->len);
+
+  return copy;
+}
+
+static void
+byte_array_wipe_and_free (GByteArray *array)
+{
+  memset (array->data, 0, array->len);
+  g_byte_array_unref (array);
+}
+
+static void
+cached_keys_free (CachedKeys *keys)
+{
+  byte_array_wipe_and_free (keys->client_key);
+  byte_array_wipe_and_free (keys->server_key);
+  g_slice_free (CachedKeys, keys);
+}
+
+/* Entries are keyed by everything the derived keys depend on except the
+ * password: neither it nor anything cheap to check guesses of it against is
+ * kept. A changed password comes with a new salt, and keys which stop
+ * working are dropped by wocky_sasl_scram_forget_cached_keys(). The salt is
+ * base64, so it can't contain the separator; the server is prefixed with its
+ * length, and the username coming last means it doesn't matter if either of
+ * them does. */
+static gchar *
+make_key (const gchar *server,
+    const gchar *username,
+    const gchar *salt,
+    guint64 iterations,
+    GChecksumType hash_algo)
+{
+  if (server == NULL)
+    server = "";
+
+  return g_strdup_printf ("%d:%" G_GUINT64_FORMAT ":%s:%" G_GSIZE_FORMAT
+      ":%s:%s", hash_algo, iterations, salt, strlen (server), server,
+      username);
+}
+
+/* The key names the account, so don't leave it lying around either */
+static void
+key_wipe_and_free (gchar *key)
+{
+  memset (key, 0, strlen (key));
+  g_free (key);
+}
+
+static gboolean
+cached_keys_expired (WockySaslScramCache *self,
+    CachedKeys *keys,
+    gint64 now)
+{
+  WockySaslScramCachePrivate *priv = self->priv;
+
+  return priv->max_age != 0 &&
+      now - keys->stored >= (gint64) priv->max_age * G_USEC_PER_SEC;
+}
+
+/* Drops expired entries, then the oldest ones until there is room for one
+ * more. Called with the lock held; the cache is small, so a scan is fine. */
+static void
+make_room (WockySaslScramCache *self,
+    gint64 now)
+{
+  WockySaslScramCachePrivate *priv = self->priv;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, priv->keys);
+
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (cached_keys_expired (self, value, now))
+        g_hash_table_iter_remove (&iter);
+    }
+
+  while (priv->max_entries > 0 &&
+      g_hash_table_size (priv->keys) >= priv->max_entries)
+    {
+      gpointer oldest = NULL;
+      gint64 oldest_stored = G_MAXINT64;
+
+      g_hash_table_iter_init (&iter, priv->keys);
+
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        {
+          CachedKeys *keys = value;
+
+          if (keys->stored < oldest_stored)
+            {
+              oldest = key;
+              oldest_stored = keys->stored;
+            }
+        }
+
+      g_hash_table_remove (priv->keys, oldest);
+    }
+}
+
+static void
+wocky_sasl_scram_cache_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  WockySaslScramCache *self = WOCKY_SASL_SCRAM_CACHE (object);
+  WockySaslScramCachePrivate *priv = self->priv;
+
+  switch (property_id)
+    {
+      case PROP_MAX_ENTRIES:
+        g_value_set_uint (value, priv->max_entries);
+        break;
+      case PROP_MAX_AGE:
+        g_value_set_uint (value, priv->max_age);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+wocky_sasl_scram_cache_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+  WockySaslScramCache *self = WOCKY_SASL_SCRAM_CACHE (object);
+  WockySaslScramCachePrivate *priv = self->priv;
+
+  switch (property_id)
+    {
+      case PROP_MAX_ENTRIES:
+        g_mutex_lock (&priv->lock);
+        priv->max_entries = g_value_get_uint (value);
+        g_mutex_unlock (&priv->lock);
+        break;
+      case PROP_MAX_AGE:
+        g_mutex_lock (&priv->lock);
+        priv->max_age = g_value_get_uint (value);
+        g_mutex_unlock (&priv->lock);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+wocky_sasl_scram_cache_finalize (GObject *object)
+{
+  WockySaslScramCache *self = WOCKY_SASL_SCRAM_CACHE (object);
+  WockySaslScramCachePrivate *priv = self->priv;
+
+  g_hash_table_unref (priv->keys);
+  g_mutex_clear (&priv->lock);
+
+  G_OBJECT_CLASS (wocky_sasl_scram_cache_parent_class)->finalize (object);
+}
+
+static void
+wocky_sasl_scram_cache_class_init (WockySaslScramCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->get_property = wocky_sasl_scram_cache_get_property;
+  object_class->set_property = wocky_sasl_scram_cache_set_property;
+  object_class->finalize = wocky_sasl_scram_cache_finalize;
+
+  /**
+   * WockySaslScramCache:max-entries:
+   *
+   * The most entries to keep; when a new one is stored in a full cache, the
+   * oldest is dropped. 0 means no limit.
+   */
+  g_object_class_install_property (object_class, PROP_MAX_ENTRIES,
+      g_param_spec_uint ("max-entries", "Maximum entries",
+          "The most entries to keep, or 0 for no limit",
+          0, G_MAXUINT, DEFAULT_MAX_ENTRIES,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * WockySaslScramCache:max-age:
+   *
+   * How long entries are used for after being stored, in seconds. 0 means
+   * they never expire.
+   */
+  g_object_class_install_property (object_class, PROP_MAX_AGE,
+      g_param_spec_uint ("max-age", "Maximum age",
+          "Seconds after which entries expire, or 0 for never",
+          0, G_MAXUINT, DEFAULT_MAX_AGE,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+wocky_sasl_scram_cache_init (WockySaslScramCache *self)
+{
+  WockySaslScramCachePrivate *priv;
+
+  self->priv = wocky_sasl_scram_cache_get_instance_private (self);
+  priv = self->priv;
+
+  g_mutex_init (&priv->lock);
+  priv->keys = g_hash_table_new_full (g_str_hash, g_str_equal,
+      (GDestroyNotify) key_wipe_and_free, (GDestroyNotify) cached_keys_free);
+}
+
+/**
+ * wocky_sasl_scram_cache_new:
+ *
+ * Returns: (transfer full): a new, empty #WockySaslScramCache
+ */
+WockySaslScramCache *
+wocky_sasl_scram_cache_new (void)
+{
+  return g_object_new (WOCKY_TYPE_SASL_SCRAM_CACHE, NULL);
+}
+
+/**
+ * wocky_sasl_scram_cache_lookup:
+ * @self: a #WockySaslScramCache
+ * @server: the server being authenticated to
+ * @username: the SCRAM username
+ * @salt: the base64 encoded salt, as sent by the server
+ * @iterations: the iteration count sent by the server
+ * @hash_algo: the hash function of the SCRAM mechanism
+ * @client_key: (out) (transfer full): location for the ClientKey
+ * @server_key: (out) (transfer full): location for the ServerKey
+ *
+ * Looks up the keys derived earlier for the given parameters. Keys derived
+ * for a different server, salt or iteration count are never returned. The
+ * password is not part of the lookup: servers change the salt along with the
+ * password, and keys which stop working should be removed with
+ * wocky_sasl_scram_cache_remove().
+ *
+ * Returns: %TRUE if keys were found, in which case @client_key and
+ *  @server_key are set to new arrays; %FALSE otherwise.
+ */
+gboolean
+wocky_sasl_scram_cache_lookup (WockySaslScramCache *self,
+    const gchar *server,
+    const gchar *username,
+    const gchar *salt,
+    guint64 iterations,
+    GChecksumType hash_algo,
+    GByteArray **client_key,
+    GByteArray **server_key)
+{
+  WockySaslScramCachePrivate *priv = self->priv;
+  gchar *key = make_key (server, username, salt, iterations, hash_algo);
+  CachedKeys *keys;
+
+  g_mutex_lock (&priv->lock);
+
+  keys = g_hash_table_lookup (priv->keys, key);
+
+  if (keys != NULL && cached_keys_expired (self, keys, g_get_monotonic_time ()))
+    {
+      g_hash_table_remove (priv->keys, key);
+      keys = NULL;
+    }
+
+  if (keys != NULL)
+    {
+      *client_key = byte_array_dup (keys->client_key);
+      *server_key = byte_array_dup (keys->server_key);
+    }
+
+  g_mutex_unlock (&priv->lock);
+  key_wipe_and_free (key);
+
+  return keys != NULL;
+}
+
+/**
+ * wocky_sasl_scram_cache_store:
+ * @self: a #WockySaslScramCache
+ * @server: the server being authenticated to
+ * @username: the SCRAM username
+ * @salt: the base64 encoded salt, as sent by the server
+ * @iterations: the iteration count sent by the server
+ * @hash_algo: the hash function of the SCRAM mechanism
+ * @client_key: the ClientKey derived for these parameters
+ * @server_key: the ServerKey derived for these parameters
+ *
+ * Remembers the keys derived for the given parameters, replacing any
+ * previous entry. If the cache is full, the oldest entry is dropped.
+ */
+void
+wocky_sasl_scram_cache_store (WockySaslScramCache *self,
+    const gchar *server,
+    const gchar *username,
+    const gchar *salt,
+    guint64 iterations,
+    GChecksumType hash_algo,
+    const GByteArray *client_key,
+    const GByteArray *server_key)
+{
+  WockySaslScramCachePrivate *priv = self->priv;
+  gchar *key = make_key (server, username, salt, iterations, hash_algo);
+  CachedKeys *keys = g_slice_new (CachedKeys);
+
+  keys->client_key = byte_array_dup (client_key);
+  keys->server_key = byte_array_dup (server_key);
+  keys->stored = g_get_monotonic_time ();
+
+  g_mutex_lock (&priv->lock);
+  g_hash_table_remove (priv->keys, key);
+  make_room (self, keys->stored);
+  g_hash_table_insert (priv->keys, key, keys);
+  g_mutex_unlock (&priv->lock);
+}
+
+/**
+ * wocky_sasl_scram_cache_remove:
+ * @self: a #WockySaslScramCache
+ * @server: the server being authenticated to
+ * @username: the SCRAM username
+ * @salt: the base64 encoded salt
+ * @iterations: the iteration count
+ * @hash_algo: the hash function of the SCRAM mechanism
+ *
+ * Forgets the keys stored for the given parameters, if any. This is done
+ * automatically when authentication using cached keys fails.
+ */
+void
+wocky_sasl_scram_cache_remove (WockySaslScramCache *self,
+    const gchar *server,
+    const gchar *username,
+    const gchar *salt,
+    guint64 iterations,
+    GChecksumType hash_algo)
+{
+  WockySaslScramCachePrivate *priv = self->priv;
+  gchar *key = make_key (server, username, salt, iterations, hash_algo);
+
+  g_mutex_lock (&priv->lock);
+  g_hash_table_remove (priv->keys, key);
+  g_mutex_unlock (&priv->lock);
+
+  key_wipe_and_free (key);
+}
+
+/**
+ * wocky_sasl_scram_cache_clear:
+ * @self: a #WockySaslScramCache
+ *
+ * Forgets all stored keys.
+ */
+void
+wocky_sasl_scram_cache_clear (WockySaslScramCache *self)
+{
+  WockySaslScramCachePrivate *priv = self->priv;
+
+  g_mutex_lock (&priv->lock);
+  g_hash_table_remove_all (priv->keys);
+  g_mutex_unlock (&priv->lock);
+}
@@ -0,0 +1,114 @@
+/*
+ * wocky-sasl-scram-cache.h - Cache of derived SCRAM keys
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef _WOCKY_SASL_SCRAM_CACHE_H
+#define _WOCKY_SASL_SCRAM_CACHE_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define WOCKY_TYPE_SASL_SCRAM_CACHE \
+    wocky_sasl_scram_cache_get_type ()
+
+#define WOCKY_SASL_SCRAM_CACHE(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), WOCKY_TYPE_SASL_SCRAM_CACHE, \
+        WockySaslScramCache))
+
+#define WOCKY_SASL_SCRAM_CACHE_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_CAST ((klass), WOCKY_TYPE_SASL_SCRAM_CACHE, \
+        WockySaslScramCacheClass))
+
+#define WOCKY_IS_SASL_SCRAM_CACHE(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), WOCKY_TYPE_SASL_SCRAM_CACHE))
+
+#define WOCKY_IS_SASL_SCRAM_CACHE_CLASS(klass) \
+    (G_TYPE_CHECK_CLASS_TYPE ((klass), WOCKY_TYPE_SASL_SCRAM_CACHE))
+
+#define WOCKY_SASL_SCRAM_CACHE_GET_CLASS(obj) \
+    (G_TYPE_INSTANCE_GET_CLASS ((obj), WOCKY_TYPE_SASL_SCRAM_CACHE, \
+        WockySaslScramCacheClass))
+
+typedef struct _WockySaslScramCachePrivate WockySaslScramCachePrivate;
+
+/**
+ * WockySaslScramCache:
+ *
+ * Remembers the ClientKey and ServerKey derived during SCRAM
+ * authentication, so that reconnecting to a server which still has the same
+ * salt, iteration count and password skips the expensive password
+ * derivation. Only the derived keys are kept, never the password itself or
+ * anything computed cheaply from it. The number
+ * of entries and their lifetime are bounded by the
+ * #WockySaslScramCache:max-entries and #WockySaslScramCache:max-age
+ * properties. All functions may be called from any thread.
+ */
+typedef struct
+{
+  GObject parent;
+  WockySaslScramCachePrivate *priv;
+} WockySaslScramCache;
+
+typedef struct
+{
+  GObjectClass parent_class;
+} WockySaslScramCacheClass;
+
+GType
+wocky_sasl_scram_cache_get_type (void);
+
+WockySaslScramCache *
+wocky_sasl_scram_cache_new (void);
+
+gboolean
+wocky_sasl_scram_cache_lookup (WockySaslScramCache *self,
+    const gchar *server,
+    const gchar *username,
+    const gchar *salt,
+    guint64 iterations,
+    GChecksumType hash_algo,
+    GByteArray **client_key,
+    GByteArray **server_key);
+
+void
+wocky_sasl_scram_cache_store (WockySaslScramCache *self,
+    const gchar *server,
+    const gchar *username,
+    const gchar *salt,
+    guint64 iterations,
+    GChecksumType hash_algo,
+    const GByteArray *client_key,
+    const GByteArray *server_key);
+
+void
+wocky_sasl_scram_cache_remove (WockySaslScramCache *self,
+    const gchar *server,
+    const gchar *username,
+    const gchar *salt,
+    guint64 iterations,
+    GChecksumType hash_algo);
+
+void
+wocky_sasl_scram_cache_clear (WockySaslScramCache *self);
+
+G_END_DECLS
+
+#endif /* _WOCKY_SASL_SCRAM_CACHE_H */
@@ -51,7 +51,8 @@ enum
   PROP_CB_DATA,
   PROP_HASH_ALGO,
   PROP_USERNAME,
-  PROP_PASSWORD
+  PROP_PASSWORD,
+  PROP_CACHE
 };
 
 struct _WockySaslScramPrivate
@@ -77,8 +78,11 @@ struct _WockySaslScramPrivate
   guint64 iterations;
 
   GByteArray *salted_password;
+  GByteArray *client_key;
   GByteArray *server_key;
   GByteArray *stored_key;
+
+  WockySaslScramCache *cache;
 };
 
 G_DEFINE_TYPE_WITH_CODE (WockySaslScram, wocky_sasl_scram,
@@ -118,6 +122,10 @@ wocky_sasl_scram_get_property (
         g_value_set_string (value, priv->server);
         break;
 
+      case PROP_CACHE:
+        g_value_set_object (value, priv->cache);
+        break;
+
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -160,6 +168,11 @@ wocky_sasl_scram_set_property (
         priv->password = g_value_dup_string (value);
         break;
 
+      case PROP_CACHE:
+        g_clear_object (&priv->cache);
+        priv->cache = g_value_dup_object (value);
+        break;
+
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -187,9 +200,12 @@ wocky_sasl_scram_dispose (GObject *object)
   g_free (priv->auth_message);
 
   g_clear_pointer (&(priv->salted_password), g_byte_array_unref);
+  g_clear_pointer (&(priv->client_key), g_byte_array_unref);
   g_clear_pointer (&(priv->server_key), g_byte_array_unref);
   g_clear_pointer (&(priv->stored_key), g_byte_array_unref);
 
+  g_clear_object (&priv->cache);
+
   G_OBJECT_CLASS (wocky_sasl_scram_parent_class)->dispose (object);
 }
 
@@ -234,6 +250,12 @@ wocky_sasl_scram_class_init (
       g_param_spec_string ("password", "password",
           "The password to authenticate with", NULL,
           G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_CACHE,
+      g_param_spec_object ("cache", "key cache",
+          "Where to look up and store the keys derived from the password",
+          WOCKY_TYPE_SASL_SCRAM_CACHE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static gboolean
@@ -245,6 +267,18 @@ static gboolean
 scram_handle_auth_data (WockyAuthHandler *handler,
     const GString *data, GString **response, GError **error);
 
+static void
+scram_handle_auth_data_async (WockyAuthHandler *handler,
+    const GString *data,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+static gboolean
+scram_handle_auth_data_finish (WockyAuthHandler *handler,
+    GAsyncResult *result,
+    GString **response,
+    GError **error);
+
 static gboolean
 scram_handle_success (WockyAuthHandler *handler,
     GError **error);
@@ -259,6 +293,8 @@ sasl_handler_iface_init (gpointer g_iface)
   iface->initial_response_func = scram_initial_response;
   iface->auth_data_func = scram_handle_auth_data;
   iface->success_func = scram_handle_success;
+  iface->auth_data_async_func = scram_handle_auth_data_async;
+  iface->auth_data_finish_func = scram_handle_auth_data_finish;
 }
 
 static void
@@ -385,55 +421,50 @@ scram_xor_array (GByteArray *result, GByteArray *in)
     result->data[i] ^=  in->data[i];
 }
 
-static void
-scram_calculate_salted_password (WockySaslScram *self)
+/* SaltedPassword := Hi (password, salt, i), which is PBKDF2 with HMAC as the
+ * pseudorandom function and a single block of output. Only uses its
+ * arguments, so that it can run in a thread */
+static GByteArray *
+scram_salt_password (GChecksumType hash_algo,
+    const gchar *password,
+    const gchar *salt_b64,
+    guint64 iterations)
 {
-  WockySaslScramPrivate *priv = self->priv;
-  guint64 i;
-  GByteArray *result, *prev, *salt;
-  guint8 one[] = {0,0,0,1};
+  GByteArray *salt, *result;
   gint state = 0;
   guint save = 0;
   gsize len;
-  gsize pass_len = strlen (priv->password);
-
-  if (priv->salted_password != NULL)
-    return;
 
-  /* salt for U1 */
   salt = g_byte_array_new ();
-  /* Make sure we have enough data for the decoding base 64 and add 4 extra
-   * bytes for the calculation */
-  g_byte_array_set_size (salt, (strlen (priv->salt)/4 * 3) + 3 + 4 );
-  len = g_base64_decode_step (priv->salt, strlen (priv->salt),
+  /* Make sure we have enough data for the decoding base 64 */
+  g_byte_array_set_size (salt, (strlen (salt_b64)/4 * 3) + 3);
+  len = g_base64_decode_step (salt_b64, strlen (salt_b64),
     salt->data, &state, &save);
   g_byte_array_set_size (salt, len);
-  g_byte_array_append (salt, one, sizeof (one));
 
-  /* Calculate U1 */
-  result = sasl_calculate_hmac (priv->hash_algo,
-    (guint8 *) priv->password, pass_len,
-    salt->data, salt->len);
+  result = g_byte_array_new ();
+  g_byte_array_set_size (result, g_checksum_type_get_length (hash_algo));
 
-  prev = g_byte_array_sized_new (result->len);
-  g_byte_array_append (prev, result->data, result->len);
+  sasl_pbkdf2_hmac (hash_algo,
+      (guint8 *) password, strlen (password),
+      salt->data, salt->len, iterations,
+      result->data, result->len);
 
-  /* Calculate U2 and onwards, while keeping a rolling result */
-  for (i = 1; i < priv->iterations; i++)
-    {
-      GByteArray *U = sasl_calculate_hmac (priv->hash_algo,
-        (guint8 *) priv->password,
-        pass_len, prev->data, prev->len);
+  g_byte_array_unref (salt);
 
-      g_byte_array_unref (prev);
-      prev = U;
+  return result;
+}
 
-      scram_xor_array (result, U);
-    }
+static void
+scram_calculate_salted_password (WockySaslScram *self)
+{
+  WockySaslScramPrivate *priv = self->priv;
 
-  g_byte_array_unref (prev);
-  g_byte_array_unref (salt);
-  priv->salted_password = result;
+  if (priv->salted_password != NULL)
+    return;
+
+  priv->salted_password = scram_salt_password (priv->hash_algo,
+      priv->password, priv->salt, priv->iterations);
 }
 
 /* As per RFC
@@ -444,52 +475,107 @@ scram_calculate_salted_password (WockySaslScram *self)
  * SaltedPassword  := Hi(Normalize(password), salt, i)
  */
 #define CLIENT_KEY_STR "Client Key"
+static GByteArray *
+scram_calculate_client_key (WockySaslScram *self)
+{
+  WockySaslScramPrivate *priv = self->priv;
+
+  return sasl_calculate_hmac (priv->hash_algo,
+      priv->salted_password->data,
+      priv->salted_password->len, (guint8 *) CLIENT_KEY_STR,
+      strlen (CLIENT_KEY_STR));
+}
+#undef CLIENT_KEY_STR
+
 static void
-scram_calculate_stored_key (WockySaslScram  *self,
-                            GByteArray     **ckey)
+scram_calculate_stored_key (WockySaslScram *self,
+    GByteArray *client_key)
 {
-  WockySaslScramPrivate *priv = wocky_sasl_scram_get_instance_private (self);
-  GByteArray *client_key;
+  WockySaslScramPrivate *priv = self->priv;
   GChecksum *checksum;
 
-  if (priv->stored_key != NULL && ckey == NULL)
+  if (priv->stored_key != NULL)
     return;
-  g_clear_pointer (&(priv->stored_key), g_byte_array_unref);
-
-  /* Calculate the salted password and save it for later as we need it to
-   * verify the servers reply */
-  scram_calculate_salted_password (self);
 
   priv->stored_key = g_byte_array_new ();
   g_byte_array_set_size (priv->stored_key,
       g_checksum_type_get_length (priv->hash_algo));
 
-  client_key = sasl_calculate_hmac (priv->hash_algo,
-      priv->salted_password->data,
-      priv->salted_password->len, (guint8 *) CLIENT_KEY_STR,
-      strlen (CLIENT_KEY_STR));
-
   checksum = g_checksum_new (priv->hash_algo);
   g_checksum_update (checksum, client_key->data, client_key->len);
   g_checksum_get_digest (checksum,
       priv->stored_key->data, (gsize *)&(priv->stored_key->len));
   g_checksum_free (checksum);
+}
 
-  if (ckey)
-    *ckey = client_key;
-  else
-    g_byte_array_unref (client_key);
+/*
+ *    ServerSignature := HMAC(ServerKey, AuthMessage)
+ *    ServerKey       := HMAC(SaltedPassword, "Server Key")
+ */
+#define SERVER_KEY_STR "Server Key"
+static void
+scram_calculate_server_key (WockySaslScram *self)
+{
+  WockySaslScramPrivate *priv = wocky_sasl_scram_get_instance_private (self);
+
+  if (priv->server_key == NULL)
+    priv->server_key = sasl_calculate_hmac (priv->hash_algo,
+        priv->salted_password->data, priv->salted_password->len,
+        (guint8 *) SERVER_KEY_STR, strlen (SERVER_KEY_STR));
+}
+#undef SERVER_KEY_STR
+
+static gboolean
+scram_lookup_cached_keys (WockySaslScram *self)
+{
+  WockySaslScramPrivate *priv = self->priv;
+
+  if (priv->cache == NULL)
+    return FALSE;
+
+  if (!wocky_sasl_scram_cache_lookup (priv->cache, priv->server,
+          priv->username, priv->salt, priv->iterations, priv->hash_algo,
+          &priv->client_key, &priv->server_key))
+    return FALSE;
+
+  DEBUG ("Using cached keys, skipping the password derivation");
+
+  return TRUE;
+}
+
+/* Gets the ClientKey, StoredKey and ServerKey ready for the client side of
+ * the exchange. They come from the cache when it has them, and go in it when
+ * they had to be derived from the password. */
+static void
+scram_calculate_client_keys (WockySaslScram *self)
+{
+  WockySaslScramPrivate *priv = self->priv;
+
+  if (priv->client_key == NULL && !scram_lookup_cached_keys (self))
+    {
+      /* Calculate the salted password and the server key for later, as we
+       * need it to verify the servers reply */
+      scram_calculate_salted_password (self);
+      priv->client_key = scram_calculate_client_key (self);
+      scram_calculate_server_key (self);
+
+      if (priv->cache != NULL)
+        wocky_sasl_scram_cache_store (priv->cache, priv->server,
+            priv->username, priv->salt, priv->iterations, priv->hash_algo,
+            priv->client_key, priv->server_key);
+    }
+
+  scram_calculate_stored_key (self, priv->client_key);
 }
-#undef CLIENT_KEY_STR
 
 static gchar *
 scram_make_client_proof (WockySaslScram *self)
 {
   WockySaslScramPrivate *priv = self->priv;
   gchar *proof = NULL;
-  GByteArray *client_key, *client_signature;
+  GByteArray *client_signature;
 
-  scram_calculate_stored_key (self, &client_key);
+  scram_calculate_client_keys (self);
 
   DEBUG ("auth message: %s", priv->auth_message);
 
@@ -497,29 +583,23 @@ scram_make_client_proof (WockySaslScram *self)
       priv->stored_key->data, priv->stored_key->len,
       (guint8 *) priv->auth_message, strlen (priv->auth_message));
 
-  /* xor signature and key, overwriting key */
-  scram_xor_array (client_key, client_signature);
+  /* xor signature and key, overwriting the signature */
+  scram_xor_array (client_signature, priv->client_key);
 
-  proof = g_base64_encode (client_key->data, client_key->len);
+  proof = g_base64_encode (client_signature->data, client_signature->len);
 
-  g_byte_array_unref (client_key);
   g_byte_array_unref (client_signature);
 
   return proof;
 }
 
 static gboolean
-scram_handle_server_first_message (WockySaslScram *self,
+scram_parse_server_first_message (WockySaslScram *self,
     gchar *message,
-    GString **reply,
     GError **error)
 {
   WockySaslScramPrivate *priv = self->priv;
   gchar attr, *value = NULL;
-  gchar *proof = NULL;
-  GByteArray *cb = NULL;
-  gchar *cb_b64 = NULL;
-  GString *client_reply;
 
   if (!scram_get_next_attr_value (&message, &attr, &value))
     goto invalid;
@@ -551,6 +631,44 @@ scram_handle_server_first_message (WockySaslScram *self,
   if (priv->iterations == 0)
     goto invalid_iterations;
 
+  return TRUE;
+
+invalid_iterations:
+  g_set_error (error, WOCKY_AUTH_ERROR,
+    WOCKY_AUTH_ERROR_INVALID_REPLY,
+    "Server sent an invalid interation count");
+  return FALSE;
+
+invalid_nonce:
+  g_set_error (error, WOCKY_AUTH_ERROR,
+    WOCKY_AUTH_ERROR_INVALID_REPLY,
+    "Server sent an invalid invalid nonce value");
+  return FALSE;
+
+invalid:
+  g_set_error (error, WOCKY_AUTH_ERROR,
+    WOCKY_AUTH_ERROR_INVALID_REPLY,
+    "Server sent an invalid first reply");
+  return FALSE;
+
+unknown_extension:
+  g_set_error (error, WOCKY_AUTH_ERROR,
+    WOCKY_AUTH_ERROR_INVALID_REPLY,
+    "Server sent an unknown mandatory extension");
+  return FALSE;
+}
+
+/* Builds the reply to the server's first message, deriving the keys from
+ * the password if that hasn't been done yet */
+static GString *
+scram_make_client_final_message (WockySaslScram *self)
+{
+  WockySaslScramPrivate *priv = self->priv;
+  gchar *proof = NULL;
+  GByteArray *cb = NULL;
+  gchar *cb_b64 = NULL;
+  GString *client_reply;
+
   /* We got everything we needed for our response without proof
    * base64("n,,") => biws */
   client_reply = g_string_new (NULL);
@@ -581,51 +699,22 @@ scram_handle_server_first_message (WockySaslScram *self,
 
   DEBUG ("Client reply: %s", client_reply->str);
 
-  *reply = client_reply;
-
-  return TRUE;
-
-invalid_iterations:
-  g_set_error (error, WOCKY_AUTH_ERROR,
-    WOCKY_AUTH_ERROR_INVALID_REPLY,
-    "Server sent an invalid interation count");
-  return FALSE;
-
-invalid_nonce:
-  g_set_error (error, WOCKY_AUTH_ERROR,
-    WOCKY_AUTH_ERROR_INVALID_REPLY,
-    "Server sent an invalid invalid nonce value");
-  return FALSE;
-
-invalid:
-  g_set_error (error, WOCKY_AUTH_ERROR,
-    WOCKY_AUTH_ERROR_INVALID_REPLY,
-    "Server sent an invalid first reply");
-  return FALSE;
-
-unknown_extension:
-  g_set_error (error, WOCKY_AUTH_ERROR,
-    WOCKY_AUTH_ERROR_INVALID_REPLY,
-    "Server sent an unknown mandatory extension");
-  return FALSE;
+  return client_reply;
 }
 
-/*
- *    ServerSignature := HMAC(ServerKey, AuthMessage)
- *    ServerKey       := HMAC(SaltedPassword, "Server Key")
- */
-#define SERVER_KEY_STR "Server Key"
-inline static void
-scram_calculate_server_key (WockySaslScram *self)
+static gboolean
+scram_handle_server_first_message (WockySaslScram *self,
+    gchar *message,
+    GString **reply,
+    GError **error)
 {
-  WockySaslScramPrivate *priv = wocky_sasl_scram_get_instance_private (self);
+  if (!scram_parse_server_first_message (self, message, error))
+    return FALSE;
 
-  if (priv->server_key == NULL)
-    priv->server_key = sasl_calculate_hmac (priv->hash_algo,
-        priv->salted_password->data, priv->salted_password->len,
-        (guint8 *) SERVER_KEY_STR, strlen (SERVER_KEY_STR));
+  *reply = scram_make_client_final_message (self);
+
+  return TRUE;
 }
-#undef SERVER_KEY_STR
 
 static gboolean
 scram_check_server_verification (WockySaslScram *self,
@@ -726,6 +815,145 @@ out:
   return ret;
 }
 
+/* What the worker thread needs to derive the keys; copied so that the
+ * thread doesn't share anything with the handler */
+typedef struct {
+  GChecksumType hash_algo;
+  gchar *password;
+  gchar *salt;
+  guint64 iterations;
+} ScramDerivation;
+
+static void
+scram_derivation_free (ScramDerivation *derivation)
+{
+  memset (derivation->password, 0, strlen (derivation->password));
+  g_free (derivation->password);
+  g_free (derivation->salt);
+  g_slice_free (ScramDerivation, derivation);
+}
+
+static void
+scram_derive_thread (GTask *task,
+    gpointer source_object,
+    gpointer task_data,
+    GCancellable *cancellable)
+{
+  ScramDerivation *derivation = task_data;
+
+  g_task_return_pointer (task,
+      scram_salt_password (derivation->hash_algo, derivation->password,
+          derivation->salt, derivation->iterations),
+      (GDestroyNotify) g_byte_array_unref);
+}
+
+static void
+scram_reply_to_server_first_message (WockySaslScram *self,
+    GTask *task)
+{
+  WockySaslScramPrivate *priv = self->priv;
+
+  g_task_return_pointer (task, scram_make_client_final_message (self),
+      (GDestroyNotify) wocky_g_string_free);
+  priv->state = WOCKY_SASL_SCRAM_STATE_SERVER_FINAL_MESSAGE;
+
+  g_object_unref (task);
+}
+
+static void
+scram_derive_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  WockySaslScram *self = WOCKY_SASL_SCRAM (source);
+  WockySaslScramPrivate *priv = self->priv;
+  GTask *task = G_TASK (user_data);
+
+  DEBUG ("Key derivation finished");
+
+  priv->salted_password = g_task_propagate_pointer (G_TASK (result), NULL);
+  scram_reply_to_server_first_message (self, task);
+}
+
+static void
+scram_handle_auth_data_async (WockyAuthHandler *handler,
+    const GString *data,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockySaslScram *self = WOCKY_SASL_SCRAM (handler);
+  WockySaslScramPrivate *priv = self->priv;
+  GTask *task = g_task_new (G_OBJECT (self), NULL, callback, user_data);
+  GTask *derive;
+  ScramDerivation *derivation;
+  GError *error = NULL;
+
+  g_task_set_source_tag (task, scram_handle_auth_data_async);
+
+  /* Only the reply to the server's first message needs the keys, the rest
+   * is cheap */
+  if (priv->state != WOCKY_SASL_SCRAM_STATE_SERVER_FIRST_MESSAGE)
+    {
+      GString *response = NULL;
+
+      if (scram_handle_auth_data (handler, data, &response, &error))
+        g_task_return_pointer (task, response,
+            (GDestroyNotify) wocky_g_string_free);
+      else
+        g_task_return_error (task, error);
+
+      g_object_unref (task);
+      return;
+    }
+
+  DEBUG ("Got server message: %s", data->str);
+
+  priv->server_first_bare = g_strdup (data->str);
+
+  if (!scram_parse_server_first_message (self, data->str, &error))
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  if (priv->salted_password != NULL || scram_lookup_cached_keys (self))
+    {
+      scram_reply_to_server_first_message (self, task);
+      return;
+    }
+
+  /* Hi() is deliberately slow, so keep it off the main loop and carry on
+   * once it's done */
+  DEBUG ("Deriving keys with %" G_GUINT64_FORMAT " iterations in a thread",
+      priv->iterations);
+
+  derivation = g_slice_new0 (ScramDerivation);
+  derivation->hash_algo = priv->hash_algo;
+  derivation->password = g_strdup (priv->password);
+  derivation->salt = g_strdup (priv->salt);
+  derivation->iterations = priv->iterations;
+
+  derive = g_task_new (G_OBJECT (self), NULL, scram_derive_cb, task);
+  g_task_set_task_data (derive, derivation,
+      (GDestroyNotify) scram_derivation_free);
+  g_task_run_in_thread (derive, scram_derive_thread);
+  g_object_unref (derive);
+}
+
+static gboolean
+scram_handle_auth_data_finish (WockyAuthHandler *handler,
+    GAsyncResult *result,
+    GString **response,
+    GError **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, handler), FALSE);
+
+  *response = g_task_propagate_pointer (G_TASK (result), error);
+
+  return !g_task_had_error (G_TASK (result));
+}
+
 static gboolean
 scram_handle_success (WockyAuthHandler *handler,
     GError **error)
@@ -742,6 +970,27 @@ scram_handle_success (WockyAuthHandler *handler,
   return FALSE;
 }
 
+/**
+ * wocky_sasl_scram_forget_cached_keys:
+ * @self: a #WockySaslScram
+ *
+ * Removes the keys for the current exchange from the #WockySaslScram:cache,
+ * if any. Called when authentication fails, so that keys which no longer
+ * work (because the password was changed, but not the salt) are derived
+ * again from the password next time.
+ */
+void
+wocky_sasl_scram_forget_cached_keys (WockySaslScram *self)
+{
+  WockySaslScramPrivate *priv = self->priv;
+
+  if (priv->cache == NULL || priv->salt == NULL)
+    return;
+
+  wocky_sasl_scram_cache_remove (priv->cache, priv->server, priv->username,
+      priv->salt, priv->iterations, priv->hash_algo);
+}
+
 /**
  * SASL Server implementation
  */
@@ -857,6 +1106,8 @@ wocky_sasl_scram_server_start_finish (WockySaslScram *self,
        */
       if (priv->password)
         {
+          GByteArray *client_key;
+
           /* We shall not have both (password and keys) pre-set */
           g_assert (priv->salted_password == NULL);
           g_assert (priv->server_key == NULL);
@@ -868,7 +1119,9 @@ wocky_sasl_scram_server_start_finish (WockySaslScram *self,
           priv->salt = sasl_generate_base64_nonce ();
           scram_calculate_salted_password (self);
           scram_calculate_server_key (self);
-          scram_calculate_stored_key (self, NULL);
+          client_key = scram_calculate_client_key (self);
+          scram_calculate_stored_key (self, client_key);
+          g_byte_array_unref (client_key);
         }
       else if (priv->server_key == NULL || priv->stored_key == NULL
             || priv->salt == NULL || priv->iterations == 0)
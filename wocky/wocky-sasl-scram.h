@@ -27,6 +27,7 @@
 #include <glib-object.h>
 
 #include "wocky-auth-handler.h"
+#include "wocky-sasl-scram-cache.h"
 
 G_BEGIN_DECLS
 
@@ -71,6 +72,9 @@ WockySaslScram *
 wocky_sasl_scram_new (
     const gchar *server, const gchar *username, const gchar *password);
 
+void
+wocky_sasl_scram_forget_cached_keys (WockySaslScram *self);
+
 void
 wocky_sasl_scram_server_start_async (WockySaslScram      *self,
                                      gchar               *message,
@@ -61,3 +61,704 @@ sasl_calculate_hmac (GChecksumType digest_type,
   return g_byte_array_new_take (digest, len);
 }
 
+
+/* PBKDF2-HMAC (RFC 8018), as used for SCRAM's Hi() function.
+ *
+ * GHmac allocates a pair of checksums per HMAC and re-hashes the padded key
+ * every time, which dominates the cost of a few thousand iterations. Instead
+ * the inner and outer pad states are computed once, and every iteration is
+ * then exactly two compression function calls on a block which is built in
+ * place from the previous state, so the loop never allocates, never hashes
+ * the key again and never converts to bytes until the very end. */
+
+#define PBKDF2_MAX_BLOCK 128
+#define PBKDF2_MAX_WORDS 8
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+typedef union {
+  guint32 w32[PBKDF2_MAX_WORDS];
+  guint64 w64[PBKDF2_MAX_WORDS];
+} Pbkdf2State;
+
+typedef struct {
+  GChecksumType type;
+  gsize digest_len;
+  gsize block_len;
+  /* size of a state word: 4 for SHA-1 and SHA-256, 8 for SHA-384/512 */
+  gsize word_len;
+  const void *iv;
+} Pbkdf2Hash;
+
+static const guint32 sha1_iv[PBKDF2_MAX_WORDS] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+static const guint32 sha256_iv[] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+static const guint64 sha384_iv[] = {
+  G_GUINT64_CONSTANT (0xcbbb9d5dc1059ed8),
+  G_GUINT64_CONSTANT (0x629a292a367cd507),
+  G_GUINT64_CONSTANT (0x9159015a3070dd17),
+  G_GUINT64_CONSTANT (0x152fecd8f70e5939),
+  G_GUINT64_CONSTANT (0x67332667ffc00b31),
+  G_GUINT64_CONSTANT (0x8eb44a8768581511),
+  G_GUINT64_CONSTANT (0xdb0c2e0d64f98fa7),
+  G_GUINT64_CONSTANT (0x47b5481dbefa4fa4) };
+
+static const guint64 sha512_iv[] = {
+  G_GUINT64_CONSTANT (0x6a09e667f3bcc908),
+  G_GUINT64_CONSTANT (0xbb67ae8584caa73b),
+  G_GUINT64_CONSTANT (0x3c6ef372fe94f82b),
+  G_GUINT64_CONSTANT (0xa54ff53a5f1d36f1),
+  G_GUINT64_CONSTANT (0x510e527fade682d1),
+  G_GUINT64_CONSTANT (0x9b05688c2b3e6c1f),
+  G_GUINT64_CONSTANT (0x1f83d9abfb41bd6b),
+  G_GUINT64_CONSTANT (0x5be0cd19137e2179) };
+
+static const guint32 sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+static const guint64 sha512_k[80] = {
+  G_GUINT64_CONSTANT (0x428a2f98d728ae22),
+  G_GUINT64_CONSTANT (0x7137449123ef65cd),
+  G_GUINT64_CONSTANT (0xb5c0fbcfec4d3b2f),
+  G_GUINT64_CONSTANT (0xe9b5dba58189dbbc),
+  G_GUINT64_CONSTANT (0x3956c25bf348b538),
+  G_GUINT64_CONSTANT (0x59f111f1b605d019),
+  G_GUINT64_CONSTANT (0x923f82a4af194f9b),
+  G_GUINT64_CONSTANT (0xab1c5ed5da6d8118),
+  G_GUINT64_CONSTANT (0xd807aa98a3030242),
+  G_GUINT64_CONSTANT (0x12835b0145706fbe),
+  G_GUINT64_CONSTANT (0x243185be4ee4b28c),
+  G_GUINT64_CONSTANT (0x550c7dc3d5ffb4e2),
+  G_GUINT64_CONSTANT (0x72be5d74f27b896f),
+  G_GUINT64_CONSTANT (0x80deb1fe3b1696b1),
+  G_GUINT64_CONSTANT (0x9bdc06a725c71235),
+  G_GUINT64_CONSTANT (0xc19bf174cf692694),
+  G_GUINT64_CONSTANT (0xe49b69c19ef14ad2),
+  G_GUINT64_CONSTANT (0xefbe4786384f25e3),
+  G_GUINT64_CONSTANT (0x0fc19dc68b8cd5b5),
+  G_GUINT64_CONSTANT (0x240ca1cc77ac9c65),
+  G_GUINT64_CONSTANT (0x2de92c6f592b0275),
+  G_GUINT64_CONSTANT (0x4a7484aa6ea6e483),
+  G_GUINT64_CONSTANT (0x5cb0a9dcbd41fbd4),
+  G_GUINT64_CONSTANT (0x76f988da831153b5),
+  G_GUINT64_CONSTANT (0x983e5152ee66dfab),
+  G_GUINT64_CONSTANT (0xa831c66d2db43210),
+  G_GUINT64_CONSTANT (0xb00327c898fb213f),
+  G_GUINT64_CONSTANT (0xbf597fc7beef0ee4),
+  G_GUINT64_CONSTANT (0xc6e00bf33da88fc2),
+  G_GUINT64_CONSTANT (0xd5a79147930aa725),
+  G_GUINT64_CONSTANT (0x06ca6351e003826f),
+  G_GUINT64_CONSTANT (0x142929670a0e6e70),
+  G_GUINT64_CONSTANT (0x27b70a8546d22ffc),
+  G_GUINT64_CONSTANT (0x2e1b21385c26c926),
+  G_GUINT64_CONSTANT (0x4d2c6dfc5ac42aed),
+  G_GUINT64_CONSTANT (0x53380d139d95b3df),
+  G_GUINT64_CONSTANT (0x650a73548baf63de),
+  G_GUINT64_CONSTANT (0x766a0abb3c77b2a8),
+  G_GUINT64_CONSTANT (0x81c2c92e47edaee6),
+  G_GUINT64_CONSTANT (0x92722c851482353b),
+  G_GUINT64_CONSTANT (0xa2bfe8a14cf10364),
+  G_GUINT64_CONSTANT (0xa81a664bbc423001),
+  G_GUINT64_CONSTANT (0xc24b8b70d0f89791),
+  G_GUINT64_CONSTANT (0xc76c51a30654be30),
+  G_GUINT64_CONSTANT (0xd192e819d6ef5218),
+  G_GUINT64_CONSTANT (0xd69906245565a910),
+  G_GUINT64_CONSTANT (0xf40e35855771202a),
+  G_GUINT64_CONSTANT (0x106aa07032bbd1b8),
+  G_GUINT64_CONSTANT (0x19a4c116b8d2d0c8),
+  G_GUINT64_CONSTANT (0x1e376c085141ab53),
+  G_GUINT64_CONSTANT (0x2748774cdf8eeb99),
+  G_GUINT64_CONSTANT (0x34b0bcb5e19b48a8),
+  G_GUINT64_CONSTANT (0x391c0cb3c5c95a63),
+  G_GUINT64_CONSTANT (0x4ed8aa4ae3418acb),
+  G_GUINT64_CONSTANT (0x5b9cca4f7763e373),
+  G_GUINT64_CONSTANT (0x682e6ff3d6b2b8a3),
+  G_GUINT64_CONSTANT (0x748f82ee5defb2fc),
+  G_GUINT64_CONSTANT (0x78a5636f43172f60),
+  G_GUINT64_CONSTANT (0x84c87814a1f0ab72),
+  G_GUINT64_CONSTANT (0x8cc702081a6439ec),
+  G_GUINT64_CONSTANT (0x90befffa23631e28),
+  G_GUINT64_CONSTANT (0xa4506cebde82bde9),
+  G_GUINT64_CONSTANT (0xbef9a3f7b2c67915),
+  G_GUINT64_CONSTANT (0xc67178f2e372532b),
+  G_GUINT64_CONSTANT (0xca273eceea26619c),
+  G_GUINT64_CONSTANT (0xd186b8c721c0c207),
+  G_GUINT64_CONSTANT (0xeada7dd6cde0eb1e),
+  G_GUINT64_CONSTANT (0xf57d4f7fee6ed178),
+  G_GUINT64_CONSTANT (0x06f067aa72176fba),
+  G_GUINT64_CONSTANT (0x0a637dc5a2c898a6),
+  G_GUINT64_CONSTANT (0x113f9804bef90dae),
+  G_GUINT64_CONSTANT (0x1b710b35131c471b),
+  G_GUINT64_CONSTANT (0x28db77f523047d84),
+  G_GUINT64_CONSTANT (0x32caab7b40c72493),
+  G_GUINT64_CONSTANT (0x3c9ebe0a15c9bebc),
+  G_GUINT64_CONSTANT (0x431d67c49c100d4c),
+  G_GUINT64_CONSTANT (0x4cc5d4becb3e42b6),
+  G_GUINT64_CONSTANT (0x597f299cfc657e2a),
+  G_GUINT64_CONSTANT (0x5fcb6fab3ad6faec),
+  G_GUINT64_CONSTANT (0x6c44198c4a475817) };
+
+static const Pbkdf2Hash pbkdf2_hashes[] = {
+  { G_CHECKSUM_SHA1, 20, 64, 4, sha1_iv },
+  { G_CHECKSUM_SHA256, 32, 64, 4, sha256_iv },
+  { G_CHECKSUM_SHA384, 48, 128, 8, sha384_iv },
+  { G_CHECKSUM_SHA512, 64, 128, 8, sha512_iv },
+};
+
+/* The compression functions take the message block as host order words */
+static void
+sha1_compress (guint32 *st, const guint32 *in)
+{
+  guint32 w[80];
+  guint32 a = st[0], b = st[1], c = st[2], d = st[3], e = st[4];
+  guint i;
+
+  memcpy (w, in, 16 * sizeof (guint32));
+
+  for (i = 16; i < 80; i++)
+    w[i] = ROTL32 (w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  for (i = 0; i < 80; i++)
+    {
+      guint32 f, k, t;
+
+      if (i < 20)
+        {
+          f = (b & c) | (~b & d);
+          k = 0x5a827999;
+        }
+      else if (i < 40)
+        {
+          f = b ^ c ^ d;
+          k = 0x6ed9eba1;
+        }
+      else if (i < 60)
+        {
+          f = (b & c) | (b & d) | (c & d);
+          k = 0x8f1bbcdc;
+        }
+      else
+        {
+          f = b ^ c ^ d;
+          k = 0xca62c1d6;
+        }
+
+      t = ROTL32 (a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = ROTL32 (b, 30);
+      b = a;
+      a = t;
+    }
+
+  st[0] += a;
+  st[1] += b;
+  st[2] += c;
+  st[3] += d;
+  st[4] += e;
+}
+
+static void
+sha256_compress (guint32 *st, const guint32 *in)
+{
+  guint32 w[64];
+  guint32 a = st[0], b = st[1], c = st[2], d = st[3];
+  guint32 e = st[4], f = st[5], g = st[6], h = st[7];
+  guint i;
+
+  memcpy (w, in, 16 * sizeof (guint32));
+
+  for (i = 16; i < 64; i++)
+    {
+      guint32 s0 = ROTR32 (w[i - 15], 7) ^ ROTR32 (w[i - 15], 18)
+          ^ (w[i - 15] >> 3);
+      guint32 s1 = ROTR32 (w[i - 2], 17) ^ ROTR32 (w[i - 2], 19)
+          ^ (w[i - 2] >> 10);
+
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+  for (i = 0; i < 64; i++)
+    {
+      guint32 s1 = ROTR32 (e, 6) ^ ROTR32 (e, 11) ^ ROTR32 (e, 25);
+      guint32 ch = (e & f) ^ (~e & g);
+      guint32 t1 = h + s1 + ch + sha256_k[i] + w[i];
+      guint32 s0 = ROTR32 (a, 2) ^ ROTR32 (a, 13) ^ ROTR32 (a, 22);
+      guint32 maj = (a & b) ^ (a & c) ^ (b & c);
+      guint32 t2 = s0 + maj;
+
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+  st[0] += a;
+  st[1] += b;
+  st[2] += c;
+  st[3] += d;
+  st[4] += e;
+  st[5] += f;
+  st[6] += g;
+  st[7] += h;
+}
+
+static void
+sha512_compress (guint64 *st, const guint64 *in)
+{
+  guint64 w[80];
+  guint64 a = st[0], b = st[1], c = st[2], d = st[3];
+  guint64 e = st[4], f = st[5], g = st[6], h = st[7];
+  guint i;
+
+  memcpy (w, in, 16 * sizeof (guint64));
+
+  for (i = 16; i < 80; i++)
+    {
+      guint64 s0 = ROTR64 (w[i - 15], 1) ^ ROTR64 (w[i - 15], 8)
+          ^ (w[i - 15] >> 7);
+      guint64 s1 = ROTR64 (w[i - 2], 19) ^ ROTR64 (w[i - 2], 61)
+          ^ (w[i - 2] >> 6);
+
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+  for (i = 0; i < 80; i++)
+    {
+      guint64 s1 = ROTR64 (e, 14) ^ ROTR64 (e, 18) ^ ROTR64 (e, 41);
+      guint64 ch = (e & f) ^ (~e & g);
+      guint64 t1 = h + s1 + ch + sha512_k[i] + w[i];
+      guint64 s0 = ROTR64 (a, 28) ^ ROTR64 (a, 34) ^ ROTR64 (a, 39);
+      guint64 maj = (a & b) ^ (a & c) ^ (b & c);
+      guint64 t2 = s0 + maj;
+
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+  st[0] += a;
+  st[1] += b;
+  st[2] += c;
+  st[3] += d;
+  st[4] += e;
+  st[5] += f;
+  st[6] += g;
+  st[7] += h;
+}
+
+/* A block of host order words, big enough for either word size */
+typedef union {
+  guint32 w32[PBKDF2_MAX_BLOCK / 4];
+  guint64 w64[PBKDF2_MAX_BLOCK / 8];
+} Pbkdf2Block;
+
+static void
+pbkdf2_compress (const Pbkdf2Hash *hash,
+    Pbkdf2State *st,
+    const Pbkdf2Block *block)
+{
+  if (hash->word_len == 8)
+    sha512_compress (st->w64, block->w64);
+  else if (hash->type == G_CHECKSUM_SHA1)
+    sha1_compress (st->w32, block->w32);
+  else
+    sha256_compress (st->w32, block->w32);
+}
+
+static void
+pbkdf2_compress_bytes (const Pbkdf2Hash *hash,
+    Pbkdf2State *st,
+    const guint8 *data)
+{
+  Pbkdf2Block block;
+  gsize i;
+
+  if (hash->word_len == 8)
+    {
+      for (i = 0; i < 16; i++)
+        {
+          guint64 v;
+
+          memcpy (&v, data + i * 8, 8);
+          block.w64[i] = GUINT64_FROM_BE (v);
+        }
+    }
+  else
+    {
+      for (i = 0; i < 16; i++)
+        {
+          guint32 v;
+
+          memcpy (&v, data + i * 4, 4);
+          block.w32[i] = GUINT32_FROM_BE (v);
+        }
+    }
+
+  pbkdf2_compress (hash, st, &block);
+}
+
+static void
+pbkdf2_state_init (const Pbkdf2Hash *hash,
+    Pbkdf2State *st)
+{
+  memset (st, 0, sizeof (*st));
+  memcpy (st, hash->iv, PBKDF2_MAX_WORDS * hash->word_len);
+}
+
+static void
+pbkdf2_state_to_bytes (const Pbkdf2Hash *hash,
+    const Pbkdf2State *st,
+    guint8 *out,
+    gsize len)
+{
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      if (hash->word_len == 8)
+        out[i] = st->w64[i / 8] >> (56 - 8 * (i % 8));
+      else
+        out[i] = st->w32[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+/* Hash the concatenation of up to two buffers, starting from @st which has
+ * already consumed @prefix_len bytes. Only used outside of the iteration
+ * loop, for the (hashed) key and U1 */
+static void
+pbkdf2_hash (const Pbkdf2Hash *hash,
+    Pbkdf2State *st,
+    gsize prefix_len,
+    const guint8 *data1,
+    gsize len1,
+    const guint8 *data2,
+    gsize len2)
+{
+  guint8 buf[PBKDF2_MAX_BLOCK];
+  const guint8 *parts[] = { data1, data2 };
+  gsize lens[] = { len1, len2 };
+  gsize fill = 0;
+  guint64 bits = (prefix_len + len1 + len2) * 8;
+  gsize p, i;
+
+  for (p = 0; p < G_N_ELEMENTS (parts); p++)
+    {
+      for (i = 0; i < lens[p]; i++)
+        {
+          buf[fill++] = parts[p][i];
+
+          if (fill == hash->block_len)
+            {
+              pbkdf2_compress_bytes (hash, st, buf);
+              fill = 0;
+            }
+        }
+    }
+
+  buf[fill++] = 0x80;
+
+  /* The length is 8 bytes for SHA-1/256 and 16 for SHA-384/512 */
+  if (fill > hash->block_len - 2 * hash->word_len)
+    {
+      memset (buf + fill, 0, hash->block_len - fill);
+      pbkdf2_compress_bytes (hash, st, buf);
+      fill = 0;
+    }
+
+  memset (buf + fill, 0, hash->block_len - fill);
+
+  for (i = 0; i < 8; i++)
+    buf[hash->block_len - 1 - i] = bits >> (8 * i);
+
+  pbkdf2_compress_bytes (hash, st, buf);
+  memset (buf, 0, sizeof (buf));
+}
+
+/* Iteration count independent part of the derivation: the pad states */
+typedef struct {
+  const Pbkdf2Hash *hash;
+  Pbkdf2State inner;
+  Pbkdf2State outer;
+} Pbkdf2Key;
+
+static void
+pbkdf2_key_init (Pbkdf2Key *key,
+    const Pbkdf2Hash *hash,
+    const guint8 *password,
+    gsize password_len)
+{
+  guint8 pad[PBKDF2_MAX_BLOCK];
+  gsize i;
+
+  key->hash = hash;
+  memset (pad, 0, sizeof (pad));
+
+  if (password_len > hash->block_len)
+    {
+      Pbkdf2State st;
+
+      pbkdf2_state_init (hash, &st);
+      pbkdf2_hash (hash, &st, 0, password, password_len, NULL, 0);
+      pbkdf2_state_to_bytes (hash, &st, pad, hash->digest_len);
+      memset (&st, 0, sizeof (st));
+    }
+  else
+    {
+      memcpy (pad, password, password_len);
+    }
+
+  for (i = 0; i < hash->block_len; i++)
+    pad[i] ^= 0x36;
+
+  pbkdf2_state_init (hash, &key->inner);
+  pbkdf2_compress_bytes (hash, &key->inner, pad);
+
+  for (i = 0; i < hash->block_len; i++)
+    pad[i] ^= 0x36 ^ 0x5c;
+
+  pbkdf2_state_init (hash, &key->outer);
+  pbkdf2_compress_bytes (hash, &key->outer, pad);
+
+  memset (pad, 0, sizeof (pad));
+}
+
+/* Set up @block to hold a digest followed by the padding of an HMAC's second
+ * compression, which is the same for the inner and outer hash as both have
+ * consumed exactly one key block before */
+static void
+pbkdf2_block_init (const Pbkdf2Hash *hash,
+    Pbkdf2Block *block)
+{
+  gsize words = hash->digest_len / hash->word_len;
+  guint64 bits = (hash->block_len + hash->digest_len) * 8;
+
+  memset (block, 0, sizeof (*block));
+
+  if (hash->word_len == 8)
+    {
+      block->w64[words] = G_GUINT64_CONSTANT (1) << 63;
+      block->w64[15] = bits;
+    }
+  else
+    {
+      block->w32[words] = (guint32) 1 << 31;
+      block->w32[15] = bits;
+    }
+}
+
+/* Completes an HMAC whose inner hash state is in @st: runs the outer hash
+ * over it and leaves the result in @st */
+static void
+pbkdf2_outer (const Pbkdf2Key *key,
+    Pbkdf2Block *block,
+    Pbkdf2State *st)
+{
+  memcpy (block, st, key->hash->digest_len);
+  memcpy (st, &key->outer, sizeof (*st));
+  pbkdf2_compress (key->hash, st, block);
+}
+
+/* T_index = U_1 ^ U_2 ^ ... ^ U_iterations */
+static void
+pbkdf2_block (const Pbkdf2Key *key,
+    const guint8 *salt,
+    gsize salt_len,
+    guint32 index,
+    guint64 iterations,
+    Pbkdf2State *result)
+{
+  const Pbkdf2Hash *hash = key->hash;
+  Pbkdf2Block block;
+  Pbkdf2State u;
+  guint8 be_index[4];
+  gsize words = hash->digest_len / hash->word_len;
+  guint64 n;
+  gsize i;
+
+  be_index[0] = index >> 24;
+  be_index[1] = index >> 16;
+  be_index[2] = index >> 8;
+  be_index[3] = index;
+
+  pbkdf2_block_init (hash, &block);
+
+  /* U_1 = HMAC (P, S || INT (i)) */
+  memcpy (&u, &key->inner, sizeof (u));
+  pbkdf2_hash (hash, &u, hash->block_len, salt, salt_len,
+      be_index, sizeof (be_index));
+  pbkdf2_outer (key, &block, &u);
+  memcpy (result, &u, sizeof (u));
+
+  /* U_n = HMAC (P, U_n-1), two compressions each. The digest words go
+   * straight into the next block, in front of the fixed padding */
+  for (n = 1; n < iterations; n++)
+    {
+      memcpy (&block, &u, hash->digest_len);
+      memcpy (&u, &key->inner, sizeof (u));
+      pbkdf2_compress (hash, &u, &block);
+
+      pbkdf2_outer (key, &block, &u);
+
+      if (hash->word_len == 8)
+        {
+          for (i = 0; i < words; i++)
+            result->w64[i] ^= u.w64[i];
+        }
+      else
+        {
+          for (i = 0; i < words; i++)
+            result->w32[i] ^= u.w32[i];
+        }
+    }
+
+  memset (&u, 0, sizeof (u));
+  memset (&block, 0, sizeof (block));
+}
+
+/* Generic version for digests the kernel above doesn't know about */
+static void
+pbkdf2_block_slow (GChecksumType digest_type,
+    const guint8 *password,
+    gsize password_len,
+    const guint8 *salt,
+    gsize salt_len,
+    guint32 index,
+    guint64 iterations,
+    guint8 *result)
+{
+  GHmac *hmac = g_hmac_new (digest_type, password, password_len);
+  gsize digest_len = g_checksum_type_get_length (digest_type);
+  guint8 u[PBKDF2_MAX_BLOCK];
+  guint8 be_index[4];
+  gsize len;
+  guint64 n;
+  gsize i;
+
+  be_index[0] = index >> 24;
+  be_index[1] = index >> 16;
+  be_index[2] = index >> 8;
+  be_index[3] = index;
+
+  g_hmac_update (hmac, salt, salt_len);
+  g_hmac_update (hmac, be_index, sizeof (be_index));
+  len = digest_len;
+  g_hmac_get_digest (hmac, u, &len);
+  g_hmac_unref (hmac);
+  memcpy (result, u, digest_len);
+
+  for (n = 1; n < iterations; n++)
+    {
+      hmac = g_hmac_new (digest_type, password, password_len);
+      g_hmac_update (hmac, u, digest_len);
+      len = digest_len;
+      g_hmac_get_digest (hmac, u, &len);
+      g_hmac_unref (hmac);
+
+      for (i = 0; i < digest_len; i++)
+        result[i] ^= u[i];
+    }
+
+  memset (u, 0, sizeof (u));
+}
+
+/**
+ * sasl_pbkdf2_hmac:
+ * @digest_type: the hash function to use for the HMAC
+ * @password: the password
+ * @password_len: the length of @password
+ * @salt: the salt
+ * @salt_len: the length of @salt
+ * @iterations: the iteration count, at least 1
+ * @out: buffer for the derived key
+ * @out_len: the number of bytes to derive into @out
+ *
+ * Derives a key using PBKDF2 with HMAC-@digest_type as its pseudorandom
+ * function, as per RFC 8018. With @out_len set to the digest length this is
+ * the Hi() function of SCRAM (RFC 5802).
+ */
+void
+sasl_pbkdf2_hmac (GChecksumType digest_type,
+    const guint8 *password,
+    gsize password_len,
+    const guint8 *salt,
+    gsize salt_len,
+    guint64 iterations,
+    guint8 *out,
+    gsize out_len)
+{
+  const Pbkdf2Hash *hash = NULL;
+  Pbkdf2Key key;
+  gsize digest_len = g_checksum_type_get_length (digest_type);
+  guint32 index;
+  gsize i;
+
+  g_return_if_fail (iterations > 0);
+
+  for (i = 0; i < G_N_ELEMENTS (pbkdf2_hashes); i++)
+    {
+      if (pbkdf2_hashes[i].type == digest_type)
+        hash = pbkdf2_hashes + i;
+    }
+
+  if (hash != NULL)
+    pbkdf2_key_init (&key, hash, password, password_len);
+
+  for (index = 1; out_len > 0; index++)
+    {
+      gsize len = MIN (out_len, digest_len);
+
+      if (hash != NULL)
+        {
+          Pbkdf2State t;
+
+          pbkdf2_block (&key, salt, salt_len, index, iterations, &t);
+          pbkdf2_state_to_bytes (hash, &t, out, len);
+          memset (&t, 0, sizeof (t));
+        }
+      else
+        {
+          guint8 t[PBKDF2_MAX_BLOCK];
+
+          pbkdf2_block_slow (digest_type, password, password_len,
+              salt, salt_len, index, iterations, t);
+          memcpy (out, t, len);
+          memset (t, 0, sizeof (t));
+        }
+
+      out += len;
+      out_len -= len;
+    }
+
+  memset (&key, 0, sizeof (key));
+}
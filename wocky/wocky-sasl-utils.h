@@ -33,5 +33,13 @@ GByteArray * sasl_calculate_hmac (GChecksumType digest_type,
     gsize key_len,
     guint8 *text,
     gsize text_len);
+void sasl_pbkdf2_hmac (GChecksumType digest_type,
+    const guint8 *password,
+    gsize password_len,
+    const guint8 *salt,
+    gsize salt_len,
+    guint64 iterations,
+    guint8 *out,
+    gsize out_len);
 
 #endif /* __WOCKY_SASL_UTILS_H__ */
@@ -0,0 +1,40 @@
+/*
+ * wocky-stanza-internal.h - internal methods for WockyStanza
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_COMPILATION)
+# error "This is an internal header."
+#endif
+
+#ifndef WOCKY_STANZA_INTERNAL_H
+#define WOCKY_STANZA_INTERNAL_H
+
+#include "wocky-stanza.h"
+
+G_BEGIN_DECLS
+
+void _wocky_stanza_classify (WockyStanza *stanza);
+const gchar *_wocky_stanza_get_sub_type_name (WockyStanzaSubType sub_type);
+
+/* Classifies @node as though it were a stanza's top node, without caching
+ * anything. WockyStanza's class must have been initialised. */
+void _wocky_stanza_classify_node (WockyNode *node,
+    WockyStanzaType *type,
+    WockyStanzaSubType *sub_type);
+
+G_END_DECLS
+
+#endif /* WOCKY_STANZA_INTERNAL_H */
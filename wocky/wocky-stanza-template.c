@@ -0,0 +1,438 @@
+/*
+ * wocky-stanza-template.c - Source for WockyStanzaTemplate
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SECTION: wocky-stanza-template
+ * @title: WockyStanzaTemplate
+ * @short_description: Stanzas compiled once and filled in many times
+ * @include: wocky/wocky-stanza-template.h
+ *
+ * wocky_stanza_build() interprets its specification, and looks up the
+ * names and namespaces in it, every time it is called. A
+ * #WockyStanzaTemplate does that once, in wocky_stanza_template_new(), and
+ * remembers where the parts which vary between stanzas go as named slots.
+ * Instantiating it copies the compiled stanza and fills in the slots.
+ *
+ * <example><programlisting>
+ * ping = wocky_stanza_template_new (
+ *     WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_GET, NULL, NULL,
+ *     '?', "to", "to",
+ *     '?', "id", "id",
+ *     '(', "ping", ':', WOCKY_XMPP_NS_PING, ')',
+ *     NULL);
+ *
+ * stanza = wocky_stanza_template_instantiate (ping,
+ *     "to", "example.com",
+ *     "id", id,
+ *     NULL);
+ * </programlisting></example>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-stanza-template.h"
+
+#include <string.h>
+
+#include "wocky-intern-internal.h"
+#include "wocky-node-private.h"
+#include "wocky-stanza-internal.h"
+
+typedef struct {
+  /* interned */
+  const gchar *name;
+  /* interned, or NULL for the node's content */
+  const gchar *key;
+  /* indices of the children to follow from the top node */
+  guint depth;
+  guint *path;
+} Slot;
+
+struct _WockyStanzaTemplate {
+  gint ref_count;
+  WockyStanza *prototype;
+  guint n_slots;
+  Slot *slots;
+};
+
+G_DEFINE_BOXED_TYPE (WockyStanzaTemplate, wocky_stanza_template,
+    wocky_stanza_template_ref, wocky_stanza_template_unref)
+
+static void
+add_slot (GArray *slots,
+    GArray *path,
+    const gchar *key,
+    const gchar *name)
+{
+  Slot slot;
+  guint i;
+
+  g_assert (name != NULL);
+
+  slot.name = g_intern_string (name);
+  slot.key = (key != NULL) ? _wocky_intern_permanent (key) : NULL;
+  slot.depth = path->len;
+  slot.path = NULL;
+
+  if (path->len > 0)
+    {
+      slot.path = g_new (guint, path->len);
+      memcpy (slot.path, path->data, path->len * sizeof (guint));
+    }
+
+  for (i = 0; i < slots->len; i++)
+    if (g_array_index (slots, Slot, i).name == slot.name)
+      g_critical ("slot '%s' is used more than once", name);
+
+  g_array_append_val (slots, slot);
+}
+
+/**
+ * wocky_stanza_template_new:
+ * @type: The type of stanza to build
+ * @sub_type: The stanza's subtype
+ * @from: The sender's JID, or %NULL to leave it unspecified or fill it in
+ *  from a slot
+ * @to: The target's JID, or %NULL to leave it unspecified or fill it in
+ *  from a slot
+ * @...: the description of the stanza, as for wocky_stanza_build() but
+ *  with #WockyStanzaTemplateTag<!-- -->s for the slots, terminated with
+ *  %NULL
+ *
+ * Compiles a template for stanzas built by wocky_stanza_build() with the
+ * same arguments, except for the values given to each slot when the
+ * template is instantiated. Each slot must have a different name. Slots
+ * are numbered from 0 in the order they appear in the specification, for
+ * wocky_stanza_template_instantiate_values().
+ *
+ * Returns: a new template, or %NULL if @sub_type isn't valid for @type
+ */
+WockyStanzaTemplate *
+wocky_stanza_template_new (WockyStanzaType type,
+    WockyStanzaSubType sub_type,
+    const gchar *from,
+    const gchar *to,
+    ...)
+{
+  WockyStanzaTemplate *tmpl;
+  WockyStanza *prototype;
+  GPtrArray *stack;
+  GArray *path, *slots;
+  gint arg;
+  va_list ap;
+
+  prototype = wocky_stanza_build (type, sub_type, from, to, NULL);
+
+  if (prototype == NULL)
+    return NULL;
+
+  stack = g_ptr_array_new ();
+  g_ptr_array_add (stack, wocky_stanza_get_top_node (prototype));
+  path = g_array_new (FALSE, FALSE, sizeof (guint));
+  slots = g_array_new (FALSE, FALSE, sizeof (Slot));
+
+  va_start (ap, to);
+
+  while ((arg = va_arg (ap, gint)) != 0)
+    {
+      WockyNode *node = g_ptr_array_index (stack, stack->len - 1);
+
+      switch (arg)
+        {
+        case WOCKY_NODE_ATTRIBUTE:
+          {
+            gchar *key = va_arg (ap, gchar *);
+            gchar *value = va_arg (ap, gchar *);
+
+            g_assert (key != NULL);
+            g_assert (value != NULL);
+            wocky_node_set_attribute (node, key, value);
+          }
+          break;
+
+        case WOCKY_NODE_START:
+          {
+            gchar *name = va_arg (ap, gchar *);
+            guint n_children, position;
+
+            g_assert (name != NULL);
+            g_ptr_array_add (stack, wocky_node_add_child (node, name));
+            _wocky_node_get_children (node, &n_children);
+            position = n_children - 1;
+            g_array_append_val (path, position);
+          }
+          break;
+
+        case WOCKY_NODE_TEXT:
+          wocky_node_set_content (node, va_arg (ap, gchar *));
+          break;
+
+        case WOCKY_NODE_XMLNS:
+          {
+            gchar *ns = va_arg (ap, gchar *);
+
+            g_assert (ns != NULL);
+            node->ns = g_quark_from_string (ns);
+          }
+          break;
+
+        case WOCKY_NODE_LANGUAGE:
+          {
+            gchar *lang = va_arg (ap, gchar *);
+
+            g_assert (lang != NULL);
+            wocky_node_set_language (node, lang);
+          }
+          break;
+
+        case WOCKY_NODE_END:
+          /* never pop the top node */
+          g_warn_if_fail (stack->len > 1);
+
+          if (stack->len > 1)
+            {
+              g_ptr_array_set_size (stack, stack->len - 1);
+              g_array_set_size (path, path->len - 1);
+            }
+          break;
+
+        case WOCKY_STANZA_TEMPLATE_ATTRIBUTE_SLOT:
+          {
+            gchar *key = va_arg (ap, gchar *);
+            gchar *name = va_arg (ap, gchar *);
+
+            g_assert (key != NULL);
+            add_slot (slots, path, key, name);
+          }
+          break;
+
+        case WOCKY_STANZA_TEMPLATE_TEXT_SLOT:
+          add_slot (slots, path, NULL, va_arg (ap, gchar *));
+          break;
+
+        default:
+          /* including WOCKY_NODE_ASSIGN_TO: there are no nodes to assign
+           * until the template is instantiated */
+          g_critical ("unknown template tag %c", arg);
+          g_assert_not_reached ();
+        }
+    }
+
+  va_end (ap);
+
+  if (G_UNLIKELY (stack->len > 1))
+    g_warning ("improperly nested template spec! %u elements unclosed",
+        stack->len - 1);
+
+  g_ptr_array_unref (stack);
+  g_array_unref (path);
+
+  /* so that instances start out classified, too */
+  _wocky_stanza_classify (prototype);
+
+  tmpl = g_slice_new0 (WockyStanzaTemplate);
+  tmpl->ref_count = 1;
+  tmpl->prototype = prototype;
+  tmpl->n_slots = slots->len;
+  tmpl->slots = (Slot *) g_array_free (slots, FALSE);
+
+  return tmpl;
+}
+
+/**
+ * wocky_stanza_template_ref:
+ * @tmpl: a template
+ *
+ * Increments @tmpl's reference count.
+ *
+ * Returns: @tmpl
+ */
+WockyStanzaTemplate *
+wocky_stanza_template_ref (WockyStanzaTemplate *tmpl)
+{
+  g_return_val_if_fail (tmpl != NULL, NULL);
+
+  g_atomic_int_inc (&tmpl->ref_count);
+  return tmpl;
+}
+
+/**
+ * wocky_stanza_template_unref:
+ * @tmpl: a template
+ *
+ * Decrements @tmpl's reference count, freeing it if this was the last
+ * reference.
+ */
+void
+wocky_stanza_template_unref (WockyStanzaTemplate *tmpl)
+{
+  guint i;
+
+  g_return_if_fail (tmpl != NULL);
+
+  if (!g_atomic_int_dec_and_test (&tmpl->ref_count))
+    return;
+
+  for (i = 0; i < tmpl->n_slots; i++)
+    g_free (tmpl->slots[i].path);
+
+  g_free (tmpl->slots);
+  g_object_unref (tmpl->prototype);
+  g_slice_free (WockyStanzaTemplate, tmpl);
+}
+
+/**
+ * wocky_stanza_template_get_n_slots:
+ * @tmpl: a template
+ *
+ * Returns: the number of slots in @tmpl
+ */
+guint
+wocky_stanza_template_get_n_slots (WockyStanzaTemplate *tmpl)
+{
+  g_return_val_if_fail (tmpl != NULL, 0);
+
+  return tmpl->n_slots;
+}
+
+/**
+ * wocky_stanza_template_get_slot:
+ * @tmpl: a template
+ * @name: the name of a slot
+ *
+ * Returns: the number of the slot called @name, for
+ *  wocky_stanza_template_instantiate_values(), or -1 if @tmpl has no such
+ *  slot
+ */
+gint
+wocky_stanza_template_get_slot (WockyStanzaTemplate *tmpl,
+    const gchar *name)
+{
+  guint i;
+
+  g_return_val_if_fail (tmpl != NULL, -1);
+  g_return_val_if_fail (name != NULL, -1);
+
+  for (i = 0; i < tmpl->n_slots; i++)
+    if (!strcmp (tmpl->slots[i].name, name))
+      return i;
+
+  return -1;
+}
+
+static void
+fill_slot (WockyNode *top,
+    const Slot *slot,
+    const gchar *value)
+{
+  WockyNode *node = top;
+  guint i;
+
+  if (value == NULL)
+    return;
+
+  /* instances are copies of the prototype, so have children in the same
+   * places */
+  for (i = 0; i < slot->depth; i++)
+    {
+      guint n_children;
+      WockyNode **children = _wocky_node_get_children (node, &n_children);
+
+      g_assert (slot->path[i] < n_children);
+      node = children[slot->path[i]];
+    }
+
+  if (slot->key != NULL)
+    wocky_node_set_attribute (node, slot->key, value);
+  else
+    wocky_node_set_content (node, value);
+}
+
+/**
+ * wocky_stanza_template_instantiate_values:
+ * @tmpl: a template
+ * @values: (array): the value of each of @tmpl's slots, in order, any of
+ *  which may be %NULL
+ *
+ * Builds a stanza from @tmpl, without looking up slots by name.
+ *
+ * Returns: (transfer full): a new stanza
+ */
+WockyStanza *
+wocky_stanza_template_instantiate_values (WockyStanzaTemplate *tmpl,
+    const gchar * const *values)
+{
+  WockyStanza *stanza;
+  WockyNode *top;
+  guint i;
+
+  g_return_val_if_fail (tmpl != NULL, NULL);
+  g_return_val_if_fail (values != NULL || tmpl->n_slots == 0, NULL);
+
+  stanza = wocky_stanza_copy (tmpl->prototype);
+  top = wocky_stanza_get_top_node (stanza);
+
+  for (i = 0; i < tmpl->n_slots; i++)
+    fill_slot (top, tmpl->slots + i, values[i]);
+
+  return stanza;
+}
+
+/**
+ * wocky_stanza_template_instantiate:
+ * @tmpl: a template
+ * @...: pairs of a slot name and its value, terminated with %NULL. Slots
+ *  which aren't given are left empty, as if their value was %NULL
+ *
+ * Builds a stanza from @tmpl.
+ *
+ * Returns: (transfer full): a new stanza
+ */
+WockyStanza *
+wocky_stanza_template_instantiate (WockyStanzaTemplate *tmpl,
+    ...)
+{
+  WockyStanza *stanza;
+  WockyNode *top;
+  const gchar *name;
+  va_list ap;
+
+  g_return_val_if_fail (tmpl != NULL, NULL);
+
+  stanza = wocky_stanza_copy (tmpl->prototype);
+  top = wocky_stanza_get_top_node (stanza);
+
+  va_start (ap, tmpl);
+
+  while ((name = va_arg (ap, const gchar *)) != NULL)
+    {
+      const gchar *value = va_arg (ap, const gchar *);
+      gint i = wocky_stanza_template_get_slot (tmpl, name);
+
+      if (i < 0)
+        g_critical ("template has no slot '%s'", name);
+      else
+        fill_slot (top, tmpl->slots + i, value);
+    }
+
+  va_end (ap);
+
+  return stanza;
+}
@@ -0,0 +1,82 @@
+/*
+ * wocky-stanza-template.h - Header for WockyStanzaTemplate
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_H_INSIDE) && !defined (WOCKY_COMPILATION)
+# error "Only <wocky/wocky.h> can be included directly."
+#endif
+
+#ifndef __WOCKY_STANZA_TEMPLATE_H__
+#define __WOCKY_STANZA_TEMPLATE_H__
+
+#include <glib-object.h>
+
+#include "wocky-stanza.h"
+
+G_BEGIN_DECLS
+
+/**
+ * WockyStanzaTemplateTag:
+ * @WOCKY_STANZA_TEMPLATE_ATTRIBUTE_SLOT: followed by an attribute key and a
+ *  slot name: the attribute is set to the slot's value, or left out if the
+ *  slot's value is %NULL
+ * @WOCKY_STANZA_TEMPLATE_TEXT_SLOT: followed by a slot name: the current
+ *  node's content is set to the slot's value, unless it is %NULL
+ *
+ * Tags which may be used in a wocky_stanza_template_new() specification, in
+ * addition to the #WockyNodeBuildTag<!-- -->s other than
+ * %WOCKY_NODE_ASSIGN_TO.
+ */
+typedef enum {
+  WOCKY_STANZA_TEMPLATE_ATTRIBUTE_SLOT = '?',
+  WOCKY_STANZA_TEMPLATE_TEXT_SLOT = '%',
+} WockyStanzaTemplateTag;
+
+/**
+ * WockyStanzaTemplate:
+ *
+ * A stanza compiled once from a wocky_stanza_build() specification, with
+ * named slots to fill in each time it is instantiated. Templates are
+ * immutable once compiled, so may be shared freely.
+ */
+typedef struct _WockyStanzaTemplate WockyStanzaTemplate;
+
+#define WOCKY_TYPE_STANZA_TEMPLATE (wocky_stanza_template_get_type ())
+GType wocky_stanza_template_get_type (void);
+
+WockyStanzaTemplate *wocky_stanza_template_new (WockyStanzaType type,
+    WockyStanzaSubType sub_type,
+    const gchar *from,
+    const gchar *to,
+    ...) G_GNUC_NULL_TERMINATED G_GNUC_WARN_UNUSED_RESULT;
+WockyStanzaTemplate *wocky_stanza_template_ref (
+    WockyStanzaTemplate *tmpl);
+void wocky_stanza_template_unref (WockyStanzaTemplate *tmpl);
+
+guint wocky_stanza_template_get_n_slots (WockyStanzaTemplate *tmpl);
+gint wocky_stanza_template_get_slot (WockyStanzaTemplate *tmpl,
+    const gchar *name);
+
+WockyStanza *wocky_stanza_template_instantiate (
+    WockyStanzaTemplate *tmpl,
+    ...) G_GNUC_NULL_TERMINATED;
+WockyStanza *wocky_stanza_template_instantiate_values (
+    WockyStanzaTemplate *tmpl,
+    const gchar * const *values);
+
+G_END_DECLS
+
+#endif /* #ifndef __WOCKY_STANZA_TEMPLATE_H__ */
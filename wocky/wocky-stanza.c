@@ -31,7 +31,9 @@
 #include "wocky-namespaces.h"
 #include "wocky-debug-internal.h"
 
+#include "wocky-intern-internal.h"
 #include "wocky-node-private.h"
+#include "wocky-stanza-internal.h"
 
 /* private structure */
 struct _WockyStanzaPrivate
@@ -39,6 +41,14 @@ struct _WockyStanzaPrivate
   WockyContact *from_contact;
   WockyContact *to_contact;
 
+  /* Cached by classify(). The top node's name and namespace never change,
+   * but sub_type is stale once the top node's serial moves past
+   * classified_serial. */
+  gboolean classified;
+  guint classified_serial;
+  WockyStanzaType type;
+  WockyStanzaSubType sub_type;
+
   gboolean dispose_has_run;
 };
 
@@ -137,6 +147,56 @@ static const StanzaSubTypeName sub_type_names[NUM_WOCKY_STANZA_SUB_TYPE] =
         WOCKY_STANZA_TYPE_UNKNOWN },
 };
 
+/* A perfect hash over the names in both type_names and sub_type_names: no
+ * two names in the same table share a slot, as build_classify_slots()
+ * checks. @len must be at least 2; the third byte of a two-byte name is its
+ * nul. */
+#define CLASSIFY_SLOTS 32
+
+static guint
+classify_hash (const gchar *name,
+    gsize len)
+{
+  const guchar *s = (const guchar *) name;
+
+  return (s[0] + 2 * s[2] + s[len - 1] + 3 * len) % CLASSIFY_SLOTS;
+}
+
+/* Indices into type_names and sub_type_names; 0 is an empty slot */
+static guint8 type_slots[CLASSIFY_SLOTS];
+static guint8 sub_type_slots[CLASSIFY_SLOTS];
+
+static const gchar *type_key;
+
+static void
+build_classify_slots (void)
+{
+  guint i, h;
+
+  /* names are interned so that a hit can be confirmed by address */
+  for (i = 1; type_names[i].type != WOCKY_STANZA_TYPE_UNKNOWN; i++)
+    {
+      type_names[i].name = _wocky_intern_static (type_names[i].name);
+      h = classify_hash (type_names[i].name, strlen (type_names[i].name));
+      g_assert (type_slots[h] == 0);
+      type_slots[h] = i;
+    }
+
+  for (i = 1; i < WOCKY_STANZA_SUB_TYPE_UNKNOWN; i++)
+    {
+      /* available has no name */
+      if (sub_type_names[i].name == NULL)
+        continue;
+
+      h = classify_hash (sub_type_names[i].name,
+          strlen (sub_type_names[i].name));
+      g_assert (sub_type_slots[h] == 0);
+      sub_type_slots[h] = i;
+    }
+
+  type_key = _wocky_intern_static ("type");
+}
+
 static void
 wocky_stanza_init (WockyStanza *self)
 {
@@ -157,7 +217,11 @@ wocky_stanza_class_init (WockyStanzaClass *wocky_stanza_class)
   object_class->dispose = wocky_stanza_dispose;
   object_class->finalize = wocky_stanza_finalize;
 
+  /* GType runs this exactly once, whichever thread makes the first stanza,
+   * and before any stanza exists; the tables are only read from then on,
+   * so need no locking */
   fill_in_namespace_quarks ();
+  build_classify_slots ();
 }
 
 static void
@@ -209,16 +273,41 @@ wocky_stanza_new (const gchar *name,
   return result;
 }
 
+/**
+ * wocky_stanza_copy:
+ * @old: a stanza
+ *
+ * Copies @old. If @old has been sealed with wocky_node_seal(), only its top
+ * node is copied and everything below it is shared with @old; see
+ * wocky_node_make_child_writable() to change anything other than the top
+ * node of such a copy.
+ *
+ * Returns: (transfer full): a new stanza, whose top node isn't sealed
+ */
 WockyStanza *
 wocky_stanza_copy (WockyStanza *old)
 {
+  WockyNode *old_top = wocky_stanza_get_top_node (old);
   WockyNode *top;
+  WockyStanza *copy;
 
-  top = _wocky_node_copy (wocky_stanza_get_top_node (old));
+  top = _wocky_node_copy (old_top);
 
-  return g_object_new (WOCKY_TYPE_STANZA,
+  copy = g_object_new (WOCKY_TYPE_STANZA,
       "top-node", top,
       NULL);
+
+  /* the copy's attributes are the same, so the classification is too */
+  if (old->priv->classified &&
+      old->priv->classified_serial == old_top->serial)
+    {
+      copy->priv->classified = TRUE;
+      copy->priv->classified_serial = top->serial;
+      copy->priv->type = old->priv->type;
+      copy->priv->sub_type = old->priv->sub_type;
+    }
+
+  return copy;
 }
 
 static const gchar *
@@ -433,22 +522,23 @@ static WockyStanzaType
 get_type_from_node (WockyNode *node)
 {
   const gchar *name = node->name;
-  GQuark ns = node->ns;
+  gsize len;
   guint i;
 
   if (name == NULL)
     return WOCKY_STANZA_TYPE_NONE;
 
-  /* We skip the first entry as it's NONE */
-  for (i = 1; i < WOCKY_STANZA_TYPE_UNKNOWN; i++)
-    {
-       if (type_names[i].name != NULL &&
-           ns == type_names[i].ns_q &&
-           strcmp (name, type_names[i].name) == 0)
-         {
-           return type_names[i].type;
-         }
-    }
+  len = strlen (name);
+
+  if (len < 2)
+    return WOCKY_STANZA_TYPE_UNKNOWN;
+
+  /* node names are usually interned, and so need no strcmp() */
+  i = type_slots[classify_hash (name, len)];
+
+  if (i != 0 && _wocky_intern_equal (name, type_names[i].name) &&
+      node->ns == type_names[i].ns_q)
+    return type_names[i].type;
 
   return WOCKY_STANZA_TYPE_UNKNOWN;
 }
@@ -456,42 +546,107 @@ get_type_from_node (WockyNode *node)
 static WockyStanzaSubType
 get_sub_type_from_name (const gchar *name)
 {
+  gsize len;
   guint i;
 
   if (name == NULL)
     return WOCKY_STANZA_SUB_TYPE_NONE;
 
-  /* We skip the first entry as it's NONE */
-  for (i = 1; i < WOCKY_STANZA_SUB_TYPE_UNKNOWN; i++)
+  len = strlen (name);
+
+  if (len < 2)
+    return WOCKY_STANZA_SUB_TYPE_UNKNOWN;
+
+  i = sub_type_slots[classify_hash (name, len)];
+
+  if (i != 0 && strcmp (name, sub_type_names[i].name) == 0)
+    return sub_type_names[i].sub_type;
+
+  return WOCKY_STANZA_SUB_TYPE_UNKNOWN;
+}
+
+void
+_wocky_stanza_classify_node (WockyNode *node,
+    WockyStanzaType *type,
+    WockyStanzaSubType *sub_type)
+{
+  if (type != NULL)
+    *type = get_type_from_node (node);
+
+  if (sub_type != NULL)
+    *sub_type = get_sub_type_from_name (
+        _wocky_node_get_attribute_interned (node, type_key));
+}
+
+static WockyStanzaPrivate *
+classify (WockyStanza *stanza)
+{
+  WockyStanzaPrivate *priv = stanza->priv;
+  WockyNode *top_node = wocky_stanza_get_top_node (stanza);
+
+  g_assert (top_node != NULL);
+
+  if (!priv->classified)
+    {
+      _wocky_stanza_classify_node (top_node, &priv->type, &priv->sub_type);
+      priv->classified = TRUE;
+    }
+  else if (priv->classified_serial != top_node->serial)
     {
-      if (sub_type_names[i].name != NULL &&
-          strcmp (name, sub_type_names[i].name) == 0)
-        {
-          return sub_type_names[i].sub_type;
-        }
+      _wocky_stanza_classify_node (top_node, NULL, &priv->sub_type);
     }
 
-  return WOCKY_STANZA_SUB_TYPE_UNKNOWN;
+  priv->classified_serial = top_node->serial;
+  return priv;
+}
+
+/*
+ * _wocky_stanza_classify:
+ * @stanza: a stanza
+ *
+ * Works out @stanza's type and sub-type now, rather than the first time
+ * wocky_stanza_get_type_info() is called. The reader calls this as it
+ * finishes each stanza.
+ */
+void
+_wocky_stanza_classify (WockyStanza *stanza)
+{
+  classify (stanza);
+}
+
+/* The value of the type attribute for @sub_type, or NULL if it has none */
+const gchar *
+_wocky_stanza_get_sub_type_name (WockyStanzaSubType sub_type)
+{
+  return get_sub_type_name (sub_type);
 }
 
+/**
+ * wocky_stanza_get_type_info:
+ * @stanza: a stanza
+ * @type: (out) (allow-none): set to @stanza's type
+ * @sub_type: (out) (allow-none): set to @stanza's sub-type
+ *
+ * Gets the type and sub-type of @stanza, from the name of its top node and
+ * its <code>type</code> attribute. These are only worked out once, and
+ * again if the top node's attributes change.
+ */
 void
 wocky_stanza_get_type_info (WockyStanza *stanza,
     WockyStanzaType *type,
     WockyStanzaSubType *sub_type)
 {
-  WockyNode *top_node;
+  WockyStanzaPrivate *priv;
 
   g_return_if_fail (stanza != NULL);
 
-  top_node = wocky_stanza_get_top_node (stanza);
-  g_assert (top_node != NULL);
+  priv = classify (stanza);
 
   if (type != NULL)
-    *type = get_type_from_node (top_node);
+    *type = priv->type;
 
   if (sub_type != NULL)
-    *sub_type = get_sub_type_from_name (
-        wocky_node_get_attribute (top_node, "type"));
+    *sub_type = priv->sub_type;
 }
 
 gboolean
@@ -676,7 +831,7 @@ wocky_stanza_extract_errors (WockyStanza *stanza,
     GError **specialized,
     WockyNode **specialized_node)
 {
-  WockyStanzaSubType sub_type;
+  WockyStanzaSubType sub_type = WOCKY_STANZA_SUB_TYPE_NONE;
   WockyNode *error;
 
   wocky_stanza_get_type_info (stanza, NULL, &sub_type);
@@ -0,0 +1,51 @@
+/*
+ * wocky-utf8-internal.h - UTF-8 validation for node strings
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#if !defined (WOCKY_COMPILATION)
+# error "This is an internal header."
+#endif
+
+#ifndef WOCKY_UTF8_INTERNAL_H
+#define WOCKY_UTF8_INTERNAL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  WOCKY_UTF8_IMPL_SCALAR,
+  WOCKY_UTF8_IMPL_SSE2,
+  WOCKY_UTF8_IMPL_AVX2,
+  WOCKY_UTF8_IMPL_NEON,
+  WOCKY_UTF8_N_IMPLS
+} WockyUtf8Impl;
+
+gboolean _wocky_utf8_impl_is_supported (WockyUtf8Impl impl);
+const gchar *_wocky_utf8_impl_get_name (WockyUtf8Impl impl);
+gsize _wocky_utf8_validate_with (WockyUtf8Impl impl,
+    const gchar *str,
+    gsize len);
+
+gboolean _wocky_utf8_validate (const gchar *str,
+    gssize len,
+    const gchar **end);
+gchar *_wocky_utf8_make_valid (const gchar *str,
+    gssize len);
+
+G_END_DECLS
+
+#endif /* WOCKY_UTF8_INTERNAL_H */
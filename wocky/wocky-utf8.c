@@ -0,0 +1,586 @@
+/*
+ * wocky-utf8.c - UTF-8 validation for node strings
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Every name, attribute value and text chunk which goes into a WockyNode is
+ * checked to be UTF-8, and anything that isn't is replaced. Nearly all of it
+ * is valid, and most of it is ASCII, so the checks here are built to get
+ * through that quickly: whole words or vectors of ASCII at a time, and with
+ * AVX2 whole vectors of any UTF-8 at a time, using the lookup algorithm from
+ * Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+ * Byte" (2021). The implementation is picked once, when first needed,
+ * according to what the CPU can do.
+ *
+ * They all accept exactly what g_utf8_validate() with a length does: no
+ * overlong forms, surrogates, code points past U+10FFFF, truncated
+ * characters or NULs.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "wocky-utf8-internal.h"
+
+#include <string.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+# define HAVE_X86_SIMD 1
+# include <immintrin.h>
+#endif
+
+#if defined (__aarch64__) && defined (__ARM_NEON)
+# define HAVE_NEON 1
+# include <arm_neon.h>
+#endif
+
+typedef gsize (*ValidateFunc) (const guchar *s,
+    gsize len);
+
+/* If the eight bytes at @s are all ASCII and non-zero */
+static inline gboolean
+word_is_ascii (const guchar *s)
+{
+  const guint64 low = G_GUINT64_CONSTANT (0x0101010101010101);
+  const guint64 high = G_GUINT64_CONSTANT (0x8080808080808080);
+  guint64 w;
+
+  memcpy (&w, s, sizeof (w));
+
+  /* a high bit set in w is non-ASCII; one set in (w - low) & ~w is a zero */
+  return ((w | ((w - low) & ~w)) & high) == 0;
+}
+
+/* Returns the length of the character at @s[@i], or 0 if it is invalid or
+ * incomplete. */
+static inline gsize
+char_length (const guchar *s,
+    gsize len,
+    gsize i)
+{
+  guchar c = s[i];
+  guchar lo = 0x80, hi = 0xbf;
+  gsize n, k;
+
+  if (c < 0x80)
+    return c != 0 ? 1 : 0;
+  else if (c < 0xc2)
+    /* a continuation byte, or an overlong two-byte form */
+    return 0;
+  else if (c < 0xe0)
+    n = 2;
+  else if (c < 0xf0)
+    {
+      n = 3;
+
+      if (c == 0xe0)
+        lo = 0xa0; /* overlong */
+      else if (c == 0xed)
+        hi = 0x9f; /* surrogates */
+    }
+  else if (c < 0xf5)
+    {
+      n = 4;
+
+      if (c == 0xf0)
+        lo = 0x90; /* overlong */
+      else if (c == 0xf4)
+        hi = 0x8f; /* past U+10FFFF */
+    }
+  else
+    return 0;
+
+  if (len - i < n)
+    return 0;
+
+  if (s[i + 1] < lo || s[i + 1] > hi)
+    return 0;
+
+  for (k = 2; k < n; k++)
+    if ((s[i + k] & 0xc0) != 0x80)
+      return 0;
+
+  return n;
+}
+
+/* Checks characters from @s[@i] up to @stop, which is at most @len, one at
+ * a time. Returns where it got to, which is before @stop only if there is an
+ * invalid character there; the last character may end past @stop. */
+static inline gsize
+validate_chars (const guchar *s,
+    gsize len,
+    gsize i,
+    gsize stop)
+{
+  while (i < stop)
+    {
+      gsize n;
+
+      /* 0x01 to 0x7f */
+      if (s[i] - 1u < 0x7f)
+        {
+          i++;
+          continue;
+        }
+
+      n = char_length (s, len, i);
+
+      if (n == 0)
+        break;
+
+      i += n;
+    }
+
+  return i;
+}
+
+/* Returns the length of the valid prefix of @s, starting from @i, which
+ * must be at the start of a character. */
+static gsize
+validate_scalar_from (const guchar *s,
+    gsize len,
+    gsize i)
+{
+  while (i < len)
+    {
+      gsize stop;
+
+      while (i + 8 <= len && word_is_ascii (s + i))
+        i += 8;
+
+      stop = MIN (i + 8, len);
+      i = validate_chars (s, len, i, stop);
+
+      if (i < stop)
+        break;
+    }
+
+  return i;
+}
+
+static gsize
+validate_scalar (const guchar *s,
+    gsize len)
+{
+  return validate_scalar_from (s, len, 0);
+}
+
+/* The vectorised validators check a block at a time, so they leave off at a
+ * block boundary, which may be in the middle of a character. This returns
+ * the start of the character which @i is in, given that the characters
+ * before it are valid. */
+static inline gsize
+char_start (const guchar *s,
+    gsize i)
+{
+  gsize j = i;
+
+  while (j > 0 && i - j < 3 && (s[j - 1] & 0xc0) == 0x80)
+    j--;
+
+  if (j > 0 && s[j - 1] >= 0xc0)
+    j--;
+
+  return j;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* SSE2 can't classify more than ASCII in parallel, but can skip over it
+ * sixteen bytes at a time. */
+__attribute__ ((target ("sse2")))
+static gsize
+validate_sse2 (const guchar *s,
+    gsize len)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gsize i = 0;
+
+  while (i + 16 <= len)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (s + i));
+      guint mask = _mm_movemask_epi8 (v) |
+          _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero));
+      gsize stop = i + 16;
+
+      if (mask == 0)
+        {
+          i = stop;
+          continue;
+        }
+
+      /* skip the ASCII before the first byte which isn't */
+      i = validate_chars (s, len, i + __builtin_ctz (mask), stop);
+
+      if (i < stop)
+        return i;
+    }
+
+  return validate_scalar_from (s, len, i);
+}
+
+/* The error bits of the lookup algorithm: each is set in all three tables
+ * for the byte pairs which make that error. */
+#define TOO_SHORT  (1 << 0) /* a lead byte not followed by a continuation */
+#define TOO_LONG   (1 << 1) /* ASCII followed by a continuation */
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE  (1 << 3)
+#define SURROGATE  (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS  (1 << 7) /* a continuation not belonging to a lead byte */
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+/* @input's bytes, shifted later by @n with the end of @prev moving in */
+#define AVX2_PREV(input, prev, n) \
+  _mm256_alignr_epi8 (input, \
+      _mm256_permute2x128_si256 (prev, input, 0x21), 16 - (n))
+
+#define AVX2_TABLE(...) _mm256_setr_epi8 (__VA_ARGS__, __VA_ARGS__)
+
+__attribute__ ((target ("avx2")))
+static inline __m256i
+avx2_shr4 (__m256i v)
+{
+  return _mm256_and_si256 (_mm256_srli_epi16 (v, 4), _mm256_set1_epi8 (0x0f));
+}
+
+/* Nonzero where the pair of @prev1 and @input is an error */
+__attribute__ ((target ("avx2")))
+static inline __m256i
+avx2_check_special_cases (__m256i input,
+    __m256i prev1)
+{
+  const __m256i byte_1_high_table = AVX2_TABLE (
+      /* 0_______ ________ */
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+      /* 10______ ________ */
+      TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+      /* 1100____ ________ */
+      TOO_SHORT | OVERLONG_2,
+      /* 1101____ ________ */
+      TOO_SHORT,
+      /* 1110____ ________ */
+      TOO_SHORT | OVERLONG_3 | SURROGATE,
+      /* 1111____ ________ */
+      TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m256i byte_1_low_table = AVX2_TABLE (
+      /* ____0000 ________ */
+      CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+      /* ____0001 ________ */
+      CARRY | OVERLONG_2,
+      /* ____001_ ________ */
+      CARRY,
+      CARRY,
+      /* ____0100 ________ */
+      CARRY | TOO_LARGE,
+      /* ____0101 ________ */
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      /* ____011_ ________ */
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      /* ____1___ ________ */
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      /* ____1101 ________ */
+      CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+      CARRY | TOO_LARGE | TOO_LARGE_1000,
+      CARRY | TOO_LARGE | TOO_LARGE_1000);
+  const __m256i byte_2_high_table = AVX2_TABLE (
+      /* ________ 0_______ */
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      /* ________ 1000____ */
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+          OVERLONG_4,
+      /* ________ 1001____ */
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+      /* ________ 101_____ */
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      /* ________ 11______ */
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+  __m256i byte_1_high = _mm256_shuffle_epi8 (byte_1_high_table,
+      avx2_shr4 (prev1));
+  __m256i byte_1_low = _mm256_shuffle_epi8 (byte_1_low_table,
+      _mm256_and_si256 (prev1, _mm256_set1_epi8 (0x0f)));
+  __m256i byte_2_high = _mm256_shuffle_epi8 (byte_2_high_table,
+      avx2_shr4 (input));
+
+  return _mm256_and_si256 (_mm256_and_si256 (byte_1_high, byte_1_low),
+      byte_2_high);
+}
+
+/* Nonzero where @input has an error, given that @prev came before it */
+__attribute__ ((target ("avx2")))
+static inline __m256i
+avx2_check_block (__m256i input,
+    __m256i prev)
+{
+  __m256i special = avx2_check_special_cases (input,
+      AVX2_PREV (input, prev, 1));
+  /* the third and fourth bytes of three- and four-byte characters must be
+   * continuations, which the pairs above can't tell */
+  __m256i is_third = _mm256_subs_epu8 (AVX2_PREV (input, prev, 2),
+      _mm256_set1_epi8 (0xe0 - 0x80));
+  __m256i is_fourth = _mm256_subs_epu8 (AVX2_PREV (input, prev, 3),
+      _mm256_set1_epi8 (0xf0 - 0x80));
+  __m256i must_be_cont = _mm256_and_si256 (
+      _mm256_or_si256 (is_third, is_fourth), _mm256_set1_epi8 ((gchar) 0x80));
+
+  return _mm256_xor_si256 (must_be_cont, special);
+}
+
+__attribute__ ((target ("avx2")))
+static gsize
+validate_avx2 (const guchar *s,
+    gsize len)
+{
+  /* nonzero if the last three bytes begin a character they don't finish */
+  const __m256i max_complete = _mm256_setr_epi8 (
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      (gchar) (0xf0 - 1), (gchar) (0xe0 - 1), (gchar) (0xc0 - 1));
+  const __m256i zero = _mm256_setzero_si256 ();
+  __m256i prev = zero;
+  __m256i prev_incomplete = zero;
+  gsize i = 0;
+
+  while (i + 32 <= len)
+    {
+      __m256i input = _mm256_loadu_si256 ((const __m256i *) (s + i));
+      __m256i error = _mm256_cmpeq_epi8 (input, zero);
+
+      if (_mm256_movemask_epi8 (input) == 0)
+        {
+          error = _mm256_or_si256 (error, prev_incomplete);
+          prev_incomplete = zero;
+        }
+      else
+        {
+          error = _mm256_or_si256 (error, avx2_check_block (input, prev));
+          prev_incomplete = _mm256_subs_epu8 (input, max_complete);
+        }
+
+      /* start again from the last character known to be good to find
+       * exactly where the error is */
+      if (!_mm256_testz_si256 (error, error))
+        return validate_scalar_from (s, len, char_start (s, i));
+
+      prev = input;
+      i += 32;
+    }
+
+  return validate_scalar_from (s, len, char_start (s, i));
+}
+
+#endif /* HAVE_X86_SIMD */
+
+#ifdef HAVE_NEON
+
+/* Like the SSE2 version, NEON skips over ASCII sixteen bytes at a time. */
+static gsize
+validate_neon (const guchar *s,
+    gsize len)
+{
+  gsize i = 0;
+
+  while (i + 16 <= len)
+    {
+      uint8x16_t v = vld1q_u8 (s + i);
+      gsize stop = i + 16;
+
+      if (vmaxvq_u8 (v) < 0x80 && vminvq_u8 (v) != 0)
+        {
+          i = stop;
+          continue;
+        }
+
+      i = validate_chars (s, len, i, stop);
+
+      if (i < stop)
+        return i;
+    }
+
+  return validate_scalar_from (s, len, i);
+}
+
+#endif /* HAVE_NEON */
+
+static const gchar * const impl_names[WOCKY_UTF8_N_IMPLS] =
+    { "scalar", "sse2", "avx2", "neon" };
+
+static const ValidateFunc impl_funcs[WOCKY_UTF8_N_IMPLS] = {
+    validate_scalar,
+#ifdef HAVE_X86_SIMD
+    validate_sse2,
+    validate_avx2,
+#else
+    NULL,
+    NULL,
+#endif
+#ifdef HAVE_NEON
+    validate_neon,
+#else
+    NULL,
+#endif
+};
+
+gboolean
+_wocky_utf8_impl_is_supported (WockyUtf8Impl impl)
+{
+  g_return_val_if_fail (impl < WOCKY_UTF8_N_IMPLS, FALSE);
+
+  switch (impl)
+    {
+#ifdef HAVE_X86_SIMD
+      case WOCKY_UTF8_IMPL_SSE2:
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("sse2") != 0;
+
+      case WOCKY_UTF8_IMPL_AVX2:
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("avx2") != 0;
+#endif
+
+      default:
+        return impl_funcs[impl] != NULL;
+    }
+}
+
+const gchar *
+_wocky_utf8_impl_get_name (WockyUtf8Impl impl)
+{
+  g_return_val_if_fail (impl < WOCKY_UTF8_N_IMPLS, NULL);
+
+  return impl_names[impl];
+}
+
+/* Returns the length of the valid prefix of @str. */
+gsize
+_wocky_utf8_validate_with (WockyUtf8Impl impl,
+    const gchar *str,
+    gsize len)
+{
+  g_return_val_if_fail (_wocky_utf8_impl_is_supported (impl), 0);
+
+  return impl_funcs[impl] ((const guchar *) str, len);
+}
+
+static ValidateFunc
+get_validator (void)
+{
+  static gsize best = 0;
+
+  if (g_once_init_enter (&best))
+    {
+      static const WockyUtf8Impl preferred[] = { WOCKY_UTF8_IMPL_AVX2,
+          WOCKY_UTF8_IMPL_NEON, WOCKY_UTF8_IMPL_SSE2 };
+      WockyUtf8Impl impl = WOCKY_UTF8_IMPL_SCALAR;
+      guint i;
+
+      for (i = 0; i < G_N_ELEMENTS (preferred); i++)
+        {
+          if (_wocky_utf8_impl_is_supported (preferred[i]))
+            {
+              impl = preferred[i];
+              break;
+            }
+        }
+
+      /* stored plus one, as g_once_init_leave() needs it to be nonzero */
+      g_once_init_leave (&best, impl + 1);
+    }
+
+  return impl_funcs[best - 1];
+}
+
+/**
+ * _wocky_utf8_validate:
+ * @str: a string
+ * @len: the length of @str in bytes, or -1 if it is nul-terminated
+ * @end: (out) (allow-none): where to store the end of the valid data
+ *
+ * Equivalent to g_utf8_validate(), but faster.
+ *
+ * Returns: %TRUE if @str is valid UTF-8.
+ */
+gboolean
+_wocky_utf8_validate (const gchar *str,
+    gssize len,
+    const gchar **end)
+{
+  gsize n, valid;
+
+  n = (len < 0) ? strlen (str) : (gsize) len;
+  valid = get_validator () ((const guchar *) str, n);
+
+  if (end != NULL)
+    *end = str + valid;
+
+  return valid == n;
+}
+
+/**
+ * _wocky_utf8_make_valid:
+ * @str: a string
+ * @len: the length of @str in bytes, or -1 if it is nul-terminated
+ *
+ * Copies @str, replacing anything that isn't valid UTF-8 by U+FFFD
+ * REPLACEMENT CHARACTER. Each invalid byte is replaced, together with any
+ * continuation bytes following it.
+ *
+ * Returns: a newly allocated, nul-terminated, valid copy of @str
+ */
+gchar *
+_wocky_utf8_make_valid (const gchar *str,
+    gssize len)
+{
+  ValidateFunc validate = get_validator ();
+  const guchar *p = (const guchar *) str;
+  gsize left = (len < 0) ? strlen (str) : (gsize) len;
+  GString *result = g_string_sized_new (left + 1);
+
+  while (left > 0)
+    {
+      gsize valid = validate (p, left);
+
+      g_string_append_len (result, (const gchar *) p, valid);
+
+      if (valid == left)
+        break;
+
+      /* U+FFFD REPLACEMENT CHARACTER */
+      g_string_append (result, "\357\277\275");
+
+      p += valid + 1;
+      left -= valid + 1;
+
+      while (left > 0 && (*p & 0xc0) == 0x80)
+        {
+          p++;
+          left--;
+        }
+    }
+
+  return g_string_free (result, FALSE);
+}
@@ -67,9 +67,37 @@ wocky_xep_0115_capabilities_has_feature (
   WockyXep0115CapabilitiesInterface *iface =
     WOCKY_XEP_0115_CAPABILITIES_GET_INTERFACE (contact);
   WockyXep0115CapabilitiesHasFeatureFunc method = iface->has_feature;
+  WockyCapsSet *caps;
 
   if (method != NULL)
     return method (contact, feature);
 
+  /* Contacts sharing a set don't need to answer this themselves */
+  caps = wocky_xep_0115_capabilities_get_caps_set (contact);
+
+  if (caps != NULL)
+    return wocky_caps_set_has_feature (caps, feature);
+
   return FALSE;
 }
+
+/**
+ * wocky_xep_0115_capabilities_get_caps_set:
+ * @contact: a contact
+ *
+ * Returns: (transfer none): the shared set of capabilities @contact
+ *  advertises, or %NULL if it isn't known or @contact doesn't keep one
+ */
+WockyCapsSet *
+wocky_xep_0115_capabilities_get_caps_set (
+    WockyXep0115Capabilities *contact)
+{
+  WockyXep0115CapabilitiesInterface *iface =
+    WOCKY_XEP_0115_CAPABILITIES_GET_INTERFACE (contact);
+  WockyXep0115CapabilitiesGetCapsSetFunc method = iface->get_caps_set;
+
+  if (method != NULL)
+    return method (contact);
+
+  return NULL;
+}
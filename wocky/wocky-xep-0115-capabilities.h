@@ -27,6 +27,8 @@
 
 #include <glib-object.h>
 
+#include "wocky-caps-set.h"
+
 G_BEGIN_DECLS
 
 #define WOCKY_TYPE_XEP_0115_CAPABILITIES \
@@ -56,6 +58,9 @@ typedef gboolean (*WockyXep0115CapabilitiesHasFeatureFunc) (
     WockyXep0115Capabilities *contact,
     const gchar *feature);
 
+typedef WockyCapsSet * (*WockyXep0115CapabilitiesGetCapsSetFunc) (
+    WockyXep0115Capabilities *contact);
+
 const GPtrArray * wocky_xep_0115_capabilities_get_data_forms (
     WockyXep0115Capabilities *contact);
 
@@ -63,12 +68,18 @@ gboolean wocky_xep_0115_capabilities_has_feature (
     WockyXep0115Capabilities *contact,
     const gchar *feature);
 
+WockyCapsSet * wocky_xep_0115_capabilities_get_caps_set (
+    WockyXep0115Capabilities *contact);
+
 struct _WockyXep0115CapabilitiesInterface {
     GTypeInterface parent;
 
     /* TODO: capability enumeration and identities! */
     WockyXep0115CapabilitiesGetDataFormsFunc get_data_forms;
     WockyXep0115CapabilitiesHasFeatureFunc has_feature;
+
+    /* if has_feature is NULL, features are looked up in this set */
+    WockyXep0115CapabilitiesGetCapsSetFunc get_caps_set;
 };
 
 GType wocky_xep_0115_capabilities_get_type (void);
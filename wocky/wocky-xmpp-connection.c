@@ -87,6 +87,10 @@ struct _WockyXmppConnectionPrivate
   const guint8 *output_buffer;
   gsize offset;
   gsize length;
+  /* holds output_buffer, if it is being written from a GBytes */
+  GBytes *output_bytes;
+  /* where split stanzas are put back together to be written */
+  GByteArray *split_buffer;
 
   GTask *force_close_task;
 };
@@ -212,6 +216,7 @@ wocky_xmpp_connection_dispose (GObject *object)
   g_clear_object (&(priv->writer));
   g_clear_object (&(priv->output_task));
   g_clear_object (&(priv->output_cancellable));
+  g_clear_pointer (&(priv->output_bytes), g_bytes_unref);
   g_clear_object (&(priv->input_task));
   g_clear_object (&(priv->input_cancellable));
 
@@ -224,6 +229,11 @@ wocky_xmpp_connection_dispose (GObject *object)
 void
 wocky_xmpp_connection_finalize (GObject *object)
 {
+  WockyXmppConnection *self = WOCKY_XMPP_CONNECTION (object);
+
+  if (self->priv->split_buffer != NULL)
+    g_byte_array_unref (self->priv->split_buffer);
+
   G_OBJECT_CLASS (wocky_xmpp_connection_parent_class)->finalize (object);
 }
 
@@ -291,6 +301,7 @@ finished:
 
     priv->output_cancellable = NULL;
     priv->output_task = NULL;
+    g_clear_pointer (&priv->output_bytes, g_bytes_unref);
 
     if (error == NULL)
       g_task_return_boolean (t, TRUE);
@@ -702,16 +713,189 @@ wocky_xmpp_connection_send_stanza_async (WockyXmppConnection *connection,
   if (cancellable != NULL)
     priv->output_cancellable = g_object_ref (cancellable);
   priv->offset = 0;
-  priv->length = 0;
-
-  wocky_xmpp_writer_write_stanza (priv->writer, stanza, &priv->output_buffer,
-      &priv->length);
+  priv->output_bytes = wocky_xmpp_writer_write_stanza_bytes (priv->writer,
+      stanza);
+  priv->output_buffer = g_bytes_get_data (priv->output_bytes, &priv->length);
 
   wocky_xmpp_connection_do_write (connection);
 
   return;
 }
 
+/**
+ * wocky_xmpp_connection_send_bytes_async:
+ * @connection: a #WockyXmppConnection
+ * @bytes: a serialized stanza, such as from
+ *  wocky_xmpp_writer_write_stanza_bytes()
+ * @cancellable: optional GCancellable object, NULL to ignore.
+ * @callback: callback to call when the request is satisfied.
+ * @user_data: the data to pass to callback function.
+ *
+ * Request asynchronous sending of an already serialized stanza. @bytes is
+ * written out directly, and only referenced while it is, so the same
+ * serialized stanza may be sent on several connections or sent again later.
+ * When the operation is finished @callback will be called. You can then call
+ * wocky_xmpp_connection_send_stanza_finish() to get the result of the
+ * operation.
+ *
+ * Can only be called after wocky_xmpp_connection_send_open_async has finished
+ * its operation.
+ */
+void
+wocky_xmpp_connection_send_bytes_async (WockyXmppConnection *connection,
+    GBytes *bytes,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockyXmppConnectionPrivate *priv =
+      connection->priv;
+
+  g_return_if_fail (g_bytes_get_size (bytes) > 0);
+
+  if (G_UNLIKELY (priv->output_task != NULL))
+    {
+      g_task_report_new_error (G_OBJECT (connection), callback, user_data,
+          wocky_xmpp_connection_send_bytes_async, G_IO_ERROR,
+          G_IO_ERROR_PENDING, "Another send operation is pending");
+      return;
+    }
+
+  if (G_UNLIKELY (!priv->output_open))
+    {
+      g_task_report_new_error (G_OBJECT (connection), callback, user_data,
+          wocky_xmpp_connection_send_bytes_async,
+          WOCKY_XMPP_CONNECTION_ERROR, WOCKY_XMPP_CONNECTION_ERROR_NOT_OPEN,
+          "Connections hasn't been opened for sending");
+      return;
+    }
+
+  if (G_UNLIKELY (priv->output_closed))
+    {
+      g_task_report_new_error (G_OBJECT (connection), callback, user_data,
+          wocky_xmpp_connection_send_bytes_async,
+          WOCKY_XMPP_CONNECTION_ERROR, WOCKY_XMPP_CONNECTION_ERROR_IS_CLOSED,
+          "Connections has been closed for sending");
+      return;
+    }
+
+  g_assert (priv->output_cancellable == NULL);
+
+  priv->output_task = g_task_new (G_OBJECT (connection), cancellable,
+      callback, user_data);
+
+  if (cancellable != NULL)
+    priv->output_cancellable = g_object_ref (cancellable);
+
+  priv->offset = 0;
+  priv->output_bytes = g_bytes_ref (bytes);
+  priv->output_buffer = g_bytes_get_data (bytes, &priv->length);
+
+  wocky_xmpp_connection_do_write (connection);
+}
+
+/**
+ * wocky_xmpp_connection_send_split_stanza_async:
+ * @connection: a #WockyXmppConnection
+ * @head: the start of a stanza, from wocky_xmpp_writer_write_stanza_split()
+ * @to: the stanza's recipient, or %NULL to send it with no "to" attribute
+ * @tail: the rest of the stanza
+ * @cancellable: optional GCancellable object, NULL to ignore.
+ * @callback: callback to call when the request is satisfied.
+ * @user_data: the data to pass to callback function.
+ *
+ * Request asynchronous sending of a stanza which has already been
+ * serialized with wocky_xmpp_writer_write_stanza_split(), addressed to @to.
+ * The same @head and @tail may be sent on any number of connections, to
+ * different recipients, for the cost of serializing the stanza once. When
+ * the operation is finished @callback will be called. You can then call
+ * wocky_xmpp_connection_send_stanza_finish() to get the result of the
+ * operation.
+ *
+ * Can only be called after wocky_xmpp_connection_send_open_async has finished
+ * its operation.
+ */
+void
+wocky_xmpp_connection_send_split_stanza_async (
+    WockyXmppConnection *connection,
+    GBytes *head,
+    const gchar *to,
+    GBytes *tail,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  WockyXmppConnectionPrivate *priv =
+      connection->priv;
+  gconstpointer data;
+  gsize size;
+
+  if (G_UNLIKELY (priv->output_task != NULL))
+    {
+      g_task_report_new_error (G_OBJECT (connection), callback, user_data,
+          wocky_xmpp_connection_send_split_stanza_async, G_IO_ERROR,
+          G_IO_ERROR_PENDING, "Another send operation is pending");
+      return;
+    }
+
+  if (G_UNLIKELY (!priv->output_open))
+    {
+      g_task_report_new_error (G_OBJECT (connection), callback, user_data,
+          wocky_xmpp_connection_send_split_stanza_async,
+          WOCKY_XMPP_CONNECTION_ERROR, WOCKY_XMPP_CONNECTION_ERROR_NOT_OPEN,
+          "Connections hasn't been opened for sending");
+      return;
+    }
+
+  if (G_UNLIKELY (priv->output_closed))
+    {
+      g_task_report_new_error (G_OBJECT (connection), callback, user_data,
+          wocky_xmpp_connection_send_split_stanza_async,
+          WOCKY_XMPP_CONNECTION_ERROR, WOCKY_XMPP_CONNECTION_ERROR_IS_CLOSED,
+          "Connections has been closed for sending");
+      return;
+    }
+
+  g_assert (priv->output_task == NULL);
+  g_assert (priv->output_cancellable == NULL);
+
+  priv->output_task = g_task_new (G_OBJECT (connection), cancellable,
+      callback, user_data);
+
+  if (cancellable != NULL)
+    priv->output_cancellable = g_object_ref (cancellable);
+
+  /* Copying the serialized stanza is much cheaper than serializing it
+   * again, and lets it go out in one write */
+  if (priv->split_buffer == NULL)
+    priv->split_buffer = g_byte_array_new ();
+
+  g_byte_array_set_size (priv->split_buffer, 0);
+
+  data = g_bytes_get_data (head, &size);
+  g_byte_array_append (priv->split_buffer, data, size);
+
+  if (to != NULL)
+    {
+      gchar *escaped = g_markup_escape_text (to, -1);
+
+      g_byte_array_append (priv->split_buffer, (const guint8 *) " to=\"", 5);
+      g_byte_array_append (priv->split_buffer, (const guint8 *) escaped,
+          strlen (escaped));
+      g_byte_array_append (priv->split_buffer, (const guint8 *) "\"", 1);
+      g_free (escaped);
+    }
+
+  data = g_bytes_get_data (tail, &size);
+  g_byte_array_append (priv->split_buffer, data, size);
+
+  priv->output_buffer = priv->split_buffer->data;
+  priv->length = priv->split_buffer->len;
+  priv->offset = 0;
+
+  wocky_xmpp_connection_do_write (connection);
+}
+
 /**
  * wocky_xmpp_connection_send_stanza_finish:
  * @connection: a #WockyXmppConnection.
@@ -1091,6 +1275,103 @@ wocky_xmpp_connection_new_id (WockyXmppConnection *self)
   return g_uuid_string_random ();
 }
 
+/**
+ * wocky_xmpp_connection_add_streaming_handler:
+ * @connection: a #WockyXmppConnection
+ * @type: the type of stanza to stream
+ * @name: the name of a child of the stanzas' top nodes
+ * @ns: the namespace of that child
+ * @func: a function to call with each child of that child
+ * @user_data: data to pass to @func
+ * @destroy: called on @user_data when the handler is removed, or %NULL
+ *
+ * Streams the items of stanzas received on @connection to @func as they
+ * are read; see wocky_xmpp_reader_add_streaming_handler().
+ *
+ * Returns: an id for wocky_xmpp_connection_remove_streaming_handler()
+ */
+guint
+wocky_xmpp_connection_add_streaming_handler (WockyXmppConnection *connection,
+    WockyStanzaType type,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderStreamingFunc func,
+    gpointer user_data,
+    GDestroyNotify destroy)
+{
+  g_return_val_if_fail (WOCKY_IS_XMPP_CONNECTION (connection), 0);
+
+  return wocky_xmpp_reader_add_streaming_handler (connection->priv->reader,
+      type, name, ns, func, user_data, destroy);
+}
+
+/**
+ * wocky_xmpp_connection_remove_streaming_handler:
+ * @connection: a #WockyXmppConnection
+ * @id: the id of a handler added by
+ *  wocky_xmpp_connection_add_streaming_handler()
+ *
+ * Stops streaming items to a handler.
+ */
+void
+wocky_xmpp_connection_remove_streaming_handler (
+    WockyXmppConnection *connection,
+    guint id)
+{
+  g_return_if_fail (WOCKY_IS_XMPP_CONNECTION (connection));
+
+  /* the reader's handlers went with it */
+  if (connection->priv->reader == NULL)
+    return;
+
+  wocky_xmpp_reader_remove_streaming_handler (connection->priv->reader, id);
+}
+
+/**
+ * wocky_xmpp_connection_add_filter:
+ * @connection: a #WockyXmppConnection
+ * @name: the name of the elements to filter, or %NULL to filter every
+ *  element in @ns
+ * @ns: the namespace of the elements to filter
+ * @action: what to do with matching elements
+ *
+ * Skips the contents of matching elements in stanzas received on
+ * @connection; see wocky_xmpp_reader_add_filter().
+ *
+ * Returns: an id for wocky_xmpp_connection_remove_filter()
+ */
+guint
+wocky_xmpp_connection_add_filter (WockyXmppConnection *connection,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderFilterAction action)
+{
+  g_return_val_if_fail (WOCKY_IS_XMPP_CONNECTION (connection), 0);
+
+  return wocky_xmpp_reader_add_filter (connection->priv->reader, name, ns,
+      action);
+}
+
+/**
+ * wocky_xmpp_connection_remove_filter:
+ * @connection: a #WockyXmppConnection
+ * @id: the id of a filter added by wocky_xmpp_connection_add_filter()
+ *
+ * Stops filtering elements matching a filter.
+ */
+void
+wocky_xmpp_connection_remove_filter (WockyXmppConnection *connection,
+    guint id)
+{
+  g_return_if_fail (WOCKY_IS_XMPP_CONNECTION (connection));
+
+  /* the reader's filters went with it */
+  if (connection->priv->reader == NULL)
+    return;
+
+  wocky_xmpp_reader_remove_filter (connection->priv->reader, id);
+}
+
 static void
 stream_close_cb (GObject *source,
     GAsyncResult *res,
@@ -27,6 +27,7 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 #include "wocky-stanza.h"
+#include "wocky-xmpp-reader.h"
 
 G_BEGIN_DECLS
 
@@ -141,6 +142,21 @@ void wocky_xmpp_connection_send_stanza_async (WockyXmppConnection *connection,
     GAsyncReadyCallback callback,
     gpointer user_data);
 
+void wocky_xmpp_connection_send_bytes_async (WockyXmppConnection *connection,
+    GBytes *bytes,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
+void wocky_xmpp_connection_send_split_stanza_async (
+    WockyXmppConnection *connection,
+    GBytes *head,
+    const gchar *to,
+    GBytes *tail,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
 gboolean wocky_xmpp_connection_send_stanza_finish (
     WockyXmppConnection *connection,
     GAsyncResult *result,
@@ -190,6 +206,25 @@ void wocky_xmpp_connection_reset (WockyXmppConnection *connection);
 
 gchar * wocky_xmpp_connection_new_id (WockyXmppConnection *self);
 
+guint wocky_xmpp_connection_add_streaming_handler (
+    WockyXmppConnection *connection,
+    WockyStanzaType type,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderStreamingFunc func,
+    gpointer user_data,
+    GDestroyNotify destroy);
+void wocky_xmpp_connection_remove_streaming_handler (
+    WockyXmppConnection *connection,
+    guint id);
+
+guint wocky_xmpp_connection_add_filter (WockyXmppConnection *connection,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderFilterAction action);
+void wocky_xmpp_connection_remove_filter (WockyXmppConnection *connection,
+    guint id);
+
 G_END_DECLS
 
 #endif /* #ifndef __WOCKY_XMPP_CONNECTION_H__*/
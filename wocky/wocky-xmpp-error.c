@@ -269,7 +269,11 @@ wocky_xmpp_error_description (WockyXmppError error)
     return NULL;
 }
 
+/* Domains are only ever prepended, under error_domains_lock, and the new
+ * head is published atomically once its link is complete; so the list can
+ * be walked from any thread without taking the lock. */
 static GList *error_domains = NULL;
+G_LOCK_DEFINE_STATIC (error_domains_lock);
 
 /**
  * wocky_xmpp_error_register_domain
@@ -278,12 +282,18 @@ static GList *error_domains = NULL;
  * Registers a new set of application-specific stanza errors. This allows
  * GErrors in that domain to be passed to wocky_stanza_error_to_node(), and to
  * be recognized and returned by wocky_xmpp_error_extract() (and
- * wocky_stanza_extract_errors(), by extension).
+ * wocky_stanza_extract_errors(), by extension). This may be called from any
+ * thread.
  */
 void
 wocky_xmpp_error_register_domain (WockyXmppErrorDomain *domain)
 {
-  error_domains = g_list_prepend (error_domains, domain);
+  GList *head;
+
+  G_LOCK (error_domains_lock);
+  head = g_list_prepend (g_atomic_pointer_get (&error_domains), domain);
+  g_atomic_pointer_set (&error_domains, head);
+  G_UNLOCK (error_domains_lock);
 }
 
 static WockyXmppErrorDomain *
@@ -291,7 +301,7 @@ xmpp_error_find_domain (GQuark domain)
 {
   GList *l;
 
-  for (l = error_domains; l != NULL; l = l->next)
+  for (l = g_atomic_pointer_get (&error_domains); l != NULL; l = l->next)
     {
       WockyXmppErrorDomain *d = l->data;
 
@@ -355,12 +365,12 @@ xmpp_error_from_node_for_ns (
     GType enum_type,
     gint *code)
 {
-  GSList *l;
+  WockyNodeIter iter;
+  WockyNode *child;
 
-  for (l = node->children; l != NULL; l = l->next)
+  wocky_node_iter_init (&iter, node, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &child))
     {
-      WockyNode *child = l->data;
-
       if (wocky_node_has_ns_q (child, ns) &&
           wocky_enum_from_nick (enum_type, child->name, code))
         return TRUE;
@@ -445,7 +455,8 @@ wocky_xmpp_error_extract (WockyNode *error,
   gboolean have_specialized = FALSE;
   WockyNode *specialized_node_tmp = NULL;
   const gchar *message = NULL;
-  GSList *l;
+  WockyNodeIter iter;
+  WockyNode *child;
 
   g_return_if_fail (!wocky_strdiff (error->name, "error"));
 
@@ -474,10 +485,9 @@ wocky_xmpp_error_extract (WockyNode *error,
         }
     }
 
-  for (l = error->children; l != NULL; l = g_slist_next (l))
+  wocky_node_iter_init (&iter, error, NULL, NULL);
+  while (wocky_node_iter_next (&iter, &child))
     {
-      WockyNode *child = l->data;
-
       if (child->ns == WOCKY_XMPP_ERROR)
         {
           if (!wocky_strdiff (child->name, "text"))
@@ -44,6 +44,9 @@
 #include "wocky-namespaces.h"
 
 #include "wocky-stanza.h"
+#include "wocky-stanza-internal.h"
+#include "wocky-intern-internal.h"
+#include "wocky-node-private.h"
 
 #define WOCKY_DEBUG_FLAG WOCKY_DEBUG_XMPP_READER
 #include "wocky-debug-internal.h"
@@ -126,8 +129,50 @@ struct _WockyXmppReaderPrivate
   gchar *default_namespace;
   GQueue *stanzas;
   WockyXmppReaderState state;
+
+  /* StreamingHandler, in the order they were added */
+  GSList *streaming_handlers;
+  guint last_streaming_handler;
+  /* the id of the handler for the element being read at depth 1 in the
+   * current stanza, or 0 */
+  guint streaming;
+
+  /* Filter, in the order they were added */
+  GSList *filters;
+  guint last_filter;
+  /* while the content of a filtered element is being skipped, the depth
+   * within it (1 being the placeholder node itself); otherwise 0 */
+  guint skipping;
 };
 
+typedef struct {
+  guint id;
+  WockyStanzaType type;
+  /* interned */
+  const gchar *name;
+  GQuark ns;
+  WockyXmppReaderStreamingFunc func;
+  gpointer user_data;
+  GDestroyNotify destroy;
+} StreamingHandler;
+
+static void
+streaming_handler_free (StreamingHandler *handler)
+{
+  if (handler->destroy != NULL)
+    handler->destroy (handler->user_data);
+
+  g_slice_free (StreamingHandler, handler);
+}
+
+typedef struct {
+  guint id;
+  /* interned, or NULL to match any element in ns */
+  const gchar *name;
+  GQuark ns;
+  WockyXmppReaderFilterAction action;
+} Filter;
+
 G_DEFINE_TYPE_WITH_CODE (WockyXmppReader, wocky_xmpp_reader, G_TYPE_OBJECT,
           G_ADD_PRIVATE (WockyXmppReader))
 
@@ -169,6 +214,8 @@ wocky_xmpp_reader_clear_parser_state (WockyXmppReader *self)
   g_queue_clear (priv->nodes);
   priv->node = NULL;
   priv->depth = 0;
+  priv->streaming = 0;
+  priv->skipping = 0;
 
   g_free (priv->to);
   priv->to = NULL;
@@ -313,6 +360,13 @@ wocky_xmpp_reader_dispose (GObject *object)
   /* release any references held by the object here */
   wocky_xmpp_reader_clear_parser_state (self);
 
+  g_slist_free_full (priv->streaming_handlers,
+      (GDestroyNotify) streaming_handler_free);
+  priv->streaming_handlers = NULL;
+
+  g_slist_free_full (priv->filters, g_free);
+  priv->filters = NULL;
+
   if (G_OBJECT_CLASS (wocky_xmpp_reader_parent_class)->dispose)
     G_OBJECT_CLASS (wocky_xmpp_reader_parent_class)->dispose (object);
 }
@@ -534,6 +588,112 @@ handle_stream_open (
   priv->depth++;
 }
 
+/* Returns the id of the first handler for priv->node, a child of
+ * priv->stanza's top node, or 0 */
+static guint
+find_streaming_handler (WockyXmppReader *self)
+{
+  WockyXmppReaderPrivate *priv = self->priv;
+  WockyStanzaType type;
+  GSList *l;
+
+  _wocky_stanza_classify_node (wocky_stanza_get_top_node (priv->stanza),
+      &type, NULL);
+
+  for (l = priv->streaming_handlers; l != NULL; l = l->next)
+    {
+      StreamingHandler *handler = l->data;
+
+      /* node names are usually interned, and so need no strcmp() */
+      if (handler->type == type &&
+          _wocky_intern_equal (handler->name, priv->node->name) &&
+          handler->ns == priv->node->ns)
+        return handler->id;
+    }
+
+  return 0;
+}
+
+static StreamingHandler *
+get_streaming_handler (WockyXmppReader *self,
+    guint id)
+{
+  GSList *l;
+
+  for (l = self->priv->streaming_handlers; l != NULL; l = l->next)
+    {
+      StreamingHandler *handler = l->data;
+
+      if (handler->id == id)
+        return handler;
+    }
+
+  return NULL;
+}
+
+/* priv->node, a child of the top node, has just started. Returns the id of
+ * the handler which will be given its children, or 0. */
+static guint
+start_streaming (WockyXmppReader *self)
+{
+  WockyXmppReaderPrivate *priv = self->priv;
+  guint id = find_streaming_handler (self);
+  StreamingHandler *handler;
+
+  if (id == 0)
+    return 0;
+
+  /* the handler vets the stanza once, rather than every item */
+  handler = get_streaming_handler (self, id);
+
+  if (!handler->func (priv->stanza, NULL, handler->user_data))
+    return 0;
+
+  return id;
+}
+
+/* priv->node, a grandchild of the top node, has just been read */
+static void
+stream_item (WockyXmppReader *self)
+{
+  WockyXmppReaderPrivate *priv = self->priv;
+  WockyNode *item = priv->node;
+  WockyNode *parent = g_queue_peek_tail (priv->nodes);
+  StreamingHandler *handler = get_streaming_handler (self, priv->streaming);
+
+  /* the handler may have been removed since the stanza started */
+  if (handler == NULL)
+    {
+      priv->streaming = 0;
+      return;
+    }
+
+  /* the handler may remove itself, so mustn't be used after this */
+  if (handler->func (priv->stanza, item, handler->user_data))
+    _wocky_node_remove_last_child (parent);
+}
+
+/* Returns the first filter matching priv->node, or NULL */
+static Filter *
+find_filter (WockyXmppReader *self)
+{
+  WockyXmppReaderPrivate *priv = self->priv;
+  GSList *l;
+
+  for (l = priv->filters; l != NULL; l = l->next)
+    {
+      Filter *filter = l->data;
+
+      /* node names are usually interned, and so need no strcmp() */
+      if (filter->ns == priv->node->ns &&
+          (filter->name == NULL ||
+           _wocky_intern_equal (filter->name, priv->node->name)))
+        return filter;
+    }
+
+  return NULL;
+}
+
 static void
 handle_regular_element (
     WockyXmppReader *self,
@@ -567,6 +727,26 @@ handle_regular_element (
       g_queue_push_tail (priv->nodes, priv->node);
       priv->node = wocky_node_add_child_ns (priv->node,
         localname, uri);
+
+      /* a child of the top node, whose children may be streamed */
+      if (priv->streaming_handlers != NULL &&
+          g_queue_get_length (priv->nodes) == 1)
+        priv->streaming = start_streaming (self);
+
+      if (priv->filters != NULL)
+        {
+          Filter *filter = find_filter (self);
+
+          /* leave priv->node as a placeholder, and ignore everything up to
+           * its end tag */
+          if (filter != NULL)
+            {
+              priv->skipping = 1;
+
+              if (filter->action == WOCKY_XMPP_READER_FILTER_SKIP)
+                nb_attributes = 0;
+            }
+        }
     }
 
   for (i = 0; i < nb_attributes * 5; i+=5)
@@ -588,11 +768,12 @@ handle_regular_element (
         }
       else
         {
-          /* preserve the prefix, if any was received */
+          /* preserve the prefix, if any was received and the namespace
+           * doesn't have one yet */
           if (attr_prefix != NULL)
             {
-              GQuark ns = g_quark_from_string (attr_uri);
-              wocky_node_attribute_ns_set_prefix (ns, attr_prefix);
+              GQuark ns = _wocky_intern_quark (attr_uri);
+              _wocky_node_attribute_ns_add_prefix (ns, attr_prefix);
             }
 
           wocky_node_set_attribute_n_ns (priv->node, attr_name,
@@ -613,6 +794,14 @@ _start_element_ns (void *user_data, const xmlChar *localname,
   WockyXmppReaderPrivate *priv = self->priv;
   gchar *uri = NULL;
 
+  /* inside a filtered element */
+  if (priv->skipping > 0)
+    {
+      priv->skipping++;
+      priv->depth++;
+      return;
+    }
+
   if (ns_uri != NULL)
     uri = g_strstrip (g_strdup ((const gchar *) ns_uri));
 
@@ -632,7 +821,7 @@ _characters (void *user_data, const xmlChar *ch, int len)
   WockyXmppReader *self = WOCKY_XMPP_READER (user_data);
   WockyXmppReaderPrivate *priv = self->priv;
 
-  if (priv->node != NULL)
+  if (priv->node != NULL && priv->skipping == 0)
     {
       wocky_node_append_content_n (priv->node, (const gchar *)ch,
           (gsize)len);
@@ -648,6 +837,16 @@ _end_element_ns (void *user_data, const xmlChar *localname,
 
   priv->depth--;
 
+  /* the placeholder for a filtered element ends like any other element,
+   * once everything inside it has been skipped */
+  if (priv->skipping > 0)
+    {
+      priv->skipping--;
+
+      if (priv->skipping > 0)
+        return;
+    }
+
   if (priv->stream_mode && priv->depth == 0)
     {
       DEBUG ("Stream ended");
@@ -657,12 +856,21 @@ _end_element_ns (void *user_data, const xmlChar *localname,
     {
       g_assert (g_queue_get_length (priv->nodes) == 0);
       DEBUG_STANZA (priv->stanza, "Received stanza");
+      _wocky_stanza_classify (priv->stanza);
       g_queue_push_tail (priv->stanzas, priv->stanza);
       priv->stanza = NULL;
       priv->node = NULL;
     }
   else
     {
+      guint ancestors = g_queue_get_length (priv->nodes);
+
+      /* priv->node is a child of the top node, or one of its children */
+      if (ancestors == 1)
+        priv->streaming = 0;
+      else if (ancestors == 2 && priv->streaming != 0)
+        stream_item (self);
+
       priv->node = (WockyNode *) g_queue_pop_tail (priv->nodes);
     }
 }
@@ -813,6 +1021,173 @@ wocky_xmpp_reader_get_error (WockyXmppReader *reader)
   return priv->error == NULL ? NULL : g_error_copy (priv->error);
 }
 
+/**
+ * wocky_xmpp_reader_add_streaming_handler:
+ * @reader: a #WockyXmppReader
+ * @type: the type of stanza to stream
+ * @name: the name of a child of the stanzas' top nodes
+ * @ns: the namespace of that child
+ * @func: a function to call with each child of that child
+ * @user_data: data to pass to @func
+ * @destroy: called on @user_data when the handler is removed, or %NULL
+ *
+ * Asks @reader to pass each child of stanzas' &lt;@name xmlns='@ns'/&gt;
+ * elements to @func as soon as it has been read. Anything @func deals with
+ * is freed straight away, rather than being kept until the whole stanza
+ * has been read, so a long list of items needs no more memory at once
+ * than the longest one. For example, adding a handler for
+ * %WOCKY_STANZA_TYPE_IQ and &lt;query xmlns='jabber:iq:roster'/&gt; streams
+ * the &lt;item/&gt;s of a roster.
+ *
+ * @func is called with a %NULL item when each such element starts, and may
+ * turn down the whole stanza then; see #WockyXmppReaderStreamingFunc.
+ *
+ * The stanzas are still returned by wocky_xmpp_reader_pop_stanza(), without
+ * the items which were dealt with. Only the first handler added for an
+ * element is used; it stays in effect across wocky_xmpp_reader_reset().
+ *
+ * Returns: an id for wocky_xmpp_reader_remove_streaming_handler()
+ */
+guint
+wocky_xmpp_reader_add_streaming_handler (WockyXmppReader *reader,
+    WockyStanzaType type,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderStreamingFunc func,
+    gpointer user_data,
+    GDestroyNotify destroy)
+{
+  WockyXmppReaderPrivate *priv;
+  StreamingHandler *handler;
+
+  g_return_val_if_fail (WOCKY_IS_XMPP_READER (reader), 0);
+  g_return_val_if_fail (name != NULL, 0);
+  g_return_val_if_fail (ns != NULL, 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  priv = reader->priv;
+
+  handler = g_slice_new0 (StreamingHandler);
+  handler->id = ++priv->last_streaming_handler;
+  handler->type = type;
+  handler->name = _wocky_intern_permanent (name);
+  handler->ns = g_quark_from_string (ns);
+  handler->func = func;
+  handler->user_data = user_data;
+  handler->destroy = destroy;
+
+  priv->streaming_handlers = g_slist_append (priv->streaming_handlers,
+      handler);
+
+  return handler->id;
+}
+
+/**
+ * wocky_xmpp_reader_remove_streaming_handler:
+ * @reader: a #WockyXmppReader
+ * @id: the id of a handler added by
+ *  wocky_xmpp_reader_add_streaming_handler()
+ *
+ * Stops streaming items to a handler. It may be called from the handler
+ * itself.
+ */
+void
+wocky_xmpp_reader_remove_streaming_handler (WockyXmppReader *reader,
+    guint id)
+{
+  WockyXmppReaderPrivate *priv;
+  StreamingHandler *handler;
+
+  g_return_if_fail (WOCKY_IS_XMPP_READER (reader));
+
+  priv = reader->priv;
+  handler = get_streaming_handler (reader, id);
+  g_return_if_fail (handler != NULL);
+
+  priv->streaming_handlers = g_slist_remove (priv->streaming_handlers,
+      handler);
+  streaming_handler_free (handler);
+}
+
+/**
+ * wocky_xmpp_reader_add_filter:
+ * @reader: a #WockyXmppReader
+ * @name: the name of the elements to filter, or %NULL to filter every
+ *  element in @ns
+ * @ns: the namespace of the elements to filter
+ * @action: what to do with matching elements
+ *
+ * Asks @reader not to build the contents of elements below stanzas' top
+ * nodes which match @name and @ns, such as XHTML-IM bodies or other
+ * payloads which are never looked at. A matching element is left in the
+ * stanza as a placeholder node, with the same name and namespace, and with
+ * or without its attributes according to @action; everything inside it is
+ * skipped as it is parsed.
+ *
+ * The first filter added which matches an element is used. Filters stay
+ * in effect across wocky_xmpp_reader_reset().
+ *
+ * Returns: an id for wocky_xmpp_reader_remove_filter()
+ */
+guint
+wocky_xmpp_reader_add_filter (WockyXmppReader *reader,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderFilterAction action)
+{
+  WockyXmppReaderPrivate *priv;
+  Filter *filter;
+
+  g_return_val_if_fail (WOCKY_IS_XMPP_READER (reader), 0);
+  g_return_val_if_fail (ns != NULL, 0);
+
+  priv = reader->priv;
+
+  filter = g_new0 (Filter, 1);
+  filter->id = ++priv->last_filter;
+  filter->name = (name == NULL) ? NULL : _wocky_intern_permanent (name);
+  filter->ns = g_quark_from_string (ns);
+  filter->action = action;
+
+  priv->filters = g_slist_append (priv->filters, filter);
+
+  return filter->id;
+}
+
+/**
+ * wocky_xmpp_reader_remove_filter:
+ * @reader: a #WockyXmppReader
+ * @id: the id of a filter added by wocky_xmpp_reader_add_filter()
+ *
+ * Stops filtering elements matching a filter. Elements which are already
+ * being skipped are skipped to their end.
+ */
+void
+wocky_xmpp_reader_remove_filter (WockyXmppReader *reader,
+    guint id)
+{
+  WockyXmppReaderPrivate *priv;
+  GSList *l;
+
+  g_return_if_fail (WOCKY_IS_XMPP_READER (reader));
+
+  priv = reader->priv;
+
+  for (l = priv->filters; l != NULL; l = l->next)
+    {
+      Filter *filter = l->data;
+
+      if (filter->id == id)
+        {
+          priv->filters = g_slist_delete_link (priv->filters, l);
+          g_free (filter);
+          return;
+        }
+    }
+
+  g_return_if_reached ();
+}
+
 /**
  * wocky_xmpp_reader_reset:
  * @reader: a #WockyXmppReader
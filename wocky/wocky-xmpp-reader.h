@@ -131,6 +131,62 @@ WockyStanza *wocky_xmpp_reader_peek_stanza (WockyXmppReader *reader);
 GError *wocky_xmpp_reader_get_error (WockyXmppReader *reader);
 void wocky_xmpp_reader_reset (WockyXmppReader *reader);
 
+/**
+ * WockyXmppReaderStreamingFunc:
+ * @stanza: the stanza being read. So far it has its top node's attributes,
+ *  and those of the top node's children which have been read and not
+ *  streamed
+ * @item: a grandchild of @stanza's top node, which has just been read, or
+ *  %NULL when the child of the top node whose children would be streamed
+ *  has just started
+ * @user_data: the data passed to wocky_xmpp_reader_add_streaming_handler()
+ *
+ * Handles one item of a stanza as soon as it has been read, rather than
+ * after the whole stanza has been. The function is first called with @item
+ * set to %NULL, once per stanza, so that it can decide from the top node's
+ * attributes (its sender, say) whether to stream that stanza at all.
+ *
+ * Returns: %TRUE if @item has been dealt with, in which case the reader
+ *  frees it and leaves it out of @stanza; %FALSE to leave it in @stanza.
+ *  If @item is %NULL, %TRUE to have the stanza's items streamed, or %FALSE
+ *  to leave them all in @stanza.
+ */
+typedef gboolean (*WockyXmppReaderStreamingFunc) (WockyStanza *stanza,
+    WockyNode *item,
+    gpointer user_data);
+
+guint wocky_xmpp_reader_add_streaming_handler (WockyXmppReader *reader,
+    WockyStanzaType type,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderStreamingFunc func,
+    gpointer user_data,
+    GDestroyNotify destroy);
+void wocky_xmpp_reader_remove_streaming_handler (WockyXmppReader *reader,
+    guint id);
+
+/**
+ * WockyXmppReaderFilterAction:
+ * @WOCKY_XMPP_READER_FILTER_SKIP: keep only the element's name and
+ *  namespace; its attributes, content and children are not read
+ * @WOCKY_XMPP_READER_FILTER_TRUNCATE: keep the element's name, namespace and
+ *  attributes; its content and children are not read
+ *
+ * What a #WockyXmppReader does with elements matching a filter added with
+ * wocky_xmpp_reader_add_filter().
+ */
+typedef enum {
+  WOCKY_XMPP_READER_FILTER_SKIP,
+  WOCKY_XMPP_READER_FILTER_TRUNCATE,
+} WockyXmppReaderFilterAction;
+
+guint wocky_xmpp_reader_add_filter (WockyXmppReader *reader,
+    const gchar *name,
+    const gchar *ns,
+    WockyXmppReaderFilterAction action);
+void wocky_xmpp_reader_remove_filter (WockyXmppReader *reader,
+    guint id);
+
 G_END_DECLS
 
 #endif /* #ifndef __WOCKY_XMPP_READER_H__*/
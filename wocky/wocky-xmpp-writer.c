@@ -25,7 +25,9 @@
  *
  * The #WockyXmppWriter serializes #WockyStanza<!-- -->s and XMPP stream opening
  * and closing to raw XML. The various functions provide a pointer to an
- * internal buffer, which remains valid until the next call to the writer.
+ * internal buffer, which remains valid until the next call to the writer,
+ * except for wocky_xmpp_writer_write_stanza_bytes() and friends which hand
+ * the buffer over as a #GBytes that may be kept for as long as needed.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -43,6 +45,20 @@
 #define WOCKY_DEBUG_FLAG WOCKY_DEBUG_XMPP_WRITER
 #include "wocky-debug-internal.h"
 
+/* Buffers which have been handed out as GBytes go back into a pool when
+ * they are released, so that a writer can usually pick up one which is
+ * already big enough instead of allocating and growing a new one. A
+ * GByteArray never shrinks, so a buffer which has ever held more than
+ * OUTPUT_POOL_MAX_LENGTH bytes is freed rather than kept, even if its
+ * last contents were small. */
+#define OUTPUT_POOL_SIZE 16
+#define OUTPUT_POOL_MAX_LENGTH 65536
+#define OUTPUT_INITIAL_SIZE 1024
+
+G_LOCK_DEFINE_STATIC (output_pool);
+static GByteArray *output_pool[OUTPUT_POOL_SIZE];
+static guint output_pool_len = 0;
+
 /* properties */
 enum {
   PROP_STREAMING_MODE = 1,
@@ -56,12 +72,143 @@ struct _WockyXmppWriterPrivate
   GQuark current_ns;
   GQuark stream_ns;
   gboolean stream_mode;
-  xmlBufferPtr buffer;
+  /* where xmlwriter's output goes; NULL once handed out, until the next
+   * write */
+  GByteArray *output;
+  /* the most output has held since it was taken from the pool, which
+   * bounds how much memory it has allocated */
+  gsize output_peak;
+  /* for escaping the stream opening's attributes, lazily created */
+  xmlBufferPtr escape_buffer;
+
+  /* while wocky_xmpp_writer_write_stanza_split() is at work, the top node
+   * whose "to" attribute is left out, and the offset in output at which it
+   * would go */
+  WockyNode *split_node;
+  gsize split_offset;
 };
 
 G_DEFINE_TYPE_WITH_CODE (WockyXmppWriter, wocky_xmpp_writer, G_TYPE_OBJECT,
           G_ADD_PRIVATE (WockyXmppWriter))
 
+static GByteArray *
+_output_pool_take (void)
+{
+  GByteArray *output = NULL;
+
+  G_LOCK (output_pool);
+
+  if (output_pool_len > 0)
+    output = output_pool[--output_pool_len];
+
+  G_UNLOCK (output_pool);
+
+  if (output == NULL)
+    output = g_byte_array_sized_new (OUTPUT_INITIAL_SIZE);
+
+  return output;
+}
+
+/* Only for buffers which have never held more than OUTPUT_POOL_MAX_LENGTH
+ * bytes */
+static void
+_output_pool_release (gpointer data)
+{
+  GByteArray *output = data;
+
+  G_LOCK (output_pool);
+
+  if (output_pool_len < OUTPUT_POOL_SIZE)
+    {
+      g_byte_array_set_size (output, 0);
+      output_pool[output_pool_len++] = output;
+      output = NULL;
+    }
+
+  G_UNLOCK (output_pool);
+
+  if (output != NULL)
+    g_byte_array_unref (output);
+}
+
+static int
+_output_write (void *context,
+    const char *buffer,
+    int len)
+{
+  WockyXmppWriterPrivate *priv = context;
+
+  /* libxml2 flushes (possibly nothing) when the text writer is freed, which
+   * can be after output has been handed out */
+  if (priv->output == NULL)
+    {
+      priv->output = _output_pool_take ();
+      priv->output_peak = 0;
+    }
+
+  g_byte_array_append (priv->output, (const guint8 *) buffer, len);
+  return len;
+}
+
+static void
+_output_update_peak (WockyXmppWriterPrivate *priv)
+{
+  priv->output_peak = MAX (priv->output_peak, priv->output->len);
+}
+
+/* Gets an empty output buffer ready for the next write */
+static void
+_output_reset (WockyXmppWriterPrivate *priv)
+{
+  if (priv->output == NULL)
+    {
+      priv->output = _output_pool_take ();
+      priv->output_peak = 0;
+    }
+  else
+    {
+      _output_update_peak (priv);
+      g_byte_array_set_size (priv->output, 0);
+    }
+}
+
+/* Hands the output buffer over to the caller; it goes back into the pool
+ * when they are done with it, if it is small enough */
+static GBytes *
+_output_steal (WockyXmppWriterPrivate *priv)
+{
+  GByteArray *output = priv->output;
+  GDestroyNotify free_func = _output_pool_release;
+
+  _output_update_peak (priv);
+
+  if (priv->output_peak > OUTPUT_POOL_MAX_LENGTH)
+    free_func = (GDestroyNotify) g_byte_array_unref;
+
+  priv->output = NULL;
+
+  return g_bytes_new_with_free_func (output->data, output->len,
+      free_func, output);
+}
+
+/* Gives up the output buffer, returning it to the pool if it is small
+ * enough */
+static void
+_output_drop (WockyXmppWriterPrivate *priv)
+{
+  if (priv->output == NULL)
+    return;
+
+  _output_update_peak (priv);
+
+  if (priv->output_peak > OUTPUT_POOL_MAX_LENGTH)
+    g_byte_array_unref (priv->output);
+  else
+    _output_pool_release (priv->output);
+
+  priv->output = NULL;
+}
+
 static void
 wocky_xmpp_writer_init (WockyXmppWriter *self)
 {
@@ -72,8 +219,8 @@ wocky_xmpp_writer_init (WockyXmppWriter *self)
 
   priv->current_ns = 0;
   priv->stream_ns = 0;
-  priv->buffer = xmlBufferCreate ();
-  priv->xmlwriter = xmlNewTextWriterMemory (priv->buffer, 0);
+  priv->xmlwriter = xmlNewTextWriter (xmlOutputBufferCreateIO (_output_write,
+      NULL, priv, NULL));
   priv->stream_mode = TRUE;
   /* xmlTextWriterSetIndent (priv->xmlwriter, 1); */
 }
@@ -134,7 +281,11 @@ wocky_xmpp_writer_finalize (GObject *object)
 
   /* free any data held directly by the object here */
   xmlFreeTextWriter (priv->xmlwriter);
-  xmlBufferFree (priv->buffer);
+
+  _output_drop (priv);
+
+  if (priv->escape_buffer != NULL)
+    xmlBufferFree (priv->escape_buffer);
 
   G_OBJECT_CLASS (wocky_xmpp_writer_parent_class)->finalize (object);
 }
@@ -206,6 +357,24 @@ wocky_xmpp_writer_new_no_stream (void)
   return g_object_new (WOCKY_TYPE_XMPP_WRITER, "streaming-mode", FALSE, NULL);
 }
 
+/* Writes @value out escaped as an attribute value */
+static void
+_write_escaped (WockyXmppWriterPrivate *priv,
+    const gchar *value)
+{
+  if (priv->escape_buffer == NULL)
+    priv->escape_buffer = xmlBufferCreate ();
+  else
+    xmlBufferEmpty (priv->escape_buffer);
+
+  xmlAttrSerializeTxtContent (priv->escape_buffer, NULL, NULL,
+      (const xmlChar *) value);
+
+  xmlTextWriterFlush (priv->xmlwriter);
+  g_byte_array_append (priv->output, xmlBufferContent (priv->escape_buffer),
+      xmlBufferLength (priv->escape_buffer));
+}
+
 /**
  * wocky_xmpp_writer_stream_open:
  * @writer: a WockyXmppWriter
@@ -237,7 +406,7 @@ wocky_xmpp_writer_stream_open (WockyXmppWriter *writer,
 
   g_assert (priv->stream_mode);
 
-  xmlBufferEmpty (priv->buffer);
+  _output_reset (priv);
   xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)
       "<?xml version='1.0' encoding='UTF-8'?>\n"            \
       "<stream:stream"                                      \
@@ -247,50 +416,43 @@ wocky_xmpp_writer_stream_open (WockyXmppWriter *writer,
   if (to != NULL)
     {
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)" to=\"");
-      xmlTextWriterFlush (priv->xmlwriter);
-      xmlAttrSerializeTxtContent (priv->buffer, NULL, NULL, (xmlChar *) to);
+      _write_escaped (priv, to);
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)"\"");
     }
 
   if (from != NULL)
     {
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)" from=\"");
-      xmlTextWriterFlush (priv->xmlwriter);
-      xmlAttrSerializeTxtContent (priv->buffer, NULL, NULL, (xmlChar *) from);
+      _write_escaped (priv, from);
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)"\"");
     }
 
   if (version != NULL)
     {
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)" version=\"");
-      xmlTextWriterFlush (priv->xmlwriter);
-      xmlAttrSerializeTxtContent (priv->buffer, NULL,
-        NULL, (xmlChar *) version);
+      _write_escaped (priv, version);
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)"\"");
     }
 
   if (lang != NULL)
     {
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)" xml:lang=\"");
-      xmlTextWriterFlush (priv->xmlwriter);
-      xmlAttrSerializeTxtContent (priv->buffer, NULL,
-        NULL, (xmlChar *) lang);
+      _write_escaped (priv, lang);
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)"\"");
     }
 
   if (id != NULL)
     {
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)" id=\"");
-      xmlTextWriterFlush (priv->xmlwriter);
-      xmlAttrSerializeTxtContent (priv->buffer, NULL, NULL, (xmlChar *) id);
+      _write_escaped (priv, id);
       xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *)"\"");
     }
 
   xmlTextWriterWriteString (priv->xmlwriter, (xmlChar *) ">\n");
   xmlTextWriterFlush (priv->xmlwriter);
 
-  *data = (const guint8 *)priv->buffer->content;
-  *length  = priv->buffer->use;
+  *data = priv->output->data;
+  *length  = priv->output->len;
 
   /* Set the magic known namespaces */
   priv->current_ns = g_quark_from_string ("jabber:client");
@@ -364,6 +526,17 @@ _write_attr (const gchar *key, const gchar *value,
   return TRUE;
 }
 
+static gboolean
+_write_attr_except_to (const gchar *key, const gchar *value,
+    const gchar *prefix, const gchar *ns,
+    gpointer user_data)
+{
+  if (ns == NULL && !strcmp (key, "to"))
+    return TRUE;
+
+  return _write_attr (key, value, prefix, ns, user_data);
+}
+
 static gboolean
 _write_child (WockyNode *node, gpointer user_data)
 {
@@ -399,7 +572,18 @@ _xml_write_node (WockyXmppWriter *writer, WockyNode *node)
           (const xmlChar *) wocky_node_get_ns (node));
     }
 
-  wocky_node_each_attribute (node, _write_attr, writer);
+  if (G_UNLIKELY (node == priv->split_node))
+    {
+      /* The start tag's name has been written out, but namespace
+       * declarations only come once all the attributes have been */
+      xmlTextWriterFlush (priv->xmlwriter);
+      priv->split_offset = priv->output->len;
+      wocky_node_each_attribute (node, _write_attr_except_to, writer);
+    }
+  else
+    {
+      wocky_node_each_attribute (node, _write_attr, writer);
+    }
 
   l = wocky_node_get_language (node);
 
@@ -430,7 +614,7 @@ _write_node_tree (WockyXmppWriter *writer,
 {
   WockyXmppWriterPrivate *priv = writer->priv;
 
-  xmlBufferEmpty (priv->buffer);
+  _output_reset (priv);
 
   DEBUG_NODE_TREE (tree, "Serializing tree:");
 
@@ -447,8 +631,8 @@ _write_node_tree (WockyXmppWriter *writer,
     }
   xmlTextWriterFlush (priv->xmlwriter);
 
-  *data = (const guint8 *)priv->buffer->content;
-  *length  = priv->buffer->use;
+  *data = priv->output->data;
+  *length  = priv->output->len;
 
 #ifdef ENABLE_DEBUG
   wocky_debug (WOCKY_DEBUG_NET, "Writing xml: %.*s", (int)*length, *data);
@@ -474,6 +658,69 @@ wocky_xmpp_writer_write_stanza (WockyXmppWriter *writer,
   _write_node_tree (writer, WOCKY_NODE_TREE (stanza), data, length);
 }
 
+/**
+ * wocky_xmpp_writer_write_stanza_split:
+ * @writer: a WockyXmppWriter
+ * @stanza: the stanza to serialize
+ * @head: location to store the serialization up to the end of the name of
+ *  @stanza's top element
+ * @tail: location to store the rest of the serialization
+ *
+ * Serialize the @stanza to XML, as wocky_xmpp_writer_write_stanza() does but
+ * leaving out its "to" attribute, if any. A "to" attribute can then be put
+ * between @head and @tail to address the same serialized stanza to any
+ * number of recipients, without serializing it again for each of them; see
+ * wocky_xmpp_connection_send_split_stanza_async().
+ *
+ * Unlike wocky_xmpp_writer_write_stanza(), the result does not depend on
+ * the writer's buffer, which may be used again straight away.
+ */
+void
+wocky_xmpp_writer_write_stanza_split (WockyXmppWriter *writer,
+    WockyStanza *stanza,
+    GBytes **head,
+    GBytes **tail)
+{
+  WockyXmppWriterPrivate *priv = writer->priv;
+  const guint8 *data;
+  gsize length;
+  GBytes *bytes;
+
+  priv->split_node = wocky_stanza_get_top_node (stanza);
+  _write_node_tree (writer, WOCKY_NODE_TREE (stanza), &data, &length);
+  priv->split_node = NULL;
+
+  bytes = _output_steal (priv);
+  *head = g_bytes_new_from_bytes (bytes, 0, priv->split_offset);
+  *tail = g_bytes_new_from_bytes (bytes, priv->split_offset,
+      length - priv->split_offset);
+  g_bytes_unref (bytes);
+}
+
+/**
+ * wocky_xmpp_writer_write_stanza_bytes:
+ * @writer: a WockyXmppWriter
+ * @stanza: the stanza to serialize
+ *
+ * Serialize the @stanza to XML, as wocky_xmpp_writer_write_stanza() does.
+ * The writer's buffer is handed over rather than copied, and a recycled one
+ * is used for the next call, so the result stays valid for as long as it is
+ * referenced: it may be queued, resent or shared between connections.
+ *
+ * Returns: (transfer full): the serialized @stanza
+ */
+GBytes *
+wocky_xmpp_writer_write_stanza_bytes (WockyXmppWriter *writer,
+    WockyStanza *stanza)
+{
+  const guint8 *data;
+  gsize length;
+
+  _write_node_tree (writer, WOCKY_NODE_TREE (stanza), &data, &length);
+
+  return _output_steal (writer->priv);
+}
+
 /**
  * wocky_xmpp_writer_write_node_tree:
  * @writer: a WockyXmppWriter
@@ -499,6 +746,31 @@ wocky_xmpp_writer_write_node_tree (WockyXmppWriter *writer,
   _write_node_tree (writer, tree, data, length);
 }
 
+/**
+ * wocky_xmpp_writer_write_node_tree_bytes:
+ * @writer: a WockyXmppWriter
+ * @tree: the node tree to serialize
+ *
+ * Serialize the @tree to XML, as wocky_xmpp_writer_write_node_tree() does,
+ * handing the result over as wocky_xmpp_writer_write_stanza_bytes() does.
+ * This function may only be called in non-streaming mode.
+ *
+ * Returns: (transfer full): the serialized @tree
+ */
+GBytes *
+wocky_xmpp_writer_write_node_tree_bytes (WockyXmppWriter *writer,
+    WockyNodeTree *tree)
+{
+  const guint8 *data;
+  gsize length;
+
+  g_return_val_if_fail (!writer->priv->stream_mode, NULL);
+
+  _write_node_tree (writer, tree, &data, &length);
+
+  return _output_steal (writer->priv);
+}
+
 /**
  * wocky_xmpp_writer_flush:
  * @writer: a WockyXmppWriter
@@ -508,8 +780,5 @@ wocky_xmpp_writer_write_node_tree (WockyXmppWriter *writer,
 void
 wocky_xmpp_writer_flush (WockyXmppWriter *writer)
 {
-  WockyXmppWriterPrivate *priv = writer->priv;
-
-  xmlBufferFree (priv->buffer);
-  priv->buffer = xmlBufferCreate ();
+  _output_drop (writer->priv);
 }
@@ -94,11 +94,22 @@ void wocky_xmpp_writer_write_stanza (WockyXmppWriter *writer,
     const guint8 **data,
     gsize *length);
 
+GBytes *wocky_xmpp_writer_write_stanza_bytes (WockyXmppWriter *writer,
+    WockyStanza *stanza);
+
+void wocky_xmpp_writer_write_stanza_split (WockyXmppWriter *writer,
+    WockyStanza *stanza,
+    GBytes **head,
+    GBytes **tail);
+
 void wocky_xmpp_writer_write_node_tree (WockyXmppWriter *writer,
     WockyNodeTree *tree,
     const guint8 **data,
     gsize *length);
 
+GBytes *wocky_xmpp_writer_write_node_tree_bytes (WockyXmppWriter *writer,
+    WockyNodeTree *tree);
+
 void wocky_xmpp_writer_flush (WockyXmppWriter *writer);
 
 G_END_DECLS
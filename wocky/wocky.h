@@ -29,10 +29,16 @@
 #include "wocky-bare-contact.h"
 #include "wocky-c2s-porter.h"
 #include "wocky-caps-cache.h"
+#include "wocky-caps-cache-backend.h"
+#include "wocky-caps-cache-mmap.h"
+#include "wocky-caps-cache-sqlite.h"
 #include "wocky-caps-hash.h"
+#include "wocky-caps-resolver.h"
+#include "wocky-caps-set.h"
 #include "wocky-connector.h"
 #include "wocky-contact-factory.h"
 #include "wocky-contact.h"
+#include "wocky-credential-store.h"
 #include "wocky-data-form.h"
 #include "wocky-debug.h"
 #include "wocky-disco-identity.h"
@@ -59,6 +65,7 @@
 #include "wocky-namespaces.h"
 #include "wocky-node.h"
 #include "wocky-node-tree.h"
+#include "wocky-node-query.h"
 #include "wocky-pep-service.h"
 #include "wocky-ping.h"
 #include "wocky-porter.h"
@@ -71,11 +78,14 @@
 #include "wocky-roster.h"
 #include "wocky-sasl-auth.h"
 #include "wocky-sasl-digest-md5.h"
+#include "wocky-sasl-ht.h"
 #include "wocky-sasl-plain.h"
 #include "wocky-sasl-scram.h"
+#include "wocky-sasl-scram-cache.h"
 #include "wocky-sasl-utils.h"
 #include "wocky-session.h"
 #include "wocky-stanza.h"
+#include "wocky-stanza-template.h"
 #include "wocky-tls-connector.h"
 #include "wocky-tls.h"
 #include "wocky-tls-handler.h"